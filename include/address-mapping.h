@@ -24,7 +24,11 @@
  * SOFTWARE.
  */
 
-#include <tuple>
+#include <algorithm>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
 #include <vector>
 
 #include "defines.h"
@@ -36,10 +40,35 @@ namespace Charly {
 
 /*
  * Keeps track of which addresses belong to which files
+ *
+ * Ranges are kept sorted by their start address, so lookups are a binary search. They are
+ * done for every stack trace entry and whenever an exception is thrown
+ *
+ * The mapping is shared by all isolates, lookups only take a shared lock
  * */
 class AddressMapping {
 private:
-  std::vector<std::tuple<uint8_t*, uint8_t*, std::string>> mappings;
+  struct AddressRange {
+    uint8_t* begin;
+    uint8_t* end;
+    std::string path;
+    InstructionBlock* block;
+  };
+
+  std::vector<AddressRange> mappings;
+  mutable std::shared_mutex mutex;
+
+  // Return the range containing an address
+  inline const AddressRange* find_range(uint8_t* address) const {
+    auto it = std::upper_bound(this->mappings.begin(), this->mappings.end(), address,
+                               [](uint8_t* address, const AddressRange& range) { return address < range.begin; });
+    if (it == this->mappings.begin()) {
+      return nullptr;
+    }
+    it--;
+
+    return address < it->end ? &*it : nullptr;
+  }
 
 public:
 
@@ -47,18 +76,55 @@ public:
   inline void register_instructionblock(InstructionBlock* block, const std::string& path) {
     uint8_t* begin = block->data;
     uint8_t* end = begin + block->capacity;
-    this->mappings.push_back({begin, end, path});
+    std::unique_lock<std::shared_mutex> lk(this->mutex);
+    auto it = std::upper_bound(this->mappings.begin(), this->mappings.end(), begin,
+                               [](uint8_t* address, const AddressRange& range) { return address < range.begin; });
+    this->mappings.insert(it, {begin, end, path, block});
   }
 
-  // Return the filepath an address belongs to
-  inline std::optional<std::string> resolve_address(uint8_t* address) {
-    for (const auto& a : this->mappings) {
-      if (address >= std::get<0>(a) && address < std::get<1>(a)) {
-        return std::get<2>(a);
+  // Remove an instructionblock which is about to be deallocated
+  inline void unregister_instructionblock(InstructionBlock* block) {
+    std::unique_lock<std::shared_mutex> lk(this->mutex);
+    for (auto it = this->mappings.begin(); it != this->mappings.end(); it++) {
+      if (it->block == block) {
+        this->mappings.erase(it);
+        return;
       }
     }
+  }
+
+  // Return the filepath an address belongs to
+  inline std::optional<std::string> resolve_address(uint8_t* address) const {
+    std::shared_lock<std::shared_mutex> lk(this->mutex);
+    const AddressRange* range = this->find_range(address);
+    if (range == nullptr) {
+      return std::nullopt;
+    }
+
+    return range->path;
+  }
+
+  // Return the instructionblock an address belongs to
+  inline InstructionBlock* resolve_block(uint8_t* address) const {
+    std::shared_lock<std::shared_mutex> lk(this->mutex);
+    const AddressRange* range = this->find_range(address);
+    return range ? range->block : nullptr;
+  }
+
+  // Return the filepath and the source position of the instruction at an address
+  inline std::optional<std::pair<std::string, SourcePosition>> resolve_position(uint8_t* address) const {
+    std::shared_lock<std::shared_mutex> lk(this->mutex);
+    const AddressRange* range = this->find_range(address);
+    if (range == nullptr) {
+      return std::nullopt;
+    }
+
+    auto position = range->block->line_table.find(address - range->begin);
+    if (!position.has_value()) {
+      return std::nullopt;
+    }
 
-    return std::nullopt;
+    return std::make_pair(range->path, position.value());
   }
 };
 }  // namespace Charly
@@ -24,9 +24,12 @@
  * SOFTWARE.
  */
 
+#include <cassert>
 #include <functional>
 #include <list>
+#include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "instructionblock.h"
 #include "opcode.h"
@@ -45,12 +48,21 @@ struct UnresolvedReference {
   uint32_t instruction_base;
 };
 
+// The keys of a switch statement mapped to the labels of the blocks they select
+struct BranchTableLabels {
+  int64_t integer_base = 0;
+  std::vector<Label> integer_labels;
+  std::vector<std::pair<std::string, Label>> string_labels;
+  Label default_label;
+};
+
 // Handles label resolution and compile-time offset calculations
 class Assembler : public InstructionBlock {
 public:
   inline void reset() {
     this->labels.clear();
     this->unresolved_label_references.clear();
+    this->unresolved_branch_tables.clear();
     this->next_label_id = 0;
   }
 
@@ -69,7 +81,7 @@ public:
   void write_branchge_to_label(Label label);
   void write_brancheq_to_label(Label label);
   void write_branchneq_to_label(Label label);
-  void write_registercatchtable_to_label(Label label);
+  void write_loopincrement_to_label(Label label, uint32_t index, uint32_t level, VALUE step, Opcode comparison);
   void write_putfunction_to_label(VALUE symbol,
                                   Label label,
                                   bool anonymous,
@@ -77,16 +89,35 @@ public:
                                   uint32_t argc,
                                   uint32_t lvarcount);
   void write_putgenerator_to_label(VALUE symbol, Label label);
+  void write_branchtable_to_labels(const BranchTableLabels& table_labels);
 
   // Unresolved reference handling
   void resolve_unresolved_label_references();
   inline bool has_unresolved_label_references() {
-    return this->unresolved_label_references.size() != 0;
+    return this->unresolved_label_references.size() != 0 || this->unresolved_branch_tables.size() != 0;
   }
 
+  // Redirects branches which target an unconditional branch to its final destination
+  //
+  // Has to be called after all label references have been resolved
+  void thread_branches();
+
+  // Writes the maximum stack depths of function and generator bodies, keyed by the
+  // offset of their first instruction, into the instructions creating them
+  //
+  // Has to be called once the instruction stream doesn't change anymore
+  void write_stack_depths(const std::unordered_map<uint32_t, uint32_t>& depths);
+
 private:
+  // Offsets into the instruction stream are encoded as 32-bit integers
+  inline uint32_t current_offset() {
+    assert(this->writeoffset <= UINT32_MAX);
+    return static_cast<uint32_t>(this->writeoffset);
+  }
+
   std::unordered_map<Label, uint32_t> labels;
   std::list<UnresolvedReference> unresolved_label_references;
+  std::list<std::pair<uint32_t, BranchTableLabels>> unresolved_branch_tables;
   uint32_t next_label_id = 0;
 };
 }  // namespace Charly::Compilation
@@ -24,6 +24,8 @@
  * SOFTWARE.
  */
 
+#include <algorithm>
+#include <cstddef>
 #include <cstdint>
 #include <functional>
 #include <iostream>
@@ -43,6 +45,65 @@ const std::string kPaddingCharacters = "  ";
 struct AbstractNode;
 typedef std::function<AbstractNode*(AbstractNode*)> VisitFunc;
 
+// Bump allocator for the AST nodes of a single compilation unit
+//
+// While a scope of an arena is active on the current thread, all AST nodes are allocated
+// from it. Deleting such a node runs its destructor but keeps its memory, the memory of
+// all nodes is released at once when the arena is destroyed. Nodes allocated while
+// no arena is active live on the regular heap
+class NodeArena {
+public:
+  // Makes an arena the allocation target of the current thread
+  class Scope {
+  public:
+    Scope(NodeArena& arena) : previous(NodeArena::current) {
+      NodeArena::current = &arena;
+    }
+
+    ~Scope() {
+      NodeArena::current = this->previous;
+    }
+
+  private:
+    NodeArena* previous;
+  };
+
+  NodeArena() = default;
+  NodeArena(const NodeArena&) = delete;
+  NodeArena& operator=(const NodeArena&) = delete;
+
+  ~NodeArena() {
+    for (char* chunk : this->chunks)
+      ::operator delete(chunk);
+  }
+
+  inline void* allocate(size_t size) {
+    size = (size + kAlignment - 1) & ~(kAlignment - 1);
+
+    if (size > this->remaining) {
+      size_t chunk_size = std::max(size, kChunkSize);
+      this->cursor = static_cast<char*>(::operator new(chunk_size));
+      this->remaining = chunk_size;
+      this->chunks.push_back(this->cursor);
+    }
+
+    void* data = this->cursor;
+    this->cursor += size;
+    this->remaining -= size;
+    return data;
+  }
+
+  static constexpr size_t kAlignment = alignof(std::max_align_t);
+  static inline thread_local NodeArena* current = nullptr;
+
+private:
+  static constexpr size_t kChunkSize = 64 * 1024;
+
+  std::vector<char*> chunks;
+  char* cursor = nullptr;
+  size_t remaining = 0;
+};
+
 // Abstract base class of all ASTNodes
 struct AbstractNode {
 public:
@@ -57,6 +118,27 @@ public:
       delete this->offset_info;
   }
 
+  // Nodes are allocated from the active arena of the current thread
+  //
+  // Each allocation is prefixed by the arena it belongs to, or nullptr if it lives on the heap
+  static void* operator new(size_t size) {
+    NodeArena* arena = NodeArena::current;
+    size += NodeArena::kAlignment;
+    void* data = arena ? arena->allocate(size) : ::operator new(size);
+    *static_cast<NodeArena**>(data) = arena;
+    return static_cast<char*>(data) + NodeArena::kAlignment;
+  }
+
+  static void operator delete(void* pointer) {
+    if (pointer == nullptr)
+      return;
+
+    void* data = static_cast<char*>(pointer) - NodeArena::kAlignment;
+    if (*static_cast<NodeArena**>(data) == nullptr) {
+      ::operator delete(data);
+    }
+  }
+
   inline AbstractNode* at(const Token& loc) {
     return this->at(loc.location);
   }
@@ -937,6 +1019,30 @@ struct CallIndex : public AbstractNode {
   }
 };
 
+// The body of a function, inlined at a call site
+//
+// Generated by the inliner, the name is recorded for stack traces
+struct InlinedCall : public AbstractNode {
+  std::string name;
+  AbstractNode* expression;
+
+  InlinedCall(const std::string& n, AbstractNode* e) : name(n), expression(e) {
+  }
+
+  inline ~InlinedCall() {
+    delete expression;
+  }
+
+  inline void dump(std::ostream& stream, size_t depth = 0) {
+    stream << std::string(depth, ' ') << "- InlinedCall: " << this->name << '\n';
+    this->expression->dump(stream, depth + 1);
+  }
+
+  inline void visit(VisitFunc func) {
+    this->expression = func(this->expression);
+  }
+};
+
 // reads a value from the stack
 struct StackValue : public AbstractNode {
   inline void dump(std::ostream& stream, size_t depth = 0) {
@@ -1568,6 +1674,7 @@ const size_t kTypeANDIndexAssignment = typeid(ANDIndexAssignment).hash_code();
 const size_t kTypeCall = typeid(Call).hash_code();
 const size_t kTypeCallMember = typeid(CallMember).hash_code();
 const size_t kTypeCallIndex = typeid(CallIndex).hash_code();
+const size_t kTypeInlinedCall = typeid(InlinedCall).hash_code();
 const size_t kTypeStackValue = typeid(StackValue).hash_code();
 const size_t kTypeIdentifier = typeid(Identifier).hash_code();
 const size_t kTypeSelf = typeid(Self).hash_code();
@@ -1618,6 +1725,54 @@ inline bool is_literal(AbstractNode* node) {
           node->type() == kTypeNumber || node->type() == kTypeBoolean || node->type() == kTypeFunction);
 }
 
+// Checks wether a given node is a literal whose value is known at compile time
+inline bool is_constant(AbstractNode* node) {
+  return (node->type() == kTypeNumber || node->type() == kTypeString || node->type() == kTypeBoolean ||
+          node->type() == kTypeNull || node->type() == kTypeNan);
+}
+
+// Returns the truthyness of a constant literal, mirrors charly_truthyness
+inline bool constant_truthyness(AbstractNode* node) {
+  if (node->type() == kTypeNumber)
+    return node->as<Number>()->value != 0;
+  if (node->type() == kTypeBoolean)
+    return node->as<Boolean>()->value;
+  return node->type() == kTypeString;
+}
+
+// Checks wether a given node can be removed from a block without changing the behaviour of the program
+inline bool is_pure(AbstractNode* node) {
+  if (is_literal(node))
+    return true;
+  if (node->type() == kTypeArray) {
+    for (AbstractNode* child : node->as<Array>()->expressions->children) {
+      if (!is_pure(child))
+        return false;
+    }
+    return true;
+  }
+  if (node->type() == kTypeHash) {
+    for (auto& pair : node->as<Hash>()->pairs) {
+      if (!is_pure(pair.second))
+        return false;
+    }
+    return true;
+  }
+  if (node->type() == kTypeAnd)
+    return is_pure(node->as<And>()->left) && is_pure(node->as<And>()->right);
+  if (node->type() == kTypeOr)
+    return is_pure(node->as<Or>()->left) && is_pure(node->as<Or>()->right);
+  if (node->type() == kTypeTernaryIf) {
+    TernaryIf* ternary = node->as<TernaryIf>();
+    return is_pure(ternary->condition) && is_pure(ternary->then_expression) && is_pure(ternary->else_expression);
+  }
+  if (node->type() == kTypeTypeof)
+    return is_pure(node->as<Typeof>()->expression);
+  if (node->type() == kTypeInlinedCall)
+    return is_pure(node->as<InlinedCall>()->expression);
+  return false;
+}
+
 // Checks wether a given node yields a value
 inline bool yields_value(AbstractNode* node) {
   if (node->type() == kTypeMatch)
@@ -1627,7 +1782,7 @@ inline bool yields_value(AbstractNode* node) {
           node->type() == kTypeAssignment || node->type() == kTypeMemberAssignment ||
           node->type() == kTypeANDMemberAssignment || node->type() == kTypeIndexAssignment ||
           node->type() == kTypeANDIndexAssignment || node->type() == kTypeCall || node->type() == kTypeCallMember ||
-          node->type() == kTypeCallIndex || node->type() == kTypeStackValue || node->type() == kTypeIdentifier ||
+          node->type() == kTypeCallIndex || node->type() == kTypeInlinedCall || node->type() == kTypeStackValue || node->type() == kTypeIdentifier ||
           node->type() == kTypeSelf || node->type() == kTypeMember || node->type() == kTypeYield ||
           node->type() == kTypeIndex || node->type() == kTypeNull || node->type() == kTypeNan ||
           node->type() == kTypeString || node->type() == kTypeNumber || node->type() == kTypeBoolean ||
@@ -25,6 +25,7 @@
  */
 
 #include <queue>
+#include <string>
 #include <vector>
 #include <unordered_map>
 
@@ -32,6 +33,7 @@
 #include <mutex>
 #include <condition_variable>
 
+#include "utf8buffer.h"
 #include "value.h"
 
 #pragma once
@@ -105,18 +107,47 @@ enum AsyncTaskType : uint8_t {
   rl_cursorto,
   rl_movecursor,
 
+  // Passes its first argument back to the callback
+  echo,
+
   Count
 };
 
 struct AsyncTask {
   AsyncTaskType type;
-  std::vector<VALUE> arguments;
+  std::vector<VALUE> arguments{};
   VALUE cb;
+
+  // Copied out of the heap when the task is created, worker threads never read charly values
+  std::vector<std::string> string_arguments{};
+
+  // Operands of file descriptor operations
+  //
+  // The buffer is resolved on the main thread, its value is kept alive via the arguments
+  int fd = -1;
+  size_t size = 0;
+  UTF8Buffer* buffer = nullptr;
+
+  // Set by the worker pool, used to measure how long the task waited for a thread
+  Timestamp submitted_at{};
 };
 
+// Outcome of an AsyncTask
+//
+// Worker threads never allocate charly values, the payload is converted into
+// a value on the main thread right before the callback is invoked. Which of the
+// payload fields are set depends on the type of the task
 struct AsyncTaskResult {
-  VALUE cb;
-  VALUE result;
+  AsyncTask task;
+
+  // errno of the failed operation, 0 on success
+  int error = 0;
+
+  std::string data;
+  std::vector<std::string> entries;
+  bool flag = false;
+  int64_t size = 0;
+  int64_t mtime = 0;
 };
 
 }  // namespace Charly
@@ -44,14 +44,36 @@ static const std::string kHelpMessage =
     "    asm_no_offsets                   Don't display offsets in the disassembly\n"
     "    asm_no_branches                  Don't display branches as arrows in the disassembly\n"
     "    asm_no_func_branches             Don't display branches for PutFunction instructions\n"
+    "    asm_profile                      Display a disassembly annotated with the instruction profile at exit\n"
+    "    asm_profile_output filename      Write the annotations of the profiled disassembly to a JSON file\n"
     "    skipexec                         Don't execute after parsing\n"
-    "    instruction_profile              Display a profile of all executed instructions\n"
+    "    instruction_profile              Display a profile of all executed instructions and instruction pairs\n"
+    "    instruction_profile_order order  Sort the instruction profile by time (default), count or average\n"
+    "    sample_profile                   Sample the call stack and display the hottest functions at exit\n"
+    "    sample_profile_output filename   Write the sampled stacks in collapsed format for flamegraphs\n"
+    "    sample_profile_interval micros   Set the sampling interval, defaults to 1000 microseconds\n"
     "    trace_opcodes                    Display opcodes as they are being executed\n"
-    "    trace_catchtables                Display catchtables as they are being created or left\n"
+    "    trace_catchtables                Display the exception handlers thrown exceptions are caught by\n"
     "    trace_frames                     Display frames as they are being entered and left\n"
     "    trace_gc                         Display statistics about the gc at runtime\n"
+    "    gc_stats                         Display a summary of the gc statistics at exit\n"
+    "    allocation_profile               Display the instructions which allocated the most memory at exit\n"
+    "    allocation_sample_interval n     Only sample every nth allocation for the allocation profile\n"
+    "    metrics_interval millis          Write event loop and worker pool metrics every millis milliseconds\n"
+    "    metrics_output filename          Write the periodic metrics to a file instead of stderr\n"
+    "    max_heap_size mb                 Throw an out of memory exception once the heap exceeds mb megabytes\n"
+    "    task_allocation_budget mb        Throw an out of memory exception once a task allocated mb megabytes\n"
     "    verbose_addresses                Display addresses of printed values, when applicable\n"
+    "    perf_map                         Write symbols for the opcode handlers to /tmp/perf-<pid>.map\n"
+    "    jit                              Compile hot functions to native code (x86-64 only)\n"
+    "    jit_threshold n                  Compile functions after n calls and loop iterations, defaults to 1000\n"
+    "    trace_jit                        Display the functions compiled by the jit\n"
     "    single_worker_thread             Only start a single async worker thread\n"
+    "    worker_threads count             Start at most count async worker threads, defaults to the cpu quota\n"
+    "    no_module_cache                  Don't read or write the compiled module cache\n"
+    "    reload_modules                   Import modified files again instead of reusing their first import\n"
+    "    no_parallel_compile              Don't compile imported files ahead of time on compiler threads\n"
+    "    no_peephole                      Don't rewrite redundant instruction sequences after code generation\n"
     "\n"
     "Examples:\n"
     "\n"
@@ -62,7 +84,10 @@ static const std::string kHelpMessage =
     "    $ charly file.ch -fskipexec -fdump_asm\n"
     "\n"
     "    Dumping generated AST for a file:\n"
-    "    $ charly file.ch -fskipexec -fdump_ast";
+    "    $ charly file.ch -fskipexec -fdump_ast\n"
+    "\n"
+    "    Finding the hottest instructions of a file:\n"
+    "    $ charly file.ch -fasm_profile";
 
 static const std::string kLicense =
     "MIT License \n"
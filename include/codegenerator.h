@@ -79,6 +79,7 @@ private:
   AST::AbstractNode* visit_call(AST::Call* node, VisitContinue cont);
   AST::AbstractNode* visit_callmember(AST::CallMember* node, VisitContinue cont);
   AST::AbstractNode* visit_callindex(AST::CallIndex* node, VisitContinue cont);
+  AST::AbstractNode* visit_inlinedcall(AST::InlinedCall* node, VisitContinue cont);
   AST::AbstractNode* visit_identifier(AST::Identifier* node, VisitContinue cont);
   AST::AbstractNode* visit_self(AST::Self* node, VisitContinue cont);
   AST::AbstractNode* visit_member(AST::Member* node, VisitContinue cont);
@@ -107,13 +108,51 @@ private:
   // Returns false if location is invalid, true if valid
   bool codegen_write(ValueLocation& location, bool keep_on_stack = false);
 
+  // Codegen a single statement of a block, discarding the value it produces
+  void codegen_statement(AST::AbstractNode* node);
+
+  // Attributes the instructions emitted next to the source position of a node
+  void record_source_position(AST::AbstractNode* node);
+
+  // Codegen a call, optionally as a tail call
+  void codegen_call(AST::Call* node, bool tail_call);
+  void codegen_callmember(AST::CallMember* node, bool tail_call);
+
+  // Superinstruction selection
+  //
+  // Returns the location of an identifier if it is stored inside a frame, nullptr otherwise
+  ValueLocation* frame_location_of(AST::AbstractNode* node);
+
+  // Returns the location of an identifier if it refers to a global slot, nullptr otherwise
+  ValueLocation* global_location_of(AST::AbstractNode* node);
+
+  // Codegen the left and right operands of a binary operation
+  void codegen_operands(AST::AbstractNode* left, AST::AbstractNode* right);
+
   void codegen_cmp_arguments(AST::AbstractNode* node);
   void codegen_cmp_branchunless(AST::AbstractNode* node, Label target_label);
 
+  // Counted loop recognition
+  //
+  // Returns the increment statement of a while loop of the form
+  //
+  //   while i < bound {
+  //     ...
+  //     i += step
+  //   }
+  //
+  // where i is a local variable, bound a different local variable, self or a number
+  // literal and step a number literal. Returns nullptr if the loop has a different shape
+  AST::Assignment* counted_loop_increment(AST::While* node);
+  void codegen_counted_loop(AST::While* node, AST::Assignment* increment);
+
   Assembler assembler;
   std::vector<Label> break_stack;
   std::vector<Label> continue_stack;
   std::list<QueuedFunction> queued_functions;
+
+  // Amount of try blocks surrounding the code currently being generated
+  uint32_t try_block_depth = 0;
 };
 
 // clang-format off
@@ -24,15 +24,22 @@
  * SOFTWARE.
  */
 
+#include <condition_variable>
+#include <deque>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "address-mapping.h"
 #include "ast.h"
 #include "compiler.h"
 #include "disassembler.h"
+#include "module-cache.h"
 #include "parser.h"
 #include "runflags.h"
 #include "sourcefile.h"
@@ -41,10 +48,36 @@
 
 namespace Charly::Compilation {
 
+// A module which is compiled ahead of time on a compiler thread
+//
+// Each module is compiled with its own symbol table and string pool, which are
+// merged into the shared ones once the module is actually imported
+struct PrefetchedModule {
+  enum class State : uint8_t { Queued, Running, Finished };
+
+  State state = State::Queued;
+  std::string source;
+  std::optional<InstructionBlock*> instructionblock;
+  SymbolTable symtable;
+  StringPool stringpool;
+};
+
+// A compiled module, shared by every isolate which imports it
+//
+// Blocks are never deallocated while the compiler manager is alive
+struct CompiledModule {
+  size_t source_hash;
+  size_t source_length;
+  InstructionBlock* block;
+};
+
 // Interface to the parser and compiler
 class CompilerManager {
 public:
-  CompilerManager(const RunFlags& f) : flags(f) {
+  CompilerManager(const RunFlags& f)
+      : flags(f),
+        module_cache(f),
+        parallel_compilation(!f.no_parallel_compile && !f.dump_tokens && !f.dump_ast && !f.dump_asm) {
 
     // Pre-register some symbols in the symtable
     this->symtable("+");
@@ -81,7 +114,6 @@ public:
     this->symtable("<cfunction>");
     this->symtable("<generator>");
     this->symtable("<frame>");
-    this->symtable("<catchtable>");
     this->symtable("<cpointer>");
     this->symtable("<number>");
     this->symtable("<boolean>");
@@ -91,14 +123,46 @@ public:
   };
   CompilerManager(const CompilerManager&) = delete;
   CompilerManager(CompilerManager&&) = delete;
+  ~CompilerManager();
 
   std::optional<ParserResult> parse(const std::string& filename, const std::string& source);
+  // Compiling a module again with an unchanged source returns the block of the first compilation
+  //
+  // Safe to call from multiple isolates at once
   std::optional<CompilerResult> compile(const std::string& filename, const std::string& source);
 
+  // Displays a disassembly of each dumped module, annotated with the instruction profile of a VM
+  //
+  // If json is given, the annotations of all dumped modules are also written to it as a JSON array
+  void dump_profiled_modules(const VMInstructionProfile& profile, std::ostream* json = nullptr);
+
 private:
+  // Static imports of compiled modules are compiled ahead of time on compiler threads
+  //
+  // Only import statements with a string literal as their argument are considered.
+  // A prefetched module is used if its path and source match the module being compiled
+  void prefetch_imports(const std::string& filename, const std::vector<std::string>& imports);
+  std::optional<InstructionBlock*> take_prefetched_module(const std::string& filename, const std::string& source);
+  void compile_prefetched_module(const std::string& filename, PrefetchedModule& module);
+  void compiler_thread_handler();
+
   RunFlags flags;
   std::ostream& out_stream = std::cout;
   std::ostream& err_stream = std::cerr;
+  ModuleCache module_cache;
+
+  // Serializes compilations, which append to the shared symbol table and string pool
+  std::mutex compile_mutex;
+  std::unordered_map<std::string, CompiledModule> compiled_blocks;
+
+  bool parallel_compilation;
+  std::mutex prefetch_mutex;
+  std::condition_variable prefetch_cv;
+  std::unordered_map<std::string, std::shared_ptr<PrefetchedModule>> prefetched_modules;
+  std::unordered_set<std::string> compiled_modules;
+  std::deque<std::string> prefetch_queue;
+  std::vector<std::thread> compiler_threads;
+  bool compiler_threads_active = true;
 
 public:
   SymbolTable symtable;
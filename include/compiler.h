@@ -29,6 +29,7 @@
 
 #include "ast.h"
 #include "instructionblock.h"
+#include "peephole.h"
 #include "runflags.h"
 #include "sourcefile.h"
 #include "stringpool.h"
@@ -60,6 +61,7 @@ struct CompilerResult {
   AST::AbstractNode* abstract_syntax_tree;
   std::vector<CompilerMessage> messages;
   bool has_errors = false;
+  PeepholeReport peephole_report;
 };
 
 // Context for multiple compilations
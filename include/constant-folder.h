@@ -0,0 +1,87 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "ast.h"
+#include "compiler-pass.h"
+
+#pragma once
+
+namespace Charly::Compilation {
+
+// Evaluates expressions whose operands are known at compile time
+//
+// Constant locals which are initialized with a literal and never reassigned
+// are replaced by their value. Conditional statements with a constant condition
+// are replaced by the branch that would be taken at runtime.
+class ConstantFolder : public CompilerPass {
+  using CompilerPass::CompilerPass;
+
+public:
+  // Records every variable that is the target of an assignment
+  //
+  // ignore_const blocks allow assignments to constants, those constants
+  // are never propagated
+  void collect_reassigned_names(AST::AbstractNode* node);
+
+  AST::AbstractNode* visit_block(AST::Block* node, VisitContinue cont);
+  AST::AbstractNode* visit_function(AST::Function* node, VisitContinue cont);
+  AST::AbstractNode* visit_class(AST::Class* node, VisitContinue cont);
+  AST::AbstractNode* visit_localinitialisation(AST::LocalInitialisation* node, VisitContinue cont);
+  AST::AbstractNode* visit_trycatch(AST::TryCatch* node, VisitContinue cont);
+  AST::AbstractNode* visit_match(AST::Match* node, VisitContinue cont);
+  AST::AbstractNode* visit_identifier(AST::Identifier* node, VisitContinue cont);
+  AST::AbstractNode* visit_if(AST::If* node, VisitContinue cont);
+  AST::AbstractNode* visit_ifelse(AST::IfElse* node, VisitContinue cont);
+  AST::AbstractNode* visit_unless(AST::Unless* node, VisitContinue cont);
+  AST::AbstractNode* visit_unlesselse(AST::UnlessElse* node, VisitContinue cont);
+  AST::AbstractNode* visit_ternaryif(AST::TernaryIf* node, VisitContinue cont);
+  AST::AbstractNode* visit_and(AST::And* node, VisitContinue cont);
+  AST::AbstractNode* visit_or(AST::Or* node, VisitContinue cont);
+  AST::AbstractNode* visit_binary(AST::Binary* node, VisitContinue cont);
+  AST::AbstractNode* visit_unary(AST::Unary* node, VisitContinue cont);
+  AST::AbstractNode* visit_inlinedcall(AST::InlinedCall* node, VisitContinue cont);
+
+private:
+  // Declares a name in the current scope
+  //
+  // value is the literal the name refers to, or nullptr if it is not a constant
+  void declare(const std::string& name, AST::AbstractNode* value);
+
+  // Returns the literal a name refers to, nullptr if it is unknown
+  AST::AbstractNode* lookup(const std::string& name);
+
+  AST::AbstractNode* fold_comparison(AST::Binary* node);
+  AST::AbstractNode* fold_arithmetic(AST::Binary* node);
+
+  std::vector<std::unordered_map<std::string, AST::AbstractNode*>> scopes;
+  std::unordered_set<std::string> reassigned_names;
+};
+}  // namespace Charly::Compilation
@@ -38,7 +38,6 @@ typedef uint16_t STATUS;
 
 class VM;
 struct Frame;
-struct CatchTable;
 class InstructionBlock;
 
 class CLI;
@@ -30,6 +30,7 @@
 #include <vector>
 
 #include "compiler.h"
+#include "instruction-profile.h"
 #include "instructionblock.h"
 
 #pragma once
@@ -90,6 +91,18 @@ public:
     uint32_t end_offset = UINT32_MAX;
   };
 
+  // A straight-line sequence of instructions, together with the time the profile attributes to it
+  struct BasicBlock {
+    uint32_t start_offset;
+    uint32_t end_offset;
+    uint64_t encountered = 0;
+    double nanoseconds = 0;
+    bool hot = false;
+  };
+
+  // Basic blocks taking at least this fraction of the profiled time of the whole block are highlighted
+  static constexpr double kHotBlockThreshold = 0.1;
+
 public:
   Disassembler(InstructionBlock* b, Flags f, CompilerContext* cc = nullptr) : block(b), flags(f), compiler_context(cc) {
     if (!f.no_branches) {
@@ -100,8 +113,20 @@ public:
   ~Disassembler() {
   }
 
+  // Annotate each instruction with the amount of times it ran, the time spent at it and
+  // how often it ran as a number specialized variant
+  //
+  // Instructions are looked up by their address, so the profile has to belong to the VM
+  // which executed this block
+  inline void set_profile(const VMInstructionProfile* profile) {
+    this->profile = profile;
+  }
+
   void dump(std::ostream& stream);
 
+  // Writes the annotations of all executed instructions and the basic blocks as a JSON object
+  void write_profile_json(std::ostream& stream, const std::string& filename);
+
 private:
   template <typename V>
   inline void print_hex(V value, std::ostream& stream, uint32_t width = 1) {
@@ -135,12 +160,20 @@ private:
   void detect_branches();
   void draw_branchlines_for_offset(uint32_t offset, std::ostream& stream);
 
+  // Splits the block into basic blocks and sums up their profile
+  void detect_basic_blocks();
+  const BasicBlock* basic_block_at(uint32_t offset) const;
+  void print_annotation(uint32_t offset, std::ostream& stream);
+
 private:
   InstructionBlock* block;
   std::vector<Branch> branches;
   uint32_t highest_branch_density = 0;
   Flags flags;
   CompilerContext* compiler_context;
+  const VMInstructionProfile* profile = nullptr;
+  std::vector<BasicBlock> basic_blocks;
+  double total_nanoseconds = 0;
 };
 
 template <>
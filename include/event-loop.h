@@ -0,0 +1,80 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#pragma once
+
+namespace Charly {
+
+// Readiness primitive the main thread of the VM blocks on while it has nothing to do
+//
+// Backed by epoll and an eventfd on linux and by kqueue with a user event on other platforms.
+// Worker threads call wake once they have pushed their results, file descriptors registered
+// via watch are reported by wait once they become readable or writable.
+class EventLoop {
+public:
+  struct Event {
+    uint64_t token;
+    bool readable;
+    bool writable;
+  };
+
+  EventLoop();
+  EventLoop(const EventLoop& other) = delete;
+  EventLoop(EventLoop&& other) = delete;
+  ~EventLoop();
+
+  // Wakes up the thread currently blocked inside wait, may be called from any thread
+  //
+  // Wakeups are coalesced until the waiting thread has observed them
+  void wake();
+
+  // Blocks until the loop is woken up, a watched file descriptor is ready or the timeout expires
+  //
+  // Events of watched file descriptors are appended to events. Errors and hangups are
+  // reported as the file descriptor being both readable and writable
+  void wait(std::chrono::milliseconds timeout, std::vector<Event>& events);
+
+  // Registers a file descriptor or changes the events it is watched for
+  //
+  // The token is reported by wait. Watching for neither event removes the file descriptor
+  bool watch(int fd, uint64_t token, bool readable, bool writable);
+  void unwatch(int fd);
+
+private:
+  int poll_fd = -1;
+
+  // The eventfd the workers write to, unused on platforms with kqueue
+  int wake_fd = -1;
+
+  std::atomic<bool> wake_pending{false};
+};
+
+}  // namespace Charly
@@ -24,11 +24,21 @@
  * SOFTWARE.
  */
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 #include <mutex>
-#include <set>
+#include <thread>
+
+#include <sys/mman.h>
 
 #include "value.h"
 
@@ -52,7 +62,6 @@ struct MemoryCell {
     Generator generator;
     Class klass;
     Frame frame;
-    CatchTable catchtable;
     CPointer cpointer;
   };
 
@@ -66,30 +75,455 @@ struct MemoryCell {
   }
 };
 
+// Cells are allocated from heaps of different size classes
+//
+// Each type is always allocated from the smallest size class it fits into
+enum CellSizeClass : uint8_t { kCellSizeSmall, kCellSizeMedium, kCellSizeLarge, kCellSizeClassCount };
+static constexpr size_t kCellSizes[kCellSizeClassCount] = {32, 64, sizeof(MemoryCell)};
+
+constexpr CellSizeClass cell_size_class_for(size_t size) {
+  if (size <= kCellSizes[kCellSizeSmall])
+    return kCellSizeSmall;
+  if (size <= kCellSizes[kCellSizeMedium])
+    return kCellSizeMedium;
+  return kCellSizeLarge;
+}
+
+// Reason the garbage collector asked the VM to throw an out of memory exception
+enum OutOfMemoryReason : uint8_t { kHeapLimitReached, kTaskBudgetExhausted };
+
+// A single heap, containing cells of the same size class
+struct CellHeap {
+  CellSizeClass size_class;
+  size_t cell_count;
+  MemoryCell* cells;
+
+  // Amount of cells which survived the last sweep of this heap
+  size_t live_cells;
+
+  inline MemoryCell* cell_at(size_t index) {
+    return reinterpret_cast<MemoryCell*>(reinterpret_cast<char*>(this->cells) + index * kCellSizes[this->size_class]);
+  }
+};
+
 // Flagas for the memory manager
+//
+// Heap related settings apply to each size class separately
 struct GarbageCollectorConfig {
-  size_t initial_heap_count = 4;
+  size_t initial_heap_count = 2;
   size_t heap_cell_count = 1 << 16;
   float heap_growth_factor = 2;
   size_t min_free_cells = 32;
 
+  // Heaps are mapped directly via mmap, optionally backed by transparent huge pages
+  bool use_huge_pages = false;
+
+  // Empty heaps are returned to the operating system after a collection if more than
+  // heap_high_water_mark of the cells of their size class are free
+  //
+  // At least heap_low_water_mark heaps of each size class are kept around
+  float heap_high_water_mark = 0.75;
+  size_t heap_low_water_mark = 2;
+
+  // Amount of cells that can be allocated before a minor collection is started
+  size_t young_generation_cell_count = 1 << 14;
+
+  // Full collections mark the heap in small steps in between allocations
+  // and while the VM is idle
+  //
+  // Marking starts once less than incremental_marking_threshold of all cells are free.
+  // A step is performed every mark_step_interval allocations and runs for at most
+  // mark_step_pause_target microseconds
+  bool incremental_marking = true;
+  float incremental_marking_threshold = 0.25;
+  size_t mark_step_interval = 256;
+  uint32_t mark_step_pause_target = 500;
+
+  // Marking work which has to be done during a pause is split across multiple
+  // threads once more than parallel_marking_threshold cells are waiting to be visited
+  //
+  // The thread performing the collection counts as one of the marker threads
+  size_t marker_thread_count = std::min(std::thread::hardware_concurrency(), 4u);
+  size_t parallel_marking_threshold = 1 << 12;
+
+  // Heaps are swept one at a time once the allocator runs out of free cells,
+  // instead of sweeping all of them at the end of a collection
+  bool lazy_sweeping = true;
+
+  // No heaps are added once the heaps of all size classes take up max_heap_bytes, 0 disables the limit
+  //
+  // If a full collection doesn't free enough cells at the limit, allocations are served from a reserve
+  // of one additional heap per size class and the VM throws an out of memory exception at its next
+  // safepoint. The VM panics once the reserve is used up as well
+  size_t max_heap_bytes = 0;
+
+  // Amount of cell bytes a single task may allocate before the VM throws an
+  // out of memory exception inside of it, 0 disables the budget
+  size_t task_allocation_budget = 0;
+
   bool trace = false;
   std::ostream& out_stream = std::cerr;
   std::ostream& err_stream = std::cout;
 };
 
+// Distribution of pause times
+//
+// Bucket N counts pauses shorter than 2^N microseconds, the last bucket
+// counts all remaining pauses
+struct PauseHistogram {
+  static constexpr size_t kBucketCount = 16;
+  uint64_t buckets[kBucketCount] = {0};
+
+  inline void record(uint64_t nanoseconds) {
+    size_t bucket = 0;
+    uint64_t limit = 1000;
+    while (bucket < kBucketCount - 1 && nanoseconds >= limit) {
+      bucket++;
+      limit *= 2;
+    }
+    this->buckets[bucket]++;
+  }
+};
+
+// Statistics recorded by the garbage collector
+//
+// Pause times are measured in nanoseconds. Every piece of collector work performed
+// while the VM is waiting counts as a pause. This includes minor collections, the
+// final pause of a full collection, incremental mark steps and lazy sweep steps
+struct GarbageCollectorStats {
+  uint64_t minor_collections = 0;
+  uint64_t full_collections = 0;
+  uint64_t mark_steps = 0;
+  uint64_t sweep_steps = 0;
+
+  uint64_t pause_count = 0;
+  uint64_t total_pause_time = 0;
+  uint64_t max_pause_time = 0;
+  PauseHistogram pause_histogram;
+
+  uint64_t allocated_cells = 0;
+  uint64_t allocated_bytes = 0;
+  uint64_t freed_cells = 0;
+  uint64_t promoted_cells = 0;
+
+  // Amount of cells which survived the last full collection
+  uint64_t live_cells = 0;
+
+  uint64_t heap_count = 0;
+  uint64_t heap_bytes = 0;
+  uint64_t peak_heap_bytes = 0;
+
+  std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+
+  inline void record_pause(uint64_t nanoseconds) {
+    this->pause_count++;
+    this->total_pause_time += nanoseconds;
+    this->max_pause_time = std::max(this->max_pause_time, nanoseconds);
+    this->pause_histogram.record(nanoseconds);
+  }
+
+  // Bytes allocated per second since the collector was created
+  inline double allocation_rate() const {
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - this->start_time;
+    return elapsed.count() > 0 ? this->allocated_bytes / elapsed.count() : 0;
+  }
+};
+
+// Instruction which allocated cells of a single type
+struct AllocationSiteKey {
+  uint8_t* address;
+  uint8_t type;
+
+  inline bool operator==(const AllocationSiteKey& other) const {
+    return this->address == other.address && this->type == other.type;
+  }
+};
+
+struct AllocationSiteKeyHash {
+  inline size_t operator()(const AllocationSiteKey& key) const {
+    return std::hash<uintptr_t>()(reinterpret_cast<uintptr_t>(key.address)) ^ key.type;
+  }
+};
+
+// Each sample counts as allocation_sample_interval allocations of its size
+struct AllocationSite {
+  VALUE function_name = kNull;
+  uint64_t count = 0;
+  uint64_t bytes = 0;
+};
+
+// Allocation site with its function and source position resolved
+struct AllocationSiteReport {
+  std::string type;
+  std::string function;
+  std::string location;
+  uint64_t count;
+  uint64_t bytes;
+};
+
+// Worklist of a single marker thread of the parallel marker
+//
+// The owning marker thread pushes and pops cells at the back of its private stack without
+// any locking. Once the private stack holds more than kShareThreshold cells while the shared
+// deque is empty, its older half is moved into the shared deque. Other marker threads steal
+// half of the shared deque at once, taking the cells from its front.
+//
+// Only the owner adds cells to the shared deque, so the shared deque of a marker
+// thread which ran out of work stays empty
+struct MarkDeque {
+  static constexpr size_t kShareThreshold = 64;
+
+  std::vector<MemoryCell*> local;
+  std::mutex m;
+  std::deque<MemoryCell*> shared;
+  std::atomic<size_t> shared_size{0};
+
+  inline void push(MemoryCell* cell) {
+    this->local.push_back(cell);
+    this->share_surplus();
+  }
+
+  // Takes a cell from the private stack, refilling it from the shared deque once it runs empty
+  inline bool pop(MemoryCell*& cell) {
+    if (this->local.empty() && !this->steal(this->local)) {
+      return false;
+    }
+
+    cell = this->local.back();
+    this->local.pop_back();
+    this->share_surplus();
+    return true;
+  }
+
+  // Moves half of the shared cells into the private stack of a marker thread
+  inline bool steal(std::vector<MemoryCell*>& target) {
+    if (this->shared_size.load() == 0) {
+      return false;
+    }
+
+    std::unique_lock<std::mutex> lk(this->m);
+    size_t count = (this->shared.size() + 1) / 2;
+    target.insert(target.end(), this->shared.begin(), this->shared.begin() + count);
+    this->shared.erase(this->shared.begin(), this->shared.begin() + count);
+    this->shared_size.store(this->shared.size());
+    return count > 0;
+  }
+
+  // Returns true if other marker threads have nothing to steal from this deque
+  inline bool empty() {
+    return this->shared_size.load() == 0;
+  }
+
+private:
+  inline void share_surplus() {
+    if (this->local.size() <= kShareThreshold || this->shared_size.load(std::memory_order_relaxed) != 0) {
+      return;
+    }
+
+    size_t count = this->local.size() / 2;
+    std::unique_lock<std::mutex> lk(this->m);
+    this->shared.insert(this->shared.end(), this->local.begin(), this->local.begin() + count);
+    this->local.erase(this->local.begin(), this->local.begin() + count);
+    this->shared_size.store(this->shared.size());
+  }
+};
+
+// Helper threads of the parallel marker
+//
+// The threads are started the first time a pause marks in parallel and are parked
+// in between pauses. The thread performing the collection takes part as marker 0.
+class MarkerPool {
+public:
+  using Job = std::function<void(size_t id)>;
+
+  MarkerPool(size_t helper_count);
+  MarkerPool(const MarkerPool&) = delete;
+  MarkerPool(MarkerPool&&) = delete;
+  ~MarkerPool();
+
+  // Runs the job on the calling thread and on every helper thread
+  // Returns once all threads have finished it
+  void run(const Job& job);
+
+  // The amount of marker threads, including the calling thread
+  inline size_t thread_count() {
+    return this->threads.size() + 1;
+  }
+
+private:
+  void helper_main(size_t id);
+
+  std::mutex m;
+  std::condition_variable start_cv;
+  std::condition_variable done_cv;
+
+  // Each call to run starts a new generation, helpers remember the last one they ran
+  const Job* job = nullptr;
+  uint64_t generation = 0;
+  size_t running_helpers = 0;
+  bool stopping = false;
+
+  std::vector<std::thread> threads;
+};
+
+// Generational mark & sweep garbage collector
+//
+// Cells allocated since the last collection form the young generation. Minor collections
+// only mark and sweep young cells, old cells are assumed to be alive. Young cells which
+// survive a collection are promoted in place by setting their old flag.
+//
+// Cells never move, since native code holds raw pointers to cells across allocations.
+//
+// Full collections are performed incrementally using tri-color marking. White cells are
+// unmarked, gray cells are marked and queued inside the gray_cells worklist, black cells
+// are marked and have had their children marked. The write barrier turns black cells gray
+// again, so they are rescanned before the collection finishes. Before sweeping, the roots are
+// scanned once again. Frames on the frame stack are only marked during that final pause,
+// since they can be released at any time.
+//
+// Large worklists inside a pause are drained by multiple marker threads. Each thread owns a
+// MarkDeque and steals work from the others once its own deque runs empty. Cells are claimed
+// by atomically setting their mark bit, so every cell is visited exactly once. The helper
+// threads are kept inside a MarkerPool, which is reused by all pauses of the collector.
+//
+// The sweep phase of a full collection is performed lazily. At the end of the collection
+// the free list is emptied, and the allocator sweeps another heap each time it runs out
+// of free cells. Until a heap was swept, its marked cells are treated like old cells by
+// the write barrier. Minor collections may run while heaps are still unswept, a new full
+// collection finishes the sweep first.
+//
+// Old cells which might reference young cells are tracked inside the remembered set.
+// The VM calls write_barrier each time it stores a value into a cell. Values held as
+// temporaries may be modified by native code without a barrier, so they are added to the
+// remembered set once they are released.
+//
+// Temporaries created by code running on the VM thread are kept alive by handle scopes.
+// Handles are stored on a single stack which is truncated once a scope is left. Values
+// which need to stay alive for longer or which are held by other threads are registered
+// via mark_persistent.
 class GarbageCollector {
   friend VM;
   GarbageCollectorConfig config;
   VM* host_vm;
-  MemoryCell* free_cell;
-  size_t remaining_free_cells = 0;
-  std::vector<MemoryCell*> heaps;
-  std::multiset<VALUE> temporaries;
+  std::vector<CellHeap> heaps;
+  size_t heap_count[kCellSizeClassCount] = {0};
+
+  // Each size class has its own free list
+  MemoryCell* free_cell[kCellSizeClassCount] = {nullptr};
+  size_t remaining_free_cells[kCellSizeClassCount] = {0};
+
+  // Values registered via mark_persistent, mapped to the amount of times they were registered
+  std::unordered_map<VALUE, uint32_t> temporaries;
+
+  // Values held by handle scopes, only accessed by the VM thread
+  std::vector<VALUE> handles;
+
+  // Cells allocated since the last collection
+  std::vector<MemoryCell*> young_cells;
+
+  // Old cells which might contain references to young cells
+  std::vector<MemoryCell*> remembered_cells;
+
+  // Set while a minor collection is running
+  bool minor_collection = false;
+
+  GarbageCollectorStats stats;
+
+  // Measures the time spent inside the outermost collector call
+  struct PauseScope;
+  uint32_t pause_depth = 0;
+
+  // Set while a full collection is marking the heap incrementally
+  bool incremental_marking = false;
+  size_t allocations_since_mark_step = 0;
+
+  // Collections which don't free enough cells at the heap limit request another full collection,
+  // which has to confirm the verdict before the out of memory exception is requested
+  //
+  // Incremental marking keeps cells alive which were dropped while it was running, and a lazy sweep
+  // might only finish after the values which exhausted the heap were released, for example by the
+  // exception of an earlier out of memory situation unwinding the stack
+  bool full_collection_requested = false;
+  bool sweeping_requested_collection = false;
+
+  // Cells which have been marked but whose children haven't been visited yet
+  std::vector<MemoryCell*> gray_cells;
+
+  // Heaps with an index in the range [sweep_heap_index, sweep_heap_end) haven't
+  // been swept since the last full collection
+  size_t sweep_heap_index = 0;
+  size_t sweep_heap_end = 0;
+  size_t swept_free_cells[kCellSizeClassCount] = {0};
+  size_t swept_freed_bytes = 0;
+
+  // Allocation site profiling
+  //
+  // Every allocation_sample_interval-th allocation is attributed to the instruction the VM
+  // is currently executing. The type and size of the sampled cell are only known once it was
+  // initialized, so it is recorded right before the next allocation or once it gets freed
+  uint32_t allocation_sample_interval = 0;
+  uint32_t allocations_until_sample = 0;
+  MemoryCell* pending_sample_cell = nullptr;
+  uint8_t* pending_sample_address = nullptr;
+  VALUE pending_sample_function = kNull;
+  std::unordered_map<AllocationSiteKey, AllocationSite, AllocationSiteKeyHash> allocation_sites;
+  void record_pending_allocation_sample();
+
+  // Set once the heap limit or the allocation budget of the current task was exceeded
+  bool out_of_memory = false;
+  OutOfMemoryReason out_of_memory_reason = kHeapLimitReached;
+
+  // Cell bytes allocated since the current task started
+  uint64_t task_allocated_bytes = 0;
+  bool task_budget_exhausted = false;
+
+  void add_heap(CellSizeClass size_class);
+  void grow_heap(CellSizeClass size_class);
 
-  void add_heap();
-  void grow_heap();
+  // Returns true if a heap of this size class can be added without exceeding the heap limit by more than reserve bytes
+  bool heap_fits_limit(CellSizeClass size_class, size_t reserve = 0);
+
+  // Asks the VM to throw an out of memory exception at its next safepoint
+  void request_out_of_memory(OutOfMemoryReason reason);
+  void release_empty_heaps();
+  size_t heap_size(CellSizeClass size_class);
+
+  // Returns true if less than incremental_marking_threshold of the cells of a size class are free
+  bool below_marking_threshold(CellSizeClass size_class);
   void collect();
+  void collect_young();
+  void start_incremental_marking();
+  void mark_roots();
+  void mark_root(VALUE value);
+
+  // Calls the callback with each value the VM keeps alive directly
+  template <typename Fn>
+  void each_root(Fn&& callback);
+  void mark_children(MemoryCell* cell);
+  void shade(MemoryCell* cell);
+
+  // Calls the callback with each value referenced by a cell
+  template <typename Fn>
+  void each_child(MemoryCell* cell, Fn&& callback);
+
+  // Returns the cell a value points to if it needs to be marked, nullptr otherwise
+  // Doesn't check the mark bit of the cell
+  MemoryCell* markable_cell(VALUE value);
+
+  // Parallel marking
+  std::unique_ptr<MarkerPool> marker_pool;
+  void drain_gray_cells_parallel();
+  void parallel_mark_worker(std::vector<MarkDeque>& deques, size_t id, std::atomic<size_t>& active_markers);
+  bool claim_cell(MemoryCell* cell);
+
+  // Lazy sweeping
+  void sweep_next_heap();
+  void finish_sweeping();
+
+  // Visits gray cells until no gray cells are left or the deadline was reached
+  // Returns true if there are no gray cells left
+  bool drain_gray_cells(std::chrono::steady_clock::time_point deadline);
+  bool drain_gray_cells();
 
   void deallocate(MemoryCell* value);
   template <typename T>
@@ -97,24 +531,31 @@ class GarbageCollector {
     this->deallocate(reinterpret_cast<MemoryCell*>(value));
   }
   std::recursive_mutex g_mutex;
+
+  static std::atomic<bool> snapshot_requested;
 public:
-  GarbageCollector(GarbageCollectorConfig cfg, VM* host_vm) : config(cfg), host_vm(host_vm), free_cell(nullptr) {
-    this->free_cell = nullptr;
+  GarbageCollector(GarbageCollectorConfig cfg, VM* host_vm) : config(cfg), host_vm(host_vm) {
 
     // Allocate the initial heaps
-    size_t heapc = cfg.initial_heap_count;
-    while (heapc--) {
-      this->add_heap();
+    for (uint8_t size_class = 0; size_class < kCellSizeClassCount; size_class++) {
+      size_t heapc = cfg.initial_heap_count;
+      while (heapc--) {
+        this->add_heap(static_cast<CellSizeClass>(size_class));
+      }
     }
   }
   GarbageCollector(const GarbageCollector&) = delete;
   GarbageCollector(GarbageCollector&&) = delete;
   ~GarbageCollector() {
-    for (MemoryCell* heap : this->heaps) {
-      std::free(heap);
+    for (CellHeap& heap : this->heaps) {
+      munmap(heap.cells, this->heap_size(heap.size_class));
     }
   }
-  MemoryCell* allocate();
+  MemoryCell* allocate(CellSizeClass size_class);
+  template <typename T>
+  inline MemoryCell* allocate() {
+    return this->allocate(cell_size_class_for(sizeof(T)));
+  }
   void mark(VALUE cell);
   template <typename T>
   inline void mark(T* cell) {
@@ -124,7 +565,138 @@ public:
   void mark_persistent(VALUE value);
   void unmark_persistent(VALUE value);
 
+  // Performs a single step of an ongoing incremental collection
+  void do_mark_step();
+  inline bool is_marking() {
+    return this->incremental_marking;
+  }
+
+  // Sweeps a single heap left over from the last full collection
+  void do_sweep_step();
+  inline bool is_sweeping() {
+    return this->sweep_heap_index < this->sweep_heap_end;
+  }
+
+  // Has to be called before a value is stored inside a cell
+  inline void write_barrier(MemoryCell* cell) {
+    // Marked cells might belong to a heap which hasn't been swept yet,
+    // they are promoted once their heap is swept
+    if ((cell->basic.old || cell->basic.mark) && !cell->basic.remembered) {
+      cell->basic.remembered = true;
+      this->remembered_cells.push_back(cell);
+    }
+
+    // Black cells have to be scanned again
+    if (this->incremental_marking && cell->basic.mark && !cell->basic.gray) {
+      this->shade(cell);
+    }
+  }
+  template <typename T>
+  inline void write_barrier(T* cell) {
+    this->write_barrier(reinterpret_cast<MemoryCell*>(cell));
+  }
+  inline void write_barrier(VALUE value) {
+    if (charly_is_ptr(value) && charly_as_pointer(value) != nullptr) {
+      this->write_barrier(charly_as_pointer_to<MemoryCell>(value));
+    }
+  }
+
+  inline const GarbageCollectorStats& get_stats() {
+    return this->stats;
+  }
+
+  // Checked by the VM at each safepoint
+  inline bool out_of_memory_pending() {
+    return this->out_of_memory;
+  }
+
+  // Returns why the out of memory exception was requested
+  inline OutOfMemoryReason pending_out_of_memory_reason() {
+    return this->out_of_memory_reason;
+  }
+
+  // Clears the request once the exception was thrown
+  //
+  // The heaps being swept were marked before the exception released any values,
+  // so their sweep can't confirm another out of memory situation
+  inline void clear_out_of_memory() {
+    this->out_of_memory = false;
+    this->sweeping_requested_collection = false;
+  }
+
+  // Gives the task which is about to be executed a fresh allocation budget
+  inline void start_task() {
+    this->task_allocated_bytes = 0;
+    this->task_budget_exhausted = false;
+  }
+
+  // Heap snapshots
+  //
+  // Writes every cell reachable from the roots, together with its size and
+  // outgoing references, to the stream. See docs/garbage-collector.md for the format
+  //
+  // Returns the amount of cells written
+  size_t write_heap_snapshot(std::ostream& out);
+
+  // Samples every interval-th allocation, an interval of 0 disables the profiler
+  //
+  // Sites recorded so far are kept when the interval changes
+  void set_allocation_sample_interval(uint32_t interval);
+  inline uint32_t get_allocation_sample_interval() {
+    return this->allocation_sample_interval;
+  }
+
+  // Recorded allocation sites, sorted by the amount of bytes they allocated
+  std::vector<AllocationSiteReport> allocation_profile();
+  void write_allocation_profile(std::ostream& out, uint32_t count = 25);
+
+  // Safe to call from inside a signal handler, the snapshot is written
+  // the next time the VM reaches a safe point
+  static void request_heap_snapshot();
+  void write_requested_heap_snapshot();
+  inline static bool heap_snapshot_requested() {
+    return GarbageCollector::snapshot_requested.load(std::memory_order_relaxed);
+  }
+
+  // Handle scopes
+  inline size_t handle_count() {
+    return this->handles.size();
+  }
+  inline void push_handle(VALUE value) {
+    this->handles.push_back(value);
+  }
+  inline void release_handles(size_t base) {
+    // Native code modifies values held in handles without going through the write barrier
+    for (size_t i = base; i < this->handles.size(); i++) {
+      this->write_barrier(this->handles[i]);
+    }
+    this->handles.resize(base);
+  }
+
   void lock();
   void unlock();
 };
+
+// Keeps values alive until the scope is left
+//
+// Handle scopes have to be strictly nested, since leaving a scope releases
+// every handle created after it. They may only be used by the VM thread
+class HandleScope {
+  GarbageCollector& gc;
+  size_t base;
+
+public:
+  HandleScope(GarbageCollector& t_gc) : gc(t_gc), base(t_gc.handle_count()) {
+  }
+  HandleScope(const HandleScope&) = delete;
+  HandleScope(HandleScope&&) = delete;
+  ~HandleScope() {
+    this->gc.release_handles(this->base);
+  }
+
+  inline VALUE add(VALUE value) {
+    this->gc.push_handle(value);
+    return value;
+  }
+};
 }  // namespace Charly
@@ -0,0 +1,87 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "ast.h"
+#include "compiler-pass.h"
+
+#pragma once
+
+namespace Charly::Compilation {
+
+// The maximum amount of nodes in the body of a function that gets inlined
+static constexpr size_t kMaximumInlineNodes = 16;
+
+// Replaces calls to small local functions with the body of the function
+//
+// A function is inlined if it is a constant local which is never reassigned and its body
+// consists of a single returned expression. The expression may only contain literals,
+// operators, member reads, its parameters and names which resolve to the same declaration
+// at the call site. The arguments of an inlined call have to be literals or locals which
+// are never reassigned, so they can be duplicated or dropped without changing the program.
+class Inliner : public CompilerPass {
+  using CompilerPass::CompilerPass;
+
+public:
+  // Records every variable that is the target of an assignment
+  void collect_reassigned_names(AST::AbstractNode* node);
+
+  AST::AbstractNode* visit_block(AST::Block* node, VisitContinue cont);
+  AST::AbstractNode* visit_function(AST::Function* node, VisitContinue cont);
+  AST::AbstractNode* visit_localinitialisation(AST::LocalInitialisation* node, VisitContinue cont);
+  AST::AbstractNode* visit_trycatch(AST::TryCatch* node, VisitContinue cont);
+  AST::AbstractNode* visit_match(AST::Match* node, VisitContinue cont);
+  AST::AbstractNode* visit_call(AST::Call* node, VisitContinue cont);
+
+private:
+  struct InlineCandidate {
+    AST::Function* function;
+
+    // The scope each name used by the body resolved to at the declaration of the function
+    std::unordered_map<std::string, std::optional<size_t>> free_names;
+  };
+
+  // Declares a name in the current scope
+  void declare(const std::string& name, std::optional<InlineCandidate> candidate = std::nullopt);
+
+  // Returns the index of the scope a name is declared in
+  std::optional<size_t> resolve(const std::string& name);
+
+  // Checks wether a function can be inlined and collects the names used by its body
+  std::optional<InlineCandidate> create_candidate(AST::Function* node);
+
+  // Checks wether an argument can be substituted for a parameter
+  bool is_trivial_argument(AST::AbstractNode* node);
+
+  std::vector<std::unordered_map<std::string, std::optional<InlineCandidate>>> scopes;
+  std::unordered_set<std::string> reassigned_names;
+};
+}  // namespace Charly::Compilation
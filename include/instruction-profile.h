@@ -0,0 +1,178 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "opcode.h"
+
+#pragma once
+
+namespace Charly {
+
+// Cheap monotonic tick counter used to time individual instructions
+//
+// Reads the time stamp counter on x86 and the virtual counter on arm64, which
+// are both invariant on the platforms we support. Other platforms fall back
+// to the steady clock, in which case one tick equals one nanosecond
+inline uint64_t read_cycle_counter() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#elif defined(__aarch64__)
+  uint64_t ticks;
+  asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+  return ticks;
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+}
+
+enum class InstructionProfileOrder : uint8_t { TotalTime, Count, AverageTime };
+
+struct VMInstructionProfileEntry {
+  uint64_t encountered = 0;
+  uint64_t total_ticks = 0;
+};
+
+// Profile of a single instruction inside an instructionblock
+//
+// Sites of arithmetic and comparison instructions also count how often they ran as
+// one of their number specialized variants
+struct VMInstructionSiteEntry {
+  uint64_t encountered = 0;
+  uint64_t total_ticks = 0;
+  uint64_t specializable = 0;
+  uint64_t specialized = 0;
+};
+
+// Returns true if the opcode is one of the number specialized variants of a generic instruction
+inline bool is_specialized_opcode(Opcode opcode) {
+  return opcode >= Opcode::AddNum && opcode <= Opcode::BranchGeNum;
+}
+
+// Returns true if the VM rewrites this opcode into a number specialized variant, or already did
+inline bool is_specializable_opcode(Opcode opcode) {
+  switch (opcode) {
+    case Opcode::Add:
+    case Opcode::Sub:
+    case Opcode::Mul:
+    case Opcode::Lt:
+    case Opcode::Gt:
+    case Opcode::Le:
+    case Opcode::Ge:
+    case Opcode::BranchLt:
+    case Opcode::BranchGt:
+    case Opcode::BranchLe:
+    case Opcode::BranchGe: return true;
+    default: return is_specialized_opcode(opcode);
+  }
+}
+
+// Stores how often each type of instruction was encountered, how many ticks
+// it took and which instruction was executed directly before it
+//
+// Tick counts are converted to nanoseconds when the profile is written. The
+// overhead of reading the counter twice is measured once and subtracted from each sample
+class VMInstructionProfile {
+public:
+  VMInstructionProfile() : entries(kOpcodeCount) {
+  }
+
+  // Measures the counter frequency and overhead and allocates the pair table
+  //
+  // If track_sites is set, each executed instruction is also profiled by its address
+  void enable(bool track_sites = false);
+
+  inline void add_entry(Opcode opcode, const uint8_t* ip, uint64_t ticks) {
+    VMInstructionProfileEntry& entry = this->entries[opcode];
+    entry.encountered += 1;
+    entry.total_ticks += ticks;
+
+    if (this->previous_opcode < kOpcodeCount) {
+      this->pairs[this->previous_opcode * kOpcodeCount + opcode] += 1;
+    }
+    this->previous_opcode = opcode;
+
+    if (this->track_sites) {
+      VMInstructionSiteEntry& site = this->sites[ip];
+      site.encountered += 1;
+      site.total_ticks += ticks;
+      if (is_specializable_opcode(opcode)) {
+        site.specializable += 1;
+        site.specialized += is_specialized_opcode(opcode);
+      }
+    }
+  }
+
+  // Average time of an instruction in nanoseconds, with the timer overhead removed
+  double average_nanoseconds(Opcode opcode) const;
+
+  // Total time spent at an instruction in nanoseconds, with the timer overhead removed
+  double site_nanoseconds(const VMInstructionSiteEntry& site) const {
+    uint64_t overhead = site.encountered * this->overhead_ticks;
+    return this->ticks_to_nanoseconds(site.total_ticks > overhead ? site.total_ticks - overhead : 0);
+  }
+
+  // Returns the profile of the instruction at a given address, or nullptr if it never ran
+  const VMInstructionSiteEntry* site(const uint8_t* ip) const {
+    auto it = this->sites.find(ip);
+    return it == this->sites.end() ? nullptr : &it->second;
+  }
+
+  void dump(std::ostream& out, InstructionProfileOrder order, uint32_t pair_count = 25) const;
+
+  std::vector<VMInstructionProfileEntry> entries;
+
+  // Amount of times each opcode directly followed another, indexed by [previous * kOpcodeCount + next]
+  std::vector<uint64_t> pairs;
+
+  // Profiles of the individual instructions, keyed by their address
+  std::unordered_map<const uint8_t*, VMInstructionSiteEntry> sites;
+
+private:
+  double ticks_to_nanoseconds(uint64_t ticks) const {
+    return static_cast<double>(ticks) / this->ticks_per_nanosecond;
+  }
+
+  uint64_t corrected_ticks(const VMInstructionProfileEntry& entry) const {
+    uint64_t overhead = entry.encountered * this->overhead_ticks;
+    return entry.total_ticks > overhead ? entry.total_ticks - overhead : 0;
+  }
+
+  uint32_t previous_opcode = kOpcodeCount;
+  bool track_sites = false;
+  double ticks_per_nanosecond = 1.0;
+  uint64_t overhead_ticks = 0;
+};
+}  // namespace Charly
@@ -24,7 +24,13 @@
  * SOFTWARE.
  */
 
+#include <algorithm>
 #include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
 
 #include "memoryblock.h"
 #include "opcode.h"
@@ -32,8 +38,282 @@
 #pragma once
 
 namespace Charly {
+
+// Maps a range of instructions protected by a try statement to its handler
+//
+// All offsets are relative to the beginning of the block, the range excludes the end offset
+struct ExceptionTableEntry {
+  uint32_t begin;
+  uint32_t end;
+  uint32_t handler;
+};
+
+// Instruction range of a function body which was inlined into its caller
+struct InlinedFunctionEntry {
+  uint32_t begin;
+  uint32_t end;
+  VALUE name;
+};
+
+// Maps the keys of a switch statement to the blocks they select
+//
+// Integer keys are stored densely starting at integer_base, holes point to the default block.
+// String keys are sorted by their hash. All offsets are relative to the beginning of the block
+struct SwitchTable {
+  struct StringTarget {
+    size_t hash;
+    std::string key;
+    uint32_t target;
+  };
+
+  int64_t integer_base = 0;
+  std::vector<uint32_t> integer_targets;
+  std::vector<StringTarget> string_targets;
+  uint32_t default_target = 0;
+
+  // Keeps the first target if a key is added twice, the same case wins in the comparison chain
+  inline void add_string_target(const std::string& key, uint32_t target) {
+    size_t hash = std::hash<std::string_view>{}(key);
+    auto it = std::lower_bound(this->string_targets.begin(), this->string_targets.end(), hash,
+                               [](const StringTarget& entry, size_t hash) { return entry.hash < hash; });
+    for (auto search = it; search != this->string_targets.end() && search->hash == hash; search++) {
+      if (search->key == key) {
+        return;
+      }
+    }
+    this->string_targets.insert(it, {hash, key, target});
+  }
+
+  inline uint32_t find_integer_target(int64_t key) const {
+    if (key < this->integer_base || key - this->integer_base >= static_cast<int64_t>(this->integer_targets.size())) {
+      return this->default_target;
+    }
+    return this->integer_targets[key - this->integer_base];
+  }
+
+  inline uint32_t find_string_target(std::string_view key) const {
+    size_t hash = std::hash<std::string_view>{}(key);
+    auto it = std::lower_bound(this->string_targets.begin(), this->string_targets.end(), hash,
+                               [](const StringTarget& entry, size_t hash) { return entry.hash < hash; });
+    for (; it != this->string_targets.end() && it->hash == hash; it++) {
+      if (it->key == key) {
+        return it->target;
+      }
+    }
+    return this->default_target;
+  }
+
+  // Calls the callback with a reference to every offset stored in the table
+  inline void each_target(const std::function<void(uint32_t&)>& callback) {
+    for (uint32_t& target : this->integer_targets)
+      callback(target);
+    for (StringTarget& entry : this->string_targets)
+      callback(entry.target);
+    callback(this->default_target);
+  }
+};
+
+// Line and column of the source code an instruction was generated from
+struct SourcePosition {
+  uint32_t line;
+  uint32_t column;
+};
+
+// Maps instruction offsets to the source positions they were generated from
+//
+// Each entry covers the instructions from its offset up to the offset of the next entry.
+// Entries are stored as variable length deltas to the previous entry. Every kCheckpointInterval
+// entries the decoded state is saved, so a lookup only decodes the entries following the
+// closest checkpoint
+class LineTable {
+public:
+  struct Entry {
+    uint32_t offset;
+    SourcePosition position;
+  };
+
+  // Entries have to be added in ascending order of their offsets
+  inline void add(uint32_t offset, SourcePosition position) {
+    if (this->entry_count > 0 && position.line == this->last.position.line &&
+        position.column == this->last.position.column) {
+      return;
+    }
+
+    Entry previous = this->entry_count > 0 ? this->last : Entry{0, {0, 0}};
+    write_varint(offset - previous.offset);
+    write_varint(zigzag_encode(static_cast<int64_t>(position.line) - previous.position.line));
+    write_varint(position.column);
+
+    if (this->entry_count % kCheckpointInterval == 0) {
+      this->checkpoints.push_back({{offset, position}, static_cast<uint32_t>(this->data.size())});
+    }
+
+    this->last = {offset, position};
+    this->entry_count++;
+  }
+
+  // Returns the position of the entry covering an offset
+  inline std::optional<SourcePosition> find(uint32_t offset) const {
+    auto it = std::upper_bound(this->checkpoints.begin(), this->checkpoints.end(), offset,
+                               [](uint32_t offset, const Checkpoint& entry) { return offset < entry.entry.offset; });
+    if (it == this->checkpoints.begin()) {
+      return std::nullopt;
+    }
+    it--;
+
+    Entry current = it->entry;
+    size_t cursor = it->data_offset;
+
+    Entry next = current;
+    while (cursor < this->data.size()) {
+      size_t next_cursor = cursor;
+      if (!read_entry(next_cursor, next) || next.offset > offset) {
+        break;
+      }
+      current = next;
+      cursor = next_cursor;
+    }
+
+    return current.position;
+  }
+
+  inline void each_entry(const std::function<void(const Entry&)>& callback) const {
+    Entry entry = {0, {0, 0}};
+    size_t cursor = 0;
+    while (cursor < this->data.size() && read_entry(cursor, entry)) {
+      callback(entry);
+    }
+  }
+
+  // Replaces the table with an encoded one, returns false if it is malformed
+  inline bool load(const uint8_t* encoded, size_t length) {
+    LineTable source;
+    source.data.assign(encoded, encoded + length);
+
+    LineTable table;
+    Entry entry = {0, {0, 0}};
+    size_t cursor = 0;
+    while (cursor < length) {
+      if (!source.read_entry(cursor, entry)) {
+        return false;
+      }
+      table.add(entry.offset, entry.position);
+    }
+
+    *this = std::move(table);
+    return true;
+  }
+
+  inline const std::vector<uint8_t>& encoded() const {
+    return this->data;
+  }
+
+  inline size_t size() const {
+    return this->entry_count;
+  }
+
+private:
+  static constexpr size_t kCheckpointInterval = 32;
+
+  // Decoded entry and the data offset of the entry following it
+  struct Checkpoint {
+    Entry entry;
+    uint32_t data_offset;
+  };
+
+  inline void write_varint(uint64_t value) {
+    while (value >= 0x80) {
+      this->data.push_back(static_cast<uint8_t>(value) | 0x80);
+      value >>= 7;
+    }
+    this->data.push_back(static_cast<uint8_t>(value));
+  }
+
+  inline bool read_varint(size_t& cursor, uint64_t& value) const {
+    value = 0;
+    for (uint32_t shift = 0; cursor < this->data.size() && shift < 64; shift += 7) {
+      uint8_t byte = this->data[cursor++];
+      value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if ((byte & 0x80) == 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Decodes the entry at cursor, which is stored relative to previous
+  inline bool read_entry(size_t& cursor, Entry& previous) const {
+    uint64_t offset_delta;
+    uint64_t line_delta;
+    uint64_t column;
+    if (!read_varint(cursor, offset_delta) || !read_varint(cursor, line_delta) || !read_varint(cursor, column)) {
+      return false;
+    }
+
+    previous.offset += offset_delta;
+    previous.position.line += zigzag_decode(line_delta);
+    previous.position.column = column;
+    return true;
+  }
+
+  static inline uint64_t zigzag_encode(int64_t value) {
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+  }
+
+  static inline int64_t zigzag_decode(uint64_t value) {
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+  }
+
+  std::vector<uint8_t> data;
+  std::vector<Checkpoint> checkpoints;
+  Entry last = {0, {0, 0}};
+  size_t entry_count = 0;
+};
+
 class InstructionBlock : public MemoryBlock {
 public:
+  // Protected instruction ranges, consulted only when an exception is thrown
+  //
+  // Entries of nested try statements are placed before the entries of the statements
+  // surrounding them, so the first matching entry is always the innermost one
+  std::vector<ExceptionTableEntry> exception_table;
+
+  // Offsets of all PutString instructions
+  //
+  // Their operands point into the string pool of the compiling process and
+  // have to be relocated when the block is loaded from the module cache
+  std::vector<uint32_t> string_references;
+
+  // Tables of BranchTable instructions, indexed by their first operand
+  std::vector<SwitchTable> branch_tables;
+
+  // Inlined function bodies, consulted only when a stack trace is created
+  //
+  // Like the exception table, nested entries are placed before the entries surrounding them
+  std::vector<InlinedFunctionEntry> inlined_functions;
+
+  // Source positions of the instructions, consulted only when a stack trace is created
+  LineTable line_table;
+
+  inline void add_exception_handler(uint32_t begin, uint32_t end, uint32_t handler) {
+    this->exception_table.push_back({begin, end, handler});
+  }
+
+  inline void add_inlined_function(uint32_t begin, uint32_t end, VALUE name) {
+    this->inlined_functions.push_back({begin, end, name});
+  }
+
+  // Returns the offset of the innermost handler protecting the instruction at offset
+  inline std::optional<uint32_t> find_exception_handler(uint32_t offset) {
+    for (const ExceptionTableEntry& entry : this->exception_table) {
+      if (offset >= entry.begin && offset < entry.end) {
+        return entry.handler;
+      }
+    }
+
+    return std::nullopt;
+  }
+
   inline void write_nop() {
     this->write(Opcode::Nop);
   }
@@ -47,6 +327,7 @@ public:
   inline void write_readmembersymbol(VALUE symbol) {
     this->write(Opcode::ReadMemberSymbol);
     this->write(symbol);
+    this->write_u32(0);
   }
 
   inline void write_readmembervalue() {
@@ -109,6 +390,7 @@ public:
   }
 
   inline void write_putstring(uint32_t offset, uint32_t length) {
+    this->string_references.push_back(this->writeoffset);
     this->write(Opcode::PutString);
     this->write(offset);
     this->write(length);
@@ -119,7 +401,8 @@ public:
                                 bool anonymous,
                                 bool needs_arguments,
                                 uint32_t argc,
-                                uint32_t lvarcount) {
+                                uint32_t lvarcount,
+                                uint32_t max_stack_depth) {
     this->write(Opcode::PutFunction);
     this->write(symbol);
     this->write(body_offset);
@@ -127,6 +410,7 @@ public:
     this->write(needs_arguments);
     this->write(argc);
     this->write(lvarcount);
+    this->write(max_stack_depth);
   }
 
   inline void write_putcfunction(VALUE symbol, uintptr_t funcptr, uint32_t argc) {
@@ -136,10 +420,11 @@ public:
     this->write(argc);
   }
 
-  inline void write_putgenerator(VALUE symbol, int32_t body_offset) {
+  inline void write_putgenerator(VALUE symbol, int32_t body_offset, uint32_t max_stack_depth) {
     this->write(Opcode::PutGenerator);
     this->write(symbol);
     this->write(body_offset);
+    this->write(max_stack_depth);
   }
 
   inline void write_putarray(uint32_t count) {
@@ -196,6 +481,22 @@ public:
     this->write(argc);
   }
 
+  inline void write_tailcall(uint32_t argc) {
+    this->write(Opcode::TailCall);
+    this->write(argc);
+  }
+
+  inline void write_tailcallmember(uint32_t argc) {
+    this->write(Opcode::TailCallMember);
+    this->write(argc);
+  }
+
+  inline void write_branchtable(uint32_t table_index) {
+    this->write(Opcode::BranchTable);
+    this->write(table_index);
+    this->write<uint32_t>(0);
+  }
+
   inline void write_return() {
     this->write(Opcode::Return);
   }
@@ -208,15 +509,6 @@ public:
     this->write(Opcode::Throw);
   }
 
-  inline void write_registercatchtable(int32_t offset) {
-    this->write(Opcode::RegisterCatchTable);
-    this->write(offset);
-  }
-
-  inline void write_popcatchtable() {
-    this->write(Opcode::PopCatchTable);
-  }
-
   inline void write_branch(int32_t offset) {
     this->write(Opcode::Branch);
     this->write(offset);
@@ -262,6 +554,15 @@ public:
     this->write(offset);
   }
 
+  inline void write_loopincrement(int32_t offset, uint32_t index, uint32_t level, VALUE step, Opcode comparison) {
+    this->write(Opcode::LoopIncrement);
+    this->write(offset);
+    this->write(index);
+    this->write(level);
+    this->write(step);
+    this->write(comparison);
+  }
+
   inline void write_operator(uint8_t opcode) {
     this->write(opcode);
   }
@@ -277,5 +578,50 @@ public:
   inline void write_typeof() {
     this->write(Opcode::Typeof);
   }
+
+  inline void write_readlocalmembersymbol(uint32_t index, uint32_t level, VALUE symbol) {
+    this->write(Opcode::ReadLocalMemberSymbol);
+    this->write(index);
+    this->write(level);
+    this->write(symbol);
+    this->write_u32(0);
+  }
+
+  inline void write_putselfmembersymbol(uint32_t level, VALUE symbol) {
+    this->write(Opcode::PutSelfMemberSymbol);
+    this->write(level);
+    this->write(symbol);
+    this->write_u32(0);
+  }
+
+  inline void write_readlocalpair(uint32_t index1, uint32_t level1, uint32_t index2, uint32_t level2) {
+    this->write(Opcode::ReadLocalPair);
+    this->write(index1);
+    this->write(level1);
+    this->write(index2);
+    this->write(level2);
+  }
+
+  inline void write_readglobal(uint32_t index) {
+    this->write(Opcode::ReadGlobal);
+    this->write(index);
+  }
+
+  inline void write_setglobalpush(uint32_t index) {
+    this->write(Opcode::SetGlobalPush);
+    this->write(index);
+  }
+
+  inline void write_setglobal(uint32_t index) {
+    this->write(Opcode::SetGlobal);
+    this->write(index);
+  }
+
+  inline void write_readglobalmembersymbol(uint32_t index, VALUE symbol) {
+    this->write(Opcode::ReadGlobalMemberSymbol);
+    this->write(index);
+    this->write(symbol);
+    this->write_u32(0);
+  }
 };
 }  // namespace Charly
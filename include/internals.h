@@ -24,9 +24,12 @@
  * SOFTWARE.
  */
 
+#include <optional>
+#include <string>
 #include <unordered_map>
 
 #include "defines.h"
+#include "native-binding.h"
 #include "value.h"
 
 #pragma once
@@ -50,16 +53,24 @@ static const std::unordered_map<std::string, std::string> kStandardCharlyLibrari
     {"_charly_string", "src/stdlib/primitives/string.ch"},
 
     // Libraries
+    {"_charly_fs", "src/stdlib/libs/fs.ch"},
+    {"_charly_isolate", "src/stdlib/libs/isolate.ch"},
+    {"_charly_json", "src/stdlib/libs/json.ch"},
     {"_charly_math", "src/stdlib/libs/math.ch"},
+    {"_charly_net", "src/stdlib/libs/net.ch"},
     {"_charly_time", "src/stdlib/libs/time.ch"},
+    {"_charly_typedarray", "src/stdlib/libs/typedarray.ch"},
     {"_charly_unittest", "src/stdlib/libs/unittest.ch"}
 };
 
 // The signature of an internal method
+//
+// Methods declared with typed parameters are called via their thunk
 struct InternalMethodSignature {
   std::string name;
   size_t argc;
   void* func_pointer;
+  CFunctionThunk thunk = nullptr;
 };
 
 #define CHECK(T, V)                                             \
@@ -78,9 +89,16 @@ struct InternalMethodSignature {
     }                                                           \
   }
 
+// Returns the canonical path of the file an import statement inside source_filename refers to
+std::optional<std::string> resolve_import_path(const std::string& include, const std::string& source_filename);
+
 VALUE import(VM& vm, VALUE filename, VALUE source);
+
+// Imports include the first time the name member of object is read
+VALUE lazy_import(VM& vm, VALUE object, VALUE name, VALUE include);
 VALUE get_method(VM& vm, VALUE argument);
 VALUE write(VM& vm, VALUE value);
+VALUE flush(VM& vm);
 VALUE getn(VM& vm);
 VALUE dirname(VM& vm);
 VALUE set_primitive_value(VM& vm, VALUE klass);
@@ -94,6 +112,8 @@ VALUE set_primitive_generator(VM& vm, VALUE klass);
 VALUE set_primitive_boolean(VM& vm, VALUE klass);
 VALUE set_primitive_null(VM& vm, VALUE klass);
 VALUE to_s(VM& vm, VALUE value);
+VALUE copy(VM& vm, VALUE value);
+VALUE deep_copy(VM& vm, VALUE value);
 
 VALUE defer(VM& vm, VALUE cb, VALUE dur);
 VALUE defer_interval(VM& vm, VALUE cb, VALUE period);
@@ -102,5 +122,17 @@ VALUE clear_interval(VM& vm, VALUE uid);
 VALUE exit(VM& vm, VALUE status_code);
 
 VALUE register_worker_task(VM& vm, VALUE v, VALUE cb);
+
+VALUE gc_stats(VM& vm);
+VALUE gc_write_heap_snapshot(VM& vm, VALUE path);
+VALUE gc_profile_allocations(VM& vm, VALUE interval);
+VALUE gc_allocation_sites(VM& vm);
+
+VALUE runtime_metrics(VM& vm);
+
+VALUE profiler_start(VM& vm, VALUE interval);
+VALUE profiler_stop(VM& vm);
+VALUE profiler_report(VM& vm);
+VALUE profiler_write(VM& vm, VALUE path);
 }  // namespace Internals
 }  // namespace Charly
@@ -0,0 +1,121 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "memoryblock.h"
+#include "typed-array.h"
+#include "utf8buffer.h"
+#include "value.h"
+
+#pragma once
+
+namespace Charly {
+class VM;
+
+// A value copied out of the heap of one isolate, recreated inside the heap of another
+//
+// Buffers and typed arrays are moved instead of copied, their storage is owned by the message
+// until it is received. Arrays which only contain immediate values share their storage with
+// the array of the sender, copy-on-write keeps both sides from seeing each others changes.
+// Strings pointing into the memory of a buffer keep pointing into it
+struct IsolateMessage {
+  struct ReleaseArrayStorage {
+    void operator()(ArrayStorage* storage) {
+      storage->release();
+    }
+  };
+
+  struct ReleaseSharedMemory {
+    void operator()(SharedMemory* memory) {
+      memory->release();
+    }
+  };
+
+  struct DestroyTypedArray {
+    void operator()(TypedArray* array) {
+      TypedArray::destructor(array);
+    }
+  };
+
+  MemoryBlock data;
+  std::vector<std::unique_ptr<UTF8Buffer>> buffers;
+  std::vector<std::unique_ptr<ArrayStorage, ReleaseArrayStorage>> arrays;
+  std::vector<std::unique_ptr<SharedMemory, ReleaseSharedMemory>> memory;
+  std::vector<std::unique_ptr<TypedArray, DestroyTypedArray>> typed_arrays;
+};
+
+// Connects an isolate to the isolate which spawned it
+//
+// Each side pushes its messages into the inbox of the other side and wakes up its event loop.
+// The VM of a side is reset to null once it stops running
+struct IsolateChannel {
+  static constexpr uint32_t kParent = 0;
+  static constexpr uint32_t kChild = 1;
+
+  struct Side {
+    VM* vm = nullptr;
+    std::deque<IsolateMessage> inbox;
+  };
+
+  std::mutex mutex;
+  Side sides[2];
+
+  // Set once either side closed the channel, no more messages are delivered afterwards
+  bool closed = false;
+
+  // Set by the parent to stop the child after its current task
+  bool terminate = false;
+
+  // Set once the child has stopped, the parent then joins its thread
+  bool finished = false;
+  uint8_t status_code = 0;
+};
+
+// The local side of a channel, owned by the VM
+//
+// Children keep their parent running until they have stopped. Children themselves
+// keep running while they listen for messages of their parent
+struct IsolateHandle {
+  std::shared_ptr<IsolateChannel> channel;
+  uint32_t side;
+
+  // Invoked with every received message, messages are queued while this is null
+  VALUE on_message = kNull;
+
+  // Invoked with the status code of a child once it has stopped
+  VALUE on_exit = kNull;
+
+  // The thread running the child, only set on the side of the parent
+  std::thread thread;
+};
+
+}  // namespace Charly
@@ -0,0 +1,136 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "opcode.h"
+
+#pragma once
+
+namespace Charly {
+
+class VM;
+
+// Executes a single instruction on behalf of compiled code
+//
+// Returns the address of the instruction to execute next, or null if the VM halted
+typedef uint8_t* (*JITHelper)(VM* vm, uint8_t* ip);
+
+static constexpr uint32_t kDefaultJITThreshold = 1000;
+
+// Upper bound on the amount of instructions compiled per function
+static constexpr uint32_t kMaxJITInstructions = 16384;
+
+// Native code generated for a single function
+struct CompiledFunction {
+  std::string name;
+  uint8_t* entry;
+  void* code;
+  size_t code_size;
+  size_t mapping_size;
+  uint32_t instruction_count;
+};
+
+// Baseline compiler translating the bytecode of hot functions into native code
+//
+// Each instruction becomes a direct call to the helper of its opcode, followed by a
+// comparison of the returned address with the addresses the instruction can continue at.
+// Fallthrough and branch targets inside the function are reached via native jumps, so the
+// indirect jump of the interpreter's dispatch disappears. Locals, the stack and the frames
+// stay where the interpreter keeps them, which allows control to pass between native code
+// and the interpreter at any instruction boundary.
+//
+// Compiled code hands control back to the interpreter whenever execution continues somewhere
+// it didn't compile: calls into other functions, returns, thrown exceptions and opcodes without
+// a helper. The interpreter enters native code again at calls, returns and backward branches.
+//
+// Functions become hot once their calls and loop iterations reach the threshold.
+// Code generation is only implemented for x86-64, other architectures keep interpreting
+class JIT {
+public:
+  JIT(const JITHelper* helpers, bool enabled, uint32_t threshold, bool perf_map);
+  JIT(const JIT&) = delete;
+  JIT(JIT&&) = delete;
+  ~JIT();
+
+  static bool is_supported();
+
+  inline bool is_enabled() {
+    return this->enabled;
+  }
+
+  // Native code of the instruction at address, if the function containing it was compiled
+  inline void* lookup(uint8_t* address) {
+    auto it = this->entries.find(address);
+    return it != this->entries.end() ? it->second : nullptr;
+  }
+
+  // Counts a call or loop iteration of the function starting at entry
+  //
+  // Returns true exactly once, when the function becomes hot
+  inline bool record_execution(uint8_t* entry) {
+    uint32_t& count = this->counters[entry];
+    if (count < this->threshold) {
+      return ++count == this->threshold;
+    }
+    return false;
+  }
+
+  // Compiles the function starting at entry, returns false if it couldn't be compiled
+  bool compile(uint8_t* entry, const std::string& name);
+
+  // Runs native code until it hands control back to the interpreter
+  void execute(VM* vm, void* code);
+
+  inline const std::vector<CompiledFunction>& compiled_functions() {
+    return this->functions;
+  }
+
+private:
+  // Collects the addresses of all instructions reachable from entry, sorted by address
+  bool discover_instructions(uint8_t* entry, std::vector<uint8_t*>& instructions);
+
+  // Copies code into executable memory
+  void* map_code(const std::vector<uint8_t>& code, size_t& mapping_size);
+
+  bool enabled;
+  uint32_t threshold;
+  bool perf_map;
+  const JITHelper* helpers;
+
+  // Enters compiled code: saves a callee-saved register, stores the VM in it and jumps to the instruction
+  void (*trampoline)(VM* vm, void* code) = nullptr;
+  size_t trampoline_size = 0;
+
+  std::unordered_map<uint8_t*, uint32_t> counters;
+  std::unordered_map<uint8_t*, void*> entries;
+  std::vector<CompiledFunction> functions;
+};
+}  // namespace Charly
@@ -25,23 +25,32 @@
  */
 
 #include <iostream>
+#include <memory>
 #include <string>
 
 #pragma once
 
 namespace Charly::Compilation {
+
+// A position inside a source file
+//
+// The filename is shared between all locations of a file, since every token
+// and every AST node stores at least one location
 struct Location {
   uint32_t pos = 0;
   uint32_t row = 0;
   uint32_t column = 0;
   uint32_t length = 0;
-  std::string filename;
+  std::shared_ptr<const std::string> filename;
 
   Location() {
   }
-  Location(uint32_t p, uint32_t r, uint32_t c, uint32_t l, const std::string& s)
+  Location(uint32_t p, uint32_t r, uint32_t c, uint32_t l, const std::shared_ptr<const std::string>& s)
       : pos(p), row(r), column(c), length(l), filename(s) {
   }
+  Location(uint32_t p, uint32_t r, uint32_t c, uint32_t l, const std::string& s)
+      : pos(p), row(r), column(c), length(l), filename(std::make_shared<const std::string>(s)) {
+  }
   Location(const Location& o) : pos(o.pos), row(o.row), column(o.column), length(o.length), filename(o.filename) {
   }
   Location(Location&& o) : pos(o.pos), row(o.row), column(o.column), length(o.length), filename(std::move(o.filename)) {
@@ -68,7 +77,9 @@ struct Location {
   }
 
   inline void write_to_stream(std::ostream& stream) const {
-    stream << this->filename << ":" << this->row << ":" << this->column;
+    if (this->filename)
+      stream << *this->filename;
+    stream << ":" << this->row << ":" << this->column;
   }
 };
 }  // namespace Charly::Compilation
@@ -30,9 +30,11 @@ namespace Charly::Compilation {
 
   // Different types of locations
   //
-  // Values can either be stored inside a stack frame, on the stack or inside a frames arguments.
+  // Values can either be stored inside a stack frame, on the stack, inside a frames arguments
+  // or inside one of the global slots of the top level frame.
   enum LocationType : uint8_t {
     LocFrame,
+    LocGlobal,
     LocArguments,
     LocSelf,
     LocStack,
@@ -49,6 +51,10 @@ namespace Charly::Compilation {
       return { .type = LocationType::LocFrame, .as_frame = { index, level } };
     }
 
+    static ValueLocation global(uint32_t index) {
+      return { .type = LocationType::LocGlobal, .as_global = { index } };
+    }
+
     static ValueLocation stack(uint32_t offset) {
       return { .type = LocationType::LocStack, .as_stack = { offset } };
     }
@@ -87,6 +93,10 @@ namespace Charly::Compilation {
         uint32_t level;
       } as_frame;
 
+      struct {
+        uint32_t index;
+      } as_global;
+
       struct {
         uint32_t offset;
       } as_stack;
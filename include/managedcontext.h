@@ -36,21 +36,15 @@ namespace Charly {
 class ManagedContext {
 private:
   VM& vm;
-  std::vector<VALUE> temporaries;
+  HandleScope handles;
 
 public:
-  ManagedContext(VM& t_vm) : vm(t_vm) {
-  }
-  ~ManagedContext() {
-    for (auto& temp : this->temporaries) {
-      this->vm.gc.unmark_persistent(temp);
-    }
+  ManagedContext(VM& t_vm) : vm(t_vm), handles(t_vm.gc) {
   }
 
   template <class T>
   inline T mark_in_gc(T&& value) {
-    this->vm.gc.mark_persistent(reinterpret_cast<VALUE>(value));
-    this->temporaries.push_back(reinterpret_cast<VALUE>(value));
+    this->handles.add(reinterpret_cast<VALUE>(value));
     return value;
   }
 
@@ -59,11 +53,6 @@ public:
     return mark_in_gc(this->vm.create_frame(std::forward<Args>(params)...));
   }
 
-  template <typename... Args>
-  inline CatchTable* create_catchtable(Args&&... params) {
-    return mark_in_gc(this->vm.create_catchtable(std::forward<Args>(params)...));
-  }
-
   template <typename... Args>
   inline VALUE create_object(Args&&... params) {
     return mark_in_gc(this->vm.create_object(std::forward<Args>(params)...));
@@ -24,11 +24,15 @@
  * SOFTWARE.
  */
 
+#include <algorithm>
 #include <cstdint>
+#include <cstdlib>
 #include <cstring>
 #include <string>
 #include <vector>
 
+#include "shared-memory.h"
+
 #pragma once
 
 namespace Charly {
@@ -45,10 +49,14 @@ public:
     this->capacity = kInitialCapacity;
     this->writeoffset = 0;
   }
+
+  // Creates a block over memory of a shared owner, the block takes over the passed reference
+  //
+  // The bytes are copied into a private allocation once the block has to grow
+  MemoryBlock(SharedMemory* owner, uint8_t* data, size_t size) : data(data), capacity(size), writeoffset(size), owner(owner) {
+  }
   ~MemoryBlock() {
-    if (this->data) {
-      std::free(this->data);
-    }
+    this->free_data();
   }
   MemoryBlock(const MemoryBlock& other) : data(nullptr) {
     this->data = reinterpret_cast<uint8_t*>(std::malloc(other.capacity));
@@ -60,36 +68,37 @@ public:
     this->data = other.data;
     this->capacity = other.capacity;
     this->writeoffset = other.writeoffset;
+    this->owner = other.owner;
     other.data = nullptr;
     other.capacity = 0;
     other.writeoffset = 0;
+    other.owner = nullptr;
   }
   MemoryBlock& operator=(const MemoryBlock& other) {
     if (this != &other) {
-      if (this->data) {
-        std::free(this->data);
-      }
+      this->free_data();
       this->data = reinterpret_cast<uint8_t*>(std::malloc(other.capacity));
       std::memcpy(this->data, other.data, other.capacity);
       this->capacity = other.capacity;
       this->writeoffset = other.writeoffset;
+      this->owner = nullptr;
     }
 
     return *this;
   }
   MemoryBlock& operator=(MemoryBlock&& other) {
     if (this != &other) {
-      if (this->data) {
-        std::free(this->data);
-      }
+      this->free_data();
 
       this->data = other.data;
       this->capacity = other.capacity;
       this->writeoffset = other.writeoffset;
+      this->owner = other.owner;
 
       other.data = nullptr;
       other.capacity = 0;
       other.writeoffset = 0;
+      other.owner = nullptr;
     }
 
     return *this;
@@ -99,17 +108,52 @@ public:
   inline void grow_to_fit(size_t size) {
     if (this->capacity < size) {
       // Calculate the new size
-      size_t new_size = this->capacity;
+      size_t new_size = std::max(this->capacity, kInitialCapacity);
       while (new_size < size) {
         new_size *= kGrowthFactor;
       }
 
+      // Shared memory can't be resized, the block switches to a private copy
+      if (this->owner) {
+        this->detach(new_size);
+        return;
+      }
+
       // Realloc the data to fit the new size
       this->data = reinterpret_cast<uint8_t*>(std::realloc(this->data, new_size));
       this->capacity = new_size;
     }
   }
 
+  // Pins the memory of this block, so that slices and strings can point into it
+  //
+  // Returns a new reference to the owner of the memory. The bytes in front of the write
+  // offset are never modified by appending to the block
+  inline SharedMemory* share() {
+    if (!this->owner) {
+      this->owner = new HeapMemory(this->data, this->capacity);
+    }
+
+    return this->owner->retain();
+  }
+
+  // Switches to a private copy of shared memory before it is modified in place
+  inline void make_exclusive() {
+    if (this->owner && !this->owner->is_exclusive()) {
+      this->detach(this->capacity);
+    }
+  }
+
+  // Discards the contents of the block while keeping its memory for reuse
+  //
+  // Memory still referenced by slices or strings is left to them
+  inline void clear() {
+    this->writeoffset = 0;
+    if (this->owner && !this->owner->is_exclusive()) {
+      this->detach(std::max(this->capacity, kInitialCapacity));
+    }
+  }
+
   // Append data to the end of the internal buffer
   // Automatically grows the buffer to fit
   template <typename T>
@@ -153,13 +197,20 @@ public:
   }
 
   // Write a block of memory into the internal buffer
-  inline uint32_t write_block(uint8_t* data, size_t size) {
+  inline uint32_t write_block(const uint8_t* data, size_t size) {
     this->grow_to_fit(this->writeoffset + size);
     memcpy(this->data + this->writeoffset, data, size);
     this->writeoffset += size;
     return size;
   }
 
+  // Write a block of memory at a given offset, the block grows if the data reaches past the write offset
+  inline void overwrite_block(size_t offset, const uint8_t* data, size_t size) {
+    this->grow_to_fit(offset + size);
+    memcpy(this->data + offset, data, size);
+    this->writeoffset = std::max(this->writeoffset, offset + size);
+  }
+
   // Write a string into the internal buffer
   inline uint32_t write_string(const std::string& data) {
     this->grow_to_fit(this->writeoffset + data.size());
@@ -168,6 +219,19 @@ public:
     return data.size();
   }
 
+  // Returns a pointer to the unused space behind the write offset, which can hold at least size bytes
+  //
+  // Data written into that space directly, for example by a read syscall, is added to the
+  // block via advance_writeoffset
+  inline uint8_t* reserve_tail(size_t size) {
+    this->grow_to_fit(this->writeoffset + size);
+    return this->data + this->writeoffset;
+  }
+
+  inline void advance_writeoffset(size_t count) {
+    this->writeoffset += count;
+  }
+
   // Read data from a given offset
   template <typename T>
   inline T& read(uint32_t offset) {
@@ -185,7 +249,7 @@ public:
   }
 
   // Returns the capacity of this memory block
-  inline uint32_t get_capacity() {
+  inline size_t get_capacity() {
     return this->capacity;
   }
 
@@ -197,6 +261,27 @@ public:
 protected:
   uint8_t* data;
   size_t capacity = kInitialCapacity;
-  uint32_t writeoffset = 0;
+  size_t writeoffset = 0;
+
+  // Set if the data belongs to a shared owner instead of this block
+  SharedMemory* owner = nullptr;
+
+private:
+  inline void free_data() {
+    if (this->owner) {
+      this->owner->release();
+    } else if (this->data) {
+      std::free(this->data);
+    }
+  }
+
+  inline void detach(size_t new_capacity) {
+    uint8_t* copy = reinterpret_cast<uint8_t*>(std::malloc(new_capacity));
+    std::memcpy(copy, this->data, std::min(this->writeoffset, new_capacity));
+    this->owner->release();
+    this->owner = nullptr;
+    this->data = copy;
+    this->capacity = new_capacity;
+  }
 };
 }  // namespace Charly
@@ -0,0 +1,104 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "instructionblock.h"
+#include "runflags.h"
+#include "stringpool.h"
+#include "symboltable.h"
+
+#pragma once
+
+namespace Charly::Compilation {
+
+// Bump this whenever the layout of cache files or the emitted bytecode changes
+static constexpr uint32_t kModuleCacheFormatVersion = 12;
+static constexpr uint32_t kModuleCacheMagic = 0x43484d43;  // CHMC
+
+// Fixed size header at the beginning of each cache file
+//
+// The header is followed by the raw bytes of the instructionblock, its exception
+// table, its branch tables, its inlined function ranges, its encoded line table, the strings referenced
+// by PutString instructions, the symbols used by the module and the string literals of its import statements
+struct ModuleCacheHeader {
+  uint32_t magic;
+  uint32_t format_version;
+  uint64_t build_fingerprint;
+  uint64_t source_hash;
+  uint64_t source_length;
+  uint32_t block_size;
+  uint32_t exception_count;
+  uint32_t branch_table_count;
+  uint32_t inlined_function_count;
+  uint32_t line_table_size;
+  uint32_t string_count;
+  uint32_t symbol_count;
+  uint32_t import_count;
+};
+
+// Stores compiled modules on disk, keyed by a hash of their source
+//
+// Cached modules are stored before they are executed for the first time, so the
+// bytecode contains no quickened instructions or inline cache indices yet.
+// String pool offsets are relocated into the pool of the loading process.
+//
+// The cache directory is read from the CHARLY_MODULE_CACHE environment variable,
+// and defaults to the .module-cache folder inside CHARLYVMDIR
+class ModuleCache {
+public:
+  ModuleCache(const RunFlags& flags);
+
+  inline bool is_enabled() {
+    return this->directory.size() > 0;
+  }
+
+  // Returns a copy of the cached block for this source, if there is a valid one
+  //
+  // The import statements of the module are appended to imports
+  std::optional<InstructionBlock*> load(const std::string& source,
+                                        SymbolTable& symtable,
+                                        StringPool& stringpool,
+                                        std::vector<std::string>& imports);
+
+  // Writes a freshly compiled block to the cache
+  //
+  // Failures are ignored, the module is simply compiled again the next time
+  void store(const std::string& source,
+             InstructionBlock* block,
+             const std::unordered_map<VALUE, std::string>& symbols,
+             StringPool& stringpool,
+             const std::vector<std::string>& imports);
+
+private:
+  std::string path_for_source(const std::string& source);
+
+  std::string directory;
+};
+}  // namespace Charly::Compilation
@@ -0,0 +1,263 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <optional>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "defines.h"
+#include "value.h"
+
+#pragma once
+
+namespace Charly {
+
+// Typed bindings for native functions
+//
+// Instead of receiving raw VALUEs and checking their types by hand, a native function
+// can be declared with regular C++ parameter and return types:
+//
+//   double sqrt(double n);
+//   VALUE push(VM& vm, VALUE array, VALUE item);
+//   double rand(std::optional<double> min, std::optional<double> max);
+//   VALUE print(VM& vm, NativeArguments arguments);
+//
+// NativeBinding<F>::thunk type checks and unpacks the arguments passed by the VM and boxes the
+// return value. The VM calls the thunk directly via the CFunction::thunk field, without going
+// through the arity switch used for untyped functions.
+//
+// The first parameter may optionally be a VM&. std::optional<T> parameters are optional
+// arguments and a trailing NativeArguments parameter receives all remaining arguments.
+
+// The remaining arguments passed to a variadic native function
+struct NativeArguments {
+  uint32_t argc;
+  VALUE* argv;
+
+  inline VALUE operator[](uint32_t index) const {
+    return this->argv[index];
+  }
+};
+
+// Throws an exception inside the VM, stating that an argument had the wrong type
+//
+// Defined in internals.cpp so this header doesn't depend on the VM class
+namespace Internals {
+void native_argument_error(VM& vm, uint32_t index, const char* expected);
+}
+
+// Conversion between VALUEs and the C++ types native functions can be declared with
+template <typename T>
+struct NativeType;
+
+template <>
+struct NativeType<VALUE> {
+  static constexpr const char* kName = "value";
+  static inline bool check(VALUE) {
+    return true;
+  }
+  static inline VALUE unpack(VALUE value) {
+    return value;
+  }
+  static inline VALUE pack(VALUE value) {
+    return value;
+  }
+};
+
+template <>
+struct NativeType<double> {
+  static constexpr const char* kName = "number";
+  static inline bool check(VALUE value) {
+    return charly_is_number(value);
+  }
+  static inline double unpack(VALUE value) {
+    return charly_number_to_double(value);
+  }
+  static inline VALUE pack(double value) {
+    return charly_create_number(value);
+  }
+};
+
+template <>
+struct NativeType<int32_t> {
+  static constexpr const char* kName = "number";
+  static inline bool check(VALUE value) {
+    return charly_is_number(value);
+  }
+  static inline int32_t unpack(VALUE value) {
+    return charly_number_to_int32(value);
+  }
+  static inline VALUE pack(int32_t value) {
+    return charly_create_number(value);
+  }
+};
+
+template <>
+struct NativeType<int64_t> {
+  static constexpr const char* kName = "number";
+  static inline bool check(VALUE value) {
+    return charly_is_number(value);
+  }
+  static inline int64_t unpack(VALUE value) {
+    return charly_number_to_int64(value);
+  }
+  static inline VALUE pack(int64_t value) {
+    return charly_create_number(value);
+  }
+};
+
+template <>
+struct NativeType<bool> {
+  static constexpr const char* kName = "boolean";
+  static inline bool check(VALUE value) {
+    return charly_is_boolean(value);
+  }
+  static inline bool unpack(VALUE value) {
+    return value == kTrue;
+  }
+  static inline VALUE pack(bool value) {
+    return value ? kTrue : kFalse;
+  }
+};
+
+template <>
+struct NativeType<std::string> {
+  static constexpr const char* kName = "string";
+  static inline bool check(VALUE value) {
+    return charly_is_string(value);
+  }
+  static inline std::string unpack(VALUE value) {
+    return charly_string_std(value);
+  }
+};
+
+// Reads a single argument from the arguments passed by the VM
+template <typename T>
+struct NativeParameter {
+  static constexpr bool kRequired = true;
+
+  static inline bool check(VM& vm, uint32_t index, uint32_t, VALUE* argv) {
+    if (!NativeType<T>::check(argv[index])) {
+      Internals::native_argument_error(vm, index, NativeType<T>::kName);
+      return false;
+    }
+    return true;
+  }
+
+  static inline T unpack(uint32_t index, uint32_t, VALUE* argv) {
+    return NativeType<T>::unpack(argv[index]);
+  }
+};
+
+template <typename T>
+struct NativeParameter<std::optional<T>> {
+  static constexpr bool kRequired = false;
+
+  static inline bool check(VM& vm, uint32_t index, uint32_t argc, VALUE* argv) {
+    return index >= argc || NativeParameter<T>::check(vm, index, argc, argv);
+  }
+
+  static inline std::optional<T> unpack(uint32_t index, uint32_t argc, VALUE* argv) {
+    if (index >= argc) {
+      return std::nullopt;
+    }
+    return NativeType<T>::unpack(argv[index]);
+  }
+};
+
+template <>
+struct NativeParameter<NativeArguments> {
+  static constexpr bool kRequired = false;
+
+  static inline bool check(VM&, uint32_t, uint32_t, VALUE*) {
+    return true;
+  }
+
+  static inline NativeArguments unpack(uint32_t index, uint32_t argc, VALUE* argv) {
+    if (index >= argc) {
+      return {0, nullptr};
+    }
+    return {argc - index, argv + index};
+  }
+};
+
+// Amount of arguments a native function can't be called without
+//
+// Counts the parameters up to the first optional or variadic one
+template <typename... Args>
+static constexpr uint32_t native_required_argc() {
+  uint32_t count = 0;
+  bool required[] = {NativeParameter<Args>::kRequired..., false};
+  while (required[count]) {
+    count++;
+  }
+  return count;
+}
+
+template <auto Fn, typename R, bool kTakesVM, typename... Args>
+struct NativeThunk {
+  static constexpr uint32_t kArgc = native_required_argc<Args...>();
+
+  static VALUE thunk(VM& vm, uint32_t argc, VALUE* argv) {
+    return invoke(vm, argc, argv, std::index_sequence_for<Args...>{});
+  }
+
+  template <size_t... I>
+  static inline VALUE invoke(VM& vm, uint32_t argc, VALUE* argv, std::index_sequence<I...>) {
+    // The exception for the first argument with a wrong type is thrown inside check
+    bool arguments_valid = (NativeParameter<Args>::check(vm, I, argc, argv) && ...);
+    if (!arguments_valid) {
+      return kNull;
+    }
+
+    if constexpr (std::is_void_v<R>) {
+      if constexpr (kTakesVM) {
+        Fn(vm, NativeParameter<Args>::unpack(I, argc, argv)...);
+      } else {
+        Fn(NativeParameter<Args>::unpack(I, argc, argv)...);
+      }
+      return kNull;
+    } else if constexpr (kTakesVM) {
+      return NativeType<R>::pack(Fn(vm, NativeParameter<Args>::unpack(I, argc, argv)...));
+    } else {
+      return NativeType<R>::pack(Fn(NativeParameter<Args>::unpack(I, argc, argv)...));
+    }
+  }
+};
+
+template <auto Fn, typename Signature = decltype(Fn)>
+struct NativeBinding;
+
+template <auto Fn, typename R, typename... Args>
+struct NativeBinding<Fn, R (*)(VM&, Args...)> : NativeThunk<Fn, R, true, Args...> {};
+
+template <auto Fn, typename R, typename... Args>
+struct NativeBinding<Fn, R (*)(Args...)> : NativeThunk<Fn, R, false, Args...> {};
+
+}  // namespace Charly
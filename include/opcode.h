@@ -33,7 +33,7 @@
 namespace Charly {
 // An opcode identifies a single instruction the machine can perform
 // Opcodes can have arguments
-const uint32_t kOpcodeCount = 66;
+const uint32_t kOpcodeCount = 86;
 enum Opcode : uint8_t {
 
   // Do nothing
@@ -49,8 +49,12 @@ enum Opcode : uint8_t {
 
   // Resolve symbol inside identifier
   //
+  // The cache argument is written as 0 by the compiler and is lazily
+  // replaced with the index of this site's inline cache by the VM
+  //
   // args:
   // - symbol
+  // - cache
   //
   // stack:
   // - identifier
@@ -178,6 +182,7 @@ enum Opcode : uint8_t {
   // - needs_arguments
   // - argc
   // - lvarcount
+  // - max_stack_depth
   PutFunction,
 
   // Put a function pointer onto the stack
@@ -193,6 +198,7 @@ enum Opcode : uint8_t {
   // args:
   // - symbol
   // - block_offset
+  // - max_stack_depth
   PutGenerator,
 
   // Put an array onto the stack, popping a given amount of values from the stack
@@ -282,16 +288,6 @@ enum Opcode : uint8_t {
   // - value
   Throw,
 
-  // Push a new catch table onto the machine
-  // WARNING: Offset is in bytes, no instruction length decoding is done
-  //
-  // args:
-  // - offset
-  RegisterCatchTable,
-
-  // Pop the current catch table off the catchstack
-  PopCatchTable,
-
   // Apply a given offset to the instruction pointer
   // WARNING: Offset is in bytes, no instruction length decoding is done
   //
@@ -438,7 +434,159 @@ enum Opcode : uint8_t {
   GCCollect,
 
   // Push the type of the uppermost value on the stack as a string
-  Typeof
+  Typeof,
+
+  // Superinstructions
+  //
+  // These combine common instruction sequences emitted by the code generator
+  // into a single instruction, saving a dispatch per sequence
+
+  // ReadLocal followed by a ReadMemberSymbol
+  //
+  // args:
+  // - index
+  // - level
+  // - symbol
+  // - cache
+  ReadLocalMemberSymbol,
+
+  // PutSelf followed by a ReadMemberSymbol
+  //
+  // args:
+  // - level
+  // - symbol
+  // - cache
+  PutSelfMemberSymbol,
+
+  // Two ReadLocal instructions
+  //
+  // args:
+  // - index of the first local
+  // - level of the first local
+  // - index of the second local
+  // - level of the second local
+  ReadLocalPair,
+
+  // Quickened instructions
+  //
+  // The code generator never emits these instructions. The VM rewrites a generic
+  // operator instruction into one of these once it has seen it being executed with
+  // two numbers. If a specialized instruction encounters an operand which isn't a number,
+  // it rewrites itself back into the generic instruction
+  //
+  // Each quickened instruction has the same length and arguments as its generic variant
+  AddNum,
+  SubNum,
+  MulNum,
+  LtNum,
+  GtNum,
+  LeNum,
+  GeNum,
+  BranchLtNum,
+  BranchGtNum,
+  BranchLeNum,
+  BranchGeNum,
+
+  // Call a function with argc arguments in tail position
+  //
+  // If the callee is a regular function and the current frame doesn't belong to a generator,
+  // the frame of the current function is replaced by the callee's frame. The callee then
+  // returns directly into the caller of the current function
+  //
+  // Otherwise this behaves exactly like a Call instruction. The code generator always
+  // follows this instruction with a Return and never emits it inside try blocks
+  //
+  // args:
+  // - argc
+  //
+  // stack:
+  // - function
+  // - arguments
+  TailCall,
+
+  // Call a function with argc arguments and a target in tail position
+  //
+  // args:
+  // - argc
+  //
+  // stack:
+  // - target
+  // - function
+  // - arguments
+  TailCallMember,
+
+  // Select the block of a switch statement via a branch table of the instructionblock
+  //
+  // If the value is an integer or string and the table contains keys of that type,
+  // branches to the block the value selects, or to the default block if no key matches.
+  // Otherwise execution continues with the next instruction, the comparison chain
+  // of the switch statement. The value is left on the stack
+  //
+  // args:
+  // - table index
+  // - cache index
+  //
+  // stack:
+  // - value
+  BranchTable,
+
+  // Advance the counter of a counted loop and branch back to the start of its body
+  //
+  // Adds step to the local variable at a given index and level and compares the result
+  // to the bound popped off the stack via the comparison of the given branch opcode.
+  // Branches by offset unless the comparison holds, so the loop exits exactly when the
+  // loop condition would have branched out of it. Integer counters are advanced and
+  // compared without going through the generic operator implementations
+  //
+  // args:
+  // - offset
+  // - index
+  // - level
+  // - step
+  // - comparison (BranchLt, BranchGt, BranchLe or BranchGe)
+  //
+  // stack:
+  // - bound
+  LoopIncrement,
+
+  // Global slots
+  //
+  // Names declared in the top level frame (Charly, the primitive classes, print, ...) are
+  // resolved to their slot index by the compiler. These instructions access the top level
+  // frame of the VM directly instead of walking up the environment chain of the current frame
+
+  // Read the global at a given index
+  //
+  // args:
+  // - index
+  ReadGlobal,
+
+  // Pop a value off the stack and write it to the global at a given index
+  // Pushes the value back onto the stack
+  //
+  // args:
+  // - index
+  //
+  // stack:
+  // - value
+  SetGlobalPush,
+
+  // Same as the SetGlobalPush instruction, except it doesn't push the value onto the stack
+  //
+  // args:
+  // - index
+  //
+  // stack:
+  // - value
+  SetGlobal,
+
+  // ReadGlobal followed by a ReadMemberSymbol
+  //
+  // args:
+  // - index
+  // - symbol
+  // - cache
+  ReadGlobalMemberSymbol
 };
 
 // clang-format off
@@ -446,7 +594,7 @@ enum Opcode : uint8_t {
 static constexpr uint32_t kInstructionLengths[]{
   /* Nop */                   1,
   /* ReadLocal */             1 + sizeof(uint32_t) + sizeof(uint32_t),
-  /* ReadMemberSymbol */      1 + sizeof(VALUE),
+  /* ReadMemberSymbol */      1 + sizeof(VALUE) + sizeof(uint32_t),
   /* ReadMemberValue */       1,
   /* ReadArrayIndex */        1 + sizeof(uint32_t),
   /* SetLocalPush */          1 + sizeof(uint32_t) + sizeof(uint32_t),
@@ -460,9 +608,9 @@ static constexpr uint32_t kInstructionLengths[]{
   /* PutSelf */               1 + sizeof(uint32_t),
   /* PutValue */              1 + sizeof(VALUE),
   /* PutString */             1 + sizeof(uint32_t) + sizeof(uint32_t),
-  /* PutFunction */           1 + sizeof(VALUE) + sizeof(int32_t) + sizeof(bool) * 2 + sizeof(uint32_t) + sizeof(uint32_t),
+  /* PutFunction */           1 + sizeof(VALUE) + sizeof(int32_t) + sizeof(bool) * 2 + sizeof(uint32_t) * 3,
   /* PutCFunction */          1 + sizeof(VALUE) + sizeof(uintptr_t) + sizeof(uint32_t),
-  /* PutGenerator */          1 + sizeof(VALUE) + sizeof(int32_t),
+  /* PutGenerator */          1 + sizeof(VALUE) + sizeof(int32_t) + sizeof(uint32_t),
   /* PutArray */              1 + sizeof(uint32_t),
   /* PutHash */               1 + sizeof(uint32_t),
   /* PutClass */              1 + sizeof(VALUE) + sizeof(uint32_t) * 4 + sizeof(bool) + sizeof(bool),
@@ -475,8 +623,6 @@ static constexpr uint32_t kInstructionLengths[]{
   /* Return */                1,
   /* Yield */                 1,
   /* Throw */                 1,
-  /* RegisterCatchTable */    1 + sizeof(int32_t),
-  /* PopCatchTable */         1,
   /* Branch */                1 + sizeof(uint32_t),
   /* BranchIf */              1 + sizeof(uint32_t),
   /* BranchUnless */          1 + sizeof(uint32_t),
@@ -509,7 +655,29 @@ static constexpr uint32_t kInstructionLengths[]{
   /* UBNot */                 1,
   /* Halt */                  1,
   /* GCCollect */             1,
-  /* Typeof */                1
+  /* Typeof */                1,
+  /* ReadLocalMemberSymbol */ 1 + sizeof(uint32_t) + sizeof(uint32_t) + sizeof(VALUE) + sizeof(uint32_t),
+  /* PutSelfMemberSymbol */   1 + sizeof(uint32_t) + sizeof(VALUE) + sizeof(uint32_t),
+  /* ReadLocalPair */         1 + sizeof(uint32_t) * 4,
+  /* AddNum */                1,
+  /* SubNum */                1,
+  /* MulNum */                1,
+  /* LtNum */                 1,
+  /* GtNum */                 1,
+  /* LeNum */                 1,
+  /* GeNum */                 1,
+  /* BranchLtNum */           1 + sizeof(uint32_t),
+  /* BranchGtNum */           1 + sizeof(uint32_t),
+  /* BranchLeNum */           1 + sizeof(uint32_t),
+  /* BranchGeNum */           1 + sizeof(uint32_t),
+  /* TailCall */              1 + sizeof(uint32_t),
+  /* TailCallMember */        1 + sizeof(uint32_t),
+  /* BranchTable */           1 + sizeof(uint32_t) + sizeof(uint32_t),
+  /* LoopIncrement */         1 + sizeof(int32_t) + sizeof(uint32_t) * 2 + sizeof(VALUE) + sizeof(Opcode),
+  /* ReadGlobal */            1 + sizeof(uint32_t),
+  /* SetGlobalPush */         1 + sizeof(uint32_t),
+  /* SetGlobal */             1 + sizeof(uint32_t),
+  /* ReadGlobalMemberSymbol */ 1 + sizeof(uint32_t) + sizeof(VALUE) + sizeof(uint32_t)
 };
 
 // String representations of instruction opcodes
@@ -545,8 +713,6 @@ static std::string kOpcodeMnemonics[]{
   "return",
   "yield",
   "throw",
-  "registercatchtable",
-  "popcatchtable",
   "branch",
   "branchif",
   "branchunless",
@@ -579,7 +745,29 @@ static std::string kOpcodeMnemonics[]{
   "ubnot",
   "halt",
   "gccollect",
-  "typeof"
+  "typeof",
+  "readlocalmembersymbol",
+  "putselfmembersymbol",
+  "readlocalpair",
+  "addnum",
+  "subnum",
+  "mulnum",
+  "ltnum",
+  "gtnum",
+  "lenum",
+  "genum",
+  "branchltnum",
+  "branchgtnum",
+  "branchlenum",
+  "branchgenum",
+  "tailcall",
+  "tailcallmember",
+  "branchtable",
+  "loopincrement",
+  "readglobal",
+  "setglobalpush",
+  "setglobal",
+  "readglobalmembersymbol"
 };
 // clang-format on
 
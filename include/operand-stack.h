@@ -0,0 +1,158 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+#include "defines.h"
+
+#pragma once
+
+namespace Charly {
+
+// Free slots every frame reserves on top of the maximum stack depth of its function
+//
+// Covers the few values native code pushes without entering a frame of its own,
+// like the result of a native function or the return value of a generator
+static constexpr size_t kOperandStackRedZone = 16;
+
+// Amount of slots a stack starts out with once it is used for the first time
+static constexpr size_t kOperandStackInitialCapacity = 1024;
+
+// Contiguous stack of values the interpreter operates on
+//
+// The compiler computes the maximum stack depth of every function, which is reserved
+// once whenever a frame is entered. Pushes don't need to check the capacity of the
+// stack after that. Code which can't know how many values it will push uses push_back
+class OperandStack {
+public:
+  OperandStack() = default;
+  OperandStack(const OperandStack& other) {
+    *this = other;
+  }
+  OperandStack& operator=(const OperandStack& other) {
+    if (this != &other) {
+      this->top = this->base;
+      this->reserve(other.size());
+      std::copy(other.base, other.top, this->base);
+      this->top = this->base + other.size();
+    }
+    return *this;
+  }
+  ~OperandStack() {
+    delete[] this->base;
+  }
+
+  inline size_t size() const {
+    return this->top - this->base;
+  }
+
+  inline size_t capacity() const {
+    return this->limit - this->base;
+  }
+
+  inline VALUE* begin() const {
+    return this->base;
+  }
+
+  inline VALUE* end() const {
+    return this->top;
+  }
+
+  inline VALUE& operator[](size_t index) const {
+    return this->base[index];
+  }
+
+  inline VALUE& back() const {
+    return this->top[-1];
+  }
+
+  // Pushes a value into space which was reserved beforehand
+  inline void push(VALUE value) {
+    *this->top++ = value;
+  }
+
+  // Pushes a value, growing the stack if necessary
+  inline void push_back(VALUE value) {
+    if (this->top == this->limit) {
+      this->grow(1);
+    }
+    *this->top++ = value;
+  }
+
+  inline VALUE pop() {
+    return *--this->top;
+  }
+
+  inline void pop_back() {
+    this->top--;
+  }
+
+  // Drops all values above size, which can't be larger than the current size
+  inline void resize(size_t size) {
+    this->top = this->base + size;
+  }
+
+  inline void clear() {
+    this->top = this->base;
+  }
+
+  // Makes sure count values can be pushed without growing the stack
+  //
+  // Growing the stack moves it, pointers into it are invalidated
+  inline void reserve(size_t count) {
+    if (static_cast<size_t>(this->limit - this->top) < count) {
+      this->grow(count);
+    }
+  }
+
+  inline void swap(OperandStack& other) {
+    std::swap(this->base, other.base);
+    std::swap(this->top, other.top);
+    std::swap(this->limit, other.limit);
+  }
+
+private:
+  void grow(size_t count) {
+    size_t size = this->size();
+    size_t capacity = std::max(std::max(this->capacity() * 2, size + count), kOperandStackInitialCapacity);
+    VALUE* buffer = new VALUE[capacity];
+    if (this->base) {
+      std::memcpy(buffer, this->base, size * sizeof(VALUE));
+      delete[] this->base;
+    }
+    this->base = buffer;
+    this->top = buffer + size;
+    this->limit = buffer + capacity;
+  }
+
+  VALUE* base = nullptr;
+  VALUE* top = nullptr;
+  VALUE* limit = nullptr;
+};
+}  // namespace Charly
@@ -0,0 +1,127 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <charconv>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+#include "value.h"
+
+#pragma once
+
+namespace Charly {
+
+// Numbers are printed in fixed notation with 16 decimal places, integers without any
+//
+// The longest output is that of -DBL_MAX: 309 integer digits, the decimal point and 16 decimal places
+static constexpr size_t kFormattedNumberMaxLength = 1 + 309 + 1 + 16;
+
+// Writes a number into buffer, returns the amount of characters written
+inline size_t format_number(char* buffer, VALUE value) {
+  char* end = buffer + kFormattedNumberMaxLength;
+  std::to_chars_result result;
+  if (charly_is_int(value)) {
+    result = std::to_chars(buffer, end, charly_int_to_int64(value));
+  } else {
+    result = std::to_chars(buffer, end, charly_double_to_double(value), std::chars_format::fixed, 16);
+  }
+  return result.ptr - buffer;
+}
+
+// Growable character buffer values are formatted into
+//
+// Formatting into a buffer skips the locale and formatting state lookups std::ostream performs
+// for every insertion. The buffer keeps its capacity when it is cleared, so a reused buffer stops
+// allocating once it has grown to the size of the largest output
+class OutputBuffer {
+  std::string buffer;
+
+public:
+  inline OutputBuffer& operator<<(char c) {
+    this->buffer.push_back(c);
+    return *this;
+  }
+
+  inline OutputBuffer& operator<<(const char* str) {
+    this->buffer.append(str);
+    return *this;
+  }
+
+  inline OutputBuffer& operator<<(const std::string& str) {
+    this->buffer.append(str);
+    return *this;
+  }
+
+  inline OutputBuffer& operator<<(uint32_t number) {
+    char digits[16];
+    this->buffer.append(digits, std::to_chars(digits, digits + sizeof(digits), number).ptr - digits);
+    return *this;
+  }
+
+  // Addresses are written in hexadecimal
+  inline OutputBuffer& operator<<(const void* address) {
+    char digits[16];
+    uintptr_t value = reinterpret_cast<uintptr_t>(address);
+    this->buffer.append("0x");
+    this->buffer.append(digits, std::to_chars(digits, digits + sizeof(digits), value, 16).ptr - digits);
+    return *this;
+  }
+
+  inline void write(const char* data, size_t length) {
+    this->buffer.append(data, length);
+  }
+
+  inline void write_number(VALUE value) {
+    char digits[kFormattedNumberMaxLength];
+    this->buffer.append(digits, format_number(digits, value));
+  }
+
+  inline void write_spaces(size_t count) {
+    this->buffer.append(count, ' ');
+  }
+
+  inline const char* data() const {
+    return this->buffer.data();
+  }
+
+  inline size_t size() const {
+    return this->buffer.size();
+  }
+
+  inline void clear() {
+    this->buffer.clear();
+  }
+
+  // Writes the contents to a stream and empties the buffer
+  inline void flush_to(std::ostream& stream) {
+    stream.write(this->buffer.data(), this->buffer.size());
+    stream.flush();
+    this->buffer.clear();
+  }
+};
+}  // namespace Charly
@@ -0,0 +1,76 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "instructionblock.h"
+#include "opcode.h"
+
+#pragma once
+
+namespace Charly::Compilation {
+
+// Describes a sequence of instructions which can be replaced by a cheaper one
+//
+// The rewrite function writes the replacement into the output block. It returns false,
+// without writing anything, if the operands of the matched instructions do not qualify.
+// Replacements must not contain instructions with relative offsets, those are not relocated.
+struct PeepholePattern {
+  std::string name;
+  std::vector<Opcode> sequence;
+  bool (*rewrite)(InstructionBlock& block, const uint32_t* offsets, InstructionBlock& output);
+};
+
+// Summary of the changes made to a block, displayed by the dump_asm flag
+struct PeepholeReport {
+  uint32_t size_before = 0;
+  uint32_t size_after = 0;
+  std::map<std::string, uint32_t> applied_patterns;
+};
+
+// Rewrites redundant instruction sequences of a fully assembled block
+//
+// Instructions which are the target of a branch, a function, a branch table, an
+// exception table entry or the boundary of an inlined function start a new sequence, so a pattern never spans across a label. All offsets
+// pointing into the block are relocated after instructions have been removed.
+class PeepholeOptimizer {
+public:
+  PeepholeOptimizer(InstructionBlock& b) : block(b) {
+  }
+
+  void optimize();
+
+  PeepholeReport report;
+
+private:
+  // Returns true if any pattern was applied
+  bool run_pass();
+
+  InstructionBlock& block;
+};
+}  // namespace Charly::Compilation
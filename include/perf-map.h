@@ -0,0 +1,47 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#pragma once
+
+namespace Charly::PerfMap {
+
+// Symbols for code the native symbol tables don't describe
+//
+// Entries are appended to /tmp/perf-<pid>.map, which perf and other native profilers
+// consult for addresses they can't resolve via the symbols of the executable
+void add_symbol(const void* start, size_t size, const std::string& name);
+
+// Gives each handler of a computed goto dispatch table its own symbol
+//
+// Handlers are assumed to extend up to the next handler in memory, the last one
+// extends up to end. Tables which were already registered are skipped
+void add_dispatch_table(void* const* table, const std::string* names, size_t count, const void* end,
+                        const std::string& prefix);
+}  // namespace Charly::PerfMap
@@ -0,0 +1,96 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <cmath>
+#include <cstdint>
+#include <random>
+
+#pragma once
+
+namespace Charly {
+
+// xoshiro256** pseudo random number generator
+//
+// Much cheaper than the generators of the standard library, but not suitable for
+// cryptographic purposes. Each VM owns its own generator, which is seeded from
+// std::random_device unless the program seeds it explicitly
+class Random {
+public:
+  Random() {
+    std::random_device device;
+    this->seed((static_cast<uint64_t>(device()) << 32) | device());
+  }
+
+  // The state is derived from the seed via splitmix64, so similar seeds
+  // still produce unrelated sequences
+  inline void seed(uint64_t value) {
+    for (uint64_t& word : this->state) {
+      value += 0x9e3779b97f4a7c15;
+      uint64_t z = value;
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+      word = z ^ (z >> 31);
+    }
+  }
+
+  inline uint64_t next() {
+    uint64_t result = rotl(this->state[1] * 5, 7) * 9;
+    uint64_t t = this->state[1] << 17;
+
+    this->state[2] ^= this->state[0];
+    this->state[3] ^= this->state[1];
+    this->state[1] ^= this->state[2];
+    this->state[0] ^= this->state[3];
+    this->state[2] ^= t;
+    this->state[3] = rotl(this->state[3], 45);
+
+    return result;
+  }
+
+  // Returns a number in the range [0, 1)
+  inline double next_double() {
+    return (this->next() >> 11) * 0x1.0p-53;
+  }
+
+  // Returns two independent samples of the standard normal distribution
+  //
+  // Uses the Box-Muller transform
+  inline void next_normal_pair(double& first, double& second) {
+    double radius = std::sqrt(-2.0 * std::log(1.0 - this->next_double()));
+    double angle = 2.0 * M_PI * this->next_double();
+    first = radius * std::cos(angle);
+    second = radius * std::sin(angle);
+  }
+
+private:
+  static inline uint64_t rotl(uint64_t value, int amount) {
+    return (value << amount) | (value >> (64 - amount));
+  }
+
+  uint64_t state[4];
+};
+}  // namespace Charly
@@ -25,6 +25,7 @@
  */
 
 #include <algorithm>
+#include <cstdlib>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -51,14 +52,35 @@ struct RunFlags {
   bool asm_no_offsets = false;
   bool asm_no_branches = false;
   bool asm_no_func_branches = false;
+  bool asm_profile = false;
+  std::string asm_profile_output;
   bool skip_execution = false;
   bool instruction_profile = false;
+  std::string instruction_profile_order = "time";
+  bool sample_profile = false;
+  std::string sample_profile_output;
+  uint32_t sample_profile_interval = 0;
   bool trace_opcodes = false;
   bool trace_catchtables = false;
   bool trace_frames = false;
   bool trace_gc = false;
+  bool gc_stats = false;
+  uint32_t allocation_sample_interval = 0;
+  uint32_t metrics_interval = 0;
+  std::string metrics_output;
+  uint32_t max_heap_size = 0;
+  uint32_t task_allocation_budget = 0;
   bool verbose_addresses = false;
+  bool perf_map = false;
+  bool jit = false;
+  bool trace_jit = false;
+  uint32_t jit_threshold = 0;
   bool single_worker_thread = false;
+  uint32_t worker_threads = 0;
+  bool no_module_cache = false;
+  bool reload_modules = false;
+  bool no_parallel_compile = false;
+  bool no_peephole = false;
 
   RunFlags(int argc, char** argv, char** envp) {
     // Parse environment variables
@@ -79,6 +101,17 @@ struct RunFlags {
 
     bool append_to_flags = false;
     bool append_to_dump_files_include = false;
+    bool append_to_worker_threads = false;
+    bool append_to_instruction_profile_order = false;
+    bool append_to_asm_profile_output = false;
+    bool append_to_sample_profile_output = false;
+    bool append_to_sample_profile_interval = false;
+    bool append_to_allocation_sample_interval = false;
+    bool append_to_metrics_interval = false;
+    bool append_to_metrics_output = false;
+    bool append_to_max_heap_size = false;
+    bool append_to_task_allocation_budget = false;
+    bool append_to_jit_threshold = false;
 
     auto append_flag = [&](const std::string& flag) {
       if (!flag.compare("dump_ast"))
@@ -93,6 +126,15 @@ struct RunFlags {
         this->asm_no_branches = true;
       if (!flag.compare("asm_no_func_branches"))
         this->asm_no_func_branches = true;
+      if (!flag.compare("asm_profile")) {
+        this->asm_profile = true;
+        this->instruction_profile = true;
+      }
+      if (!flag.compare("asm_profile_output")) {
+        this->asm_profile = true;
+        this->instruction_profile = true;
+        append_to_asm_profile_output = true;
+      }
       if (!flag.compare("skipexec"))
         this->skip_execution = true;
       if (!flag.compare("trace_opcodes"))
@@ -103,14 +145,62 @@ struct RunFlags {
         this->trace_frames = true;
       if (!flag.compare("trace_gc"))
         this->trace_gc = true;
+      if (!flag.compare("gc_stats"))
+        this->gc_stats = true;
+      if (!flag.compare("allocation_profile") && this->allocation_sample_interval == 0)
+        this->allocation_sample_interval = 1;
+      if (!flag.compare("allocation_sample_interval"))
+        append_to_allocation_sample_interval = true;
+      if (!flag.compare("metrics_interval"))
+        append_to_metrics_interval = true;
+      if (!flag.compare("metrics_output"))
+        append_to_metrics_output = true;
+      if (!flag.compare("max_heap_size"))
+        append_to_max_heap_size = true;
+      if (!flag.compare("task_allocation_budget"))
+        append_to_task_allocation_budget = true;
       if (!flag.compare("verbose_addresses"))
         this->verbose_addresses = true;
+      if (!flag.compare("perf_map"))
+        this->perf_map = true;
+      if (!flag.compare("jit"))
+        this->jit = true;
+      if (!flag.compare("trace_jit"))
+        this->trace_jit = true;
+      if (!flag.compare("jit_threshold")) {
+        this->jit = true;
+        append_to_jit_threshold = true;
+      }
       if (!flag.compare("instruction_profile"))
         this->instruction_profile = true;
+      if (!flag.compare("instruction_profile_order")) {
+        this->instruction_profile = true;
+        append_to_instruction_profile_order = true;
+      }
+      if (!flag.compare("sample_profile"))
+        this->sample_profile = true;
+      if (!flag.compare("sample_profile_output")) {
+        this->sample_profile = true;
+        append_to_sample_profile_output = true;
+      }
+      if (!flag.compare("sample_profile_interval")) {
+        this->sample_profile = true;
+        append_to_sample_profile_interval = true;
+      }
       if (!flag.compare("dump_file_include"))
         append_to_dump_files_include = true;
       if (!flag.compare("single_worker_thread"))
         this->single_worker_thread = true;
+      if (!flag.compare("worker_threads"))
+        append_to_worker_threads = true;
+      if (!flag.compare("no_module_cache"))
+        this->no_module_cache = true;
+      if (!flag.compare("reload_modules"))
+        this->reload_modules = true;
+      if (!flag.compare("no_parallel_compile"))
+        this->no_parallel_compile = true;
+      if (!flag.compare("no_peephole"))
+        this->no_peephole = true;
       this->flags.push_back(flag);
     };
 
@@ -140,6 +230,105 @@ struct RunFlags {
         continue;
       }
 
+      // Set the maximum amount of async worker threads
+      //
+      // -fworker_threads 4
+      if (append_to_worker_threads) {
+        this->worker_threads = std::strtoul(arg.c_str(), nullptr, 10);
+        append_to_worker_threads = false;
+        continue;
+      }
+
+      // Set the column the instruction profile is sorted by
+      //
+      // -finstruction_profile_order count
+      if (append_to_instruction_profile_order) {
+        this->instruction_profile_order = arg;
+        append_to_instruction_profile_order = false;
+        continue;
+      }
+
+      // Write the annotations of the profiled disassembly to a file
+      //
+      // -fasm_profile_output profile.json
+      if (append_to_asm_profile_output) {
+        this->asm_profile_output = arg;
+        append_to_asm_profile_output = false;
+        continue;
+      }
+
+      // Write the collapsed stacks of the sampling profiler to a file
+      //
+      // -fsample_profile_output profile.folded
+      if (append_to_sample_profile_output) {
+        this->sample_profile_output = arg;
+        append_to_sample_profile_output = false;
+        continue;
+      }
+
+      // Set the sampling interval in microseconds
+      //
+      // -fsample_profile_interval 500
+      if (append_to_sample_profile_interval) {
+        this->sample_profile_interval = std::strtoul(arg.c_str(), nullptr, 10);
+        append_to_sample_profile_interval = false;
+        continue;
+      }
+
+      // Only attribute every nth allocation to its allocation site
+      //
+      // -fallocation_sample_interval 64
+      if (append_to_allocation_sample_interval) {
+        this->allocation_sample_interval = std::max(std::strtoul(arg.c_str(), nullptr, 10), 1ul);
+        append_to_allocation_sample_interval = false;
+        continue;
+      }
+
+      // Periodically write the runtime metrics
+      //
+      // -fmetrics_interval 1000
+      if (append_to_metrics_interval) {
+        this->metrics_interval = std::strtoul(arg.c_str(), nullptr, 10);
+        append_to_metrics_interval = false;
+        continue;
+      }
+
+      // Write the periodic runtime metrics to a file instead of stderr
+      //
+      // -fmetrics_output metrics.log
+      if (append_to_metrics_output) {
+        this->metrics_output = arg;
+        append_to_metrics_output = false;
+        continue;
+      }
+
+      // Limit the size of the heap, in megabytes
+      //
+      // -fmax_heap_size 512
+      if (append_to_max_heap_size) {
+        this->max_heap_size = std::strtoul(arg.c_str(), nullptr, 10);
+        append_to_max_heap_size = false;
+        continue;
+      }
+
+      // Limit the amount of memory a single task may allocate, in megabytes
+      //
+      // -ftask_allocation_budget 64
+      if (append_to_task_allocation_budget) {
+        this->task_allocation_budget = std::strtoul(arg.c_str(), nullptr, 10);
+        append_to_task_allocation_budget = false;
+        continue;
+      }
+
+      // Set the amount of calls and loop iterations after which functions are compiled
+      //
+      // -fjit_threshold 100
+      if (append_to_jit_threshold) {
+        this->jit_threshold = std::strtoul(arg.c_str(), nullptr, 10);
+        append_to_jit_threshold = false;
+        continue;
+      }
+
       // Check if there are enough characters for this argument
       // to be a single character flag
       if (arg.size() == 1) {
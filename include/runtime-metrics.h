@@ -0,0 +1,129 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#pragma once
+
+namespace Charly {
+
+// Distribution of latencies which may be recorded from multiple threads
+//
+// Bucket N counts latencies shorter than 2^N microseconds, the last bucket
+// counts all remaining latencies
+struct LatencyHistogram {
+  static constexpr size_t kBucketCount = 24;
+  std::atomic<uint64_t> buckets[kBucketCount] = {};
+  std::atomic<uint64_t> count = 0;
+  std::atomic<uint64_t> total = 0;
+  std::atomic<uint64_t> max = 0;
+
+  inline void record(uint64_t nanoseconds) {
+    size_t bucket = 0;
+    uint64_t limit = 1000;
+    while (bucket < kBucketCount - 1 && nanoseconds >= limit) {
+      bucket++;
+      limit *= 2;
+    }
+    this->buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    this->count.fetch_add(1, std::memory_order_relaxed);
+    this->total.fetch_add(nanoseconds, std::memory_order_relaxed);
+
+    uint64_t current = this->max.load(std::memory_order_relaxed);
+    while (nanoseconds > current && !this->max.compare_exchange_weak(current, nanoseconds)) {
+    }
+  }
+
+  inline void record(std::chrono::steady_clock::duration duration) {
+    auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+    this->record(static_cast<uint64_t>(nanoseconds > 0 ? nanoseconds : 0));
+  }
+
+  inline uint64_t average() const {
+    uint64_t samples = this->count.load(std::memory_order_relaxed);
+    return samples ? this->total.load(std::memory_order_relaxed) / samples : 0;
+  }
+
+  // Upper bound of the bucket containing the given percentile, in nanoseconds
+  inline uint64_t percentile(double p) const {
+    uint64_t samples = this->count.load(std::memory_order_relaxed);
+    if (samples == 0)
+      return 0;
+
+    uint64_t threshold = static_cast<uint64_t>(samples * p / 100.0);
+    uint64_t seen = 0;
+    uint64_t limit = 1000;
+    for (size_t bucket = 0; bucket < kBucketCount - 1; bucket++) {
+      seen += this->buckets[bucket].load(std::memory_order_relaxed);
+      if (seen > threshold)
+        return limit;
+      limit *= 2;
+    }
+
+    return this->max.load(std::memory_order_relaxed);
+  }
+};
+
+// Counters of the event loop inside VM::start_runtime, only modified by the VM thread
+struct EventLoopMetrics {
+  uint64_t tasks_executed = 0;
+  uint64_t max_task_queue_depth = 0;
+  uint64_t timers_fired = 0;
+
+  // Time spent blocked inside the event loop waiting for something to do
+  uint64_t idle_time = 0;
+
+  // Delay between the deadline of a timer and the start of its callback
+  LatencyHistogram timer_lateness;
+
+  // Delay between a task being queued and the start of its callback
+  LatencyHistogram task_queue_wait;
+
+  std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+};
+
+// Counters of a WorkerPool, modified by the worker threads
+struct WorkerPoolMetrics {
+  std::atomic<uint64_t> tasks_completed = 0;
+
+  // Time the threads spent executing tasks
+  std::atomic<uint64_t> busy_time = 0;
+
+  // Delay between a task being submitted and a thread taking it
+  LatencyHistogram queue_wait;
+};
+
+// Named values of a metrics snapshot, in the order they are reported
+//
+// Durations are reported in microseconds
+using RuntimeMetricsReport = std::vector<std::pair<std::string, double>>;
+}  // namespace Charly
@@ -0,0 +1,128 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#pragma once
+
+namespace Charly {
+
+static constexpr std::chrono::microseconds kDefaultSampleInterval{1000};
+
+// Self and total sample counts of a single function
+struct ProfiledFunction {
+  std::string name;
+  uint64_t self_samples;
+  uint64_t total_samples;
+};
+
+// Samples the call stack of a VM at a fixed interval
+//
+// A timer thread only raises a flag, the VM itself records the sample once it
+// reaches its next safepoint (calls, returns and backward branches). Walking the
+// frame chain therefore never races with the interpreter.
+//
+// Functions are identified by the address of their body and are only named the
+// first time they show up in a sample
+class SamplingProfiler {
+public:
+  SamplingProfiler() = default;
+  SamplingProfiler(const SamplingProfiler&) = delete;
+  SamplingProfiler(SamplingProfiler&&) = delete;
+  ~SamplingProfiler() {
+    this->stop();
+  }
+
+  void start(std::chrono::microseconds interval = kDefaultSampleInterval);
+  void stop();
+
+  inline bool is_running() {
+    return this->timer.joinable();
+  }
+
+  // Checked by the VM at each safepoint
+  inline bool sample_due() {
+    return this->sample_requested.load(std::memory_order_relaxed);
+  }
+
+  // Returns the id of a function, describe is only invoked for functions which weren't seen before
+  template <typename Fn>
+  inline uint32_t function_id(const void* key, Fn&& describe) {
+    auto it = this->function_ids.find(key);
+    if (it != this->function_ids.end()) {
+      return it->second;
+    }
+
+    uint32_t id = this->function_names.size();
+    this->function_names.push_back(describe());
+    this->function_ids.emplace(key, id);
+    return id;
+  }
+
+  // Records a stack of function ids, ordered from the outermost to the innermost frame
+  inline void add_sample(const std::vector<uint32_t>& stack) {
+    this->sample_requested.store(false, std::memory_order_relaxed);
+    this->stacks[stack] += 1;
+    this->samples += 1;
+  }
+
+  inline uint64_t sample_count() {
+    return this->samples;
+  }
+
+  void clear();
+
+  // Functions sorted by their self samples
+  std::vector<ProfiledFunction> functions() const;
+
+  // Writes one line per distinct stack in the collapsed format read by flamegraph.pl
+  void write_collapsed(std::ostream& out) const;
+
+  // Writes a table of the functions with the most self samples
+  void write_summary(std::ostream& out, uint32_t count = 25) const;
+
+private:
+  std::thread timer;
+  std::mutex timer_mutex;
+  std::condition_variable timer_cv;
+  bool stopping = false;
+  std::atomic<bool> sample_requested = false;
+
+  std::unordered_map<const void*, uint32_t> function_ids;
+  std::vector<std::string> function_names;
+  std::map<std::vector<uint32_t>, uint64_t> stacks;
+  uint64_t samples = 0;
+};
+}  // namespace Charly
@@ -0,0 +1,119 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include "defines.h"
+
+#pragma once
+
+namespace Charly {
+
+// Objects can hold at most this many properties before they are
+// switched into dictionary mode
+static constexpr uint32_t kShapeMaxSlotCount = 64;
+
+// Limits on the amount of children of a single shape and on the amount of shapes inside a tree
+//
+// Objects which would need a shape beyond these limits are switched into dictionary mode,
+// so objects with ever changing keys can't grow the shape tree without bound
+static constexpr uint32_t kShapeMaxTransitionCount = 256;
+static constexpr uint32_t kShapeMaxCount = 1 << 14;
+
+// Describes the layout of an object
+//
+// Objects which had the same properties added in the same order share the same shape.
+// A shape maps the symbols of these properties to slot indices into the slot storage of the object.
+//
+// Shapes form a tree which is rooted at the empty shape of the VM. Adding a new property to an
+// object moves it to the corresponding child shape. Shapes are never deallocated while the VM
+// is running, the root shape owns all of its children. Since shapes are never freed, the tree
+// stops growing once it reaches one of the limits above.
+struct Shape {
+  Shape* root;
+  Shape* parent;
+  std::vector<VALUE> keys;
+  std::unordered_map<VALUE, uint32_t> offsets;
+  std::unordered_map<VALUE, Shape*> transitions;
+
+  // Amount of shapes inside the tree, only maintained by the root shape
+  uint32_t tree_size = 1;
+
+  Shape() : root(this), parent(nullptr) {
+  }
+
+  Shape(Shape* p, VALUE key) : root(p->root), parent(p), keys(p->keys), offsets(p->offsets) {
+    this->offsets[key] = this->keys.size();
+    this->keys.push_back(key);
+  }
+
+  Shape(const Shape&) = delete;
+  Shape(Shape&&) = delete;
+
+  ~Shape() {
+    for (auto& entry : this->transitions) {
+      delete entry.second;
+    }
+  }
+
+  // Returns the slot index of a given key
+  inline std::optional<uint32_t> lookup(VALUE key) {
+    auto it = this->offsets.find(key);
+    if (it == this->offsets.end()) {
+      return std::nullopt;
+    }
+
+    return it->second;
+  }
+
+  // Returns the shape an object ends up with once the key is added to it
+  //
+  // Returns nullptr if the new shape would exceed one of the limits of the
+  // shape tree, the object has to be switched into dictionary mode instead
+  inline Shape* transition(VALUE key) {
+    auto it = this->transitions.find(key);
+    if (it != this->transitions.end()) {
+      return it->second;
+    }
+
+    if (this->slot_count() >= kShapeMaxSlotCount || this->transitions.size() >= kShapeMaxTransitionCount ||
+        this->root->tree_size >= kShapeMaxCount) {
+      return nullptr;
+    }
+
+    Shape* child = new Shape(this, key);
+    this->transitions[key] = child;
+    this->root->tree_size++;
+    return child;
+  }
+
+  inline uint32_t slot_count() {
+    return this->keys.size();
+  }
+};
+}  // namespace Charly
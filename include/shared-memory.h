@@ -0,0 +1,77 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+
+#pragma once
+
+namespace Charly {
+
+// Reference counted owner of a region of memory
+//
+// Buffers, slices of them and strings created from them can point into the same memory,
+// each of them holds a reference to its owner. The memory is released once the last
+// reference is gone. References may be held by different isolates
+struct SharedMemory {
+  std::atomic<uint32_t> refcount;
+  uint8_t* data;
+  size_t size;
+
+  // Read-only memory, like a file mapped without write access, is never modified in place
+  bool writable;
+
+  SharedMemory(uint8_t* data, size_t size, bool writable) : refcount(1), data(data), size(size), writable(writable) {
+  }
+  virtual ~SharedMemory() = default;
+
+  inline SharedMemory* retain() {
+    this->refcount.fetch_add(1, std::memory_order_relaxed);
+    return this;
+  }
+
+  inline void release() {
+    if (this->refcount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      delete this;
+    }
+  }
+
+  // Returns true if the memory can be modified without anyone else observing the change
+  inline bool is_exclusive() {
+    return this->writable && this->refcount.load(std::memory_order_acquire) == 1;
+  }
+};
+
+// Memory allocated via malloc
+struct HeapMemory : public SharedMemory {
+  HeapMemory(uint8_t* data, size_t size) : SharedMemory(data, size, true) {
+  }
+  ~HeapMemory() {
+    std::free(this->data);
+  }
+};
+}  // namespace Charly
@@ -0,0 +1,79 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <sys/socket.h>
+
+#include <deque>
+#include <string>
+
+#include "value.h"
+
+#pragma once
+
+namespace Charly {
+
+// A non-blocking socket owned by the VM and registered with its event loop
+//
+// The callbacks stored inside a socket are visited by the garbage collector until it is closed
+struct Socket {
+  enum class Kind : uint8_t {
+    Listener,  // TCP socket accepting connections
+    Stream,    // TCP connection
+    Datagram   // UDP socket
+  };
+
+  // Data which could not be sent immediately
+  //
+  // Datagrams remember their destination address
+  struct PendingWrite {
+    std::string data;
+    size_t offset = 0;
+    VALUE cb = kNull;
+    sockaddr_storage address = {};
+    socklen_t address_length = 0;
+  };
+
+  Kind kind;
+  int fd;
+
+  // Set while a connection attempt is in progress
+  bool connecting = false;
+
+  // Listeners invoke this for every accepted connection, streams once they are connected
+  VALUE on_connect = kNull;
+
+  // Invoked with every chunk of received data, reading is paused while this is null
+  VALUE on_read = kNull;
+
+  std::deque<PendingWrite> writes;
+  size_t pending_bytes = 0;
+
+  // The events the socket is currently registered for in the event loop
+  bool watch_readable = false;
+  bool watch_writable = false;
+};
+
+}  // namespace Charly
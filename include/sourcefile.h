@@ -25,6 +25,7 @@
  */
 
 #include <cstdio>
+#include <memory>
 #include <string>
 #include "utf8buffer.h"
 
@@ -34,6 +35,9 @@ namespace Charly {
 class SourceFile : public UTF8Buffer {
 public:
   std::string filename = "<unknown>";
+
+  // Shared by the locations of all tokens read from this file
+  std::shared_ptr<const std::string> location_filename;
   size_t frame_pos = 0;
   size_t pos = 0;
   size_t row = 1;
@@ -41,12 +45,14 @@ public:
   uint32_t current_char = L'\0';
   std::string frame;
 
-  SourceFile(const std::string& f, const std::string& source) : UTF8Buffer(), filename(f) {
+  SourceFile(const std::string& f, const std::string& source)
+      : UTF8Buffer(), filename(f), location_filename(std::make_shared<const std::string>(f)) {
     this->write_string(source);
     this->read_char();
   }
 
-  SourceFile(const std::string& source) : UTF8Buffer(), filename("") {
+  SourceFile(const std::string& source)
+      : UTF8Buffer(), filename(""), location_filename(std::make_shared<const std::string>("")) {
     this->write_string(source);
     this->read_char();
   }
@@ -85,6 +91,21 @@ public:
     return cp;
   }
 
+  // Advance over count ASCII chars following the current char, none of which may be a newline
+  //
+  // Has the same effect as calling read_char count times, but copies the chars in one block
+  inline void skip_ascii(size_t count) {
+    if (count == 0)
+      return;
+
+    const char* data = this->read_pointer();
+    this->frame.append(data, count);
+    this->skip_bytes(count);
+    this->pos += count;
+    this->column += count;
+    this->current_char = static_cast<uint8_t>(data[count - 1]);
+  }
+
   // Read a char without appending to the frame or advancing the position
   inline uint32_t peek_char() {
     return this->peek_next_utf8();
@@ -0,0 +1,324 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "defines.h"
+#include "opcode.h"
+#include "symboltable.h"
+
+#pragma once
+
+// Instructions are encoded byte by byte, the interpreter reads their operands in native byte order
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "The static assembler only emits little endian code");
+
+namespace Charly {
+
+// Assembles builtin bytecode routines at compile time
+//
+// Routines are declared as static constexpr values, so their code ends up in the read-only
+// data of the executable instead of being generated each time a VM starts:
+//
+//   static constexpr auto kRoutine = StaticAssembler::assemble(
+//     StaticAssembler::Label{0},
+//     StaticAssembler::instruction<Opcode::PutValue>(StaticAssembler::SymbolOperand{"foo"}),
+//     StaticAssembler::instruction<Opcode::Branch>(StaticAssembler::LabelOperand{0}));
+//
+// Operand types are checked against the signature of each opcode and the signatures are checked
+// against kInstructionLengths, so malformed instructions fail to compile. Label errors fail the
+// constant evaluation of the routine.
+//
+// Symbols are hashed with std::hash, which can't be evaluated at compile time, and native
+// pointers are only known once the executable is loaded. Operands referring to either are
+// recorded as relocations and patched by link, which copies routines containing relocations
+// into a page that is made read-only afterwards. Routines without relocations are executed
+// straight from the read-only data of the executable.
+namespace StaticAssembler {
+
+// Symbol of a string, resolved when the routine is linked
+struct SymbolOperand {
+  const char* name;
+};
+
+// Entry of the native pointer table passed to link
+struct NativeOperand {
+  uint32_t index;
+};
+
+// Branch offset to a label of the routine
+struct LabelOperand {
+  uint32_t id;
+};
+
+// Marks the position of a label, emits no code
+//
+// Label ids of a routine have to be smaller than its amount of labels
+struct Label {
+  uint32_t id;
+};
+
+enum class RelocationKind : uint8_t { Symbol, Native };
+
+struct Relocation {
+  uint32_t offset = 0;
+  RelocationKind kind = RelocationKind::Symbol;
+  const char* symbol = nullptr;
+  uint32_t native_index = 0;
+};
+
+// Operand types of the opcodes routines may contain
+//
+// Linked routines are read-only, so opcodes which rewrite themselves when they execute
+// (quickened arithmetic, comparisons and instructions with inline caches) have no signature
+template <Opcode O>
+struct InstructionSignature;
+
+#define CHARLY_INSTRUCTION_SIGNATURE(O, ...) \
+  template <>                                \
+  struct InstructionSignature<Opcode::O> {   \
+    using Operands = __VA_ARGS__;            \
+  };
+
+CHARLY_INSTRUCTION_SIGNATURE(Nop, std::tuple<>)
+CHARLY_INSTRUCTION_SIGNATURE(ReadLocal, std::tuple<uint32_t, uint32_t>)
+CHARLY_INSTRUCTION_SIGNATURE(ReadMemberValue, std::tuple<>)
+CHARLY_INSTRUCTION_SIGNATURE(ReadArrayIndex, std::tuple<uint32_t>)
+CHARLY_INSTRUCTION_SIGNATURE(SetLocalPush, std::tuple<uint32_t, uint32_t>)
+CHARLY_INSTRUCTION_SIGNATURE(SetLocal, std::tuple<uint32_t, uint32_t>)
+CHARLY_INSTRUCTION_SIGNATURE(SetMemberValue, std::tuple<>)
+CHARLY_INSTRUCTION_SIGNATURE(SetArrayIndex, std::tuple<uint32_t>)
+CHARLY_INSTRUCTION_SIGNATURE(PutSelf, std::tuple<uint32_t>)
+CHARLY_INSTRUCTION_SIGNATURE(PutValue, std::tuple<VALUE>)
+CHARLY_INSTRUCTION_SIGNATURE(PutCFunction, std::tuple<VALUE, uintptr_t, uint32_t>)
+CHARLY_INSTRUCTION_SIGNATURE(PutArray, std::tuple<uint32_t>)
+CHARLY_INSTRUCTION_SIGNATURE(PutHash, std::tuple<uint32_t>)
+CHARLY_INSTRUCTION_SIGNATURE(Pop, std::tuple<>)
+CHARLY_INSTRUCTION_SIGNATURE(Dup, std::tuple<>)
+CHARLY_INSTRUCTION_SIGNATURE(Dupn, std::tuple<uint32_t>)
+CHARLY_INSTRUCTION_SIGNATURE(Swap, std::tuple<>)
+CHARLY_INSTRUCTION_SIGNATURE(Call, std::tuple<uint32_t>)
+CHARLY_INSTRUCTION_SIGNATURE(Throw, std::tuple<>)
+CHARLY_INSTRUCTION_SIGNATURE(Branch, std::tuple<int32_t>)
+CHARLY_INSTRUCTION_SIGNATURE(BranchIf, std::tuple<int32_t>)
+CHARLY_INSTRUCTION_SIGNATURE(BranchUnless, std::tuple<int32_t>)
+CHARLY_INSTRUCTION_SIGNATURE(Eq, std::tuple<>)
+CHARLY_INSTRUCTION_SIGNATURE(Neq, std::tuple<>)
+CHARLY_INSTRUCTION_SIGNATURE(UNot, std::tuple<>)
+CHARLY_INSTRUCTION_SIGNATURE(Halt, std::tuple<>)
+CHARLY_INSTRUCTION_SIGNATURE(Typeof, std::tuple<>)
+CHARLY_INSTRUCTION_SIGNATURE(ReadGlobal, std::tuple<uint32_t>)
+CHARLY_INSTRUCTION_SIGNATURE(SetGlobalPush, std::tuple<uint32_t>)
+CHARLY_INSTRUCTION_SIGNATURE(SetGlobal, std::tuple<uint32_t>)
+
+#undef CHARLY_INSTRUCTION_SIGNATURE
+
+// Checks if an operand can be passed where the signature of an opcode expects Expected
+template <typename Expected, typename Given>
+constexpr bool kAcceptsOperand = std::is_same_v<Expected, Given>;
+template <>
+constexpr bool kAcceptsOperand<VALUE, SymbolOperand> = true;
+template <>
+constexpr bool kAcceptsOperand<uintptr_t, NativeOperand> = true;
+template <>
+constexpr bool kAcceptsOperand<int32_t, LabelOperand> = true;
+
+template <typename Signature, typename Given, size_t... I>
+constexpr bool operands_match(std::index_sequence<I...>) {
+  if constexpr (std::tuple_size_v<Signature> != std::tuple_size_v<Given>) {
+    return false;
+  } else {
+    return (kAcceptsOperand<std::tuple_element_t<I, Signature>, std::tuple_element_t<I, Given>> && ...);
+  }
+}
+
+template <typename... Types>
+constexpr size_t encoded_size(std::tuple<Types...>*) {
+  return (sizeof(Opcode) + ... + sizeof(Types));
+}
+
+template <typename T>
+constexpr size_t kRelocationCount =
+    std::is_same_v<T, SymbolOperand> || std::is_same_v<T, NativeOperand> ? 1 : 0;
+
+template <Opcode O, typename... Operands>
+struct Instruction {
+  std::tuple<Operands...> operands;
+
+  static constexpr size_t kSize = kInstructionLengths[O];
+  static constexpr size_t kRelocations = (0 + ... + kRelocationCount<Operands>);
+  static constexpr size_t kLabels = 0;
+};
+
+template <Opcode O, typename... Args>
+constexpr Instruction<O, Args...> instruction(Args... operands) {
+  using Signature = typename InstructionSignature<O>::Operands;
+  static_assert(encoded_size(static_cast<Signature*>(nullptr)) == kInstructionLengths[O],
+                "Signature doesn't match the length of the instruction");
+  static_assert(operands_match<Signature, std::tuple<Args...>>(std::index_sequence_for<Args...>{}),
+                "Operand types don't match the signature of the opcode");
+  return {{operands...}};
+}
+
+// Label positions are only checked while the routine is evaluated at compile time
+//
+// Calling this non-constexpr function fails the constant evaluation
+inline void assembler_error(const char*) {
+}
+
+// Assembled code and the operands that still have to be patched
+template <size_t Size, size_t RelocationCount>
+struct Routine {
+  std::array<uint8_t, Size> code{};
+  std::array<Relocation, RelocationCount> relocations{};
+
+  // Returns the executable code of this routine
+  //
+  // Routines with relocations are copied and patched once per call, callers are
+  // expected to keep the result in a static variable. natives is indexed by NativeOperands
+  const uint8_t* link(const void* const* natives = nullptr) const;
+
+  // Registers the names of all symbol operands, so they can be decoded
+  void register_symbols(SymbolTable& symtable) const {
+    for (const Relocation& relocation : this->relocations) {
+      if (relocation.kind == RelocationKind::Symbol) {
+        symtable(relocation.symbol);
+      }
+    }
+  }
+};
+
+// Copies code into a fresh page, applies the relocations and makes the page read-only
+const uint8_t* link_routine(const uint8_t* code,
+                            size_t size,
+                            const Relocation* relocations,
+                            size_t relocation_count,
+                            const void* const* natives);
+
+template <size_t Size, size_t RelocationCount>
+const uint8_t* Routine<Size, RelocationCount>::link(const void* const* natives) const {
+  if constexpr (RelocationCount == 0) {
+    return this->code.data();
+  }
+  return link_routine(this->code.data(), Size, this->relocations.data(), RelocationCount, natives);
+}
+
+template <size_t Size, size_t RelocationCount, size_t LabelCount>
+struct Writer {
+  Routine<Size, RelocationCount>& routine;
+  std::array<uint32_t, LabelCount>& labels;
+  size_t offset = 0;
+  size_t relocation = 0;
+  size_t instruction_start = 0;
+
+  template <typename T>
+  constexpr void bytes(T value) {
+    for (size_t i = 0; i < sizeof(T); i++) {
+      this->routine.code[this->offset++] = static_cast<uint8_t>(static_cast<uint64_t>(value) >> (i * 8));
+    }
+  }
+
+  template <typename T>
+  constexpr void operand(T value) {
+    this->bytes(value);
+  }
+
+  constexpr void operand(SymbolOperand value) {
+    this->routine.relocations[this->relocation++] = {static_cast<uint32_t>(this->offset), RelocationKind::Symbol,
+                                                     value.name, 0};
+    this->bytes(VALUE(0));
+  }
+
+  constexpr void operand(NativeOperand value) {
+    this->routine.relocations[this->relocation++] = {static_cast<uint32_t>(this->offset), RelocationKind::Native,
+                                                     nullptr, value.index};
+    this->bytes(uintptr_t(0));
+  }
+
+  // Branch offsets are relative to the beginning of the branch instruction
+  constexpr void operand(LabelOperand value) {
+    if (value.id >= LabelCount) {
+      assembler_error("Reference to an unknown label");
+    }
+    int64_t distance = static_cast<int64_t>(this->labels[value.id]) - static_cast<int64_t>(this->instruction_start);
+    this->bytes(static_cast<uint32_t>(static_cast<int32_t>(distance)));
+  }
+
+  template <Opcode O, typename... Operands>
+  constexpr void emit(const Instruction<O, Operands...>& instruction) {
+    this->instruction_start = this->offset;
+    this->bytes(O);
+    std::apply([this](auto... operands) { (this->operand(operands), ...); }, instruction.operands);
+  }
+
+  constexpr void emit(const Label&) {
+  }
+};
+
+template <typename T>
+struct ItemTraits : T {};
+template <>
+struct ItemTraits<Label> {
+  static constexpr size_t kSize = 0;
+  static constexpr size_t kRelocations = 0;
+  static constexpr size_t kLabels = 1;
+};
+
+template <typename... Items>
+constexpr auto assemble(Items... items) {
+  constexpr size_t kSize = (0 + ... + ItemTraits<Items>::kSize);
+  constexpr size_t kRelocations = (0 + ... + ItemTraits<Items>::kRelocations);
+  constexpr size_t kLabels = (0 + ... + ItemTraits<Items>::kLabels);
+
+  // Labels may be referenced before they are placed, so their offsets are collected first
+  std::array<uint32_t, kLabels> labels{};
+  std::array<bool, kLabels> placed{};
+  uint32_t offset = 0;
+  auto place = [&](auto item) {
+    if constexpr (std::is_same_v<decltype(item), Label>) {
+      if (item.id >= kLabels || placed[item.id]) {
+        assembler_error("Label ids must be unique and smaller than the amount of labels");
+      }
+      labels[item.id] = offset;
+      placed[item.id] = true;
+    } else {
+      offset += decltype(item)::kSize;
+    }
+  };
+  (place(items), ...);
+
+  Routine<kSize, kRelocations> routine{};
+  Writer<kSize, kRelocations, kLabels> writer{routine, labels};
+  (writer.emit(items), ...);
+  return routine;
+}
+}  // namespace StaticAssembler
+}  // namespace Charly
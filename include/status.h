@@ -37,7 +37,7 @@ enum Status : STATUS {
   UnknownOpcode,
   TooManyArgumentsForCFunction,
   NotEnoughArguments,
-  CatchStackEmpty,
+  UncaughtException,
   ReadFailedOutOfBounds,
   ReadFailedTooDeep,
   WriteFailedOutOfBounds,
@@ -47,7 +47,8 @@ enum Status : STATUS {
   CorruptedStack,
   ObjectClassNotAClass,
   RuntimeTaskNotCallable,
-  InvalidInstructionPointer
+  InvalidInstructionPointer,
+  OutOfMemory
 };
 
 // Human-readable status messages
@@ -60,7 +61,7 @@ static const std::string kStatusHumanReadable[] = {
   "Unknown opcode",
   "Too many arguments for CFunction",
   "Not enough arguments",
-  "Catch stack is empty",
+  "Uncaught exception",
   "Reading local field failed, out of bounds",
   "Reading local field failed, too deep",
   "Writing local field failed, out of bounds",
@@ -70,7 +71,8 @@ static const std::string kStatusHumanReadable[] = {
   "Corrupted Stack",
   "Object's klass field not set to an instance of a class",
   "Callback of runtime task is not a callable type",
-  "Invalid instruction pointer"
+  "Invalid instruction pointer",
+  "Out of memory"
 };
 // clang-format on
 }  // namespace Charly
@@ -26,6 +26,7 @@
 
 #include <cstdint>
 #include <functional>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 
@@ -41,8 +42,13 @@ struct StringOffsetInfo {
   uint32_t length;
 };
 
+// Stores the string literals of all compiled modules
+//
+// The pool of the compiler manager is shared by all isolates. Appending a string
+// might move the data of the pool, so the VM copies literals out via get_string
 class StringPool : public MemoryBlock {
   std::unordered_map<size_t, StringOffsetInfo> known_strings;
+  std::mutex mutex;
 
   inline size_t hash_string(const std::string& str) {
     return std::hash<std::string>{}(str);
@@ -57,6 +63,7 @@ public:
   }
   inline StringOffsetInfo get_offsetinfo(const std::string& str) {
     size_t str_hash = this->hash_string(str);
+    std::unique_lock<std::mutex> lk(this->mutex);
     if (this->is_known(str_hash)) {
       return this->get_offsetinfo(str_hash);
     } else {
@@ -67,5 +74,10 @@ public:
       return info;
     }
   }
+
+  inline std::string get_string(uint32_t offset, uint32_t length) {
+    std::unique_lock<std::mutex> lk(this->mutex);
+    return std::string(reinterpret_cast<char*>(this->data + offset), length);
+  }
 };
 }  // namespace Charly
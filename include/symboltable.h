@@ -24,7 +24,9 @@
  * SOFTWARE.
  */
 
+#include <mutex>
 #include <optional>
+#include <thread>
 
 #include "value.h"
 
@@ -32,9 +34,17 @@
 
 namespace Charly {
 const std::string kUndefinedSymbolString = "<undefined symbol>";
+// Maps symbols back to the strings they were computed from
+//
+// The table of the compiler manager is shared by all isolates, so every access is synchronized
 class SymbolTable {
 private:
   std::unordered_map<VALUE, std::string> table;
+  mutable std::mutex mutex;
+
+  // Receives every symbol encoded by the thread which started the journal while it is active
+  std::unordered_map<VALUE, std::string>* journal = nullptr;
+  std::thread::id journal_thread;
 
 public:
   SymbolTable() = default;
@@ -58,6 +68,11 @@ public:
   }
 
   VALUE encode_string(const std::string& input);
+
+  // Registers the string a symbol was computed from
+  //
+  // Only copies the string if the symbol wasn't known before
+  VALUE register_symbol(VALUE symbol, const char* data, size_t length);
   std::optional<std::string> decode_symbol(VALUE symbol);
 
   VALUE operator()(const std::string& input) {
@@ -67,6 +82,19 @@ public:
     return this->decode_symbol(symbol);
   }
 
+  // Records all symbols encoded until the journal is stopped, even already known ones
+  //
+  // Used by the module cache to find the symbols a compiled module references
+  inline void start_journal(std::unordered_map<VALUE, std::string>* target) {
+    std::unique_lock<std::mutex> lk(this->mutex);
+    this->journal = target;
+    this->journal_thread = std::this_thread::get_id();
+  }
+  inline void stop_journal() {
+    std::unique_lock<std::mutex> lk(this->mutex);
+    this->journal = nullptr;
+  }
+
   void copy_symbols_to_table(SymbolTable& other);
   inline void copy_symbols_from_table(SymbolTable& other) {
     other.copy_symbols_to_table(*this);
@@ -0,0 +1,305 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include "value.h"
+
+#pragma once
+
+namespace Charly {
+
+// Hierarchical timing wheel storing timers and intervals
+//
+// Time is divided into ticks of one millisecond. Each of the kLevels wheels has kSlots slots,
+// a slot of level n spans kSlots^n ticks. Entries are stored in the lowest level whose range
+// covers their deadline and move down one level each time the wheel above them turns over,
+// entries further away than the highest level wait inside the overflow list.
+//
+// Every entry is indexed by its uid, so inserting and cancelling are constant time operations.
+// Expired entries are returned ordered by their deadline, entries with the same deadline in
+// the order they were registered in.
+template <typename T>
+class TimerWheel {
+public:
+  static constexpr uint32_t kSlotBits = 6;
+  static constexpr uint32_t kSlots = 1 << kSlotBits;
+  static constexpr uint32_t kLevels = 4;
+
+  // Wheel position of the overflow list
+  static constexpr uint8_t kOverflowLevel = kLevels;
+
+  TimerWheel() : epoch(std::chrono::steady_clock::now()) {
+  }
+
+  // Inserts a new entry which expires at the given time
+  //
+  // Entries with a period are inserted again every time they expire, at least one tick later
+  void insert(uint64_t uid, Timestamp deadline, const T& payload, std::optional<uint32_t> period = std::nullopt) {
+    Entry& entry = this->entries[uid];
+    entry.payload = payload;
+    entry.period = period;
+
+    // Entries which are already due expire during the next tick
+    this->place(uid, entry, std::max(this->tick_for(deadline), this->current_tick + 1));
+  }
+
+  // Removes the entry with this uid, the payload is returned via the payload argument
+  //
+  // Only removes periodic entries if periodic is set, and only non-periodic ones otherwise
+  bool remove(uint64_t uid, bool periodic, T& payload) {
+    auto it = this->entries.find(uid);
+    if (it == this->entries.end() || it->second.period.has_value() != periodic) {
+      return false;
+    }
+
+    payload = it->second.payload;
+    this->unlink(it->second);
+    this->entries.erase(it);
+    return true;
+  }
+
+  // Advances the wheel to the given time and appends all expired payloads to expired
+  //
+  // If deadlines is given, the tick each payload expired at is appended to it
+  void advance(Timestamp now, std::vector<T>& expired, std::vector<Timestamp>* deadlines = nullptr) {
+    uint64_t target = this->elapsed_ticks(now);
+
+    if (this->entries.size() == 0) {
+      this->current_tick = std::max(this->current_tick, target);
+      return;
+    }
+
+    std::vector<uint64_t> due;
+    while (this->current_tick < target) {
+
+      // Skip ahead to the next tick with any work to do
+      uint64_t tick = this->next_event_tick();
+      if (tick > target) {
+        this->current_tick = target;
+        break;
+      }
+      this->current_tick = tick;
+
+      // Move entries of higher levels down, starting at the top, once the wheel below them turned over
+      if ((tick & ((1ull << (kSlotBits * kLevels)) - 1)) == 0) {
+        this->cascade(this->overflow);
+      }
+      for (uint32_t level = kLevels - 1; level > 0; level--) {
+        if ((tick & ((1ull << (kSlotBits * level)) - 1)) == 0) {
+          uint32_t slot = (tick >> (kSlotBits * level)) & (kSlots - 1);
+          this->cascade(this->slots[level][slot]);
+          this->occupied[level] &= ~(1ull << slot);
+        }
+      }
+
+      uint32_t slot = tick & (kSlots - 1);
+      std::vector<uint64_t>& bucket = this->slots[0][slot];
+      if (bucket.size() == 0) {
+        continue;
+      }
+
+      due.swap(bucket);
+      this->occupied[0] &= ~(1ull << slot);
+      std::sort(due.begin(), due.end());
+
+      for (uint64_t uid : due) {
+        Entry& entry = this->entries[uid];
+        expired.push_back(entry.payload);
+        if (deadlines) {
+          deadlines->push_back(this->epoch + std::chrono::milliseconds(tick));
+        }
+
+        if (entry.period.has_value()) {
+          this->place(uid, entry, target + std::max(entry.period.value(), 1u));
+        } else {
+          this->entries.erase(uid);
+        }
+      }
+      due.clear();
+    }
+  }
+
+  // Time until the next entry might expire
+  //
+  // Entries in higher levels are assumed to expire once they are moved to the level below,
+  // so the returned duration is never longer than the time until the actual next deadline
+  std::chrono::milliseconds time_until_next(Timestamp now, std::chrono::milliseconds limit) {
+    if (this->entries.size() == 0) {
+      return limit;
+    }
+
+    uint64_t next_tick = this->next_event_tick();
+    uint64_t now_tick = this->elapsed_ticks(now);
+    if (next_tick <= now_tick) {
+      return std::chrono::milliseconds(0);
+    }
+
+    return std::min(limit, std::chrono::milliseconds(next_tick - now_tick));
+  }
+
+  // Calls the callback with the payload of every entry
+  template <typename Fn>
+  void each(Fn&& callback) {
+    for (auto& it : this->entries) {
+      callback(it.second.payload);
+    }
+  }
+
+  void clear() {
+    for (auto& level : this->slots) {
+      for (auto& bucket : level) {
+        bucket.clear();
+      }
+    }
+    std::fill(std::begin(this->occupied), std::end(this->occupied), 0);
+    this->overflow.clear();
+    this->entries.clear();
+  }
+
+  inline size_t size() {
+    return this->entries.size();
+  }
+
+private:
+  struct Entry {
+    T payload;
+    uint64_t deadline;
+    std::optional<uint32_t> period;
+
+    // Location of the uid inside the slots
+    uint8_t level;
+    uint8_t slot;
+    uint32_t index;
+  };
+
+  // Deadlines are rounded up, so entries never expire early
+  uint64_t tick_for(Timestamp time) {
+    auto offset = std::chrono::duration_cast<std::chrono::nanoseconds>(time - this->epoch).count();
+    if (offset <= 0) {
+      return 0;
+    }
+    return (offset + 999999) / 1000000;
+  }
+
+  uint64_t elapsed_ticks(Timestamp time) {
+    auto offset = std::chrono::duration_cast<std::chrono::milliseconds>(time - this->epoch).count();
+    return offset > 0 ? offset : 0;
+  }
+
+  std::vector<uint64_t>& bucket_of(const Entry& entry) {
+    if (entry.level == kOverflowLevel) {
+      return this->overflow;
+    }
+    return this->slots[entry.level][entry.slot];
+  }
+
+  // The next tick at which an entry expires or a slot has to be cascaded
+  uint64_t next_event_tick() {
+    uint64_t next_tick = UINT64_MAX;
+    for (uint32_t level = 0; level < kLevels; level++) {
+      if (this->occupied[level] == 0) {
+        continue;
+      }
+
+      // Slots are visited in order, starting with the one after the current slot
+      uint32_t shift = kSlotBits * level;
+      uint64_t position = (this->current_tick >> shift) + 1;
+      uint32_t first = position & (kSlots - 1);
+      uint64_t mask = this->occupied[level];
+      uint64_t rotated = first ? (mask >> first) | (mask << (kSlots - first)) : mask;
+      next_tick = std::min(next_tick, (position + __builtin_ctzll(rotated)) << shift);
+    }
+
+    if (this->overflow.size()) {
+      uint32_t shift = kSlotBits * kLevels;
+      next_tick = std::min(next_tick, ((this->current_tick >> shift) + 1) << shift);
+    }
+
+    return next_tick;
+  }
+
+  // Stores the uid in the slot matching its deadline, which may not lie before the current tick
+  void place(uint64_t uid, Entry& entry, uint64_t deadline) {
+    entry.deadline = deadline;
+    uint64_t delta = entry.deadline - this->current_tick;
+
+    entry.level = kOverflowLevel;
+    entry.slot = 0;
+    for (uint32_t level = 0; level < kLevels; level++) {
+      if (delta < (1ull << (kSlotBits * (level + 1)))) {
+        entry.level = level;
+        entry.slot = (entry.deadline >> (kSlotBits * level)) & (kSlots - 1);
+        this->occupied[level] |= 1ull << entry.slot;
+        break;
+      }
+    }
+
+    std::vector<uint64_t>& bucket = this->bucket_of(entry);
+    entry.index = bucket.size();
+    bucket.push_back(uid);
+  }
+
+  // Removes the uid of an entry from its slot by moving the last uid of the slot into its place
+  void unlink(Entry& entry) {
+    std::vector<uint64_t>& bucket = this->bucket_of(entry);
+    uint64_t last = bucket.back();
+    bucket[entry.index] = last;
+    this->entries[last].index = entry.index;
+    bucket.pop_back();
+
+    if (bucket.size() == 0 && entry.level != kOverflowLevel) {
+      this->occupied[entry.level] &= ~(1ull << entry.slot);
+    }
+  }
+
+  // Places all entries of a bucket again, relative to the current tick
+  void cascade(std::vector<uint64_t>& bucket) {
+    std::vector<uint64_t> uids;
+    uids.swap(bucket);
+    for (uint64_t uid : uids) {
+      Entry& entry = this->entries[uid];
+      this->place(uid, entry, entry.deadline);
+    }
+  }
+
+  Timestamp epoch;
+  uint64_t current_tick = 0;
+
+  std::unordered_map<uint64_t, Entry> entries;
+  std::vector<uint64_t> slots[kLevels][kSlots];
+  std::vector<uint64_t> overflow;
+
+  // Bitmap of the non-empty slots of each level
+  uint64_t occupied[kLevels] = {};
+};
+
+}  // namespace Charly
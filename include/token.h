@@ -24,7 +24,11 @@
  * SOFTWARE.
  */
 
+#include <array>
+#include <cstdint>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 
 #include "location.h"
@@ -248,7 +252,11 @@ static std::string kTokenTypeStrings[] = {
   "Eof",
   "Unknown"
 };
-static const std::unordered_map<std::string, TokenType> kTokenKeywordsAndLiterals = {
+struct KeywordEntry {
+  std::string_view name;
+  TokenType type;
+};
+static constexpr KeywordEntry kTokenKeywordsAndLiterals[] = {
   {"NaN", TokenType::Nan},
   {"break", TokenType::Break},
   {"case", TokenType::Case},
@@ -305,6 +313,55 @@ static std::unordered_map<TokenType, TokenType> kTokenAndAssignmentOperators = {
 };
 // clang-format on
 
+// Perfect hash lookup of keywords and literals
+//
+// The hash is collision free for all entries of kTokenKeywordsAndLiterals, so looking up
+// an identifier compares it against at most one candidate
+namespace KeywordTable {
+static constexpr size_t kSize = 128;
+static constexpr size_t kMinLength = 2;
+static constexpr size_t kMaxLength = 11;
+
+constexpr size_t hash(std::string_view name) {
+  return (name.size() * 8 + name[0] * 3 + name[1] * 2 + name[name.size() - 1]) & (kSize - 1);
+}
+
+// Maps each hash to an index into kTokenKeywordsAndLiterals, or -1 if there is no keyword
+constexpr std::array<int8_t, kSize> build_slots() {
+  std::array<int8_t, kSize> slots = {};
+  for (size_t i = 0; i < kSize; i++)
+    slots[i] = -1;
+  for (size_t i = 0; i < std::size(kTokenKeywordsAndLiterals); i++)
+    slots[hash(kTokenKeywordsAndLiterals[i].name)] = i;
+  return slots;
+}
+
+static constexpr std::array<int8_t, kSize> kSlots = build_slots();
+
+constexpr bool is_collision_free() {
+  for (size_t i = 0; i < std::size(kTokenKeywordsAndLiterals); i++) {
+    std::string_view name = kTokenKeywordsAndLiterals[i].name;
+    if (name.size() < kMinLength || name.size() > kMaxLength || kSlots[hash(name)] != static_cast<int8_t>(i))
+      return false;
+  }
+  return true;
+}
+
+static_assert(is_collision_free(), "keyword hash has collisions, pick new coefficients");
+}  // namespace KeywordTable
+
+// Returns the token type of a keyword or literal
+inline std::optional<TokenType> find_keyword(std::string_view name) {
+  if (name.size() < KeywordTable::kMinLength || name.size() > KeywordTable::kMaxLength)
+    return std::nullopt;
+
+  int8_t index = KeywordTable::kSlots[KeywordTable::hash(name)];
+  if (index < 0 || kTokenKeywordsAndLiterals[index].name != name)
+    return std::nullopt;
+
+  return kTokenKeywordsAndLiterals[index].type;
+}
+
 struct Token {
   TokenType type;
   std::string value;
@@ -25,6 +25,8 @@
  */
 
 #include <functional>
+#include <string>
+#include <unordered_set>
 
 #include "ast.h"
 
@@ -166,6 +168,10 @@ public:
     cont();
     return node;
   }
+  virtual inline AST::AbstractNode* visit_inlinedcall(AST::InlinedCall* node, VisitContinue cont) {
+    cont();
+    return node;
+  }
   virtual inline AST::AbstractNode* visit_identifier(AST::Identifier* node, VisitContinue cont) {
     cont();
     return node;
@@ -319,6 +325,8 @@ public:
       return walker->visit_callmember(node->as<AST::CallMember>(), cont);
     if (node->type() == AST::kTypeCallIndex)
       return walker->visit_callindex(node->as<AST::CallIndex>(), cont);
+    if (node->type() == AST::kTypeInlinedCall)
+      return walker->visit_inlinedcall(node->as<AST::InlinedCall>(), cont);
     if (node->type() == AST::kTypeIdentifier)
       return walker->visit_identifier(node->as<AST::Identifier>(), cont);
     if (node->type() == AST::kTypeSelf)
@@ -366,4 +374,20 @@ public:
     return walker->visit_abstract(node, cont);
   }
 };
+
+// Collects the targets of all assignments inside a tree
+class AssignmentCollector : public TreeWalker {
+public:
+  AssignmentCollector(std::unordered_set<std::string>& n) : names(n) {
+  }
+
+  AST::AbstractNode* visit_assignment(AST::Assignment* node, VisitContinue cont) {
+    this->names.insert(node->target);
+    cont();
+    return node;
+  }
+
+private:
+  std::unordered_set<std::string>& names;
+};
 };  // namespace Charly::Compilation
@@ -0,0 +1,145 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+
+#include "value.h"
+
+#pragma once
+
+namespace Charly {
+
+// Typed arrays store numbers unboxed in a contiguous block of memory
+//
+// They are CPointer values whose data field points to a TypedArray structure. The VM
+// recognizes them by their destructor and reads and writes elements directly when they
+// are indexed with a number, without going through the symbol lookup of other values.
+enum TypedArrayKind : uint8_t { kTypedArrayFloat64, kTypedArrayInt32 };
+
+// Typed arrays hold at most this many elements
+static constexpr uint32_t kTypedArrayMaxLength = 1 << 28;
+
+struct TypedArray {
+  TypedArrayKind kind;
+  uint32_t length;
+  union {
+    double* f64;
+    int32_t* i32;
+    void* data;
+  };
+
+  static inline size_t element_size(TypedArrayKind kind) {
+    return kind == kTypedArrayFloat64 ? sizeof(double) : sizeof(int32_t);
+  }
+
+  // Elements are zero-initialized
+  //
+  // Returns nullptr if the elements couldn't be allocated
+  static inline TypedArray* create(TypedArrayKind kind, uint32_t length) {
+    void* data = std::calloc(length ? length : 1, TypedArray::element_size(kind));
+    if (data == nullptr) {
+      return nullptr;
+    }
+
+    TypedArray* array = new TypedArray();
+    array->kind = kind;
+    array->length = length;
+    array->data = data;
+    return array;
+  }
+
+  static inline void destructor(void* data) {
+    TypedArray* array = static_cast<TypedArray*>(data);
+    std::free(array->data);
+    delete array;
+  }
+
+  // Converts a number into an element of an int32 array
+  //
+  // Fractions are truncated, values outside of the int32 range saturate and NaN is stored as 0
+  static inline int32_t to_int32(double value) {
+    if (std::isnan(value)) {
+      return 0;
+    }
+
+    if (value <= INT32_MIN) {
+      return INT32_MIN;
+    }
+
+    if (value >= INT32_MAX) {
+      return INT32_MAX;
+    }
+
+    return static_cast<int32_t>(value);
+  }
+
+  // Negative indices read from the end of the array, fractions are truncated
+  // Returns false if the index is out of bounds
+  inline bool resolve_index(VALUE value, uint32_t& index) {
+    double position = std::trunc(charly_number_to_double(value));
+    if (position < 0) {
+      position += this->length;
+    }
+
+    // Written so that NaN is out of bounds too
+    if (!(position >= 0 && position < this->length)) {
+      return false;
+    }
+
+    index = static_cast<uint32_t>(position);
+    return true;
+  }
+
+  inline VALUE read(uint32_t index) {
+    if (this->kind == kTypedArrayFloat64) {
+      return charly_create_double(this->f64[index]);
+    }
+
+    return charly_create_integer(this->i32[index]);
+  }
+
+  inline void write(uint32_t index, VALUE value) {
+    if (this->kind == kTypedArrayFloat64) {
+      this->f64[index] = charly_number_to_double(value);
+    } else {
+      this->i32[index] = TypedArray::to_int32(charly_number_to_double(value));
+    }
+  }
+};
+
+__attribute__((always_inline))
+inline bool charly_is_typedarray(VALUE value) {
+  return charly_is_cpointer(value) &&
+         charly_as_cpointer(value)->destructor == reinterpret_cast<void*>(TypedArray::destructor);
+}
+
+__attribute__((always_inline))
+inline TypedArray* charly_as_typedarray(VALUE value) {
+  return static_cast<TypedArray*>(charly_as_cpointer(value)->data);
+}
+}  // namespace Charly
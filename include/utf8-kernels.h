@@ -0,0 +1,423 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <utf8/utf8.h>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#pragma once
+
+namespace Charly {
+namespace UTF8 {
+
+// Bulk operations on utf8 encoded text
+//
+// The input is processed in blocks of 16 bytes using SSE2 or NEON instructions, depending
+// on the target architecture. Each block operation returns a 16-bit mask with one bit
+// per byte. The remaining bytes, or the whole input on other targets, are handled by the
+// scalar loops below.
+//
+// Case mapping and whitespace trimming only consider ASCII characters, non-ASCII bytes
+// are never modified or skipped.
+namespace Detail {
+#if defined(__SSE2__)
+#define CHARLY_UTF8_BLOCKS 1
+static constexpr size_t kBlockSize = 16;
+
+__attribute__((always_inline))
+inline __m128i load_block(const char* data) {
+  return _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+}
+
+// Bytes in the range [lower, lower + count)
+__attribute__((always_inline))
+inline __m128i in_range(__m128i block, char lower, char count) {
+  __m128i shifted = _mm_add_epi8(block, _mm_set1_epi8(static_cast<char>(0x80 - lower)));
+  return _mm_cmplt_epi8(shifted, _mm_set1_epi8(static_cast<char>(0x80 + count)));
+}
+
+__attribute__((always_inline))
+inline uint32_t continuation_mask(const char* data) {
+  // Continuation bytes are in the range [0x80, 0xBF], which is below 0xC0 when interpreted as signed
+  return _mm_movemask_epi8(_mm_cmplt_epi8(load_block(data), _mm_set1_epi8(static_cast<char>(0xC0))));
+}
+
+__attribute__((always_inline))
+inline uint32_t nonascii_mask(const char* data) {
+  return _mm_movemask_epi8(load_block(data));
+}
+
+__attribute__((always_inline))
+inline uint32_t whitespace_mask(const char* data) {
+  __m128i block = load_block(data);
+  __m128i space = _mm_cmpeq_epi8(block, _mm_set1_epi8(' '));
+  return _mm_movemask_epi8(_mm_or_si128(space, in_range(block, '\t', 5)));
+}
+
+// Spaces and tabs
+__attribute__((always_inline))
+inline uint32_t blank_mask(const char* data) {
+  __m128i block = load_block(data);
+  __m128i space = _mm_cmpeq_epi8(block, _mm_set1_epi8(' '));
+  return _mm_movemask_epi8(_mm_or_si128(space, _mm_cmpeq_epi8(block, _mm_set1_epi8('\t'))));
+}
+
+// ASCII letters, digits, underscores and dollar signs
+__attribute__((always_inline))
+inline uint32_t identifier_mask(const char* data) {
+  __m128i block = load_block(data);
+  __m128i letter = in_range(_mm_or_si128(block, _mm_set1_epi8(0x20)), 'a', 26);
+  __m128i digit = in_range(block, '0', 10);
+  __m128i underscore = _mm_cmpeq_epi8(block, _mm_set1_epi8('_'));
+  __m128i dollar = _mm_cmpeq_epi8(block, _mm_set1_epi8('$'));
+  return _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(letter, digit), _mm_or_si128(underscore, dollar)));
+}
+
+// Quotes, backslashes and control characters, which can't appear unescaped inside JSON strings
+__attribute__((always_inline))
+inline uint32_t json_special_mask(const char* data) {
+  __m128i block = load_block(data);
+  __m128i quote = _mm_cmpeq_epi8(block, _mm_set1_epi8('"'));
+  __m128i backslash = _mm_cmpeq_epi8(block, _mm_set1_epi8('\\'));
+  return _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(quote, backslash), in_range(block, 0, 32)));
+}
+
+// Toggles the case of all bytes in the range [lower, lower + 26)
+__attribute__((always_inline))
+inline void toggle_case(char* data, char lower) {
+  __m128i block = load_block(data);
+  __m128i bit = _mm_and_si128(in_range(block, lower, 26), _mm_set1_epi8(0x20));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(data), _mm_xor_si128(block, bit));
+}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define CHARLY_UTF8_BLOCKS 1
+static constexpr size_t kBlockSize = 16;
+
+__attribute__((always_inline))
+inline uint8x16_t load_block(const char* data) {
+  return vld1q_u8(reinterpret_cast<const uint8_t*>(data));
+}
+
+// NEON has no movemask instruction, so every byte selects its bit and the halves are summed up
+__attribute__((always_inline))
+inline uint32_t movemask(uint8x16_t mask) {
+  static const uint8_t kBits[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+  uint8x16_t bits = vandq_u8(mask, vld1q_u8(kBits));
+  return vaddv_u8(vget_low_u8(bits)) | (vaddv_u8(vget_high_u8(bits)) << 8);
+}
+
+// Bytes in the range [lower, lower + count)
+__attribute__((always_inline))
+inline uint8x16_t in_range(uint8x16_t block, uint8_t lower, uint8_t count) {
+  return vcltq_u8(vsubq_u8(block, vdupq_n_u8(lower)), vdupq_n_u8(count));
+}
+
+__attribute__((always_inline))
+inline uint32_t continuation_mask(const char* data) {
+  return movemask(in_range(load_block(data), 0x80, 0x40));
+}
+
+__attribute__((always_inline))
+inline uint32_t nonascii_mask(const char* data) {
+  return movemask(vcgeq_u8(load_block(data), vdupq_n_u8(0x80)));
+}
+
+__attribute__((always_inline))
+inline uint32_t whitespace_mask(const char* data) {
+  uint8x16_t block = load_block(data);
+  return movemask(vorrq_u8(vceqq_u8(block, vdupq_n_u8(' ')), in_range(block, '\t', 5)));
+}
+
+// Spaces and tabs
+__attribute__((always_inline))
+inline uint32_t blank_mask(const char* data) {
+  uint8x16_t block = load_block(data);
+  return movemask(vorrq_u8(vceqq_u8(block, vdupq_n_u8(' ')), vceqq_u8(block, vdupq_n_u8('\t'))));
+}
+
+// ASCII letters, digits, underscores and dollar signs
+__attribute__((always_inline))
+inline uint32_t identifier_mask(const char* data) {
+  uint8x16_t block = load_block(data);
+  uint8x16_t letter = in_range(vorrq_u8(block, vdupq_n_u8(0x20)), 'a', 26);
+  uint8x16_t digit = in_range(block, '0', 10);
+  uint8x16_t underscore = vceqq_u8(block, vdupq_n_u8('_'));
+  uint8x16_t dollar = vceqq_u8(block, vdupq_n_u8('$'));
+  return movemask(vorrq_u8(vorrq_u8(letter, digit), vorrq_u8(underscore, dollar)));
+}
+
+// Quotes, backslashes and control characters, which can't appear unescaped inside JSON strings
+__attribute__((always_inline))
+inline uint32_t json_special_mask(const char* data) {
+  uint8x16_t block = load_block(data);
+  uint8x16_t quote = vceqq_u8(block, vdupq_n_u8('"'));
+  uint8x16_t backslash = vceqq_u8(block, vdupq_n_u8('\\'));
+  return movemask(vorrq_u8(vorrq_u8(quote, backslash), vcltq_u8(block, vdupq_n_u8(32))));
+}
+
+// Toggles the case of all bytes in the range [lower, lower + 26)
+__attribute__((always_inline))
+inline void toggle_case(char* data, uint8_t lower) {
+  uint8x16_t block = load_block(data);
+  uint8x16_t bit = vandq_u8(in_range(block, lower, 26), vdupq_n_u8(0x20));
+  vst1q_u8(reinterpret_cast<uint8_t*>(data), veorq_u8(block, bit));
+}
+#endif
+
+__attribute__((always_inline))
+inline bool is_continuation(char c) {
+  return (static_cast<uint8_t>(c) & 0xC0) == 0x80;
+}
+
+__attribute__((always_inline))
+inline bool is_whitespace(char c) {
+  return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+__attribute__((always_inline))
+inline bool is_blank(char c) {
+  return c == ' ' || c == '\t';
+}
+
+__attribute__((always_inline))
+inline bool is_json_special(char c) {
+  return c == '"' || c == '\\' || static_cast<uint8_t>(c) < 32;
+}
+
+__attribute__((always_inline))
+inline bool is_identifier(char c) {
+  char lower = c | 0x20;
+  return (lower >= 'a' && lower <= 'z') || (c >= '0' && c <= '9') || c == '_' || c == '$';
+}
+}  // namespace Detail
+
+// Returns the amount of codepoints in a utf8 encoded string
+//
+// Counts all bytes which aren't continuation bytes, so malformed sequences
+// are counted instead of raising an exception
+inline size_t codepoint_count(const char* data, size_t length) {
+  size_t count = 0;
+  size_t i = 0;
+
+#ifdef CHARLY_UTF8_BLOCKS
+  for (; i + Detail::kBlockSize <= length; i += Detail::kBlockSize) {
+    count += Detail::kBlockSize - __builtin_popcount(Detail::continuation_mask(data + i));
+  }
+#endif
+
+  for (; i < length; i++) {
+    count += !Detail::is_continuation(data[i]);
+  }
+
+  return count;
+}
+
+// Returns the amount of ASCII bytes at the start of a string
+inline size_t ascii_prefix_length(const char* data, size_t length) {
+  size_t i = 0;
+
+#ifdef CHARLY_UTF8_BLOCKS
+  for (; i + Detail::kBlockSize <= length; i += Detail::kBlockSize) {
+    uint32_t mask = Detail::nonascii_mask(data + i);
+    if (mask) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+#endif
+
+  for (; i < length; i++) {
+    if (static_cast<uint8_t>(data[i]) >= 0x80) {
+      break;
+    }
+  }
+
+  return i;
+}
+
+// Checks wether a string is valid utf8
+//
+// ASCII bytes are always valid, so the decoder only has to look at the
+// remainder of the string after the first non-ASCII byte
+inline bool is_valid(const char* data, size_t length) {
+  size_t ascii_length = ascii_prefix_length(data, length);
+  return utf8::is_valid(data + ascii_length, data + length);
+}
+
+// Returns the amount of whitespace bytes at the start of a string
+inline size_t leading_whitespace(const char* data, size_t length) {
+  size_t i = 0;
+
+#ifdef CHARLY_UTF8_BLOCKS
+  for (; i + Detail::kBlockSize <= length; i += Detail::kBlockSize) {
+    uint32_t mask = ~Detail::whitespace_mask(data + i) & 0xFFFF;
+    if (mask) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+#endif
+
+  for (; i < length; i++) {
+    if (!Detail::is_whitespace(data[i])) {
+      break;
+    }
+  }
+
+  return i;
+}
+
+// Returns the amount of spaces and tabs at the start of a string
+inline size_t leading_blanks(const char* data, size_t length) {
+  size_t i = 0;
+
+#ifdef CHARLY_UTF8_BLOCKS
+  for (; i + Detail::kBlockSize <= length; i += Detail::kBlockSize) {
+    uint32_t mask = ~Detail::blank_mask(data + i) & 0xFFFF;
+    if (mask) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+#endif
+
+  for (; i < length; i++) {
+    if (!Detail::is_blank(data[i])) {
+      break;
+    }
+  }
+
+  return i;
+}
+
+// Returns the amount of ASCII identifier bytes at the start of a string
+//
+// Identifiers consist of letters, digits, underscores and dollar signs
+inline size_t identifier_prefix_length(const char* data, size_t length) {
+  size_t i = 0;
+
+#ifdef CHARLY_UTF8_BLOCKS
+  for (; i + Detail::kBlockSize <= length; i += Detail::kBlockSize) {
+    uint32_t mask = ~Detail::identifier_mask(data + i) & 0xFFFF;
+    if (mask) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+#endif
+
+  for (; i < length; i++) {
+    if (!Detail::is_identifier(data[i])) {
+      break;
+    }
+  }
+
+  return i;
+}
+
+// Returns the amount of bytes at the start of a string which need no escaping inside a JSON string
+//
+// The scan stops at quotes, backslashes and control characters
+inline size_t json_plain_prefix_length(const char* data, size_t length) {
+  size_t i = 0;
+
+#ifdef CHARLY_UTF8_BLOCKS
+  for (; i + Detail::kBlockSize <= length; i += Detail::kBlockSize) {
+    uint32_t mask = Detail::json_special_mask(data + i);
+    if (mask) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+#endif
+
+  for (; i < length; i++) {
+    if (Detail::is_json_special(data[i])) {
+      break;
+    }
+  }
+
+  return i;
+}
+
+// Returns the amount of whitespace bytes at the end of a string
+inline size_t trailing_whitespace(const char* data, size_t length) {
+  size_t end = length;
+
+#ifdef CHARLY_UTF8_BLOCKS
+  for (; end >= Detail::kBlockSize; end -= Detail::kBlockSize) {
+    uint32_t mask = ~Detail::whitespace_mask(data + end - Detail::kBlockSize) & 0xFFFF;
+    if (mask) {
+      return length - (end - Detail::kBlockSize + 31 - __builtin_clz(mask)) - 1;
+    }
+  }
+#endif
+
+  for (; end > 0; end--) {
+    if (!Detail::is_whitespace(data[end - 1])) {
+      break;
+    }
+  }
+
+  return length - end;
+}
+
+// Converts all ASCII uppercase characters to lowercase in place
+inline void ascii_lowercase(char* data, size_t length) {
+  size_t i = 0;
+
+#ifdef CHARLY_UTF8_BLOCKS
+  for (; i + Detail::kBlockSize <= length; i += Detail::kBlockSize) {
+    Detail::toggle_case(data + i, 'A');
+  }
+#endif
+
+  for (; i < length; i++) {
+    if (data[i] >= 'A' && data[i] <= 'Z') {
+      data[i] ^= 0x20;
+    }
+  }
+}
+
+// Converts all ASCII lowercase characters to uppercase in place
+inline void ascii_uppercase(char* data, size_t length) {
+  size_t i = 0;
+
+#ifdef CHARLY_UTF8_BLOCKS
+  for (; i + Detail::kBlockSize <= length; i += Detail::kBlockSize) {
+    Detail::toggle_case(data + i, 'a');
+  }
+#endif
+
+  for (; i < length; i++) {
+    if (data[i] >= 'a' && data[i] <= 'z') {
+      data[i] ^= 0x20;
+    }
+  }
+}
+}  // namespace UTF8
+}  // namespace Charly
@@ -30,6 +30,7 @@
 #include <string>
 
 #include "memoryblock.h"
+#include "utf8-kernels.h"
 
 #pragma once
 
@@ -43,6 +44,9 @@ public:
   UTF8Buffer() : MemoryBlock() {
   }
 
+  UTF8Buffer(SharedMemory* owner, uint8_t* data, size_t size) : MemoryBlock(owner, data, size) {
+  }
+
   UTF8Buffer(const UTF8Buffer& other) : MemoryBlock(), readoffset(other.readoffset) {
   }
 
@@ -67,12 +71,31 @@ public:
     this->write_block(data.data, data.writeoffset);
   }
 
+  inline void clear() {
+    MemoryBlock::clear();
+    this->readoffset = 0;
+  }
+
+  // Raw access to the bytes which haven't been read yet
+  inline const char* read_pointer() const {
+    return reinterpret_cast<const char*>(this->data + this->readoffset);
+  }
+
+  inline size_t remaining_bytes() const {
+    return this->readoffset < this->writeoffset ? this->writeoffset - this->readoffset : 0;
+  }
+
+  // Advance over bytes returned by read_pointer without decoding them
+  inline void skip_bytes(size_t count) {
+    this->readoffset += count;
+  }
+
   // UTF8 methods
   uint32_t append_utf8(uint32_t cp);
   uint32_t next_utf8();
   uint32_t peek_next_utf8();
   static inline bool is_valid_utf8(char* start, char* end) {
-    return utf8::is_valid(start, end);
+    return UTF8::is_valid(start, end - start);
   }
 
   size_t codepointcount();
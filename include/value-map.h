@@ -0,0 +1,324 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <new>
+#include <utility>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "defines.h"
+
+#pragma once
+
+namespace Charly {
+
+// Open addressing hash map from VALUE keys to VALUE values
+//
+// Follows the layout of a swiss table. Every slot has a control byte, which is either
+// kEmpty or contains the lower 7 bits of the hash of the key stored in the slot. Lookups
+// compare the control bytes of a whole group of 16 slots at once and only compare keys of
+// slots whose control byte matches. Groups are probed quadratically.
+//
+// Entries can't be removed, none of the tables of the vm ever delete keys. The storage is
+// only allocated once the first entry is inserted
+class ValueMap {
+public:
+  using value_type = std::pair<VALUE, VALUE>;
+
+  static constexpr size_t kGroupSize = 16;
+  static constexpr uint8_t kEmpty = 0x80;
+
+  class iterator {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = ValueMap::value_type;
+    using difference_type = std::ptrdiff_t;
+    using pointer = value_type*;
+    using reference = value_type&;
+
+    iterator(const uint8_t* control, value_type* slot, value_type* end) : control(control), slot(slot), end(end) {
+      this->skip_empty();
+    }
+
+    inline reference operator*() const {
+      return *this->slot;
+    }
+
+    inline pointer operator->() const {
+      return this->slot;
+    }
+
+    inline iterator& operator++() {
+      this->control++;
+      this->slot++;
+      this->skip_empty();
+      return *this;
+    }
+
+    inline bool operator==(const iterator& other) const {
+      return this->slot == other.slot;
+    }
+
+    inline bool operator!=(const iterator& other) const {
+      return this->slot != other.slot;
+    }
+
+  private:
+    inline void skip_empty() {
+      while (this->slot != this->end && *this->control == kEmpty) {
+        this->control++;
+        this->slot++;
+      }
+    }
+
+    const uint8_t* control;
+    value_type* slot;
+    value_type* end;
+  };
+
+  ValueMap() = default;
+  ValueMap(const ValueMap& other) {
+    *this = other;
+  }
+  ValueMap& operator=(const ValueMap& other) {
+    if (this != &other) {
+      this->deallocate();
+      if (other.entry_count) {
+        this->allocate(other.slot_count);
+        std::memcpy(this->control, other.control, other.slot_count);
+        std::memcpy(static_cast<void*>(this->slots), other.slots, other.slot_count * sizeof(value_type));
+        this->entry_count = other.entry_count;
+        this->growth_left = other.growth_left;
+      }
+    }
+    return *this;
+  }
+  ~ValueMap() {
+    this->deallocate();
+  }
+
+  inline size_t size() const {
+    return this->entry_count;
+  }
+
+  inline bool empty() const {
+    return this->entry_count == 0;
+  }
+
+  inline size_t capacity() const {
+    return this->slot_count;
+  }
+
+  inline iterator begin() const {
+    return iterator(this->control, this->slots, this->slots + this->slot_count);
+  }
+
+  inline iterator end() const {
+    value_type* end = this->slots + this->slot_count;
+    return iterator(this->control + this->slot_count, end, end);
+  }
+
+  inline iterator find(VALUE key) const {
+    value_type* slot = this->lookup(key);
+    if (slot == nullptr) {
+      return this->end();
+    }
+
+    size_t index = slot - this->slots;
+    return iterator(this->control + index, slot, this->slots + this->slot_count);
+  }
+
+  inline size_t count(VALUE key) const {
+    return this->lookup(key) != nullptr;
+  }
+
+  // Returns the value of a key, inserting a zero value if the key doesn't exist yet
+  inline VALUE& operator[](VALUE key) {
+    value_type* slot = this->lookup(key);
+    if (slot) {
+      return slot->second;
+    }
+
+    if (this->growth_left == 0) {
+      this->rehash(this->slot_count ? this->slot_count * 2 : kGroupSize);
+    }
+
+    return this->insert_new(key, VALUE{})->second;
+  }
+
+  // Makes sure count entries fit into the map without growing it
+  inline void reserve(size_t count) {
+    if (count > this->entry_count + this->growth_left) {
+      size_t slot_count = kGroupSize;
+      while (max_load(slot_count) < count) {
+        slot_count *= 2;
+      }
+      this->rehash(slot_count);
+    }
+  }
+
+private:
+  // Maps are kept at most 7/8 full, so every probe sequence ends at an empty slot
+  static inline size_t max_load(size_t slot_count) {
+    return slot_count - slot_count / 8;
+  }
+
+  static inline uint64_t hash(VALUE key) {
+    uint64_t h = key * 0x9e3779b97f4a7c15ull;
+    return h ^ (h >> 32);
+  }
+
+  static inline uint8_t control_hash(uint64_t hash) {
+    return hash & 0x7f;
+  }
+
+  // Bitmask of the slots in a group whose control byte equals byte
+  static inline uint32_t match_group(const uint8_t* group, uint8_t byte) {
+#if defined(__SSE2__)
+    __m128i control = _mm_load_si128(reinterpret_cast<const __m128i*>(group));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(control, _mm_set1_epi8(static_cast<char>(byte))));
+#else
+    uint32_t mask = 0;
+    for (size_t i = 0; i < kGroupSize; i++) {
+      mask |= static_cast<uint32_t>(group[i] == byte) << i;
+    }
+    return mask;
+#endif
+  }
+
+  // Bitmask of the empty slots in a group
+  static inline uint32_t match_empty(const uint8_t* group) {
+#if defined(__SSE2__)
+    return _mm_movemask_epi8(_mm_load_si128(reinterpret_cast<const __m128i*>(group)));
+#else
+    return match_group(group, kEmpty);
+#endif
+  }
+
+  inline value_type* lookup(VALUE key) const {
+    if (this->entry_count == 0) {
+      return nullptr;
+    }
+
+    uint64_t h = hash(key);
+    uint8_t byte = control_hash(h);
+    size_t group_mask = this->slot_count / kGroupSize - 1;
+    size_t group = (h >> 7) & group_mask;
+
+    for (size_t step = 1;; step++) {
+      size_t offset = group * kGroupSize;
+      uint32_t candidates = match_group(this->control + offset, byte);
+      while (candidates) {
+        size_t index = offset + __builtin_ctz(candidates);
+        if (this->slots[index].first == key) {
+          return this->slots + index;
+        }
+        candidates &= candidates - 1;
+      }
+
+      if (match_empty(this->control + offset)) {
+        return nullptr;
+      }
+
+      group = (group + step) & group_mask;
+    }
+  }
+
+  // Inserts a key which is known not to exist yet into a map with room for it
+  inline value_type* insert_new(VALUE key, VALUE value) {
+    uint64_t h = hash(key);
+    size_t group_mask = this->slot_count / kGroupSize - 1;
+    size_t group = (h >> 7) & group_mask;
+
+    for (size_t step = 1;; step++) {
+      size_t offset = group * kGroupSize;
+      uint32_t empty = match_empty(this->control + offset);
+      if (empty) {
+        size_t index = offset + __builtin_ctz(empty);
+        this->control[index] = control_hash(h);
+        this->slots[index] = {key, value};
+        this->entry_count++;
+        this->growth_left--;
+        return this->slots + index;
+      }
+
+      group = (group + step) & group_mask;
+    }
+  }
+
+  void allocate(size_t slot_count) {
+    // The control bytes are followed by the slots inside a single allocation, aligned for group loads
+    uint8_t* storage = static_cast<uint8_t*>(
+        ::operator new(slot_count + slot_count * sizeof(value_type), std::align_val_t(kGroupSize)));
+    this->control = storage;
+    this->slots = reinterpret_cast<value_type*>(storage + slot_count);
+    this->slot_count = slot_count;
+    this->entry_count = 0;
+    this->growth_left = max_load(slot_count);
+    std::memset(this->control, kEmpty, slot_count);
+  }
+
+  void deallocate() {
+    if (this->control) {
+      ::operator delete(this->control, std::align_val_t(kGroupSize));
+    }
+    this->control = nullptr;
+    this->slots = nullptr;
+    this->slot_count = 0;
+    this->entry_count = 0;
+    this->growth_left = 0;
+  }
+
+  void rehash(size_t slot_count) {
+    uint8_t* old_control = this->control;
+    value_type* old_slots = this->slots;
+    size_t old_slot_count = this->slot_count;
+
+    this->allocate(slot_count);
+    for (size_t i = 0; i < old_slot_count; i++) {
+      if (old_control[i] != kEmpty) {
+        this->insert_new(old_slots[i].first, old_slots[i].second);
+      }
+    }
+
+    if (old_control) {
+      ::operator delete(old_control, std::align_val_t(kGroupSize));
+    }
+  }
+
+  uint8_t* control = nullptr;
+  value_type* slots = nullptr;
+  size_t slot_count = 0;
+  size_t entry_count = 0;
+  size_t growth_left = 0;
+};
+}  // namespace Charly
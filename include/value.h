@@ -24,9 +24,13 @@
  * SOFTWARE.
  */
 
+#include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <new>
+#include <optional>
 #include <sstream>
-#include <unordered_map>
+#include <string_view>
 #include <vector>
 #include <chrono>
 
@@ -34,6 +38,11 @@
 
 #include "common.h"
 #include "defines.h"
+#include "operand-stack.h"
+#include "shape.h"
+#include "shared-memory.h"
+#include "utf8-kernels.h"
+#include "value-map.h"
 
 #pragma once
 
@@ -42,9 +51,9 @@ namespace Charly {
 using Timestamp = std::chrono::time_point<std::chrono::steady_clock>;
 
 // Human readable types of all data types
-const std::string kHumanReadableTypes[] = {"dead",      "class",     "object", "array",      "string",   "function",
-                                           "cfunction", "generator", "frame",  "catchtable", "cpointer", "number",
-                                           "boolean",   "null",      "symbol", "unknown"};
+const std::string kHumanReadableTypes[] = {"dead",     "class",     "object",    "array",  "string",
+                                           "function", "cfunction", "generator", "frame",  "cpointer",
+                                           "number",   "boolean",   "null",      "symbol", "unknown"};
 
 // Identifies which type a VALUE points to
 enum ValueType : uint8_t {
@@ -59,7 +68,6 @@ enum ValueType : uint8_t {
   kTypeCFunction,
   kTypeGenerator,
   kTypeFrame,
-  kTypeCatchTable,
   kTypeCPointer,
 
   // Types which are immediate encoded using nan-boxing
@@ -93,31 +101,256 @@ struct Basic {
   // Holds the type of the heap allocated struct
   uint8_t type : 5;
 
-  Basic() : f1(false), f2(false), mark(false), type(kTypeDead) {
+  // Set once the cell survived a collection and belongs to the old generation
+  bool old : 1;
+
+  // Set while the cell is part of the remembered set of the garbage collector
+  bool remembered : 1;
+
+  // Set while the cell is marked but its children haven't been marked yet
+  bool gray : 1;
+
+  Basic() : f1(false), f2(false), mark(false), type(kTypeDead), old(false), remembered(false), gray(false) {
   }
 };
 
+// Storage of arrays and dictionary objects which can be shared by multiple cells
+//
+// Copies of an array or object share the storage of the original until either of them is
+// modified. Code which modifies the storage has to obtain it via the writable method of the
+// owning cell, which copies the storage first if it is shared
+template <typename T>
+struct SharedStorage : public T {
+  std::atomic<uint32_t> refcount;
+
+  SharedStorage() : T(), refcount(1) {
+  }
+  SharedStorage(const SharedStorage& other) : T(other), refcount(1) {
+  }
+
+  SharedStorage& operator=(const SharedStorage& other) {
+    T::operator=(other);
+    return *this;
+  }
+
+  // Storages of arrays sent to other isolates are shared across threads
+  inline bool is_shared() {
+    return this->refcount.load(std::memory_order_acquire) > 1;
+  }
+
+  inline SharedStorage* retain() {
+    this->refcount.fetch_add(1, std::memory_order_relaxed);
+    return this;
+  }
+
+  inline void release() {
+    if (this->refcount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      delete this;
+    }
+  }
+};
+
+using ArrayStorage = SharedStorage<std::vector<VALUE>>;
+using DictionaryStorage = SharedStorage<ValueMap>;
+
 // Describes an object type
 //
-// It contains an unordered map which holds the objects values
+// The properties of an object are stored in slots, the layout of which is described by
+// the objects shape. The first few slots are stored inline, the others inside a separately
+// allocated overflow vector
+//
+// Objects which exceed kShapeMaxSlotCount properties or whose next shape would exceed
+// another limit of the shape tree are switched into dictionary mode. They drop their shape and store their properties inside a hash map, which might
+// be shared with copies of the object
+//
 // The klass field is a VALUE containing the class the object was constructed from
+//
+// Uses the f1 flag of the basic structure to mark objects which are the prototype of some class
+// Uses the f2 flag to mark objects with unresolved lazy members, see VM::read_lazy_member
+static constexpr uint32_t kObjectInlineSlotCount = 10;
 struct Object {
   Basic basic;
   VALUE klass;
-  std::unordered_map<VALUE, VALUE>* container;
+  Shape* shape;
+  VALUE inline_slots[kObjectInlineSlotCount];
+  std::vector<VALUE>* overflow_slots;
+  DictionaryStorage* container;
+
+  inline bool is_prototype() {
+    return this->basic.f1;
+  }
+
+  inline void set_prototype(bool f) {
+    this->basic.f1 = f;
+  }
+
+  inline bool has_lazy_members() {
+    return this->basic.f2;
+  }
+
+  inline void set_lazy_members(bool f) {
+    this->basic.f2 = f;
+  }
+
+  inline bool is_dictionary() {
+    return this->shape == nullptr;
+  }
+
+  // Read the slot at a given index
+  //
+  // This method performs no overflow checks
+  inline VALUE read_slot(uint32_t index) {
+    if (index < kObjectInlineSlotCount) {
+      return this->inline_slots[index];
+    } else {
+      return (*this->overflow_slots)[index - kObjectInlineSlotCount];
+    }
+  }
+
+  // Write the slot at a given index
+  //
+  // Slots are only ever appended, so the index is at most one past the last slot
+  inline void write_slot(uint32_t index, VALUE value) {
+    if (index < kObjectInlineSlotCount) {
+      this->inline_slots[index] = value;
+      return;
+    }
+
+    index -= kObjectInlineSlotCount;
+    if (this->overflow_slots == nullptr) {
+      this->overflow_slots = new std::vector<VALUE>();
+    }
+
+    if (index == this->overflow_slots->size()) {
+      this->overflow_slots->push_back(value);
+    } else {
+      (*this->overflow_slots)[index] = value;
+    }
+  }
+
+  inline std::optional<VALUE> read(VALUE key) {
+    if (this->is_dictionary()) {
+      auto it = this->container->find(key);
+      if (it == this->container->end()) {
+        return std::nullopt;
+      }
+
+      return it->second;
+    }
+
+    auto offset = this->shape->lookup(key);
+    if (!offset.has_value()) {
+      return std::nullopt;
+    }
+
+    return this->read_slot(offset.value());
+  }
+
+  inline bool contains(VALUE key) {
+    if (this->is_dictionary()) {
+      return this->container->count(key) == 1;
+    }
+
+    return this->shape->lookup(key).has_value();
+  }
+
+  // Returns the dictionary of this object, copying it if it is shared
+  inline DictionaryStorage* writable_container() {
+    if (this->container->is_shared()) {
+      DictionaryStorage* copy = new DictionaryStorage(*this->container);
+      this->container->release();
+      this->container = copy;
+    }
+
+    return this->container;
+  }
+
+  inline void write(VALUE key, VALUE value) {
+    if (this->is_dictionary()) {
+      (*this->writable_container())[key] = value;
+      return;
+    }
+
+    auto offset = this->shape->lookup(key);
+    if (offset.has_value()) {
+      this->write_slot(offset.value(), value);
+      return;
+    }
+
+    uint32_t index = this->shape->slot_count();
+    Shape* next = this->shape->transition(key);
+    if (next == nullptr) {
+      this->make_dictionary(index + 1);
+      (*this->container)[key] = value;
+      return;
+    }
+
+    this->shape = next;
+    this->write_slot(index, value);
+  }
+
+  inline size_t size() {
+    return this->is_dictionary() ? this->container->size() : this->shape->slot_count();
+  }
+
+  // Calls the callback with each key and value pair of this object
+  template <typename F>
+  inline void each(F callback) {
+    if (this->is_dictionary()) {
+      for (auto& entry : *this->container) {
+        callback(entry.first, entry.second);
+      }
+    } else {
+      for (uint32_t i = 0; i < this->shape->slot_count(); i++) {
+        callback(this->shape->keys[i], this->read_slot(i));
+      }
+    }
+  }
+
+  // Moves all properties into a hash map and drops the shape of this object
+  inline void make_dictionary(size_t initial_capacity = 0) {
+    if (this->is_dictionary()) {
+      return;
+    }
+
+    DictionaryStorage* dictionary = new DictionaryStorage();
+    dictionary->reserve(std::max(initial_capacity, static_cast<size_t>(this->shape->slot_count())));
+    this->each([&](VALUE key, VALUE value) { (*dictionary)[key] = value; });
+
+    delete this->overflow_slots;
+    this->overflow_slots = nullptr;
+    this->shape = nullptr;
+    this->container = dictionary;
+  }
 
   inline void clean() {
-    delete this->container;
+    delete this->overflow_slots;
+    if (this->container) {
+      this->container->release();
+    }
   }
 };
 
 // Array type
+//
+// The elements are stored inside an ArrayStorage, which might be shared with copies of the array
 struct Array {
   Basic basic;
-  std::vector<VALUE>* data;
+  ArrayStorage* data;
+
+  // Returns the storage of this array, copying it if it is shared
+  inline ArrayStorage* writable() {
+    if (this->data->is_shared()) {
+      ArrayStorage* copy = new ArrayStorage(*this->data);
+      this->data->release();
+      this->data = copy;
+    }
+
+    return this->data;
+  }
 
   inline void clean() {
-    delete this->data;
+    this->data->release();
   }
 };
 
@@ -130,14 +363,73 @@ struct Array {
 // now only stores a pointer and a length to the allocated memory
 //
 // Uses the f1 flag of the basic structure to differentiate between short and heap strings
-static constexpr uint32_t kShortStringMaxSize = 118;
+//
+// Heap strings created by concatenation store their data inside a StringBuffer, which might
+// be shared with other strings
+//
+// Strings are immutable, so the symbol and the codepoint count of a heap string are computed
+// once and cached inside the cell
+static constexpr uint32_t kShortStringMaxSize = 110;
+static constexpr uint32_t kUTF8LengthUnknown = 0xFFFFFFFF;
+
+// Growable buffer shared by heap strings created via concatenation
+//
+// Because strings are immutable, a string can share the buffer of the string it was
+// appended to. The bytes in the range [0, used) belong to some string, the remaining
+// capacity can be claimed by appending to the string which ends exactly at used.
+// Repeated concatenations like s = s + piece thus only copy each piece once
+struct StringBuffer {
+  std::atomic<uint32_t> refcount;
+  uint32_t used;
+  uint32_t capacity;
+
+  inline char* data() {
+    return reinterpret_cast<char*>(this + 1);
+  }
+
+  // Returns true if the string with the given length can append length bytes in place
+  inline bool can_append(uint32_t string_length, uint32_t length) {
+    return this->used == string_length && this->capacity - this->used >= length;
+  }
+
+  static inline StringBuffer* create(uint32_t capacity) {
+    void* memory = std::malloc(sizeof(StringBuffer) + capacity);
+    StringBuffer* buffer = new (memory) StringBuffer();
+    buffer->refcount = 0;
+    buffer->used = 0;
+    buffer->capacity = capacity;
+    return buffer;
+  }
+
+  inline void retain() {
+    this->refcount.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  inline void release() {
+    if (this->refcount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      this->~StringBuffer();
+      std::free(this);
+    }
+  }
+};
+
 struct String {
   Basic basic;
 
+  // Cached amount of codepoints, kUTF8LengthUnknown if it hasn't been computed yet
+  // Placed right after the basic field where it fits into the alignment padding
+  uint32_t utf8_length;
+
   union {
     struct {
       uint32_t length;
       char* data;
+
+      // Set if data points into a shared buffer
+      StringBuffer* buffer;
+
+      // Set if data points into the memory of a Buffer, like a mapped file
+      SharedMemory* memory;
     } lbuf;
     struct {
       uint8_t length;
@@ -145,6 +437,9 @@ struct String {
     } sbuf;
   };
 
+  // Cached symbol of this string, 0 if it hasn't been computed yet
+  VALUE symbol;
+
   inline char* data() {
     return basic.f1 ? sbuf.data : lbuf.data;
   }
@@ -159,7 +454,13 @@ struct String {
   }
   inline void clean() {
     if (!basic.f1) {
-      std::free(lbuf.data);
+      if (lbuf.buffer) {
+        lbuf.buffer->release();
+      } else if (lbuf.memory) {
+        lbuf.memory->release();
+      } else {
+        std::free(lbuf.data);
+      }
     }
   }
 };
@@ -168,20 +469,34 @@ struct String {
 //
 // Uses the f1 flag of the basic structure to differentiate between small and regular frames
 // Uses the f2 flag of the basic structure to store the machine should halt after this frame
+//
+// Frames allocated on the VM's frame stack store their local variables directly after
+// the frame struct, these frames are never seen by the sweep phase of the GC
+//
+// Each frame caches the frames further up its environment chain inside its display,
+// so reading a variable of an enclosing function doesn't have to walk the chain.
+// Entry i holds the frame i + 2 levels up, the display of a new frame is built from
+// the display of its parent environment frame in constant time
 static constexpr uint32_t kSmallFrameLocalCount = 6;
+static constexpr uint32_t kFrameDisplaySize = 2;
 struct Frame {
   Basic basic;
   Frame* parent;
   Frame* parent_environment_frame;
-  CatchTable* last_active_catchtable;
+  Frame* display[kFrameDisplaySize];
   VALUE caller_value;
   uint32_t stacksize_at_entry;
+  bool stack_allocated;
   union {
     std::vector<VALUE>* lenv;
     struct {
       VALUE data[kSmallFrameLocalCount];
       uint8_t lvarcount;
     } senv;
+    struct {
+      VALUE* data;
+      uint32_t lvarcount;
+    } xenv;
   };
   VALUE self;
   uint8_t* return_address;
@@ -194,12 +509,44 @@ struct Frame {
     this->basic.f2 = f;
   }
 
+  // Rebuild the display from the current parent environment frame
+  inline void build_display() {
+    Frame* parent = this->parent_environment_frame;
+    for (uint32_t i = 0; i < kFrameDisplaySize; i++) {
+      if (parent == nullptr) {
+        this->display[i] = nullptr;
+      } else {
+        this->display[i] = i == 0 ? parent->parent_environment_frame : parent->display[i - 1];
+      }
+    }
+  }
+
+  // Returns the frame a given amount of levels up the environment chain
+  //
+  // Returns nullptr if the chain isn't deep enough
+  inline Frame* environment_frame(uint32_t level) {
+    if (level == 0)
+      return this;
+    if (level == 1)
+      return this->parent_environment_frame;
+    if (level <= kFrameDisplaySize + 1)
+      return this->display[level - 2];
+
+    Frame* frame = this->display[kFrameDisplaySize - 1];
+    for (level -= kFrameDisplaySize + 1; frame && level > 0; level--) {
+      frame = frame->parent_environment_frame;
+    }
+    return frame;
+  }
+
   // Read the local variable at a given index
   //
   // This method performs no overflow checks
   inline VALUE read_local(uint32_t index) {
     if (this->basic.f1) {
       return this->senv.data[index];
+    } else if (this->stack_allocated) {
+      return this->xenv.data[index];
     } else {
       return (* this->lenv)[index];
     }
@@ -211,6 +558,8 @@ struct Frame {
   inline void write_local(uint32_t index, VALUE value) {
     if (this->basic.f1) {
       this->senv.data[index] = value;
+    } else if (this->stack_allocated) {
+      this->xenv.data[index] = value;
     } else {
       (* this->lenv)[index] = value;
     }
@@ -220,6 +569,8 @@ struct Frame {
   inline size_t lvarcount() {
     if (this->basic.f1) {
       return this->senv.lvarcount;
+    } else if (this->stack_allocated) {
+      return this->xenv.lvarcount;
     } else {
       if (this->lenv) return this->lenv->size();
       return 0;
@@ -241,15 +592,6 @@ struct Frame {
   }
 };
 
-// Catchtable used for exception handling
-struct CatchTable {
-  Basic basic;
-  uint8_t* address;
-  size_t stacksize;
-  Frame* frame;
-  CatchTable* parent;
-};
-
 // Contains a data pointer and a destructor method to deallocate c library resources
 struct CPointer {
   Basic basic;
@@ -274,14 +616,26 @@ struct Function {
   Frame* context;
   uint8_t* body_address;
   bool bound_self_set;
+
+  // Maximum amount of values the body keeps on the stack, as computed by the compiler
+  uint32_t max_stack_depth;
   VALUE bound_self;
-  std::unordered_map<VALUE, VALUE>* container;
+
+  // Allocated once the first member is written
+  ValueMap* container;
 
   inline bool anonymous() { return this->basic.f1; }
   inline bool needs_arguments() { return this->basic.f2; }
   inline void set_anonymous(bool f) { this->basic.f1 = f; }
   inline void set_needs_arguments(bool f) { this->basic.f2 = f; }
 
+  inline ValueMap* writable_container() {
+    if (this->container == nullptr) {
+      this->container = new ValueMap();
+    }
+    return this->container;
+  }
+
   inline void clean() {
     delete this->container;
   }
@@ -291,12 +645,27 @@ struct Function {
 
 // Function type used for including external functions from C-Land into the virtual machine
 // These are basically just a function pointer with some metadata associated to them
+// Entry point of native functions declared with typed parameters
+//
+// See native-binding.h
+typedef VALUE (*CFunctionThunk)(VM& vm, uint32_t argc, VALUE* argv);
+
 struct CFunction {
   Basic basic;
   VALUE name;
   void* pointer;
+  CFunctionThunk thunk;
   uint32_t argc;
-  std::unordered_map<VALUE, VALUE>* container;
+
+  // Allocated once the first member is written
+  ValueMap* container;
+
+  inline ValueMap* writable_container() {
+    if (this->container == nullptr) {
+      this->container = new ValueMap();
+    }
+    return this->container;
+  }
 
   inline void clean() {
     delete this->container;
@@ -315,9 +684,11 @@ struct CFunction {
 // Relevant fields which differ from the Function struct
 //
 // context_frame: Stores the frame that is active in the generator
-// context_catchtable: Stores the catchtable that is active in the generator
 // context_stack: Stores all values on the stack which belong to the generator
+//                While the generator is running, the VM operates on this stack directly and
+//                the stack of the caller is kept here instead, so pausing and resuming only swaps them
 // resume_address: Stores the address at which execution should continue the next time it is called
+// max_stack_depth: Maximum amount of values the generator keeps on its stack, as computed by the compiler
 // finished: Wether the generator has finished, if true, calling it will throw an exception
 //
 // The context_frame field contains the frame which was created for the function.
@@ -330,20 +701,28 @@ struct Generator {
   Basic basic;
   VALUE name;
   Frame* context_frame;
-  CatchTable* context_catchtable;
-  std::vector<VALUE>* context_stack;
+  OperandStack* context_stack;
   uint8_t* resume_address;
-  bool owns_catchtable;
   bool running;
   bool bound_self_set;
+  uint32_t max_stack_depth;
   VALUE bound_self;
-  std::unordered_map<VALUE, VALUE>* container;
+
+  // Allocated once the first member is written
+  ValueMap* container;
 
   inline bool finished() { return this->basic.f1; }
   inline bool started() { return this->basic.f2; }
   inline void set_finished(bool f) { this->basic.f1 = f; }
   inline void set_started(bool f) { this->basic.f2 = f; }
 
+  inline ValueMap* writable_container() {
+    if (this->container == nullptr) {
+      this->container = new ValueMap();
+    }
+    return this->container;
+  }
+
   inline void clean() {
     delete this->container;
     delete this->context_stack;
@@ -360,7 +739,16 @@ struct Class {
   std::vector<VALUE>* member_properties;
   VALUE prototype;
   VALUE parent_class;
-  std::unordered_map<VALUE, VALUE>* container;
+
+  // Allocated once the first static member is written
+  ValueMap* container;
+
+  inline ValueMap* writable_container() {
+    if (this->container == nullptr) {
+      this->container = new ValueMap();
+    }
+    return this->container;
+  }
 
   inline void clean() {
     delete this->member_properties;
@@ -498,7 +886,6 @@ inline Generator* charly_as_generator(VALUE value)    { return charly_as_pointer
 __attribute__((always_inline))
 inline Frame* charly_as_frame(VALUE value)            { return charly_as_pointer_to<Frame>(value); }
 __attribute__((always_inline))
-inline CatchTable* charly_as_catchtable(VALUE value)  { return charly_as_pointer_to<CatchTable>(value); }
 __attribute__((always_inline))
 inline CPointer* charly_as_cpointer(VALUE value)      { return charly_as_pointer_to<CPointer>(value); }
 
@@ -564,7 +951,6 @@ inline bool charly_is_callable(VALUE value) {
 __attribute__((always_inline))
 inline bool charly_is_frame(VALUE value) { return charly_is_heap_type(value, kTypeFrame); }
 __attribute__((always_inline))
-inline bool charly_is_catchtable(VALUE value) { return charly_is_heap_type(value, kTypeCatchTable); }
 __attribute__((always_inline))
 inline bool charly_is_cpointer(VALUE value) { return charly_is_heap_type(value, kTypeCPointer); }
 
@@ -904,10 +1290,15 @@ inline VALUE charly_create_istring(const char* ptr, uint8_t length) {
 // Get the amount of utf8 codepoints inside a string
 __attribute__((always_inline))
 inline uint32_t charly_string_utf8_length(VALUE value) {
-  uint32_t length = charly_string_length(value);
-  char* start = charly_string_data(value);
-  char* end = start + length;
-  return utf8::distance(start, end);
+  if (charly_is_hstring(value)) {
+    String* string = charly_as_hstring(value);
+    if (string->utf8_length == kUTF8LengthUnknown) {
+      string->utf8_length = UTF8::codepoint_count(string->data(), string->length());
+    }
+    return string->utf8_length;
+  }
+
+  return UTF8::codepoint_count(charly_string_data(value), charly_string_length(value));
 }
 
 // Get the utf8 codepoint at a given index into the string
@@ -1063,8 +1454,12 @@ inline float charly_value_to_float(VALUE value)     { return charly_value_to_dou
 // This method assumes the caller doesn't care what format the resulting number has,
 // so it might return an immediate integer or double
 __attribute__((always_inline))
+inline bool charly_fits_integer(int64_t value) {
+  return static_cast<int64_t>(static_cast<uint64_t>(value) << 16) >> 16 == value;
+}
+__attribute__((always_inline))
 inline VALUE charly_create_number(int64_t value) {
-  if (value >= kMaxInt || value <= kMinInt) return charly_create_double(value);
+  if (!charly_fits_integer(value)) return charly_create_double(value);
   return charly_create_integer(value);
 }
 __attribute__((always_inline))
@@ -1095,32 +1490,83 @@ inline VALUE charly_create_number(double value)   {
 __attribute__((always_inline))
 inline VALUE charly_create_number(float value)    { return charly_create_number((double)value); }
 
+// Integer arithmetic methods
+//
+// Sums and differences of two 48-bit integers always fit into an int64_t, products
+// are checked for overflow. Results which don't fit into 48 bits are returned as doubles
+//
+// Note: These methods assume the caller made sure that left and right are immediate integers
+__attribute__((always_inline))
+inline VALUE charly_add_int(VALUE left, VALUE right) {
+  return charly_create_number(charly_int_to_int64(left) + charly_int_to_int64(right));
+}
+__attribute__((always_inline))
+inline VALUE charly_sub_int(VALUE left, VALUE right) {
+  return charly_create_number(charly_int_to_int64(left) - charly_int_to_int64(right));
+}
+__attribute__((always_inline))
+inline VALUE charly_mul_int(VALUE left, VALUE right) {
+  int64_t l = charly_int_to_int64(left);
+  int64_t r = charly_int_to_int64(right);
+  int64_t result;
+  if (__builtin_mul_overflow(l, r, &result)) {
+    return charly_create_double(static_cast<double>(l) * static_cast<double>(r));
+  }
+  return charly_create_number(result);
+}
+
+// Divisions which leave no remainder produce an integer
+__attribute__((always_inline))
+inline VALUE charly_div_int(VALUE left, VALUE right) {
+  int64_t l = charly_int_to_int64(left);
+  int64_t r = charly_int_to_int64(right);
+  if (r != 0 && l % r == 0) return charly_create_number(l / r);
+  return charly_create_number(static_cast<double>(l) / static_cast<double>(r));
+}
+
+// Non-negative exponents are computed via exponentiation by squaring
+__attribute__((always_inline))
+inline VALUE charly_pow_int(VALUE left, VALUE right) {
+  int64_t base = charly_int_to_int64(left);
+  int64_t exponent = charly_int_to_int64(right);
+
+  if (exponent >= 0) {
+    int64_t result = 1;
+    int64_t factor = base;
+    bool overflow = false;
+    while (exponent > 0 && !overflow) {
+      if (exponent & 1) overflow |= __builtin_mul_overflow(result, factor, &result);
+      exponent >>= 1;
+      if (exponent > 0) overflow |= __builtin_mul_overflow(factor, factor, &factor);
+    }
+
+    if (!overflow) return charly_create_number(result);
+  }
+
+  return charly_create_number(std::pow(static_cast<double>(base), static_cast<double>(charly_int_to_int64(right))));
+}
+
 // Binary arithmetic methods
 //
 // Note: These methods assume the caller made sure that left and right are of a number type
 __attribute__((always_inline))
 inline VALUE charly_add_number(VALUE left, VALUE right) {
-  if (charly_is_int(left) && charly_is_int(right)) {
-    return charly_create_number(charly_int_to_int64(left) + charly_int_to_int64(right));
-  }
+  if (charly_is_int(left) && charly_is_int(right)) return charly_add_int(left, right);
   return charly_create_number(charly_number_to_double(left) + charly_number_to_double(right));
 }
 __attribute__((always_inline))
 inline VALUE charly_sub_number(VALUE left, VALUE right) {
-  if (charly_is_int(left) && charly_is_int(right)) {
-    return charly_create_number(charly_int_to_int64(left) - charly_int_to_int64(right));
-  }
+  if (charly_is_int(left) && charly_is_int(right)) return charly_sub_int(left, right);
   return charly_create_number(charly_number_to_double(left) - charly_number_to_double(right));
 }
 __attribute__((always_inline))
 inline VALUE charly_mul_number(VALUE left, VALUE right) {
-  if (charly_is_int(left) && charly_is_int(right)) {
-    return charly_create_number(charly_int_to_int64(left) * charly_int_to_int64(right));
-  }
+  if (charly_is_int(left) && charly_is_int(right)) return charly_mul_int(left, right);
   return charly_create_number(charly_number_to_double(left) * charly_number_to_double(right));
 }
 __attribute__((always_inline))
 inline VALUE charly_div_number(VALUE left, VALUE right) {
+  if (charly_is_int(left) && charly_is_int(right)) return charly_div_int(left, right);
   return charly_create_number(charly_number_to_double(left) / charly_number_to_double(right));
 }
 __attribute__((always_inline))
@@ -1133,9 +1579,7 @@ inline VALUE charly_mod_number(VALUE left, VALUE right) {
 }
 __attribute__((always_inline))
 inline VALUE charly_pow_number(VALUE left, VALUE right) {
-  if (charly_is_int(left) && charly_is_int(right)) {
-    return charly_create_number(std::pow(charly_int_to_int64(left), charly_int_to_int64(right)));
-  }
+  if (charly_is_int(left) && charly_is_int(right)) return charly_pow_int(left, right);
   return charly_create_number(std::pow(charly_number_to_double(left), charly_number_to_double(right)));
 }
 __attribute__((always_inline))
@@ -1317,12 +1761,20 @@ inline VALUE charly_string_mul_into_immediate(VALUE left, int64_t amount) {
 }
 
 // Convert types into symbols
+//
+// std::hash produces the same value for a std::string and a std::string_view of the same
+// characters, so symbols can be computed without copying the data into a std::string
 __attribute__((always_inline))
-inline VALUE charly_create_symbol(const std::string& input) {
-  size_t val = std::hash<std::string>{}(input);
+inline VALUE charly_create_symbol(const char* data, size_t length) {
+  size_t val = std::hash<std::string_view>{}(std::string_view(data, length));
   return kSignatureSymbol | (val & kMaskSymbol);
 }
 
+__attribute__((always_inline))
+inline VALUE charly_create_symbol(const std::string& input) {
+  return charly_create_symbol(input.data(), input.size());
+}
+
 // TODO: Refactor this...
 // It creates too many copies of data and std::stringstream is not acceptable
 __attribute__((always_inline))
@@ -1330,9 +1782,15 @@ inline VALUE charly_create_symbol(VALUE value) {
   uint8_t type = charly_get_type(value);
   switch (type) {
     case kTypeString: {
-      char* str_data = charly_string_data(value);
-      uint32_t str_length = charly_string_length(value);
-      return charly_create_symbol(std::string(str_data, str_length));
+      if (charly_is_hstring(value)) {
+        String* string = charly_as_hstring(value);
+        if (!string->symbol) {
+          string->symbol = charly_create_symbol(string->data(), string->length());
+        }
+        return string->symbol;
+      }
+
+      return charly_create_symbol(charly_string_data(value), charly_string_length(value));
     }
     case kTypeNumber: {
       if (charly_is_float(value)) {
@@ -1362,7 +1820,7 @@ inline VALUE charly_create_pointer(void* ptr) {
 
 // External libs interface
 struct CharlyLibSignatures {
-  std::vector<std::tuple<std::string, uint32_t>> signatures;
+  std::vector<std::tuple<std::string, uint32_t, CFunctionThunk>> signatures;
 };
 
 // Shorthand for declaring charly api methods to export
@@ -1370,7 +1828,8 @@ struct CharlyLibSignatures {
   extern "C" VALUE N
 
 // Shorthands for defining the signatures
-#define F(N, A) {#N, A},
+#define F(N, A) {#N, A, nullptr},
+#define NATIVE(N) {#N, NativeBinding<N>::kArgc, NativeBinding<N>::thunk},
 #define CHARLY_MANIFEST(P) \
   extern "C" { \
     CharlyLibSignatures __charly_signatures = {{ \
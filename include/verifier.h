@@ -0,0 +1,95 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "instructionblock.h"
+#include "opcode.h"
+
+#pragma once
+
+namespace Charly::Compilation {
+
+// Checks that an instructionblock can be executed without corrupting the state of the VM
+//
+// The interpreter trusts the blocks it executes. Its handlers don't validate the operands of
+// instructions and pop values without checking the size of the stack. Every block is verified
+// before it is handed to the VM, no matter if it was just compiled or loaded from the module cache.
+//
+// A block is valid if
+// - it consists of complete instructions with known opcodes
+// - branches, branch tables, exception handlers and functions point at the start of an instruction
+// - execution can't run past the end of the block
+// - every instruction is reached with the same stack depth on all paths and never pops values
+//   which were pushed before its function was entered
+// - functions return with exactly their return value left on the stack
+// - local variables are accessed within the frames of the enclosing functions
+// - yield instructions only appear inside generators
+// - it contains no native function pointers
+//
+// The code at the start of a block runs without a frame of its own. The functions it creates
+// have the top level frame as their parent environment.
+class Verifier {
+public:
+  Verifier(InstructionBlock& b) : block(b) {
+  }
+
+  // Returns a description of the first problem found, or nothing if the block is valid
+  //
+  // The code generator verifies its blocks before it writes the stack depth operands of PutFunction
+  // and PutGenerator instructions. All other callers check that they cover the depth of the body
+  std::optional<std::string> verify(bool check_declared_stack_depths = true);
+
+  // Maximum stack depth of each function and generator body, keyed by the offset of its first instruction
+  std::unordered_map<uint32_t, uint32_t> stack_depths;
+
+private:
+  // State shared by all instructions of a function or generator body
+  struct Body {
+    // Local variable counts of the frames the body can access, indexed by level
+    std::vector<uint32_t> environment;
+    bool has_frame = false;
+    bool generator = false;
+  };
+
+  std::optional<std::string> verify_instructions();
+  std::optional<std::string> verify_body(uint32_t entry, const Body& body);
+
+  // Merges the body created at entry with the bodies created elsewhere
+  std::optional<std::string> add_body(uint32_t entry, const Body& body);
+
+  InstructionBlock& block;
+  std::vector<bool> instruction_starts;
+  std::unordered_map<uint32_t, Body> bodies;
+  std::vector<uint32_t> pending_bodies;
+
+  // Offsets of the PutFunction and PutGenerator instructions which can be executed
+  std::vector<uint32_t> reachable_creators;
+};
+}  // namespace Charly::Compilation
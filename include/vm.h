@@ -28,14 +28,24 @@
 #include <optional>
 #include <queue>
 #include <map>
+#include <unordered_set>
 #include <atomic>
 #include <chrono>
+#include <filesystem>
+#include <functional>
+#include <memory>
 
 #include "defines.h"
 #include "gc.h"
+#include "instruction-profile.h"
 #include "instructionblock.h"
 #include "internals.h"
+#include "jit.h"
 #include "opcode.h"
+#include "output-buffer.h"
+#include "random.h"
+#include "runtime-metrics.h"
+#include "sampling-profiler.h"
 #include "status.h"
 #include "stringpool.h"
 #include "symboltable.h"
@@ -47,54 +57,185 @@
 #include "sourcefile.h"
 
 #include "async_task.h"
+#include "event-loop.h"
+#include "isolate-channel.h"
+#include "socket.h"
+#include "timer-wheel.h"
+#include "worker-pool.h"
 
 #pragma once
 
 namespace Charly {
 
-struct VMInstructionProfileEntry {
-  uint64_t encountered = 0;
-  uint64_t average_length = 0;
+// Size of the contiguous region frames are bump-allocated from
+//
+// Calls which don't fit into the frame stack anymore fall back to allocating their
+// frame inside the GC heap
+static constexpr size_t kFrameStackSize = 1024 * 1024 * 2;
+
+// Caches the results of lookups performed by a single ReadMemberSymbol instruction
+//
+// Entries are keyed on the class whose prototype chain was searched. The whole cache
+// is considered empty if its epoch doesn't match the epoch of the VM, which gets incremented
+// each time a prototype or primitive class is modified
+static constexpr uint32_t kInlineCacheEntryCount = 4;
+struct InlineCacheEntry {
+  VALUE klass = kNull;
+  VALUE value = kNull;
 };
 
-// Stores how often each type of instruction was encountered
-// and how it took on average
-class VMInstructionProfile {
-public:
-  VMInstructionProfile() : entries(nullptr) {
-    this->entries = new VMInstructionProfileEntry[kOpcodeCount];
+struct InlineCache {
+  uint64_t epoch = 0;
+  uint32_t size = 0;
+  uint32_t next_victim = 0;
+  InlineCacheEntry entries[kInlineCacheEntryCount];
+
+  // Slot of the symbol in objects of a given shape
+  // Shapes never change their layout, so this entry never needs to be invalidated
+  Shape* shape = nullptr;
+  uint32_t slot = 0;
+
+  inline std::optional<VALUE> lookup(VALUE klass, uint64_t current_epoch) {
+    if (this->epoch != current_epoch) {
+      return std::nullopt;
+    }
+
+    for (uint32_t i = 0; i < this->size; i++) {
+      if (this->entries[i].klass == klass) {
+        return this->entries[i].value;
+      }
+    }
+
+    return std::nullopt;
   }
-  ~VMInstructionProfile() {
-    delete[] this->entries;
+
+  inline void insert(VALUE klass, VALUE value, uint64_t current_epoch) {
+    if (this->epoch != current_epoch) {
+      this->epoch = current_epoch;
+      this->size = 0;
+      this->next_victim = 0;
+    }
+
+    // Once the cache is full, entries get replaced in a round-robin fashion
+    if (this->size < kInlineCacheEntryCount) {
+      this->entries[this->size++] = {klass, value};
+    } else {
+      this->entries[this->next_victim] = {klass, value};
+      this->next_victim = (this->next_victim + 1) % kInlineCacheEntryCount;
+    }
   }
+};
+
+// Program output is collected in a buffer, which is written to the output stream once it
+// reaches this size, before the VM blocks waiting for input or events and when the VM exits
+static constexpr size_t kOutputBufferFlushThreshold = 1 << 13;
+
+// Global cache for method lookups on primitive values
+//
+// Direct-mapped table keyed on the primitive class and the symbol that was looked up.
+// Shares its epoch with the inline caches, so modifying a prototype or replacing a
+// primitive class invalidates it too
+static constexpr uint32_t kMethodCacheSize = 1024;
+struct MethodCacheEntry {
+  uint64_t epoch = 0;
+  VALUE klass = kNull;
+  VALUE symbol = kNull;
+  std::optional<VALUE> value;
+};
+
+struct MethodCache {
+  MethodCacheEntry entries[kMethodCacheSize];
+
+  inline MethodCacheEntry& entry_for(VALUE klass, VALUE symbol) {
+    return this->entries[((klass >> 4) ^ symbol) & (kMethodCacheSize - 1)];
+  }
+
+  inline bool lookup(VALUE klass, VALUE symbol, uint64_t current_epoch, std::optional<VALUE>& result) {
+    MethodCacheEntry& entry = this->entry_for(klass, symbol);
+    if (entry.epoch != current_epoch || entry.klass != klass || entry.symbol != symbol) {
+      return false;
+    }
 
-  void add_entry(Opcode opcode, uint64_t length) {
-    VMInstructionProfileEntry& entry = this->entries[opcode];
-    entry.average_length = (entry.average_length * entry.encountered + length) / (entry.encountered + 1);
-    entry.encountered += 1;
+    result = entry.value;
+    return true;
   }
 
-  VMInstructionProfileEntry* entries;
+  inline void insert(VALUE klass, VALUE symbol, std::optional<VALUE> value, uint64_t current_epoch) {
+    this->entry_for(klass, symbol) = {current_epoch, klass, symbol, value};
+  }
 };
 
+// Idle VM which executed the prelude, isolates are booted from a copy of its heap
+//
+// See isolate.cpp
+struct BootImage;
+
 struct VMContext {
   SymbolTable& symtable;
   StringPool& stringpool;
   Compilation::CompilerManager& compiler_manager;
 
   bool instruction_profile = false;
+
+  // Also profile each executed instruction by its address, for the annotated disassembly
+  bool instruction_site_profile = false;
+
   bool trace_opcodes = false;
   bool trace_catchtables = false;
   bool trace_frames = false;
   bool trace_gc = false;
   bool verbose_addresses = false;
   bool single_worker_thread = false;
+  bool reload_changed_modules = false;
+  bool perf_map = false;
+
+  // Compile functions to native code once their calls and loop iterations reach jit_threshold
+  bool jit = false;
+  bool trace_jit = false;
+  uint32_t jit_threshold = kDefaultJITThreshold;
+
+  // Maximum amount of async worker threads, 0 sizes the pool to the cpu quota of the process
+  uint32_t worker_threads = 0;
+
+  // Attribute every nth allocation to the instruction performing it, 0 disables the allocation profiler
+  uint32_t allocation_sample_interval = 0;
+
+  // Write a line of runtime metrics to metrics_stream every metrics_interval milliseconds, 0 disables it
+  uint32_t metrics_interval = 0;
+  std::ostream* metrics_stream = nullptr;
+
+  // Memory ceilings, see GarbageCollectorConfig::max_heap_bytes and task_allocation_budget
+  size_t max_heap_bytes = 0;
+  size_t task_allocation_budget = 0;
+
+  // Called right before the VM throws an out of memory exception
+  std::function<void(VM&, OutOfMemoryReason)> out_of_memory_callback{};
+
+  // Shared by all isolates spawned from this context, created by the first spawn
+  std::shared_ptr<BootImage> boot_image{};
 
   std::istream& in_stream = std::cin;
   std::ostream& out_stream = std::cout;
   std::ostream& err_stream = std::cerr;
 };
 
+// A module imported via Internals::import
+//
+// The modification time is only consulted if the reload_changed_modules flag is set
+struct ImportedModule {
+  VALUE exports;
+  std::filesystem::file_time_type modification_time;
+};
+
+// A member of an object which is imported the first time it is read
+//
+// See Internals::lazy_import
+struct LazyMember {
+  VALUE object;
+  VALUE symbol;
+  std::string path;
+};
+
 /*
  * Stores information about a callback the VM needs to execute
  * */
@@ -103,27 +244,17 @@ struct VMTask {
   VALUE fn;
   VALUE argument;
 
+  // Time the task was added to the task queue and, for timers, the time it was scheduled for
+  Timestamp queued_at;
+  Timestamp deadline;
+
   VMTask(uint64_t u, VALUE f, VALUE a) : uid(u), fn(f), argument(a) {
   }
 
   VMTask(VALUE f, VALUE a) : uid(0), fn(f), argument(a) {
   }
-};
 
-/*
- * Represents the state of a single worker thread
- * */
-struct WorkerThread {
-  uint16_t tid;
-  bool currently_executing_task;
-  std::thread th;
-
-  WorkerThread(std::function<void(void*, uint16_t)> fn, void* vm_handle, uint16_t _tid)
-      : tid(_tid), currently_executing_task(false), th(fn, vm_handle, _tid) {
-  }
-
-  ~WorkerThread() {
-    if (this->th.joinable()) this->th.join();
+  VMTask() : uid(0), fn(kNull), argument(kNull) {
   }
 };
 
@@ -132,41 +263,70 @@ class VM {
   friend ManagedContext;
 
 public:
-  VM(VMContext& ctx)
-      : context(ctx),
-        gc(GarbageCollectorConfig{.out_stream = ctx.err_stream, .err_stream = ctx.err_stream, .trace = ctx.trace_gc}, this),
-        running(true),
-        frames(nullptr),
-        catchstack(nullptr),
-        ip(nullptr),
-        halted(false) {
-
-    // Determine how many worker threads to spawn
-    uint16_t num_threads = std::max(std::thread::hardware_concurrency(), static_cast<uint32_t>(32));
-    if (ctx.single_worker_thread) num_threads = 1;
-
-    // Start all the worker threads
-    for (int i = 0; i < num_threads; i++) {
-      this->worker_threads.push_back(new WorkerThread(this->worker_thread_handler, this, i));
-    }
-
+  VM(VMContext& ctx) : VM(ctx, nullptr) {
     this->exec_prelude();
   }
+
+  // Boots a VM from the heap of another, already initialized VM instead of executing the prelude
+  //
+  // The image VM has to be idle while it is being copied. Both VMs may share
+  // a VMContext, but must then never run at the same time
+  VM(VMContext& ctx, VM& image) : VM(ctx, nullptr) {
+    this->clone_heap_from(image);
+    this->booted_from_image = true;
+  }
   VM(const VM& other) = delete;
   VM(VM&& other) = delete;
   ~VM() {
     this->exit(0);
     this->gc.do_collect();
 
-    // Deallocate worker threads
-    auto it = this->worker_threads.begin();
-    while (it != this->worker_threads.end()) {
-      WorkerThread* wt = *it;
-      delete wt;
-      this->worker_threads.erase(it);
+    for (InstructionBlock* block : this->cloned_blocks) {
+      this->context.compiler_manager.address_mapping.unregister_instructionblock(block);
+      delete block;
     }
+
+    delete this->root_shape;
+    delete[] this->frame_stack;
+    delete this->method_cache;
   }
 
+private:
+  VM(VMContext& ctx, std::nullptr_t)
+      : context(ctx),
+        gc(GarbageCollectorConfig{.max_heap_bytes = ctx.max_heap_bytes,
+                                  .task_allocation_budget = ctx.task_allocation_budget,
+                                  .trace = ctx.trace_gc,
+                                  .out_stream = ctx.err_stream,
+                                  .err_stream = ctx.err_stream},
+           this),
+        running(true),
+        frames(nullptr),
+        ip(nullptr),
+        halted(false),
+        dispatch_loop(VM::select_dispatch_loop(ctx)),
+        jit(VM::jit_helpers(), ctx.jit && !ctx.instruction_profile && !ctx.trace_opcodes, ctx.jit_threshold,
+            ctx.perf_map),
+        worker_pool(VM::worker_thread_count(ctx),
+                    [this](std::vector<AsyncTaskResult>& batch) { this->execute_worker_tasks(batch); }) {
+    if (ctx.instruction_profile) {
+      this->instruction_profile.enable(ctx.instruction_site_profile);
+    }
+
+    if (ctx.allocation_sample_interval) {
+      this->gc.set_allocation_sample_interval(ctx.allocation_sample_interval);
+    }
+
+    // Module bodies and the prelude bootstrap run without a frame reserving space for them
+    this->stack.reserve(kOperandStackInitialCapacity);
+  }
+
+  // Copies all values reachable from the top frame and the primitive classes of another VM
+  //
+  // See boot-image.cpp
+  void clone_heap_from(VM& image);
+
+public:
   // Methods that operate on the VM's frames
   Frame* pop_frame();
   Frame* create_frame(VALUE self, Function* calling_function, uint8_t* return_address, bool halt_after_return = false);
@@ -176,14 +336,45 @@ public:
                       uint8_t* return_address,
                       bool halt_after_return = false);
 
+  // Moves the current frame off the frame stack into the GC heap
+  //
+  // Must be called before a reference to the current frame is stored anywhere
+  // which could outlive the call, e.g. when creating closures or generators
+  Frame* capture_current_frame();
+
+  // Creates a heap frame which only serves as the environment of functions, without entering it
+  Frame* create_environment_frame(Frame* parent_environment_frame, uint32_t lvarcount);
+
+  // Unlinks a frame which was just left and releases its frame stack memory
+  void release_frame(Frame* frame);
+
   // Stack manipulation
-  VALUE pop_stack();
-  void push_stack(VALUE value);
+  //
+  // Pushes go into the space the current frame reserved, popping an empty stack yields null
+  // Verified bytecode never pops more values than it pushed
+  inline VALUE pop_stack() {
+    return this->stack.pop();
+  }
+
+  // Pops the return value of code run on behalf of native code
+  //
+  // Uncaught exceptions unwind the stack without leaving a value behind
+  inline VALUE pop_result() {
+    return this->stack.size() ? this->stack.pop() : kNull;
+  }
+  inline void push_stack(VALUE value) {
+    this->stack.push(value);
+  }
 
-  // CatchStack manipulation
-  CatchTable* create_catchtable(uint8_t* address);
-  CatchTable* pop_catchtable();
-  void unwind_catchstack();
+  // Exception handling
+  //
+  // Handlers are looked up in the exception tables of the instructionblocks
+  // the instructions of the active frames belong to
+  std::optional<uint8_t*> find_exception_handler(uint8_t* address);
+  void unwind_to_handler();
+
+  // Returns the address of the instruction which entered a frame
+  uint8_t* call_site_address(Frame* frame);
 
   // Methods to create new data types
   VALUE create_object(uint32_t initial_capacity);
@@ -191,15 +382,20 @@ public:
   VALUE create_string(const char* data, uint32_t length);
   VALUE create_string(const std::string& str);
   VALUE create_weak_string(char* data, uint32_t length);
+  VALUE create_buffered_string(StringBuffer* buffer, uint32_t length);
+
+  // Creates a string pointing into shared memory instead of copying it, short strings are still copied
+  VALUE create_string_view(SharedMemory* memory, char* data, uint32_t length);
   VALUE create_empty_short_string();
   VALUE create_function(VALUE name,
                         uint8_t* body_address,
                         uint32_t argc,
                         uint32_t lvarcount,
+                        uint32_t max_stack_depth,
                         bool anonymous,
                         bool needs_arguments);
-  VALUE create_cfunction(VALUE name, uint32_t argc, void* pointer);
-  VALUE create_generator(VALUE name, uint8_t* resume_address);
+  VALUE create_cfunction(VALUE name, uint32_t argc, void* pointer, CFunctionThunk thunk = nullptr);
+  VALUE create_generator(VALUE name, uint8_t* resume_address, uint32_t max_stack_depth);
   VALUE create_class(VALUE name);
   VALUE create_cpointer(void* data, void* destructor);
   VALUE create_symbol(VALUE value);
@@ -244,42 +440,87 @@ public:
   VALUE ubnot(VALUE value);
 
   // Machine functionality
-  VALUE readmembersymbol(VALUE source, VALUE symbol);
+  VALUE readmembersymbol(VALUE source, VALUE symbol, InlineCache* cache = nullptr);
   VALUE setmembersymbol(VALUE target, VALUE symbol, VALUE value);
   VALUE readmembervalue(VALUE source, VALUE value);
   VALUE setmembervalue(VALUE target, VALUE member_value, VALUE value);
   std::optional<VALUE> findprototypevalue(Class* source, VALUE symbol);
   std::optional<VALUE> findprimitivevalue(VALUE value, VALUE symbol);
+  VALUE primitive_class_of(VALUE value);
   VALUE call_dynamic(VALUE v, const std::vector<VALUE>& args, VALUE target = kNull);
-  void call(uint32_t argc, bool with_target, bool halt_after_return = false);
-  void call_function(Function* function, uint32_t argc, VALUE* argv, VALUE self, bool halt_after_return = false);
+
+  // Calls a function from inside a native function and returns its result
+  //
+  // Returns an empty optional if the callback threw an exception. The native function
+  // should return right away, execution continues inside the exception handler
+  std::optional<VALUE> call_callback(VALUE function, uint32_t argc, VALUE* argv);
+  void call(uint32_t argc, bool with_target, bool halt_after_return = false, bool tail_call = false);
+  void call_function(Function* function,
+                     uint32_t argc,
+                     VALUE* argv,
+                     VALUE self,
+                     bool halt_after_return = false,
+                     bool tail_call = false);
   void call_cfunction(CFunction* function, uint32_t argc, VALUE* argv);
   void call_class(Class* klass, uint32_t argc, VALUE* argv);
   void call_generator(Generator* klass, uint32_t argc, VALUE* argv);
+
+  // Switches back to the stack of the caller once a generator returned or threw
+  void leave_generator_stack(Generator* generator);
   void initialize_member_properties(Class* klass, Object* object);
   bool invoke_class_constructors(Class* klass, Object* object, uint32_t argc, VALUE* argv);
   void throw_exception(const std::string& message);
   void throw_exception(VALUE payload);
+
+  // Throws the out of memory exception requested by the garbage collector
+  void throw_out_of_memory_exception();
   VALUE stacktrace_array();
+
+  // Prints the functions which were inlined at address, innermost first
+  //
+  // Calls the callback after each printed entry, returns true if there were any
+  bool print_inlined_functions(std::ostream& io, uint8_t* address, const std::function<void()>& callback);
+
+  // Prints the file, line and column the instruction at address was generated from
+  void print_source_position(std::ostream& io, uint8_t* address);
   void panic(STATUS reason);
   void stacktrace(std::ostream& io);
-  void catchstacktrace(std::ostream& io);
   void stackdump(std::ostream& io);
+
+  // Records the current frame chain in the sampling profiler
+  void record_profiler_sample();
+
+  // Snapshot of the event loop and worker pool metrics
+  //
+  // write_runtime_metrics writes it as a single line of key=value pairs
+  RuntimeMetricsReport runtime_metrics();
+  void write_runtime_metrics(std::ostream& out);
   void inline pretty_print(std::ostream& io, void* value) {
     this->pretty_print(io, (VALUE)value);
   }
   void pretty_print(std::ostream& io, VALUE value);
   void to_s(std::ostream& io, VALUE value, uint32_t depth = 0);
+  void to_s(OutputBuffer& io, VALUE value, uint32_t depth = 0);
+
+  // Creates a string containing the to_s representation of value
+  VALUE to_string(VALUE value);
+
+  // Appends the to_s representation of value to the program output
+  void write_output(VALUE value);
+  void flush_output();
 
   // Private member access
   inline Frame* get_current_frame() {
     return this->frames;
   }
+  inline Frame* get_top_frame() {
+    return this->top_frame;
+  }
 
   // Instructions
   Opcode fetch_instruction();
   void op_readlocal(uint32_t index, uint32_t level);
-  void op_readmembersymbol(VALUE symbol);
+  void op_readmembersymbol(VALUE symbol, uint32_t* cache_index);
   void op_readmembervalue();
   void op_readarrayindex(uint32_t index);
   void op_setlocalpush(uint32_t index, uint32_t level);
@@ -292,15 +533,16 @@ public:
   void op_setarrayindex(uint32_t index);
   void op_putself(uint32_t level);
   void op_putvalue(VALUE value);
-  void op_putstring(char* data, uint32_t length);
+  void op_putstring(uint32_t offset, uint32_t length);
   void op_putfunction(VALUE symbol,
                       uint8_t* body_address,
                       bool anonymous,
                       bool needs_arguments,
                       uint32_t argc,
-                      uint32_t lvarcount);
+                      uint32_t lvarcount,
+                      uint32_t max_stack_depth);
   void op_putcfunction(VALUE symbol, void* pointer, uint32_t argc);
-  void op_putgenerator(VALUE symbol, uint8_t* resume_address);
+  void op_putgenerator(VALUE symbol, uint8_t* resume_address, uint32_t max_stack_depth);
   void op_putarray(uint32_t count);
   void op_puthash(uint32_t count);
   void op_putclass(VALUE name,
@@ -316,11 +558,11 @@ public:
   void op_swap();
   void op_call(uint32_t argc);
   void op_callmember(uint32_t argc);
+  void op_tailcall(uint32_t argc);
+  void op_tailcallmember(uint32_t argc);
   void op_return();
   void op_yield();
   void op_throw();
-  void op_registercatchtable(int32_t offset);
-  void op_popcatchtable();
   void op_branch(int32_t offset);
   void op_branchif(int32_t offset);
   void op_branchunless(int32_t offset);
@@ -331,50 +573,119 @@ public:
   void op_brancheq(int32_t offset);
   void op_branchneq(int32_t offset);
   void op_typeof();
+  void op_readlocalmembersymbol(uint32_t index, uint32_t level, VALUE symbol, uint32_t* cache_index);
+  void op_putselfmembersymbol(uint32_t level, VALUE symbol, uint32_t* cache_index);
+  void op_readlocalpair(uint32_t index1, uint32_t level1, uint32_t index2, uint32_t level2);
+  void op_branchtable(uint32_t table_index, uint32_t* cache_index);
+  void op_loopincrement(int32_t offset, uint32_t index, uint32_t level, VALUE step, Opcode comparison);
+  void op_readglobal(uint32_t index);
+  void op_setglobalpush(uint32_t index);
+  void op_setglobal(uint32_t index);
+  void op_readglobalmembersymbol(uint32_t index, VALUE symbol, uint32_t* cache_index);
 
   inline void set_primitive_value(VALUE value) {
     this->primitive_value = value;
+    this->invalidate_inline_caches();
   }
   inline void set_primitive_object(VALUE value) {
     this->primitive_object = value;
+    this->invalidate_inline_caches();
   }
   inline void set_primitive_class(VALUE value) {
     this->primitive_class = value;
+    this->invalidate_inline_caches();
   }
   inline void set_primitive_array(VALUE value) {
     this->primitive_array = value;
+    this->invalidate_inline_caches();
   }
   inline void set_primitive_string(VALUE value) {
     this->primitive_string = value;
+    this->invalidate_inline_caches();
   }
   inline void set_primitive_number(VALUE value) {
     this->primitive_number = value;
+    this->invalidate_inline_caches();
   }
   inline void set_primitive_function(VALUE value) {
     this->primitive_function = value;
+    this->invalidate_inline_caches();
   }
   inline void set_primitive_generator(VALUE value) {
     this->primitive_generator = value;
+    this->invalidate_inline_caches();
   }
   inline void set_primitive_boolean(VALUE value) {
     this->primitive_boolean = value;
+    this->invalidate_inline_caches();
   }
   inline void set_primitive_null(VALUE value) {
     this->primitive_null = value;
+    this->invalidate_inline_caches();
+  }
+
+  inline const GarbageCollectorStats& gc_stats() {
+    return this->gc.get_stats();
+  }
+
+  // Native code has to call this before storing a value into an existing cell
+  inline void write_barrier(VALUE cell) {
+    this->gc.write_barrier(cell);
+  }
+
+  // Runs a full collection and finishes sweeping before returning
+  inline void collect_garbage() {
+    this->gc.do_collect();
+  }
+
+  inline void set_allocation_sample_interval(uint32_t interval) {
+    this->gc.set_allocation_sample_interval(interval);
+  }
+
+  inline std::vector<AllocationSiteReport> allocation_profile() {
+    return this->gc.allocation_profile();
+  }
+
+  inline void write_allocation_profile(std::ostream& out) {
+    this->gc.write_allocation_profile(out);
+  }
+
+  inline size_t write_heap_snapshot(std::ostream& out) {
+    return this->gc.write_heap_snapshot(out);
+  }
+
+  // Invalidates the inline caches of all ReadMemberSymbol instructions
+  // and the global method cache
+  inline void invalidate_inline_caches() {
+    this->inline_cache_epoch++;
   }
 
   VMContext context;
   VMInstructionProfile instruction_profile;
+  SamplingProfiler profiler;
+  EventLoopMetrics event_loop_metrics;
 
   inline uint8_t* get_ip() {
     return this->ip;
   }
 
+  // Lookup and registration of modules imported via Internals::import
+  std::optional<VALUE> find_imported_module(const std::string& path);
+  void register_imported_module(const std::string& path, VALUE exports);
+
+  // Members which are only imported once they are read for the first time
+  void register_lazy_member(Object* object, VALUE symbol, const std::string& path);
+  std::optional<VALUE> read_lazy_member(Object* object, VALUE symbol);
+
   void run();
   void exec_prelude();
   VALUE exec_module(Function* fn);
   VALUE exec_function(Function* fn, VALUE argument);
   uint8_t start_runtime();
+
+  // Returns true once there are no more tasks, timers, sockets, isolates or worker threads
+  // which could schedule work
+  bool can_exit_runtime();
   void exit(uint8_t status_code);
 
   VALUE register_module(InstructionBlock* block);
@@ -387,19 +698,49 @@ public:
   void clear_timer(uint64_t uid);
   void clear_interval(uint64_t uid);
 
-  static void worker_thread_handler(void* vm_handle, uint16_t tid);
-
   void register_worker_task(AsyncTask task);
 
   std::chrono::time_point<std::chrono::high_resolution_clock> starttime;
+
+  // Time at which the event loop writes the next line of runtime metrics, see VMContext::metrics_interval
+  Timestamp next_metrics_dump;
+
+  // Open sockets, indexed by their id
+  //
+  // See libs/net
+  std::unordered_map<uint64_t, Socket> sockets;
+  uint64_t next_socket_id = 0;
+
+  // Channels to the parent and the children of this isolate, indexed by their id
+  //
+  // See libs/isolate
+  std::unordered_map<uint64_t, IsolateHandle> isolates;
+  uint64_t next_isolate_id = 0;
+
+  // Source of the random numbers of the math library
+  //
+  // See libs/math
+  Random random;
+
+  // The main thread blocks on this while it is idle, worker threads wake it up after pushing results
+  //
+  // Also reports readiness of the sockets
+  EventLoop event_loop;
+
 private:
 
   uint8_t status_code = 0;
 
   GarbageCollector gc;
 
-  // Used to avoid an overflow when printing cyclic data structures
-  std::vector<VALUE> pretty_print_stack;
+  // Containers which are currently being printed, used to avoid an overflow when printing cyclic data structures
+  std::unordered_set<VALUE> pretty_print_visited;
+
+  // See kOutputBufferFlushThreshold
+  OutputBuffer output_buffer;
+
+  // Reused by to_string
+  OutputBuffer format_buffer;
 
   // References to the primitive classes of the VM
   VALUE primitive_value = kNull;
@@ -417,23 +758,12 @@ private:
   std::queue<VMTask> task_queue;
   bool running;
 
-  // Remaining timers & intervals
-  std::map<Timestamp, VMTask> timers;
-  std::map<Timestamp, std::tuple<VMTask, uint32_t>> intervals;
+  // Remaining timers & intervals, indexed by their uid
+  TimerWheel<VMTask> timers;
 
   uint64_t next_timer_id = 0;
 
-  // Worker threads
-  bool worker_threads_active = true;
-  std::vector<WorkerThread*> worker_threads;
-
-  // Holds the remaining tasks
-  std::condition_variable worker_task_queue_cv;
-  std::mutex worker_task_queue_m;
-  std::queue<AsyncTask> worker_task_queue;
-
   // Finished tasks which are ready to be handled by the vm
-  std::condition_variable worker_result_queue_cv;
   std::mutex worker_result_queue_m;
   std::queue<AsyncTaskResult> worker_result_queue;
 
@@ -445,13 +775,94 @@ private:
   // objects & methods.
   Frame* top_frame;
 
+  // Root of the shape tree, the shape of all newly created objects
+  Shape* root_shape = new Shape();
+
+  // Inline caches of all ReadMemberSymbol instructions
+  // Index 0 is reserved for instructions which haven't been assigned a cache yet
+  //
+  // Grows on demand, indices are claimed via claim_cache_index
+  std::vector<InlineCache> inline_caches = std::vector<InlineCache>(1);
+  uint64_t inline_cache_epoch = 1;
+
+  // Instructionblocks of all BranchTable instructions, saves an address lookup per dispatch
+  // Index 0 is reserved for instructions which haven't been assigned an entry yet
+  std::vector<InstructionBlock*> branch_table_blocks = std::vector<InstructionBlock*>(1);
+
+  // Results of method lookups on primitive values
+  MethodCache* method_cache = new MethodCache();
+
+  // Strings created from string literals, keyed by their offset into the string pool
+  //
+  // The string pool is append-only and deduplicates its strings, so an offset
+  // always refers to the same literal. These strings are GC roots
+  std::unordered_map<uint32_t, VALUE> interned_literals;
+
+  // Return values of all modules imported so far, keyed by their canonical path
+  //
+  // Every module is only compiled and executed the first time it is imported. The export
+  // values are GC roots
+  std::unordered_map<std::string, ImportedModule> imported_modules;
+
+  // Lazy members which weren't read yet
+  //
+  // The objects are GC roots
+  std::vector<LazyMember> lazy_members;
+
+  // Copies of the instructionblocks of the VM this VM was booted from
+  //
+  // Their instructions reference the inline caches of this VM, so they can't be shared
+  std::vector<InstructionBlock*> cloned_blocks;
+  bool booted_from_image = false;
+
   // Holds the last value that was thrown as an exception
   VALUE last_exception_thrown;
 
-  std::vector<VALUE> stack;
+  OperandStack stack;
   Frame* frames;
-  CatchTable* catchstack;
+
+  // Frames of calls which didn't capture their environment are bump-allocated
+  // from this region instead of the GC heap
+  uint8_t* frame_stack = new uint8_t[kFrameStackSize];
+  uint8_t* frame_stack_top = frame_stack;
+  uint8_t* frame_stack_end = frame_stack + kFrameStackSize;
+
   uint8_t* ip;
   bool halted;
+
+  // The main interpreter loop is instantiated once for every combination
+  // of debugging features. The variant matching the VMContext is selected
+  // when the VM is constructed, so the default loop contains no instrumentation code
+  using DispatchLoop = void (VM::*)();
+  template <bool kInstructionProfile, bool kTraceOpcodes>
+  void run_loop();
+  static DispatchLoop select_dispatch_loop(const VMContext& context);
+  DispatchLoop dispatch_loop;
+
+  // Native code of hot functions
+  //
+  // Compiled code calls jit_execute for every instruction. The instrumented dispatch
+  // loops don't enter compiled code, so the JIT is disabled if any of them is selected
+  template <Opcode O>
+  static uint8_t* jit_execute(VM* vm, uint8_t* ip);
+  static const JITHelper* jit_helpers();
+  bool enter_compiled_code(bool count);
+  void compile_function(Function* function);
+  JIT jit;
+
+  // Runs file system operations and other AsyncTasks off the main thread
+  //
+  // Declared last, so its threads are joined before the result queue is destroyed
+  static uint32_t worker_thread_count(const VMContext& context);
+
+  // Returns the cache index stored in an instruction, claims a new one if it has none yet
+  //
+  // Isolates share their instructionblocks, so indices are unique within the process
+  // and every VM sizes its own caches to the indices it encounters
+  static uint32_t claim_cache_index(uint32_t* operand);
+  static std::mutex cache_index_mutex;
+  static uint32_t next_cache_index;
+  void execute_worker_tasks(std::vector<AsyncTaskResult>& batch);
+  WorkerPool worker_pool;
 };
 }  // namespace Charly
@@ -0,0 +1,166 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "async_task.h"
+#include "runtime-metrics.h"
+
+#pragma once
+
+namespace Charly {
+
+// Tasks waiting for a single worker thread
+//
+// The owning worker takes tasks from the front, other workers steal from the back
+struct WorkerDeque {
+  std::mutex m;
+  std::deque<AsyncTask> tasks;
+
+  inline void push(AsyncTask&& task) {
+    std::unique_lock<std::mutex> lk(this->m);
+    this->tasks.push_back(std::move(task));
+  }
+
+  // Moves up to limit tasks into batch, returns the amount of tasks taken
+  inline size_t pop(std::vector<AsyncTaskResult>& batch, size_t limit) {
+    std::unique_lock<std::mutex> lk(this->m);
+    size_t count = 0;
+    while (this->tasks.size() && count < limit) {
+      batch.emplace_back().task = std::move(this->tasks.front());
+      this->tasks.pop_front();
+      count++;
+    }
+    return count;
+  }
+
+  // Moves up to half of the queued tasks into batch, returns the amount of tasks taken
+  inline size_t steal(std::vector<AsyncTaskResult>& batch, size_t limit) {
+    std::unique_lock<std::mutex> lk(this->m);
+    size_t count = 0;
+    size_t half = (this->tasks.size() + 1) / 2;
+    while (count < half && count < limit) {
+      batch.emplace_back().task = std::move(this->tasks.back());
+      this->tasks.pop_back();
+      count++;
+    }
+    return count;
+  }
+};
+
+// Pool of threads executing AsyncTasks
+//
+// Threads are only started once tasks are submitted and there is no parked thread
+// which could take them, up to a maximum of max_threads. Each thread owns a deque
+// which submitted tasks are distributed to in round-robin order. Threads whose own
+// deque is empty steal from the others and park once no work is left.
+//
+// Tasks are only ever submitted by the main thread of the VM. The batch handler executes
+// the taken tasks and hands their results back, it runs on the worker thread which took them.
+class WorkerPool {
+public:
+  using BatchHandler = std::function<void(std::vector<AsyncTaskResult>&)>;
+
+  // The maximum amount of tasks a thread takes at once
+  static constexpr size_t kBatchSize = 16;
+
+  WorkerPool(uint32_t max_threads, BatchHandler handler);
+  WorkerPool(const WorkerPool& other) = delete;
+  WorkerPool(WorkerPool&& other) = delete;
+  ~WorkerPool() {
+    this->stop();
+  }
+
+  // The amount of cpus this process may use
+  //
+  // Respects the cpu quota of the cgroup the process runs in, if there is one
+  static uint32_t available_cpus();
+
+  void submit(AsyncTask&& task);
+
+  // Discards all queued tasks and joins all threads once they have finished their current batch
+  void stop();
+
+  // Returns true if no task is queued or being executed
+  bool idle();
+
+  // Calls the callback with every queued task
+  template <typename Fn>
+  void each_queued_task(Fn&& callback) {
+    for (auto& deque : this->deques) {
+      std::unique_lock<std::mutex> lk(deque->m);
+      for (const AsyncTask& task : deque->tasks) {
+        callback(task);
+      }
+    }
+  }
+
+  inline size_t thread_count() {
+    return this->threads.size();
+  }
+
+  // Amount of tasks which were submitted but not taken by a thread yet
+  inline size_t queued_task_count() {
+    return this->queued_tasks.load(std::memory_order_relaxed);
+  }
+
+  WorkerPoolMetrics metrics;
+
+private:
+  void worker_main(size_t id);
+
+  // Fills batch with tasks from the threads own deque or another thread's deque
+  //
+  // Parks the thread while there is no work, returns false once the pool is stopped
+  bool take_tasks(size_t id, std::vector<AsyncTaskResult>& batch);
+
+  BatchHandler handler;
+  uint32_t max_threads;
+  size_t next_deque = 0;
+
+  std::vector<std::unique_ptr<WorkerDeque>> deques;
+  std::vector<std::thread> threads;
+
+  // Counts tasks which were submitted but not taken yet and threads which currently hold tasks
+  std::atomic<size_t> queued_tasks{0};
+  std::atomic<size_t> executing_threads{0};
+
+  std::mutex park_m;
+  std::condition_variable park_cv;
+  size_t parked_threads = 0;
+
+  // Only modified while holding park_m, so parking threads can't miss the pool being stopped
+  std::atomic<bool> active{true};
+};
+
+}  // namespace Charly
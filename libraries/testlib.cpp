@@ -1,5 +1,6 @@
 // clang -g -Wall -fPIC -shared -o libraries/testlib.lib libraries/testlib.cpp -Iinclude -Ilibs -I/usr/local/opt/llvm/include/c++/v1 -lstdc++ -std=c++17
 
+#include "native-binding.h"
 #include "value.h"
 #include "vm.h"
 
@@ -7,9 +8,12 @@ using namespace Charly;
 
 /* ###--- Manifest of userspace functions ---### */
 
+int32_t add(int32_t v);
+int32_t read();
+
 CHARLY_MANIFEST(
-  F(add, 1)
-  F(read, 0)
+  NATIVE(add)
+  NATIVE(read)
 )
 
 /* ###--- Charly ---### */
@@ -30,13 +34,11 @@ CHARLY_API(__charly_destructor, () {
 
 /* ###--- Userspace ---### */
 
-CHARLY_API(add, (VM& vm, VALUE v) {
-  if (charly_is_number(v)) {
-    *counter += charly_int_to_int32(v);
-  }
-  return charly_create_number(*counter);
-})
+int32_t add(int32_t v) {
+  *counter += v;
+  return *counter;
+}
 
-CHARLY_API(read, () {
-  return charly_create_number(*counter);
-})
+int32_t read() {
+  return *counter;
+}
@@ -24,6 +24,7 @@
  * SOFTWARE.
  */
 
+#include <csignal>
 #include <filesystem>
 #include <fstream>
 
@@ -102,36 +103,137 @@ int CLI::run() {
     return 0;
   }
 
+  // Periodic runtime metrics are written to stderr unless a file was given
+  std::ofstream metrics_file;
+  std::ostream* metrics_stream = &std::cerr;
+  if (this->flags.metrics_output.size()) {
+    metrics_file.open(this->flags.metrics_output);
+    if (!metrics_file.is_open()) {
+      std::cerr << "Could not open " << this->flags.metrics_output << '\n';
+      return 1;
+    }
+    metrics_stream = &metrics_file;
+  }
+
   VMContext context({.symtable = cmanager.symtable,
                      .stringpool = cmanager.stringpool,
                      .compiler_manager = cmanager,
                      .instruction_profile = this->flags.instruction_profile,
+                     .instruction_site_profile = this->flags.asm_profile,
                      .trace_opcodes = this->flags.trace_opcodes,
                      .trace_catchtables = this->flags.trace_catchtables,
                      .trace_frames = this->flags.trace_frames,
                      .trace_gc = this->flags.trace_gc,
                      .verbose_addresses = this->flags.verbose_addresses,
-                     .single_worker_thread = this->flags.single_worker_thread});
+                     .single_worker_thread = this->flags.single_worker_thread,
+                     .reload_changed_modules = this->flags.reload_modules,
+                     .perf_map = this->flags.perf_map,
+                     .jit = this->flags.jit,
+                     .trace_jit = this->flags.trace_jit,
+                     .jit_threshold = this->flags.jit_threshold ? this->flags.jit_threshold : kDefaultJITThreshold,
+                     .worker_threads = this->flags.worker_threads,
+                     .allocation_sample_interval = this->flags.allocation_sample_interval,
+                     .metrics_interval = this->flags.metrics_interval,
+                     .metrics_stream = metrics_stream,
+                     .max_heap_bytes = static_cast<size_t>(this->flags.max_heap_size) << 20,
+                     .task_allocation_budget = static_cast<size_t>(this->flags.task_allocation_budget) << 20});
   VM vm(context);
 
+  // Sending SIGUSR2 to the process writes a heap snapshot into the working directory
+  std::signal(SIGUSR2, [](int) { GarbageCollector::request_heap_snapshot(); });
+
   VALUE fn_prelude = vm.register_module(cresult_prelude->instructionblock.value());
   VALUE fn_user = vm.register_module(cresult_userfile->instructionblock.value());
 
   vm.register_task({fn_prelude, kNull});
   vm.register_task({fn_user, kNull});
+
+  if (this->flags.sample_profile) {
+    uint32_t interval = this->flags.sample_profile_interval;
+    vm.profiler.start(interval ? std::chrono::microseconds(interval) : kDefaultSampleInterval);
+  }
+
   uint8_t status_code = vm.start_runtime();
 
   // Display the instruction profile if requested
   if (this->flags.instruction_profile) {
-    uint8_t opcode = 0;
-    std::cerr << "Instruction Profile:" << '\n';
-    while (opcode < kOpcodeCount) {
-      std::cerr << std::setw(26);
-      std::cerr << kOpcodeMnemonics[opcode] << ": ";
-      std::cerr << std::setw(1);
-      std::cerr << vm.instruction_profile.entries[opcode].average_length << " nanoseconds ";
-      std::cerr << "(" << vm.instruction_profile.entries[opcode].encountered << " samples)" << '\n';
-      opcode++;
+    InstructionProfileOrder order = InstructionProfileOrder::TotalTime;
+    if (this->flags.instruction_profile_order == "count") {
+      order = InstructionProfileOrder::Count;
+    } else if (this->flags.instruction_profile_order == "average") {
+      order = InstructionProfileOrder::AverageTime;
+    }
+
+    vm.instruction_profile.dump(std::cerr, order);
+  }
+
+  // Display the disassembly annotated with the instruction profile if requested
+  if (this->flags.asm_profile) {
+    if (this->flags.asm_profile_output.size()) {
+      std::ofstream output(this->flags.asm_profile_output);
+      if (output.is_open()) {
+        cmanager.dump_profiled_modules(vm.instruction_profile, &output);
+      } else {
+        std::cerr << "Could not open " << this->flags.asm_profile_output << '\n';
+        cmanager.dump_profiled_modules(vm.instruction_profile);
+      }
+    } else {
+      cmanager.dump_profiled_modules(vm.instruction_profile);
+    }
+  }
+
+  // Display the sampling profile if requested
+  if (this->flags.sample_profile) {
+    vm.profiler.stop();
+    vm.profiler.write_summary(std::cerr);
+
+    if (this->flags.sample_profile_output.size()) {
+      std::ofstream output(this->flags.sample_profile_output);
+      if (output.is_open()) {
+        vm.profiler.write_collapsed(output);
+      } else {
+        std::cerr << "Could not open " << this->flags.sample_profile_output << '\n';
+      }
+    }
+  }
+
+  // Write a final line of metrics covering the whole run
+  if (this->flags.metrics_interval) {
+    vm.write_runtime_metrics(*metrics_stream);
+  }
+
+  // Display the allocation sites if requested
+  if (this->flags.allocation_sample_interval) {
+    vm.write_allocation_profile(std::cerr);
+  }
+
+  // Display the gc statistics if requested
+  if (this->flags.gc_stats) {
+    const GarbageCollectorStats& stats = vm.gc_stats();
+    std::cerr << "GC Statistics:" << '\n';
+    std::cerr << "  Minor collections:    " << stats.minor_collections << '\n';
+    std::cerr << "  Full collections:     " << stats.full_collections << '\n';
+    std::cerr << "  Mark steps:           " << stats.mark_steps << '\n';
+    std::cerr << "  Sweep steps:          " << stats.sweep_steps << '\n';
+    std::cerr << "  Pauses:               " << stats.pause_count << '\n';
+    std::cerr << "  Total pause time:     " << stats.total_pause_time / 1000 << " microseconds" << '\n';
+    std::cerr << "  Max pause time:       " << stats.max_pause_time / 1000 << " microseconds" << '\n';
+    std::cerr << "  Allocated cells:      " << stats.allocated_cells << " (" << stats.allocated_bytes << " bytes)" << '\n';
+    std::cerr << "  Allocation rate:      " << static_cast<uint64_t>(stats.allocation_rate())
+              << " bytes per second" << '\n';
+    std::cerr << "  Freed cells:          " << stats.freed_cells << '\n';
+    std::cerr << "  Promoted cells:       " << stats.promoted_cells << '\n';
+    std::cerr << "  Live cells:           " << stats.live_cells << '\n';
+    std::cerr << "  Heaps:                " << stats.heap_count << " (" << stats.heap_bytes << " bytes, peak "
+              << stats.peak_heap_bytes << " bytes)" << '\n';
+    std::cerr << "  Pause histogram:" << '\n';
+    for (size_t i = 0; i < PauseHistogram::kBucketCount; i++) {
+      if (i == PauseHistogram::kBucketCount - 1) {
+        std::cerr << "    >= " << std::setw(6) << (1 << (i - 1)) << " microseconds: ";
+      } else {
+        std::cerr << "     < " << std::setw(6) << (1 << i) << " microseconds: ";
+      }
+      std::cerr << std::setw(1) << stats.pause_histogram.buckets[i] << '\n';
     }
   }
 
@@ -33,23 +33,23 @@ Label Assembler::reserve_label() {
 
 Label Assembler::place_label() {
   Label label = this->reserve_label();
-  this->labels[label] = this->writeoffset;
+  this->labels[label] = this->current_offset();
   return label;
 }
 
 Label Assembler::place_label(Label label) {
-  this->labels[label] = this->writeoffset;
+  this->labels[label] = this->current_offset();
   return label;
 }
 
 void Assembler::write_branch_to_label(Label label) {
   if (this->labels.count(label) > 0) {
     this->write_u8(Opcode::Branch);
-    this->write_u32(this->labels[label] - this->writeoffset + 1);
+    this->write_u32(this->labels[label] - this->current_offset() + 1);
   } else {
-    uint32_t instruction_base = this->writeoffset;
+    uint32_t instruction_base = this->current_offset();
     this->write_u8(Opcode::Branch);
-    this->unresolved_label_references.push_back(UnresolvedReference({label, this->writeoffset, instruction_base}));
+    this->unresolved_label_references.push_back(UnresolvedReference({label, this->current_offset(), instruction_base}));
     this->write_u32(0);
   }
 }
@@ -57,11 +57,11 @@ void Assembler::write_branch_to_label(Label label) {
 void Assembler::write_branchif_to_label(Label label) {
   if (this->labels.count(label) > 0) {
     this->write_u8(Opcode::BranchIf);
-    this->write_u32(this->labels[label] - this->writeoffset + 1);
+    this->write_u32(this->labels[label] - this->current_offset() + 1);
   } else {
-    uint32_t instruction_base = this->writeoffset;
+    uint32_t instruction_base = this->current_offset();
     this->write_u8(Opcode::BranchIf);
-    this->unresolved_label_references.push_back(UnresolvedReference({label, this->writeoffset, instruction_base}));
+    this->unresolved_label_references.push_back(UnresolvedReference({label, this->current_offset(), instruction_base}));
     this->write_u32(0);
   }
 }
@@ -69,11 +69,11 @@ void Assembler::write_branchif_to_label(Label label) {
 void Assembler::write_branchlt_to_label(Label label) {
   if (this->labels.count(label) > 0) {
     this->write_u8(Opcode::BranchLt);
-    this->write_u32(this->labels[label] - this->writeoffset + 1);
+    this->write_u32(this->labels[label] - this->current_offset() + 1);
   } else {
-    uint32_t instruction_base = this->writeoffset;
+    uint32_t instruction_base = this->current_offset();
     this->write_u8(Opcode::BranchLt);
-    this->unresolved_label_references.push_back(UnresolvedReference({label, this->writeoffset, instruction_base}));
+    this->unresolved_label_references.push_back(UnresolvedReference({label, this->current_offset(), instruction_base}));
     this->write_u32(0);
   }
 }
@@ -81,11 +81,11 @@ void Assembler::write_branchlt_to_label(Label label) {
 void Assembler::write_branchgt_to_label(Label label) {
   if (this->labels.count(label) > 0) {
     this->write_u8(Opcode::BranchGt);
-    this->write_u32(this->labels[label] - this->writeoffset + 1);
+    this->write_u32(this->labels[label] - this->current_offset() + 1);
   } else {
-    uint32_t instruction_base = this->writeoffset;
+    uint32_t instruction_base = this->current_offset();
     this->write_u8(Opcode::BranchGt);
-    this->unresolved_label_references.push_back(UnresolvedReference({label, this->writeoffset, instruction_base}));
+    this->unresolved_label_references.push_back(UnresolvedReference({label, this->current_offset(), instruction_base}));
     this->write_u32(0);
   }
 }
@@ -93,11 +93,11 @@ void Assembler::write_branchgt_to_label(Label label) {
 void Assembler::write_branchle_to_label(Label label) {
   if (this->labels.count(label) > 0) {
     this->write_u8(Opcode::BranchLe);
-    this->write_u32(this->labels[label] - this->writeoffset + 1);
+    this->write_u32(this->labels[label] - this->current_offset() + 1);
   } else {
-    uint32_t instruction_base = this->writeoffset;
+    uint32_t instruction_base = this->current_offset();
     this->write_u8(Opcode::BranchLe);
-    this->unresolved_label_references.push_back(UnresolvedReference({label, this->writeoffset, instruction_base}));
+    this->unresolved_label_references.push_back(UnresolvedReference({label, this->current_offset(), instruction_base}));
     this->write_u32(0);
   }
 }
@@ -105,11 +105,11 @@ void Assembler::write_branchle_to_label(Label label) {
 void Assembler::write_branchge_to_label(Label label) {
   if (this->labels.count(label) > 0) {
     this->write_u8(Opcode::BranchGe);
-    this->write_u32(this->labels[label] - this->writeoffset + 1);
+    this->write_u32(this->labels[label] - this->current_offset() + 1);
   } else {
-    uint32_t instruction_base = this->writeoffset;
+    uint32_t instruction_base = this->current_offset();
     this->write_u8(Opcode::BranchGe);
-    this->unresolved_label_references.push_back(UnresolvedReference({label, this->writeoffset, instruction_base}));
+    this->unresolved_label_references.push_back(UnresolvedReference({label, this->current_offset(), instruction_base}));
     this->write_u32(0);
   }
 }
@@ -117,11 +117,11 @@ void Assembler::write_branchge_to_label(Label label) {
 void Assembler::write_brancheq_to_label(Label label) {
   if (this->labels.count(label) > 0) {
     this->write_u8(Opcode::BranchEq);
-    this->write_u32(this->labels[label] - this->writeoffset + 1);
+    this->write_u32(this->labels[label] - this->current_offset() + 1);
   } else {
-    uint32_t instruction_base = this->writeoffset;
+    uint32_t instruction_base = this->current_offset();
     this->write_u8(Opcode::BranchEq);
-    this->unresolved_label_references.push_back(UnresolvedReference({label, this->writeoffset, instruction_base}));
+    this->unresolved_label_references.push_back(UnresolvedReference({label, this->current_offset(), instruction_base}));
     this->write_u32(0);
   }
 }
@@ -129,11 +129,11 @@ void Assembler::write_brancheq_to_label(Label label) {
 void Assembler::write_branchneq_to_label(Label label) {
   if (this->labels.count(label) > 0) {
     this->write_u8(Opcode::BranchNeq);
-    this->write_u32(this->labels[label] - this->writeoffset + 1);
+    this->write_u32(this->labels[label] - this->current_offset() + 1);
   } else {
-    uint32_t instruction_base = this->writeoffset;
+    uint32_t instruction_base = this->current_offset();
     this->write_u8(Opcode::BranchNeq);
-    this->unresolved_label_references.push_back(UnresolvedReference({label, this->writeoffset, instruction_base}));
+    this->unresolved_label_references.push_back(UnresolvedReference({label, this->current_offset(), instruction_base}));
     this->write_u32(0);
   }
 }
@@ -141,25 +141,33 @@ void Assembler::write_branchneq_to_label(Label label) {
 void Assembler::write_branchunless_to_label(Label label) {
   if (this->labels.count(label) > 0) {
     this->write_u8(Opcode::BranchUnless);
-    this->write_u32(this->labels[label] - this->writeoffset + 1);
+    this->write_u32(this->labels[label] - this->current_offset() + 1);
   } else {
-    uint32_t instruction_base = this->writeoffset;
+    uint32_t instruction_base = this->current_offset();
     this->write_u8(Opcode::BranchUnless);
-    this->unresolved_label_references.push_back(UnresolvedReference({label, this->writeoffset, instruction_base}));
+    this->unresolved_label_references.push_back(UnresolvedReference({label, this->current_offset(), instruction_base}));
     this->write_u32(0);
   }
 }
 
-void Assembler::write_registercatchtable_to_label(Label label) {
+void Assembler::write_loopincrement_to_label(Label label,
+                                             uint32_t index,
+                                             uint32_t level,
+                                             VALUE step,
+                                             Opcode comparison) {
   if (this->labels.count(label) > 0) {
-    this->write_u8(Opcode::RegisterCatchTable);
-    this->write_u32(this->labels[label] - this->writeoffset + 1);
+    this->write_u8(Opcode::LoopIncrement);
+    this->write_u32(this->labels[label] - this->current_offset() + 1);
   } else {
-    uint32_t instruction_base = this->writeoffset;
-    this->write_u8(Opcode::RegisterCatchTable);
-    this->unresolved_label_references.push_back(UnresolvedReference({label, this->writeoffset, instruction_base}));
+    uint32_t instruction_base = this->current_offset();
+    this->write_u8(Opcode::LoopIncrement);
+    this->unresolved_label_references.push_back(UnresolvedReference({label, this->current_offset(), instruction_base}));
     this->write_u32(0);
   }
+  this->write_u32(index);
+  this->write_u32(level);
+  this->write_u64(step);
+  this->write_u8(comparison);
 }
 
 void Assembler::write_putfunction_to_label(VALUE symbol,
@@ -171,21 +179,23 @@ void Assembler::write_putfunction_to_label(VALUE symbol,
   if (this->labels.count(label) > 0) {
     this->write_u8(Opcode::PutFunction);
     this->write_u64(symbol);
-    this->write_u32(this->labels[label] - this->writeoffset + 1);
+    this->write_u32(this->labels[label] - this->current_offset() + 1);
     this->write_u8(anonymous);
     this->write_u8(needs_arguments);
     this->write_u32(argc);
     this->write_u32(lvarcount);
+    this->write_u32(0);
   } else {
-    uint32_t instruction_base = this->writeoffset;
+    uint32_t instruction_base = this->current_offset();
     this->write_u8(Opcode::PutFunction);
     this->write_u64(symbol);
-    this->unresolved_label_references.push_back(UnresolvedReference({label, this->writeoffset, instruction_base}));
+    this->unresolved_label_references.push_back(UnresolvedReference({label, this->current_offset(), instruction_base}));
     this->write_u32(0);
     this->write_u8(anonymous);
     this->write_u8(needs_arguments);
     this->write_u32(argc);
     this->write_u32(lvarcount);
+    this->write_u32(0);
   }
 }
 
@@ -193,16 +203,25 @@ void Assembler::write_putgenerator_to_label(VALUE symbol, Label label) {
   if (this->labels.count(label) > 0) {
     this->write_u8(Opcode::PutGenerator);
     this->write_u64(symbol);
-    this->write_u32(this->labels[label] - this->writeoffset + 1);
+    this->write_u32(this->labels[label] - this->current_offset() + 1);
+    this->write_u32(0);
   } else {
-    uint32_t instruction_base = this->writeoffset;
+    uint32_t instruction_base = this->current_offset();
     this->write_u8(Opcode::PutGenerator);
     this->write_u64(symbol);
-    this->unresolved_label_references.push_back(UnresolvedReference({label, this->writeoffset, instruction_base}));
+    this->unresolved_label_references.push_back(UnresolvedReference({label, this->current_offset(), instruction_base}));
+    this->write_u32(0);
     this->write_u32(0);
   }
 }
 
+void Assembler::write_branchtable_to_labels(const BranchTableLabels& table_labels) {
+  uint32_t table_index = this->branch_tables.size();
+  this->branch_tables.emplace_back();
+  this->unresolved_branch_tables.emplace_back(table_index, table_labels);
+  this->write_branchtable(table_index);
+}
+
 void Assembler::resolve_unresolved_label_references() {
   for (auto uref = this->unresolved_label_references.begin(); uref != this->unresolved_label_references.end();) {
     // Check if the label exists
@@ -216,5 +235,96 @@ void Assembler::resolve_unresolved_label_references() {
     this->read<int32_t>(uref->target_offset) = relative_offset;
     uref = this->unresolved_label_references.erase(uref);
   }
+
+  for (auto utable = this->unresolved_branch_tables.begin(); utable != this->unresolved_branch_tables.end();) {
+    const BranchTableLabels& table_labels = utable->second;
+
+    // Check if all labels exist
+    bool resolvable = this->labels.count(table_labels.default_label) > 0;
+    for (Label label : table_labels.integer_labels)
+      resolvable = resolvable && this->labels.count(label) > 0;
+    for (const auto& entry : table_labels.string_labels)
+      resolvable = resolvable && this->labels.count(entry.second) > 0;
+    if (!resolvable) {
+      utable++;
+      continue;
+    }
+
+    SwitchTable& table = this->branch_tables[utable->first];
+    table.integer_base = table_labels.integer_base;
+    table.default_target = this->labels[table_labels.default_label];
+    for (Label label : table_labels.integer_labels) {
+      table.integer_targets.push_back(this->labels[label]);
+    }
+    for (const auto& entry : table_labels.string_labels) {
+      table.add_string_target(entry.first, this->labels[entry.second]);
+    }
+
+    utable = this->unresolved_branch_tables.erase(utable);
+  }
+}
+
+static bool is_branch_opcode(Opcode opcode) {
+  switch (opcode) {
+    case Opcode::Branch:
+    case Opcode::BranchIf:
+    case Opcode::BranchUnless:
+    case Opcode::BranchLt:
+    case Opcode::BranchGt:
+    case Opcode::BranchLe:
+    case Opcode::BranchGe:
+    case Opcode::BranchEq:
+    case Opcode::BranchNeq:
+    case Opcode::LoopIncrement: return true;
+    default: return false;
+  }
+}
+
+void Assembler::thread_branches() {
+  uint32_t offset = 0;
+  while (offset < this->writeoffset) {
+    Opcode opcode = this->read<Opcode>(offset);
+    if (opcode >= kOpcodeCount) {
+      return;
+    }
+
+    if (is_branch_opcode(opcode)) {
+      uint32_t target = offset + this->read<int32_t>(offset + 1);
+
+      // Limit the amount of hops, empty infinite loops compile to cycles of branches
+      for (int hops = 0; hops < 16; hops++) {
+        if (target >= this->writeoffset || this->read<Opcode>(target) != Opcode::Branch) {
+          break;
+        }
+
+        uint32_t next_target = target + this->read<int32_t>(target + 1);
+        if (next_target == target) {
+          break;
+        }
+        target = next_target;
+      }
+
+      this->read<int32_t>(offset + 1) = target - offset;
+    }
+
+    offset += kInstructionLengths[opcode];
+  }
+}
+
+void Assembler::write_stack_depths(const std::unordered_map<uint32_t, uint32_t>& depths) {
+  uint32_t offset = 0;
+  while (offset < this->writeoffset) {
+    Opcode opcode = this->read<Opcode>(offset);
+
+    // The depth is the last operand of both instructions
+    if (opcode == Opcode::PutFunction || opcode == Opcode::PutGenerator) {
+      auto it = depths.find(offset + this->read<int32_t>(offset + 1 + sizeof(VALUE)));
+      if (it != depths.end()) {
+        this->read<uint32_t>(offset + kInstructionLengths[opcode] - sizeof(uint32_t)) = it->second;
+      }
+    }
+
+    offset += kInstructionLengths[opcode];
+  }
 }
 }  // namespace Charly::Compilation
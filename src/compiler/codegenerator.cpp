@@ -24,13 +24,23 @@
  * SOFTWARE.
  */
 
+#include <algorithm>
 #include <cmath>
+#include <limits>
+#include <optional>
 
 #include "codegenerator.h"
 #include "stringpool.h"
+#include "verifier.h"
 
 namespace Charly::Compilation {
 
+// Switch statements with fewer keys are faster to dispatch via the comparison chain
+static constexpr size_t kMinimumBranchTableKeys = 4;
+
+// Maximum amount of table slots per integer key
+static constexpr size_t kMaximumBranchTableSparseness = 4;
+
 InstructionBlock* CodeGenerator::compile(AST::AbstractNode* node) {
   this->visit_node(node);
   this->assembler.write_halt();
@@ -55,20 +65,28 @@ InstructionBlock* CodeGenerator::compile(AST::AbstractNode* node) {
     this->queued_functions.pop_front();
   }
   this->assembler.resolve_unresolved_label_references();
+  this->assembler.thread_branches();
+
+  if (!this->config.flags.no_peephole) {
+    PeepholeOptimizer optimizer(this->assembler);
+    optimizer.optimize();
+    this->result.peephole_report = optimizer.report;
+  }
+
+  // The stack depths of the bodies are computed during the verification
+  Verifier verifier(this->assembler);
+  if (std::optional<std::string> error = verifier.verify(false)) {
+    this->push_fatal_error(node, "Generated code failed verification: " + error.value());
+  }
+  this->assembler.write_stack_depths(verifier.stack_depths);
+
   return new InstructionBlock(this->assembler);
 }
 
 AST::AbstractNode* CodeGenerator::visit_block(AST::Block* node, VisitContinue) {
   this->assembler.write_nop();
   for (auto& node : node->statements) {
-    this->visit_node(node);
-
-    // If the statement produces an expression, pop it off the stack now
-    if (AST::yields_value(node)) {
-      if (!AST::is_assignment(node)) {
-        this->assembler.write_pop();
-      }
-    }
+    this->codegen_statement(node);
   }
 
   return node;
@@ -239,6 +257,11 @@ AST::AbstractNode* CodeGenerator::visit_do_until(AST::DoUntil* node, VisitContin
 }
 
 AST::AbstractNode* CodeGenerator::visit_while(AST::While* node, VisitContinue) {
+  if (AST::Assignment* increment = this->counted_loop_increment(node)) {
+    this->codegen_counted_loop(node, increment);
+    return node;
+  }
+
   // Setup labels
   Label condition_label = this->assembler.place_label();
   Label break_label = this->assembler.reserve_label();
@@ -318,13 +341,75 @@ AST::AbstractNode* CodeGenerator::visit_unary(AST::Unary* node, VisitContinue) {
 
 AST::AbstractNode* CodeGenerator::visit_binary(AST::Binary* node, VisitContinue) {
   // Codegen expression
-  this->visit_node(node->left);
-  this->visit_node(node->right);
+  this->codegen_operands(node->left, node->right);
   this->assembler.write_operator(kOperatorOpcodeMapping[node->operator_type]);
 
   return node;
 }
 
+// Builds a branch table for a switch statement whose conditions are all integer or all string literals
+//
+// Sparse integer keys would produce huge tables, those switches only use the comparison chain
+static std::optional<BranchTableLabels> build_branch_table(AST::Switch* node,
+                                                           const std::vector<Label>& block_labels,
+                                                           Label default_label) {
+  std::vector<std::pair<AST::AbstractNode*, Label>> keys;
+  size_t i = 0;
+  for (auto n : node->cases->children) {
+    for (auto c : n->as<AST::SwitchNode>()->conditions->children) {
+      keys.emplace_back(c, block_labels[i]);
+    }
+    i++;
+  }
+
+  if (keys.size() < kMinimumBranchTableKeys) {
+    return std::nullopt;
+  }
+
+  BranchTableLabels table_labels;
+  table_labels.default_label = default_label;
+
+  bool all_integers = std::all_of(keys.begin(), keys.end(), [](auto& key) {
+    return key.first->type() == AST::kTypeNumber &&
+           charly_is_int(charly_create_number(key.first->template as<AST::Number>()->value));
+  });
+  if (all_integers) {
+    int64_t min = std::numeric_limits<int64_t>::max();
+    int64_t max = std::numeric_limits<int64_t>::min();
+    for (auto& key : keys) {
+      int64_t value = key.first->as<AST::Number>()->value;
+      min = std::min(min, value);
+      max = std::max(max, value);
+    }
+
+    if (max - min >= static_cast<int64_t>(keys.size() * kMaximumBranchTableSparseness)) {
+      return std::nullopt;
+    }
+
+    // Iterate in reverse so the first case wins if a key appears twice
+    table_labels.integer_base = min;
+    table_labels.integer_labels.resize(max - min + 1, default_label);
+    for (auto it = keys.rbegin(); it != keys.rend(); it++) {
+      int64_t value = it->first->as<AST::Number>()->value;
+      table_labels.integer_labels[value - min] = it->second;
+    }
+
+    return table_labels;
+  }
+
+  bool all_strings = std::all_of(keys.begin(), keys.end(),
+                                 [](auto& key) { return key.first->type() == AST::kTypeString; });
+  if (all_strings) {
+    for (auto& key : keys) {
+      table_labels.string_labels.emplace_back(key.first->as<AST::String>()->value, key.second);
+    }
+
+    return table_labels;
+  }
+
+  return std::nullopt;
+}
+
 AST::AbstractNode* CodeGenerator::visit_switch(AST::Switch* node, VisitContinue) {
   // Setup labels
   Label end_label = this->assembler.reserve_label();
@@ -337,25 +422,34 @@ AST::AbstractNode* CodeGenerator::visit_switch(AST::Switch* node, VisitContinue)
   std::vector<Label> block_labels;
   block_labels.reserve(node->cases->children.size());
 
-  // Codegen the switch conditions
+  // Reserve the labels of the blocks which run if a node is selected
   for (auto n : node->cases->children) {
     // Check if this is a switchnode (it should be)
     if (n->type() != AST::kTypeSwitchNode) {
       this->push_fatal_error(n, "Expected node to be a SwitchNode");
     }
 
-    AST::SwitchNode* snode = n->as<AST::SwitchNode>();
+    block_labels.push_back(this->assembler.reserve_label());
+  }
 
-    // Label of the block which runs if this node is selected
-    Label node_block = this->assembler.reserve_label();
-    block_labels.push_back(node_block);
+  // Integer and string values are dispatched via a branch table, other values
+  // fall through to the comparison chain since they might overload the == operator
+  std::optional<BranchTableLabels> table_labels = build_branch_table(node, block_labels, default_block);
+  if (table_labels.has_value()) {
+    this->assembler.write_branchtable_to_labels(table_labels.value());
+  }
+
+  // Codegen the switch conditions
+  size_t case_index = 0;
+  for (auto n : node->cases->children) {
+    AST::SwitchNode* snode = n->as<AST::SwitchNode>();
+    Label node_block = block_labels[case_index++];
 
     // Codegen each condition
     for (auto c : snode->conditions->children) {
       this->assembler.write_dup();
       this->visit_node(c);
-      this->assembler.write_operator(Opcode::Eq);
-      this->assembler.write_branchif_to_label(node_block);
+      this->assembler.write_brancheq_to_label(node_block);
     }
   }
 
@@ -499,7 +593,6 @@ AST::AbstractNode* CodeGenerator::visit_andindexassignment(AST::ANDIndexAssignme
   this->assembler.write_readmembervalue();
   this->visit_node(node->expression);
   this->assembler.write_operator(kOperatorOpcodeMapping[node->operator_type]);
-  this->assembler.write_setmembervalue();
 
   if (node->yielded_value_needed) {
     this->assembler.write_setmembervaluepush();
@@ -511,34 +604,12 @@ AST::AbstractNode* CodeGenerator::visit_andindexassignment(AST::ANDIndexAssignme
 }
 
 AST::AbstractNode* CodeGenerator::visit_call(AST::Call* node, VisitContinue) {
-  // Codegen target
-  this->visit_node(node->target);
-
-  // Codegen arguments
-  for (auto arg : node->arguments->children) {
-    this->visit_node(arg);
-  }
-
-  this->assembler.write_call(node->arguments->children.size());
-
+  this->codegen_call(node, false);
   return node;
 }
 
 AST::AbstractNode* CodeGenerator::visit_callmember(AST::CallMember* node, VisitContinue) {
-  // Codegen target
-  this->visit_node(node->context);
-
-  // Codegen function
-  this->assembler.write_dup();
-  this->assembler.write_readmembersymbol(this->context.symtable(node->symbol));
-
-  // Codegen arguments
-  for (auto arg : node->arguments->children) {
-    this->visit_node(arg);
-  }
-
-  this->assembler.write_callmember(node->arguments->children.size());
-
+  this->codegen_callmember(node, false);
   return node;
 }
 
@@ -556,11 +627,21 @@ AST::AbstractNode* CodeGenerator::visit_callindex(AST::CallIndex* node, VisitCon
     this->visit_node(arg);
   }
 
+  this->record_source_position(node);
   this->assembler.write_callmember(node->arguments->children.size());
 
   return node;
 }
 
+AST::AbstractNode* CodeGenerator::visit_inlinedcall(AST::InlinedCall* node, VisitContinue cont) {
+  // Record the instructions of the inlined body, so stack traces can still show the function
+  uint32_t inline_begin = this->assembler.get_writeoffset();
+  cont();
+  uint32_t inline_end = this->assembler.get_writeoffset();
+  this->assembler.add_inlined_function(inline_begin, inline_end, this->context.symtable(node->name));
+  return node;
+}
+
 AST::AbstractNode* CodeGenerator::visit_identifier(AST::Identifier* node, VisitContinue) {
   // Check if we have the offset info for this identifier
   if (node->offset_info == nullptr) {
@@ -580,9 +661,27 @@ AST::AbstractNode* CodeGenerator::visit_self(AST::Self* node, VisitContinue) {
 }
 
 AST::AbstractNode* CodeGenerator::visit_member(AST::Member* node, VisitContinue) {
+  VALUE symbol = this->context.symtable(node->symbol);
+
+  // Member reads of local variables, globals and self can be fused into a single instruction
+  if (ValueLocation* location = this->frame_location_of(node->target)) {
+    this->assembler.write_readlocalmembersymbol(location->as_frame.index, location->as_frame.level, symbol);
+    return node;
+  }
+
+  if (ValueLocation* location = this->global_location_of(node->target)) {
+    this->assembler.write_readglobalmembersymbol(location->as_global.index, symbol);
+    return node;
+  }
+
+  if (node->target->type() == AST::kTypeSelf) {
+    this->assembler.write_putselfmembersymbol(node->target->as<AST::Self>()->ir_frame_level, symbol);
+    return node;
+  }
+
   // Codegen target
   this->visit_node(node->target);
-  this->assembler.write_readmembersymbol(this->context.symtable(node->symbol));
+  this->assembler.write_readmembersymbol(symbol);
 
   return node;
 }
@@ -716,7 +815,23 @@ AST::AbstractNode* CodeGenerator::visit_class(AST::Class* node, VisitContinue) {
 }
 
 AST::AbstractNode* CodeGenerator::visit_return(AST::Return* node, VisitContinue cont) {
-  cont();
+  // Calls in tail position are emitted as tail calls
+  //
+  // Calls inside try blocks have to keep the current frame alive, so the
+  // exception handler can still be reached
+  if (node->expression->type() == AST::kTypeEmpty) {
+    // A bare return statement returns null
+    this->assembler.write_putvalue(kNull);
+  } else if (this->try_block_depth > 0) {
+    cont();
+  } else if (node->expression->type() == AST::kTypeCall) {
+    this->codegen_call(node->expression->as<AST::Call>(), true);
+  } else if (node->expression->type() == AST::kTypeCallMember) {
+    this->codegen_callmember(node->expression->as<AST::CallMember>(), true);
+  } else {
+    cont();
+  }
+
   this->assembler.write_return();
   return node;
 }
@@ -729,6 +844,7 @@ AST::AbstractNode* CodeGenerator::visit_yield(AST::Yield* node, VisitContinue co
 
 AST::AbstractNode* CodeGenerator::visit_throw(AST::Throw* node, VisitContinue cont) {
   cont();
+  this->record_source_position(node);
   this->assembler.write_throw();
   return node;
 }
@@ -763,19 +879,23 @@ AST::AbstractNode* CodeGenerator::visit_trycatch(AST::TryCatch* node, VisitConti
   }
 
   // Label setup
-  Label handler_label = this->assembler.reserve_label();
   Label finally_label = this->assembler.reserve_label();
 
   // Codegen try block
-  this->assembler.write_registercatchtable_to_label(handler_label);
+  //
+  // The instructions of the try block are registered in the exception table of the block,
+  // no code is executed when entering or leaving the try block
+  uint32_t try_begin = this->assembler.get_writeoffset();
+  this->try_block_depth++;
   this->visit_node(node->block);
-  this->assembler.write_popcatchtable();
+  this->try_block_depth--;
+  uint32_t try_end = this->assembler.get_writeoffset();
   this->assembler.write_branch_to_label(finally_label);
 
   // Codegen handler block
   // If we don't have a handler block, we treat this try catch statement
   // as a cleanup landing pad and rethrow the exception after executing the finally block
-  this->assembler.place_label(handler_label);
+  this->assembler.add_exception_handler(try_begin, try_end, this->assembler.get_writeoffset());
   if (node->handler_block->type() != AST::kTypeEmpty) {
     if (!this->codegen_write(*(node->exception_name->offset_info))) {
       this->push_fatal_error(node, "Invalid offset info generated by compiler");
@@ -818,6 +938,10 @@ bool CodeGenerator::codegen_read(ValueLocation& location) {
       );
       break;
     }
+    case LocationType::LocGlobal: {
+      this->assembler.write_readglobal(location.as_global.index);
+      break;
+    }
     case LocationType::LocStack: {
       // In this case we do nothing because the value we are trying to summon
       // onto the stack here is already on the stack as guaranteed by the compiler.
@@ -829,8 +953,7 @@ bool CodeGenerator::codegen_read(ValueLocation& location) {
       break;
     }
     case LocationType::LocSelf: {
-      this->assembler.write_putself(location.as_self.level);
-      this->assembler.write_readmembersymbol(location.as_self.symbol);
+      this->assembler.write_putselfmembersymbol(location.as_self.level, location.as_self.symbol);
       break;
     }
     case LocationType::LocInvalid: {
@@ -858,6 +981,14 @@ bool CodeGenerator::codegen_write(ValueLocation& location, bool keep_on_stack) {
       }
       break;
     }
+    case LocationType::LocGlobal: {
+      if (keep_on_stack) {
+        this->assembler.write_setglobalpush(location.as_global.index);
+      } else {
+        this->assembler.write_setglobal(location.as_global.index);
+      }
+      break;
+    }
     case LocationType::LocStack: {
       // In this case we do nothing because the value that is being stored onto the stack
       // is by definition already on the stack
@@ -890,9 +1021,106 @@ bool CodeGenerator::codegen_write(ValueLocation& location, bool keep_on_stack) {
   return true;
 }
 
+void CodeGenerator::codegen_statement(AST::AbstractNode* node) {
+  this->record_source_position(node);
+  this->visit_node(node);
+
+  // If the statement produces an expression, pop it off the stack now
+  if (AST::yields_value(node)) {
+    if (!AST::is_assignment(node)) {
+      this->assembler.write_pop();
+    }
+  }
+}
+
+void CodeGenerator::record_source_position(AST::AbstractNode* node) {
+  if (node->location_start.has_value()) {
+    const Location& location = node->location_start.value();
+    this->assembler.line_table.add(this->assembler.get_writeoffset(), {location.row, location.column});
+  }
+}
+
+void CodeGenerator::codegen_call(AST::Call* node, bool tail_call) {
+  // Codegen target
+  this->visit_node(node->target);
+
+  // Codegen arguments
+  for (auto arg : node->arguments->children) {
+    this->visit_node(arg);
+  }
+
+  this->record_source_position(node);
+  if (tail_call) {
+    this->assembler.write_tailcall(node->arguments->children.size());
+  } else {
+    this->assembler.write_call(node->arguments->children.size());
+  }
+}
+
+void CodeGenerator::codegen_callmember(AST::CallMember* node, bool tail_call) {
+  // Codegen target
+  this->visit_node(node->context);
+
+  // Codegen function
+  this->assembler.write_dup();
+  this->assembler.write_readmembersymbol(this->context.symtable(node->symbol));
+
+  // Codegen arguments
+  for (auto arg : node->arguments->children) {
+    this->visit_node(arg);
+  }
+
+  this->record_source_position(node);
+  if (tail_call) {
+    this->assembler.write_tailcallmember(node->arguments->children.size());
+  } else {
+    this->assembler.write_callmember(node->arguments->children.size());
+  }
+}
+
+ValueLocation* CodeGenerator::frame_location_of(AST::AbstractNode* node) {
+  if (node->type() != AST::kTypeIdentifier) {
+    return nullptr;
+  }
+
+  ValueLocation* location = node->as<AST::Identifier>()->offset_info;
+  if (location == nullptr || location->type != LocationType::LocFrame) {
+    return nullptr;
+  }
+
+  return location;
+}
+
+ValueLocation* CodeGenerator::global_location_of(AST::AbstractNode* node) {
+  if (node->type() != AST::kTypeIdentifier) {
+    return nullptr;
+  }
+
+  ValueLocation* location = node->as<AST::Identifier>()->offset_info;
+  if (location == nullptr || location->type != LocationType::LocGlobal) {
+    return nullptr;
+  }
+
+  return location;
+}
+
+void CodeGenerator::codegen_operands(AST::AbstractNode* left, AST::AbstractNode* right) {
+  ValueLocation* left_location = this->frame_location_of(left);
+  ValueLocation* right_location = this->frame_location_of(right);
+
+  // Two local variables can be read with a single instruction
+  if (left_location && right_location) {
+    this->assembler.write_readlocalpair(left_location->as_frame.index, left_location->as_frame.level,
+                                        right_location->as_frame.index, right_location->as_frame.level);
+    return;
+  }
+
+  this->visit_node(left);
+  this->visit_node(right);
+}
+
 void CodeGenerator::codegen_cmp_arguments(AST::AbstractNode* node) {
-  this->visit_node(node->as<AST::Binary>()->left);
-  this->visit_node(node->as<AST::Binary>()->right);
+  this->codegen_operands(node->as<AST::Binary>()->left, node->as<AST::Binary>()->right);
 }
 
 void CodeGenerator::codegen_cmp_branchunless(AST::AbstractNode* node, Label target_label) {
@@ -928,4 +1156,109 @@ void CodeGenerator::codegen_cmp_branchunless(AST::AbstractNode* node, Label targ
   }
 }
 
+static bool is_same_frame_location(ValueLocation* left, ValueLocation* right) {
+  return left->as_frame.index == right->as_frame.index && left->as_frame.level == right->as_frame.level;
+}
+
+AST::Assignment* CodeGenerator::counted_loop_increment(AST::While* node) {
+  if (!AST::is_comparison(node->condition) || node->block->type() != AST::kTypeBlock) {
+    return nullptr;
+  }
+
+  AST::Binary* condition = node->condition->as<AST::Binary>();
+  if (condition->operator_type == TokenType::Equal || condition->operator_type == TokenType::Not) {
+    return nullptr;
+  }
+
+  ValueLocation* counter = this->frame_location_of(condition->left);
+  if (counter == nullptr) {
+    return nullptr;
+  }
+
+  // The bound is read before the counter is advanced, so it can't be the counter itself
+  if (ValueLocation* bound = this->frame_location_of(condition->right)) {
+    if (is_same_frame_location(counter, bound)) {
+      return nullptr;
+    }
+  } else if (condition->right->type() != AST::kTypeNumber && condition->right->type() != AST::kTypeSelf) {
+    return nullptr;
+  }
+
+  AST::Block* block = node->block->as<AST::Block>();
+  if (block->statements.size() == 0 || block->statements.back()->type() != AST::kTypeAssignment) {
+    return nullptr;
+  }
+
+  AST::Assignment* increment = block->statements.back()->as<AST::Assignment>();
+  ValueLocation* target = increment->offset_info;
+  if (target == nullptr || target->type != LocationType::LocFrame || !is_same_frame_location(counter, target)) {
+    return nullptr;
+  }
+
+  if (increment->expression->type() != AST::kTypeBinary) {
+    return nullptr;
+  }
+
+  AST::Binary* step = increment->expression->as<AST::Binary>();
+  if (step->operator_type != TokenType::Plus && step->operator_type != TokenType::Minus) {
+    return nullptr;
+  }
+
+  ValueLocation* source = this->frame_location_of(step->left);
+  if (source == nullptr || !is_same_frame_location(counter, source) || step->right->type() != AST::kTypeNumber) {
+    return nullptr;
+  }
+
+  return increment;
+}
+
+void CodeGenerator::codegen_counted_loop(AST::While* node, AST::Assignment* increment) {
+  AST::Binary* condition = node->condition->as<AST::Binary>();
+  AST::Binary* step_expression = increment->expression->as<AST::Binary>();
+  ValueLocation* counter = increment->offset_info;
+
+  double step = step_expression->right->as<AST::Number>()->value;
+  if (step_expression->operator_type == TokenType::Minus) {
+    step = -step;
+  }
+
+  // The instruction exits the loop exactly when the condition would have branched out of it
+  Opcode comparison;
+  switch (condition->operator_type) {
+    case TokenType::Less: comparison = Opcode::BranchGe; break;
+    case TokenType::Greater: comparison = Opcode::BranchLe; break;
+    case TokenType::LessEqual: comparison = Opcode::BranchGt; break;
+    default: comparison = Opcode::BranchLt; break;
+  }
+
+  // Setup labels
+  //
+  // Continue statements skip the increment, so they still jump to the full condition check
+  Label condition_label = this->assembler.place_label();
+  Label body_label = this->assembler.reserve_label();
+  Label break_label = this->assembler.reserve_label();
+  this->break_stack.push_back(break_label);
+  this->continue_stack.push_back(condition_label);
+
+  // The condition is only checked once before entering the loop
+  this->codegen_cmp_arguments(condition);
+  this->codegen_cmp_branchunless(condition, break_label);
+
+  // Block codegen, the increment is performed by the LoopIncrement instruction
+  this->assembler.place_label(body_label);
+  AST::Block* block = node->block->as<AST::Block>();
+  for (auto it = block->statements.begin(); *it != increment; it++) {
+    this->codegen_statement(*it);
+  }
+
+  this->visit_node(condition->right);
+  this->assembler.write_loopincrement_to_label(body_label, counter->as_frame.index, counter->as_frame.level,
+                                               charly_create_number(step), comparison);
+  this->assembler.place_label(break_label);
+
+  // Remove the break and continue labels from the stack again
+  this->break_stack.pop_back();
+  this->continue_stack.pop_back();
+}
+
 }  // namespace Charly::Compilation
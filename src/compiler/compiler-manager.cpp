@@ -24,10 +24,48 @@
  * SOFTWARE.
  */
 
+#include <algorithm>
+#include <fstream>
+
 #include "compiler-manager.h"
+#include "internals.h"
+#include "tree-walker.h"
 
 namespace Charly::Compilation {
 
+// Collects the string literals of all import statements of a module
+class ImportCollector : public TreeWalker {
+public:
+  std::vector<std::string> imports;
+
+  AST::AbstractNode* visit_import(AST::Import* node, VisitContinue cont) override {
+    if (node->source->type() == AST::kTypeString) {
+      this->imports.push_back(node->source->as<AST::String>()->value);
+    }
+
+    cont();
+    return node;
+  }
+};
+
+CompilerManager::~CompilerManager() {
+  {
+    std::unique_lock<std::mutex> lk(this->prefetch_mutex);
+    this->compiler_threads_active = false;
+  }
+  this->prefetch_cv.notify_all();
+
+  for (std::thread& thread : this->compiler_threads) {
+    thread.join();
+  }
+
+  for (auto& entry : this->prefetched_modules) {
+    if (entry.second->instructionblock.has_value()) {
+      delete entry.second->instructionblock.value();
+    }
+  }
+}
+
 std::optional<ParserResult> CompilerManager::parse(const std::string& filename, const std::string& source) {
   SourceFile userfile(filename, source);
   Parser parser(userfile);
@@ -56,16 +94,75 @@ std::optional<ParserResult> CompilerManager::parse(const std::string& filename,
 }
 
 std::optional<CompilerResult> CompilerManager::compile(const std::string& filename, const std::string& source) {
+
+  // Isolates compile modules concurrently, they share the resulting blocks
+  std::unique_lock<std::mutex> lk(this->compile_mutex);
+  size_t source_hash = std::hash<std::string>{}(source);
+  auto compiled = this->compiled_blocks.find(filename);
+  if (compiled != this->compiled_blocks.end() && compiled->second.source_hash == source_hash &&
+      compiled->second.source_length == source.size()) {
+    CompilerResult compiled_result;
+    compiled_result.instructionblock = compiled->second.block;
+    compiled_result.abstract_syntax_tree = nullptr;
+    return compiled_result;
+  }
+
+  // The dump flags need the tokens, AST and compiler context, so they always bypass the cache
+  bool use_module_cache = this->module_cache.is_enabled() && !this->flags.dump_tokens && !this->flags.dump_ast &&
+                          !this->flags.dump_asm;
+
+  std::optional<InstructionBlock*> ready_block;
+  std::vector<std::string> imports;
+
+  // Modules compiled ahead of time already scheduled their own imports
+  if (this->parallel_compilation) {
+    {
+      std::unique_lock<std::mutex> lk(this->prefetch_mutex);
+      this->compiled_modules.insert(filename);
+    }
+
+    ready_block = this->take_prefetched_module(filename, source);
+  }
+
+  if (!ready_block.has_value() && use_module_cache) {
+    ready_block = this->module_cache.load(source, this->symtable, this->stringpool, imports);
+    this->prefetch_imports(filename, imports);
+  }
+
+  if (ready_block.has_value()) {
+    CompilerResult ready_result;
+    ready_result.instructionblock = ready_block;
+    ready_result.abstract_syntax_tree = nullptr;
+    this->address_mapping.register_instructionblock(ready_block.value(), filename);
+    this->compiled_blocks[filename] = {source_hash, source.size(), ready_block.value()};
+    return ready_result;
+  }
+
+  // All AST nodes of this module are released at once when the arena goes out of scope
+  AST::NodeArena node_arena;
+  AST::NodeArena::Scope node_arena_scope(node_arena);
+
   auto parser_result = this->parse(filename, source);
 
   if (!parser_result.has_value()) {
     return std::nullopt;
   }
 
+  // The compiler rewrites import statements, so they are collected beforehand
+  ImportCollector import_collector;
+  import_collector.visit_node(parser_result->abstract_syntax_tree.value());
+  imports = import_collector.imports;
+  this->prefetch_imports(filename, imports);
+
   CompilerConfig cconfig = {.flags = this->flags};
   CompilerContext ccontext(this->symtable, this->stringpool);
   Compiler compiler(ccontext, cconfig);
+
+  // Record the symbols this module uses, so a cached copy can restore them
+  std::unordered_map<VALUE, std::string> used_symbols;
+  this->symtable.start_journal(&used_symbols);
   CompilerResult compiler_result = compiler.compile(parser_result->abstract_syntax_tree.value());
+  this->symtable.stop_journal();
 
   if (this->flags.dump_ast) {
     if (this->flags.dump_file_contains(filename)) {
@@ -119,13 +216,232 @@ std::optional<CompilerResult> CompilerManager::compile(const std::string& filena
                                .no_offsets = this->flags.asm_no_offsets});
       Disassembler disassembler(compiler_result.instructionblock.value(), disassembler_flags, &ccontext);
       disassembler.dump(this->err_stream);
+
+      const PeepholeReport& report = compiler_result.peephole_report;
+      if (report.applied_patterns.size() > 0) {
+        this->err_stream << "peephole: " << report.size_before << " -> " << report.size_after << " bytes" << '\n';
+        for (const auto& entry : report.applied_patterns) {
+          this->err_stream << "  " << entry.first << ": " << entry.second << '\n';
+        }
+      }
     }
   }
 
+  // Modules which produced warnings are not cached so the warnings keep showing up
+  if (use_module_cache && compiler_result.messages.size() == 0) {
+    this->module_cache.store(source, compiler_result.instructionblock.value(), used_symbols, this->stringpool, imports);
+  }
+
   // Register this blocks address range
   this->address_mapping.register_instructionblock(compiler_result.instructionblock.value(), filename);
+  this->compiled_blocks[filename] = {source_hash, source.size(), compiler_result.instructionblock.value()};
+
+  // The tree doesn't outlive the arena it was allocated in
+  compiler_result.abstract_syntax_tree = nullptr;
+  for (CompilerMessage& message : compiler_result.messages) {
+    message.node.reset();
+  }
 
   return compiler_result;
 }
 
+void CompilerManager::dump_profiled_modules(const VMInstructionProfile& profile, std::ostream* json) {
+  std::unique_lock<std::mutex> lk(this->compile_mutex);
+
+  // Display the modules in a stable order
+  std::vector<std::string> filenames;
+  for (const auto& entry : this->compiled_blocks) {
+    if (this->flags.dump_file_contains(entry.first)) {
+      filenames.push_back(entry.first);
+    }
+  }
+  std::sort(filenames.begin(), filenames.end());
+
+  CompilerContext ccontext(this->symtable, this->stringpool);
+  Disassembler::Flags disassembler_flags = Disassembler::Flags({.no_branches = this->flags.asm_no_branches,
+                                                                .no_offsets = this->flags.asm_no_offsets,
+                                                                .no_func_branches = this->flags.asm_no_func_branches});
+
+  if (json) {
+    *json << "[";
+  }
+
+  for (size_t i = 0; i < filenames.size(); i++) {
+    Disassembler disassembler(this->compiled_blocks[filenames[i]].block, disassembler_flags, &ccontext);
+    disassembler.set_profile(&profile);
+
+    this->err_stream << filenames[i] << ":" << '\n';
+    disassembler.dump(this->err_stream);
+
+    if (json) {
+      *json << (i ? ",\n" : "\n");
+      disassembler.write_profile_json(*json, filenames[i]);
+    }
+  }
+
+  if (json) {
+    *json << "\n]\n";
+  }
+}
+
+void CompilerManager::prefetch_imports(const std::string& filename, const std::vector<std::string>& imports) {
+  if (!this->parallel_compilation) {
+    return;
+  }
+
+  for (const std::string& include : imports) {
+
+    // Standard libraries are usually imported via the name the prelude maps them to
+    std::string include_name = include;
+    if (Internals::kStandardCharlyLibraries.count("_charly_" + include)) {
+      include_name = "_charly_" + include;
+    }
+
+    std::optional<std::string> path = Internals::resolve_import_path(include_name, filename);
+    if (!path.has_value() || path->size() < 3 || path->compare(path->size() - 3, 3, ".ch") != 0) {
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lk(this->prefetch_mutex);
+    if (this->compiled_modules.count(path.value()) || this->prefetched_modules.count(path.value())) {
+      continue;
+    }
+
+    this->prefetched_modules[path.value()] = std::make_shared<PrefetchedModule>();
+    this->prefetch_queue.push_back(path.value());
+
+    // Compiler threads are only started once there is something to compile
+    if (this->compiler_threads.size() == 0) {
+      uint32_t thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+      for (uint32_t i = 0; i < thread_count; i++) {
+        this->compiler_threads.emplace_back(&CompilerManager::compiler_thread_handler, this);
+      }
+    }
+
+    this->prefetch_cv.notify_one();
+  }
+}
+
+std::optional<InstructionBlock*> CompilerManager::take_prefetched_module(const std::string& filename,
+                                                                         const std::string& source) {
+  std::shared_ptr<PrefetchedModule> module;
+
+  {
+    std::unique_lock<std::mutex> lk(this->prefetch_mutex);
+    auto it = this->prefetched_modules.find(filename);
+    if (it == this->prefetched_modules.end()) {
+      return std::nullopt;
+    }
+
+    // Modules which haven't been picked up by a compiler thread yet are compiled right away
+    module = it->second;
+    this->prefetched_modules.erase(it);
+    if (module->state == PrefetchedModule::State::Queued) {
+      return std::nullopt;
+    }
+
+    this->prefetch_cv.wait(lk, [&]() { return module->state == PrefetchedModule::State::Finished; });
+  }
+
+  if (!module->instructionblock.has_value()) {
+    return std::nullopt;
+  }
+
+  InstructionBlock* block = module->instructionblock.value();
+  if (module->source != source) {
+    delete block;
+    return std::nullopt;
+  }
+
+  // Symbols are hashes of their strings, so only the strings have to be copied.
+  // String pool offsets of the module are relocated into the shared pool
+  this->symtable.copy_symbols_from_table(module->symtable);
+  for (uint32_t instruction_offset : block->string_references) {
+    uint32_t offset = block->read<uint32_t>(instruction_offset + 1);
+    uint32_t length = block->read<uint32_t>(instruction_offset + 1 + sizeof(uint32_t));
+    StringOffsetInfo info = this->stringpool.get_offsetinfo(std::string(module->stringpool.get_const_data() + offset, length));
+    block->write<uint32_t>(info.offset, instruction_offset + 1);
+  }
+
+  return block;
+}
+
+void CompilerManager::compile_prefetched_module(const std::string& filename, PrefetchedModule& module) {
+  std::ifstream inputfile(filename);
+  if (!inputfile.is_open()) {
+    return;
+  }
+  module.source = std::string((std::istreambuf_iterator<char>(inputfile)), std::istreambuf_iterator<char>());
+
+  std::vector<std::string> imports;
+  module.instructionblock = this->module_cache.load(module.source, module.symtable, module.stringpool, imports);
+
+  if (!module.instructionblock.has_value()) {
+    AST::NodeArena node_arena;
+    AST::NodeArena::Scope node_arena_scope(node_arena);
+
+    SourceFile userfile(filename, module.source);
+    Parser parser(userfile);
+    ParserResult parse_result = parser.parse();
+    if (parse_result.syntax_error.has_value()) {
+      return;
+    }
+
+    ImportCollector import_collector;
+    import_collector.visit_node(parse_result.abstract_syntax_tree.value());
+    imports = import_collector.imports;
+
+    CompilerConfig cconfig = {.flags = this->flags};
+    CompilerContext ccontext(module.symtable, module.stringpool);
+    Compiler compiler(ccontext, cconfig);
+    std::unordered_map<VALUE, std::string> used_symbols;
+    module.symtable.start_journal(&used_symbols);
+    CompilerResult compiler_result = compiler.compile(parse_result.abstract_syntax_tree.value());
+    module.symtable.stop_journal();
+
+    // Modules with diagnostics are compiled again once they are imported, which reports them
+    if (compiler_result.messages.size() > 0) {
+      if (compiler_result.instructionblock.has_value()) {
+        delete compiler_result.instructionblock.value();
+      }
+      return;
+    }
+
+    module.instructionblock = compiler_result.instructionblock;
+    this->module_cache.store(module.source, module.instructionblock.value(), used_symbols, module.stringpool, imports);
+  }
+
+  this->prefetch_imports(filename, imports);
+}
+
+void CompilerManager::compiler_thread_handler() {
+  std::unique_lock<std::mutex> lk(this->prefetch_mutex);
+
+  while (true) {
+    this->prefetch_cv.wait(lk, [&]() { return !this->compiler_threads_active || this->prefetch_queue.size(); });
+    if (!this->compiler_threads_active) {
+      return;
+    }
+
+    std::string filename = this->prefetch_queue.front();
+    this->prefetch_queue.pop_front();
+
+    // The module might have been compiled on the main thread in the meantime
+    auto it = this->prefetched_modules.find(filename);
+    if (it == this->prefetched_modules.end() || it->second->state != PrefetchedModule::State::Queued) {
+      continue;
+    }
+
+    std::shared_ptr<PrefetchedModule> module = it->second;
+    module->state = PrefetchedModule::State::Running;
+
+    lk.unlock();
+    this->compile_prefetched_module(filename, *module);
+    lk.lock();
+
+    module->state = PrefetchedModule::State::Finished;
+    this->prefetch_cv.notify_all();
+  }
+}
+
 }  // namespace Charly::Compilation
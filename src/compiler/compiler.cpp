@@ -26,6 +26,9 @@
 
 #include "compiler.h"
 #include "codegenerator.h"
+#include "constant-folder.h"
+#include "dead-code-eliminator.h"
+#include "inliner.h"
 #include "lvar-rewrite.h"
 #include "normalizer.h"
 
@@ -68,17 +71,32 @@ CompilerResult Compiler::compile(AST::AbstractNode* tree) {
       return result;
     }
 
+    // Replace calls to small local functions with their body
+    Inliner inliner(this->context, this->config, result);
+    inliner.collect_reassigned_names(result.abstract_syntax_tree);
+    result.abstract_syntax_tree = inliner.visit_node(result.abstract_syntax_tree);
+
+    // Evaluate expressions which only depend on literals and constants
+    ConstantFolder constant_folder(this->context, this->config, result);
+    constant_folder.collect_reassigned_names(result.abstract_syntax_tree);
+    result.abstract_syntax_tree = constant_folder.visit_node(result.abstract_syntax_tree);
+
+    // Remove unreachable statements and statements without any effect
+    DeadCodeEliminator dead_code_eliminator(this->context, this->config, result);
+    result.abstract_syntax_tree = dead_code_eliminator.visit_node(result.abstract_syntax_tree);
+
     // Calculate all offsets of all variables, assignments and declarations
     LVarRewriter lvar_rewriter(this->context, this->config, result);
     lvar_rewriter.push_local_scope();
 
     // Register the known local variables in the top level
+    // They are accessed via their global slot from every function of the module
     uint32_t i = 0;
     for (const auto& tlc : kKnownTopLevelConstants) {
       lvar_rewriter.scope->register_symbol(
         this->context.symtable(std::get<0>(tlc)),
         LocalOffsetInfo(
-          ValueLocation::frame(i, 1),
+          ValueLocation::global(i),
           true,
           true,
           std::get<1>(tlc)
@@ -0,0 +1,580 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cmath>
+#include <list>
+#include <optional>
+
+#include "constant-folder.h"
+#include "value.h"
+
+namespace Charly::Compilation {
+
+static AST::AbstractNode* copy_constant(AST::AbstractNode* node) {
+  if (node->type() == AST::kTypeNumber)
+    return new AST::Number(node->as<AST::Number>()->value);
+  if (node->type() == AST::kTypeString)
+    return new AST::String(node->as<AST::String>()->value);
+  if (node->type() == AST::kTypeBoolean)
+    return new AST::Boolean(node->as<AST::Boolean>()->value);
+  if (node->type() == AST::kTypeNan)
+    return new AST::Nan();
+  return new AST::Null();
+}
+
+void ConstantFolder::collect_reassigned_names(AST::AbstractNode* node) {
+  AssignmentCollector collector(this->reassigned_names);
+  collector.visit_node(node);
+}
+
+void ConstantFolder::declare(const std::string& name, AST::AbstractNode* value) {
+  if (this->scopes.size() == 0)
+    return;
+  this->scopes.back()[name] = value;
+}
+
+AST::AbstractNode* ConstantFolder::lookup(const std::string& name) {
+  for (auto it = this->scopes.rbegin(); it != this->scopes.rend(); it++) {
+    auto entry = it->find(name);
+    if (entry != it->end()) {
+      return entry->second;
+    }
+  }
+
+  return nullptr;
+}
+
+AST::AbstractNode* ConstantFolder::visit_block(AST::Block* node, VisitContinue) {
+  this->scopes.emplace_back();
+
+  std::list<AST::AbstractNode*> remaining_statements;
+  for (auto statement : node->statements) {
+    AST::AbstractNode* folded_node = this->visit_node(statement);
+
+    // Statements which were folded into a literal have no effect
+    if (AST::is_constant(folded_node)) {
+      delete folded_node;
+      continue;
+    }
+
+    remaining_statements.push_back(folded_node);
+  }
+  node->statements = remaining_statements;
+
+  this->scopes.pop_back();
+  return node;
+}
+
+AST::AbstractNode* ConstantFolder::visit_function(AST::Function* node, VisitContinue cont) {
+  this->scopes.emplace_back();
+
+  if (node->needs_arguments) {
+    this->declare("arguments", nullptr);
+  }
+
+  for (const std::string& param : node->parameters) {
+    this->declare(param, nullptr);
+  }
+
+  cont();
+
+  this->scopes.pop_back();
+  return node;
+}
+
+AST::AbstractNode* ConstantFolder::visit_class(AST::Class* node, VisitContinue) {
+  // Property declarations are identifier nodes too, but never refer to a variable
+  node->parent_class = this->visit_node(node->parent_class);
+  node->member_functions = reinterpret_cast<AST::NodeList*>(this->visit_node(node->member_functions));
+  node->constructor = this->visit_node(node->constructor);
+  node->static_functions = reinterpret_cast<AST::NodeList*>(this->visit_node(node->static_functions));
+  return node;
+}
+
+AST::AbstractNode* ConstantFolder::visit_localinitialisation(AST::LocalInitialisation* node, VisitContinue cont) {
+  // Functions and classes can reference themselves inside their body
+  auto exp_type = node->expression->type();
+  if (exp_type == AST::kTypeFunction || exp_type == AST::kTypeClass) {
+    this->declare(node->name, nullptr);
+    cont();
+    return node;
+  }
+
+  cont();
+
+  bool propagate = node->constant && AST::is_constant(node->expression) && this->reassigned_names.count(node->name) == 0;
+  this->declare(node->name, propagate ? node->expression : nullptr);
+
+  return node;
+}
+
+AST::AbstractNode* ConstantFolder::visit_trycatch(AST::TryCatch* node, VisitContinue) {
+  node->block = this->visit_node(node->block);
+
+  this->scopes.emplace_back();
+  this->declare(node->exception_name->name, nullptr);
+  node->handler_block = this->visit_node(node->handler_block);
+  this->scopes.pop_back();
+
+  node->finally_block = this->visit_node(node->finally_block);
+
+  return node;
+}
+
+AST::AbstractNode* ConstantFolder::visit_match(AST::Match* node, VisitContinue) {
+  // Match arms bind names of their own, which this pass does not track
+  return node;
+}
+
+AST::AbstractNode* ConstantFolder::visit_identifier(AST::Identifier* node, VisitContinue) {
+  AST::AbstractNode* value = this->lookup(node->name);
+  if (value == nullptr) {
+    return node;
+  }
+
+  AST::AbstractNode* replacement = copy_constant(value);
+  replacement->at(node);
+  delete node;
+  return replacement;
+}
+
+AST::AbstractNode* ConstantFolder::visit_if(AST::If* node, VisitContinue cont) {
+  cont();
+
+  if (!AST::is_constant(node->condition)) {
+    return node;
+  }
+
+  AST::AbstractNode* result;
+  if (AST::constant_truthyness(node->condition)) {
+    result = node->then_block;
+    node->then_block = nullptr;
+  } else {
+    result = (new AST::Block())->at(node);
+  }
+
+  delete node;
+  return result;
+}
+
+AST::AbstractNode* ConstantFolder::visit_ifelse(AST::IfElse* node, VisitContinue cont) {
+  cont();
+
+  if (!AST::is_constant(node->condition)) {
+    return node;
+  }
+
+  AST::AbstractNode* result;
+  if (AST::constant_truthyness(node->condition)) {
+    result = node->then_block;
+    node->then_block = nullptr;
+  } else {
+    result = node->else_block;
+    node->else_block = nullptr;
+  }
+
+  delete node;
+  return result;
+}
+
+AST::AbstractNode* ConstantFolder::visit_unless(AST::Unless* node, VisitContinue cont) {
+  cont();
+
+  if (!AST::is_constant(node->condition)) {
+    return node;
+  }
+
+  AST::AbstractNode* result;
+  if (!AST::constant_truthyness(node->condition)) {
+    result = node->then_block;
+    node->then_block = nullptr;
+  } else {
+    result = (new AST::Block())->at(node);
+  }
+
+  delete node;
+  return result;
+}
+
+AST::AbstractNode* ConstantFolder::visit_unlesselse(AST::UnlessElse* node, VisitContinue cont) {
+  cont();
+
+  if (!AST::is_constant(node->condition)) {
+    return node;
+  }
+
+  AST::AbstractNode* result;
+  if (!AST::constant_truthyness(node->condition)) {
+    result = node->then_block;
+    node->then_block = nullptr;
+  } else {
+    result = node->else_block;
+    node->else_block = nullptr;
+  }
+
+  delete node;
+  return result;
+}
+
+AST::AbstractNode* ConstantFolder::visit_ternaryif(AST::TernaryIf* node, VisitContinue cont) {
+  cont();
+
+  if (!AST::is_constant(node->condition)) {
+    return node;
+  }
+
+  AST::AbstractNode* result;
+  if (AST::constant_truthyness(node->condition)) {
+    result = node->then_expression;
+    node->then_expression = nullptr;
+  } else {
+    result = node->else_expression;
+    node->else_expression = nullptr;
+  }
+
+  delete node;
+  return result;
+}
+
+AST::AbstractNode* ConstantFolder::visit_and(AST::And* node, VisitContinue cont) {
+  cont();
+
+  if (!AST::is_constant(node->left)) {
+    return node;
+  }
+
+  // The left side is the result if it is falsey
+  AST::AbstractNode* result;
+  if (AST::constant_truthyness(node->left)) {
+    result = node->right;
+    node->right = nullptr;
+  } else {
+    result = node->left;
+    node->left = nullptr;
+  }
+
+  delete node;
+  return result;
+}
+
+AST::AbstractNode* ConstantFolder::visit_or(AST::Or* node, VisitContinue cont) {
+  cont();
+
+  if (!AST::is_constant(node->left)) {
+    return node;
+  }
+
+  // The left side is the result if it is truthy
+  AST::AbstractNode* result;
+  if (AST::constant_truthyness(node->left)) {
+    result = node->left;
+    node->left = nullptr;
+  } else {
+    result = node->right;
+    node->right = nullptr;
+  }
+
+  delete node;
+  return result;
+}
+
+AST::AbstractNode* ConstantFolder::visit_binary(AST::Binary* node, VisitContinue cont) {
+  cont();
+
+  switch (node->operator_type) {
+    case TokenType::Equal:
+    case TokenType::Not:
+    case TokenType::Less:
+    case TokenType::Greater:
+    case TokenType::LessEqual:
+    case TokenType::GreaterEqual: {
+      return this->fold_comparison(node);
+    }
+    default: { return this->fold_arithmetic(node); }
+  }
+}
+
+AST::AbstractNode* ConstantFolder::fold_comparison(AST::Binary* node) {
+  std::optional<bool> result;
+
+  if (node->left->type() == AST::kTypeNumber && node->right->type() == AST::kTypeNumber) {
+    // Numbers are compared with the same routines the VM uses
+    VALUE left = charly_create_number(node->left->as<AST::Number>()->value);
+    VALUE right = charly_create_number(node->right->as<AST::Number>()->value);
+
+    switch (node->operator_type) {
+      case TokenType::Equal: result = charly_eq_number(left, right) == kTrue; break;
+      case TokenType::Not: result = charly_neq_number(left, right) == kTrue; break;
+      case TokenType::Less: result = charly_lt_number(left, right) == kTrue; break;
+      case TokenType::Greater: result = charly_gt_number(left, right) == kTrue; break;
+      case TokenType::LessEqual: result = charly_le_number(left, right) == kTrue; break;
+      case TokenType::GreaterEqual: result = charly_ge_number(left, right) == kTrue; break;
+      default: break;
+    }
+  }
+
+  if (node->left->type() == AST::kTypeString && node->right->type() == AST::kTypeString) {
+    bool equal = node->left->as<AST::String>()->value == node->right->as<AST::String>()->value;
+
+    switch (node->operator_type) {
+      case TokenType::Equal: result = equal; break;
+      case TokenType::Not: result = !equal; break;
+      default: break;
+    }
+  }
+
+  if (!result.has_value()) {
+    return node;
+  }
+
+  AST::Boolean* boolean = new AST::Boolean(result.value());
+  boolean->at(node);
+  delete node;
+  return boolean;
+}
+
+AST::AbstractNode* ConstantFolder::fold_arithmetic(AST::Binary* node) {
+  switch (node->operator_type) {
+    case TokenType::Plus: {
+      // Concatenate arrays
+      if (node->left->type() == AST::kTypeArray && node->right->type() == AST::kTypeArray) {
+        AST::Array* cat_array = node->left->as<AST::Array>();
+        cat_array->at(node);
+
+        for (auto& right_item : node->right->as<AST::Array>()->expressions->children) {
+          cat_array->expressions->append_node(right_item);
+        }
+
+        node->left = nullptr;
+        node->right->as<AST::Array>()->expressions->children.clear();
+        delete node;
+        return cat_array;
+      }
+
+      if (node->left->type() == AST::kTypeNumber && node->right->type() == AST::kTypeNumber) {
+        double left = node->left->as<AST::Number>()->value;
+        double right = node->right->as<AST::Number>()->value;
+        AST::Number* result = new AST::Number(left + right);
+        result->at(node);
+        delete node;
+        return result;
+      }
+
+      if (node->left->type() == AST::kTypeString && node->right->type() == AST::kTypeString) {
+        AST::String* cat_string = node->left->as<AST::String>();
+        cat_string->at(node);
+        cat_string->value.append(node->right->as<AST::String>()->value);
+
+        node->left = nullptr;
+        node->right = nullptr;
+        delete node;
+        return cat_string;
+      }
+
+      break;
+    }
+    case TokenType::Minus: {
+      if (node->left->type() == AST::kTypeNumber && node->right->type() == AST::kTypeNumber) {
+        double left = node->left->as<AST::Number>()->value;
+        double right = node->right->as<AST::Number>()->value;
+        AST::Number* result = new AST::Number(left - right);
+        result->at(node);
+        delete node;
+        return result;
+      }
+
+      break;
+    }
+    case TokenType::Mul: {
+      if (node->left->type() == AST::kTypeNumber && node->right->type() == AST::kTypeNumber) {
+        double left = node->left->as<AST::Number>()->value;
+        double right = node->right->as<AST::Number>()->value;
+        AST::Number* result = new AST::Number(left * right);
+        result->at(node);
+        delete node;
+        return result;
+      }
+
+      if ((node->left->type() == AST::kTypeString && node->right->type() == AST::kTypeNumber) ||
+          (node->left->type() == AST::kTypeNumber && node->right->type() == AST::kTypeString)) {
+        AST::String* new_string;
+        std::string source_string;
+        int64_t num;
+
+        if (node->left->type() == AST::kTypeString) {
+          new_string = node->left->as<AST::String>();
+          new_string->at(node);
+          num = node->right->as<AST::Number>()->value;
+        } else {
+          new_string = node->right->as<AST::String>();
+          new_string->at(node);
+          num = node->left->as<AST::Number>()->value;
+        }
+        source_string = new_string->value;
+
+        // If we multiply a string with zero, we just return an empty string
+        if (num <= 0) {
+          new_string = (new AST::String(""))->at(node)->as<AST::String>();
+          delete node;
+          return new_string;
+        }
+
+        num--;  // subtract one from num because we already have a copy inside new_string
+        while (num--) {
+          new_string->value.append(source_string);
+        }
+
+        node->left = nullptr;
+        node->right = nullptr;
+        delete node;
+        return new_string;
+      }
+
+      break;
+    }
+    case TokenType::Div: {
+      if (node->left->type() == AST::kTypeNumber && node->right->type() == AST::kTypeNumber) {
+        double left = node->left->as<AST::Number>()->value;
+        double right = node->right->as<AST::Number>()->value;
+        AST::Number* result = new AST::Number(left / right);
+        result->at(node);
+        delete node;
+        return result;
+      }
+
+      break;
+    }
+    case TokenType::Mod: {
+      if (node->left->type() == AST::kTypeNumber && node->right->type() == AST::kTypeNumber) {
+        int64_t left = node->left->as<AST::Number>()->value;
+        int64_t right = node->right->as<AST::Number>()->value;
+
+        // Division by 0 would cause a SIGFPE
+        if (right == 0) return node;
+
+        AST::Number* result = new AST::Number(left % right);
+        result->at(node);
+        delete node;
+        return result;
+      }
+
+      break;
+    }
+    case TokenType::Pow: {
+      if (node->left->type() == AST::kTypeNumber && node->right->type() == AST::kTypeNumber) {
+        double left = node->left->as<AST::Number>()->value;
+        double right = node->right->as<AST::Number>()->value;
+        AST::Number* result = new AST::Number(pow(left, right));
+        result->at(node);
+        delete node;
+        return result;
+      }
+
+      break;
+    }
+    case TokenType::BitOR:
+    case TokenType::BitXOR:
+    case TokenType::BitAND:
+    case TokenType::LeftShift:
+    case TokenType::RightShift: {
+      if (node->left->type() == AST::kTypeNumber && node->right->type() == AST::kTypeNumber) {
+        // Bitwise operators truncate their operands the same way the VM does
+        VALUE left = charly_create_number(node->left->as<AST::Number>()->value);
+        VALUE right = charly_create_number(node->right->as<AST::Number>()->value);
+        VALUE value = kNull;
+
+        switch (node->operator_type) {
+          case TokenType::BitOR: value = charly_or_number(left, right); break;
+          case TokenType::BitXOR: value = charly_xor_number(left, right); break;
+          case TokenType::BitAND: value = charly_and_number(left, right); break;
+          case TokenType::LeftShift: value = charly_shl_number(left, right); break;
+          case TokenType::RightShift: value = charly_shr_number(left, right); break;
+          default: break;
+        }
+
+        AST::Number* result = new AST::Number(charly_number_to_double(value));
+        result->at(node);
+        delete node;
+        return result;
+      }
+
+      break;
+    }
+    default: {
+      // Do nothing
+    }
+  }
+
+  return node;
+}
+
+AST::AbstractNode* ConstantFolder::visit_unary(AST::Unary* node, VisitContinue cont) {
+  cont();
+
+  if (node->operator_type == TokenType::UNot && AST::is_constant(node->expression)) {
+    AST::Boolean* result = new AST::Boolean(!AST::constant_truthyness(node->expression));
+    result->at(node);
+    delete node;
+    return result;
+  }
+
+  if (node->expression->type() == AST::kTypeNumber) {
+    switch (node->operator_type) {
+      case TokenType::UMinus: {
+        double num = node->expression->as<AST::Number>()->value;
+        AST::Number* num_node = new AST::Number(-num);
+        num_node->at(node);
+        delete node;
+        return num_node;
+      }
+      case TokenType::BitNOT: {
+        int64_t num = node->expression->as<AST::Number>()->value;
+        AST::Number* num_node = new AST::Number(~num);
+        num_node->at(node);
+        delete node;
+        return num_node;
+      }
+      default: { return node; }
+    }
+  }
+
+  return node;
+}
+
+AST::AbstractNode* ConstantFolder::visit_inlinedcall(AST::InlinedCall* node, VisitContinue cont) {
+  cont();
+
+  // A constant can't fail, there is nothing left to show in a stack trace
+  if (!AST::is_constant(node->expression)) {
+    return node;
+  }
+
+  AST::AbstractNode* result = node->expression;
+  node->expression = nullptr;
+  delete node;
+  return result;
+}
+}  // namespace Charly::Compilation
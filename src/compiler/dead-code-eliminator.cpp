@@ -0,0 +1,197 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <list>
+
+#include "dead-code-eliminator.h"
+
+namespace Charly::Compilation {
+bool DeadCodeEliminator::can_be_merged(AST::Block* node) {
+  if (node->ignore_const) {
+    return false;
+  }
+
+  for (auto statement : node->statements) {
+    if (statement->type() == AST::kTypeLocalInitialisation) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool DeadCodeEliminator::is_empty_block(AST::AbstractNode* node) {
+  return node->type() == AST::kTypeBlock && node->as<AST::Block>()->statements.size() == 0;
+}
+
+AST::AbstractNode* DeadCodeEliminator::visit_block(AST::Block* node, VisitContinue) {
+  // Statements of merged blocks have already been visited, they are marked with true
+  std::list<std::pair<AST::AbstractNode*, bool>> pending_statements;
+  for (auto statement : node->statements) {
+    pending_statements.emplace_back(statement, false);
+  }
+  node->statements.clear();
+
+  bool terminated = false;
+  while (pending_statements.size() > 0) {
+    auto [statement, visited] = pending_statements.front();
+    pending_statements.pop_front();
+
+    // Everything after a return, break, continue or throw is unreachable
+    if (terminated) {
+      delete statement;
+      continue;
+    }
+
+    if (!visited) {
+      statement = this->visit_node(statement);
+    }
+
+    if (statement->type() == AST::kTypeBlock && this->can_be_merged(statement->as<AST::Block>())) {
+      AST::Block* block = statement->as<AST::Block>();
+      auto insert_position = pending_statements.begin();
+      for (auto child : block->statements) {
+        pending_statements.emplace(insert_position, child, true);
+      }
+      block->statements.clear();
+      delete block;
+      continue;
+    }
+
+    if (AST::is_pure(statement)) {
+      delete statement;
+      continue;
+    }
+
+    terminated = AST::terminates_block(statement);
+    node->statements.push_back(statement);
+  }
+
+  return node;
+}
+
+AST::AbstractNode* DeadCodeEliminator::visit_if(AST::If* node, VisitContinue cont) {
+  cont();
+
+  // The condition might still have side effects
+  if (this->is_empty_block(node->then_block)) {
+    AST::AbstractNode* condition = node->condition;
+    node->condition = nullptr;
+    delete node;
+    return condition;
+  }
+
+  return node;
+}
+
+AST::AbstractNode* DeadCodeEliminator::visit_ifelse(AST::IfElse* node, VisitContinue cont) {
+  cont();
+
+  if (this->is_empty_block(node->else_block)) {
+    AST::If* replacement = new AST::If(node->condition, node->then_block);
+    replacement->at(node);
+    node->condition = nullptr;
+    node->then_block = nullptr;
+    delete node;
+    return this->visit_if(replacement, [] {});
+  }
+
+  if (this->is_empty_block(node->then_block)) {
+    AST::Unless* replacement = new AST::Unless(node->condition, node->else_block);
+    replacement->at(node);
+    node->condition = nullptr;
+    node->else_block = nullptr;
+    delete node;
+    return replacement;
+  }
+
+  return node;
+}
+
+AST::AbstractNode* DeadCodeEliminator::visit_unless(AST::Unless* node, VisitContinue cont) {
+  cont();
+
+  // The condition might still have side effects
+  if (this->is_empty_block(node->then_block)) {
+    AST::AbstractNode* condition = node->condition;
+    node->condition = nullptr;
+    delete node;
+    return condition;
+  }
+
+  return node;
+}
+
+AST::AbstractNode* DeadCodeEliminator::visit_unlesselse(AST::UnlessElse* node, VisitContinue cont) {
+  cont();
+
+  if (this->is_empty_block(node->else_block)) {
+    AST::Unless* replacement = new AST::Unless(node->condition, node->then_block);
+    replacement->at(node);
+    node->condition = nullptr;
+    node->then_block = nullptr;
+    delete node;
+    return this->visit_unless(replacement, [] {});
+  }
+
+  if (this->is_empty_block(node->then_block)) {
+    AST::If* replacement = new AST::If(node->condition, node->else_block);
+    replacement->at(node);
+    node->condition = nullptr;
+    node->else_block = nullptr;
+    delete node;
+    return replacement;
+  }
+
+  return node;
+}
+
+AST::AbstractNode* DeadCodeEliminator::visit_while(AST::While* node, VisitContinue cont) {
+  cont();
+
+  if (AST::is_constant(node->condition) && !AST::constant_truthyness(node->condition)) {
+    AST::Block* replacement = new AST::Block();
+    replacement->at(node);
+    delete node;
+    return replacement;
+  }
+
+  return node;
+}
+
+AST::AbstractNode* DeadCodeEliminator::visit_until(AST::Until* node, VisitContinue cont) {
+  cont();
+
+  if (AST::is_constant(node->condition) && AST::constant_truthyness(node->condition)) {
+    AST::Block* replacement = new AST::Block();
+    replacement->at(node);
+    delete node;
+    return replacement;
+  }
+
+  return node;
+}
+}  // namespace Charly::Compilation
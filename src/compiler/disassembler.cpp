@@ -37,9 +37,22 @@ void Disassembler::dump(std::ostream& stream) {
   uint32_t offset = this->flags.start_offset;
 
   stream << "Disassembly of block at " << reinterpret_cast<void*>(this->block) << '\n';
+  if (this->profile) {
+    this->detect_basic_blocks();
+    stream << "Profiled time: " << std::fixed << std::setprecision(3) << this->total_nanoseconds / 1e6 << " ms"
+           << std::defaultfloat << '\n';
+    stream.fill(' ');
+    stream << std::setw(12) << "count" << std::setw(9) << "time%" << std::setw(7) << "spec%" << '\n';
+  }
+
   while (offset < this->block->get_writeoffset() && offset < this->flags.end_offset) {
     Opcode opcode = static_cast<Opcode>(this->block->read<uint8_t>(offset));
 
+    // Print the execution count, time and specialization rate of the instruction
+    if (this->profile) {
+      this->print_annotation(offset, stream);
+    }
+
     // Print the branch arrows
     if (!this->flags.no_branches && this->highest_branch_density > 0) {
       this->draw_branchlines_for_offset(offset, stream);
@@ -62,7 +75,46 @@ void Disassembler::dump(std::ostream& stream) {
                << this->block->read<uint32_t>(offset + 1 + sizeof(uint32_t));
         break;
       }
-      case Opcode::ReadMemberSymbol:
+      case Opcode::ReadMemberSymbol: {
+        this->print_symbol(this->block->read<VALUE>(offset + 1), stream);
+        stream << ", ";
+        this->print_value(this->block->read<uint32_t>(offset + 1 + sizeof(VALUE)), stream);
+        break;
+      }
+      case Opcode::ReadLocalMemberSymbol: {
+        stream << this->block->read<uint32_t>(offset + 1) << ", "
+               << this->block->read<uint32_t>(offset + 1 + sizeof(uint32_t)) << ", ";
+        this->print_symbol(this->block->read<VALUE>(offset + 1 + sizeof(uint32_t) * 2), stream);
+        stream << ", ";
+        this->print_value(this->block->read<uint32_t>(offset + 1 + sizeof(uint32_t) * 2 + sizeof(VALUE)), stream);
+        break;
+      }
+      case Opcode::PutSelfMemberSymbol: {
+        stream << this->block->read<uint32_t>(offset + 1) << ", ";
+        this->print_symbol(this->block->read<VALUE>(offset + 1 + sizeof(uint32_t)), stream);
+        stream << ", ";
+        this->print_value(this->block->read<uint32_t>(offset + 1 + sizeof(uint32_t) + sizeof(VALUE)), stream);
+        break;
+      }
+      case Opcode::BranchTable: {
+        stream << this->block->read<uint32_t>(offset + 1) << ", ";
+        this->print_value(this->block->read<uint32_t>(offset + 1 + sizeof(uint32_t)), stream);
+        break;
+      }
+      case Opcode::ReadLocalPair: {
+        stream << this->block->read<uint32_t>(offset + 1) << ", "
+               << this->block->read<uint32_t>(offset + 1 + sizeof(uint32_t)) << ", "
+               << this->block->read<uint32_t>(offset + 1 + sizeof(uint32_t) * 2) << ", "
+               << this->block->read<uint32_t>(offset + 1 + sizeof(uint32_t) * 3);
+        break;
+      }
+      case Opcode::ReadGlobalMemberSymbol: {
+        stream << this->block->read<uint32_t>(offset + 1) << ", ";
+        this->print_symbol(this->block->read<VALUE>(offset + 1 + sizeof(uint32_t)), stream);
+        stream << ", ";
+        this->print_value(this->block->read<uint32_t>(offset + 1 + sizeof(uint32_t) + sizeof(VALUE)), stream);
+        break;
+      }
       case Opcode::SetMemberSymbolPush:
       case Opcode::SetMemberSymbol: {
         this->print_symbol(this->block->read<VALUE>(offset + 1), stream);
@@ -70,7 +122,10 @@ void Disassembler::dump(std::ostream& stream) {
       }
       case Opcode::ReadArrayIndex:
       case Opcode::SetArrayIndexPush:
-      case Opcode::SetArrayIndex: {
+      case Opcode::SetArrayIndex:
+      case Opcode::ReadGlobal:
+      case Opcode::SetGlobalPush:
+      case Opcode::SetGlobal: {
         stream << this->block->read<uint32_t>(offset + 1);
         break;
       }
@@ -118,6 +173,9 @@ void Disassembler::dump(std::ostream& stream) {
         this->print_value(this->block->read<uint32_t>(offset + 1 + sizeof(VALUE) + sizeof(uint32_t) + sizeof(bool) +
                                                       sizeof(bool) + sizeof(uint32_t)),
                           stream);
+        stream << ", ";
+        this->print_value(this->block->read<uint32_t>(offset + kInstructionLengths[Opcode::PutFunction] - sizeof(uint32_t)),
+                          stream);
         break;
       }
       case Opcode::PutCFunction: {
@@ -133,6 +191,8 @@ void Disassembler::dump(std::ostream& stream) {
         stream << ", ";
         this->print_hex(this->block->get_data() + offset + this->block->read<int32_t>(offset + 1 + sizeof(VALUE)),
                         stream, 12);
+        stream << ", ";
+        this->print_value(this->block->read<uint32_t>(offset + 1 + sizeof(VALUE) + sizeof(int32_t)), stream);
         break;
       }
       case Opcode::PutClass: {
@@ -156,11 +216,12 @@ void Disassembler::dump(std::ostream& stream) {
       case Opcode::PutHash:
       case Opcode::Dupn:
       case Opcode::Call:
-      case Opcode::CallMember: {
+      case Opcode::CallMember:
+      case Opcode::TailCall:
+      case Opcode::TailCallMember: {
         this->print_value(this->block->read<uint32_t>(offset + 1), stream);
         break;
       }
-      case Opcode::RegisterCatchTable:
       case Opcode::Branch:
       case Opcode::BranchIf:
       case Opcode::BranchUnless:
@@ -169,8 +230,22 @@ void Disassembler::dump(std::ostream& stream) {
       case Opcode::BranchLe:
       case Opcode::BranchGe:
       case Opcode::BranchEq:
-      case Opcode::BranchNeq: {
+      case Opcode::BranchNeq:
+      case Opcode::BranchLtNum:
+      case Opcode::BranchGtNum:
+      case Opcode::BranchLeNum:
+      case Opcode::BranchGeNum: {
+        this->print_hex(this->block->get_data() + offset + this->block->read<int32_t>(offset + 1), stream, 12);
+        break;
+      }
+      case Opcode::LoopIncrement: {
         this->print_hex(this->block->get_data() + offset + this->block->read<int32_t>(offset + 1), stream, 12);
+        stream << ", " << this->block->read<uint32_t>(offset + 1 + sizeof(int32_t)) << ", "
+               << this->block->read<uint32_t>(offset + 1 + sizeof(int32_t) + sizeof(uint32_t)) << ", ";
+        this->print_symbol(this->block->read<VALUE>(offset + 1 + sizeof(int32_t) + sizeof(uint32_t) * 2), stream);
+        stream << ", "
+               << kOpcodeMnemonics[this->block->read<Opcode>(offset + 1 + sizeof(int32_t) + sizeof(uint32_t) * 2 +
+                                                              sizeof(VALUE))];
         break;
       }
       default: {
@@ -181,6 +256,60 @@ void Disassembler::dump(std::ostream& stream) {
     stream << '\n';
     offset += kInstructionLengths[opcode];
   }
+
+  // Print the exception table
+  if (this->block->exception_table.size() > 0) {
+    stream << "Exception table:" << '\n';
+    for (const ExceptionTableEntry& entry : this->block->exception_table) {
+      this->print_hex(this->block->get_data() + entry.begin, stream, 12);
+      stream << " - ";
+      this->print_hex(this->block->get_data() + entry.end, stream, 12);
+      stream << " -> ";
+      this->print_hex(this->block->get_data() + entry.handler, stream, 12);
+      stream << '\n';
+    }
+  }
+
+  // Print the inlined functions
+  if (this->block->inlined_functions.size() > 0) {
+    stream << "Inlined functions:" << '\n';
+    for (const InlinedFunctionEntry& entry : this->block->inlined_functions) {
+      this->print_hex(this->block->get_data() + entry.begin, stream, 12);
+      stream << " - ";
+      this->print_hex(this->block->get_data() + entry.end, stream, 12);
+      stream << " ";
+      this->print_symbol(entry.name, stream);
+      stream << '\n';
+    }
+  }
+
+  // Print the line table
+  if (this->block->line_table.size() > 0) {
+    stream << "Line table:" << '\n';
+    this->block->line_table.each_entry([&](const LineTable::Entry& entry) {
+      this->print_hex(this->block->get_data() + entry.offset, stream, 12);
+      stream << " -> " << entry.position.line << ":" << entry.position.column << '\n';
+    });
+  }
+
+  // Print the branch tables
+  for (size_t i = 0; i < this->block->branch_tables.size(); i++) {
+    const SwitchTable& table = this->block->branch_tables[i];
+    stream << "Branch table " << i << ":" << '\n';
+    for (size_t k = 0; k < table.integer_targets.size(); k++) {
+      stream << "  " << table.integer_base + static_cast<int64_t>(k) << " -> ";
+      this->print_hex(this->block->get_data() + table.integer_targets[k], stream, 12);
+      stream << '\n';
+    }
+    for (const SwitchTable::StringTarget& entry : table.string_targets) {
+      stream << "  \"" << entry.key << "\" -> ";
+      this->print_hex(this->block->get_data() + entry.target, stream, 12);
+      stream << '\n';
+    }
+    stream << "  default -> ";
+    this->print_hex(this->block->get_data() + table.default_target, stream, 12);
+    stream << '\n';
+  }
 }
 
 void Disassembler::detect_branches() {
@@ -207,7 +336,6 @@ void Disassembler::detect_branches() {
 
         break;
       }
-      case Opcode::RegisterCatchTable:
       case Opcode::Branch:
       case Opcode::BranchIf:
       case Opcode::BranchUnless:
@@ -216,7 +344,12 @@ void Disassembler::detect_branches() {
       case Opcode::BranchLe:
       case Opcode::BranchGe:
       case Opcode::BranchEq:
-      case Opcode::BranchNeq: {
+      case Opcode::BranchNeq:
+      case Opcode::BranchLtNum:
+      case Opcode::BranchGtNum:
+      case Opcode::BranchLeNum:
+      case Opcode::BranchGeNum:
+      case Opcode::LoopIncrement: {
         this->branches.emplace_back(offset, offset + this->block->read<int32_t>(offset + 1));
         break;
       }
@@ -326,4 +459,238 @@ void Disassembler::draw_branchlines_for_offset(uint32_t offset, std::ostream& st
 
   stream << std::string(branchlane, branchlanewidth) << ' ';
 }
+// Offset of the branch target of an instruction, relative to the instruction itself
+static std::optional<int32_t> relative_target_of(InstructionBlock* block, uint32_t offset) {
+  switch (block->read<Opcode>(offset)) {
+    case Opcode::Branch:
+    case Opcode::BranchIf:
+    case Opcode::BranchUnless:
+    case Opcode::BranchLt:
+    case Opcode::BranchGt:
+    case Opcode::BranchLe:
+    case Opcode::BranchGe:
+    case Opcode::BranchEq:
+    case Opcode::BranchNeq:
+    case Opcode::BranchLtNum:
+    case Opcode::BranchGtNum:
+    case Opcode::BranchLeNum:
+    case Opcode::BranchGeNum:
+    case Opcode::LoopIncrement: return block->read<int32_t>(offset + 1);
+    case Opcode::PutFunction:
+    case Opcode::PutGenerator: return block->read<int32_t>(offset + 1 + sizeof(VALUE));
+    default: return std::nullopt;
+  }
+}
+
+// Returns true if the instruction following this one starts a new basic block
+static bool ends_basic_block(Opcode opcode) {
+  switch (opcode) {
+    case Opcode::Branch:
+    case Opcode::BranchIf:
+    case Opcode::BranchUnless:
+    case Opcode::BranchLt:
+    case Opcode::BranchGt:
+    case Opcode::BranchLe:
+    case Opcode::BranchGe:
+    case Opcode::BranchEq:
+    case Opcode::BranchNeq:
+    case Opcode::BranchLtNum:
+    case Opcode::BranchGtNum:
+    case Opcode::BranchLeNum:
+    case Opcode::BranchGeNum:
+    case Opcode::BranchTable:
+    case Opcode::LoopIncrement:
+    case Opcode::Return:
+    case Opcode::Throw:
+    case Opcode::Halt:
+    case Opcode::TailCall:
+    case Opcode::TailCallMember: return true;
+    default: return false;
+  }
+}
+
+void Disassembler::detect_basic_blocks() {
+  uint32_t size = this->block->get_writeoffset();
+  std::vector<bool> leaders(size + 1, false);
+  leaders[0] = true;
+
+  auto mark = [&](uint32_t target) {
+    if (target <= size) {
+      leaders[target] = true;
+    }
+  };
+
+  for (uint32_t offset = 0; offset < size;) {
+    Opcode opcode = this->block->read<Opcode>(offset);
+    if (opcode >= kOpcodeCount) {
+      break;
+    }
+
+    if (auto target = relative_target_of(this->block, offset)) {
+      mark(offset + target.value());
+    }
+    if (ends_basic_block(opcode)) {
+      mark(offset + kInstructionLengths[opcode]);
+    }
+
+    offset += kInstructionLengths[opcode];
+  }
+
+  for (const ExceptionTableEntry& entry : this->block->exception_table) {
+    mark(entry.handler);
+  }
+  for (SwitchTable& table : this->block->branch_tables) {
+    table.each_target([&](uint32_t& target) { mark(target); });
+  }
+
+  // Sum up the profile of the instructions inside each basic block
+  this->basic_blocks.clear();
+  this->total_nanoseconds = 0;
+  for (uint32_t offset = 0; offset < size;) {
+    Opcode opcode = this->block->read<Opcode>(offset);
+    if (opcode >= kOpcodeCount) {
+      break;
+    }
+
+    if (leaders[offset] || this->basic_blocks.empty()) {
+      this->basic_blocks.push_back({offset, offset});
+    }
+
+    BasicBlock& current = this->basic_blocks.back();
+    current.end_offset = offset + kInstructionLengths[opcode];
+    if (const VMInstructionSiteEntry* site = this->profile->site(this->block->get_data() + offset)) {
+      double nanoseconds = this->profile->site_nanoseconds(*site);
+      current.encountered = std::max(current.encountered, site->encountered);
+      current.nanoseconds += nanoseconds;
+      this->total_nanoseconds += nanoseconds;
+    }
+
+    offset += kInstructionLengths[opcode];
+  }
+
+  for (BasicBlock& basic_block : this->basic_blocks) {
+    basic_block.hot = this->total_nanoseconds > 0 &&
+                      basic_block.nanoseconds / this->total_nanoseconds >= kHotBlockThreshold;
+  }
+}
+
+const Disassembler::BasicBlock* Disassembler::basic_block_at(uint32_t offset) const {
+  auto it = std::upper_bound(this->basic_blocks.begin(), this->basic_blocks.end(), offset,
+                             [](uint32_t value, const BasicBlock& block) { return value < block.start_offset; });
+  if (it == this->basic_blocks.begin()) {
+    return nullptr;
+  }
+
+  --it;
+  return offset < it->end_offset ? &*it : nullptr;
+}
+
+void Disassembler::print_annotation(uint32_t offset, std::ostream& stream) {
+  std::ios_base::fmtflags previous_flags = stream.flags();
+  std::streamsize previous_precision = stream.precision();
+  stream.fill(' ');
+
+  const BasicBlock* basic_block = this->basic_block_at(offset);
+  const VMInstructionSiteEntry* site = this->profile->site(this->block->get_data() + offset);
+  if (site) {
+    double nanoseconds = this->profile->site_nanoseconds(*site);
+    double share = this->total_nanoseconds > 0 ? 100.0 * nanoseconds / this->total_nanoseconds : 0;
+    stream << std::setw(12) << site->encountered;
+    stream << std::fixed << std::setprecision(2) << std::setw(8) << share << '%';
+    if (site->specializable) {
+      stream << std::setprecision(0) << std::setw(6) << 100.0 * site->specialized / site->specializable << '%';
+    } else {
+      stream << std::setw(7) << "";
+    }
+  } else {
+    stream << std::setw(28) << "";
+  }
+
+  // Hot basic blocks are marked in the gutter
+  stream << (basic_block && basic_block->hot ? " >> " : "    ");
+
+  stream.flags(previous_flags);
+  stream.precision(previous_precision);
+}
+
+static void write_json_string(std::ostream& stream, const std::string& value) {
+  stream << '"';
+  for (char c : value) {
+    switch (c) {
+      case '"': stream << "\\\""; break;
+      case '\\': stream << "\\\\"; break;
+      case '\n': stream << "\\n"; break;
+      case '\t': stream << "\\t"; break;
+      default: {
+        if (static_cast<unsigned char>(c) < 0x20) {
+          stream << "\\u" << std::hex << std::setfill('0') << std::setw(4) << static_cast<int>(c) << std::dec;
+        } else {
+          stream << c;
+        }
+      }
+    }
+  }
+  stream << '"';
+}
+
+void Disassembler::write_profile_json(std::ostream& stream, const std::string& filename) {
+  if (this->profile == nullptr) {
+    return;
+  }
+
+  this->detect_basic_blocks();
+
+  std::ios_base::fmtflags previous_flags = stream.flags();
+  std::streamsize previous_precision = stream.precision();
+  stream << std::fixed << std::setprecision(1);
+
+  stream << "{\"file\": ";
+  write_json_string(stream, filename);
+  stream << ", \"nanoseconds\": " << this->total_nanoseconds;
+
+  stream << ", \"instructions\": [";
+  bool first = true;
+  for (uint32_t offset = 0; offset < this->block->get_writeoffset();) {
+    Opcode opcode = this->block->read<Opcode>(offset);
+    if (opcode >= kOpcodeCount) {
+      break;
+    }
+
+    if (const VMInstructionSiteEntry* site = this->profile->site(this->block->get_data() + offset)) {
+      stream << (first ? "" : ", ");
+      stream << "{\"offset\": " << offset << ", \"opcode\": \"" << kOpcodeMnemonics[opcode] << "\"";
+      stream << ", \"count\": " << site->encountered;
+      stream << ", \"nanoseconds\": " << this->profile->site_nanoseconds(*site);
+      if (site->specializable) {
+        stream << std::setprecision(4);
+        stream << ", \"specialized\": " << static_cast<double>(site->specialized) / site->specializable;
+        stream << std::setprecision(1);
+      }
+      stream << "}";
+      first = false;
+    }
+
+    offset += kInstructionLengths[opcode];
+  }
+  stream << "]";
+
+  stream << ", \"blocks\": [";
+  first = true;
+  for (const BasicBlock& basic_block : this->basic_blocks) {
+    if (basic_block.encountered == 0) {
+      continue;
+    }
+
+    stream << (first ? "" : ", ");
+    stream << "{\"start\": " << basic_block.start_offset << ", \"end\": " << basic_block.end_offset;
+    stream << ", \"count\": " << basic_block.encountered;
+    stream << ", \"nanoseconds\": " << basic_block.nanoseconds;
+    stream << ", \"hot\": " << (basic_block.hot ? "true" : "false") << "}";
+    first = false;
+  }
+  stream << "]}";
+
+  stream.flags(previous_flags);
+  stream.precision(previous_precision);
+}
 }  // namespace Charly::Compilation
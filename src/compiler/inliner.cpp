@@ -0,0 +1,295 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <algorithm>
+
+#include "inliner.h"
+
+namespace Charly::Compilation {
+
+// Counts the nodes of an expression which may be inlined, collects the names it uses
+//
+// Returns nothing if the expression contains a node that can't be inlined
+static std::optional<size_t> count_inlineable_nodes(AST::AbstractNode* node, std::unordered_set<std::string>& names) {
+  if (AST::is_constant(node))
+    return 1;
+
+  if (node->type() == AST::kTypeIdentifier) {
+    names.insert(node->as<AST::Identifier>()->name);
+    return 1;
+  }
+
+  std::vector<AST::AbstractNode*> children;
+  if (node->type() == AST::kTypeUnary) {
+    children = {node->as<AST::Unary>()->expression};
+  } else if (node->type() == AST::kTypeBinary) {
+    children = {node->as<AST::Binary>()->left, node->as<AST::Binary>()->right};
+  } else if (node->type() == AST::kTypeAnd) {
+    children = {node->as<AST::And>()->left, node->as<AST::And>()->right};
+  } else if (node->type() == AST::kTypeOr) {
+    children = {node->as<AST::Or>()->left, node->as<AST::Or>()->right};
+  } else if (node->type() == AST::kTypeTernaryIf) {
+    AST::TernaryIf* ternary = node->as<AST::TernaryIf>();
+    children = {ternary->condition, ternary->then_expression, ternary->else_expression};
+  } else if (node->type() == AST::kTypeMember) {
+    children = {node->as<AST::Member>()->target};
+  } else if (node->type() == AST::kTypeIndex) {
+    children = {node->as<AST::Index>()->target, node->as<AST::Index>()->argument};
+  } else if (node->type() == AST::kTypeTypeof) {
+    children = {node->as<AST::Typeof>()->expression};
+  } else {
+    return std::nullopt;
+  }
+
+  size_t count = 1;
+  for (AST::AbstractNode* child : children) {
+    std::optional<size_t> child_count = count_inlineable_nodes(child, names);
+    if (!child_count.has_value())
+      return std::nullopt;
+    count += child_count.value();
+  }
+
+  return count;
+}
+
+// Copies an expression accepted by count_inlineable_nodes, replacing parameters with their arguments
+static AST::AbstractNode* copy_expression(AST::AbstractNode* node,
+                                          const std::unordered_map<std::string, AST::AbstractNode*>& arguments,
+                                          AST::AbstractNode* call) {
+  auto copy = [&](AST::AbstractNode* child) { return copy_expression(child, arguments, call); };
+
+  AST::AbstractNode* result = nullptr;
+  if (node->type() == AST::kTypeNumber) {
+    result = new AST::Number(node->as<AST::Number>()->value);
+  } else if (node->type() == AST::kTypeString) {
+    result = new AST::String(node->as<AST::String>()->value);
+  } else if (node->type() == AST::kTypeBoolean) {
+    result = new AST::Boolean(node->as<AST::Boolean>()->value);
+  } else if (node->type() == AST::kTypeNull) {
+    result = new AST::Null();
+  } else if (node->type() == AST::kTypeNan) {
+    result = new AST::Nan();
+  } else if (node->type() == AST::kTypeSelf) {
+    result = new AST::Self();
+  } else if (node->type() == AST::kTypeIdentifier) {
+    auto argument = arguments.find(node->as<AST::Identifier>()->name);
+    if (argument != arguments.end()) {
+      return copy_expression(argument->second, {}, call);
+    }
+    result = new AST::Identifier(node->as<AST::Identifier>()->name);
+  } else if (node->type() == AST::kTypeUnary) {
+    AST::Unary* unary = node->as<AST::Unary>();
+    result = new AST::Unary(unary->operator_type, copy(unary->expression));
+  } else if (node->type() == AST::kTypeBinary) {
+    AST::Binary* binary = node->as<AST::Binary>();
+    result = new AST::Binary(binary->operator_type, copy(binary->left), copy(binary->right));
+  } else if (node->type() == AST::kTypeAnd) {
+    result = new AST::And(copy(node->as<AST::And>()->left), copy(node->as<AST::And>()->right));
+  } else if (node->type() == AST::kTypeOr) {
+    result = new AST::Or(copy(node->as<AST::Or>()->left), copy(node->as<AST::Or>()->right));
+  } else if (node->type() == AST::kTypeTernaryIf) {
+    AST::TernaryIf* ternary = node->as<AST::TernaryIf>();
+    result = new AST::TernaryIf(copy(ternary->condition), copy(ternary->then_expression),
+                                copy(ternary->else_expression));
+  } else if (node->type() == AST::kTypeMember) {
+    result = new AST::Member(copy(node->as<AST::Member>()->target), node->as<AST::Member>()->symbol);
+  } else if (node->type() == AST::kTypeIndex) {
+    result = new AST::Index(copy(node->as<AST::Index>()->target), copy(node->as<AST::Index>()->argument));
+  } else if (node->type() == AST::kTypeTypeof) {
+    result = new AST::Typeof(copy(node->as<AST::Typeof>()->expression));
+  }
+
+  return result->at(call);
+}
+
+void Inliner::collect_reassigned_names(AST::AbstractNode* node) {
+  AssignmentCollector collector(this->reassigned_names);
+  collector.visit_node(node);
+}
+
+void Inliner::declare(const std::string& name, std::optional<InlineCandidate> candidate) {
+  if (this->scopes.size() == 0)
+    return;
+  this->scopes.back()[name] = std::move(candidate);
+}
+
+std::optional<size_t> Inliner::resolve(const std::string& name) {
+  for (size_t i = this->scopes.size(); i > 0; i--) {
+    if (this->scopes[i - 1].count(name)) {
+      return i - 1;
+    }
+  }
+
+  return std::nullopt;
+}
+
+std::optional<Inliner::InlineCandidate> Inliner::create_candidate(AST::Function* node) {
+  if (node->generator || node->needs_arguments || node->body->type() != AST::kTypeBlock) {
+    return std::nullopt;
+  }
+
+  // The normalizer turns the body of every function into a block which ends with a return
+  AST::Block* body = node->body->as<AST::Block>();
+  if (body->statements.size() != 1 || body->statements.front()->type() != AST::kTypeReturn) {
+    return std::nullopt;
+  }
+
+  std::unordered_set<std::string> names;
+  AST::AbstractNode* expression = body->statements.front()->as<AST::Return>()->expression;
+  std::optional<size_t> size = count_inlineable_nodes(expression, names);
+  if (!size.has_value() || size.value() > kMaximumInlineNodes) {
+    return std::nullopt;
+  }
+
+  InlineCandidate candidate = {node, {}};
+  for (const std::string& name : names) {
+    if (std::find(node->parameters.begin(), node->parameters.end(), name) == node->parameters.end()) {
+      candidate.free_names[name] = this->resolve(name);
+    }
+  }
+
+  return candidate;
+}
+
+bool Inliner::is_trivial_argument(AST::AbstractNode* node) {
+  if (AST::is_constant(node) || node->type() == AST::kTypeSelf)
+    return true;
+
+  // Undeclared names are looked up at runtime and might throw, so they can't be dropped
+  if (node->type() == AST::kTypeIdentifier) {
+    const std::string& name = node->as<AST::Identifier>()->name;
+    return this->reassigned_names.count(name) == 0 && this->resolve(name).has_value();
+  }
+
+  return false;
+}
+
+AST::AbstractNode* Inliner::visit_block(AST::Block* node, VisitContinue cont) {
+  this->scopes.emplace_back();
+  cont();
+  this->scopes.pop_back();
+  return node;
+}
+
+AST::AbstractNode* Inliner::visit_function(AST::Function* node, VisitContinue cont) {
+  this->scopes.emplace_back();
+
+  if (node->needs_arguments) {
+    this->declare("arguments");
+  }
+
+  for (const std::string& param : node->parameters) {
+    this->declare(param);
+  }
+
+  cont();
+
+  this->scopes.pop_back();
+  return node;
+}
+
+AST::AbstractNode* Inliner::visit_localinitialisation(AST::LocalInitialisation* node, VisitContinue cont) {
+  // Functions and classes can reference themselves inside their body
+  auto exp_type = node->expression->type();
+  if (exp_type == AST::kTypeFunction || exp_type == AST::kTypeClass) {
+    this->declare(node->name);
+  }
+
+  cont();
+
+  if (node->constant && exp_type == AST::kTypeFunction && this->reassigned_names.count(node->name) == 0) {
+    this->declare(node->name, this->create_candidate(node->expression->as<AST::Function>()));
+  } else {
+    this->declare(node->name);
+  }
+
+  return node;
+}
+
+AST::AbstractNode* Inliner::visit_trycatch(AST::TryCatch* node, VisitContinue) {
+  node->block = this->visit_node(node->block);
+
+  this->scopes.emplace_back();
+  this->declare(node->exception_name->name);
+  node->handler_block = this->visit_node(node->handler_block);
+  this->scopes.pop_back();
+
+  node->finally_block = this->visit_node(node->finally_block);
+
+  return node;
+}
+
+AST::AbstractNode* Inliner::visit_match(AST::Match* node, VisitContinue) {
+  // Match arms bind names of their own, which this pass does not track
+  return node;
+}
+
+AST::AbstractNode* Inliner::visit_call(AST::Call* node, VisitContinue cont) {
+  cont();
+
+  if (node->target->type() != AST::kTypeIdentifier) {
+    return node;
+  }
+
+  // The name has to refer to the declaration of the function
+  const std::string& name = node->target->as<AST::Identifier>()->name;
+  std::optional<size_t> scope = this->resolve(name);
+  if (!scope.has_value()) {
+    return node;
+  }
+
+  const std::optional<InlineCandidate>& candidate = this->scopes[scope.value()][name];
+  if (!candidate.has_value()) {
+    return node;
+  }
+
+  AST::Function* function = candidate->function;
+  if (function->parameters.size() != node->arguments->children.size()) {
+    return node;
+  }
+
+  // Names used by the body must not be shadowed at the call site
+  for (auto& [free_name, free_scope] : candidate->free_names) {
+    if (this->resolve(free_name) != free_scope) {
+      return node;
+    }
+  }
+
+  std::unordered_map<std::string, AST::AbstractNode*> arguments;
+  size_t i = 0;
+  for (AST::AbstractNode* argument : node->arguments->children) {
+    if (!this->is_trivial_argument(argument)) {
+      return node;
+    }
+    arguments[function->parameters[i++]] = argument;
+  }
+
+  AST::AbstractNode* expression = function->body->as<AST::Block>()->statements.front()->as<AST::Return>()->expression;
+  AST::AbstractNode* result = (new AST::InlinedCall(function->name, copy_expression(expression, arguments, node)))->at(node);
+  delete node;
+  return result;
+}
+}  // namespace Charly::Compilation
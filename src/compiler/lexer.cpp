@@ -25,12 +25,42 @@
  */
 
 #include <algorithm>
+#include <array>
 #include <iterator>
 #include <sstream>
 
 #include "lexer.h"
+#include "utf8-kernels.h"
 
 namespace Charly::Compilation {
+
+// Character classes of ASCII codepoints, all other codepoints belong to no class
+enum CharacterClass : uint8_t { kIdentStart = 1, kDigit = 2, kHexDigit = 4, kOctalDigit = 8 };
+
+static constexpr std::array<uint8_t, 256> build_character_classes() {
+  std::array<uint8_t, 256> classes = {};
+  for (uint32_t c = 'a'; c <= 'z'; c++)
+    classes[c] |= kIdentStart;
+  for (uint32_t c = 'A'; c <= 'Z'; c++)
+    classes[c] |= kIdentStart;
+  for (uint32_t c = '0'; c <= '9'; c++)
+    classes[c] |= kDigit | kHexDigit;
+  for (uint32_t c = '0'; c <= '7'; c++)
+    classes[c] |= kOctalDigit;
+  for (uint32_t c = 'a'; c <= 'f'; c++)
+    classes[c] |= kHexDigit;
+  for (uint32_t c = 'A'; c <= 'F'; c++)
+    classes[c] |= kHexDigit;
+  classes['_'] |= kIdentStart;
+  classes['$'] |= kIdentStart;
+  return classes;
+}
+
+static constexpr std::array<uint8_t, 256> kCharacterClasses = build_character_classes();
+
+static inline bool has_character_class(uint32_t cp, uint8_t mask) {
+  return cp < kCharacterClasses.size() && (kCharacterClasses[cp] & mask);
+}
 void Lexer::tokenize() {
   while (this->token.type != TokenType::Eof) {
     this->read_token();
@@ -41,7 +71,7 @@ void Lexer::reset_token() {
   this->token.type = TokenType::Unknown;
   this->token.value = "";
   this->token.location =
-      Location(this->source.pos - 1, this->source.row, this->source.column, 0, this->source.filename);
+      Location(this->source.pos - 1, this->source.row, this->source.column, 0, this->source.location_filename);
 }
 
 void Lexer::read_token() {
@@ -324,10 +354,8 @@ void Lexer::read_token() {
 
   // Change the type of keyword tokens
   if (this->token.type == TokenType::Identifier) {
-    auto search = kTokenKeywordsAndLiterals.find(this->token.value);
-
-    if (search != kTokenKeywordsAndLiterals.end()) {
-      this->token.type = search->second;
+    if (auto keyword = find_keyword(this->token.value)) {
+      this->token.type = keyword.value();
     }
   }
 
@@ -407,6 +435,7 @@ void Lexer::consume_operator_or_assignment(TokenType type) {
 
 void Lexer::consume_whitespace() {
   this->token.type = TokenType::Whitespace;
+  this->source.skip_ascii(UTF8::leading_blanks(this->source.read_pointer(), this->source.remaining_bytes()));
 
   while (true) {
     uint32_t cp = this->source.read_char();
@@ -680,6 +709,9 @@ void Lexer::consume_multiline_comment() {
 }
 
 void Lexer::consume_ident() {
+  // Non-ASCII codepoints are never part of an identifier, so the ASCII part is the whole identifier
+  this->source.skip_ascii(UTF8::identifier_prefix_length(this->source.read_pointer(), this->source.remaining_bytes()));
+
   while (Lexer::is_ident_part(this->source.current_char)) {
     this->source.read_char();
   }
@@ -689,11 +721,11 @@ void Lexer::consume_ident() {
 }
 
 bool Lexer::is_ident_start(uint32_t cp) {
-  return Lexer::is_alpha(cp) || cp == L'_' || cp == L'$';
+  return has_character_class(cp, kIdentStart);
 }
 
 bool Lexer::is_ident_part(uint32_t cp) {
-  return Lexer::is_ident_start(cp) || Lexer::is_numeric(cp);
+  return has_character_class(cp, kIdentStart | kDigit);
 }
 
 bool Lexer::is_alpha(uint32_t cp) {
@@ -709,19 +741,19 @@ bool Lexer::is_alpha_uppercase(uint32_t cp) {
 }
 
 bool Lexer::is_numeric(uint32_t cp) {
-  return (cp >= 0x30 && cp <= 0x39);
+  return has_character_class(cp, kDigit);
 }
 
 bool Lexer::is_hex(uint32_t cp) {
-  return Lexer::is_numeric(cp) || (cp >= 0x41 && cp <= 0x46) || (cp >= 0x61 && cp <= 0x66);
+  return has_character_class(cp, kHexDigit);
 }
 
 bool Lexer::is_octal(uint32_t cp) {
-  return (cp >= 0x30 && cp <= 0x37);
+  return has_character_class(cp, kOctalDigit);
 }
 
 void Lexer::unexpected_char() {
-  Location loc(this->source.pos - 1, this->source.row, this->source.column, 1, this->source.filename);
+  Location loc(this->source.pos - 1, this->source.row, this->source.column, 1, this->source.location_filename);
   throw UnexpectedCharError(loc, this->source.current_char);
 }
 }  // namespace Charly::Compilation
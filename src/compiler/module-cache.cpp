@@ -0,0 +1,350 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+#include "module-cache.h"
+#include "verifier.h"
+
+namespace Charly::Compilation {
+
+// FNV-1a, std::hash is not guaranteed to be stable between builds
+static uint64_t hash_source(const std::string& source) {
+  uint64_t hash = 0xcbf29ce484222325;
+  for (char c : source) {
+    hash ^= static_cast<uint8_t>(c);
+    hash *= 0x100000001b3;
+  }
+  return hash;
+}
+
+// Changes whenever the symbol hash function or the instruction set changes
+//
+// Symbols are embedded into the bytecode as raw values, so a cache file written by a
+// build which computes them differently must never be loaded
+static uint64_t build_fingerprint() {
+  return charly_create_symbol("charly module cache") ^ (static_cast<uint64_t>(kOpcodeCount) << 32) ^
+         kModuleCacheFormatVersion;
+}
+
+ModuleCache::ModuleCache(const RunFlags& flags) {
+  // Cached modules were compiled with the peephole optimizer enabled
+  if (flags.no_module_cache || flags.no_peephole)
+    return;
+
+  if (char* cache_path = std::getenv("CHARLY_MODULE_CACHE")) {
+    this->directory = cache_path;
+  } else if (char* vm_path = std::getenv("CHARLYVMDIR")) {
+    this->directory = std::string(vm_path) + "/.module-cache";
+  }
+}
+
+std::string ModuleCache::path_for_source(const std::string& source) {
+  std::stringstream path;
+  path << this->directory << "/" << std::hex << std::setw(16) << std::setfill('0') << hash_source(source) << ".chc";
+  return path.str();
+}
+
+std::optional<InstructionBlock*> ModuleCache::load(const std::string& source,
+                                                   SymbolTable& symtable,
+                                                   StringPool& stringpool,
+                                                   std::vector<std::string>& imports) {
+  if (!this->is_enabled())
+    return std::nullopt;
+
+  int fd = open(this->path_for_source(source).c_str(), O_RDONLY);
+  if (fd < 0)
+    return std::nullopt;
+
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0 || static_cast<size_t>(file_stat.st_size) < sizeof(ModuleCacheHeader)) {
+    close(fd);
+    return std::nullopt;
+  }
+
+  size_t file_size = file_stat.st_size;
+  void* mapping = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED)
+    return std::nullopt;
+
+  uint8_t* begin = static_cast<uint8_t*>(mapping);
+  uint8_t* end = begin + file_size;
+  uint8_t* cursor = begin;
+
+  // Reads a value from the mapping, fails if the file is truncated
+  auto read = [&](auto& target) {
+    if (static_cast<size_t>(end - cursor) < sizeof(target))
+      return false;
+    std::memcpy(&target, cursor, sizeof(target));
+    cursor += sizeof(target);
+    return true;
+  };
+
+  auto read_bytes = [&](size_t length) -> uint8_t* {
+    if (static_cast<size_t>(end - cursor) < length)
+      return nullptr;
+    uint8_t* data = cursor;
+    cursor += length;
+    return data;
+  };
+
+  ModuleCacheHeader header;
+  read(header);
+  if (header.magic != kModuleCacheMagic || header.format_version != kModuleCacheFormatVersion ||
+      header.build_fingerprint != build_fingerprint() || header.source_hash != hash_source(source) ||
+      header.source_length != source.size()) {
+    munmap(mapping, file_size);
+    return std::nullopt;
+  }
+
+  // The mapping is read-only, the block gets its own copy since the
+  // VM rewrites instructions while executing them
+  uint8_t* block_data = read_bytes(header.block_size);
+  if (block_data == nullptr) {
+    munmap(mapping, file_size);
+    return std::nullopt;
+  }
+
+  InstructionBlock* block = new InstructionBlock();
+  block->write_block(block_data, header.block_size);
+
+  bool valid = true;
+  for (uint32_t i = 0; valid && i < header.exception_count; i++) {
+    ExceptionTableEntry entry;
+    valid = read(entry) && entry.begin <= entry.end && entry.end <= header.block_size &&
+            entry.handler < header.block_size;
+    if (valid)
+      block->exception_table.push_back(entry);
+  }
+
+  // Branch tables are stored as their integer base, the integer targets, the
+  // string keys with their targets and the default target
+  for (uint32_t i = 0; valid && i < header.branch_table_count; i++) {
+    SwitchTable table;
+    uint32_t integer_count;
+    uint32_t string_count;
+    valid = read(table.integer_base) && read(integer_count) && read(string_count) && read(table.default_target);
+
+    for (uint32_t k = 0; valid && k < integer_count; k++) {
+      uint32_t target;
+      valid = read(target);
+      table.integer_targets.push_back(target);
+    }
+
+    for (uint32_t k = 0; valid && k < string_count; k++) {
+      uint32_t target;
+      uint32_t length;
+      valid = read(target) && read(length);
+
+      uint8_t* data = valid ? read_bytes(length) : nullptr;
+      if (data == nullptr) {
+        valid = false;
+        break;
+      }
+
+      table.add_string_target(std::string(reinterpret_cast<char*>(data), length), target);
+    }
+
+    table.each_target([&](uint32_t& target) { valid = valid && target < header.block_size; });
+    block->branch_tables.push_back(std::move(table));
+  }
+
+  for (uint32_t i = 0; valid && i < header.inlined_function_count; i++) {
+    InlinedFunctionEntry entry;
+    valid = read(entry) && entry.begin <= entry.end && entry.end <= header.block_size;
+    if (valid)
+      block->inlined_functions.push_back(entry);
+  }
+
+  if (valid) {
+    uint8_t* data = read_bytes(header.line_table_size);
+    valid = data != nullptr && block->line_table.load(data, header.line_table_size);
+  }
+
+  // Relocate string pool offsets into the pool of this process
+  for (uint32_t i = 0; valid && i < header.string_count; i++) {
+    uint32_t instruction_offset;
+    uint32_t length;
+    valid = read(instruction_offset) && read(length);
+    valid = valid && static_cast<size_t>(instruction_offset) + kInstructionLengths[Opcode::PutString] <= header.block_size;
+    valid = valid && block->read<Opcode>(instruction_offset) == Opcode::PutString;
+
+    uint8_t* data = valid ? read_bytes(length) : nullptr;
+    if (data == nullptr) {
+      valid = false;
+      break;
+    }
+
+    StringOffsetInfo info = stringpool.get_offsetinfo(std::string(reinterpret_cast<char*>(data), length));
+    block->write<uint32_t>(info.offset, instruction_offset + 1);
+    block->write<uint32_t>(info.length, instruction_offset + 1 + sizeof(uint32_t));
+    block->string_references.push_back(instruction_offset);
+  }
+
+  for (uint32_t i = 0; valid && i < header.symbol_count; i++) {
+    VALUE symbol;
+    uint32_t length;
+    valid = read(symbol) && read(length);
+
+    uint8_t* data = valid ? read_bytes(length) : nullptr;
+    if (data == nullptr) {
+      valid = false;
+      break;
+    }
+
+    symtable.register_symbol(symbol, reinterpret_cast<char*>(data), length);
+  }
+
+  for (uint32_t i = 0; valid && i < header.import_count; i++) {
+    uint32_t length;
+    valid = read(length);
+
+    uint8_t* data = valid ? read_bytes(length) : nullptr;
+    if (data == nullptr) {
+      valid = false;
+      break;
+    }
+
+    imports.emplace_back(reinterpret_cast<char*>(data), length);
+  }
+
+  munmap(mapping, file_size);
+
+  // The VM doesn't validate the instructions it executes, broken cache files are compiled again
+  if (valid) {
+    Verifier verifier(*block);
+    valid = !verifier.verify().has_value();
+  }
+
+  if (!valid) {
+    delete block;
+    return std::nullopt;
+  }
+
+  return block;
+}
+
+void ModuleCache::store(const std::string& source,
+                        InstructionBlock* block,
+                        const std::unordered_map<VALUE, std::string>& symbols,
+                        StringPool& stringpool,
+                        const std::vector<std::string>& imports) {
+  if (!this->is_enabled())
+    return;
+
+  ModuleCacheHeader header = {.magic = kModuleCacheMagic,
+                              .format_version = kModuleCacheFormatVersion,
+                              .build_fingerprint = build_fingerprint(),
+                              .source_hash = hash_source(source),
+                              .source_length = source.size(),
+                              .block_size = static_cast<uint32_t>(block->get_writeoffset()),
+                              .exception_count = static_cast<uint32_t>(block->exception_table.size()),
+                              .branch_table_count = static_cast<uint32_t>(block->branch_tables.size()),
+                              .inlined_function_count = static_cast<uint32_t>(block->inlined_functions.size()),
+                              .line_table_size = static_cast<uint32_t>(block->line_table.encoded().size()),
+                              .string_count = static_cast<uint32_t>(block->string_references.size()),
+                              .symbol_count = static_cast<uint32_t>(symbols.size()),
+                              .import_count = static_cast<uint32_t>(imports.size())};
+
+  MemoryBlock buffer;
+  buffer.write(header);
+  buffer.write_block(block->get_data(), header.block_size);
+
+  for (const ExceptionTableEntry& entry : block->exception_table) {
+    buffer.write(entry);
+  }
+
+  for (const SwitchTable& table : block->branch_tables) {
+    buffer.write(table.integer_base);
+    buffer.write_u32(table.integer_targets.size());
+    buffer.write_u32(table.string_targets.size());
+    buffer.write_u32(table.default_target);
+    for (uint32_t target : table.integer_targets) {
+      buffer.write_u32(target);
+    }
+    for (const SwitchTable::StringTarget& entry : table.string_targets) {
+      buffer.write_u32(entry.target);
+      buffer.write_u32(entry.key.size());
+      buffer.write_string(entry.key);
+    }
+  }
+
+  for (const InlinedFunctionEntry& entry : block->inlined_functions) {
+    buffer.write(entry);
+  }
+
+  buffer.write_block(block->line_table.encoded().data(), header.line_table_size);
+
+  for (uint32_t instruction_offset : block->string_references) {
+    uint32_t offset = block->read<uint32_t>(instruction_offset + 1);
+    uint32_t length = block->read<uint32_t>(instruction_offset + 1 + sizeof(uint32_t));
+    buffer.write_u32(instruction_offset);
+    buffer.write_u32(length);
+    buffer.write_block(stringpool.get_data() + offset, length);
+  }
+
+  for (const auto& entry : symbols) {
+    buffer.write(entry.first);
+    buffer.write_u32(entry.second.size());
+    buffer.write_string(entry.second);
+  }
+
+  for (const std::string& include : imports) {
+    buffer.write_u32(include.size());
+    buffer.write_string(include);
+  }
+
+  // Write to a temporary file first so concurrent processes never observe a partial file
+  std::error_code error;
+  std::filesystem::create_directories(this->directory, error);
+  if (error)
+    return;
+
+  std::string path = this->path_for_source(source);
+  std::string temporary_path = path + "." + std::to_string(getpid()) + ".tmp";
+
+  std::ofstream file(temporary_path, std::ios::binary | std::ios::trunc);
+  if (!file.is_open())
+    return;
+  file.write(buffer.get_const_data(), buffer.get_writeoffset());
+  file.close();
+
+  if (file.fail() || std::rename(temporary_path.c_str(), path.c_str()) != 0) {
+    std::remove(temporary_path.c_str());
+  }
+}
+}  // namespace Charly::Compilation
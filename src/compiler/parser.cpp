@@ -144,9 +144,7 @@ void Parser::if_token(TokenType type, ParseFunc func) {
 }
 
 void Parser::interpret_keyword_as_identifier() {
-  auto search = kTokenKeywordsAndLiterals.find(this->token.value);
-
-  if (search != kTokenKeywordsAndLiterals.end()) {
+  if (find_keyword(this->token.value).has_value()) {
     this->token.type = TokenType::Identifier;
   }
 }
@@ -0,0 +1,243 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <optional>
+#include <unordered_set>
+
+#include "peephole.h"
+
+namespace Charly::Compilation {
+
+// Instructions without side effects whose result is immediately discarded
+static bool rewrite_discarded_value(InstructionBlock&, const uint32_t*, InstructionBlock&) {
+  return true;
+}
+
+static bool rewrite_setlocal(InstructionBlock& block, const uint32_t* offsets, InstructionBlock& output) {
+  output.write_setlocal(block.read<uint32_t>(offsets[0] + 1), block.read<uint32_t>(offsets[0] + 1 + sizeof(uint32_t)));
+  return true;
+}
+
+static bool rewrite_setglobal(InstructionBlock& block, const uint32_t* offsets, InstructionBlock& output) {
+  output.write_setglobal(block.read<uint32_t>(offsets[0] + 1));
+  return true;
+}
+
+static bool rewrite_setmembersymbol(InstructionBlock& block, const uint32_t* offsets, InstructionBlock& output) {
+  output.write_setmembersymbol(block.read<VALUE>(offsets[0] + 1));
+  return true;
+}
+
+static bool rewrite_setmembervalue(InstructionBlock&, const uint32_t*, InstructionBlock& output) {
+  output.write_setmembervalue();
+  return true;
+}
+
+static bool rewrite_setarrayindex(InstructionBlock& block, const uint32_t* offsets, InstructionBlock& output) {
+  output.write_setarrayindex(block.read<uint32_t>(offsets[0] + 1));
+  return true;
+}
+
+static bool rewrite_branch_to_next(InstructionBlock& block, const uint32_t* offsets, InstructionBlock&) {
+  return block.read<int32_t>(offsets[0] + 1) == static_cast<int32_t>(kInstructionLengths[Opcode::Branch]);
+}
+
+// clang-format off
+static const std::vector<PeepholePattern> kPeepholePatterns = {
+  {"nop",                       {Opcode::Nop},                               rewrite_discarded_value},
+  {"dup pop",                   {Opcode::Dup, Opcode::Pop},                  rewrite_discarded_value},
+  {"putvalue pop",              {Opcode::PutValue, Opcode::Pop},             rewrite_discarded_value},
+  {"putstring pop",             {Opcode::PutString, Opcode::Pop},            rewrite_discarded_value},
+  {"putself pop",               {Opcode::PutSelf, Opcode::Pop},              rewrite_discarded_value},
+  {"readlocal pop",             {Opcode::ReadLocal, Opcode::Pop},            rewrite_discarded_value},
+  {"readglobal pop",            {Opcode::ReadGlobal, Opcode::Pop},           rewrite_discarded_value},
+  {"setlocalpush pop",          {Opcode::SetLocalPush, Opcode::Pop},         rewrite_setlocal},
+  {"setglobalpush pop",         {Opcode::SetGlobalPush, Opcode::Pop},        rewrite_setglobal},
+  {"setmembersymbolpush pop",   {Opcode::SetMemberSymbolPush, Opcode::Pop},  rewrite_setmembersymbol},
+  {"setmembervaluepush pop",    {Opcode::SetMemberValuePush, Opcode::Pop},   rewrite_setmembervalue},
+  {"setarrayindexpush pop",     {Opcode::SetArrayIndexPush, Opcode::Pop},    rewrite_setarrayindex},
+  {"branch to next",            {Opcode::Branch},                            rewrite_branch_to_next},
+};
+// clang-format on
+
+// Returns the position of the relative offset operand of an instruction
+static std::optional<uint32_t> relative_operand_position(Opcode opcode) {
+  switch (opcode) {
+    case Opcode::Branch:
+    case Opcode::BranchIf:
+    case Opcode::BranchUnless:
+    case Opcode::BranchLt:
+    case Opcode::BranchGt:
+    case Opcode::BranchLe:
+    case Opcode::BranchGe:
+    case Opcode::BranchEq:
+    case Opcode::BranchNeq:
+    case Opcode::BranchLtNum:
+    case Opcode::BranchGtNum:
+    case Opcode::BranchLeNum:
+    case Opcode::BranchGeNum:
+    case Opcode::LoopIncrement: return 1;
+    case Opcode::PutFunction:
+    case Opcode::PutGenerator: return 1 + sizeof(VALUE);
+    default: return std::nullopt;
+  }
+}
+
+void PeepholeOptimizer::optimize() {
+  this->report.size_before = this->block.get_writeoffset();
+
+  // Removing an instruction can turn its neighbours into a new match
+  for (int pass = 0; pass < 4 && this->run_pass(); pass++)
+    ;
+
+  this->report.size_after = this->block.get_writeoffset();
+}
+
+bool PeepholeOptimizer::run_pass() {
+  uint32_t size = this->block.get_writeoffset();
+
+  // Decode the instruction stream
+  std::vector<uint32_t> instructions;
+  for (uint32_t offset = 0; offset < size;) {
+    Opcode opcode = this->block.read<Opcode>(offset);
+    if (opcode >= kOpcodeCount) {
+      return false;
+    }
+
+    instructions.push_back(offset);
+    offset += kInstructionLengths[opcode];
+  }
+
+  // Collect all offsets something else refers to
+  std::unordered_set<uint32_t> labels;
+  for (uint32_t offset : instructions) {
+    auto operand = relative_operand_position(this->block.read<Opcode>(offset));
+    if (operand.has_value()) {
+      labels.insert(offset + this->block.read<int32_t>(offset + operand.value()));
+    }
+  }
+  for (const ExceptionTableEntry& entry : this->block.exception_table) {
+    labels.insert(entry.begin);
+    labels.insert(entry.end);
+    labels.insert(entry.handler);
+  }
+  for (SwitchTable& table : this->block.branch_tables) {
+    table.each_target([&](uint32_t& target) { labels.insert(target); });
+  }
+  for (const InlinedFunctionEntry& entry : this->block.inlined_functions) {
+    labels.insert(entry.begin);
+    labels.insert(entry.end);
+  }
+
+  InstructionBlock output;
+  std::vector<uint32_t> relocations(size + 1, 0);
+  std::vector<std::pair<uint32_t, uint32_t>> relative_operands;
+  bool changed = false;
+
+  for (size_t i = 0; i < instructions.size();) {
+    uint32_t offset = instructions[i];
+    Opcode opcode = this->block.read<Opcode>(offset);
+
+    const PeepholePattern* applied_pattern = nullptr;
+    InstructionBlock replacement;
+    for (const PeepholePattern& pattern : kPeepholePatterns) {
+      size_t length = pattern.sequence.size();
+      if (i + length > instructions.size()) {
+        continue;
+      }
+
+      bool matches = true;
+      for (size_t j = 0; j < length && matches; j++) {
+        matches = this->block.read<Opcode>(instructions[i + j]) == pattern.sequence[j];
+        matches = matches && (j == 0 || labels.count(instructions[i + j]) == 0);
+      }
+
+      if (matches && pattern.rewrite(this->block, &instructions[i], replacement)) {
+        applied_pattern = &pattern;
+        break;
+      }
+    }
+
+    if (applied_pattern) {
+      for (size_t j = 0; j < applied_pattern->sequence.size(); j++) {
+        relocations[instructions[i + j]] = output.get_writeoffset();
+      }
+      output.write_block(replacement.get_data(), replacement.get_writeoffset());
+
+      this->report.applied_patterns[applied_pattern->name]++;
+      i += applied_pattern->sequence.size();
+      changed = true;
+      continue;
+    }
+
+    uint32_t new_offset = output.get_writeoffset();
+    relocations[offset] = new_offset;
+    output.write_block(this->block.get_data() + offset, kInstructionLengths[opcode]);
+
+    auto operand = relative_operand_position(opcode);
+    if (operand.has_value()) {
+      relative_operands.emplace_back(new_offset, offset + this->block.read<int32_t>(offset + operand.value()));
+    }
+
+    if (opcode == Opcode::PutString) {
+      output.string_references.push_back(new_offset);
+    }
+
+    i++;
+  }
+  relocations[size] = output.get_writeoffset();
+
+  if (!changed) {
+    return false;
+  }
+
+  for (auto& [new_offset, old_target] : relative_operands) {
+    Opcode opcode = output.read<Opcode>(new_offset);
+    output.write<int32_t>(relocations[old_target] - new_offset, new_offset + relative_operand_position(opcode).value());
+  }
+
+  for (const ExceptionTableEntry& entry : this->block.exception_table) {
+    output.exception_table.push_back(
+        {relocations[entry.begin], relocations[entry.end], relocations[entry.handler]});
+  }
+
+  for (const InlinedFunctionEntry& entry : this->block.inlined_functions) {
+    output.inlined_functions.push_back({relocations[entry.begin], relocations[entry.end], entry.name});
+  }
+
+  this->block.line_table.each_entry([&](const LineTable::Entry& entry) {
+    output.line_table.add(relocations[entry.offset], entry.position);
+  });
+
+  output.branch_tables = std::move(this->block.branch_tables);
+  for (SwitchTable& table : output.branch_tables) {
+    table.each_target([&](uint32_t& target) { target = relocations[target]; });
+  }
+
+  this->block = std::move(output);
+  return true;
+}
+}  // namespace Charly::Compilation
@@ -0,0 +1,496 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <algorithm>
+#include <sstream>
+
+#include "compiler.h"
+#include "operand-stack.h"
+#include "verifier.h"
+
+namespace Charly::Compilation {
+
+// Deeper stacks are most likely caused by corrupted instructions
+static constexpr uint32_t kMaximumStackDepth = 1 << 16;
+
+// Amount of values an instruction pops off and pushes onto the stack at most
+struct StackEffect {
+  uint32_t pops;
+  uint32_t pushes;
+};
+
+static StackEffect stack_effect(InstructionBlock& block, uint32_t offset) {
+  switch (block.read<Opcode>(offset)) {
+    case Opcode::ReadLocal:
+    case Opcode::PutSelf:
+    case Opcode::PutValue:
+    case Opcode::PutString:
+    case Opcode::PutFunction:
+    case Opcode::PutCFunction:
+    case Opcode::PutGenerator:
+    case Opcode::ReadLocalMemberSymbol:
+    case Opcode::PutSelfMemberSymbol:
+    case Opcode::ReadGlobal:
+    case Opcode::ReadGlobalMemberSymbol: return {0, 1};
+    case Opcode::ReadLocalPair: return {0, 2};
+    case Opcode::ReadMemberSymbol:
+    case Opcode::ReadArrayIndex:
+    case Opcode::SetLocalPush:
+    case Opcode::SetGlobalPush:
+    case Opcode::Yield:
+    case Opcode::UAdd:
+    case Opcode::USub:
+    case Opcode::UNot:
+    case Opcode::UBNot:
+    case Opcode::Typeof:
+    case Opcode::BranchTable: return {1, 1};
+    case Opcode::SetLocal:
+    case Opcode::SetGlobal:
+    case Opcode::Pop:
+    case Opcode::Throw:
+    case Opcode::BranchIf:
+    case Opcode::BranchUnless:
+    case Opcode::LoopIncrement: return {1, 0};
+    case Opcode::Dup: return {1, 2};
+    case Opcode::ReadMemberValue:
+    case Opcode::SetMemberSymbolPush:
+    case Opcode::Add:
+    case Opcode::Sub:
+    case Opcode::Mul:
+    case Opcode::Div:
+    case Opcode::Mod:
+    case Opcode::Pow:
+    case Opcode::Eq:
+    case Opcode::Neq:
+    case Opcode::Lt:
+    case Opcode::Gt:
+    case Opcode::Le:
+    case Opcode::Ge:
+    case Opcode::Shr:
+    case Opcode::Shl:
+    case Opcode::And:
+    case Opcode::Or:
+    case Opcode::Xor:
+    case Opcode::AddNum:
+    case Opcode::SubNum:
+    case Opcode::MulNum:
+    case Opcode::LtNum:
+    case Opcode::GtNum:
+    case Opcode::LeNum:
+    case Opcode::GeNum: return {2, 1};
+    case Opcode::SetMemberSymbol:
+    case Opcode::BranchLt:
+    case Opcode::BranchGt:
+    case Opcode::BranchLe:
+    case Opcode::BranchGe:
+    case Opcode::BranchEq:
+    case Opcode::BranchNeq:
+    case Opcode::BranchLtNum:
+    case Opcode::BranchGtNum:
+    case Opcode::BranchLeNum:
+    case Opcode::BranchGeNum: return {2, 0};
+    case Opcode::Swap: return {2, 2};
+
+    // Writes to an index out of bounds push an additional null
+    case Opcode::SetArrayIndex: return {2, 1};
+    case Opcode::SetArrayIndexPush: return {2, 2};
+    case Opcode::SetMemberValue: return {3, 0};
+    case Opcode::SetMemberValuePush: return {3, 1};
+    case Opcode::PutArray: return {block.read<uint32_t>(offset + 1), 1};
+    case Opcode::PutHash: return {block.read<uint32_t>(offset + 1) * 2, 1};
+    case Opcode::Dupn: {
+      uint32_t count = block.read<uint32_t>(offset + 1);
+      return {count, count * 2};
+    }
+    case Opcode::Call:
+    case Opcode::TailCall: return {block.read<uint32_t>(offset + 1) + 1, 1};
+    case Opcode::CallMember:
+    case Opcode::TailCallMember: return {block.read<uint32_t>(offset + 1) + 2, 1};
+    case Opcode::PutClass: {
+      uint32_t counts = offset + 1 + sizeof(VALUE);
+      uint32_t flags = counts + sizeof(uint32_t) * 4;
+      uint32_t pops = block.read<uint32_t>(counts) + block.read<uint32_t>(counts + sizeof(uint32_t)) +
+                      block.read<uint32_t>(counts + sizeof(uint32_t) * 2) +
+                      block.read<uint32_t>(counts + sizeof(uint32_t) * 3) + block.read<bool>(flags) +
+                      block.read<bool>(flags + sizeof(bool));
+      return {pops, 1};
+    }
+    default: return {0, 0};
+  }
+}
+
+// Instructions whose first operand is a branch offset
+static bool has_branch_offset(Opcode opcode) {
+  switch (opcode) {
+    case Opcode::Branch:
+    case Opcode::BranchIf:
+    case Opcode::BranchUnless:
+    case Opcode::BranchLt:
+    case Opcode::BranchGt:
+    case Opcode::BranchLe:
+    case Opcode::BranchGe:
+    case Opcode::BranchEq:
+    case Opcode::BranchNeq:
+    case Opcode::BranchLtNum:
+    case Opcode::BranchGtNum:
+    case Opcode::BranchLeNum:
+    case Opcode::BranchGeNum:
+    case Opcode::LoopIncrement: return true;
+    default: return false;
+  }
+}
+
+static std::string describe(uint32_t offset, const std::string& message) {
+  std::stringstream stream;
+  stream << "0x" << std::hex << offset << ": " << message;
+  return stream.str();
+}
+
+std::optional<std::string> Verifier::verify(bool check_declared_stack_depths) {
+  if (auto error = this->verify_instructions()) {
+    return error;
+  }
+
+  // The code at the start of the block runs without a frame, the functions it creates
+  // are called with the top level frame as their parent environment
+  Body entry;
+  entry.environment = {static_cast<uint32_t>(kKnownTopLevelConstants.size())};
+  this->bodies[0] = entry;
+  this->pending_bodies.push_back(0);
+
+  while (this->pending_bodies.size()) {
+    uint32_t offset = this->pending_bodies.back();
+    this->pending_bodies.pop_back();
+
+    Body body = this->bodies[offset];
+    if (auto error = this->verify_body(offset, body)) {
+      return error;
+    }
+  }
+
+  // The interpreter reserves the red zone for code running without a frame
+  if (this->stack_depths[0] > kOperandStackRedZone) {
+    return describe(0, "top level code exceeds the stack space reserved for it");
+  }
+
+  if (check_declared_stack_depths) {
+    for (uint32_t offset : this->reachable_creators) {
+      Opcode opcode = this->block.read<Opcode>(offset);
+      uint32_t body = offset + this->block.read<int32_t>(offset + 1 + sizeof(VALUE));
+      uint32_t declared = this->block.read<uint32_t>(offset + kInstructionLengths[opcode] - sizeof(uint32_t));
+      if (declared < this->stack_depths[body]) {
+        return describe(offset, "declared stack depth is too small for the body");
+      }
+    }
+  }
+
+  return std::nullopt;
+}
+
+std::optional<std::string> Verifier::verify_instructions() {
+  uint32_t size = this->block.get_writeoffset();
+  this->instruction_starts.assign(size, false);
+
+  uint32_t offset = 0;
+  while (offset < size) {
+    Opcode opcode = this->block.read<Opcode>(offset);
+    if (opcode >= kOpcodeCount) {
+      return describe(offset, "unknown opcode");
+    }
+
+    if (size - offset < kInstructionLengths[opcode]) {
+      return describe(offset, "instruction exceeds the end of the block");
+    }
+
+    // Native pointers are only valid inside the process which wrote them
+    if (opcode == Opcode::PutCFunction) {
+      return describe(offset, "native function pointer");
+    }
+
+    this->instruction_starts[offset] = true;
+    offset += kInstructionLengths[opcode];
+  }
+
+  auto is_target = [&](int64_t target) {
+    return target >= 0 && target < size && this->instruction_starts[target];
+  };
+
+  // The string pool offsets of PutString instructions are only relocated if they are listed
+  std::vector<bool> string_references(size, false);
+  for (uint32_t reference : this->block.string_references) {
+    if (reference < size) {
+      string_references[reference] = true;
+    }
+  }
+
+  offset = 0;
+  while (offset < size) {
+    Opcode opcode = this->block.read<Opcode>(offset);
+
+    if (has_branch_offset(opcode) && !is_target(offset + static_cast<int64_t>(this->block.read<int32_t>(offset + 1)))) {
+      return describe(offset, "invalid branch target");
+    }
+
+    switch (opcode) {
+      case Opcode::PutString: {
+        if (!string_references[offset]) {
+          return describe(offset, "string missing from the string references");
+        }
+        break;
+      }
+      case Opcode::PutFunction:
+      case Opcode::PutGenerator: {
+        if (!is_target(offset + static_cast<int64_t>(this->block.read<int32_t>(offset + 1 + sizeof(VALUE))))) {
+          return describe(offset, "invalid function body");
+        }
+        break;
+      }
+      case Opcode::BranchTable: {
+        uint32_t index = this->block.read<uint32_t>(offset + 1);
+        if (index >= this->block.branch_tables.size()) {
+          return describe(offset, "invalid branch table");
+        }
+
+        bool valid = true;
+        this->block.branch_tables[index].each_target([&](uint32_t& target) { valid = valid && is_target(target); });
+        if (!valid) {
+          return describe(offset, "invalid branch table target");
+        }
+        break;
+      }
+      case Opcode::LoopIncrement: {
+        Opcode comparison = this->block.read<Opcode>(offset + kInstructionLengths[opcode] - sizeof(Opcode));
+        if (comparison < Opcode::BranchLt || comparison > Opcode::BranchGe) {
+          return describe(offset, "invalid loop comparison");
+        }
+        break;
+      }
+      default: break;
+    }
+
+    offset += kInstructionLengths[opcode];
+  }
+
+  for (const ExceptionTableEntry& entry : this->block.exception_table) {
+    if (entry.begin > entry.end || entry.end > size || !is_target(entry.handler)) {
+      return describe(entry.handler, "invalid exception table entry");
+    }
+  }
+
+  return std::nullopt;
+}
+
+std::optional<std::string> Verifier::add_body(uint32_t entry, const Body& body) {
+  auto it = this->bodies.find(entry);
+  if (it == this->bodies.end()) {
+    this->bodies[entry] = body;
+    this->pending_bodies.push_back(entry);
+    return std::nullopt;
+  }
+
+  Body& existing = it->second;
+  if (existing.generator != body.generator || existing.has_frame != body.has_frame) {
+    return describe(entry, "body is created as different kinds of functions");
+  }
+
+  // Bodies created in multiple places may only access the frames all of them share
+  bool changed = false;
+  if (body.environment.size() < existing.environment.size()) {
+    existing.environment.resize(body.environment.size());
+    changed = true;
+  }
+  for (size_t level = 0; level < existing.environment.size(); level++) {
+    if (body.environment[level] < existing.environment[level]) {
+      existing.environment[level] = body.environment[level];
+      changed = true;
+    }
+  }
+
+  if (changed) {
+    this->pending_bodies.push_back(entry);
+  }
+
+  return std::nullopt;
+}
+
+std::optional<std::string> Verifier::verify_body(uint32_t entry, const Body& body) {
+  uint32_t size = this->block.get_writeoffset();
+
+  // Depth of the stack before each reachable instruction
+  std::unordered_map<uint32_t, uint32_t> depths;
+  std::vector<std::pair<uint32_t, uint32_t>> worklist = {{entry, 0}};
+  uint32_t max_depth = 0;
+
+  auto check_local = [&](uint32_t offset, uint32_t index_offset) -> std::optional<std::string> {
+    uint32_t index = this->block.read<uint32_t>(offset + index_offset);
+    uint32_t level = this->block.read<uint32_t>(offset + index_offset + sizeof(uint32_t));
+    if (!body.has_frame || level >= body.environment.size() || index >= body.environment[level]) {
+      return describe(offset, "local variable out of bounds");
+    }
+    return std::nullopt;
+  };
+
+  while (worklist.size()) {
+    auto [offset, depth] = worklist.back();
+    worklist.pop_back();
+
+    if (offset >= size) {
+      return describe(offset, "execution runs past the end of the block");
+    }
+
+    auto it = depths.find(offset);
+    if (it != depths.end()) {
+      if (it->second != depth) {
+        return describe(offset, "inconsistent stack depth");
+      }
+      continue;
+    }
+    depths[offset] = depth;
+
+    Opcode opcode = this->block.read<Opcode>(offset);
+    StackEffect effect = stack_effect(this->block, offset);
+    if (effect.pops > depth) {
+      return describe(offset, "stack underflow");
+    }
+
+    uint32_t next_depth = depth - effect.pops + effect.pushes;
+    if (next_depth > kMaximumStackDepth) {
+      return describe(offset, "stack overflow");
+    }
+    max_depth = std::max(max_depth, next_depth);
+
+    // Handlers are entered with the stack of the frame cleared and the exception pushed onto it
+    for (const ExceptionTableEntry& handler : this->block.exception_table) {
+      if (offset >= handler.begin && offset < handler.end) {
+        worklist.push_back({handler.handler, 1});
+      }
+    }
+
+    switch (opcode) {
+      case Opcode::ReadLocal:
+      case Opcode::SetLocal:
+      case Opcode::SetLocalPush:
+      case Opcode::ReadLocalMemberSymbol: {
+        if (auto error = check_local(offset, 1)) {
+          return error;
+        }
+        break;
+      }
+      case Opcode::ReadLocalPair: {
+        if (auto error = check_local(offset, 1)) {
+          return error;
+        }
+        if (auto error = check_local(offset, 1 + sizeof(uint32_t) * 2)) {
+          return error;
+        }
+        break;
+      }
+      case Opcode::LoopIncrement: {
+        if (auto error = check_local(offset, 1 + sizeof(int32_t))) {
+          return error;
+        }
+        break;
+      }
+      case Opcode::ReadGlobal:
+      case Opcode::SetGlobal:
+      case Opcode::SetGlobalPush:
+      case Opcode::ReadGlobalMemberSymbol: {
+        if (this->block.read<uint32_t>(offset + 1) >= kKnownTopLevelConstants.size()) {
+          return describe(offset, "global variable out of bounds");
+        }
+        break;
+      }
+      case Opcode::PutFunction: {
+        Body function;
+        uint32_t lvarcount = this->block.read<uint32_t>(offset + 1 + sizeof(VALUE) + sizeof(int32_t) +
+                                                        sizeof(bool) * 2 + sizeof(uint32_t));
+        function.environment.push_back(lvarcount);
+        function.environment.insert(function.environment.end(), body.environment.begin(), body.environment.end());
+        function.has_frame = true;
+
+        if (auto error = this->add_body(offset + this->block.read<int32_t>(offset + 1 + sizeof(VALUE)), function)) {
+          return error;
+        }
+        this->reachable_creators.push_back(offset);
+        break;
+      }
+      case Opcode::PutGenerator: {
+        // Generators run inside the frame of the function which created them
+        Body generator = body;
+        generator.generator = true;
+        if (auto error = this->add_body(offset + this->block.read<int32_t>(offset + 1 + sizeof(VALUE)), generator)) {
+          return error;
+        }
+        this->reachable_creators.push_back(offset);
+        break;
+      }
+      case Opcode::Return: {
+        if (!body.has_frame) {
+          return describe(offset, "return outside of a function");
+        }
+        if (depth != 1) {
+          return describe(offset, "function returns with an unbalanced stack");
+        }
+        continue;
+      }
+      case Opcode::Yield: {
+        if (!body.generator) {
+          return describe(offset, "yield outside of a generator");
+        }
+        break;
+      }
+      case Opcode::TailCall:
+      case Opcode::TailCallMember: {
+        if (!body.has_frame) {
+          return describe(offset, "tail call outside of a function");
+        }
+        break;
+      }
+      case Opcode::Throw:
+      case Opcode::Halt: continue;
+      case Opcode::Branch: {
+        worklist.push_back({offset + this->block.read<int32_t>(offset + 1), next_depth});
+        continue;
+      }
+      case Opcode::BranchTable: {
+        this->block.branch_tables[this->block.read<uint32_t>(offset + 1)].each_target(
+            [&](uint32_t& target) { worklist.push_back({target, next_depth}); });
+        break;
+      }
+      default: break;
+    }
+
+    if (has_branch_offset(opcode)) {
+      worklist.push_back({offset + this->block.read<int32_t>(offset + 1), next_depth});
+    }
+
+    worklist.push_back({offset + kInstructionLengths[opcode], next_depth});
+  }
+
+  this->stack_depths[entry] = max_depth;
+  return std::nullopt;
+}
+}  // namespace Charly::Compilation
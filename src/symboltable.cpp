@@ -30,16 +30,31 @@ namespace Charly {
 VALUE SymbolTable::encode_string(const std::string& input) {
   VALUE symbol = charly_create_symbol(input);
 
+  std::unique_lock<std::mutex> lk(this->mutex);
   if (this->table.find(symbol) == this->table.end()) {
     this->table.insert({symbol, input});
   }
 
+  if (this->journal && this->journal_thread == std::this_thread::get_id()) {
+    this->journal->emplace(symbol, input);
+  }
+
+  return symbol;
+}
+
+VALUE SymbolTable::register_symbol(VALUE symbol, const char* data, size_t length) {
+  std::unique_lock<std::mutex> lk(this->mutex);
+  if (this->table.find(symbol) == this->table.end()) {
+    this->table.insert({symbol, std::string(data, length)});
+  }
+
   return symbol;
 }
 
 std::optional<std::string> SymbolTable::decode_symbol(VALUE symbol) {
   std::optional<std::string> decoded_string;
 
+  std::unique_lock<std::mutex> lk(this->mutex);
   auto found_string = this->table.find(symbol);
 
   if (found_string != this->table.end()) {
@@ -50,6 +65,7 @@ std::optional<std::string> SymbolTable::decode_symbol(VALUE symbol) {
 }
 
 void SymbolTable::copy_symbols_to_table(SymbolTable& other) {
+  std::scoped_lock lk(this->mutex, other.mutex);
   other.table.insert(this->table.begin(), this->table.end());
 }
 }  // namespace Charly
@@ -69,8 +69,7 @@ uint32_t UTF8Buffer::peek_next_utf8() {
 
 // Return the amount of codepoints inside the buffer
 size_t UTF8Buffer::codepointcount() {
-  uint8_t* data_end = this->data + this->writeoffset;
-  return utf8::distance(this->data, data_end);
+  return UTF8::codepoint_count(reinterpret_cast<char*>(this->data), this->writeoffset);
 }
 
 size_t UTF8Buffer::utf8_byteoffset(uint32_t start) {
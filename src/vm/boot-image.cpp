@@ -0,0 +1,393 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+#include "vm.h"
+
+namespace Charly {
+
+// Calls the callback with every value a cell references
+static void each_reference(VALUE value, const std::function<void(VALUE)>& callback) {
+  switch (charly_get_type(value)) {
+    case kTypeObject: {
+      Object* obj = charly_as_object(value);
+      callback(obj->klass);
+      obj->each([&](VALUE, VALUE value) { callback(value); });
+      break;
+    }
+
+    case kTypeArray: {
+      for (VALUE entry : *charly_as_array(value)->data)
+        callback(entry);
+      break;
+    }
+
+    case kTypeFunction: {
+      Function* func = charly_as_function(value);
+      callback(charly_create_pointer(func->context));
+      callback(func->bound_self);
+      if (func->container) {
+        for (auto entry : *func->container)
+          callback(entry.second);
+      }
+      break;
+    }
+
+    case kTypeCFunction: {
+      CFunction* cfunc = charly_as_cfunction(value);
+      if (cfunc->container) {
+        for (auto entry : *cfunc->container)
+          callback(entry.second);
+      }
+      break;
+    }
+
+    case kTypeGenerator: {
+      Generator* gen = charly_as_generator(value);
+      callback(charly_create_pointer(gen->context_frame));
+      callback(gen->bound_self);
+      for (VALUE entry : *gen->context_stack)
+        callback(entry);
+      if (gen->container) {
+        for (auto entry : *gen->container)
+          callback(entry.second);
+      }
+      break;
+    }
+
+    case kTypeClass: {
+      Class* klass = charly_as_class(value);
+      callback(klass->constructor);
+      callback(klass->prototype);
+      callback(klass->parent_class);
+      for (VALUE entry : *klass->member_properties)
+        callback(entry);
+      if (klass->container) {
+        for (auto entry : *klass->container)
+          callback(entry.second);
+      }
+      break;
+    }
+
+    case kTypeFrame: {
+      Frame* frame = charly_as_frame(value);
+      callback(charly_create_pointer(frame->parent));
+      callback(charly_create_pointer(frame->parent_environment_frame));
+      callback(frame->caller_value);
+      callback(frame->self);
+      for (size_t i = 0; i < frame->lvarcount(); i++)
+        callback(frame->read_local(i));
+      break;
+    }
+  }
+}
+
+// The heap is copied in two passes
+//
+// The first pass allocates an empty cell for every reachable cell of the image. These
+// cells contain no references yet, so collections triggered by the allocations never
+// touch cells of the image. The second pass fills in all fields and performs no allocations.
+//
+// Functions, frames and generators point into instructionblocks of the image. These
+// are copied too, since the VM writes the indices of its own inline caches into them.
+void VM::clone_heap_from(VM& image) {
+  HandleScope scope(this->gc);
+  std::unordered_map<VALUE, VALUE> relocations;
+  std::vector<VALUE> originals;
+
+  // Allocate an empty copy of a cell of the image
+  auto allocate_copy = [&](VALUE value) -> VALUE {
+    switch (charly_get_type(value)) {
+      case kTypeObject: {
+        VALUE copy = this->create_object(0);
+        charly_as_object(copy)->set_prototype(charly_as_object(value)->is_prototype());
+        charly_as_object(copy)->set_lazy_members(charly_as_object(value)->has_lazy_members());
+        return copy;
+      }
+      case kTypeArray: {
+        return this->create_array(charly_as_array(value)->data->size());
+      }
+      case kTypeString: {
+        VALUE copy = this->create_string(charly_string_data(value), charly_string_length(value));
+        if (charly_is_on_heap(copy)) {
+          charly_as_hstring(copy)->symbol = charly_as_hstring(value)->symbol;
+        }
+        return copy;
+      }
+      case kTypeFunction: {
+        Function* func = charly_as_function(value);
+        return this->create_function(func->name, nullptr, func->argc, func->lvarcount, func->max_stack_depth,
+                                     func->anonymous(), func->needs_arguments());
+      }
+      case kTypeCFunction: {
+        CFunction* cfunc = charly_as_cfunction(value);
+        return this->create_cfunction(cfunc->name, cfunc->argc, cfunc->pointer, cfunc->thunk);
+      }
+      case kTypeGenerator: {
+        Generator* generator = charly_as_generator(value);
+        return this->create_generator(generator->name, nullptr, generator->max_stack_depth);
+      }
+      case kTypeClass: {
+        return this->create_class(charly_as_class(value)->name);
+      }
+      case kTypeFrame: {
+        // Frames are created on top of the frame chain, which has to stay empty
+        Frame* frames = this->frames;
+        Frame* copy = this->create_frame(kNull, nullptr, charly_as_frame(value)->lvarcount(), nullptr);
+        this->frames = frames;
+        return charly_create_pointer(copy);
+      }
+      case kTypeCPointer: {
+        // Native resources have a single owner, only plain pointers can be shared
+        CPointer* cpointer = charly_as_cpointer(value);
+        if (cpointer->destructor) {
+          return kNull;
+        }
+        return this->create_cpointer(cpointer->data, nullptr);
+      }
+    }
+
+    return kNull;
+  };
+
+  auto discover = [&](VALUE value) {
+    if (!charly_is_ptr(value) || charly_as_pointer(value) == nullptr || relocations.count(value)) {
+      return;
+    }
+
+    relocations[value] = scope.add(allocate_copy(value));
+    originals.push_back(value);
+  };
+
+  discover(charly_create_pointer(image.top_frame));
+  discover(image.primitive_value);
+  discover(image.primitive_object);
+  discover(image.primitive_class);
+  discover(image.primitive_array);
+  discover(image.primitive_string);
+  discover(image.primitive_number);
+  discover(image.primitive_function);
+  discover(image.primitive_generator);
+  discover(image.primitive_boolean);
+  discover(image.primitive_null);
+  for (auto literal : image.interned_literals) {
+    discover(literal.second);
+  }
+  for (auto& module : image.imported_modules) {
+    discover(module.second.exports);
+  }
+  for (auto& member : image.lazy_members) {
+    discover(member.object);
+  }
+
+  for (size_t i = 0; i < originals.size(); i++) {
+    each_reference(originals[i], discover);
+  }
+
+  auto relocate = [&](VALUE value) -> VALUE {
+    auto it = relocations.find(value);
+    return it == relocations.end() ? value : it->second;
+  };
+
+  auto relocate_frame = [&](Frame* frame) -> Frame* {
+    return frame ? charly_as_frame(relocate(charly_create_pointer(frame))) : nullptr;
+  };
+
+  std::unordered_map<InstructionBlock*, InstructionBlock*> blocks;
+  AddressMapping& address_mapping = this->context.compiler_manager.address_mapping;
+  auto relocate_address = [&](uint8_t* address) -> uint8_t* {
+    InstructionBlock* block = address ? address_mapping.resolve_block(address) : nullptr;
+    if (block == nullptr) {
+      return address;
+    }
+
+    InstructionBlock*& copy = blocks[block];
+    if (copy == nullptr) {
+      copy = new InstructionBlock(*block);
+      address_mapping.register_instructionblock(copy, address_mapping.resolve_address(address).value());
+      this->cloned_blocks.push_back(copy);
+    }
+
+    return copy->get_data() + (address - block->get_data());
+  };
+
+  for (VALUE original : originals) {
+    VALUE value = relocations[original];
+    if (!charly_is_ptr(value)) {
+      continue;
+    }
+
+    switch (charly_get_type(original)) {
+      case kTypeObject: {
+        Object* source = charly_as_object(original);
+        Object* target = charly_as_object(value);
+        target->klass = relocate(source->klass);
+
+        if (source->is_dictionary()) {
+          target->make_dictionary(source->size());
+          for (auto& entry : *source->container) {
+            (*target->container)[entry.first] = relocate(entry.second);
+          }
+        } else {
+          // Shapes belong to the VM which created them, the same path is taken in this VM
+          //
+          // The target switches into dictionary mode if the shape tree of this VM is full
+          for (uint32_t i = 0; i < source->shape->slot_count(); i++) {
+            target->write(source->shape->keys[i], relocate(source->read_slot(i)));
+          }
+        }
+        break;
+      }
+
+      case kTypeArray: {
+        ArrayStorage* target = charly_as_array(value)->data;
+        for (VALUE entry : *charly_as_array(original)->data) {
+          target->push_back(relocate(entry));
+        }
+        break;
+      }
+
+      case kTypeFunction: {
+        Function* source = charly_as_function(original);
+        Function* target = charly_as_function(value);
+        target->context = relocate_frame(source->context);
+        target->body_address = relocate_address(source->body_address);
+        target->bound_self_set = source->bound_self_set;
+        target->bound_self = relocate(source->bound_self);
+        if (source->container) {
+          for (auto& entry : *source->container) {
+            (*target->writable_container())[entry.first] = relocate(entry.second);
+          }
+        }
+        break;
+      }
+
+      case kTypeCFunction: {
+        CFunction* source = charly_as_cfunction(original);
+        CFunction* target = charly_as_cfunction(value);
+        if (source->container) {
+          for (auto& entry : *source->container) {
+            (*target->writable_container())[entry.first] = relocate(entry.second);
+          }
+        }
+        break;
+      }
+
+      case kTypeGenerator: {
+        Generator* source = charly_as_generator(original);
+        Generator* target = charly_as_generator(value);
+        target->context_frame = relocate_frame(source->context_frame);
+        target->resume_address = relocate_address(source->resume_address);
+        target->running = source->running;
+        target->set_finished(source->finished());
+        target->set_started(source->started());
+        target->bound_self_set = source->bound_self_set;
+        target->bound_self = relocate(source->bound_self);
+        for (VALUE entry : *source->context_stack) {
+          target->context_stack->push_back(relocate(entry));
+        }
+        if (source->container) {
+          for (auto& entry : *source->container) {
+            (*target->writable_container())[entry.first] = relocate(entry.second);
+          }
+        }
+        break;
+      }
+
+      case kTypeClass: {
+        Class* source = charly_as_class(original);
+        Class* target = charly_as_class(value);
+        target->constructor = relocate(source->constructor);
+        target->prototype = relocate(source->prototype);
+        target->parent_class = relocate(source->parent_class);
+        for (VALUE entry : *source->member_properties) {
+          target->member_properties->push_back(relocate(entry));
+        }
+        if (source->container) {
+          for (auto& entry : *source->container) {
+            (*target->writable_container())[entry.first] = relocate(entry.second);
+          }
+        }
+        break;
+      }
+
+      case kTypeFrame: {
+        Frame* source = charly_as_frame(original);
+        Frame* target = charly_as_frame(value);
+        target->parent = relocate_frame(source->parent);
+        target->parent_environment_frame = relocate_frame(source->parent_environment_frame);
+        for (uint32_t i = 0; i < kFrameDisplaySize; i++) {
+          target->display[i] = relocate_frame(source->display[i]);
+        }
+        target->caller_value = relocate(source->caller_value);
+        target->self = relocate(source->self);
+        target->return_address = relocate_address(source->return_address);
+        target->set_halt_after_return(source->halt_after_return());
+        for (size_t i = 0; i < source->lvarcount(); i++) {
+          target->write_local(i, relocate(source->read_local(i)));
+        }
+        break;
+      }
+    }
+
+    this->gc.write_barrier(value);
+  }
+
+  this->top_frame = relocate_frame(image.top_frame);
+  this->primitive_value = relocate(image.primitive_value);
+  this->primitive_object = relocate(image.primitive_object);
+  this->primitive_class = relocate(image.primitive_class);
+  this->primitive_array = relocate(image.primitive_array);
+  this->primitive_string = relocate(image.primitive_string);
+  this->primitive_number = relocate(image.primitive_number);
+  this->primitive_function = relocate(image.primitive_function);
+  this->primitive_generator = relocate(image.primitive_generator);
+  this->primitive_boolean = relocate(image.primitive_boolean);
+  this->primitive_null = relocate(image.primitive_null);
+  for (auto literal : image.interned_literals) {
+    this->interned_literals[literal.first] = relocate(literal.second);
+  }
+  for (auto& module : image.imported_modules) {
+    this->imported_modules[module.first] = {relocate(module.second.exports), module.second.modification_time};
+  }
+  for (auto& member : image.lazy_members) {
+    this->lazy_members.push_back({relocate(member.object), member.symbol, member.path});
+  }
+
+  // Instructions of the copied blocks already carry inline cache indices of the image
+  this->inline_caches.resize(image.inline_caches.size());
+
+  // Branch table instructions of blocks which weren't copied are never executed by this VM
+  this->branch_table_blocks.resize(image.branch_table_blocks.size());
+  for (size_t i = 1; i < image.branch_table_blocks.size(); i++) {
+    auto it = blocks.find(image.branch_table_blocks[i]);
+    this->branch_table_blocks[i] = it == blocks.end() ? nullptr : it->second;
+  }
+}
+}  // namespace Charly
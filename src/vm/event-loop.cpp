@@ -0,0 +1,177 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <unistd.h>
+
+#include <cerrno>
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#else
+#include <sys/event.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#endif
+
+#include "event-loop.h"
+
+namespace Charly {
+
+// Identifies the wakeup event among other registered events
+static constexpr uint64_t kWakeToken = UINT64_MAX;
+
+// Maximum amount of events received per call to wait
+static constexpr int kMaxEvents = 32;
+
+#if defined(__linux__)
+
+EventLoop::EventLoop() {
+  this->poll_fd = epoll_create1(EPOLL_CLOEXEC);
+  this->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+  epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.u64 = kWakeToken;
+  epoll_ctl(this->poll_fd, EPOLL_CTL_ADD, this->wake_fd, &event);
+}
+
+EventLoop::~EventLoop() {
+  ::close(this->wake_fd);
+  ::close(this->poll_fd);
+}
+
+void EventLoop::wake() {
+  if (!this->wake_pending.exchange(true)) {
+    uint64_t value = 1;
+    [[maybe_unused]] ssize_t written = ::write(this->wake_fd, &value, sizeof(value));
+  }
+}
+
+void EventLoop::wait(std::chrono::milliseconds timeout, std::vector<Event>& events) {
+  epoll_event received[kMaxEvents];
+  int count = epoll_wait(this->poll_fd, received, kMaxEvents, static_cast<int>(timeout.count()));
+
+  for (int i = 0; i < count; i++) {
+    if (received[i].data.u64 == kWakeToken) {
+      uint64_t value;
+      [[maybe_unused]] ssize_t read = ::read(this->wake_fd, &value, sizeof(value));
+
+      // Reset after draining the eventfd, so later wakeups write to it again
+      this->wake_pending.store(false);
+      continue;
+    }
+
+    uint32_t flags = received[i].events;
+    bool failed = flags & (EPOLLERR | EPOLLHUP);
+    events.push_back({received[i].data.u64, failed || (flags & EPOLLIN), failed || (flags & EPOLLOUT)});
+  }
+}
+
+bool EventLoop::watch(int fd, uint64_t token, bool readable, bool writable) {
+  if (!readable && !writable) {
+    this->unwatch(fd);
+    return true;
+  }
+
+  epoll_event event = {};
+  event.events = (readable ? EPOLLIN : 0) | (writable ? EPOLLOUT : 0);
+  event.data.u64 = token;
+  if (epoll_ctl(this->poll_fd, EPOLL_CTL_MOD, fd, &event) == 0) {
+    return true;
+  }
+
+  return errno == ENOENT && epoll_ctl(this->poll_fd, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+void EventLoop::unwatch(int fd) {
+  epoll_ctl(this->poll_fd, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+#else
+
+EventLoop::EventLoop() {
+  this->poll_fd = kqueue();
+
+  struct kevent event;
+  EV_SET(&event, kWakeToken, EVFILT_USER, EV_ADD | EV_CLEAR, 0, 0, nullptr);
+  kevent(this->poll_fd, &event, 1, nullptr, 0, nullptr);
+}
+
+EventLoop::~EventLoop() {
+  ::close(this->poll_fd);
+}
+
+void EventLoop::wake() {
+  if (!this->wake_pending.exchange(true)) {
+    struct kevent event;
+    EV_SET(&event, kWakeToken, EVFILT_USER, 0, NOTE_TRIGGER, 0, nullptr);
+    kevent(this->poll_fd, &event, 1, nullptr, 0, nullptr);
+  }
+}
+
+void EventLoop::wait(std::chrono::milliseconds timeout, std::vector<Event>& events) {
+  struct kevent received[kMaxEvents];
+  struct timespec ts;
+  ts.tv_sec = timeout.count() / 1000;
+  ts.tv_nsec = (timeout.count() % 1000) * 1000000;
+  int count = kevent(this->poll_fd, nullptr, 0, received, kMaxEvents, &ts);
+
+  for (int i = 0; i < count; i++) {
+    if (received[i].filter == EVFILT_USER) {
+      this->wake_pending.store(false);
+      continue;
+    }
+
+    uint64_t token = reinterpret_cast<uint64_t>(received[i].udata);
+    bool failed = received[i].flags & (EV_EOF | EV_ERROR);
+    events.push_back({token, failed || received[i].filter == EVFILT_READ, failed || received[i].filter == EVFILT_WRITE});
+  }
+}
+
+bool EventLoop::watch(int fd, uint64_t token, bool readable, bool writable) {
+  if (!readable && !writable) {
+    this->unwatch(fd);
+    return true;
+  }
+
+  struct kevent changes[2];
+  void* udata = reinterpret_cast<void*>(token);
+  EV_SET(&changes[0], fd, EVFILT_READ, EV_ADD | (readable ? EV_ENABLE : EV_DISABLE), 0, 0, udata);
+  EV_SET(&changes[1], fd, EVFILT_WRITE, EV_ADD | (writable ? EV_ENABLE : EV_DISABLE), 0, 0, udata);
+  return kevent(this->poll_fd, changes, 2, nullptr, 0, nullptr) == 0;
+}
+
+void EventLoop::unwatch(int fd) {
+  struct kevent changes[2];
+  EV_SET(&changes[0], fd, EVFILT_READ, EV_DELETE, 0, 0, nullptr);
+  EV_SET(&changes[1], fd, EVFILT_WRITE, EV_DELETE, 0, 0, nullptr);
+  kevent(this->poll_fd, changes, 2, nullptr, 0, nullptr);
+}
+
+#endif
+
+}  // namespace Charly
@@ -24,97 +24,350 @@
  * SOFTWARE.
  */
 
+#include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
 
+#include <unistd.h>
+
 #include "gc.h"
 #include "vm.h"
 
 namespace Charly {
-void GarbageCollector::add_heap() {
-  MemoryCell* heap = static_cast<MemoryCell*>(std::calloc(this->config.heap_cell_count, sizeof(MemoryCell)));
+struct GarbageCollector::PauseScope {
+  GarbageCollector& gc;
+  std::chrono::steady_clock::time_point start_time;
+
+  PauseScope(GarbageCollector& t_gc) : gc(t_gc) {
+    if (this->gc.pause_depth++ == 0) {
+      this->start_time = std::chrono::steady_clock::now();
+    }
+  }
+
+  ~PauseScope() {
+    if (--this->gc.pause_depth == 0) {
+      auto duration = std::chrono::steady_clock::now() - this->start_time;
+      this->gc.stats.record_pause(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count());
+    }
+  }
+};
+
+// Returns the size class a type is allocated from
+static CellSizeClass cell_size_class_of_type(uint8_t type) {
+  switch (type) {
+    case kTypeObject: return cell_size_class_for(sizeof(Object));
+    case kTypeArray: return cell_size_class_for(sizeof(Array));
+    case kTypeString: return cell_size_class_for(sizeof(String));
+    case kTypeFunction: return cell_size_class_for(sizeof(Function));
+    case kTypeCFunction: return cell_size_class_for(sizeof(CFunction));
+    case kTypeGenerator: return cell_size_class_for(sizeof(Generator));
+    case kTypeClass: return cell_size_class_for(sizeof(Class));
+    case kTypeFrame: return cell_size_class_for(sizeof(Frame));
+    case kTypeCPointer: return cell_size_class_for(sizeof(CPointer));
+    default: return kCellSizeLarge;
+  }
+}
+
+size_t GarbageCollector::heap_size(CellSizeClass size_class) {
+  return this->config.heap_cell_count * kCellSizes[size_class];
+}
+
+void GarbageCollector::add_heap(CellSizeClass size_class) {
+  size_t cell_count = this->config.heap_cell_count;
+
+  // Anonymous mappings are zero-initialized and can be returned to the
+  // operating system once the heap is empty
+  void* memory = mmap(nullptr, this->heap_size(size_class), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) {
+    this->config.err_stream << "Failed to map a new heap" << '\n';
+    return;
+  }
+
+#ifdef MADV_HUGEPAGE
+  if (this->config.use_huge_pages) {
+    madvise(memory, this->heap_size(size_class), MADV_HUGEPAGE);
+  }
+#endif
+
+  CellHeap heap = {size_class, cell_count, static_cast<MemoryCell*>(memory), 0};
   this->heaps.push_back(heap);
-  this->remaining_free_cells += this->config.heap_cell_count;
+  this->heap_count[size_class]++;
+  this->stats.heap_count++;
+  this->stats.heap_bytes += this->heap_size(size_class);
+  this->stats.peak_heap_bytes = std::max(this->stats.peak_heap_bytes, this->stats.heap_bytes);
+  this->remaining_free_cells[size_class] += cell_count;
 
   // Add the newly allocated cells to the free list
-  MemoryCell* last_cell = this->free_cell;
-  for (size_t i = 0; i < this->config.heap_cell_count; i++) {
-    heap[i].free.next = last_cell;
-    last_cell = heap + i;
+  MemoryCell* last_cell = this->free_cell[size_class];
+  for (size_t i = 0; i < cell_count; i++) {
+    MemoryCell* cell = heap.cell_at(i);
+    cell->free.next = last_cell;
+    last_cell = cell;
   }
 
-  this->free_cell = last_cell;
+  this->free_cell[size_class] = last_cell;
 }
 
-void GarbageCollector::grow_heap() {
-  size_t heap_count = this->heaps.size();
+void GarbageCollector::grow_heap(CellSizeClass size_class) {
+  size_t heap_count = this->heap_count[size_class];
   size_t heaps_to_add = (heap_count * this->config.heap_growth_factor + 1) - heap_count;
-  while (heaps_to_add--)
-    this->add_heap();
+  while (heaps_to_add-- && this->heap_fits_limit(size_class))
+    this->add_heap(size_class);
+}
+
+void GarbageCollector::request_out_of_memory(OutOfMemoryReason reason) {
+  if (!this->out_of_memory) {
+    this->out_of_memory = true;
+    this->out_of_memory_reason = reason;
+  }
+}
+
+bool GarbageCollector::heap_fits_limit(CellSizeClass size_class, size_t reserve) {
+  if (this->config.max_heap_bytes == 0)
+    return true;
+  return this->stats.heap_bytes + this->heap_size(size_class) <= this->config.max_heap_bytes + reserve;
+}
+
+void GarbageCollector::release_empty_heaps() {
+  size_t released_heap_count = 0;
+
+  for (uint8_t i = 0; i < kCellSizeClassCount; i++) {
+    CellSizeClass size_class = static_cast<CellSizeClass>(i);
+    std::vector<CellHeap> released_heaps;
+
+    auto it = this->heaps.begin();
+    while (it != this->heaps.end()) {
+      size_t heap_count = this->heap_count[size_class];
+      if (heap_count <= this->config.heap_low_water_mark ||
+          this->remaining_free_cells[size_class] <=
+              heap_count * this->config.heap_cell_count * this->config.heap_high_water_mark) {
+        break;
+      }
+
+      CellHeap& heap = *it;
+      if (heap.size_class != size_class || heap.live_cells > 0) {
+        it++;
+        continue;
+      }
+
+      // Cells might have been allocated from this heap since it was swept
+      bool heap_is_empty = true;
+      for (size_t c = 0; c < heap.cell_count; c++) {
+        if (!charly_is_dead(heap.cell_at(c)->as_value())) {
+          heap_is_empty = false;
+          break;
+        }
+      }
+
+      if (!heap_is_empty) {
+        it++;
+        continue;
+      }
+
+      this->heap_count[size_class]--;
+      this->remaining_free_cells[size_class] -= heap.cell_count;
+      released_heaps.push_back(heap);
+      it = this->heaps.erase(it);
+    }
+
+    if (released_heaps.size() == 0) {
+      continue;
+    }
+
+    // Unlink the cells of the released heaps from the free list
+    size_t size = this->heap_size(size_class);
+    auto is_released = [&](MemoryCell* cell) {
+      for (CellHeap& heap : released_heaps) {
+        char* begin = reinterpret_cast<char*>(heap.cells);
+        if (reinterpret_cast<char*>(cell) >= begin && reinterpret_cast<char*>(cell) < begin + size) {
+          return true;
+        }
+      }
+      return false;
+    };
+
+    MemoryCell** link = &this->free_cell[size_class];
+    while (*link) {
+      if (is_released(*link)) {
+        *link = (*link)->free.next;
+      } else {
+        link = &(*link)->free.next;
+      }
+    }
+
+    for (CellHeap& heap : released_heaps) {
+      munmap(heap.cells, size);
+      this->stats.heap_count--;
+      this->stats.heap_bytes -= size;
+    }
+    released_heap_count += released_heaps.size();
+  }
+
+  if (this->config.trace && released_heap_count) {
+    this->config.out_stream << "#-- GC: Released " << released_heap_count << " heaps --#" << '\n';
+  }
+}
+
+bool GarbageCollector::below_marking_threshold(CellSizeClass size_class) {
+  return this->remaining_free_cells[size_class] < this->heap_count[size_class] * this->config.heap_cell_count *
+                                                      this->config.incremental_marking_threshold;
 }
 
 void GarbageCollector::mark_persistent(VALUE value) {
   std::unique_lock<std::recursive_mutex> g_lock(this->g_mutex);
-  this->temporaries.insert(value);
+  this->temporaries[value]++;
 }
 
 void GarbageCollector::unmark_persistent(VALUE value) {
   std::unique_lock<std::recursive_mutex> g_lock(this->g_mutex);
 
   // Check if this value is a registered temporary variable
-  if (this->temporaries.count(value)) {
-    auto it = this->temporaries.find(value);
-    if (it != this->temporaries.end()) {
-      this->temporaries.erase(it);
-    }
+  auto it = this->temporaries.find(value);
+  if (it != this->temporaries.end() && --it->second == 0) {
+    this->temporaries.erase(it);
   }
+
+  // Native code modifies temporaries without going through the write barrier
+  this->write_barrier(value);
 }
 
-void GarbageCollector::mark(VALUE value) {
+// The mark bit is set with an atomic operation on the byte of the cell header containing it,
+// since bitfields can't be accessed atomically on their own
+struct MarkBitLocation {
+  size_t offset;
+  uint8_t mask;
+};
+static const MarkBitLocation kMarkBitLocation = [] {
+  // Start from a zeroed header, so unused padding bits don't differ
+  uint8_t bytes[sizeof(Basic)] = {0};
+  Basic basic;
+  std::memcpy(&basic, bytes, sizeof(Basic));
+  basic.mark = true;
+  std::memcpy(bytes, &basic, sizeof(Basic));
+
+  size_t offset = 0;
+  while (bytes[offset] == 0)
+    offset++;
+  return MarkBitLocation{offset, bytes[offset]};
+}();
+
+// Marker threads might modify the header of a cell while it is being read
+static inline Basic load_header(MemoryCell* cell) {
+  uint8_t bytes[sizeof(Basic)];
+  uint8_t* header = reinterpret_cast<uint8_t*>(&cell->basic);
+  for (size_t i = 0; i < sizeof(Basic); i++) {
+    bytes[i] = __atomic_load_n(header + i, __ATOMIC_RELAXED);
+  }
+
+  Basic basic;
+  std::memcpy(&basic, bytes, sizeof(Basic));
+  return basic;
+}
+
+MemoryCell* GarbageCollector::markable_cell(VALUE value) {
   if (!charly_is_ptr(value)) {
+    return nullptr;
+  }
+
+  MemoryCell* cell = charly_as_pointer_to<MemoryCell>(value);
+  if (cell == nullptr) {
+    return nullptr;
+  }
+
+  Basic header = load_header(cell);
+
+  // Old cells are assumed to be alive during minor collections
+  if (this->minor_collection && header.old) {
+    return nullptr;
+  }
+
+  // Frames on the frame stack are marked during the final pause of a collection
+  if (this->incremental_marking && header.type == kTypeFrame && cell->frame.stack_allocated) {
+    return nullptr;
+  }
+
+  return cell;
+}
+
+void GarbageCollector::mark(VALUE value) {
+  MemoryCell* cell = this->markable_cell(value);
+  if (cell == nullptr || cell->basic.mark) {
+    return;
+  }
+
+  cell->basic.mark = true;
+  this->shade(cell);
+}
+
+void GarbageCollector::shade(MemoryCell* cell) {
+  cell->basic.gray = true;
+  this->gray_cells.push_back(cell);
+}
+
+void GarbageCollector::mark_root(VALUE value) {
+  if (!charly_is_ptr(value) || charly_as_pointer(value) == nullptr) {
     return;
   }
 
-  if (charly_as_pointer(value) == nullptr) {
+  // Old roots might have been modified by native code, their children are
+  // always searched for young cells
+  MemoryCell* cell = charly_as_pointer_to<MemoryCell>(value);
+  if (this->minor_collection && cell->basic.old) {
+    this->mark_children(cell);
     return;
   }
 
-  if (charly_as_basic(value)->mark) {
+  // Roots which were already marked by a previous step are scanned again
+  if (cell->basic.mark) {
+    if (!cell->basic.gray) {
+      this->shade(cell);
+    }
     return;
   }
 
-  charly_as_basic(value)->mark = true;
-  switch (charly_as_basic(value)->type) {
+  this->mark(value);
+}
+
+template <typename Fn>
+void GarbageCollector::each_child(MemoryCell* cell, Fn&& callback) {
+  VALUE value = cell->as_value();
+  switch (cell->basic.type) {
     case kTypeObject: {
       Object* obj = charly_as_object(value);
-      this->mark(obj->klass);
-      for (auto entry : *obj->container)
-        this->mark(entry.second);
+      callback(obj->klass);
+      obj->each([&](VALUE, VALUE value) { callback(value); });
       break;
     }
 
     case kTypeArray: {
       Array* arr = charly_as_array(value);
       for (auto arr_entry : *arr->data)
-        this->mark(arr_entry);
+        callback(arr_entry);
       break;
     }
 
     case kTypeFunction: {
       Function* func = charly_as_function(value);
-      this->mark(charly_create_pointer(func->context));
+      callback(charly_create_pointer(func->context));
 
       if (func->bound_self_set)
-        this->mark(func->bound_self);
-      for (auto entry : *func->container)
-        this->mark(entry.second);
+        callback(func->bound_self);
+      if (func->container) {
+        for (auto entry : *func->container)
+          callback(entry.second);
+      }
       break;
     }
 
     case kTypeCFunction: {
       CFunction* cfunc = charly_as_cfunction(value);
-      for (auto entry : *cfunc->container)
-        this->mark(entry.second);
+      if (cfunc->container) {
+        for (auto entry : *cfunc->container)
+          callback(entry.second);
+      }
       break;
     }
 
@@ -122,181 +375,673 @@ void GarbageCollector::mark(VALUE value) {
       Generator* gen = charly_as_generator(value);
       // We only mark these values if the generator is still running
       if (!gen->finished()) {
-        this->mark(charly_create_pointer(gen->context_frame));
+        callback(charly_create_pointer(gen->context_frame));
         if (gen->bound_self_set)
-          this->mark(gen->bound_self);
+          callback(gen->bound_self);
         for (auto entry : *gen->context_stack)
-          this->mark(entry);
+          callback(entry);
+      }
+      if (gen->container) {
+        for (auto entry : *gen->container)
+          callback(entry.second);
       }
-      for (auto entry : *gen->container)
-        this->mark(entry.second);
       break;
     }
 
     case kTypeClass: {
       Class* klass = charly_as_class(value);
-      this->mark(klass->constructor);
-      this->mark(klass->prototype);
-      this->mark(klass->parent_class);
-      for (auto entry : *klass->container)
-        this->mark(entry.second);
+      callback(klass->constructor);
+      callback(klass->prototype);
+      callback(klass->parent_class);
+      if (klass->container) {
+        for (auto entry : *klass->container)
+          callback(entry.second);
+      }
       break;
     }
 
     case kTypeFrame: {
       Frame* frame = charly_as_frame(value);
-      this->mark(charly_create_pointer(frame->parent));
-      this->mark(charly_create_pointer(frame->parent_environment_frame));
-      this->mark(charly_create_pointer(frame->last_active_catchtable));
-      this->mark(frame->caller_value);
-      this->mark(frame->self);
+      callback(charly_create_pointer(frame->parent));
+      callback(charly_create_pointer(frame->parent_environment_frame));
+      callback(frame->caller_value);
+      callback(frame->self);
 
       for (size_t i = 0; i < frame->lvarcount(); i++) {
-        this->mark(frame->read_local(i));
+        callback(frame->read_local(i));
       }
 
       break;
     }
+  }
+}
+
+bool GarbageCollector::drain_gray_cells(std::chrono::steady_clock::time_point deadline) {
+  uint32_t visited_cells = 0;
+  while (this->gray_cells.size()) {
+    MemoryCell* cell = this->gray_cells.back();
+    this->gray_cells.pop_back();
+    cell->basic.gray = false;
+    this->mark_children(cell);
 
-    case kTypeCatchTable: {
-      CatchTable* table = charly_as_catchtable(value);
-      this->mark(charly_create_pointer(table->frame));
-      this->mark(charly_create_pointer(table->parent));
+    // Checking the clock is comparatively expensive, so it's only done every few cells
+    if (++visited_cells % 128 == 0 && std::chrono::steady_clock::now() >= deadline) {
       break;
     }
   }
+
+  return this->gray_cells.size() == 0;
 }
 
-void GarbageCollector::do_collect() {
-  std::unique_lock<std::recursive_mutex> g_lock(this->g_mutex);
-  this->collect();
+bool GarbageCollector::drain_gray_cells() {
+  if (this->config.marker_thread_count > 1 && this->gray_cells.size() >= this->config.parallel_marking_threshold) {
+    this->drain_gray_cells_parallel();
+    return true;
+  }
+
+  return this->drain_gray_cells(std::chrono::steady_clock::time_point::max());
 }
 
-void GarbageCollector::collect() {
-  std::unique_lock<std::recursive_mutex>(this->g_mutex);
+bool GarbageCollector::claim_cell(MemoryCell* cell) {
+  uint8_t* header = reinterpret_cast<uint8_t*>(&cell->basic) + kMarkBitLocation.offset;
+  if (__atomic_load_n(header, __ATOMIC_RELAXED) & kMarkBitLocation.mask) {
+    return false;
+  }
 
-  auto gc_start_time = std::chrono::high_resolution_clock::now();
-  if (this->config.trace) {
-    this->config.out_stream << "#-- GC: Pause --#" << '\n';
+  return !(__atomic_fetch_or(header, kMarkBitLocation.mask, __ATOMIC_ACQ_REL) & kMarkBitLocation.mask);
+}
+
+MarkerPool::MarkerPool(size_t helper_count) {
+  this->threads.reserve(helper_count);
+  for (size_t id = 1; id <= helper_count; id++) {
+    this->threads.emplace_back([this, id]() { this->helper_main(id); });
+  }
+}
+
+MarkerPool::~MarkerPool() {
+  {
+    std::unique_lock<std::mutex> lk(this->m);
+    this->stopping = true;
+  }
+  this->start_cv.notify_all();
+
+  for (std::thread& thread : this->threads) {
+    thread.join();
+  }
+}
+
+void MarkerPool::run(const Job& job) {
+  {
+    std::unique_lock<std::mutex> lk(this->m);
+    this->job = &job;
+    this->generation++;
+    this->running_helpers = this->threads.size();
+  }
+  this->start_cv.notify_all();
+
+  job(0);
+
+  std::unique_lock<std::mutex> lk(this->m);
+  this->done_cv.wait(lk, [&]() { return this->running_helpers == 0; });
+  this->job = nullptr;
+}
+
+void MarkerPool::helper_main(size_t id) {
+  uint64_t last_generation = 0;
+
+  for (;;) {
+    const Job* job;
+    {
+      std::unique_lock<std::mutex> lk(this->m);
+      this->start_cv.wait(lk, [&]() { return this->stopping || this->generation != last_generation; });
+      if (this->stopping) {
+        return;
+      }
+
+      last_generation = this->generation;
+      job = this->job;
+    }
+
+    (*job)(id);
+
+    std::unique_lock<std::mutex> lk(this->m);
+    if (--this->running_helpers == 0) {
+      this->done_cv.notify_one();
+    }
+  }
+}
+
+void GarbageCollector::drain_gray_cells_parallel() {
+  if (this->marker_pool == nullptr) {
+    this->marker_pool = std::make_unique<MarkerPool>(this->config.marker_thread_count - 1);
+  }
+
+  size_t marker_count = this->marker_pool->thread_count();
+  std::vector<MarkDeque> deques(marker_count);
+
+  // Distribute the current worklist across all marker threads
+  //
+  // Gray bits are only used by the write barrier and are reset before any
+  // marker thread starts modifying cell headers
+  size_t index = 0;
+  for (MemoryCell* cell : this->gray_cells) {
+    cell->basic.gray = false;
+    deques[index++ % marker_count].local.push_back(cell);
   }
+  this->gray_cells.clear();
+
+  std::atomic<size_t> active_markers(marker_count);
+  this->marker_pool->run([&](size_t id) { this->parallel_mark_worker(deques, id, active_markers); });
+}
+
+void GarbageCollector::parallel_mark_worker(std::vector<MarkDeque>& deques,
+                                            size_t id,
+                                            std::atomic<size_t>& active_markers) {
+  MarkDeque& own = deques[id];
+  MemoryCell* cell;
+
+  auto find_work = [&]() {
+    if (own.pop(cell)) {
+      return true;
+    }
 
-  // Mark all top level values from the vm
+    for (size_t i = 1; i < deques.size(); i++) {
+      if (deques[(id + i) % deques.size()].steal(own.local)) {
+        return own.pop(cell);
+      }
+    }
+
+    return false;
+  };
+
+  for (;;) {
+    while (find_work()) {
+      this->each_child(cell, [&](VALUE value) {
+        MemoryCell* child = this->markable_cell(value);
+        if (child && this->claim_cell(child)) {
+          own.push(child);
+        }
+      });
+    }
+
+    // Only active marker threads push new work, so once every thread
+    // has run out of work, marking is finished
+    active_markers--;
+    for (;;) {
+      if (active_markers.load() == 0) {
+        return;
+      }
+
+      bool work_available = std::any_of(deques.begin(), deques.end(), [](MarkDeque& deque) { return !deque.empty(); });
+      if (work_available) {
+        active_markers++;
+        break;
+      }
+
+      std::this_thread::yield();
+    }
+  }
+}
+
+void GarbageCollector::mark_children(MemoryCell* cell) {
+  this->each_child(cell, [&](VALUE value) { this->mark(value); });
+}
+
+void GarbageCollector::do_collect() {
+  std::unique_lock<std::recursive_mutex> g_lock(this->g_mutex);
+  this->collect();
+  this->finish_sweeping();
+}
+
+template <typename Fn>
+void GarbageCollector::each_root(Fn&& callback) {
+  // Top level values from the vm
   if (this->host_vm->running) {
-    this->mark(charly_create_pointer(this->host_vm->frames));
-    this->mark(charly_create_pointer(this->host_vm->catchstack));
-    this->mark(charly_create_pointer(this->host_vm->top_frame));
-    this->mark(this->host_vm->last_exception_thrown);
+    // The whole frame chain is visited, since frames on the frame stack
+    // might only be reachable via old frames
+    for (Frame* frame = this->host_vm->frames; frame; frame = frame->parent) {
+      callback(charly_create_pointer(frame));
+    }
+    callback(charly_create_pointer(this->host_vm->top_frame));
+    callback(this->host_vm->last_exception_thrown);
 
     for (VALUE item : this->host_vm->stack) {
-      this->mark(item);
+      callback(item);
     }
 
     auto task_queue_copy = this->host_vm->task_queue;
     while (task_queue_copy.size()) {
       VMTask task = task_queue_copy.front();
       task_queue_copy.pop();
-      this->mark(task.fn);
-      this->mark(task.argument);
+      callback(task.fn);
+      callback(task.argument);
     }
 
-    {
-      std::unique_lock<std::mutex> lk(this->host_vm->worker_task_queue_m);
-      auto task_queue_copy = this->host_vm->worker_task_queue;
-      while (task_queue_copy.size()) {
-        AsyncTask task = task_queue_copy.front();
-        for (VALUE item : task.arguments) {
-          this->mark(item);
-        }
-        this->mark(task.cb);
-        task_queue_copy.pop();
+    this->host_vm->worker_pool.each_queued_task([&](const AsyncTask& task) {
+      for (VALUE item : task.arguments) {
+        callback(item);
       }
-    }
+      callback(task.cb);
+    });
 
     {
       std::unique_lock<std::mutex> lk(this->host_vm->worker_result_queue_m);
       auto result_queue_copy = this->host_vm->worker_result_queue;
       while (result_queue_copy.size()) {
-        AsyncTaskResult result = result_queue_copy.front();
+        const AsyncTaskResult& result = result_queue_copy.front();
+        for (VALUE item : result.task.arguments) {
+          callback(item);
+        }
+        callback(result.task.cb);
         result_queue_copy.pop();
-        this->mark(result.cb);
-        this->mark(result.result);
       }
     }
 
-    for (auto it : this->host_vm->timers) {
-      this->mark(it.second.fn);
-      this->mark(it.second.argument);
+    this->host_vm->timers.each([&](const VMTask& task) {
+      callback(task.fn);
+      callback(task.argument);
+    });
+
+    for (auto& entry : this->host_vm->sockets) {
+      const Socket& socket = entry.second;
+      callback(socket.on_connect);
+      callback(socket.on_read);
+      for (const Socket::PendingWrite& write : socket.writes) {
+        callback(write.cb);
+      }
     }
 
-    for (auto it : this->host_vm->intervals) {
-      this->mark(std::get<0>(it.second).fn);
-      this->mark(std::get<0>(it.second).argument);
+    for (auto& entry : this->host_vm->isolates) {
+      callback(entry.second.on_message);
+      callback(entry.second.on_exit);
     }
   }
 
-  // Mark all temporaries
+  // String literals shared by all executions of their PutString instructions
+  for (auto literal : this->host_vm->interned_literals) {
+    callback(literal.second);
+  }
+
+  // Cached return values of imported modules
+  for (auto& module : this->host_vm->imported_modules) {
+    callback(module.second.exports);
+  }
+
+  // Objects with members which weren't imported yet
+  for (auto& member : this->host_vm->lazy_members) {
+    callback(member.object);
+  }
+
+  // Temporaries and values held by handle scopes
   for (auto temp_item_iter : this->temporaries) {
-    this->mark(temp_item_iter);
+    callback(temp_item_iter.first);
   }
 
-  // Sweep Phase
-  int freed_cells_count = 0;
-  for (MemoryCell* heap : this->heaps) {
-    for (size_t i = 0; i < this->config.heap_cell_count; i++) {
-      MemoryCell* cell = heap + i;
-      if (charly_as_basic(charly_create_pointer(cell))->mark) {
-        charly_as_basic(charly_create_pointer(cell))->mark = false;
-      } else {
-        // This cell might already be on the free list
-        // Make sure we don't double free cells
-        if (!charly_is_dead(charly_create_pointer(cell))) {
-          freed_cells_count++;
-          this->deallocate(cell);
+  for (VALUE handle : this->handles) {
+    callback(handle);
+  }
+}
+
+void GarbageCollector::mark_roots() {
+  this->each_root([&](VALUE value) { this->mark_root(value); });
+}
+
+void GarbageCollector::start_incremental_marking() {
+  PauseScope pause(*this);
+
+  if (this->config.trace) {
+    this->config.out_stream << "#-- GC: Started incremental marking --#" << '\n';
+  }
+
+  // Marking requires the mark bits left over from the last collection to be cleared
+  this->finish_sweeping();
+
+  this->incremental_marking = true;
+  this->allocations_since_mark_step = 0;
+  this->mark_roots();
+}
+
+void GarbageCollector::do_mark_step() {
+  std::unique_lock<std::recursive_mutex> g_lock(this->g_mutex);
+
+  if (!this->incremental_marking) {
+    return;
+  }
+
+  PauseScope pause(*this);
+  this->stats.mark_steps++;
+  this->allocations_since_mark_step = 0;
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(this->config.mark_step_pause_target);
+  if (this->drain_gray_cells(deadline)) {
+    this->collect();
+  }
+}
+
+void GarbageCollector::do_sweep_step() {
+  std::unique_lock<std::recursive_mutex> g_lock(this->g_mutex);
+
+  if (this->is_sweeping()) {
+    this->sweep_next_heap();
+  }
+}
+
+void GarbageCollector::sweep_next_heap() {
+  PauseScope pause(*this);
+  this->stats.sweep_steps++;
+
+  CellHeap& heap = this->heaps[this->sweep_heap_index++];
+  CellSizeClass size_class = heap.size_class;
+  heap.live_cells = 0;
+
+  // All surviving cells are promoted into the old generation
+  //
+  // The free list was emptied at the end of the collection, so cells which
+  // were already free are linked into it again
+  for (size_t i = 0; i < heap.cell_count; i++) {
+    MemoryCell* cell = heap.cell_at(i);
+    if (cell->basic.mark) {
+      cell->basic.mark = false;
+      cell->basic.old = true;
+      heap.live_cells++;
+    } else if (charly_is_dead(cell->as_value())) {
+      cell->free.next = this->free_cell[size_class];
+      this->free_cell[size_class] = cell;
+      this->remaining_free_cells[size_class]++;
+      this->swept_free_cells[size_class]++;
+    } else {
+      this->deallocate(cell);
+      this->swept_free_cells[size_class]++;
+      this->swept_freed_bytes += kCellSizes[size_class];
+      this->stats.freed_cells++;
+    }
+  }
+
+  if (this->is_sweeping()) {
+    return;
+  }
+
+  this->stats.live_cells = 0;
+  for (size_t i = 0; i < this->sweep_heap_end; i++) {
+    this->stats.live_cells += this->heaps[i].live_cells;
+  }
+  this->stats.promoted_cells += this->stats.live_cells;
+
+  if (this->config.trace) {
+    this->config.out_stream << "#-- GC: Swept " << this->sweep_heap_end << " heaps, freed " << this->swept_freed_bytes
+                            << " bytes --#" << '\n';
+  }
+
+  // Grow the heaps of a size class if the collection didn't free enough cells,
+  // otherwise the next incremental collection would start right away
+  if (this->config.incremental_marking) {
+    size_t swept_heap_count[kCellSizeClassCount] = {0};
+    for (size_t i = 0; i < this->sweep_heap_end; i++) {
+      swept_heap_count[this->heaps[i].size_class]++;
+    }
+
+    for (uint8_t size_class = 0; size_class < kCellSizeClassCount; size_class++) {
+      if (this->swept_free_cells[size_class] <
+          swept_heap_count[size_class] * this->config.heap_cell_count * this->config.incremental_marking_threshold) {
+        size_t heap_count = this->heap_count[size_class];
+        this->grow_heap(static_cast<CellSizeClass>(size_class));
+
+        // At the heap limit, collections which don't free enough cells would run back to back
+        if (this->heap_count[size_class] == heap_count) {
+          if (this->sweeping_requested_collection) {
+            this->request_out_of_memory(kHeapLimitReached);
+          } else {
+            this->full_collection_requested = true;
+          }
         }
       }
     }
   }
 
+  this->release_empty_heaps();
+}
+
+void GarbageCollector::finish_sweeping() {
+  while (this->is_sweeping()) {
+    this->sweep_next_heap();
+  }
+}
+
+void GarbageCollector::collect() {
+  std::unique_lock<std::recursive_mutex> g_lock(this->g_mutex);
+  PauseScope pause(*this);
+
+  // The pending sweep is finished before the collection is counted, so its statistics
+  // are attributed to the previous collection
+  this->finish_sweeping();
+  this->stats.full_collections++;
+
+  auto gc_start_time = std::chrono::high_resolution_clock::now();
+  if (this->config.trace) {
+    this->config.out_stream << "#-- GC: Pause --#" << '\n';
+  }
+
+  // Only collections which mark the whole heap themselves can confirm an out of memory situation
+  this->sweeping_requested_collection = this->full_collection_requested && !this->incremental_marking;
+  if (!this->incremental_marking) {
+    this->full_collection_requested = false;
+  }
+
+  // Finish an ongoing incremental collection
+  //
+  // Cells marked by earlier steps stay marked, the roots are scanned once again
+  // to find values which were stored in them without a write barrier
+  this->incremental_marking = false;
+  this->mark_roots();
+  this->drain_gray_cells();
+
+  // Sweep Phase
+  //
+  // The heaps are swept lazily by the allocator, starting with empty free lists
+  for (uint8_t size_class = 0; size_class < kCellSizeClassCount; size_class++) {
+    this->free_cell[size_class] = nullptr;
+    this->remaining_free_cells[size_class] = 0;
+    this->swept_free_cells[size_class] = 0;
+  }
+  this->sweep_heap_index = 0;
+  this->sweep_heap_end = this->heaps.size();
+  this->swept_freed_bytes = 0;
+
+  // Old cells are remembered again if they are written to before the next minor collection
+  for (MemoryCell* cell : this->remembered_cells) {
+    cell->basic.remembered = false;
+  }
+  this->young_cells.clear();
+  this->remembered_cells.clear();
+
+  // Frames living on the frame stack aren't part of any heap, their mark bits need
+  // to be reset separately. All of them are reachable via the active frame chain
+  for (Frame* frame = this->host_vm->frames; frame; frame = frame->parent) {
+    if (frame->stack_allocated) {
+      frame->basic.mark = false;
+    }
+  }
+
+  if (!this->config.lazy_sweeping) {
+    this->finish_sweeping();
+  }
+
+  if (this->config.trace) {
+    std::chrono::duration<double> gc_collect_duration = std::chrono::high_resolution_clock::now() - gc_start_time;
+    this->config.out_stream << std::fixed;
+    this->config.out_stream << std::setprecision(0);
+    this->config.out_stream << "#-- GC: Finished in " << gc_collect_duration.count() * 1000000000 << " nanoseconds --#"
+                            << '\n';
+    this->config.out_stream << std::setprecision(6);
+  }
+}
+
+void GarbageCollector::collect_young() {
+  std::unique_lock<std::recursive_mutex> g_lock(this->g_mutex);
+  PauseScope pause(*this);
+  this->stats.minor_collections++;
+
+  auto gc_start_time = std::chrono::high_resolution_clock::now();
+  if (this->config.trace) {
+    this->config.out_stream << "#-- GC: Minor Pause --#" << '\n';
+  }
+
+  this->minor_collection = true;
+  this->mark_roots();
+
+  // Old cells which were written to since the last collection
+  for (MemoryCell* cell : this->remembered_cells) {
+    cell->basic.remembered = false;
+    this->mark_children(cell);
+  }
+  this->remembered_cells.clear();
+  this->drain_gray_cells();
+  this->minor_collection = false;
+
+  // Sweep Phase
+  //
+  // Only cells allocated since the last collection are visited
+  size_t freed_bytes = 0;
+  for (MemoryCell* cell : this->young_cells) {
+    if (cell->basic.mark) {
+      cell->basic.mark = false;
+      cell->basic.old = true;
+      this->stats.promoted_cells++;
+    } else if (!charly_is_dead(cell->as_value())) {
+      freed_bytes += kCellSizes[cell_size_class_of_type(cell->basic.type)];
+      this->stats.freed_cells++;
+      this->deallocate(cell);
+    }
+  }
+  this->young_cells.clear();
+
+  for (Frame* frame = this->host_vm->frames; frame; frame = frame->parent) {
+    if (frame->stack_allocated) {
+      frame->basic.mark = false;
+    }
+  }
+
   if (this->config.trace) {
     std::chrono::duration<double> gc_collect_duration = std::chrono::high_resolution_clock::now() - gc_start_time;
     this->config.out_stream << std::fixed;
     this->config.out_stream << std::setprecision(0);
-    this->config.out_stream << "#-- GC: Freed " << (freed_cells_count * sizeof(MemoryCell)) << " bytes --#" << '\n';
+    this->config.out_stream << "#-- GC: Freed " << freed_bytes << " bytes --#" << '\n';
     this->config.out_stream << "#-- GC: Finished in " << gc_collect_duration.count() * 1000000000 << " nanoseconds --#"
                             << '\n';
     this->config.out_stream << std::setprecision(6);
   }
 }
 
-MemoryCell* GarbageCollector::allocate() {
+MemoryCell* GarbageCollector::allocate(CellSizeClass size_class) {
   std::unique_lock<std::recursive_mutex> g_lock(this->g_mutex);
 
-  MemoryCell* cell = this->free_cell;
-  this->free_cell = this->free_cell->free.next;
+  // The last sampled cell has been initialized by now
+  if (this->pending_sample_cell) {
+    this->record_pending_allocation_sample();
+  }
+
+  // Allocations are safe points, so snapshots requested by a signal are written here
+  if (GarbageCollector::heap_snapshot_requested()) {
+    this->write_requested_heap_snapshot();
+  }
+
+  if (this->incremental_marking) {
+    // Minor collections are paused while the heap is being marked
+    if (++this->allocations_since_mark_step >= this->config.mark_step_interval) {
+      this->do_mark_step();
+    }
+  } else if (this->full_collection_requested) {
+    this->collect();
+  } else if (this->config.incremental_marking && !this->is_sweeping() && this->below_marking_threshold(size_class)) {
+    this->start_incremental_marking();
+  } else if (this->young_cells.size() >= this->config.young_generation_cell_count) {
+    this->collect_young();
+  }
+
+  // Sweep heaps left over from the last collection until enough free cells are available
+  size_t& remaining_free_cells = this->remaining_free_cells[size_class];
+  while (remaining_free_cells <= this->config.min_free_cells && this->is_sweeping()) {
+    this->sweep_next_heap();
+  }
 
-  // If we've just allocated the last available cell,
+  // If we're about to allocate one of the last available cells,
   // we do a collect in order to make sure we never get a failing
   // allocation in the future
-  if (this->free_cell == nullptr || this->remaining_free_cells <= this->config.min_free_cells) {
+  if (remaining_free_cells <= this->config.min_free_cells) {
     this->collect();
+    while (remaining_free_cells <= this->config.min_free_cells && this->is_sweeping()) {
+      this->sweep_next_heap();
+    }
 
     // If a collection didn't yield new available space,
     // allocate more heaps
-    if (this->free_cell == nullptr) {
-      this->grow_heap();
+    if (remaining_free_cells <= this->config.min_free_cells) {
+      this->grow_heap(size_class);
+    }
 
-      if (!this->free_cell) {
-        this->config.err_stream << "Failed to expand heap, the next allocation will cause a segfault." << '\n';
+    // The heap limit was reached or no new heap could be mapped, even though the whole heap was just
+    // collected and swept. The script is given a chance to handle the situation via an exception,
+    // allocations made until then are served from the reserve
+    if (remaining_free_cells <= this->config.min_free_cells) {
+      this->request_out_of_memory(kHeapLimitReached);
+
+      size_t reserve = 0;
+      for (size_t heap_size_class = 0; heap_size_class < kCellSizeClassCount; heap_size_class++) {
+        reserve += this->heap_size(static_cast<CellSizeClass>(heap_size_class));
+      }
+      if (this->heap_fits_limit(size_class, reserve)) {
+        this->add_heap(size_class);
+      }
+    }
+
+    if (!this->free_cell[size_class]) {
+      this->host_vm->panic(Status::OutOfMemory);
+    }
+  }
+
+  MemoryCell* cell = this->free_cell[size_class];
+  this->free_cell[size_class] = cell->free.next;
+
+  // The cell is registered after the collection, since it isn't initialized yet
+  this->young_cells.push_back(cell);
+  remaining_free_cells--;
+  this->stats.allocated_cells++;
+  this->stats.allocated_bytes += kCellSizes[size_class];
+
+  this->task_allocated_bytes += kCellSizes[size_class];
+  if (this->config.task_allocation_budget && !this->task_budget_exhausted &&
+      this->task_allocated_bytes > this->config.task_allocation_budget) {
+    this->task_budget_exhausted = true;
+    this->request_out_of_memory(kTaskBudgetExhausted);
+  }
+
+  if (this->allocation_sample_interval && --this->allocations_until_sample == 0) {
+    this->allocations_until_sample = this->allocation_sample_interval;
+    this->pending_sample_cell = cell;
+    this->pending_sample_address = this->host_vm->ip;
+    this->pending_sample_function = kNull;
+
+    // Allocations made by native functions are attributed to the instruction which called them
+    Frame* frame = this->host_vm->frames;
+    if (frame) {
+      VALUE caller = frame->caller_value;
+      if (charly_is_function(caller) && !charly_as_function(caller)->anonymous()) {
+        this->pending_sample_function = charly_as_function(caller)->name;
+      } else if (charly_is_generator(caller)) {
+        this->pending_sample_function = charly_as_generator(caller)->name;
       }
     }
   }
 
-  this->remaining_free_cells--;
   return cell;
 }
 
 void GarbageCollector::deallocate(MemoryCell* cell) {
-  std::unique_lock<std::recursive_mutex>(this->g_mutex);
+  std::unique_lock<std::recursive_mutex> g_lock(this->g_mutex);
+
+  if (cell == this->pending_sample_cell) {
+    this->record_pending_allocation_sample();
+  }
+  CellSizeClass size_class = cell_size_class_of_type(cell->basic.type);
 
   // Run the type specific cleanup function
   switch (charly_as_basic(charly_create_pointer(cell))->type) {
@@ -332,6 +1077,10 @@ void GarbageCollector::deallocate(MemoryCell* cell) {
 
     case kTypeClass: {
       cell->klass.clean();
+
+      // Inline caches are keyed on class addresses, which could be
+      // handed out again after this cell was freed
+      this->host_vm->invalidate_inline_caches();
       break;
     }
 
@@ -349,11 +1098,218 @@ void GarbageCollector::deallocate(MemoryCell* cell) {
   }
 
   // Clear the cell and link it into the freelist
-  memset(reinterpret_cast<void*>(cell), 0, sizeof(MemoryCell));
+  memset(reinterpret_cast<void*>(cell), 0, kCellSizes[size_class]);
   cell->free.basic.type = kTypeDead;
-  cell->free.next = this->free_cell;
-  this->free_cell = cell;
-  this->remaining_free_cells++;
+  cell->free.next = this->free_cell[size_class];
+  this->free_cell[size_class] = cell;
+  this->remaining_free_cells[size_class]++;
+}
+
+// Approximate amount of memory used by containers stored outside of a cell
+static size_t container_size(const ValueMap* container) {
+  if (!container) return 0;
+  return sizeof(*container) + container->capacity() * (sizeof(ValueMap::value_type) + 1);
+}
+
+template <typename T>
+static size_t container_size(const std::vector<T>* container) {
+  if (!container) return 0;
+  return sizeof(*container) + container->capacity() * sizeof(T);
+}
+
+static size_t container_size(const OperandStack* container) {
+  if (!container) return 0;
+  return sizeof(*container) + container->capacity() * sizeof(VALUE);
+}
+
+// Returns the amount of memory a cell occupies, including its out-of-line storage
+static size_t cell_snapshot_size(MemoryCell* cell) {
+  size_t size = kCellSizes[cell_size_class_of_type(cell->basic.type)];
+
+  switch (cell->basic.type) {
+    case kTypeObject: {
+      size += container_size(cell->object.overflow_slots);
+      size += container_size(cell->object.container);
+      break;
+    }
+    case kTypeArray: {
+      size += container_size(cell->array.data);
+      break;
+    }
+    case kTypeString: {
+      if (!cell->string.basic.f1) {
+        size += cell->string.lbuf.length;
+      }
+      break;
+    }
+    case kTypeFunction: {
+      size += container_size(cell->function.container);
+      break;
+    }
+    case kTypeCFunction: {
+      size += container_size(cell->cfunction.container);
+      break;
+    }
+    case kTypeGenerator: {
+      size += container_size(cell->generator.context_stack);
+      size += container_size(cell->generator.container);
+      break;
+    }
+    case kTypeClass: {
+      size += container_size(cell->klass.member_properties);
+      size += container_size(cell->klass.container);
+      break;
+    }
+    case kTypeFrame: {
+      Frame* frame = &cell->frame;
+      if (frame->stack_allocated) {
+        // Frames on the frame stack store their locals directly behind the frame
+        size = sizeof(Frame) + frame->lvarcount() * sizeof(VALUE);
+      } else if (!frame->is_smallframe()) {
+        size += container_size(frame->lenv);
+      }
+      break;
+    }
+  }
+
+  return size;
+}
+
+void GarbageCollector::record_pending_allocation_sample() {
+  MemoryCell* cell = this->pending_sample_cell;
+  this->pending_sample_cell = nullptr;
+
+  AllocationSite& site = this->allocation_sites[{this->pending_sample_address, cell->basic.type}];
+  if (charly_is_null(site.function_name)) {
+    site.function_name = this->pending_sample_function;
+  }
+  site.count += this->allocation_sample_interval;
+  site.bytes += cell_snapshot_size(cell) * this->allocation_sample_interval;
+}
+
+void GarbageCollector::set_allocation_sample_interval(uint32_t interval) {
+  std::unique_lock<std::recursive_mutex> g_lock(this->g_mutex);
+  if (this->pending_sample_cell) {
+    this->record_pending_allocation_sample();
+  }
+
+  this->allocation_sample_interval = interval;
+  this->allocations_until_sample = interval;
+}
+
+std::vector<AllocationSiteReport> GarbageCollector::allocation_profile() {
+  std::unique_lock<std::recursive_mutex> g_lock(this->g_mutex);
+  if (this->pending_sample_cell) {
+    this->record_pending_allocation_sample();
+  }
+
+  std::vector<AllocationSiteReport> report;
+  for (auto& [key, site] : this->allocation_sites) {
+    std::string function = this->host_vm->context.symtable(site.function_name).value_or("<anonymous>");
+    std::string location = "<native>";
+    auto position =
+        key.address ? this->host_vm->context.compiler_manager.address_mapping.resolve_position(key.address) : std::nullopt;
+    if (position.has_value()) {
+      auto& [path, source_position] = position.value();
+      location = path + ":" + std::to_string(source_position.line) + ":" + std::to_string(source_position.column);
+    }
+
+    report.push_back({kHumanReadableTypes[key.type], function, location, site.count, site.bytes});
+  }
+
+  std::sort(report.begin(), report.end(),
+            [](const AllocationSiteReport& l, const AllocationSiteReport& r) { return l.bytes > r.bytes; });
+  return report;
+}
+
+void GarbageCollector::write_allocation_profile(std::ostream& out, uint32_t count) {
+  std::vector<AllocationSiteReport> report = this->allocation_profile();
+
+  out << "Allocation Sites:" << '\n';
+  out << std::setw(14) << "bytes" << std::setw(12) << "count" << std::setw(12) << "type" << "  function, location" << '\n';
+  for (size_t i = 0; i < report.size() && i < count; i++) {
+    const AllocationSiteReport& site = report[i];
+    out << std::setw(14) << site.bytes << std::setw(12) << site.count << std::setw(12) << site.type;
+    out << "  " << site.function << ", " << site.location << '\n';
+  }
+}
+
+size_t GarbageCollector::write_heap_snapshot(std::ostream& out) {
+  std::unique_lock<std::recursive_mutex> g_lock(this->g_mutex);
+  PauseScope pause(*this);
+
+  // The snapshot uses its own visited set, so it can be taken at any
+  // point of an ongoing incremental collection without disturbing it
+  std::unordered_set<MemoryCell*> visited;
+  std::vector<MemoryCell*> worklist;
+  auto as_cell = [](VALUE value) -> MemoryCell* {
+    if (!charly_is_ptr(value)) return nullptr;
+    return charly_as_pointer_to<MemoryCell>(value);
+  };
+  auto visit = [&](MemoryCell* cell) {
+    if (cell && visited.insert(cell).second) {
+      worklist.push_back(cell);
+    }
+  };
+
+  out << "charly-heap-snapshot 1" << '\n';
+
+  std::unordered_set<MemoryCell*> roots;
+  this->each_root([&](VALUE value) {
+    MemoryCell* cell = as_cell(value);
+    if (cell && roots.insert(cell).second) {
+      out << "root " << cell << '\n';
+      visit(cell);
+    }
+  });
+
+  size_t cell_count = 0;
+  size_t total_size = 0;
+  while (worklist.size()) {
+    MemoryCell* cell = worklist.back();
+    worklist.pop_back();
+
+    size_t size = cell_snapshot_size(cell);
+    cell_count++;
+    total_size += size;
+
+    out << "cell " << cell << ' ' << kHumanReadableTypes[cell->basic.type] << ' ' << size;
+    this->each_child(cell, [&](VALUE value) {
+      MemoryCell* child = as_cell(value);
+      if (child) {
+        out << ' ' << child;
+        visit(child);
+      }
+    });
+    out << '\n';
+  }
+
+  out << "end " << cell_count << ' ' << total_size << '\n';
+  return cell_count;
+}
+
+std::atomic<bool> GarbageCollector::snapshot_requested = false;
+
+void GarbageCollector::request_heap_snapshot() {
+  GarbageCollector::snapshot_requested.store(true, std::memory_order_relaxed);
+}
+
+void GarbageCollector::write_requested_heap_snapshot() {
+  if (!GarbageCollector::snapshot_requested.exchange(false)) {
+    return;
+  }
+
+  static std::atomic<uint32_t> snapshot_index = 0;
+  std::string filename =
+      "charly-" + std::to_string(getpid()) + "-" + std::to_string(snapshot_index++) + ".heapsnapshot";
+  std::ofstream file(filename);
+  if (!file.is_open()) {
+    this->config.err_stream << "Could not open heap snapshot file " << filename << '\n';
+    return;
+  }
+
+  this->write_heap_snapshot(file);
+  this->config.err_stream << "Wrote heap snapshot to " << filename << '\n';
 }
 
 void GarbageCollector::lock() {
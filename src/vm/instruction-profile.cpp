@@ -0,0 +1,141 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <algorithm>
+#include <iomanip>
+#include <numeric>
+#include <thread>
+
+#include "instruction-profile.h"
+
+namespace Charly {
+
+void VMInstructionProfile::enable(bool track_sites) {
+  this->pairs.assign(kOpcodeCount * kOpcodeCount, 0);
+  this->track_sites = track_sites;
+
+#if defined(__aarch64__)
+  uint64_t frequency;
+  asm volatile("mrs %0, cntfrq_el0" : "=r"(frequency));
+  this->ticks_per_nanosecond = static_cast<double>(frequency) / 1e9;
+#elif defined(__x86_64__) || defined(__i386__)
+  // The tsc frequency isn't exposed to user space, so it is measured against the steady clock
+  auto clock_start = std::chrono::steady_clock::now();
+  uint64_t ticks_start = read_cycle_counter();
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  uint64_t ticks = read_cycle_counter() - ticks_start;
+  std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - clock_start;
+  this->ticks_per_nanosecond = static_cast<double>(ticks) / elapsed.count();
+#endif
+
+  // The smallest observed difference between two back-to-back reads is what every sample pays for the timer itself
+  uint64_t overhead = UINT64_MAX;
+  for (int i = 0; i < 1000; i++) {
+    uint64_t start = read_cycle_counter();
+    overhead = std::min(overhead, read_cycle_counter() - start);
+  }
+  this->overhead_ticks = overhead;
+}
+
+double VMInstructionProfile::average_nanoseconds(Opcode opcode) const {
+  const VMInstructionProfileEntry& entry = this->entries[opcode];
+  if (entry.encountered == 0)
+    return 0;
+  return this->ticks_to_nanoseconds(this->corrected_ticks(entry)) / entry.encountered;
+}
+
+void VMInstructionProfile::dump(std::ostream& out, InstructionProfileOrder order, uint32_t pair_count) const {
+  std::vector<uint32_t> opcodes;
+  uint64_t total_count = 0;
+  uint64_t total_ticks = 0;
+  for (uint32_t opcode = 0; opcode < kOpcodeCount; opcode++) {
+    const VMInstructionProfileEntry& entry = this->entries[opcode];
+    if (entry.encountered == 0)
+      continue;
+    opcodes.push_back(opcode);
+    total_count += entry.encountered;
+    total_ticks += this->corrected_ticks(entry);
+  }
+
+  std::stable_sort(opcodes.begin(), opcodes.end(), [&](uint32_t left, uint32_t right) {
+    const VMInstructionProfileEntry& l = this->entries[left];
+    const VMInstructionProfileEntry& r = this->entries[right];
+    switch (order) {
+      case InstructionProfileOrder::TotalTime: return this->corrected_ticks(l) > this->corrected_ticks(r);
+      case InstructionProfileOrder::Count: return l.encountered > r.encountered;
+      case InstructionProfileOrder::AverageTime:
+        return this->average_nanoseconds(static_cast<Opcode>(left)) >
+               this->average_nanoseconds(static_cast<Opcode>(right));
+    }
+    return false;
+  });
+
+  auto percentage = [](uint64_t part, uint64_t total) { return total ? 100.0 * part / total : 0.0; };
+  std::ios_base::fmtflags previous_flags = out.flags();
+  std::streamsize previous_precision = out.precision();
+
+  out << "Instruction Profile:" << '\n';
+  out << "  " << std::fixed << std::setprecision(3) << this->ticks_per_nanosecond << " ticks per nanosecond, ";
+  out << this->overhead_ticks << " ticks of timer overhead subtracted per sample" << '\n';
+  out << std::setw(26) << "opcode" << std::setw(14) << "count" << std::setw(9) << "count%";
+  out << std::setw(14) << "total ms" << std::setw(9) << "time%" << std::setw(12) << "avg ns" << '\n';
+  for (uint32_t opcode : opcodes) {
+    const VMInstructionProfileEntry& entry = this->entries[opcode];
+    uint64_t ticks = this->corrected_ticks(entry);
+    out << std::setw(26) << kOpcodeMnemonics[opcode];
+    out << std::setw(14) << entry.encountered;
+    out << std::setprecision(2) << std::setw(9) << percentage(entry.encountered, total_count);
+    out << std::setprecision(3) << std::setw(14) << this->ticks_to_nanoseconds(ticks) / 1e6;
+    out << std::setprecision(2) << std::setw(9) << percentage(ticks, total_ticks);
+    out << std::setprecision(1) << std::setw(12) << this->average_nanoseconds(static_cast<Opcode>(opcode)) << '\n';
+  }
+
+  // The most frequent pairs are the candidates for superinstructions
+  std::vector<uint32_t> pair_indices(this->pairs.size());
+  std::iota(pair_indices.begin(), pair_indices.end(), 0);
+  pair_indices.erase(std::remove_if(pair_indices.begin(), pair_indices.end(),
+                                    [&](uint32_t index) { return this->pairs[index] == 0; }),
+                     pair_indices.end());
+  uint32_t shown = std::min(pair_count, static_cast<uint32_t>(pair_indices.size()));
+  std::partial_sort(pair_indices.begin(), pair_indices.begin() + shown, pair_indices.end(),
+                    [&](uint32_t left, uint32_t right) { return this->pairs[left] > this->pairs[right]; });
+
+  uint64_t total_pairs = std::accumulate(this->pairs.begin(), this->pairs.end(), uint64_t{0});
+  if (shown > 0) {
+    out << "Most frequent instruction pairs:" << '\n';
+  }
+  for (uint32_t i = 0; i < shown; i++) {
+    uint32_t index = pair_indices[i];
+    out << std::setw(26) << kOpcodeMnemonics[index / kOpcodeCount] << " -> ";
+    out << std::left << std::setw(26) << kOpcodeMnemonics[index % kOpcodeCount] << std::right;
+    out << std::setw(14) << this->pairs[index];
+    out << std::setprecision(2) << std::setw(9) << percentage(this->pairs[index], total_pairs) << '\n';
+  }
+
+  out.flags(previous_flags);
+  out.precision(previous_precision);
+}
+}  // namespace Charly
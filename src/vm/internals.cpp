@@ -24,6 +24,7 @@
  * SOFTWARE.
  */
 
+#include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <sstream>
@@ -38,7 +39,13 @@
 #include "libs/math/math.h"
 #include "libs/time/time.h"
 #include "libs/buffer/buffer.h"
+#include "libs/fs/fs.h"
+#include "libs/isolate/isolate.h"
+#include "libs/json/json.h"
+#include "libs/net/net.h"
+#include "libs/typedarray/typedarray.h"
 #include "libs/primitives/array.h"
+#include "libs/primitives/number.h"
 #include "libs/primitives/string.h"
 
 using namespace std;
@@ -52,18 +59,33 @@ namespace Internals {
       ID_TO_STRING(N), C, reinterpret_cast<void*>(Internals::N) \
     }                                                               \
   }
+#define DEFINE_NATIVE_METHOD(N)                                                         \
+  {                                                                                     \
+    ID_TO_STRING(N), {                                                                  \
+      ID_TO_STRING(N), NativeBinding<Internals::N>::kArgc, reinterpret_cast<void*>(Internals::N), \
+          NativeBinding<Internals::N>::thunk                                            \
+    }                                                                                   \
+  }
 static std::unordered_map<std::string, InternalMethodSignature> kMethodSignatures = {
 
 // Libs
 #import "libs/primitives/array.def"
+#import "libs/primitives/number.def"
 #import "libs/primitives/string.def"
 #import "libs/math/math.def"
 #import "libs/time/time.def"
 #import "libs/buffer/buffer.def"
+#import "libs/fs/fs.def"
+#import "libs/isolate/isolate.def"
+#import "libs/json/json.def"
+#import "libs/net/net.def"
+#import "libs/typedarray/typedarray.def"
 
     // VM Barebones
     DEFINE_INTERNAL_METHOD(import, 2),
+    DEFINE_INTERNAL_METHOD(lazy_import, 3),
     DEFINE_INTERNAL_METHOD(write, 1),
+    DEFINE_INTERNAL_METHOD(flush, 0),
     DEFINE_INTERNAL_METHOD(getn, 0),
     DEFINE_INTERNAL_METHOD(dirname, 0),
 
@@ -78,6 +100,8 @@ static std::unordered_map<std::string, InternalMethodSignature> kMethodSignature
     DEFINE_INTERNAL_METHOD(set_primitive_boolean, 1),
     DEFINE_INTERNAL_METHOD(set_primitive_null, 1),
     DEFINE_INTERNAL_METHOD(to_s, 1),
+    DEFINE_INTERNAL_METHOD(copy, 1),
+    DEFINE_INTERNAL_METHOD(deep_copy, 1),
 
     DEFINE_INTERNAL_METHOD(defer, 2),
     DEFINE_INTERNAL_METHOD(defer_interval, 2),
@@ -86,57 +110,69 @@ static std::unordered_map<std::string, InternalMethodSignature> kMethodSignature
     DEFINE_INTERNAL_METHOD(exit, 1),
 
     DEFINE_INTERNAL_METHOD(register_worker_task, 2),
-};
 
-VALUE import(VM& vm, VALUE include, VALUE source) {
-  // TODO: Deallocate stuff on error
+    DEFINE_INTERNAL_METHOD(gc_stats, 0),
+    DEFINE_INTERNAL_METHOD(gc_write_heap_snapshot, 1),
+    DEFINE_INTERNAL_METHOD(gc_profile_allocations, 1),
+    DEFINE_INTERNAL_METHOD(gc_allocation_sites, 0),
 
-  CHECK(string, include);
-  CHECK(string, source);
+    DEFINE_INTERNAL_METHOD(runtime_metrics, 0),
 
-  std::string include_filename = charly_string_std(include);
-  std::string source_filename = charly_string_std(source);
+    DEFINE_INTERNAL_METHOD(profiler_start, 1),
+    DEFINE_INTERNAL_METHOD(profiler_stop, 0),
+    DEFINE_INTERNAL_METHOD(profiler_report, 0),
+    DEFINE_INTERNAL_METHOD(profiler_write, 1),
+};
+
+std::optional<std::string> resolve_import_path(const std::string& include, const std::string& source_filename) {
+  std::string include_filename = include;
 
   // Check if we are importing a standard charly library
-  bool import_library = false;
   if (kStandardCharlyLibraries.find(include_filename) != kStandardCharlyLibraries.end()) {
-    include_filename = std::string(std::getenv("CHARLYVMDIR")) + "/" + kStandardCharlyLibraries.at(include_filename);
-    import_library = true;
+    char* stdlibpath = std::getenv("CHARLYVMDIR");
+    if (stdlibpath == nullptr) {
+      return std::nullopt;
+    }
+
+    include_filename = std::string(stdlibpath) + "/" + kStandardCharlyLibraries.at(include_filename);
+  } else {
+
+    // Importing the same file
+    if (include_filename == "." || include_filename.size() == 0) {
+      return std::nullopt;
+    }
+
+    // Absolute paths are left untouched, everything else is relative to the importing file
+    // FIXME: Make sure we catch all edge cases
+    if (include_filename[0] != '/') {
+      size_t separator = source_filename.rfind('/');
+      std::string source_folder = separator == std::string::npos ? "." : source_filename.substr(0, separator);
+      include_filename = source_folder + "/" + include_filename;
+    }
   }
 
-  // Delete the filename of the source file
-  std::string source_folder(source_filename);
-  source_folder.erase(source_filename.rfind('/'));
+  // Different spellings of the same path should refer to the same module
+  std::error_code error;
+  std::filesystem::path canonical_path = std::filesystem::weakly_canonical(include_filename, error);
+  if (!error) {
+    include_filename = canonical_path.string();
+  }
 
-  // Resolve the input file path
-  if (!import_library) {
+  return include_filename;
+}
 
-    // Importing the same file
-    if (include_filename == ".") {
-      vm.throw_exception("import: could not open '.'");
-      return kNull;
-    } else {
-      // Other include strategies
-      switch (include_filename[0]) {
-
-        // Absolute paths
-        case '/': {
-          // Do nothing to the filepath
-          break;
-        }
+VALUE import(VM& vm, VALUE include, VALUE source) {
+  // TODO: Deallocate stuff on error
 
-        // Relative paths
-        case '.': {
-          include_filename = source_folder + "/" + include_filename;
-          break;
-        }
+  CHECK(string, include);
+  CHECK(string, source);
 
-        // Everything else
-        // FIXME: Make sure we catch all edge cases
-        default: { include_filename = source_folder + "/" + include_filename; }
-      }
-    }
+  std::optional<std::string> resolved_path = resolve_import_path(charly_string_std(include), charly_string_std(source));
+  if (!resolved_path) {
+    vm.throw_exception("import: could not open '" + charly_string_std(include) + "'");
+    return kNull;
   }
+  std::string include_filename = resolved_path.value();
 
   // Check if this is a compiled charly library
   // In this case we return an object with all the methods
@@ -189,17 +225,21 @@ VALUE import(VM& vm, VALUE include, VALUE source) {
       while (i < signatures->signatures.size()) {
         std::string name;
         uint32_t argc;
-        std::tie(name, argc) = signatures->signatures[i];
+        CFunctionThunk thunk;
+        std::tie(name, argc, thunk) = signatures->signatures[i];
 
         // While we are extracting the method names, we can create
         // CFunction objects for the vm
+        //
+        // Typed functions are only reachable via their thunk, since their symbols aren't exported
         CFunction* cfunc = charly_as_cfunction(lalloc.create_cfunction(
           charly_create_symbol(name),
           argc,
-          dlsym(clib, name.c_str())
+          thunk ? nullptr : dlsym(clib, name.c_str()),
+          thunk
         ));
 
-        lib->container->insert({vm.context.symtable(name), charly_create_pointer(cfunc)});
+        lib->write(vm.context.symtable(name), charly_create_pointer(cfunc));
 
         i++;
       }
@@ -215,21 +255,20 @@ VALUE import(VM& vm, VALUE include, VALUE source) {
 
         dlclose(clib);
       };
-      lib->container->insert({
-        vm.context.symtable("__libptr"),
-        lalloc.create_cpointer(clib, reinterpret_cast<void*>(destructor))
-      });
+      lib->write(vm.context.symtable("__libptr"), lalloc.create_cpointer(clib, reinterpret_cast<void*>(destructor)));
 
       // Insert the path of the library into the object
-      lib->container->insert({
-        vm.context.symtable("__libpath"),
-        lalloc.create_string(include_filename)
-      });
+      lib->write(vm.context.symtable("__libpath"), lalloc.create_string(include_filename));
 
       return charly_create_pointer(lib);
     }
   }
 
+  // Modules which were already imported return the value of their first import
+  if (auto exports = vm.find_imported_module(include_filename)) {
+    return exports.value();
+  }
+
   std::ifstream inputfile(include_filename);
   if (!inputfile.is_open()) {
     vm.throw_exception("import: could not open " + include_filename);
@@ -245,7 +284,18 @@ VALUE import(VM& vm, VALUE include, VALUE source) {
   }
 
   Function* fn = charly_as_function(vm.register_module(cresult->instructionblock.value()));
-  return vm.exec_module(fn);
+  VALUE exports = vm.exec_module(fn);
+  vm.register_imported_module(include_filename, exports);
+  return exports;
+}
+
+VALUE lazy_import(VM& vm, VALUE object, VALUE name, VALUE include) {
+  CHECK(object, object);
+  CHECK(string, name);
+  CHECK(string, include);
+
+  vm.register_lazy_member(charly_as_object(object), charly_create_symbol(name), charly_string_std(include));
+  return kNull;
 }
 
 VALUE get_method(VM& vm, VALUE argument) {
@@ -260,19 +310,32 @@ VALUE get_method(VM& vm, VALUE argument) {
 
   if (kMethodSignatures.count(methodname) > 0) {
     auto& sig = kMethodSignatures[methodname];
-    return vm.create_cfunction(vm.context.symtable(sig.name), sig.argc, sig.func_pointer);
+    return vm.create_cfunction(vm.context.symtable(sig.name), sig.argc, sig.func_pointer, sig.thunk);
   }
 
   return kNull;
 }
 
+void native_argument_error(VM& vm, uint32_t index, const char* expected) {
+  vm.throw_exception("Expected argument " + std::to_string(index + 1) + " to be " + expected);
+}
+
 VALUE write(VM& vm, VALUE value) {
-  vm.to_s(vm.context.out_stream, value);
+  vm.write_output(value);
+
+  return kNull;
+}
+
+VALUE flush(VM& vm) {
+  vm.flush_output();
 
   return kNull;
 }
 
 VALUE getn(VM& vm) {
+  // Prompts written before the read have to be visible
+  vm.flush_output();
+
   double num;
   vm.context.in_stream >> num;
   return charly_create_number(num);
@@ -383,18 +446,154 @@ VALUE exit(VM& vm, VALUE status_code) {
 }
 
 VALUE to_s(VM& vm, VALUE value) {
-  std::stringstream buffer;
-  vm.to_s(buffer, value);
-  return vm.create_string(buffer.str());
+  return vm.to_string(value);
+}
+
+VALUE copy(VM& vm, VALUE value) {
+  return vm.copy_value(value);
+}
+
+VALUE deep_copy(VM& vm, VALUE value) {
+  return vm.deep_copy_value(value);
 }
 
 VALUE register_worker_task(VM& vm, VALUE v, VALUE cb) {
   CHECK(function, cb);
-  AsyncTask task = {AsyncTaskType::fs_access, {}, cb};
-  task.arguments.push_back(v);
+  AsyncTask task = {.type = AsyncTaskType::echo, .arguments = {v}, .cb = cb};
   vm.register_worker_task(task);
   return kNull;
 }
 
+VALUE gc_stats(VM& vm) {
+  ManagedContext lalloc(vm);
+  const GarbageCollectorStats& stats = vm.gc_stats();
+
+  Array* histogram = charly_as_array(lalloc.create_array(PauseHistogram::kBucketCount));
+  for (uint64_t count : stats.pause_histogram.buckets) {
+    histogram->data->push_back(charly_create_number(count));
+  }
+
+  Object* obj = charly_as_object(lalloc.create_object(20));
+  auto write = [&](const char* key, VALUE value) { obj->write(vm.context.symtable(key), value); };
+  write("minor_collections", charly_create_number(stats.minor_collections));
+  write("full_collections", charly_create_number(stats.full_collections));
+  write("mark_steps", charly_create_number(stats.mark_steps));
+  write("sweep_steps", charly_create_number(stats.sweep_steps));
+  write("pause_count", charly_create_number(stats.pause_count));
+  write("total_pause_time", charly_create_number(stats.total_pause_time));
+  write("max_pause_time", charly_create_number(stats.max_pause_time));
+  write("pause_histogram", charly_create_pointer(histogram));
+  write("allocated_cells", charly_create_number(stats.allocated_cells));
+  write("allocated_bytes", charly_create_number(stats.allocated_bytes));
+  write("allocation_rate", charly_create_number(stats.allocation_rate()));
+  write("freed_cells", charly_create_number(stats.freed_cells));
+  write("promoted_cells", charly_create_number(stats.promoted_cells));
+  write("live_cells", charly_create_number(stats.live_cells));
+  write("heap_count", charly_create_number(stats.heap_count));
+  write("heap_bytes", charly_create_number(stats.heap_bytes));
+  write("peak_heap_bytes", charly_create_number(stats.peak_heap_bytes));
+
+  return charly_create_pointer(obj);
+}
+
+VALUE gc_write_heap_snapshot(VM& vm, VALUE path) {
+  CHECK(string, path);
+
+  std::string filename = charly_string_std(path);
+  std::ofstream file(filename);
+  if (!file.is_open()) {
+    vm.throw_exception("gc_write_heap_snapshot: could not open " + filename);
+    return kNull;
+  }
+
+  return charly_create_number(static_cast<uint64_t>(vm.write_heap_snapshot(file)));
+}
+
+VALUE gc_profile_allocations(VM& vm, VALUE interval) {
+  CHECK(number, interval);
+  vm.set_allocation_sample_interval(charly_number_to_uint32(interval));
+  return kNull;
+}
+
+VALUE gc_allocation_sites(VM& vm) {
+  ManagedContext lalloc(vm);
+  std::vector<AllocationSiteReport> report = vm.allocation_profile();
+
+  Array* arr = charly_as_array(lalloc.create_array(report.size()));
+  for (const AllocationSiteReport& site : report) {
+    Object* obj = charly_as_object(lalloc.create_object(5));
+    obj->write(vm.context.symtable("type"), lalloc.create_string(site.type));
+    obj->write(vm.context.symtable("function"), lalloc.create_string(site.function));
+    obj->write(vm.context.symtable("location"), lalloc.create_string(site.location));
+    obj->write(vm.context.symtable("count"), charly_create_number(site.count));
+    obj->write(vm.context.symtable("bytes"), charly_create_number(site.bytes));
+    arr->data->push_back(charly_create_pointer(obj));
+  }
+
+  return charly_create_pointer(arr);
+}
+
+VALUE runtime_metrics(VM& vm) {
+  ManagedContext lalloc(vm);
+  RuntimeMetricsReport report = vm.runtime_metrics();
+
+  Object* obj = charly_as_object(lalloc.create_object(report.size()));
+  for (const auto& [name, value] : report) {
+    obj->write(vm.context.symtable(name), charly_create_number(value));
+  }
+
+  return charly_create_pointer(obj);
+}
+
+VALUE profiler_start(VM& vm, VALUE interval) {
+  std::chrono::microseconds sample_interval = kDefaultSampleInterval;
+  if (!charly_is_null(interval)) {
+    CHECK(number, interval);
+    if (charly_number_to_double(interval) < 1) {
+      vm.throw_exception("profiler_start: interval has to be at least one microsecond");
+      return kNull;
+    }
+    sample_interval = std::chrono::microseconds(charly_number_to_uint64(interval));
+  }
+
+  vm.profiler.start(sample_interval);
+  return kNull;
+}
+
+VALUE profiler_stop(VM& vm) {
+  vm.profiler.stop();
+  return charly_create_number(vm.profiler.sample_count());
+}
+
+VALUE profiler_report(VM& vm) {
+  ManagedContext lalloc(vm);
+  std::vector<ProfiledFunction> functions = vm.profiler.functions();
+
+  Array* arr = charly_as_array(lalloc.create_array(functions.size()));
+  for (const ProfiledFunction& function : functions) {
+    Object* obj = charly_as_object(lalloc.create_object(3));
+    obj->write(vm.context.symtable("name"), lalloc.create_string(function.name));
+    obj->write(vm.context.symtable("self"), charly_create_number(function.self_samples));
+    obj->write(vm.context.symtable("total"), charly_create_number(function.total_samples));
+    arr->data->push_back(charly_create_pointer(obj));
+  }
+
+  return charly_create_pointer(arr);
+}
+
+VALUE profiler_write(VM& vm, VALUE path) {
+  CHECK(string, path);
+
+  std::string filename = charly_string_std(path);
+  std::ofstream file(filename);
+  if (!file.is_open()) {
+    vm.throw_exception("profiler_write: could not open " + filename);
+    return kNull;
+  }
+
+  vm.profiler.write_collapsed(file);
+  return charly_create_number(vm.profiler.sample_count());
+}
+
 }  // namespace Internals
 }  // namespace Charly
@@ -0,0 +1,325 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <optional>
+#include <unordered_set>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "jit.h"
+#include "perf-map.h"
+
+namespace Charly {
+
+// Encodes the handful of x86-64 instructions the templates are made of
+//
+// Jumps to other instructions of the function are emitted with a placeholder
+// displacement, which is patched once the offsets of all instructions are known
+class CodeBuffer {
+public:
+  std::vector<uint8_t> bytes;
+
+  inline size_t offset() {
+    return this->bytes.size();
+  }
+
+  inline void emit(std::initializer_list<uint8_t> data) {
+    this->bytes.insert(this->bytes.end(), data);
+  }
+
+  inline void emit_imm64(uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+      this->bytes.push_back(value >> (i * 8));
+    }
+  }
+
+  // mov <reg>, imm64 for rax (0), rcx (1) and rsi (6)
+  inline void mov_imm64(uint8_t reg, uint64_t value) {
+    this->emit({0x48, static_cast<uint8_t>(0xb8 + reg)});
+    this->emit_imm64(value);
+  }
+
+  // Emits a jump with the condition code cc (0x84 je, 0x85 jne) or an unconditional jump if cc is 0
+  //
+  // Returns the offset of the displacement
+  inline size_t jump(uint8_t cc) {
+    if (cc) {
+      this->emit({0x0f, cc});
+    } else {
+      this->emit({0xe9});
+    }
+    size_t displacement = this->offset();
+    this->emit({0, 0, 0, 0});
+    return displacement;
+  }
+
+  inline void patch(size_t displacement, size_t target) {
+    int32_t relative = static_cast<int32_t>(target) - static_cast<int32_t>(displacement + 4);
+    std::memcpy(this->bytes.data() + displacement, &relative, sizeof(relative));
+  }
+};
+
+static constexpr uint8_t kRegRax = 0;
+static constexpr uint8_t kRegRcx = 1;
+static constexpr uint8_t kRegRsi = 6;
+static constexpr uint8_t kJumpEqual = 0x84;
+static constexpr uint8_t kJumpNotEqual = 0x85;
+static constexpr uint8_t kJumpAlways = 0;
+
+// Offset of the branch target of an instruction, relative to the instruction itself
+static std::optional<int32_t> branch_offset(uint8_t* ip) {
+  switch (static_cast<Opcode>(*ip)) {
+    case Opcode::Branch:
+    case Opcode::BranchIf:
+    case Opcode::BranchUnless:
+    case Opcode::BranchLt:
+    case Opcode::BranchGt:
+    case Opcode::BranchLe:
+    case Opcode::BranchGe:
+    case Opcode::BranchEq:
+    case Opcode::BranchNeq:
+    case Opcode::BranchLtNum:
+    case Opcode::BranchGtNum:
+    case Opcode::BranchLeNum:
+    case Opcode::BranchGeNum:
+    case Opcode::LoopIncrement: {
+      int32_t offset;
+      std::memcpy(&offset, ip + sizeof(Opcode), sizeof(offset));
+      return offset;
+    }
+    default: {
+      return std::nullopt;
+    }
+  }
+}
+
+// Returns true if execution can continue at the instruction following ip
+static bool has_fallthrough(uint8_t* ip) {
+  switch (static_cast<Opcode>(*ip)) {
+    case Opcode::Branch:
+    case Opcode::Return:
+    case Opcode::Throw:
+    case Opcode::Halt: return false;
+    default: return true;
+  }
+}
+
+JIT::JIT(const JITHelper* helpers, bool enabled, uint32_t threshold, bool perf_map)
+    : enabled(enabled && JIT::is_supported()), threshold(std::max(threshold, 1u)), perf_map(perf_map), helpers(helpers) {
+  if (!this->enabled) {
+    return;
+  }
+
+  // push rbx; mov rbx, rdi; jmp rsi
+  CodeBuffer buffer;
+  buffer.emit({0x53, 0x48, 0x89, 0xfb, 0xff, 0xe6});
+
+  void* code = this->map_code(buffer.bytes, this->trampoline_size);
+  if (code == nullptr) {
+    this->enabled = false;
+    return;
+  }
+
+  this->trampoline = reinterpret_cast<void (*)(VM*, void*)>(code);
+}
+
+JIT::~JIT() {
+  for (const CompiledFunction& function : this->functions) {
+    munmap(function.code, function.mapping_size);
+  }
+
+  if (this->trampoline) {
+    munmap(reinterpret_cast<void*>(this->trampoline), this->trampoline_size);
+  }
+}
+
+bool JIT::is_supported() {
+#if defined(__x86_64__)
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool JIT::discover_instructions(uint8_t* entry, std::vector<uint8_t*>& instructions) {
+  std::unordered_set<uint8_t*> seen;
+  std::vector<uint8_t*> worklist = {entry};
+
+  while (worklist.size()) {
+    uint8_t* ip = worklist.back();
+    worklist.pop_back();
+
+    if (seen.count(ip)) {
+      continue;
+    }
+
+    if (*ip >= kOpcodeCount || seen.size() >= kMaxJITInstructions) {
+      return false;
+    }
+
+    seen.insert(ip);
+    instructions.push_back(ip);
+
+    if (auto offset = branch_offset(ip)) {
+      worklist.push_back(ip + offset.value());
+    }
+
+    if (has_fallthrough(ip)) {
+      worklist.push_back(ip + kInstructionLengths[*ip]);
+    }
+  }
+
+  std::sort(instructions.begin(), instructions.end());
+  return true;
+}
+
+void* JIT::map_code(const std::vector<uint8_t>& code, size_t& mapping_size) {
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  mapping_size = (code.size() + page_size - 1) / page_size * page_size;
+
+  void* memory = mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) {
+    return nullptr;
+  }
+
+  std::memcpy(memory, code.data(), code.size());
+  if (mprotect(memory, mapping_size, PROT_READ | PROT_EXEC) != 0) {
+    munmap(memory, mapping_size);
+    return nullptr;
+  }
+
+  return memory;
+}
+
+bool JIT::compile(uint8_t* entry, const std::string& name) {
+  if (!this->enabled || this->entries.count(entry)) {
+    return false;
+  }
+
+  std::vector<uint8_t*> instructions;
+  if (!this->discover_instructions(entry, instructions)) {
+    return false;
+  }
+
+  std::unordered_map<uint8_t*, size_t> index_of;
+  for (size_t i = 0; i < instructions.size(); i++) {
+    index_of[instructions[i]] = i;
+  }
+
+  CodeBuffer buffer;
+  std::vector<size_t> offsets(instructions.size());
+  std::vector<std::pair<size_t, size_t>> instruction_jumps;
+  std::vector<size_t> exit_jumps;
+
+  // Jumps to the target instruction if rax holds its address
+  auto emit_continuation = [&](uint8_t* target) {
+    auto it = index_of.find(target);
+    if (it == index_of.end() || this->helpers[*target] == nullptr) {
+      return;
+    }
+
+    buffer.mov_imm64(kRegRcx, reinterpret_cast<uint64_t>(target));
+    buffer.emit({0x48, 0x39, 0xc8});  // cmp rax, rcx
+    instruction_jumps.emplace_back(buffer.jump(kJumpEqual), it->second);
+  };
+
+  for (size_t i = 0; i < instructions.size(); i++) {
+    uint8_t* ip = instructions[i];
+    JITHelper helper = this->helpers[*ip];
+    offsets[i] = buffer.offset();
+
+    // Opcodes without a helper are left to the interpreter, instructions
+    // continuing at them simply return to it
+    if (helper == nullptr) {
+      continue;
+    }
+
+    buffer.emit({0x48, 0x89, 0xdf});  // mov rdi, rbx
+    buffer.mov_imm64(kRegRsi, reinterpret_cast<uint64_t>(ip));
+    buffer.mov_imm64(kRegRax, reinterpret_cast<uint64_t>(helper));
+    buffer.emit({0xff, 0xd0});  // call rax
+
+    if (auto offset = branch_offset(ip)) {
+      emit_continuation(ip + offset.value());
+    }
+
+    // Most instructions continue at the following one, which is usually emitted right after them
+    //
+    // Any other address, including null for a halted VM, is handled by the interpreter
+    uint8_t* next = ip + kInstructionLengths[*ip];
+    if (has_fallthrough(ip) && i + 1 < instructions.size() && instructions[i + 1] == next && this->helpers[*next]) {
+      buffer.mov_imm64(kRegRcx, reinterpret_cast<uint64_t>(next));
+      buffer.emit({0x48, 0x39, 0xc8});  // cmp rax, rcx
+      exit_jumps.push_back(buffer.jump(kJumpNotEqual));
+    } else {
+      if (has_fallthrough(ip)) {
+        emit_continuation(next);
+      }
+      exit_jumps.push_back(buffer.jump(kJumpAlways));
+    }
+  }
+
+  // Shared exit, restores the register saved by the trampoline and returns to the interpreter
+  size_t exit_offset = buffer.offset();
+  buffer.emit({0x5b, 0xc3});  // pop rbx; ret
+
+  for (auto [displacement, index] : instruction_jumps) {
+    buffer.patch(displacement, offsets[index]);
+  }
+  for (size_t displacement : exit_jumps) {
+    buffer.patch(displacement, exit_offset);
+  }
+
+  size_t mapping_size = 0;
+  void* code = this->map_code(buffer.bytes, mapping_size);
+  if (code == nullptr) {
+    return false;
+  }
+
+  // Instructions without a helper never get an entry, the interpreter executes them
+  for (size_t i = 0; i < instructions.size(); i++) {
+    if (this->helpers[*instructions[i]]) {
+      this->entries.emplace(instructions[i], static_cast<uint8_t*>(code) + offsets[i]);
+    }
+  }
+
+  this->functions.push_back({name, entry, code, buffer.bytes.size(), mapping_size,
+                             static_cast<uint32_t>(instructions.size())});
+
+  if (this->perf_map) {
+    PerfMap::add_symbol(code, buffer.bytes.size(), "jit::" + name);
+  }
+
+  return true;
+}
+
+void JIT::execute(VM* vm, void* code) {
+  this->trampoline(vm, code);
+}
+}  // namespace Charly
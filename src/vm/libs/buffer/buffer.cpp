@@ -24,6 +24,17 @@
  * SOFTWARE.
  */
 
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <utf8/utf8.h>
 
 #include "buffer.h"
@@ -36,30 +47,206 @@ namespace Charly {
 namespace Internals {
 namespace Buffer {
 
+// Buffer id management
+//
+// Buffers are moved between isolates, so the list is shared by all of them
+static std::mutex buffer_list_m;
+static uint64_t next_buf_id = 0;
+static std::unordered_map<uint64_t, UTF8Buffer*> buffer_list;
+
 static void destructor(void* data) {
   uint64_t id = reinterpret_cast<uint64_t>(data);
+  std::unique_lock<std::mutex> lk(buffer_list_m);
   UTF8Buffer* buf = buffer_list[id];
   if (buf) {
     delete buf;
   };
+  buffer_list.erase(id);
+}
+
+// A file mapped into memory, unmapped once the last buffer or string referencing it is gone
+//
+// Writable mappings are private, changes are never written back to the file
+struct MappedFile : public SharedMemory {
+  MappedFile(uint8_t* data, size_t size, bool writable) : SharedMemory(data, size, writable) {
+  }
+  ~MappedFile() {
+    munmap(this->data, this->size);
+  }
+};
+
+// Checks that a range lies inside the written part of a buffer and converts its bounds
+//
+// Start and length have to be non-negative integers
+static bool check_range(VM& vm, UTF8Buffer* buffer, VALUE start, VALUE length, size_t& _start, size_t& _length) {
+  double start_value = charly_number_to_double(start);
+  double length_value = charly_number_to_double(length);
+  if (!(start_value >= 0 && length_value >= 0) || std::trunc(start_value) != start_value ||
+      std::trunc(length_value) != length_value) {
+    vm.throw_exception("Expected start and length to be non-negative integers");
+    return false;
+  }
+
+  // Compared without adding them, so huge values can't wrap around
+  double writeoffset = buffer->get_writeoffset();
+  if (start_value > writeoffset || length_value > writeoffset - start_value) {
+    vm.throw_exception("Range is out of bounds of the buffer");
+    return false;
+  }
+
+  _start = static_cast<size_t>(start_value);
+  _length = static_cast<size_t>(length_value);
+  return true;
+}
+
+// Continuation bytes are the second to fourth bytes of a UTF-8 encoded character
+static bool is_continuation_byte(UTF8Buffer* buffer, size_t offset) {
+  return offset < buffer->get_writeoffset() && (buffer->get_data()[offset] & 0xc0) == 0x80;
+}
+
+// Creates a string pointing into the memory of a buffer, short strings are copied
+static VALUE string_view(VM& vm, UTF8Buffer* buffer, size_t start, size_t length) {
+  if (length > static_cast<size_t>(kMaxStringLength)) {
+    vm.throw_exception("Range is too long to be viewed as a string");
+    return kNull;
+  }
+
+  char* data = reinterpret_cast<char*>(buffer->get_data() + start);
+  if (length <= kShortStringMaxSize) {
+    ManagedContext lalloc(vm);
+    return lalloc.create_string(data, length);
+  }
+
+  SharedMemory* memory = buffer->share();
+  VALUE string = vm.create_string_view(memory, data, length);
+  memory->release();
+  return string;
+}
+
+VALUE wrap(VM& vm, UTF8Buffer* buffer) {
+  uint64_t id;
+  {
+    std::unique_lock<std::mutex> lk(buffer_list_m);
+    id = next_buf_id++;
+    buffer_list[id] = buffer;
+  }
+
+  ManagedContext lalloc(vm);
+  return lalloc.create_cpointer(reinterpret_cast<void*>(id), reinterpret_cast<void*>(destructor));
+}
+
+UTF8Buffer* lookup(VALUE buf) {
+  if (!charly_is_cpointer(buf) || charly_as_cpointer(buf)->destructor != reinterpret_cast<void*>(destructor)) {
+    return nullptr;
+  }
+
+  std::unique_lock<std::mutex> lk(buffer_list_m);
+  auto it = buffer_list.find(reinterpret_cast<uint64_t>(charly_as_cpointer(buf)->data));
+  return it != buffer_list.end() ? it->second : nullptr;
+}
+
+UTF8Buffer* release(VALUE buf) {
+  if (!charly_is_cpointer(buf) || charly_as_cpointer(buf)->destructor != reinterpret_cast<void*>(destructor)) {
+    return nullptr;
+  }
+
+  std::unique_lock<std::mutex> lk(buffer_list_m);
+  auto it = buffer_list.find(reinterpret_cast<uint64_t>(charly_as_cpointer(buf)->data));
+  if (it == buffer_list.end()) {
+    return nullptr;
+  }
+
+  UTF8Buffer* buffer = it->second;
+  it->second = new UTF8Buffer();
+  return buffer;
 }
 
 VALUE create(VM& vm, VALUE size) {
   CHECK(number, size);
-  uint64_t id = next_buf_id++;
   UTF8Buffer* buf = new UTF8Buffer();
   buf->grow_to_fit(charly_number_to_uint32(size));
-  buffer_list[id] = buf;
+  return wrap(vm, buf);
+}
 
-  ManagedContext lalloc(vm);
-  return lalloc.create_cpointer(reinterpret_cast<void*>(id), reinterpret_cast<void*>(destructor));
+VALUE map(VM& vm, VALUE path, VALUE writable) {
+  CHECK(string, path);
+
+  std::string filename = charly_string_std(path);
+  int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    vm.throw_exception("Could not open " + filename + ": " + std::strerror(errno));
+    return kNull;
+  }
+
+  struct ::stat file_stat;
+  if (fstat(fd, &file_stat) != 0) {
+    int error = errno;
+    ::close(fd);
+    vm.throw_exception("Could not stat " + filename + ": " + std::strerror(error));
+    return kNull;
+  }
+
+  // Empty files cannot be mapped
+  size_t size = file_stat.st_size;
+  if (size == 0) {
+    ::close(fd);
+    return wrap(vm, new UTF8Buffer());
+  }
+
+  bool _writable = charly_truthyness(writable);
+  void* data = mmap(nullptr, size, PROT_READ | (_writable ? PROT_WRITE : 0), MAP_PRIVATE, fd, 0);
+  int error = errno;
+  ::close(fd);
+  if (data == MAP_FAILED) {
+    vm.throw_exception("Could not map " + filename + ": " + std::strerror(error));
+    return kNull;
+  }
+
+  uint8_t* bytes = static_cast<uint8_t*>(data);
+  return wrap(vm, new UTF8Buffer(new MappedFile(bytes, size, _writable), bytes, size));
+}
+
+VALUE slice(VM& vm, VALUE buf, VALUE start, VALUE length) {
+  CHECK(cpointer, buf);
+  CHECK(number, start);
+  CHECK(number, length);
+
+  UTF8Buffer* buffer = lookup(buf);
+  size_t _start;
+  size_t _length;
+  if (!buffer || !check_range(vm, buffer, start, length, _start, _length)) {
+    return kNull;
+  }
+
+  return wrap(vm, new UTF8Buffer(buffer->share(), buffer->get_data() + _start, _length));
+}
+
+VALUE view(VM& vm, VALUE buf, VALUE start, VALUE length) {
+  CHECK(cpointer, buf);
+  CHECK(number, start);
+  CHECK(number, length);
+
+  UTF8Buffer* buffer = lookup(buf);
+  size_t _start;
+  size_t _length;
+  if (!buffer || !check_range(vm, buffer, start, length, _start, _length)) {
+    return kNull;
+  }
+
+  // Strings have to contain complete characters
+  if (_length && (is_continuation_byte(buffer, _start) || is_continuation_byte(buffer, _start + _length))) {
+    vm.throw_exception("Range splits a UTF-8 encoded character");
+    return kNull;
+  }
+
+  return string_view(vm, buffer, _start, _length);
 }
 
 VALUE reserve(VM& vm, VALUE buf, VALUE size) {
   CHECK(cpointer, buf);
   CHECK(number, size);
 
-  UTF8Buffer* buffer = buffer_list[reinterpret_cast<uint64_t>(charly_as_cpointer(buf)->data)];
+  UTF8Buffer* buffer = lookup(buf);
   if (!buffer) {
     return kNull;
   }
@@ -72,7 +259,7 @@ VALUE reserve(VM& vm, VALUE buf, VALUE size) {
 VALUE get_size(VM& vm, VALUE buf) {
   CHECK(cpointer, buf);
 
-  UTF8Buffer* buffer = buffer_list[reinterpret_cast<uint64_t>(charly_as_cpointer(buf)->data)];
+  UTF8Buffer* buffer = lookup(buf);
   if (!buffer) {
     return kNull;
   }
@@ -83,7 +270,7 @@ VALUE get_size(VM& vm, VALUE buf) {
 VALUE get_offset(VM& vm, VALUE buf) {
   CHECK(cpointer, buf);
 
-  UTF8Buffer* buffer = buffer_list[reinterpret_cast<uint64_t>(charly_as_cpointer(buf)->data)];
+  UTF8Buffer* buffer = lookup(buf);
   if (!buffer) {
     return kNull;
   }
@@ -95,7 +282,7 @@ VALUE write(VM& vm, VALUE buf, VALUE src) {
   CHECK(cpointer, buf);
   CHECK(string, src);
 
-  UTF8Buffer* buffer = buffer_list[reinterpret_cast<uint64_t>(charly_as_cpointer(buf)->data)];
+  UTF8Buffer* buffer = lookup(buf);
   if (!buffer) {
     return kNull;
   }
@@ -113,7 +300,7 @@ VALUE write_partial(VM& vm, VALUE buf, VALUE src, VALUE off, VALUE cnt) {
   uint32_t _off = charly_number_to_uint32(off);
   uint32_t _cnt = charly_number_to_uint32(cnt);
 
-  UTF8Buffer* buffer = buffer_list[reinterpret_cast<uint64_t>(charly_as_cpointer(buf)->data)];
+  UTF8Buffer* buffer = lookup(buf);
   if (!buffer) {
     return kNull;
   }
@@ -147,12 +334,34 @@ VALUE write_partial(VM& vm, VALUE buf, VALUE src, VALUE off, VALUE cnt) {
   return charly_create_integer(buffer->get_writeoffset());
 }
 
+VALUE write_at(VM& vm, VALUE buf, VALUE off, VALUE src) {
+  CHECK(cpointer, buf);
+  CHECK(number, off);
+  CHECK(string, src);
+
+  UTF8Buffer* buffer = lookup(buf);
+  if (!buffer) {
+    return kNull;
+  }
+
+  uint64_t offset = charly_number_to_uint64(off);
+  if (offset > buffer->get_writeoffset()) {
+    vm.throw_exception("Offset is out of bounds of the buffer");
+    return kNull;
+  }
+
+  // Slices and strings viewing the old bytes keep seeing them
+  buffer->make_exclusive();
+  buffer->overwrite_block(offset, reinterpret_cast<uint8_t*>(charly_string_data(src)), charly_string_length(src));
+  return charly_create_integer(buffer->get_writeoffset());
+}
+
 VALUE write_bytes(VM&vm, VALUE buf, VALUE bytes) {
   CHECK(cpointer, buf);
   CHECK(array, bytes);
   CHECK(array_of<kTypeNumber>, bytes);
 
-  UTF8Buffer* buffer = buffer_list[reinterpret_cast<uint64_t>(charly_as_cpointer(buf)->data)];
+  UTF8Buffer* buffer = lookup(buf);
   if (!buffer) {
     return kNull;
   }
@@ -167,17 +376,70 @@ VALUE write_bytes(VM&vm, VALUE buf, VALUE bytes) {
 
 VALUE str(VM& vm, VALUE buf) {
   CHECK(cpointer, buf);
-  UTF8Buffer* buffer = buffer_list[reinterpret_cast<uint64_t>(charly_as_cpointer(buf)->data)];
+  UTF8Buffer* buffer = lookup(buf);
+  if (!buffer) {
+    return kNull;
+  }
+  return string_view(vm, buffer, 0, buffer->get_writeoffset());
+}
+
+VALUE clear(VM& vm, VALUE buf) {
+  CHECK(cpointer, buf);
+  UTF8Buffer* buffer = lookup(buf);
+  if (!buffer) {
+    return kNull;
+  }
+
+  buffer->clear();
+  return charly_create_integer(0);
+}
+
+VALUE split_lines(VM& vm, VALUE buf, VALUE carry) {
+  CHECK(cpointer, buf);
+  CHECK(string, carry);
+  UTF8Buffer* buffer = lookup(buf);
   if (!buffer) {
     return kNull;
   }
+
+  const char* data = buffer->get_const_data();
+  const char* end = data + buffer->get_writeoffset();
+
   ManagedContext lalloc(vm);
-  return lalloc.create_string(buffer->get_const_data(), buffer->get_writeoffset());
+  Array* lines = charly_as_array(lalloc.create_array(4));
+
+  // The carry only ever prefixes the first line
+  std::string prefix(charly_string_data(carry), charly_string_length(carry));
+  auto push_line = [&](const char* start, size_t length) {
+    if (prefix.size()) {
+      prefix.append(start, length);
+      lines->data->push_back(lalloc.create_string(prefix));
+      prefix.clear();
+    } else {
+      lines->data->push_back(lalloc.create_string(start, length));
+    }
+  };
+
+  const char* start = data;
+  while (const char* newline = static_cast<const char*>(std::memchr(start, '\n', end - start))) {
+    size_t length = newline - start;
+    if (length && newline[-1] == '\r') {
+      length--;
+    } else if (!length && prefix.size() && prefix.back() == '\r') {
+      prefix.pop_back();
+    }
+
+    push_line(start, length);
+    start = newline + 1;
+  }
+
+  push_line(start, end - start);
+  return charly_create_pointer(lines);
 }
 
 VALUE bytes(VM& vm, VALUE buf) {
   CHECK(cpointer, buf);
-  UTF8Buffer* buffer = buffer_list[reinterpret_cast<uint64_t>(charly_as_cpointer(buf)->data)];
+  UTF8Buffer* buffer = lookup(buf);
   if (!buffer) {
     return kNull;
   }
@@ -34,20 +34,59 @@ namespace Charly {
 namespace Internals {
 namespace Buffer {
 
-// Buffer id management
-static uint64_t next_buf_id = 0;
-static std::unordered_map<uint64_t, UTF8Buffer*> buffer_list;
+// Wraps a buffer allocated by native code into a value usable by the Buffer class
+//
+// The buffer is owned by the returned value from then on
+VALUE wrap(VM& vm, UTF8Buffer* buffer);
+
+// Returns the buffer referenced by a value created via create or wrap, or nullptr
+UTF8Buffer* lookup(VALUE buf);
+
+// Takes the storage of a buffer, the value is left with an empty buffer
+//
+// Used to move buffers into other isolates without copying them
+UTF8Buffer* release(VALUE buf);
 
 VALUE create(VM& vm, VALUE size);
+
+// Maps a file into memory instead of reading it
+//
+// Without writable, the buffer is read-only and writing to it copies its contents first.
+// Writable mappings are private, changes are never written back to the file
+VALUE map(VM& vm, VALUE path, VALUE writable);
+
+// Returns a buffer sharing the memory of a range of another buffer
+//
+// Appending to either buffer never changes the bytes the other one sees.
+// Ranges have to lie inside the written part of the buffer
+VALUE slice(VM& vm, VALUE buf, VALUE start, VALUE length);
+
+// Returns a string pointing into a range of a buffer, short strings are copied
+//
+// Throws if the range begins or ends inside a UTF-8 encoded character
+VALUE view(VM& vm, VALUE buf, VALUE start, VALUE length);
+
 VALUE reserve(VM& vm, VALUE buf, VALUE size);
 VALUE get_size(VM& vm, VALUE buf);
 VALUE get_offset(VM& vm, VALUE buf);
 VALUE write(VM& vm, VALUE buf, VALUE src);
 VALUE write_partial(VM& vm, VALUE buf, VALUE src, VALUE off, VALUE cnt);
 VALUE write_bytes(VM& vm, VALUE buf, VALUE bytes);
+
+// Overwrites the bytes at an offset, memory shared with slices or strings is copied first
+VALUE write_at(VM& vm, VALUE buf, VALUE off, VALUE src);
 VALUE str(VM& vm, VALUE buf);
 VALUE bytes(VM& vm, VALUE buf);
 
+// Empties a buffer so its memory can be reused for new data
+VALUE clear(VM& vm, VALUE buf);
+
+// Splits the contents of a buffer into lines, dropping line endings
+//
+// carry is prepended to the first line. The last element of the result is the
+// text following the last line break, which is carried over into the next chunk
+VALUE split_lines(VM& vm, VALUE buf, VALUE carry);
+
 }  // namespace Buffer
 }  // namespace Internals
 }  // namespace Charly
@@ -0,0 +1,461 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <initializer_list>
+
+#include "fs.h"
+#include "../buffer/buffer.h"
+
+#include "managedcontext.h"
+#include "vm.h"
+
+namespace Charly {
+namespace Internals {
+namespace FS {
+
+// Copies the string arguments out of the heap and hands the task to the worker threads
+static VALUE queue_task(VM& vm, AsyncTaskType type, std::initializer_list<VALUE> strings, VALUE cb) {
+  AsyncTask task = {.type = type, .cb = cb};
+  for (VALUE value : strings) {
+    task.string_arguments.push_back(charly_string_std(value));
+  }
+
+  vm.register_worker_task(task);
+  return kNull;
+}
+
+VALUE read_file(VM& vm, VALUE path, VALUE cb) {
+  CHECK(string, path);
+  CHECK(function, cb);
+  return queue_task(vm, AsyncTaskType::fs_readfile, {path}, cb);
+}
+
+VALUE write_file(VM& vm, VALUE path, VALUE data, VALUE cb) {
+  CHECK(string, path);
+  CHECK(string, data);
+  CHECK(function, cb);
+  return queue_task(vm, AsyncTaskType::fs_write_file, {path, data}, cb);
+}
+
+VALUE append_file(VM& vm, VALUE path, VALUE data, VALUE cb) {
+  CHECK(string, path);
+  CHECK(string, data);
+  CHECK(function, cb);
+  return queue_task(vm, AsyncTaskType::fs_append_file, {path, data}, cb);
+}
+
+VALUE exists(VM& vm, VALUE path, VALUE cb) {
+  CHECK(string, path);
+  CHECK(function, cb);
+  return queue_task(vm, AsyncTaskType::fs_exists, {path}, cb);
+}
+
+VALUE stat(VM& vm, VALUE path, VALUE cb) {
+  CHECK(string, path);
+  CHECK(function, cb);
+  return queue_task(vm, AsyncTaskType::fs_stat, {path}, cb);
+}
+
+VALUE readdir(VM& vm, VALUE path, VALUE cb) {
+  CHECK(string, path);
+  CHECK(function, cb);
+  return queue_task(vm, AsyncTaskType::fs_readdir, {path}, cb);
+}
+
+VALUE mkdir(VM& vm, VALUE path, VALUE cb) {
+  CHECK(string, path);
+  CHECK(function, cb);
+  return queue_task(vm, AsyncTaskType::fs_mkdir, {path}, cb);
+}
+
+VALUE rmdir(VM& vm, VALUE path, VALUE cb) {
+  CHECK(string, path);
+  CHECK(function, cb);
+  return queue_task(vm, AsyncTaskType::fs_rmdir, {path}, cb);
+}
+
+VALUE unlink(VM& vm, VALUE path, VALUE cb) {
+  CHECK(string, path);
+  CHECK(function, cb);
+  return queue_task(vm, AsyncTaskType::fs_unlink, {path}, cb);
+}
+
+VALUE rename(VM& vm, VALUE source, VALUE destination, VALUE cb) {
+  CHECK(string, source);
+  CHECK(string, destination);
+  CHECK(function, cb);
+  return queue_task(vm, AsyncTaskType::fs_rename, {source, destination}, cb);
+}
+
+VALUE copy_file(VM& vm, VALUE source, VALUE destination, VALUE cb) {
+  CHECK(string, source);
+  CHECK(string, destination);
+  CHECK(function, cb);
+  return queue_task(vm, AsyncTaskType::fs_copy_file, {source, destination}, cb);
+}
+
+VALUE realpath(VM& vm, VALUE path, VALUE cb) {
+  CHECK(string, path);
+  CHECK(function, cb);
+  return queue_task(vm, AsyncTaskType::fs_realpath, {path}, cb);
+}
+
+VALUE open(VM& vm, VALUE path, VALUE mode, VALUE cb) {
+  CHECK(string, path);
+  CHECK(string, mode);
+  CHECK(function, cb);
+  return queue_task(vm, AsyncTaskType::fs_open, {path, mode}, cb);
+}
+
+VALUE read(VM& vm, VALUE fd, VALUE buffer, VALUE size, VALUE cb) {
+  CHECK(number, fd);
+  CHECK(cpointer, buffer);
+  CHECK(number, size);
+  CHECK(function, cb);
+
+  AsyncTask task = {.type = AsyncTaskType::fs_read,
+                    .arguments = {buffer},
+                    .cb = cb,
+                    .fd = charly_number_to_int32(fd),
+                    .size = charly_number_to_uint64(size),
+                    .buffer = Buffer::lookup(buffer)};
+  if (!task.buffer) {
+    vm.throw_exception("Expected argument buffer to be a buffer");
+    return kNull;
+  }
+
+  vm.register_worker_task(task);
+  return kNull;
+}
+
+VALUE write(VM& vm, VALUE fd, VALUE data, VALUE cb) {
+  CHECK(number, fd);
+  CHECK(function, cb);
+
+  AsyncTask task = {.type = AsyncTaskType::fs_write, .cb = cb, .fd = charly_number_to_int32(fd)};
+
+  // Buffers are written without copying them
+  if (charly_is_string(data)) {
+    task.string_arguments.push_back(charly_string_std(data));
+  } else if (UTF8Buffer* buffer = Buffer::lookup(data)) {
+    task.arguments.push_back(data);
+    task.buffer = buffer;
+    task.size = buffer->get_writeoffset();
+  } else {
+    vm.throw_exception("Expected argument data to be a string or a buffer");
+    return kNull;
+  }
+
+  vm.register_worker_task(task);
+  return kNull;
+}
+
+VALUE close(VM& vm, VALUE fd, VALUE cb) {
+  CHECK(number, fd);
+  CHECK(function, cb);
+
+  AsyncTask task = {.type = AsyncTaskType::fs_close, .cb = cb, .fd = charly_number_to_int32(fd)};
+  vm.register_worker_task(task);
+  return kNull;
+}
+
+// Reads a whole file, returns an errno value
+static int read_whole_file(const std::string& path, std::string& data) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return errno;
+  }
+
+  struct ::stat file_stat;
+  if (fstat(fd, &file_stat) == 0 && file_stat.st_size > 0) {
+    data.reserve(file_stat.st_size);
+  }
+
+  char buffer[64 * 1024];
+  while (true) {
+    ssize_t count = ::read(fd, buffer, sizeof(buffer));
+    if (count < 0 && errno == EINTR) {
+      continue;
+    }
+
+    if (count < 0) {
+      int error = errno;
+      ::close(fd);
+      return error;
+    }
+
+    if (count == 0) {
+      break;
+    }
+
+    data.append(buffer, count);
+  }
+
+  ::close(fd);
+  return 0;
+}
+
+// Writes a whole block of memory to a file descriptor, returns an errno value
+static int write_all(int fd, const char* data, size_t size) {
+  size_t written = 0;
+  while (written < size) {
+    ssize_t count = ::write(fd, data + written, size - written);
+    if (count < 0 && errno == EINTR) {
+      continue;
+    }
+
+    if (count < 0) {
+      return errno;
+    }
+
+    written += count;
+  }
+
+  return 0;
+}
+
+// Writes a whole buffer to a file, returns an errno value
+static int write_whole_file(const std::string& path, const std::string& data, int flags) {
+  int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | flags, 0666);
+  if (fd < 0) {
+    return errno;
+  }
+
+  int error = write_all(fd, data.data(), data.size());
+  if (error) {
+    ::close(fd);
+    return error;
+  }
+
+  return ::close(fd) == 0 ? 0 : errno;
+}
+
+static int open_flags(const std::string& mode) {
+  if (mode == "w") {
+    return O_WRONLY | O_CREAT | O_TRUNC;
+  }
+  if (mode == "a") {
+    return O_WRONLY | O_CREAT | O_APPEND;
+  }
+  return O_RDONLY;
+}
+
+// Appends up to size bytes read from a file descriptor to a buffer, returns an errno value
+static int read_into(int fd, UTF8Buffer* buffer, size_t size, int64_t& count) {
+  uint8_t* tail = buffer->reserve_tail(size);
+  do {
+    count = ::read(fd, tail, size);
+  } while (count < 0 && errno == EINTR);
+
+  if (count < 0) {
+    return errno;
+  }
+
+  buffer->advance_writeoffset(count);
+  return 0;
+}
+
+static int read_directory(const std::string& path, std::vector<std::string>& entries) {
+  DIR* directory = opendir(path.c_str());
+  if (directory == nullptr) {
+    return errno;
+  }
+
+  while (struct dirent* entry = ::readdir(directory)) {
+    if (std::strcmp(entry->d_name, ".") != 0 && std::strcmp(entry->d_name, "..") != 0) {
+      entries.emplace_back(entry->d_name);
+    }
+  }
+
+  closedir(directory);
+  return 0;
+}
+
+void perform(AsyncTaskResult& result) {
+  const std::vector<std::string>& arguments = result.task.string_arguments;
+
+  auto check = [&](int status) {
+    result.error = status == 0 ? 0 : errno;
+  };
+
+  switch (result.task.type) {
+    case AsyncTaskType::fs_readfile: {
+      result.error = read_whole_file(arguments[0], result.data);
+      break;
+    }
+    case AsyncTaskType::fs_write_file: {
+      result.error = write_whole_file(arguments[0], arguments[1], O_TRUNC);
+      break;
+    }
+    case AsyncTaskType::fs_append_file: {
+      result.error = write_whole_file(arguments[0], arguments[1], O_APPEND);
+      break;
+    }
+    case AsyncTaskType::fs_exists: {
+      result.flag = ::access(arguments[0].c_str(), F_OK) == 0;
+      break;
+    }
+    case AsyncTaskType::fs_stat: {
+      struct ::stat file_stat;
+      check(::stat(arguments[0].c_str(), &file_stat));
+      result.size = file_stat.st_size;
+      result.mtime = static_cast<int64_t>(file_stat.st_mtime) * 1000;
+      result.flag = S_ISDIR(file_stat.st_mode);
+      break;
+    }
+    case AsyncTaskType::fs_readdir: {
+      result.error = read_directory(arguments[0], result.entries);
+      break;
+    }
+    case AsyncTaskType::fs_mkdir: {
+      check(::mkdir(arguments[0].c_str(), 0777));
+      break;
+    }
+    case AsyncTaskType::fs_rmdir: {
+      check(::rmdir(arguments[0].c_str()));
+      break;
+    }
+    case AsyncTaskType::fs_unlink: {
+      check(::unlink(arguments[0].c_str()));
+      break;
+    }
+    case AsyncTaskType::fs_rename: {
+      check(::rename(arguments[0].c_str(), arguments[1].c_str()));
+      break;
+    }
+    case AsyncTaskType::fs_copy_file: {
+      std::error_code error;
+      std::filesystem::copy_file(arguments[0], arguments[1], std::filesystem::copy_options::overwrite_existing, error);
+      result.error = error.value();
+      break;
+    }
+    case AsyncTaskType::fs_open: {
+      int fd = ::open(arguments[0].c_str(), open_flags(arguments[1]) | O_CLOEXEC, 0666);
+      result.error = fd < 0 ? errno : 0;
+      result.size = fd;
+      break;
+    }
+    case AsyncTaskType::fs_read: {
+      result.error = read_into(result.task.fd, result.task.buffer, result.task.size, result.size);
+      break;
+    }
+    case AsyncTaskType::fs_write: {
+      const AsyncTask& task = result.task;
+      if (task.buffer) {
+        result.error = write_all(task.fd, task.buffer->get_const_data(), task.size);
+        result.size = task.size;
+      } else {
+        result.error = write_all(task.fd, arguments[0].data(), arguments[0].size());
+        result.size = arguments[0].size();
+      }
+      break;
+    }
+    case AsyncTaskType::fs_close: {
+      check(::close(result.task.fd));
+      break;
+    }
+    case AsyncTaskType::fs_realpath: {
+      char* resolved = ::realpath(arguments[0].c_str(), nullptr);
+      if (resolved == nullptr) {
+        result.error = errno;
+        break;
+      }
+      result.data = resolved;
+      std::free(resolved);
+      break;
+    }
+    default: {
+      result.error = ENOSYS;
+      break;
+    }
+  }
+}
+
+VALUE result_value(VM& vm, const AsyncTaskResult& result) {
+  ManagedContext lalloc(vm);
+  Array* pair = charly_as_array(lalloc.create_array(2));
+
+  if (result.error) {
+    pair->data->push_back(lalloc.create_string(std::strerror(result.error)));
+    pair->data->push_back(kNull);
+    return charly_create_pointer(pair);
+  }
+
+  VALUE value = kNull;
+  switch (result.task.type) {
+    case AsyncTaskType::fs_readfile:
+    case AsyncTaskType::fs_realpath: {
+      value = lalloc.create_string(result.data);
+      break;
+    }
+    case AsyncTaskType::fs_exists: {
+      value = result.flag ? kTrue : kFalse;
+      break;
+    }
+    case AsyncTaskType::fs_open:
+    case AsyncTaskType::fs_read:
+    case AsyncTaskType::fs_write: {
+      value = charly_create_number(result.size);
+      break;
+    }
+    case AsyncTaskType::fs_stat: {
+      Object* obj = charly_as_object(lalloc.create_object(3));
+      obj->write(vm.context.symtable("size"), charly_create_number(result.size));
+      obj->write(vm.context.symtable("mtime"), charly_create_number(result.mtime));
+      obj->write(vm.context.symtable("directory"), result.flag ? kTrue : kFalse);
+      value = charly_create_pointer(obj);
+      break;
+    }
+    case AsyncTaskType::fs_readdir: {
+      Array* entries = charly_as_array(lalloc.create_array(result.entries.size()));
+      for (const std::string& entry : result.entries) {
+        entries->data->push_back(lalloc.create_string(entry));
+      }
+      value = charly_create_pointer(entries);
+      break;
+    }
+    default: {
+      break;
+    }
+  }
+
+  pair->data->push_back(kNull);
+  pair->data->push_back(value);
+  return charly_create_pointer(pair);
+}
+
+}  // namespace FS
+}  // namespace Internals
+}  // namespace Charly
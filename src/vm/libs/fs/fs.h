@@ -0,0 +1,74 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "async_task.h"
+#include "defines.h"
+#include "internals.h"
+
+#pragma once
+
+namespace Charly {
+namespace Internals {
+namespace FS {
+
+// Asynchronous file system operations
+//
+// Each method queues a task for the worker threads and returns immediately. Once the
+// operation has finished, the callback is invoked on the main thread with an array
+// containing the error message, or null, and the result of the operation
+VALUE read_file(VM& vm, VALUE path, VALUE cb);
+VALUE write_file(VM& vm, VALUE path, VALUE data, VALUE cb);
+VALUE append_file(VM& vm, VALUE path, VALUE data, VALUE cb);
+VALUE exists(VM& vm, VALUE path, VALUE cb);
+VALUE stat(VM& vm, VALUE path, VALUE cb);
+VALUE readdir(VM& vm, VALUE path, VALUE cb);
+VALUE mkdir(VM& vm, VALUE path, VALUE cb);
+VALUE rmdir(VM& vm, VALUE path, VALUE cb);
+VALUE unlink(VM& vm, VALUE path, VALUE cb);
+VALUE rename(VM& vm, VALUE source, VALUE destination, VALUE cb);
+VALUE copy_file(VM& vm, VALUE source, VALUE destination, VALUE cb);
+VALUE realpath(VM& vm, VALUE path, VALUE cb);
+
+// File descriptor operations used by the streaming readers and writers
+//
+// Mode is either "r", "w" or "a", the result of open is the file descriptor.
+// read appends up to size bytes to a buffer, its result is the amount of bytes read,
+// 0 once the end of the file was reached. write accepts strings and buffers, the
+// buffer must not be modified until the callback runs
+VALUE open(VM& vm, VALUE path, VALUE mode, VALUE cb);
+VALUE read(VM& vm, VALUE fd, VALUE buffer, VALUE size, VALUE cb);
+VALUE write(VM& vm, VALUE fd, VALUE data, VALUE cb);
+VALUE close(VM& vm, VALUE fd, VALUE cb);
+
+// Executes the operation of a task, called on a worker thread
+void perform(AsyncTaskResult& result);
+
+// Converts the outcome of a task into the value passed to its callback, called on the main thread
+VALUE result_value(VM& vm, const AsyncTaskResult& result);
+
+}  // namespace FS
+}  // namespace Internals
+}  // namespace Charly
@@ -0,0 +1,818 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "isolate.h"
+#include "../buffer/buffer.h"
+
+#include "isolate-channel.h"
+#include "managedcontext.h"
+#include "vm.h"
+
+namespace Charly {
+
+// Executing the prelude makes up most of the startup time of an isolate, so it only
+// runs once per process. The image never runs again afterwards, children copy its heap
+// while holding the mutex
+struct BootImage {
+  VMContext context;
+  std::mutex mutex;
+  std::unique_ptr<VM> vm;
+
+  BootImage(const VMContext& context) : context(context) {
+  }
+};
+
+namespace Internals {
+namespace Isolate {
+
+// Layout of serialized messages
+//
+// Every value starts with a tag. Arrays and objects are followed by their size and their
+// elements, objects store the symbol of each key in front of its value. Heap values which
+// occur more than once are written as a reference to their first occurrence, so shared and
+// cyclic structures survive the copy
+//
+// Functions are sent as the address of their body together with the frames they close over.
+// The bytecode is shared by all isolates, the top level frame is replaced with the one of the
+// receiver. The self value and the locals of captured frames are written after the message
+// itself, values inside them which cannot be sent arrive as null
+enum class Tag : uint8_t {
+  Immediate,
+  String,
+  StringView,
+  Array,
+  SharedArray,
+  Object,
+  Buffer,
+  TypedArray,
+  Function,
+  CFunction,
+  Frame,
+  TopFrame,
+  Reference
+};
+
+// Arrays which only contain immediate values don't need to be copied
+static bool is_shareable(ArrayStorage* elements) {
+  for (VALUE element : *elements) {
+    if (charly_is_ptr(element)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+struct Serializer {
+  VM& vm;
+  IsolateMessage& message;
+
+  // Heap values which were already written, mapped to their reference index
+  std::unordered_map<VALUE, uint32_t> written{};
+
+  // Captured frames whose locals still have to be written
+  std::vector<Frame*> frames{};
+
+  // Buffers and typed arrays are only moved once the whole message was written successfully
+  std::vector<VALUE> buffers{};
+  std::vector<VALUE> typed_arrays{};
+
+  bool serialize_message(VALUE value) {
+    if (!this->serialize(value, true)) {
+      return false;
+    }
+
+    // Writing the locals of a frame might discover further frames
+    for (size_t i = 0; i < this->frames.size(); i++) {
+      Frame* frame = this->frames[i];
+      this->serialize(frame->self, false);
+      for (uint32_t j = 0; j < frame->lvarcount(); j++) {
+        this->serialize(frame->read_local(j), false);
+      }
+    }
+
+    return true;
+  }
+
+  // Values which cannot be sent throw if strict is set, they are written as null otherwise
+  bool serialize(VALUE value, bool strict) {
+    MemoryBlock& data = this->message.data;
+
+    if (!charly_is_ptr(value)) {
+      data.write_u8(static_cast<uint8_t>(Tag::Immediate));
+      data.write_u64(value);
+      return true;
+    }
+
+    auto it = this->written.find(value);
+    if (it != this->written.end()) {
+      data.write_u8(static_cast<uint8_t>(Tag::Reference));
+      data.write_u32(it->second);
+      return true;
+    }
+
+    switch (charly_get_type(value)) {
+      case kTypeString: {
+        String* string = charly_is_hstring(value) ? charly_as_hstring(value) : nullptr;
+        if (string && !string->is_shortstring() && string->lbuf.memory) {
+          data.write_u8(static_cast<uint8_t>(Tag::StringView));
+          data.write_u32(this->message.memory.size());
+          data.write_u64(reinterpret_cast<uint64_t>(string->lbuf.data));
+          data.write_u32(string->lbuf.length);
+          this->message.memory.emplace_back(string->lbuf.memory->retain());
+          return true;
+        }
+
+        data.write_u8(static_cast<uint8_t>(Tag::String));
+        data.write_u32(charly_string_length(value));
+        data.write_block(reinterpret_cast<uint8_t*>(charly_string_data(value)), charly_string_length(value));
+        return true;
+      }
+
+      case kTypeArray: {
+        this->written.emplace(value, this->written.size());
+        ArrayStorage* elements = charly_as_array(value)->data;
+
+        if (is_shareable(elements)) {
+          data.write_u8(static_cast<uint8_t>(Tag::SharedArray));
+          data.write_u32(this->message.arrays.size());
+          this->message.arrays.emplace_back(elements->retain());
+          return true;
+        }
+
+        data.write_u8(static_cast<uint8_t>(Tag::Array));
+        data.write_u32(elements->size());
+        for (VALUE element : *elements) {
+          if (!this->serialize(element, strict)) {
+            return false;
+          }
+        }
+        return true;
+      }
+
+      case kTypeObject: {
+        this->written.emplace(value, this->written.size());
+        Object* object = charly_as_object(value);
+        data.write_u8(static_cast<uint8_t>(Tag::Object));
+        data.write_u32(object->size());
+
+        bool success = true;
+        object->each([&](VALUE key, VALUE entry) {
+          if (success) {
+            data.write_u64(key);
+            success = this->serialize(entry, strict);
+          }
+        });
+        return success;
+      }
+
+      case kTypeCPointer: {
+        if (charly_is_typedarray(value)) {
+          this->written.emplace(value, this->written.size());
+          data.write_u8(static_cast<uint8_t>(Tag::TypedArray));
+          data.write_u32(this->typed_arrays.size());
+          this->typed_arrays.push_back(value);
+          return true;
+        }
+
+        if (Buffer::lookup(value) == nullptr) {
+          break;
+        }
+
+        this->written.emplace(value, this->written.size());
+        data.write_u8(static_cast<uint8_t>(Tag::Buffer));
+        data.write_u32(this->buffers.size());
+        this->buffers.push_back(value);
+        return true;
+      }
+
+      case kTypeFunction: {
+        this->written.emplace(value, this->written.size());
+        Function* function = charly_as_function(value);
+        data.write_u8(static_cast<uint8_t>(Tag::Function));
+        data.write_u64(function->name);
+        data.write_u64(reinterpret_cast<uint64_t>(function->body_address));
+        data.write_u32(function->argc);
+        data.write_u32(function->lvarcount);
+        data.write_u32(function->max_stack_depth);
+        data.write_u8(function->anonymous());
+        data.write_u8(function->needs_arguments());
+        data.write_u8(function->bound_self_set);
+        this->serialize_frame(function->context);
+        return this->serialize(function->bound_self, false);
+      }
+
+      case kTypeCFunction: {
+        this->written.emplace(value, this->written.size());
+        CFunction* cfunction = charly_as_cfunction(value);
+        data.write_u8(static_cast<uint8_t>(Tag::CFunction));
+        data.write_u64(cfunction->name);
+        data.write_u64(reinterpret_cast<uint64_t>(cfunction->pointer));
+        data.write_u64(reinterpret_cast<uint64_t>(cfunction->thunk));
+        data.write_u32(cfunction->argc);
+        return true;
+      }
+    }
+
+    if (!strict) {
+      data.write_u8(static_cast<uint8_t>(Tag::Immediate));
+      data.write_u64(kNull);
+      return true;
+    }
+
+    this->vm.throw_exception("Cannot send a value of type " + charly_get_typestring(value) + " to another isolate");
+    return false;
+  }
+
+  // Parent frames are written before the frame itself, its locals are written once the message is done
+  void serialize_frame(Frame* frame) {
+    MemoryBlock& data = this->message.data;
+
+    if (frame == nullptr) {
+      data.write_u8(static_cast<uint8_t>(Tag::Immediate));
+      data.write_u64(kNull);
+      return;
+    }
+
+    if (frame == this->vm.get_top_frame()) {
+      data.write_u8(static_cast<uint8_t>(Tag::TopFrame));
+      return;
+    }
+
+    VALUE value = charly_create_pointer(frame);
+    auto it = this->written.find(value);
+    if (it != this->written.end()) {
+      data.write_u8(static_cast<uint8_t>(Tag::Reference));
+      data.write_u32(it->second);
+      return;
+    }
+
+    data.write_u8(static_cast<uint8_t>(Tag::Frame));
+    this->serialize_frame(frame->parent_environment_frame);
+    this->written.emplace(value, this->written.size());
+    data.write_u32(frame->lvarcount());
+    this->frames.push_back(frame);
+  }
+
+  void move_storage() {
+    for (VALUE buffer : this->buffers) {
+      this->message.buffers.emplace_back(Buffer::release(buffer));
+    }
+
+    // The sender is left with an empty typed array of the same kind
+    for (VALUE array : this->typed_arrays) {
+      Charly::TypedArray* moved = charly_as_typedarray(array);
+      charly_as_cpointer(array)->data = Charly::TypedArray::create(moved->kind, 0);
+      this->message.typed_arrays.emplace_back(moved);
+    }
+  }
+};
+
+struct Deserializer {
+  VM& vm;
+  ManagedContext& lalloc;
+  IsolateMessage& message;
+  uint32_t offset = 0;
+
+  // Heap values in the order they were created
+  std::vector<VALUE> references{};
+
+  // Recreated frames whose locals still have to be read
+  std::vector<Frame*> frames{};
+
+  template <typename T>
+  T read() {
+    T value = this->message.data.read<T>(this->offset);
+    this->offset += sizeof(T);
+    return value;
+  }
+
+  VALUE deserialize_message() {
+    VALUE value = this->deserialize();
+
+    // Reading the locals of a frame might recreate further frames
+    for (size_t i = 0; i < this->frames.size(); i++) {
+      Frame* frame = this->frames[i];
+      frame->self = this->deserialize();
+      for (uint32_t j = 0; j < frame->lvarcount(); j++) {
+        frame->write_local(j, this->deserialize());
+      }
+    }
+
+    return value;
+  }
+
+  VALUE deserialize() {
+    switch (static_cast<Tag>(this->read<uint8_t>())) {
+      case Tag::Immediate: {
+        return this->read<VALUE>();
+      }
+
+      case Tag::String: {
+        uint32_t length = this->read<uint32_t>();
+        char* data = reinterpret_cast<char*>(this->message.data.get_data() + this->offset);
+        this->offset += length;
+        return this->lalloc.create_string(data, length);
+      }
+
+      case Tag::StringView: {
+        SharedMemory* memory = this->message.memory[this->read<uint32_t>()].get();
+        char* data = reinterpret_cast<char*>(this->read<uint64_t>());
+        uint32_t length = this->read<uint32_t>();
+        return this->lalloc.mark_in_gc(this->vm.create_string_view(memory, data, length));
+      }
+
+      case Tag::Array: {
+        uint32_t size = this->read<uint32_t>();
+        VALUE array = this->lalloc.create_array(size);
+        this->references.push_back(array);
+        for (uint32_t i = 0; i < size; i++) {
+          VALUE element = this->deserialize();
+          charly_as_array(array)->data->push_back(element);
+        }
+        return array;
+      }
+
+      case Tag::SharedArray: {
+        VALUE array = this->lalloc.create_array(0);
+        Array* cell = charly_as_array(array);
+        cell->data->release();
+        cell->data = this->message.arrays[this->read<uint32_t>()].release();
+        this->references.push_back(array);
+        return array;
+      }
+
+      case Tag::Object: {
+        uint32_t size = this->read<uint32_t>();
+        VALUE object = this->lalloc.create_object(size);
+        this->references.push_back(object);
+        for (uint32_t i = 0; i < size; i++) {
+          VALUE key = this->read<VALUE>();
+          VALUE entry = this->deserialize();
+          charly_as_object(object)->write(key, entry);
+        }
+        return object;
+      }
+
+      case Tag::Buffer: {
+        std::unique_ptr<UTF8Buffer>& buffer = this->message.buffers[this->read<uint32_t>()];
+        VALUE value = this->lalloc.mark_in_gc(Buffer::wrap(this->vm, buffer.release()));
+        this->references.push_back(value);
+        return value;
+      }
+
+      case Tag::TypedArray: {
+        Charly::TypedArray* array = this->message.typed_arrays[this->read<uint32_t>()].release();
+        VALUE value =
+            this->lalloc.create_cpointer(array, reinterpret_cast<void*>(Charly::TypedArray::destructor));
+        this->references.push_back(value);
+        return value;
+      }
+
+      case Tag::Function: {
+        VALUE name = this->read<VALUE>();
+        uint8_t* body_address = reinterpret_cast<uint8_t*>(this->read<uint64_t>());
+        uint32_t argc = this->read<uint32_t>();
+        uint32_t lvarcount = this->read<uint32_t>();
+        uint32_t max_stack_depth = this->read<uint32_t>();
+        bool anonymous = this->read<uint8_t>();
+        bool needs_arguments = this->read<uint8_t>();
+        bool bound_self_set = this->read<uint8_t>();
+
+        VALUE value = this->lalloc.create_function(name, body_address, argc, lvarcount, max_stack_depth, anonymous,
+                                                   needs_arguments);
+        this->references.push_back(value);
+
+        Function* function = charly_as_function(value);
+        function->context = this->deserialize_frame();
+        function->bound_self_set = bound_self_set;
+        function->bound_self = this->deserialize();
+        return value;
+      }
+
+      case Tag::CFunction: {
+        VALUE name = this->read<VALUE>();
+        void* pointer = reinterpret_cast<void*>(this->read<uint64_t>());
+        CFunctionThunk thunk = reinterpret_cast<CFunctionThunk>(this->read<uint64_t>());
+        uint32_t argc = this->read<uint32_t>();
+        VALUE value = this->lalloc.create_cfunction(name, argc, pointer, thunk);
+        this->references.push_back(value);
+        return value;
+      }
+
+      case Tag::Reference: {
+        return this->references[this->read<uint32_t>()];
+      }
+
+      default: {
+        break;
+      }
+    }
+
+    return kNull;
+  }
+
+  Frame* deserialize_frame() {
+    switch (static_cast<Tag>(this->read<uint8_t>())) {
+      case Tag::Frame: {
+        Frame* parent = this->deserialize_frame();
+        Frame* frame = this->lalloc.mark_in_gc(this->vm.create_environment_frame(parent, this->read<uint32_t>()));
+        this->references.push_back(charly_create_pointer(frame));
+        this->frames.push_back(frame);
+        return frame;
+      }
+
+      case Tag::TopFrame: {
+        return this->vm.get_top_frame();
+      }
+
+      case Tag::Reference: {
+        return charly_as_frame(this->references[this->read<uint32_t>()]);
+      }
+
+      default: {
+        this->read<VALUE>();
+        return nullptr;
+      }
+    }
+  }
+};
+
+static IsolateHandle* find_handle(VM& vm, VALUE id) {
+  if (!charly_is_number(id)) {
+    return nullptr;
+  }
+
+  auto it = vm.isolates.find(charly_number_to_uint64(id));
+  return it != vm.isolates.end() ? &it->second : nullptr;
+}
+
+// Looks up the channel referenced by an argument, throws if there is none
+static IsolateHandle* handle_argument(VM& vm, VALUE id) {
+  IsolateHandle* handle = find_handle(vm, id);
+  if (!handle) {
+    vm.throw_exception("Expected argument id to be an isolate");
+  }
+  return handle;
+}
+
+static std::string stdlib_path(const std::string& path) {
+  char* stdlibpath = std::getenv("CHARLYVMDIR");
+  return std::string(stdlibpath ? stdlibpath : ".") + "/src/stdlib/" + path;
+}
+
+static std::optional<std::string> read_file(const std::string& path) {
+  std::ifstream file(path);
+  if (!file.is_open()) {
+    return std::nullopt;
+  }
+
+  return std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+}
+
+// Runs the prelude inside the VM of the image, returns false if it failed
+static bool boot_image(BootImage& image) {
+  std::string prelude_path = stdlib_path("prelude.ch");
+  std::optional<std::string> prelude_source = read_file(prelude_path);
+  if (!prelude_source.has_value()) {
+    image.context.err_stream << "Could not open prelude" << '\n';
+    return false;
+  }
+
+  // The prelude was already compiled by the main isolate, its block is reused
+  auto cresult_prelude = image.context.compiler_manager.compile(prelude_path, prelude_source.value());
+  if (!cresult_prelude.has_value()) {
+    return false;
+  }
+
+  image.vm = std::make_unique<VM>(image.context);
+  VALUE fn_prelude = image.vm->register_module(cresult_prelude->instructionblock.value());
+  image.vm->register_task({fn_prelude, kNull});
+  if (image.vm->start_runtime() != 0) {
+    image.vm.reset();
+    return false;
+  }
+
+  return true;
+}
+
+// Runs the module of a child inside a copy of the boot image
+static uint8_t run_child(VMContext& context, const std::string& path, std::shared_ptr<IsolateChannel> channel) {
+  std::optional<std::string> source = read_file(path);
+  if (!source.has_value()) {
+    context.err_stream << "Could not open file " << path << '\n';
+    return 1;
+  }
+
+  auto cresult_module = context.compiler_manager.compile(path, source.value());
+  if (!cresult_module.has_value()) {
+    return 1;
+  }
+
+  BootImage& image = *context.boot_image;
+  std::unique_lock<std::mutex> image_lk(image.mutex);
+  if (!image.vm && !boot_image(image)) {
+    return 1;
+  }
+
+  VM vm(context, *image.vm);
+  image_lk.unlock();
+
+  IsolateHandle& handle = vm.isolates[vm.next_isolate_id++];
+  handle.channel = channel;
+  handle.side = IsolateChannel::kChild;
+  {
+    std::unique_lock<std::mutex> lk(channel->mutex);
+    channel->sides[IsolateChannel::kChild].vm = &vm;
+  }
+
+  VALUE fn_module = vm.register_module(cresult_module->instructionblock.value());
+  vm.register_task({fn_module, kNull});
+  return vm.start_runtime();
+}
+
+static VALUE spawn_module(VM& vm, const std::string& module_path, size_t max_heap_bytes) {
+  std::shared_ptr<IsolateChannel> channel = std::make_shared<IsolateChannel>();
+  channel->sides[IsolateChannel::kParent].vm = &vm;
+
+  // The image gets its own copy of the context, without a reference back to itself.
+  // It doesn't compile functions to native code, the copies have their own JIT
+  if (!vm.context.boot_image) {
+    VMContext image_context = vm.context;
+    image_context.single_worker_thread = true;
+    image_context.jit = false;
+    image_context.metrics_interval = 0;
+    vm.context.boot_image = std::make_shared<BootImage>(image_context);
+  }
+
+  uint64_t id = vm.next_isolate_id++;
+  IsolateHandle& handle = vm.isolates[id];
+  handle.channel = channel;
+  handle.side = IsolateChannel::kParent;
+  handle.thread = std::thread([context = vm.context, module_path, channel, max_heap_bytes]() mutable {
+    context.max_heap_bytes = max_heap_bytes;
+    uint8_t status_code = run_child(context, module_path, channel);
+
+    // The VM of the child is gone at this point, the parent may join the thread
+    std::unique_lock<std::mutex> lk(channel->mutex);
+    channel->finished = true;
+    channel->closed = true;
+    channel->status_code = status_code;
+    channel->sides[IsolateChannel::kChild].vm = nullptr;
+    channel->sides[IsolateChannel::kChild].inbox.clear();
+    if (VM* parent = channel->sides[IsolateChannel::kParent].vm) {
+      parent->event_loop.wake();
+    }
+  });
+
+  return charly_create_integer(id);
+}
+
+VALUE spawn(VM& vm, VALUE path, VALUE max_heap_size) {
+  CHECK(string, path);
+
+  size_t max_heap_bytes = vm.context.max_heap_bytes;
+  if (max_heap_size != kNull) {
+    double megabytes = charly_is_number(max_heap_size) ? charly_number_to_double(max_heap_size) : -1;
+    if (!(megabytes >= 0 && megabytes <= UINT32_MAX) || std::trunc(megabytes) != megabytes) {
+      vm.throw_exception("Expected max_heap_size to be a non-negative integer");
+      return kNull;
+    }
+    max_heap_bytes = static_cast<size_t>(megabytes) << 20;
+  }
+
+  std::string module_path = charly_string_std(path);
+  if (module_path.size() == 0 || module_path[0] != '/') {
+    char* working_directory = std::getenv("PWD");
+    module_path = std::string(working_directory ? working_directory : ".") + "/" + module_path;
+  }
+
+  return spawn_module(vm, module_path, max_heap_bytes);
+}
+
+VALUE spawn_worker(VM& vm) {
+  return spawn_module(vm, stdlib_path("libs/isolate/worker.ch"), vm.context.max_heap_bytes);
+}
+
+VALUE concurrency(VM&) {
+  return charly_create_integer(std::max(std::thread::hardware_concurrency(), 1u));
+}
+
+VALUE parent(VM& vm) {
+  for (auto& entry : vm.isolates) {
+    if (entry.second.side == IsolateChannel::kChild) {
+      return charly_create_integer(entry.first);
+    }
+  }
+
+  return kNull;
+}
+
+VALUE send(VM& vm, VALUE id, VALUE message) {
+  IsolateHandle* handle = handle_argument(vm, id);
+  if (!handle) {
+    return kNull;
+  }
+
+  IsolateChannel& channel = *handle->channel;
+  {
+    std::unique_lock<std::mutex> lk(channel.mutex);
+    if (channel.closed) {
+      return kFalse;
+    }
+  }
+
+  IsolateMessage serialized;
+  Serializer serializer = {vm, serialized};
+  if (!serializer.serialize_message(message)) {
+    return kNull;
+  }
+
+  // Messages sent before the child has started are queued until it runs
+  std::unique_lock<std::mutex> lk(channel.mutex);
+  if (channel.closed) {
+    return kFalse;
+  }
+
+  serializer.move_storage();
+  IsolateChannel::Side& receiver = channel.sides[1 - handle->side];
+  receiver.inbox.push_back(std::move(serialized));
+  if (receiver.vm) {
+    receiver.vm->event_loop.wake();
+  }
+
+  return kTrue;
+}
+
+VALUE on_message(VM& vm, VALUE id, VALUE cb) {
+  IsolateHandle* handle = handle_argument(vm, id);
+  if (!handle) {
+    return kNull;
+  }
+
+  handle->on_message = cb;
+  return kNull;
+}
+
+VALUE on_exit(VM& vm, VALUE id, VALUE cb) {
+  IsolateHandle* handle = handle_argument(vm, id);
+  if (!handle) {
+    return kNull;
+  }
+
+  if (handle->side != IsolateChannel::kParent) {
+    vm.throw_exception("Only spawned isolates report their exit");
+    return kNull;
+  }
+
+  handle->on_exit = cb;
+  return kNull;
+}
+
+VALUE close(VM& vm, VALUE id) {
+  IsolateHandle* handle = handle_argument(vm, id);
+  if (!handle) {
+    return kNull;
+  }
+
+  IsolateChannel& channel = *handle->channel;
+  std::unique_lock<std::mutex> lk(channel.mutex);
+  channel.closed = true;
+  if (handle->side == IsolateChannel::kParent) {
+    channel.terminate = true;
+  }
+
+  if (VM* other = channel.sides[1 - handle->side].vm) {
+    other->event_loop.wake();
+  }
+
+  return kNull;
+}
+
+void handle_messages(VM& vm) {
+  for (auto it = vm.isolates.begin(); it != vm.isolates.end();) {
+    IsolateHandle& handle = it->second;
+    IsolateChannel& channel = *handle.channel;
+
+    std::deque<IsolateMessage> messages;
+    bool finished;
+    bool terminate;
+    uint8_t status_code;
+    {
+      std::unique_lock<std::mutex> lk(channel.mutex);
+      finished = handle.side == IsolateChannel::kParent && channel.finished;
+      terminate = handle.side == IsolateChannel::kChild && channel.terminate;
+      status_code = channel.status_code;
+
+      // Messages are kept until a listener is registered, or dropped once the child has stopped
+      if (charly_is_function(handle.on_message) || finished) {
+        messages.swap(channel.sides[handle.side].inbox);
+      }
+    }
+
+    if (terminate) {
+      vm.exit(0);
+      return;
+    }
+
+    if (charly_is_function(handle.on_message)) {
+      for (IsolateMessage& message : messages) {
+        ManagedContext lalloc(vm);
+        Deserializer deserializer = {vm, lalloc, message};
+        vm.register_task(VMTask(handle.on_message, deserializer.deserialize_message()));
+      }
+    }
+
+    if (finished) {
+      handle.thread.join();
+      if (charly_is_function(handle.on_exit)) {
+        vm.register_task(VMTask(handle.on_exit, charly_create_integer(status_code)));
+      }
+      it = vm.isolates.erase(it);
+      continue;
+    }
+
+    it++;
+  }
+}
+
+bool keeps_running(VM& vm) {
+  for (auto& entry : vm.isolates) {
+    IsolateHandle& handle = entry.second;
+    if (handle.side == IsolateChannel::kParent) {
+      return true;
+    }
+
+    std::unique_lock<std::mutex> lk(handle.channel->mutex);
+    if (!handle.channel->closed && charly_is_function(handle.on_message)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void close_all(VM& vm) {
+  for (auto& entry : vm.isolates) {
+    IsolateHandle& handle = entry.second;
+    IsolateChannel& channel = *handle.channel;
+
+    {
+      std::unique_lock<std::mutex> lk(channel.mutex);
+      channel.closed = true;
+      channel.sides[handle.side].vm = nullptr;
+      if (handle.side == IsolateChannel::kParent) {
+        channel.terminate = true;
+      }
+
+      if (VM* other = channel.sides[1 - handle.side].vm) {
+        other->event_loop.wake();
+      }
+    }
+
+    if (handle.thread.joinable()) {
+      handle.thread.join();
+    }
+  }
+
+  vm.isolates.clear();
+}
+
+}  // namespace Isolate
+}  // namespace Internals
+}  // namespace Charly
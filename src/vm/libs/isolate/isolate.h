@@ -0,0 +1,88 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "defines.h"
+#include "internals.h"
+
+#pragma once
+
+namespace Charly {
+namespace Internals {
+namespace Isolate {
+
+// Isolates are VMs running on their own thread with their own heap
+//
+// All isolates of a process share the compiled modules, the symbol table and the
+// string pool. Each isolate is connected to the isolate which spawned it via a
+// channel, both sides are identified by integer ids.
+//
+// Relative paths are resolved against the working directory of the process.
+// max_heap_size sets the heap limit of the isolate in megabytes, 0 removes it.
+// If it is null, the isolate inherits the limit of its parent
+VALUE spawn(VM& vm, VALUE path, VALUE max_heap_size);
+
+// Spawns an isolate running the worker module of the standard library
+//
+// Workers receive jobs containing a function and a chunk of an array, and send back the results
+VALUE spawn_worker(VM& vm);
+
+// Returns the amount of threads the hardware can run in parallel
+VALUE concurrency(VM& vm);
+
+// Returns the id of the channel to the parent isolate, null inside the main isolate
+VALUE parent(VM& vm);
+
+// Copies a message into the other isolate, returns false if the channel is closed
+//
+// Arrays, objects, strings, numbers, booleans, symbols and null are copied, the classes
+// of objects are not. Buffers and typed arrays are moved, the sending isolate is left with an
+// empty one. Arrays of immediate values share their storage until either side modifies them.
+//
+// Functions are recreated from their bytecode, the variables they capture are copied with
+// them. Captured values which cannot be sent are replaced with null
+VALUE send(VM& vm, VALUE id, VALUE message);
+
+// Invokes the callback with every message received on a channel
+VALUE on_message(VM& vm, VALUE id, VALUE cb);
+
+// Invokes the callback with the status code of a child isolate once it has stopped
+VALUE on_exit(VM& vm, VALUE id, VALUE cb);
+
+// Closes a channel, children are stopped once they have finished their current task
+VALUE close(VM& vm, VALUE id);
+
+// Turns received messages into tasks and joins children which have stopped, called on the main thread
+void handle_messages(VM& vm);
+
+// Returns true while a channel keeps the VM from exiting
+bool keeps_running(VM& vm);
+
+// Closes all channels of the VM and waits for its children to stop
+void close_all(VM& vm);
+
+}  // namespace Isolate
+}  // namespace Internals
+}  // namespace Charly
@@ -0,0 +1,762 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "json.h"
+#include "../buffer/buffer.h"
+
+#include "managedcontext.h"
+#include "typed-array.h"
+#include "utf8-kernels.h"
+#include "vm.h"
+
+namespace Charly {
+namespace Internals {
+namespace JSON {
+
+// Recursive descent parser working directly on the bytes of the source
+//
+// Long runs of plain string characters are skipped in blocks of 16 bytes. Values are kept
+// alive by the managed context, the entries of the currently open containers are collected
+// on a scratch stack, so each container can be allocated with its final size once it is closed
+class Parser {
+public:
+  Parser(VM& vm, ManagedContext& lalloc, const char* data, size_t length)
+      : vm(vm), lalloc(lalloc), begin(data), cursor(data), end(data + length) {
+  }
+
+  // Returns false if the document is malformed, error and get_offset describe the reason
+  bool parse_document(VALUE& result) {
+    if (!this->parse_value(result, 0)) {
+      return false;
+    }
+
+    this->skip_whitespace();
+    if (this->cursor < this->end) {
+      return this->fail("Unexpected data after the end of the document");
+    }
+
+    return true;
+  }
+
+  inline size_t get_offset() {
+    return this->cursor - this->begin;
+  }
+
+  const char* error = nullptr;
+
+private:
+  VM& vm;
+  ManagedContext& lalloc;
+  const char* begin;
+  const char* cursor;
+  const char* end;
+
+  // Entries of all open containers, objects store their keys and values interleaved
+  std::vector<VALUE> stack;
+
+  // Buffer for strings containing escape sequences
+  std::string scratch;
+
+  // Keys which were registered with the symbol table during this parse
+  std::unordered_set<VALUE> known_symbols;
+
+  inline bool fail(const char* message) {
+    this->error = message;
+    return false;
+  }
+
+  inline void skip_whitespace() {
+    while (this->cursor < this->end) {
+      char c = *this->cursor;
+      if (c != ' ' && c != '\n' && c != '\r' && c != '\t') {
+        break;
+      }
+      this->cursor++;
+    }
+  }
+
+  inline bool consume_literal(const char* literal, size_t length) {
+    if (static_cast<size_t>(this->end - this->cursor) < length || std::memcmp(this->cursor, literal, length) != 0) {
+      return this->fail("Invalid literal");
+    }
+
+    this->cursor += length;
+    return true;
+  }
+
+  bool parse_value(VALUE& result, size_t depth) {
+    this->skip_whitespace();
+    if (this->cursor == this->end) {
+      return this->fail("Unexpected end of input");
+    }
+
+    switch (*this->cursor) {
+      case '{': return this->parse_object(result, depth + 1);
+      case '[': return this->parse_array(result, depth + 1);
+      case '"': {
+        const char* data;
+        size_t length;
+        if (!this->parse_string(data, length)) {
+          return false;
+        }
+
+        result = this->lalloc.create_string(data, length);
+        return true;
+      }
+      case 't': result = kTrue; return this->consume_literal("true", 4);
+      case 'f': result = kFalse; return this->consume_literal("false", 5);
+      case 'n': result = kNull; return this->consume_literal("null", 4);
+      default: return this->parse_number(result);
+    }
+  }
+
+  bool parse_array(VALUE& result, size_t depth) {
+    if (depth > kMaxDepth) {
+      return this->fail("Document is nested too deeply");
+    }
+
+    this->cursor++;
+    size_t base = this->stack.size();
+
+    this->skip_whitespace();
+    if (this->cursor < this->end && *this->cursor == ']') {
+      this->cursor++;
+    } else {
+      for (;;) {
+        VALUE item;
+        if (!this->parse_value(item, depth)) {
+          return false;
+        }
+        this->stack.push_back(item);
+
+        this->skip_whitespace();
+        if (this->cursor == this->end) {
+          return this->fail("Unexpected end of input");
+        }
+
+        char c = *this->cursor++;
+        if (c == ']') {
+          break;
+        }
+        if (c != ',') {
+          this->cursor--;
+          return this->fail("Expected ',' or ']'");
+        }
+      }
+    }
+
+    result = this->lalloc.create_array(this->stack.size() - base);
+    ArrayStorage* data = charly_as_array(result)->data;
+    data->insert(data->end(), this->stack.begin() + base, this->stack.end());
+    this->stack.resize(base);
+    return true;
+  }
+
+  bool parse_object(VALUE& result, size_t depth) {
+    if (depth > kMaxDepth) {
+      return this->fail("Document is nested too deeply");
+    }
+
+    this->cursor++;
+    size_t base = this->stack.size();
+
+    this->skip_whitespace();
+    if (this->cursor < this->end && *this->cursor == '}') {
+      this->cursor++;
+    } else {
+      for (;;) {
+        this->skip_whitespace();
+        if (this->cursor == this->end || *this->cursor != '"') {
+          return this->fail("Expected a string key");
+        }
+
+        const char* key_data;
+        size_t key_length;
+        if (!this->parse_string(key_data, key_length)) {
+          return false;
+        }
+        this->stack.push_back(this->create_symbol(key_data, key_length));
+
+        this->skip_whitespace();
+        if (this->cursor == this->end || *this->cursor != ':') {
+          return this->fail("Expected ':'");
+        }
+        this->cursor++;
+
+        VALUE value;
+        if (!this->parse_value(value, depth)) {
+          return false;
+        }
+        this->stack.push_back(value);
+
+        this->skip_whitespace();
+        if (this->cursor == this->end) {
+          return this->fail("Unexpected end of input");
+        }
+
+        char c = *this->cursor++;
+        if (c == '}') {
+          break;
+        }
+        if (c != ',') {
+          this->cursor--;
+          return this->fail("Expected ',' or '}'");
+        }
+      }
+    }
+
+    size_t count = (this->stack.size() - base) / 2;
+    result = this->lalloc.create_object(count);
+    Object* object = charly_as_object(result);
+    for (size_t i = base; i < this->stack.size(); i += 2) {
+      object->write(this->stack[i], this->stack[i + 1]);
+    }
+    this->stack.resize(base);
+    return true;
+  }
+
+  // Keys are turned into symbols, each distinct key only takes the lock of the symbol table once
+  VALUE create_symbol(const char* data, size_t length) {
+    VALUE symbol = charly_create_symbol(data, length);
+    if (this->known_symbols.insert(symbol).second) {
+      this->vm.context.symtable.register_symbol(symbol, data, length);
+    }
+
+    return symbol;
+  }
+
+  // Strings without escape sequences point directly into the source
+  bool parse_string(const char*& data, size_t& length) {
+    const char* start = ++this->cursor;
+    size_t plain = UTF8::json_plain_prefix_length(start, this->end - start);
+    this->cursor += plain;
+
+    if (this->cursor < this->end && *this->cursor == '"') {
+      this->cursor++;
+      data = start;
+      length = plain;
+      return true;
+    }
+
+    this->scratch.assign(start, plain);
+    while (this->cursor < this->end) {
+      char c = *this->cursor;
+
+      if (c == '"') {
+        this->cursor++;
+        data = this->scratch.data();
+        length = this->scratch.size();
+        return true;
+      }
+
+      if (c != '\\') {
+        return this->fail("Unescaped control character in string");
+      }
+
+      if (!this->parse_escape()) {
+        return false;
+      }
+
+      plain = UTF8::json_plain_prefix_length(this->cursor, this->end - this->cursor);
+      this->scratch.append(this->cursor, plain);
+      this->cursor += plain;
+    }
+
+    return this->fail("Unterminated string");
+  }
+
+  bool parse_escape() {
+    if (this->end - this->cursor < 2) {
+      return this->fail("Unterminated string");
+    }
+
+    char c = this->cursor[1];
+    this->cursor += 2;
+    switch (c) {
+      case '"': this->scratch.push_back('"'); return true;
+      case '\\': this->scratch.push_back('\\'); return true;
+      case '/': this->scratch.push_back('/'); return true;
+      case 'b': this->scratch.push_back('\b'); return true;
+      case 'f': this->scratch.push_back('\f'); return true;
+      case 'n': this->scratch.push_back('\n'); return true;
+      case 'r': this->scratch.push_back('\r'); return true;
+      case 't': this->scratch.push_back('\t'); return true;
+      case 'u': break;
+      default: this->cursor -= 2; return this->fail("Invalid escape sequence");
+    }
+
+    uint32_t cp;
+    if (!this->parse_hex(cp)) {
+      return false;
+    }
+
+    // Surrogate pairs are combined, unpaired surrogates are replaced
+    if (cp >= 0xD800 && cp <= 0xDBFF) {
+      uint32_t low;
+      if (this->end - this->cursor >= 6 && this->cursor[0] == '\\' && this->cursor[1] == 'u') {
+        this->cursor += 2;
+        if (!this->parse_hex(low)) {
+          return false;
+        }
+
+        if (low >= 0xDC00 && low <= 0xDFFF) {
+          cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+        } else {
+          // The second escape is read again on its own, it might start a pair itself
+          this->cursor -= 6;
+          cp = 0xFFFD;
+        }
+      } else {
+        cp = 0xFFFD;
+      }
+    }
+
+    if (cp >= 0xD800 && cp <= 0xDFFF) {
+      cp = 0xFFFD;
+    }
+
+    this->append_utf8(cp);
+    return true;
+  }
+
+  bool parse_hex(uint32_t& cp) {
+    if (this->end - this->cursor < 4) {
+      return this->fail("Invalid unicode escape sequence");
+    }
+
+    cp = 0;
+    for (int i = 0; i < 4; i++) {
+      char c = *this->cursor++;
+      cp <<= 4;
+      if (c >= '0' && c <= '9') {
+        cp |= c - '0';
+      } else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') {
+        cp |= (c | 0x20) - 'a' + 10;
+      } else {
+        this->cursor--;
+        return this->fail("Invalid unicode escape sequence");
+      }
+    }
+
+    return true;
+  }
+
+  void append_utf8(uint32_t cp) {
+    if (cp < 0x80) {
+      this->scratch.push_back(cp);
+    } else if (cp < 0x800) {
+      this->scratch.push_back(0xC0 | (cp >> 6));
+      this->scratch.push_back(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+      this->scratch.push_back(0xE0 | (cp >> 12));
+      this->scratch.push_back(0x80 | ((cp >> 6) & 0x3F));
+      this->scratch.push_back(0x80 | (cp & 0x3F));
+    } else {
+      this->scratch.push_back(0xF0 | (cp >> 18));
+      this->scratch.push_back(0x80 | ((cp >> 12) & 0x3F));
+      this->scratch.push_back(0x80 | ((cp >> 6) & 0x3F));
+      this->scratch.push_back(0x80 | (cp & 0x3F));
+    }
+  }
+
+  bool parse_number(VALUE& result) {
+    const char* start = this->cursor;
+    const char* c = this->cursor;
+
+    bool negative = c < this->end && *c == '-';
+    c += negative;
+
+    // Integer part, leading zeros are not allowed
+    const char* digits = c;
+    if (c < this->end && *c == '0') {
+      c++;
+    } else {
+      while (c < this->end && *c >= '0' && *c <= '9') {
+        c++;
+      }
+    }
+    if (c == digits) {
+      return this->fail(negative ? "Invalid number" : "Unexpected character");
+    }
+    size_t integer_digits = c - digits;
+
+    bool is_integer = true;
+    if (c < this->end && *c == '.') {
+      is_integer = false;
+      const char* fraction = ++c;
+      while (c < this->end && *c >= '0' && *c <= '9') {
+        c++;
+      }
+      if (c == fraction) {
+        this->cursor = c;
+        return this->fail("Invalid number");
+      }
+    }
+
+    if (c < this->end && (*c == 'e' || *c == 'E')) {
+      is_integer = false;
+      c++;
+      if (c < this->end && (*c == '+' || *c == '-')) {
+        c++;
+      }
+      const char* exponent = c;
+      while (c < this->end && *c >= '0' && *c <= '9') {
+        c++;
+      }
+      if (c == exponent) {
+        this->cursor = c;
+        return this->fail("Invalid number");
+      }
+    }
+
+    this->cursor = c;
+
+    // Integers which can't lose precision are accumulated directly
+    if (is_integer && integer_digits <= 15) {
+      int64_t value = 0;
+      for (const char* d = digits; d < c; d++) {
+        value = value * 10 + (*d - '0');
+      }
+
+      result = charly_create_number(negative ? -value : value);
+      return true;
+    }
+
+    // strtod needs a terminated string
+    std::string number(start, c - start);
+    result = charly_create_double(std::strtod(number.c_str(), nullptr));
+    return true;
+  }
+};
+
+VALUE parse(VM& vm, VALUE source) {
+  const char* data;
+  size_t length;
+  if (charly_is_string(source)) {
+    data = charly_string_data(source);
+    length = charly_string_length(source);
+  } else if (UTF8Buffer* buffer = Buffer::lookup(source)) {
+    data = buffer->get_const_data();
+    length = buffer->get_writeoffset();
+  } else {
+    vm.throw_exception("Expected argument source to be a string or a buffer");
+    return kNull;
+  }
+
+  ManagedContext lalloc(vm);
+  Parser parser(vm, lalloc, data, length);
+
+  VALUE result = kNull;
+  if (!parser.parse_document(result)) {
+    vm.throw_exception(std::string(parser.error) + " at offset " + std::to_string(parser.get_offset()));
+    return kNull;
+  }
+
+  return result;
+}
+
+// Serializes values into a growing block of memory, which becomes the storage of the resulting string
+class Writer {
+public:
+  Writer(VM& vm, uint32_t indent) : vm(vm), indent(indent) {
+  }
+
+  const char* error = nullptr;
+  UTF8Buffer out;
+
+  static bool is_serializable(VALUE value) {
+    switch (charly_get_type(value)) {
+      case kTypeNull:
+      case kTypeBoolean:
+      case kTypeNumber:
+      case kTypeString:
+      case kTypeSymbol:
+      case kTypeArray:
+      case kTypeObject: return true;
+      default: return charly_is_typedarray(value);
+    }
+  }
+
+  bool write_value(VALUE value, size_t depth) {
+    switch (charly_get_type(value)) {
+      case kTypeNull: this->write_raw("null", 4); return true;
+      case kTypeBoolean: value == kTrue ? this->write_raw("true", 4) : this->write_raw("false", 5); return true;
+      case kTypeNumber: this->write_number(value); return true;
+      case kTypeString: this->write_string(charly_string_data(value), charly_string_length(value)); return true;
+      case kTypeSymbol: {
+        const std::string& name = this->symbol_name(value);
+        this->write_string(name.data(), name.size());
+        return true;
+      }
+      case kTypeArray: return this->write_array(value, depth + 1);
+      case kTypeObject: return this->write_object(value, depth + 1);
+      default: {
+        if (charly_is_typedarray(value)) {
+          return this->write_typedarray(charly_as_typedarray(value), depth + 1);
+        }
+
+        this->write_raw("null", 4);
+        return true;
+      }
+    }
+  }
+
+private:
+  VM& vm;
+  uint32_t indent;
+
+  // Containers which are currently being written, used to detect cycles
+  std::vector<VALUE> open_containers;
+
+  // Decoded object keys, each distinct key only takes the lock of the symbol table once
+  std::unordered_map<VALUE, std::string> symbol_names;
+
+  inline void write_raw(const char* data, size_t length) {
+    this->out.write_block(reinterpret_cast<const uint8_t*>(data), length);
+  }
+
+  inline void write_char(char c) {
+    this->out.write_u8(c);
+  }
+
+  // Starts a new line and indents it, unless the output is compact
+  inline void write_newline(size_t depth) {
+    if (this->indent) {
+      size_t width = depth * this->indent;
+      uint8_t* tail = this->out.reserve_tail(width + 1);
+      tail[0] = '\n';
+      std::memset(tail + 1, ' ', width);
+      this->out.advance_writeoffset(width + 1);
+    }
+  }
+
+  bool enter(VALUE container, size_t depth) {
+    if (depth > kMaxDepth) {
+      this->error = "Value is nested too deeply to be serialized";
+      return false;
+    }
+
+    for (VALUE open : this->open_containers) {
+      if (open == container) {
+        this->error = "Cannot serialize a cyclic structure";
+        return false;
+      }
+    }
+
+    this->open_containers.push_back(container);
+    return true;
+  }
+
+  const std::string& symbol_name(VALUE symbol) {
+    auto it = this->symbol_names.find(symbol);
+    if (it == this->symbol_names.end()) {
+      std::string name = this->vm.context.symtable(symbol).value_or(kUndefinedSymbolString);
+      it = this->symbol_names.emplace(symbol, std::move(name)).first;
+    }
+
+    return it->second;
+  }
+
+  void write_number(VALUE value) {
+    char buffer[32];
+    int length;
+
+    if (charly_is_int(value)) {
+      length = std::snprintf(buffer, sizeof(buffer), "%lld", static_cast<long long>(charly_int_to_int64(value)));
+    } else {
+      double number = charly_double_to_double(value);
+      if (!std::isfinite(number)) {
+        this->write_raw("null", 4);
+        return;
+      }
+
+      // Use the shortest representation which reads back as the same number
+      length = std::snprintf(buffer, sizeof(buffer), "%.15g", number);
+      if (std::strtod(buffer, nullptr) != number) {
+        length = std::snprintf(buffer, sizeof(buffer), "%.17g", number);
+      }
+    }
+
+    this->write_raw(buffer, length);
+  }
+
+  void write_string(const char* data, size_t length) {
+    static const char kHexDigits[] = "0123456789abcdef";
+
+    this->write_char('"');
+    for (;;) {
+      size_t plain = UTF8::json_plain_prefix_length(data, length);
+      this->write_raw(data, plain);
+      data += plain;
+      length -= plain;
+
+      if (length == 0) {
+        break;
+      }
+
+      char c = *data++;
+      length--;
+      switch (c) {
+        case '"': this->write_raw("\\\"", 2); break;
+        case '\\': this->write_raw("\\\\", 2); break;
+        case '\b': this->write_raw("\\b", 2); break;
+        case '\f': this->write_raw("\\f", 2); break;
+        case '\n': this->write_raw("\\n", 2); break;
+        case '\r': this->write_raw("\\r", 2); break;
+        case '\t': this->write_raw("\\t", 2); break;
+        default: {
+          char escape[] = {'\\', 'u', '0', '0', kHexDigits[(c >> 4) & 0xF], kHexDigits[c & 0xF]};
+          this->write_raw(escape, sizeof(escape));
+        }
+      }
+    }
+    this->write_char('"');
+  }
+
+  bool write_array(VALUE value, size_t depth) {
+    if (!this->enter(value, depth)) {
+      return false;
+    }
+
+    ArrayStorage* data = charly_as_array(value)->data;
+    this->write_char('[');
+
+    bool success = true;
+    for (size_t i = 0; i < data->size(); i++) {
+      if (i) {
+        this->write_char(',');
+      }
+      this->write_newline(depth);
+
+      VALUE item = (*data)[i];
+      if (!this->write_value(is_serializable(item) ? item : kNull, depth)) {
+        success = false;
+        break;
+      }
+    }
+
+    if (success && data->size()) {
+      this->write_newline(depth - 1);
+    }
+
+    this->write_char(']');
+    this->open_containers.pop_back();
+    return success;
+  }
+
+  bool write_object(VALUE value, size_t depth) {
+    if (!this->enter(value, depth)) {
+      return false;
+    }
+
+    Object* object = charly_as_object(value);
+    this->write_char('{');
+
+    bool success = true;
+    bool first = true;
+    object->each([&](VALUE key, VALUE item) {
+      if (!success || !is_serializable(item)) {
+        return;
+      }
+
+      if (!first) {
+        this->write_char(',');
+      }
+      first = false;
+      this->write_newline(depth);
+
+      const std::string& name = this->symbol_name(key);
+      this->write_string(name.data(), name.size());
+      this->write_char(':');
+      if (this->indent) {
+        this->write_char(' ');
+      }
+
+      success = this->write_value(item, depth);
+    });
+
+    if (success && !first) {
+      this->write_newline(depth - 1);
+    }
+
+    this->write_char('}');
+    this->open_containers.pop_back();
+    return success;
+  }
+
+  bool write_typedarray(Charly::TypedArray* array, size_t depth) {
+    this->write_char('[');
+    for (uint32_t i = 0; i < array->length; i++) {
+      if (i) {
+        this->write_char(',');
+      }
+      this->write_newline(depth);
+      this->write_number(array->read(i));
+    }
+
+    if (array->length) {
+      this->write_newline(depth - 1);
+    }
+
+    this->write_char(']');
+    return true;
+  }
+};
+
+VALUE stringify(VM& vm, VALUE value, VALUE indent) {
+  CHECK(number, indent);
+
+  Writer writer(vm, std::min(charly_number_to_uint32(indent), 10u));
+  if (!writer.write_value(Writer::is_serializable(value) ? value : kNull, 0)) {
+    vm.throw_exception(writer.error);
+    return kNull;
+  }
+
+  size_t length = writer.out.get_writeoffset();
+  if (length > static_cast<size_t>(kMaxStringLength)) {
+    vm.throw_exception("Serialized value is too long to be stored in a string");
+    return kNull;
+  }
+
+  // The string takes over the memory of the writer instead of copying it
+  SharedMemory* memory = writer.out.share();
+  VALUE result = vm.create_string_view(memory, reinterpret_cast<char*>(writer.out.get_data()), length);
+  memory->release();
+  return result;
+}
+
+}  // namespace JSON
+}  // namespace Internals
+}  // namespace Charly
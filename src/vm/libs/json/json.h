@@ -0,0 +1,56 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "defines.h"
+#include "internals.h"
+
+#pragma once
+
+namespace Charly {
+namespace Internals {
+namespace JSON {
+
+// Nesting deeper than this is rejected by both the parser and the serializer
+static constexpr size_t kMaxDepth = 512;
+
+// Parses a JSON document from a string or a buffer
+//
+// Objects and arrays are created with the exact amount of entries they hold. Numbers without
+// a fraction or an exponent become integers, if they fit. Syntax errors throw an exception
+// containing the byte offset of the error
+VALUE parse(VM& vm, VALUE source);
+
+// Serializes a value into a JSON string
+//
+// Objects are written with their own properties, functions and other values without a
+// JSON representation are left out of objects and written as null inside arrays.
+// NaN and infinite numbers are written as null. A positive indent pretty prints the
+// output with that amount of spaces per level. Cyclic structures throw an exception
+VALUE stringify(VM& vm, VALUE value, VALUE indent);
+
+}  // namespace JSON
+}  // namespace Internals
+}  // namespace Charly
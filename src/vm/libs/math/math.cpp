@@ -28,9 +28,11 @@
 
 #include <cmath>
 #include <complex>
-#include <random>
+#include <unordered_map>
 #include "math.h"
+#include "typed-array.h"
 #include "vm.h"
+#include "../buffer/buffer.h"
 
 using namespace std;
 
@@ -38,130 +40,226 @@ namespace Charly {
 namespace Internals {
 namespace Math {
 
-std::random_device rand_engine;
+double cos(double n) {
+  return std::cos(n);
+}
+
+double cosh(double n) {
+  return std::cosh(n);
+}
+
+double acos(double n) {
+  return std::acos(n);
+}
 
-VALUE cos(VM& vm, VALUE n) {
-  (void)vm;
-  CHECK(number, n);
-  return charly_create_number(std::cos(charly_number_to_double(n)));
+double acosh(double n) {
+  return std::acosh(n);
 }
 
-VALUE cosh(VM& vm, VALUE n) {
-  (void)vm;
-  CHECK(number, n);
-  return charly_create_number(std::cosh(charly_number_to_double(n)));
+double sin(double n) {
+  return std::sin(n);
 }
 
-VALUE acos(VM& vm, VALUE n) {
-  (void)vm;
-  CHECK(number, n);
-  return charly_create_number(std::acos(charly_number_to_double(n)));
+double sinh(double n) {
+  return std::sinh(n);
 }
 
-VALUE acosh(VM& vm, VALUE n) {
-  (void)vm;
-  CHECK(number, n);
-  return charly_create_number(std::acosh(charly_number_to_double(n)));
+double asin(double n) {
+  return std::asin(n);
 }
 
-VALUE sin(VM& vm, VALUE n) {
-  (void)vm;
-  CHECK(number, n);
-  return charly_create_number(std::sin(charly_number_to_double(n)));
+double asinh(double n) {
+  return std::asinh(n);
 }
 
-VALUE sinh(VM& vm, VALUE n) {
-  (void)vm;
-  CHECK(number, n);
-  return charly_create_number(std::sinh(charly_number_to_double(n)));
+double tan(double n) {
+  return std::tan(n);
 }
 
-VALUE asin(VM& vm, VALUE n) {
-  (void)vm;
-  CHECK(number, n);
-  return charly_create_number(std::asin(charly_number_to_double(n)));
+double tanh(double n) {
+  return std::tanh(n);
 }
 
-VALUE asinh(VM& vm, VALUE n) {
-  (void)vm;
-  CHECK(number, n);
-  return charly_create_number(std::asinh(charly_number_to_double(n)));
+double atan(double n) {
+  return std::atan(n);
 }
 
-VALUE tan(VM& vm, VALUE n) {
-  (void)vm;
-  CHECK(number, n);
-  return charly_create_number(std::tan(charly_number_to_double(n)));
+double atanh(double n) {
+  return std::atanh(n);
 }
 
-VALUE tanh(VM& vm, VALUE n) {
-  (void)vm;
-  CHECK(number, n);
-  return charly_create_number(std::tanh(charly_number_to_double(n)));
+double cbrt(double n) {
+  return std::cbrt(n);
 }
 
-VALUE atan(VM& vm, VALUE n) {
-  (void)vm;
-  CHECK(number, n);
-  return charly_create_number(std::atan(charly_number_to_double(n)));
+double sqrt(double n) {
+  return std::sqrt(n);
 }
 
-VALUE atanh(VM& vm, VALUE n) {
-  (void)vm;
-  CHECK(number, n);
-  return charly_create_number(std::atanh(charly_number_to_double(n)));
+double ceil(double n) {
+  return std::ceil(n);
 }
 
-VALUE cbrt(VM& vm, VALUE n) {
-  (void)vm;
-  CHECK(number, n);
-  return charly_create_number(std::cbrt(charly_number_to_double(n)));
+double floor(double n) {
+  return std::floor(n);
 }
 
-VALUE sqrt(VM& vm, VALUE n) {
-  (void)vm;
-  CHECK(number, n);
-  return charly_create_number(std::sqrt(charly_number_to_double(n)));
+double log(double n) {
+  return std::log(n);
 }
 
-VALUE ceil(VM& vm, VALUE n) {
-  (void)vm;
-  CHECK(number, n);
-  return charly_create_number(std::ceil(charly_number_to_double(n)));
+double log2(double n) {
+  return std::log2(n);
 }
 
-VALUE floor(VM& vm, VALUE n) {
-  (void)vm;
-  CHECK(number, n);
-  return charly_create_number(std::floor(charly_number_to_double(n)));
+double log10(double n) {
+  return std::log10(n);
 }
 
-VALUE log(VM& vm, VALUE n) {
-  (void)vm;
-  CHECK(number, n);
-  return charly_create_number(std::log(charly_number_to_double(n)));
+double exp(double n) {
+  return std::exp(n);
 }
 
-VALUE log2(VM& vm, VALUE n) {
-  (void)vm;
-  CHECK(number, n);
-  return charly_create_number(std::log2(charly_number_to_double(n)));
+double abs(double n) {
+  return std::fabs(n);
 }
 
-VALUE log10(VM& vm, VALUE n) {
-  (void)vm;
-  CHECK(number, n);
-  return charly_create_number(std::log10(charly_number_to_double(n)));
+// Without arguments, returns a number between 0 and 1
+// With a single argument, returns a number between 0 and that argument
+static void rand_range(std::optional<double> min, std::optional<double> max, double& lower, double& upper) {
+  lower = 0;
+  upper = 1;
+
+  if (max.has_value()) {
+    lower = min.value();
+    upper = max.value();
+  } else if (min.has_value()) {
+    upper = min.value();
+  }
+}
+
+double rand(VM& vm, std::optional<double> min, std::optional<double> max) {
+  double lower, upper;
+  rand_range(min, max, lower, upper);
+  return lower + vm.random.next_double() * (upper - lower);
+}
+
+// Returns a sample of the normal distribution, defaults to mean 0 and standard deviation 1
+double normal(VM& vm, std::optional<double> mean, std::optional<double> stddev) {
+  double first, second;
+  vm.random.next_normal_pair(first, second);
+  return mean.value_or(0) + first * stddev.value_or(1);
+}
+
+void seed(VM& vm, int64_t value) {
+  vm.random.seed(value);
+}
+
+// Elements of int32 arrays are rounded down and saturate at the bounds of the int32 range
+VALUE fill_uniform(VM& vm, VALUE array, std::optional<double> min, std::optional<double> max) {
+  CHECK(typedarray, array);
+
+  double lower, upper;
+  rand_range(min, max, lower, upper);
+  double range = upper - lower;
+
+  Charly::TypedArray* arr = charly_as_typedarray(array);
+  if (arr->kind == kTypedArrayFloat64) {
+    for (uint32_t i = 0; i < arr->length; i++) {
+      arr->f64[i] = lower + vm.random.next_double() * range;
+    }
+  } else {
+    for (uint32_t i = 0; i < arr->length; i++) {
+      arr->i32[i] = Charly::TypedArray::to_int32(std::floor(lower + vm.random.next_double() * range));
+    }
+  }
+
+  return array;
 }
 
-VALUE rand(VM& vm, VALUE min, VALUE max) {
-  (void)vm;
-  CHECK(number, min);
-  CHECK(number, max);
-  return charly_create_double(std::uniform_real_distribution<double>(
-    charly_number_to_double(min),
-    charly_number_to_double(max)
-  )(rand_engine));
+VALUE fill_normal(VM& vm, VALUE array, std::optional<double> mean, std::optional<double> stddev) {
+  CHECK(typedarray, array);
+
+  double mu = mean.value_or(0);
+  double sigma = stddev.value_or(1);
+  double samples[2];
+
+  Charly::TypedArray* arr = charly_as_typedarray(array);
+  for (uint32_t i = 0; i < arr->length; i++) {
+    // Each transform produces two samples
+    if ((i & 1) == 0) {
+      vm.random.next_normal_pair(samples[0], samples[1]);
+    }
+
+    double sample = mu + samples[i & 1] * sigma;
+    if (arr->kind == kTypedArrayFloat64) {
+      arr->f64[i] = sample;
+    } else {
+      arr->i32[i] = Charly::TypedArray::to_int32(std::floor(sample));
+    }
+  }
+
+  return array;
+}
+
+VALUE random_bytes(VM& vm, VALUE buf, int64_t count) {
+  CHECK(cpointer, buf);
+
+  UTF8Buffer* buffer = Buffer::lookup(buf);
+  if (!buffer) {
+    return kNull;
+  }
+
+  if (count < 0) {
+    vm.throw_exception("random_bytes: count can't be negative");
+    return kNull;
+  }
+
+  buffer->grow_to_fit(buffer->get_writeoffset() + count);
+  for (; count >= 8; count -= 8) {
+    buffer->write_u64(vm.random.next());
+  }
+  uint64_t rest = vm.random.next();
+  for (; count > 0; count--) {
+    buffer->write_u8(rest);
+    rest >>= 8;
+  }
+
+  return charly_create_integer(buffer->get_writeoffset());
+}
+
+static const std::unordered_map<std::string, double (*)(double)> kElementwiseFunctions = {
+  {"cos", cos},   {"cosh", cosh}, {"acos", acos}, {"acosh", acosh}, {"sin", sin},   {"sinh", sinh},
+  {"asin", asin}, {"asinh", asinh}, {"tan", tan}, {"tanh", tanh},   {"atan", atan}, {"atanh", atanh},
+  {"cbrt", cbrt}, {"sqrt", sqrt}, {"ceil", ceil}, {"floor", floor}, {"log", log},   {"log2", log2},
+  {"log10", log10}, {"exp", exp}, {"abs", abs}
+};
+
+// Replaces each element with the result of the math function called name
+//
+// Results stored into int32 arrays are converted like regular element writes
+VALUE apply(VM& vm, VALUE array, std::string name) {
+  CHECK(typedarray, array);
+
+  auto it = kElementwiseFunctions.find(name);
+  if (it == kElementwiseFunctions.end()) {
+    vm.throw_exception("apply: unknown function " + name);
+    return kNull;
+  }
+  double (*function)(double) = it->second;
+
+  Charly::TypedArray* arr = charly_as_typedarray(array);
+  if (arr->kind == kTypedArrayFloat64) {
+    for (uint32_t i = 0; i < arr->length; i++) {
+      arr->f64[i] = function(arr->f64[i]);
+    }
+  } else {
+    for (uint32_t i = 0; i < arr->length; i++) {
+      arr->i32[i] = Charly::TypedArray::to_int32(function(arr->i32[i]));
+    }
+  }
+
+  return array;
 }
 
 }  // namespace Math
@@ -24,6 +24,9 @@
  * SOFTWARE.
  */
 
+#include <optional>
+#include <string>
+
 #include "defines.h"
 #include "internals.h"
 
@@ -33,26 +36,38 @@ namespace Charly {
 namespace Internals {
 namespace Math {
 
-VALUE cos(VM& vm, VALUE n);
-VALUE cosh(VM& vm, VALUE n);
-VALUE acos(VM& vm, VALUE n);
-VALUE acosh(VM& vm, VALUE n);
-VALUE sin(VM& vm, VALUE n);
-VALUE sinh(VM& vm, VALUE n);
-VALUE asin(VM& vm, VALUE n);
-VALUE asinh(VM& vm, VALUE n);
-VALUE tan(VM& vm, VALUE n);
-VALUE tanh(VM& vm, VALUE n);
-VALUE atan(VM& vm, VALUE n);
-VALUE atanh(VM& vm, VALUE n);
-VALUE cbrt(VM& vm, VALUE n);
-VALUE sqrt(VM& vm, VALUE n);
-VALUE ceil(VM& vm, VALUE n);
-VALUE floor(VM& vm, VALUE n);
-VALUE log(VM& vm, VALUE n);
-VALUE log2(VM& vm, VALUE n);
-VALUE log10(VM& vm, VALUE n);
-VALUE rand(VM& vm, VALUE min, VALUE max);
+double cos(double n);
+double cosh(double n);
+double acos(double n);
+double acosh(double n);
+double sin(double n);
+double sinh(double n);
+double asin(double n);
+double asinh(double n);
+double tan(double n);
+double tanh(double n);
+double atan(double n);
+double atanh(double n);
+double cbrt(double n);
+double sqrt(double n);
+double ceil(double n);
+double floor(double n);
+double log(double n);
+double log2(double n);
+double log10(double n);
+double exp(double n);
+double abs(double n);
+
+// Random numbers are generated by the Random instance of the VM
+double rand(VM& vm, std::optional<double> min, std::optional<double> max);
+double normal(VM& vm, std::optional<double> mean, std::optional<double> stddev);
+void seed(VM& vm, int64_t value);
+
+// Bulk operations, filling a whole typed array or buffer in a single call
+VALUE fill_uniform(VM& vm, VALUE array, std::optional<double> min, std::optional<double> max);
+VALUE fill_normal(VM& vm, VALUE array, std::optional<double> mean, std::optional<double> stddev);
+VALUE random_bytes(VM& vm, VALUE buf, int64_t count);
+VALUE apply(VM& vm, VALUE array, std::string name);
 
 }  // namespace Math
 }  // namespace Internals
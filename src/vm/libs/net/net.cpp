@@ -0,0 +1,641 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <initializer_list>
+#include <optional>
+#include <string>
+
+#include "net.h"
+#include "../buffer/buffer.h"
+
+#include "managedcontext.h"
+#include "socket.h"
+#include "vm.h"
+
+namespace Charly {
+namespace Internals {
+namespace Net {
+
+// Capacity of the buffers received data is read into
+static constexpr size_t kReadChunkSize = 16 * 1024;
+static constexpr size_t kMaxDatagramSize = 64 * 1024;
+
+// Maximum amount of connections accepted per readiness event of a listener
+static constexpr int kAcceptBatchSize = 16;
+
+// Writes to closed connections report EPIPE instead of raising SIGPIPE
+#if defined(MSG_NOSIGNAL)
+static constexpr int kSendFlags = MSG_NOSIGNAL;
+#else
+static constexpr int kSendFlags = 0;
+#endif
+
+static bool prepare_fd(int fd) {
+#if defined(SO_NOSIGPIPE)
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+
+  int flags = fcntl(fd, F_GETFL, 0);
+  return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0 && fcntl(fd, F_SETFD, FD_CLOEXEC) == 0;
+}
+
+// Small writes of request / response protocols shouldn't wait for more data
+static void disable_nagle(int fd) {
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+// Throws unless the port is an integer between 0 and 65535
+static bool check_port(VM& vm, const char* operation, VALUE port) {
+  double value = charly_number_to_double(port);
+  if (!(value >= 0 && value <= 65535) || std::trunc(value) != value) {
+    vm.throw_exception(std::string(operation) + ": Expected port to be an integer between 0 and 65535");
+    return false;
+  }
+
+  return true;
+}
+
+// Resolves an address, returns the error message on failure
+//
+// An empty host resolves to the wildcard address
+static std::optional<std::string> resolve(VALUE host,
+                                          VALUE port,
+                                          int socktype,
+                                          sockaddr_storage& address,
+                                          socklen_t& length) {
+  std::string hostname = charly_string_std(host);
+  std::string service = std::to_string(charly_number_to_uint16(port));
+
+  addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = socktype;
+  hints.ai_flags = AI_NUMERICSERV | (hostname.size() ? 0 : AI_PASSIVE);
+
+  addrinfo* result = nullptr;
+  int status = getaddrinfo(hostname.size() ? hostname.c_str() : nullptr, service.c_str(), &hints, &result);
+  if (status != 0) {
+    return std::string(gai_strerror(status));
+  }
+
+  std::memcpy(&address, result->ai_addr, result->ai_addrlen);
+  length = result->ai_addrlen;
+  freeaddrinfo(result);
+  return std::nullopt;
+}
+
+static void format_address(const sockaddr_storage& address, std::string& host, uint16_t& port) {
+  char buffer[INET6_ADDRSTRLEN] = {};
+  if (address.ss_family == AF_INET6) {
+    const sockaddr_in6* ipv6 = reinterpret_cast<const sockaddr_in6*>(&address);
+    inet_ntop(AF_INET6, &ipv6->sin6_addr, buffer, sizeof(buffer));
+    port = ntohs(ipv6->sin6_port);
+  } else {
+    const sockaddr_in* ipv4 = reinterpret_cast<const sockaddr_in*>(&address);
+    inet_ntop(AF_INET, &ipv4->sin_addr, buffer, sizeof(buffer));
+    port = ntohs(ipv4->sin_port);
+  }
+  host = buffer;
+}
+
+// Queues the callback with an array containing the error message, or null, followed by the values
+//
+// The values have to be kept alive by the caller
+static void queue_callback(VM& vm, VALUE cb, const char* error, std::initializer_list<VALUE> values) {
+  if (!charly_is_function(cb)) {
+    return;
+  }
+
+  ManagedContext lalloc(vm);
+  Array* result = charly_as_array(lalloc.create_array(values.size() + 1));
+  result->data->push_back(error ? lalloc.create_string(error) : kNull);
+  for (VALUE value : values) {
+    result->data->push_back(value);
+  }
+
+  vm.register_task(VMTask(cb, charly_create_pointer(result)));
+}
+
+static Socket* find_socket(VM& vm, uint64_t id) {
+  auto it = vm.sockets.find(id);
+  return it != vm.sockets.end() ? &it->second : nullptr;
+}
+
+// Looks up the socket referenced by an argument, throws if there is none
+static Socket* socket_argument(VM& vm, VALUE id) {
+  Socket* socket = charly_is_number(id) ? find_socket(vm, charly_number_to_uint64(id)) : nullptr;
+  if (!socket) {
+    vm.throw_exception("Expected argument id to be an open socket");
+  }
+  return socket;
+}
+
+static uint64_t add_socket(VM& vm, Socket::Kind kind, int fd) {
+  uint64_t id = vm.next_socket_id++;
+  Socket& socket = vm.sockets[id];
+  socket.kind = kind;
+  socket.fd = fd;
+  return id;
+}
+
+// Registers the socket for the events it is currently interested in
+static void update_interest(VM& vm, uint64_t id, Socket& socket) {
+  bool readable = socket.kind == Socket::Kind::Listener || socket.on_read != kNull;
+  bool writable = socket.connecting || socket.writes.size() > 0;
+  if (readable == socket.watch_readable && writable == socket.watch_writable) {
+    return;
+  }
+
+  vm.event_loop.watch(socket.fd, id, readable, writable);
+  socket.watch_readable = readable;
+  socket.watch_writable = writable;
+}
+
+// Closes the socket, pending writes and connection attempts fail with the given error
+static void close_socket(VM& vm, uint64_t id, const char* error) {
+  Socket* socket = find_socket(vm, id);
+  if (!socket) {
+    return;
+  }
+
+  vm.event_loop.unwatch(socket->fd);
+  ::close(socket->fd);
+
+  if (socket->connecting) {
+    queue_callback(vm, socket->on_connect, error, {kNull});
+  }
+  for (Socket::PendingWrite& write : socket->writes) {
+    queue_callback(vm, write.cb, error, {});
+  }
+
+  vm.sockets.erase(id);
+}
+
+// Creates a socket for the resolved address, throws and returns -1 on failure
+static int open_socket(VM& vm, const char* operation, const sockaddr_storage& address, int socktype) {
+  int fd = ::socket(address.ss_family, socktype, 0);
+  if (fd < 0 || !prepare_fd(fd)) {
+    int error = errno;
+    if (fd >= 0) ::close(fd);
+    vm.throw_exception(std::string(operation) + ": " + std::strerror(error));
+    return -1;
+  }
+
+  return fd;
+}
+
+// Binds a new socket to the address, throws and returns -1 on failure
+static int bind_socket(VM& vm, const char* operation, VALUE host, VALUE port, int socktype) {
+  sockaddr_storage address;
+  socklen_t length;
+  if (auto error = resolve(host, port, socktype, address, length)) {
+    vm.throw_exception(std::string(operation) + ": " + error.value());
+    return -1;
+  }
+
+  int fd = open_socket(vm, operation, address, socktype);
+  if (fd < 0) {
+    return -1;
+  }
+
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (::bind(fd, reinterpret_cast<sockaddr*>(&address), length) != 0 ||
+      (socktype == SOCK_STREAM && ::listen(fd, SOMAXCONN) != 0)) {
+    int error = errno;
+    ::close(fd);
+    vm.throw_exception(std::string(operation) + ": " + std::strerror(error));
+    return -1;
+  }
+
+  return fd;
+}
+
+VALUE listen(VM& vm, VALUE host, VALUE port, VALUE cb) {
+  CHECK(string, host);
+  CHECK(number, port);
+  CHECK(function, cb);
+  if (!check_port(vm, "listen", port)) {
+    return kNull;
+  }
+
+  int fd = bind_socket(vm, "listen", host, port, SOCK_STREAM);
+  if (fd < 0) {
+    return kNull;
+  }
+
+  uint64_t id = add_socket(vm, Socket::Kind::Listener, fd);
+  Socket& socket = vm.sockets[id];
+  socket.on_connect = cb;
+  update_interest(vm, id, socket);
+  return charly_create_integer(id);
+}
+
+VALUE connect(VM& vm, VALUE host, VALUE port, VALUE cb) {
+  CHECK(string, host);
+  CHECK(number, port);
+  CHECK(function, cb);
+  if (!check_port(vm, "connect", port)) {
+    return kNull;
+  }
+
+  sockaddr_storage address;
+  socklen_t length;
+  if (auto error = resolve(host, port, SOCK_STREAM, address, length)) {
+    queue_callback(vm, cb, error.value().c_str(), {kNull});
+    return kNull;
+  }
+
+  int fd = open_socket(vm, "connect", address, SOCK_STREAM);
+  if (fd < 0) {
+    return kNull;
+  }
+  disable_nagle(fd);
+
+  uint64_t id = add_socket(vm, Socket::Kind::Stream, fd);
+  Socket& socket = vm.sockets[id];
+  if (::connect(fd, reinterpret_cast<sockaddr*>(&address), length) == 0) {
+    queue_callback(vm, cb, nullptr, {charly_create_integer(id)});
+    return charly_create_integer(id);
+  }
+
+  if (errno != EINPROGRESS) {
+    queue_callback(vm, cb, std::strerror(errno), {kNull});
+    close_socket(vm, id, nullptr);
+    return kNull;
+  }
+
+  socket.connecting = true;
+  socket.on_connect = cb;
+  update_interest(vm, id, socket);
+  return charly_create_integer(id);
+}
+
+VALUE udp_bind(VM& vm, VALUE host, VALUE port) {
+  CHECK(string, host);
+  CHECK(number, port);
+  if (!check_port(vm, "udp_bind", port)) {
+    return kNull;
+  }
+
+  int fd = bind_socket(vm, "udp_bind", host, port, SOCK_DGRAM);
+  if (fd < 0) {
+    return kNull;
+  }
+
+  return charly_create_integer(add_socket(vm, Socket::Kind::Datagram, fd));
+}
+
+VALUE read_start(VM& vm, VALUE id, VALUE cb) {
+  CHECK(function, cb);
+  Socket* socket = socket_argument(vm, id);
+  if (!socket) {
+    return kNull;
+  }
+
+  if (socket->kind == Socket::Kind::Listener) {
+    vm.throw_exception("Cannot read from a listening socket");
+    return kNull;
+  }
+
+  socket->on_read = cb;
+  update_interest(vm, charly_number_to_uint64(id), *socket);
+  return kNull;
+}
+
+VALUE read_stop(VM& vm, VALUE id) {
+  Socket* socket = socket_argument(vm, id);
+  if (!socket) {
+    return kNull;
+  }
+
+  socket->on_read = kNull;
+  update_interest(vm, charly_number_to_uint64(id), *socket);
+  return kNull;
+}
+
+// Reads the bytes of a string or buffer argument, throws if it is neither
+//
+// Immediate strings live inside the value itself, so it has to be passed by reference
+static bool data_argument(VM& vm, VALUE& data, const char*& bytes, size_t& size) {
+  if (charly_is_string(data)) {
+    bytes = charly_string_data(data);
+    size = charly_string_length(data);
+    return true;
+  }
+
+  if (UTF8Buffer* buffer = Buffer::lookup(data)) {
+    bytes = buffer->get_const_data();
+    size = buffer->get_writeoffset();
+    return true;
+  }
+
+  vm.throw_exception("Expected argument data to be a string or buffer");
+  return false;
+}
+
+VALUE write(VM& vm, VALUE id, VALUE data, VALUE cb) {
+  Socket* socket = socket_argument(vm, id);
+  if (!socket) {
+    return kNull;
+  }
+
+  if (socket->kind != Socket::Kind::Stream) {
+    vm.throw_exception("Can only write to connected sockets");
+    return kNull;
+  }
+
+  const char* bytes;
+  size_t size;
+  if (!data_argument(vm, data, bytes, size)) {
+    return kNull;
+  }
+
+  // Data is only copied if the kernel can't take all of it right away
+  size_t sent = 0;
+  if (!socket->connecting && socket->writes.size() == 0) {
+    ssize_t result = ::send(socket->fd, bytes, size, kSendFlags);
+    if (result < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+      queue_callback(vm, cb, std::strerror(errno), {});
+      return charly_create_integer(socket->pending_bytes);
+    }
+    sent = result > 0 ? result : 0;
+  }
+
+  if (sent == size) {
+    queue_callback(vm, cb, nullptr, {});
+    return charly_create_integer(socket->pending_bytes);
+  }
+
+  Socket::PendingWrite& write = socket->writes.emplace_back();
+  write.data.assign(bytes + sent, size - sent);
+  write.cb = cb;
+  socket->pending_bytes += write.data.size();
+  update_interest(vm, charly_number_to_uint64(id), *socket);
+  return charly_create_integer(socket->pending_bytes);
+}
+
+VALUE send_to(VM& vm, VALUE id, VALUE host, VALUE port, VALUE data, VALUE cb) {
+  CHECK(string, host);
+  CHECK(number, port);
+  if (!check_port(vm, "send_to", port)) {
+    return kNull;
+  }
+
+  Socket* socket = socket_argument(vm, id);
+  if (!socket) {
+    return kNull;
+  }
+
+  if (socket->kind != Socket::Kind::Datagram) {
+    vm.throw_exception("Can only send datagrams from udp sockets");
+    return kNull;
+  }
+
+  const char* bytes;
+  size_t size;
+  if (!data_argument(vm, data, bytes, size)) {
+    return kNull;
+  }
+
+  sockaddr_storage address;
+  socklen_t length;
+  if (auto error = resolve(host, port, SOCK_DGRAM, address, length)) {
+    queue_callback(vm, cb, error.value().c_str(), {});
+    return charly_create_integer(socket->pending_bytes);
+  }
+
+  if (socket->writes.size() == 0) {
+    ssize_t result = ::sendto(socket->fd, bytes, size, kSendFlags, reinterpret_cast<sockaddr*>(&address), length);
+    if (result >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+      queue_callback(vm, cb, result < 0 ? std::strerror(errno) : nullptr, {});
+      return charly_create_integer(socket->pending_bytes);
+    }
+  }
+
+  Socket::PendingWrite& write = socket->writes.emplace_back();
+  write.data.assign(bytes, size);
+  write.cb = cb;
+  write.address = address;
+  write.address_length = length;
+  socket->pending_bytes += size;
+  update_interest(vm, charly_number_to_uint64(id), *socket);
+  return charly_create_integer(socket->pending_bytes);
+}
+
+VALUE close(VM& vm, VALUE id) {
+  if (socket_argument(vm, id)) {
+    close_socket(vm, charly_number_to_uint64(id), "Socket closed");
+  }
+  return kNull;
+}
+
+VALUE address(VM& vm, VALUE id) {
+  Socket* socket = socket_argument(vm, id);
+  if (!socket) {
+    return kNull;
+  }
+
+  sockaddr_storage address = {};
+  socklen_t length = sizeof(address);
+  getsockname(socket->fd, reinterpret_cast<sockaddr*>(&address), &length);
+
+  std::string host;
+  uint16_t port;
+  format_address(address, host, port);
+
+  ManagedContext lalloc(vm);
+  Array* result = charly_as_array(lalloc.create_array(2));
+  result->data->push_back(lalloc.create_string(host));
+  result->data->push_back(charly_create_integer(port));
+  return charly_create_pointer(result);
+}
+
+static void accept_connections(VM& vm, Socket& listener) {
+  for (int i = 0; i < kAcceptBatchSize; i++) {
+    int fd = ::accept(listener.fd, nullptr, nullptr);
+    if (fd < 0) {
+      return;
+    }
+
+    if (!prepare_fd(fd)) {
+      ::close(fd);
+      continue;
+    }
+    disable_nagle(fd);
+
+    uint64_t client = add_socket(vm, Socket::Kind::Stream, fd);
+    queue_callback(vm, listener.on_connect, nullptr, {charly_create_integer(client)});
+  }
+}
+
+// Hands queued data to the kernel until it stops accepting more
+static void flush_writes(VM& vm, Socket& socket) {
+  while (socket.writes.size()) {
+    Socket::PendingWrite& write = socket.writes.front();
+    const char* bytes = write.data.data() + write.offset;
+    size_t remaining = write.data.size() - write.offset;
+
+    ssize_t result;
+    if (socket.kind == Socket::Kind::Datagram) {
+      result = ::sendto(socket.fd, bytes, remaining, kSendFlags, reinterpret_cast<sockaddr*>(&write.address),
+                        write.address_length);
+    } else {
+      result = ::send(socket.fd, bytes, remaining, kSendFlags);
+    }
+
+    if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return;
+    }
+
+    // Datagrams are sent as a whole or not at all
+    if (result >= 0 && socket.kind == Socket::Kind::Stream && static_cast<size_t>(result) < remaining) {
+      write.offset += result;
+      socket.pending_bytes -= result;
+      continue;
+    }
+
+    queue_callback(vm, write.cb, result < 0 ? std::strerror(errno) : nullptr, {});
+    socket.pending_bytes -= remaining;
+    socket.writes.pop_front();
+  }
+}
+
+static void finish_connect(VM& vm, uint64_t id, Socket& socket) {
+  int error = 0;
+  socklen_t length = sizeof(error);
+  getsockopt(socket.fd, SOL_SOCKET, SO_ERROR, &error, &length);
+
+  if (error) {
+    close_socket(vm, id, std::strerror(error));
+    return;
+  }
+
+  VALUE cb = socket.on_connect;
+  socket.connecting = false;
+  socket.on_connect = kNull;
+  queue_callback(vm, cb, nullptr, {charly_create_integer(id)});
+}
+
+static void read_data(VM& vm, Socket& socket) {
+  bool datagram = socket.kind == Socket::Kind::Datagram;
+  size_t capacity = datagram ? kMaxDatagramSize : kReadChunkSize;
+
+  // Data is received directly into the storage of the buffer passed to the callback
+  UTF8Buffer* buffer = new UTF8Buffer();
+  sockaddr_storage sender = {};
+  socklen_t sender_length = sizeof(sender);
+  ssize_t result =
+      ::recvfrom(socket.fd, buffer->reserve_tail(capacity), capacity, 0, reinterpret_cast<sockaddr*>(&sender), &sender_length);
+
+  if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    delete buffer;
+    return;
+  }
+
+  // Streams stop reading once they reach their end or fail
+  if (result < 0 || (result == 0 && !datagram)) {
+    delete buffer;
+    VALUE cb = socket.on_read;
+    socket.on_read = kNull;
+    queue_callback(vm, cb, result < 0 ? std::strerror(errno) : nullptr, {kNull});
+    return;
+  }
+
+  buffer->advance_writeoffset(result);
+
+  ManagedContext lalloc(vm);
+  VALUE data = lalloc.mark_in_gc(Buffer::wrap(vm, buffer));
+  if (!datagram) {
+    queue_callback(vm, socket.on_read, nullptr, {data});
+    return;
+  }
+
+  std::string host;
+  uint16_t port;
+  format_address(sender, host, port);
+  queue_callback(vm, socket.on_read, nullptr, {data, lalloc.create_string(host), charly_create_integer(port)});
+}
+
+void handle_events(VM& vm, std::vector<EventLoop::Event>& events) {
+  for (const EventLoop::Event& event : events) {
+
+    // Sockets might have been closed by an earlier event
+    Socket* socket = find_socket(vm, event.token);
+    if (!socket) {
+      continue;
+    }
+
+    if (socket->kind == Socket::Kind::Listener) {
+      accept_connections(vm, *socket);
+      continue;
+    }
+
+    if (event.writable) {
+      if (socket->connecting) {
+        finish_connect(vm, event.token, *socket);
+        socket = find_socket(vm, event.token);
+        if (!socket) {
+          continue;
+        }
+      }
+
+      flush_writes(vm, *socket);
+    }
+
+    if (event.readable && socket->on_read != kNull) {
+      read_data(vm, *socket);
+    }
+
+    update_interest(vm, event.token, *socket);
+  }
+
+  events.clear();
+}
+
+void close_all(VM& vm) {
+  for (auto& entry : vm.sockets) {
+    vm.event_loop.unwatch(entry.second.fd);
+    ::close(entry.second.fd);
+  }
+  vm.sockets.clear();
+}
+
+}  // namespace Net
+}  // namespace Internals
+}  // namespace Charly
@@ -0,0 +1,75 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <vector>
+
+#include "defines.h"
+#include "event-loop.h"
+#include "internals.h"
+
+#pragma once
+
+namespace Charly {
+namespace Internals {
+namespace Net {
+
+// Non-blocking TCP and UDP sockets
+//
+// Sockets are identified by integer ids. Callbacks are invoked on the main thread with an
+// array containing the error message, or null, and the result of the operation. Host names
+// are resolved synchronously, numeric addresses never block.
+//
+// Ports have to be integers between 0 and 65535, binding to port 0 selects a free port
+VALUE listen(VM& vm, VALUE host, VALUE port, VALUE cb);
+VALUE connect(VM& vm, VALUE host, VALUE port, VALUE cb);
+VALUE udp_bind(VM& vm, VALUE host, VALUE port);
+
+// Received data is passed to the callback as a Buffer, null signals the end of the stream
+//
+// Datagram callbacks also receive the address and port of the sender
+VALUE read_start(VM& vm, VALUE id, VALUE cb);
+VALUE read_stop(VM& vm, VALUE id);
+
+// Queues a string or buffer and returns the amount of bytes which could not be sent yet
+//
+// The callback is invoked once all data has been handed to the kernel
+VALUE write(VM& vm, VALUE id, VALUE data, VALUE cb);
+VALUE send_to(VM& vm, VALUE id, VALUE host, VALUE port, VALUE data, VALUE cb);
+
+VALUE close(VM& vm, VALUE id);
+
+// Returns an array containing the local address and port of a socket
+VALUE address(VM& vm, VALUE id);
+
+// Handles readiness events of sockets reported by the event loop, called on the main thread
+void handle_events(VM& vm, std::vector<EventLoop::Event>& events);
+
+// Closes all sockets of the VM without invoking any callbacks
+void close_all(VM& vm);
+
+}  // namespace Net
+}  // namespace Internals
+}  // namespace Charly
@@ -26,8 +26,10 @@
 
 #include <iostream>
 
+#include <algorithm>
 #include <cmath>
 #include <complex>
+#include <cstring>
 #include <random>
 #include "math.h"
 #include "vm.h"
@@ -45,10 +47,11 @@ VALUE insert(VM& vm, VALUE a, VALUE i, VALUE v) {
 
   Array* array = charly_as_array(a);
   int32_t index = charly_number_to_int32(i);
+  vm.write_barrier(a);
 
   // Insert at end of array
   if (static_cast<uint32_t>(index) == array->data->size()) {
-    array->data->push_back(v);
+    array->writable()->push_back(v);
     return charly_create_pointer(array);
   }
 
@@ -64,8 +67,8 @@ VALUE insert(VM& vm, VALUE a, VALUE i, VALUE v) {
   }
 
   // Insert the element into the array
-  auto it = array->data->begin();
-  array->data->insert(it + index, v);
+  ArrayStorage* data = array->writable();
+  data->insert(data->begin() + index, v);
 
   return charly_create_pointer(array);
 }
@@ -89,8 +92,8 @@ VALUE remove(VM& vm, VALUE a, VALUE i) {
   }
 
   // Insert the element into the array
-  auto it = array->data->begin();
-  array->data->erase(it + index);
+  ArrayStorage* data = array->writable();
+  data->erase(data->begin() + index);
 
   return charly_create_pointer(array);
 }
@@ -263,6 +266,188 @@ VALUE range(VM& vm, VALUE a, VALUE s, VALUE c) {
   return charly_create_pointer(new_array);
 }
 
+VALUE each(VM& vm, VALUE a, VALUE cb) {
+  CHECK(array, a);
+
+  // The array is read on every iteration, since the callback might modify it
+  Array* array = charly_as_array(a);
+  for (uint32_t i = 0; i < array->data->size(); i++) {
+    VALUE args[3] = {(*array->data)[i], charly_create_integer(i), a};
+    if (!vm.call_callback(cb, 3, args)) {
+      return kNull;
+    }
+  }
+
+  return a;
+}
+
+VALUE map(VM& vm, VALUE a, VALUE cb) {
+  CHECK(array, a);
+
+  Array* array = charly_as_array(a);
+
+  Charly::ManagedContext lalloc(vm);
+  Array* new_array = charly_as_array(lalloc.create_array(array->data->size()));
+
+  for (uint32_t i = 0; i < array->data->size(); i++) {
+    VALUE args[3] = {(*array->data)[i], charly_create_integer(i), a};
+    auto result = vm.call_callback(cb, 3, args);
+    if (!result) {
+      return kNull;
+    }
+
+    new_array->data->push_back(result.value());
+  }
+
+  return charly_create_pointer(new_array);
+}
+
+VALUE filter(VM& vm, VALUE a, VALUE cb) {
+  CHECK(array, a);
+
+  Array* array = charly_as_array(a);
+
+  Charly::ManagedContext lalloc(vm);
+  Array* new_array = charly_as_array(lalloc.create_array(array->data->size()));
+
+  for (uint32_t i = 0; i < array->data->size(); i++) {
+    VALUE value = (*array->data)[i];
+    VALUE args[3] = {value, charly_create_integer(i), a};
+    auto result = vm.call_callback(cb, 3, args);
+    if (!result) {
+      return kNull;
+    }
+
+    if (charly_truthyness(result.value())) {
+      new_array->data->push_back(value);
+    }
+  }
+
+  return charly_create_pointer(new_array);
+}
+
+VALUE reduce(VM& vm, VALUE a, VALUE cb, VALUE first) {
+  CHECK(array, a);
+
+  Array* array = charly_as_array(a);
+
+  // The intermediate result doesn't need to be marked, since it is passed
+  // to the callback before anything could be allocated
+  VALUE sum = first;
+
+  for (uint32_t i = 0; i < array->data->size(); i++) {
+    VALUE args[4] = {sum, (*array->data)[i], charly_create_integer(i), a};
+    auto result = vm.call_callback(cb, 4, args);
+    if (!result) {
+      return kNull;
+    }
+
+    sum = result.value();
+  }
+
+  return sum;
+}
+
+// Stable bottom-up merge sort
+//
+// Runs of kSortRunLength elements are sorted via insertion sort first. Unlike std::sort,
+// an inconsistent comparator can't cause reads outside of the array. The comparator returns
+// an empty optional if it threw an exception, which aborts the sort
+static constexpr size_t kSortRunLength = 16;
+template <typename F>
+static bool sort_values(std::vector<VALUE>& values, F&& less) {
+  size_t size = values.size();
+
+  for (size_t start = 0; start < size; start += kSortRunLength) {
+    size_t end = std::min(start + kSortRunLength, size);
+    for (size_t i = start + 1; i < end; i++) {
+      VALUE value = values[i];
+      size_t j = i;
+      while (j > start) {
+        std::optional<bool> result = less(value, values[j - 1]);
+        if (!result) return false;
+        if (!result.value()) break;
+        values[j] = values[j - 1];
+        j--;
+      }
+      values[j] = value;
+    }
+  }
+
+  std::vector<VALUE> buffer(size);
+  for (size_t width = kSortRunLength; width < size; width *= 2) {
+    for (size_t low = 0; low < size; low += 2 * width) {
+      size_t middle = std::min(low + width, size);
+      size_t high = std::min(low + 2 * width, size);
+      size_t left = low;
+      size_t right = middle;
+      size_t offset = low;
+
+      while (left < middle && right < high) {
+        std::optional<bool> result = less(values[right], values[left]);
+        if (!result) return false;
+        buffer[offset++] = result.value() ? values[right++] : values[left++];
+      }
+
+      while (left < middle) buffer[offset++] = values[left++];
+      while (right < high) buffer[offset++] = values[right++];
+    }
+
+    values.swap(buffer);
+  }
+
+  return true;
+}
+
+VALUE sort(VM& vm, VALUE a, VALUE cb) {
+  CHECK(array, a);
+
+  Array* array = charly_as_array(a);
+
+  // The elements are sorted inside the new array, so they stay reachable
+  // if the comparator modifies the source array
+  Charly::ManagedContext lalloc(vm);
+  Array* new_array = charly_as_array(lalloc.create_array(array->data->size()));
+  new_array->data->assign(array->data->begin(), array->data->end());
+
+  bool success;
+  if (charly_is_null(cb)) {
+    success = sort_values(*new_array->data, [&](VALUE left, VALUE right) -> std::optional<bool> {
+      // The < operator only compares the length of two strings, so strings are
+      // ordered by their bytes instead, which matches the order of their code points
+      if (charly_is_string(left) && charly_is_string(right)) {
+        uint32_t left_length = charly_string_length(left);
+        uint32_t right_length = charly_string_length(right);
+        int result = std::memcmp(charly_string_data(left), charly_string_data(right),
+                                 std::min(left_length, right_length));
+        return result < 0 || (result == 0 && left_length < right_length);
+      }
+
+      uint8_t* original_ip = vm.get_ip();
+      VALUE result = vm.lt(left, right);
+      if (vm.get_ip() != original_ip) {
+        return std::nullopt;
+      }
+      return charly_truthyness(result);
+    });
+  } else {
+    success = sort_values(*new_array->data, [&](VALUE left, VALUE right) -> std::optional<bool> {
+      VALUE args[2] = {left, right};
+      auto result = vm.call_callback(cb, 2, args);
+      if (!result) {
+        return std::nullopt;
+      }
+      return charly_truthyness(result.value());
+    });
+  }
+
+  if (!success) {
+    return kNull;
+  }
+
+  return charly_create_pointer(new_array);
+}
+
 }  // namespace Array
 }  // namespace Internals
 }  // namespace Charly
@@ -40,6 +40,11 @@ VALUE flatten(VM& vm, VALUE a);
 VALUE index(VM& vm, VALUE a, VALUE i, VALUE o);
 VALUE rindex(VM& vm, VALUE a, VALUE i, VALUE o);
 VALUE range(VM& vm, VALUE a, VALUE s, VALUE c);
+VALUE each(VM& vm, VALUE a, VALUE cb);
+VALUE map(VM& vm, VALUE a, VALUE cb);
+VALUE filter(VM& vm, VALUE a, VALUE cb);
+VALUE reduce(VM& vm, VALUE a, VALUE cb, VALUE first);
+VALUE sort(VM& vm, VALUE a, VALUE cb);
 
 }  // namespace PrimitiveArray
 }  // namespace Internals
@@ -0,0 +1,121 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "number.h"
+#include "vm.h"
+
+namespace Charly {
+namespace Internals {
+namespace PrimitiveNumber {
+
+// The loops below call the callback with the current counter as the only argument
+//
+// Integer ranges are iterated with a native integer counter, other ranges
+// step through doubles just like the counter of a loop written in charly would
+
+VALUE times(VM& vm, VALUE n, VALUE cb) {
+  CHECK(number, n);
+
+  if (charly_is_int(n)) {
+    int64_t count = charly_int_to_int64(n);
+    for (int64_t i = 0; i < count; i++) {
+      VALUE args[1] = {charly_create_integer(i)};
+      if (!vm.call_callback(cb, 1, args)) {
+        return kNull;
+      }
+    }
+
+    return kNull;
+  }
+
+  double count = charly_number_to_double(n);
+  for (double i = 0; i < count; i++) {
+    VALUE args[1] = {charly_create_number(i)};
+    if (!vm.call_callback(cb, 1, args)) {
+      return kNull;
+    }
+  }
+
+  return kNull;
+}
+
+VALUE upto(VM& vm, VALUE n, VALUE num, VALUE cb) {
+  CHECK(number, n);
+  CHECK(number, num);
+
+  if (charly_is_int(n) && charly_is_int(num)) {
+    int64_t end = charly_int_to_int64(num);
+    for (int64_t i = charly_int_to_int64(n); i <= end; i++) {
+      VALUE args[1] = {charly_create_integer(i)};
+      if (!vm.call_callback(cb, 1, args)) {
+        return kNull;
+      }
+    }
+
+    return n;
+  }
+
+  double end = charly_number_to_double(num);
+  for (double i = charly_number_to_double(n); i <= end; i++) {
+    VALUE args[1] = {charly_create_number(i)};
+    if (!vm.call_callback(cb, 1, args)) {
+      return kNull;
+    }
+  }
+
+  return n;
+}
+
+VALUE downto(VM& vm, VALUE n, VALUE num, VALUE cb) {
+  CHECK(number, n);
+  CHECK(number, num);
+
+  if (charly_is_int(n) && charly_is_int(num)) {
+    int64_t end = charly_int_to_int64(num);
+    for (int64_t i = charly_int_to_int64(n); i >= end; i--) {
+      VALUE args[1] = {charly_create_integer(i)};
+      if (!vm.call_callback(cb, 1, args)) {
+        return kNull;
+      }
+    }
+
+    return n;
+  }
+
+  double end = charly_number_to_double(num);
+  for (double i = charly_number_to_double(n); i >= end; i--) {
+    VALUE args[1] = {charly_create_number(i)};
+    if (!vm.call_callback(cb, 1, args)) {
+      return kNull;
+    }
+  }
+
+  return n;
+}
+
+}  // namespace PrimitiveNumber
+}  // namespace Internals
+}  // namespace Charly
@@ -25,7 +25,6 @@
  */
 
 #include <sstream>
-#include <algorithm>
 
 #include "string.h"
 #include "vm.h"
@@ -56,29 +55,30 @@ VALUE to_n(VM& vm, VALUE str) {
 VALUE ltrim(VM& vm, VALUE src) {
   CHECK(string, src);
 
-  std::string _str(charly_string_data(src), charly_string_length(src));
+  char* data = charly_string_data(src);
+  uint32_t length = charly_string_length(src);
+  uint32_t whitespace = UTF8::leading_whitespace(data, length);
+
   ManagedContext lalloc(vm);
-  _str.erase(0, _str.find_first_not_of(" \t\n\v\f\r"));
-  return lalloc.create_string(_str);
+  return lalloc.create_string(data + whitespace, length - whitespace);
 }
 
 VALUE rtrim(VM& vm, VALUE src) {
   CHECK(string, src);
 
-  std::string _str(charly_string_data(src), charly_string_length(src));
+  char* data = charly_string_data(src);
+  uint32_t length = charly_string_length(src);
+  uint32_t whitespace = UTF8::trailing_whitespace(data, length);
+
   ManagedContext lalloc(vm);
-  _str.erase(_str.find_last_not_of(" \t\n\v\f\r") + 1);
-  return lalloc.create_string(_str);
+  return lalloc.create_string(data, length - whitespace);
 }
 
 // TODO: Implement utf8 conversions
 VALUE lowercase(VM& vm, VALUE src) {
   CHECK(string, src);
   std::string _str(charly_string_data(src), charly_string_length(src));
-
-  std::transform(_str.begin(), _str.end(), _str.begin(), [](char c) {
-    return std::tolower(c, std::locale());
-  });
+  UTF8::ascii_lowercase(_str.data(), _str.size());
 
   ManagedContext lalloc(vm);
   return lalloc.create_string(_str);
@@ -88,10 +88,7 @@ VALUE lowercase(VM& vm, VALUE src) {
 VALUE uppercase(VM& vm, VALUE src) {
   CHECK(string, src);
   std::string _str(charly_string_data(src), charly_string_length(src));
-
-  std::transform(_str.begin(), _str.end(), _str.begin(), [](char c) {
-    return std::toupper(c, std::locale());
-  });
+  UTF8::ascii_uppercase(_str.data(), _str.size());
 
   ManagedContext lalloc(vm);
   return lalloc.create_string(_str);
@@ -24,8 +24,14 @@
  * SOFTWARE.
  */
 
+#include <algorithm>
 #include <sstream>
 #include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <string>
+#include <unordered_map>
+#include <vector>
 #include <time.h>
 
 #include "time.h"
@@ -42,6 +48,398 @@ namespace Time {
 using TimepointSystem = std::chrono::time_point<std::chrono::system_clock>;
 using TimepointSteady = std::chrono::time_point<std::chrono::steady_clock>;
 
+// Converting a timestamp into local time has to consult the timezone database
+//
+// Programs usually format many timestamps of the same second, so the broken-down
+// time of the most recently converted second is cached
+struct BrokenDownTime {
+  bool valid = false;
+  std::time_t second = 0;
+  std::tm tm;
+};
+
+static const std::tm& broken_down_time(int64_t ms, bool utc) {
+  static thread_local BrokenDownTime local_cache;
+  static thread_local BrokenDownTime utc_cache;
+
+  auto tp = std::chrono::system_clock::time_point(std::chrono::milliseconds(ms));
+  std::time_t time_obj = std::chrono::system_clock::to_time_t(tp);
+
+  BrokenDownTime& cache = utc ? utc_cache : local_cache;
+  if (!cache.valid || cache.second != time_obj) {
+    if (utc) {
+      gmtime_r(&time_obj, &cache.tm);
+    } else {
+      localtime_r(&time_obj, &cache.tm);
+    }
+    cache.valid = true;
+    cache.second = time_obj;
+  }
+
+  return cache.tm;
+}
+
+static const char* const kWeekdayNames[] = {"Sunday",   "Monday", "Tuesday", "Wednesday",
+                                            "Thursday", "Friday", "Saturday"};
+static const char* const kMonthNames[] = {"January", "February", "March",     "April",   "May",      "June",
+                                          "July",    "August",   "September", "October", "November", "December"};
+
+// A format string split into literal text and conversion specifiers
+//
+// The common specifiers are rendered and parsed directly, using the names of the C locale.
+// Specifiers the compiled format doesn't know, as well as specifiers with field widths or
+// modifiers, are rendered via strftime one at a time and make parse fall back to std::get_time.
+// Specifiers with flags are rendered via strftime too, but still parsed directly
+class CompiledFormat {
+public:
+  CompiledFormat(const std::string& format) : format(format) {
+    for (size_t i = 0; i < format.size(); i++) {
+      if (format[i] != '%' || i + 1 == format.size()) {
+        this->append_literal(format[i]);
+        continue;
+      }
+
+      // Flags, field widths and alternative representations are rendered by the C library
+      //
+      // Flags only change padding and case, so the specifier can still be parsed directly
+      size_t start = i;
+      size_t end = i + 1;
+      while (end < format.size() && CompiledFormat::is_flag(format[end])) end++;
+      size_t flags_end = end;
+      while (end < format.size() && format[end] >= '0' && format[end] <= '9') end++;
+      if (end < format.size() && (format[end] == 'E' || format[end] == 'O')) end++;
+      if (end > i + 1) {
+        end = std::min(end, format.size() - 1);
+        char specifier = format[end];
+        this->segments.push_back({format.substr(start, end - start + 1), specifier, true});
+        this->direct = this->direct && flags_end == end && CompiledFormat::is_direct(specifier);
+        i = end;
+        continue;
+      }
+
+      char specifier = format[++i];
+      if (specifier == '%') {
+        this->append_literal('%');
+      } else {
+        this->segments.push_back({format.substr(start, 2), specifier, false});
+        this->direct = this->direct && CompiledFormat::is_direct(specifier);
+      }
+    }
+  }
+
+  void render(const std::tm& tm, std::string& out) const {
+    for (const Segment& segment : this->segments) {
+      if (segment.specifier == 0) {
+        out += segment.text;
+        continue;
+      }
+
+      if (segment.prefixed) {
+        CompiledFormat::render_strftime(segment.text, tm, out);
+        continue;
+      }
+
+      switch (segment.specifier) {
+        case 'Y': out += std::to_string(tm.tm_year + 1900); break;
+        case 'C': CompiledFormat::render_number(out, (tm.tm_year + 1900) / 100, 2); break;
+        case 'y': CompiledFormat::render_number(out, (tm.tm_year + 1900) % 100, 2); break;
+        case 'm': CompiledFormat::render_number(out, tm.tm_mon + 1, 2); break;
+        case 'd': CompiledFormat::render_number(out, tm.tm_mday, 2); break;
+        case 'e': CompiledFormat::render_number(out, tm.tm_mday, 2, ' '); break;
+        case 'j': CompiledFormat::render_number(out, tm.tm_yday + 1, 3); break;
+        case 'H': CompiledFormat::render_number(out, tm.tm_hour, 2); break;
+        case 'I': CompiledFormat::render_number(out, tm.tm_hour % 12 ? tm.tm_hour % 12 : 12, 2); break;
+        case 'M': CompiledFormat::render_number(out, tm.tm_min, 2); break;
+        case 'S': CompiledFormat::render_number(out, tm.tm_sec, 2); break;
+        case 'u': CompiledFormat::render_number(out, tm.tm_wday ? tm.tm_wday : 7, 1); break;
+        case 'w': CompiledFormat::render_number(out, tm.tm_wday, 1); break;
+        case 'p': out += tm.tm_hour < 12 ? "AM" : "PM"; break;
+        case 'a': out.append(kWeekdayNames[tm.tm_wday], 3); break;
+        case 'A': out += kWeekdayNames[tm.tm_wday]; break;
+        case 'b':
+        case 'h': out.append(kMonthNames[tm.tm_mon], 3); break;
+        case 'B': out += kMonthNames[tm.tm_mon]; break;
+        case 'n': out += '\n'; break;
+        case 't': out += '\t'; break;
+        case 'F': {
+          out += std::to_string(tm.tm_year + 1900);
+          out += '-';
+          CompiledFormat::render_number(out, tm.tm_mon + 1, 2);
+          out += '-';
+          CompiledFormat::render_number(out, tm.tm_mday, 2);
+          break;
+        }
+        case 'T':
+        case 'R': {
+          CompiledFormat::render_number(out, tm.tm_hour, 2);
+          out += ':';
+          CompiledFormat::render_number(out, tm.tm_min, 2);
+          if (segment.specifier == 'T') {
+            out += ':';
+            CompiledFormat::render_number(out, tm.tm_sec, 2);
+          }
+          break;
+        }
+        case 'D': {
+          CompiledFormat::render_number(out, tm.tm_mon + 1, 2);
+          out += '/';
+          CompiledFormat::render_number(out, tm.tm_mday, 2);
+          out += '/';
+          CompiledFormat::render_number(out, (tm.tm_year + 1900) % 100, 2);
+          break;
+        }
+        default: CompiledFormat::render_strftime(segment.text, tm, out); break;
+      }
+    }
+  }
+
+  // Parsing stops at the first character which doesn't match the format
+  std::tm parse(const std::string& source) const {
+    std::tm tm = {};
+
+    if (!this->direct) {
+      std::istringstream(source) >> std::get_time(&tm, this->format.c_str());
+      return tm;
+    }
+
+    const char* pos = source.c_str();
+    for (const Segment& segment : this->segments) {
+      if (segment.specifier == 0) {
+        if (!CompiledFormat::parse_literal(pos, segment.text)) {
+          return tm;
+        }
+        continue;
+      }
+
+      if (!CompiledFormat::parse_specifier(pos, segment.specifier, tm)) {
+        return tm;
+      }
+    }
+
+    return tm;
+  }
+
+private:
+  // Text holds the literal or the whole conversion specification, the specifier is 0 for literals
+  //
+  // Specifications with flags, a field width or a modifier are prefixed and always rendered via strftime
+  struct Segment {
+    std::string text;
+    char specifier;
+    bool prefixed;
+  };
+
+  std::string format;
+  std::vector<Segment> segments;
+
+  // Set if every specifier can be parsed without std::get_time
+  bool direct = true;
+
+  inline void append_literal(char c) {
+    if (this->segments.size() && this->segments.back().specifier == 0) {
+      this->segments.back().text += c;
+    } else {
+      this->segments.push_back({std::string(1, c), 0, false});
+    }
+  }
+
+  static bool is_flag(char c) {
+    return c == '_' || c == '-' || c == '0' || c == '^' || c == '#';
+  }
+
+  static bool is_direct(char specifier) {
+    return std::strchr("YCymdejHIMSuwpaAbhBntFTRD", specifier) != nullptr;
+  }
+
+  static void render_number(std::string& out, int value, int width, char padding = '0') {
+    char buf[16];
+    int length = std::snprintf(buf, sizeof(buf), "%d", value);
+    for (int i = length; i < width; i++) {
+      out += padding;
+    }
+    out.append(buf, length);
+  }
+
+  static void render_strftime(const std::string& specification, const std::tm& tm, std::string& out) {
+    char buf[128];
+    size_t length = std::strftime(buf, sizeof(buf), specification.c_str(), &tm);
+    if (length > 0 || specification.size() <= 2) {
+      out.append(buf, length);
+      return;
+    }
+
+    // Wide field widths don't fit into the stack buffer
+    std::string wide(4096, '\0');
+    length = std::strftime(&wide[0], wide.size(), specification.c_str(), &tm);
+    out.append(wide.data(), length);
+  }
+
+  // Whitespace in the format matches any amount of whitespace in the source
+  static bool parse_literal(const char*& pos, const std::string& literal) {
+    for (char c : literal) {
+      if (std::isspace(static_cast<unsigned char>(c))) {
+        while (std::isspace(static_cast<unsigned char>(*pos))) pos++;
+        continue;
+      }
+
+      if (*pos != c) {
+        return false;
+      }
+      pos++;
+    }
+
+    return true;
+  }
+
+  static bool parse_number(const char*& pos, int digits, int min, int max, int& result) {
+    while (*pos == ' ') pos++;
+
+    int value = 0;
+    int count = 0;
+    while (count < digits && *pos >= '0' && *pos <= '9') {
+      value = value * 10 + (*pos++ - '0');
+      count++;
+    }
+
+    if (count == 0 || value < min || value > max) {
+      return false;
+    }
+
+    result = value;
+    return true;
+  }
+
+  // Matches a full or abbreviated weekday or month name, ignoring case
+  static bool parse_name(const char*& pos, const char* const* names, int count, int& result) {
+    for (int i = 0; i < count; i++) {
+      size_t full = std::strlen(names[i]);
+      size_t length = strncasecmp(pos, names[i], full) == 0 ? full : strncasecmp(pos, names[i], 3) == 0 ? 3 : 0;
+      if (length) {
+        pos += length;
+        result = i;
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  static bool parse_specifier(const char*& pos, char specifier, std::tm& tm) {
+    int value;
+    switch (specifier) {
+      case 'Y': {
+        if (!parse_number(pos, 4, 0, 9999, value)) return false;
+        tm.tm_year = value - 1900;
+        return true;
+      }
+      case 'C': {
+        if (!parse_number(pos, 2, 0, 99, value)) return false;
+        tm.tm_year = value * 100 + tm.tm_year % 100 - 1900;
+        return true;
+      }
+      case 'y': {
+        if (!parse_number(pos, 2, 0, 99, value)) return false;
+        tm.tm_year = value < 69 ? value + 100 : value;
+        return true;
+      }
+      case 'm': {
+        if (!parse_number(pos, 2, 1, 12, value)) return false;
+        tm.tm_mon = value - 1;
+        return true;
+      }
+      case 'd':
+      case 'e': return parse_number(pos, 2, 1, 31, tm.tm_mday);
+      case 'j': {
+        if (!parse_number(pos, 3, 1, 366, value)) return false;
+        tm.tm_yday = value - 1;
+        return true;
+      }
+      case 'H': return parse_number(pos, 2, 0, 23, tm.tm_hour);
+      case 'I': {
+        if (!parse_number(pos, 2, 1, 12, value)) return false;
+        tm.tm_hour = (tm.tm_hour >= 12 ? 12 : 0) + value % 12;
+        return true;
+      }
+      case 'M': return parse_number(pos, 2, 0, 59, tm.tm_min);
+      case 'S': return parse_number(pos, 2, 0, 60, tm.tm_sec);
+      case 'u': {
+        if (!parse_number(pos, 1, 1, 7, value)) return false;
+        tm.tm_wday = value % 7;
+        return true;
+      }
+      case 'w': return parse_number(pos, 1, 0, 6, tm.tm_wday);
+      case 'p': {
+        if (strncasecmp(pos, "AM", 2) == 0) {
+          tm.tm_hour %= 12;
+        } else if (strncasecmp(pos, "PM", 2) == 0) {
+          tm.tm_hour = tm.tm_hour % 12 + 12;
+        } else {
+          return false;
+        }
+        pos += 2;
+        return true;
+      }
+      case 'a':
+      case 'A': return parse_name(pos, kWeekdayNames, 7, tm.tm_wday);
+      case 'b':
+      case 'h':
+      case 'B': return parse_name(pos, kMonthNames, 12, tm.tm_mon);
+      case 'n':
+      case 't': {
+        while (std::isspace(static_cast<unsigned char>(*pos))) pos++;
+        return true;
+      }
+      case 'F': {
+        return parse_specifier(pos, 'Y', tm) && parse_literal(pos, "-") && parse_specifier(pos, 'm', tm) &&
+               parse_literal(pos, "-") && parse_specifier(pos, 'd', tm);
+      }
+      case 'T': {
+        return parse_specifier(pos, 'R', tm) && parse_literal(pos, ":") && parse_specifier(pos, 'S', tm);
+      }
+      case 'R': {
+        return parse_specifier(pos, 'H', tm) && parse_literal(pos, ":") && parse_specifier(pos, 'M', tm);
+      }
+      case 'D': {
+        return parse_specifier(pos, 'm', tm) && parse_literal(pos, "/") && parse_specifier(pos, 'd', tm) &&
+               parse_literal(pos, "/") && parse_specifier(pos, 'y', tm);
+      }
+    }
+
+    return false;
+  }
+};
+
+// Formats are compiled the first time they are used
+//
+// The cache is dropped once it holds kFormatCacheSize formats, so programs which build
+// their format strings dynamically don't grow it without bounds
+static constexpr size_t kFormatCacheSize = 64;
+static const CompiledFormat& compiled_format(VALUE fmt) {
+  static thread_local std::unordered_map<std::string, CompiledFormat> cache;
+
+  std::string format = charly_string_std(fmt);
+  auto it = cache.find(format);
+  if (it != cache.end()) {
+    return it->second;
+  }
+
+  if (cache.size() >= kFormatCacheSize) {
+    cache.clear();
+  }
+
+  return cache.emplace(format, CompiledFormat(format)).first->second;
+}
+
+static VALUE render(VM& vm, VALUE ts, VALUE fmt, bool utc) {
+  static thread_local std::string buffer;
+
+  buffer.clear();
+  compiled_format(fmt).render(broken_down_time(charly_number_to_int64(ts), utc), buffer);
+
+  Charly::ManagedContext lalloc(vm);
+  return lalloc.create_string(buffer);
+}
+
 VALUE system_clock_now(VM& vm) {
   (void)vm;
   TimepointSystem now = std::chrono::system_clock::now();
@@ -64,10 +462,7 @@ VALUE highres_now(VM& vm) {
 VALUE to_local(VM& vm, VALUE ts) {
   CHECK(number, ts);
 
-  int64_t ms = charly_number_to_int64(ts);
-  auto tp = std::chrono::system_clock::time_point(std::chrono::milliseconds(ms));
-  std::time_t time_obj = std::chrono::system_clock::to_time_t(tp);
-  std::tm tm = *(std::localtime(&time_obj));
+  const std::tm& tm = broken_down_time(charly_number_to_int64(ts), false);
 
   char buf[26] = {0};
   // std::strftime(buf, sizeof(buf), "Www Mmm dd hh:mm:ss yyyy", &tm);
@@ -80,10 +475,7 @@ VALUE to_local(VM& vm, VALUE ts) {
 VALUE to_utc(VM& vm, VALUE ts) {
   CHECK(number, ts);
 
-  int64_t ms = charly_number_to_int64(ts);
-  auto tp = std::chrono::system_clock::time_point(std::chrono::milliseconds(ms));
-  std::time_t time_obj = std::chrono::system_clock::to_time_t(tp);
-  std::tm tm = *(std::gmtime(&time_obj));
+  const std::tm& tm = broken_down_time(charly_number_to_int64(ts), true);
 
   char buf[26] = {0};
   // std::strftime(buf, sizeof(buf), "Www Mmm dd hh:mm:ss yyyy", &tm);
@@ -96,75 +488,20 @@ VALUE to_utc(VM& vm, VALUE ts) {
 VALUE fmt(VM& vm, VALUE ts, VALUE fmt) {
   CHECK(number, ts);
   CHECK(string, fmt);
-
-  // Get the timestamp
-  int64_t ms = charly_number_to_int64(ts);
-  auto tp = std::chrono::system_clock::time_point(std::chrono::milliseconds(ms));
-  std::time_t time_obj = std::chrono::system_clock::to_time_t(tp);
-  std::tm tm = *(std::localtime(&time_obj));
-
-  // Copy the format string into a local buffer
-  char* fmt_data = charly_string_data(fmt);
-  uint32_t fmt_length = charly_string_length(fmt);
-
-  // If our format is bigger than our pre-allocated local buffer we have
-  // to return with an error message
-  //
-  // We subtract 1 to allow space for the null terminator
-  char format_buf[256] = {0};
-  if (fmt_length > sizeof(format_buf) - 1) {
-    return kNull;
-  }
-  std::memcpy(format_buf, fmt_data, fmt_length);
-
-  char result_buf[26] = {0};
-  std::strftime(result_buf, sizeof(result_buf), format_buf, &tm);
-
-  Charly::ManagedContext lalloc(vm);
-  return lalloc.create_string(result_buf, strlen(result_buf));
+  return render(vm, ts, fmt, false);
 }
 
 VALUE fmtutc(VM& vm, VALUE ts, VALUE fmt) {
   CHECK(number, ts);
   CHECK(string, fmt);
-
-  // Get the timestamp
-  int64_t ms = charly_number_to_int64(ts);
-  auto tp = std::chrono::system_clock::time_point(std::chrono::milliseconds(ms));
-  std::time_t time_obj = std::chrono::system_clock::to_time_t(tp);
-  std::tm tm = *(std::gmtime(&time_obj));
-
-  // Copy the format string into a local buffer
-  char* fmt_data = charly_string_data(fmt);
-  uint32_t fmt_length = charly_string_length(fmt);
-
-  // If our format is bigger than our pre-allocated local buffer we have
-  // to return with an error message
-  //
-  // We subtract 1 to allow space for the null terminator
-  char format_buf[256] = {0};
-  if (fmt_length > sizeof(format_buf) - 1) {
-    return kNull;
-  }
-  std::memcpy(format_buf, fmt_data, fmt_length);
-
-  char result_buf[26] = {0};
-  std::strftime(result_buf, sizeof(result_buf), format_buf, &tm);
-
-  Charly::ManagedContext lalloc(vm);
-  return lalloc.create_string(result_buf, strlen(result_buf));
+  return render(vm, ts, fmt, true);
 }
 
 VALUE parse(VM& vm, VALUE src, VALUE fmt) {
   CHECK(string, src);
   CHECK(string, fmt);
 
-  // Copy source and format strings
-  std::string source_string(charly_string_data(src), charly_string_length(src));
-  std::string format_string(charly_string_data(fmt), charly_string_length(fmt));
-
-  std::tm tm = {};
-  std::istringstream(source_string) >> std::get_time(&tm, format_string.c_str());
+  std::tm tm = compiled_format(fmt).parse(charly_string_std(src));
   auto tp = std::chrono::system_clock::from_time_t(std::mktime(&tm));
   return charly_create_double(std::chrono::duration_cast<std::chrono::milliseconds>(tp.time_since_epoch()).count());
 }
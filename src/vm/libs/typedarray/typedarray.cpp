@@ -0,0 +1,170 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <string>
+
+#include "typedarray.h"
+#include "vm.h"
+#include "managedcontext.h"
+
+using namespace std;
+
+namespace Charly {
+namespace Internals {
+namespace TypedArray {
+
+static VALUE create(VM& vm, TypedArrayKind kind, VALUE length) {
+  CHECK(number, length);
+
+  double requested = charly_number_to_double(length);
+  if (!(requested >= 0 && requested <= kTypedArrayMaxLength) || requested != std::trunc(requested)) {
+    vm.throw_exception("Expected the length of a typed array to be an integer between 0 and " +
+                       std::to_string(kTypedArrayMaxLength));
+    return kNull;
+  }
+
+  Charly::TypedArray* array = Charly::TypedArray::create(kind, static_cast<uint32_t>(requested));
+  if (array == nullptr) {
+    vm.throw_exception("Could not allocate a typed array of length " + std::to_string(static_cast<uint32_t>(requested)));
+    return kNull;
+  }
+
+  ManagedContext lalloc(vm);
+  return lalloc.create_cpointer(array, reinterpret_cast<void*>(Charly::TypedArray::destructor));
+}
+
+VALUE create_float64(VM& vm, VALUE length) {
+  return create(vm, kTypedArrayFloat64, length);
+}
+
+VALUE create_int32(VM& vm, VALUE length) {
+  return create(vm, kTypedArrayInt32, length);
+}
+
+VALUE is_typedarray(VM&, VALUE array) {
+  return charly_is_typedarray(array) ? kTrue : kFalse;
+}
+
+VALUE fill(VM& vm, VALUE array, VALUE value) {
+  CHECK(typedarray, array);
+  CHECK(number, value);
+
+  Charly::TypedArray* arr = charly_as_typedarray(array);
+  if (arr->kind == kTypedArrayFloat64) {
+    std::fill(arr->f64, arr->f64 + arr->length, charly_number_to_double(value));
+  } else {
+    std::fill(arr->i32, arr->i32 + arr->length, Charly::TypedArray::to_int32(charly_number_to_double(value)));
+  }
+
+  return array;
+}
+
+// Copies as many elements as fit into the target, converting between element types
+VALUE copy(VM& vm, VALUE target, VALUE source) {
+  CHECK(typedarray, target);
+  CHECK(typedarray, source);
+
+  Charly::TypedArray* dst = charly_as_typedarray(target);
+  Charly::TypedArray* src = charly_as_typedarray(source);
+  uint32_t count = std::min(dst->length, src->length);
+
+  if (dst->kind == src->kind) {
+    std::memmove(dst->data, src->data, count * Charly::TypedArray::element_size(dst->kind));
+  } else if (dst->kind == kTypedArrayFloat64) {
+    std::copy(src->i32, src->i32 + count, dst->f64);
+  } else {
+    for (uint32_t i = 0; i < count; i++) {
+      dst->i32[i] = Charly::TypedArray::to_int32(src->f64[i]);
+    }
+  }
+
+  return charly_create_integer(count);
+}
+
+VALUE sum(VM& vm, VALUE array) {
+  CHECK(typedarray, array);
+
+  Charly::TypedArray* arr = charly_as_typedarray(array);
+  if (arr->kind == kTypedArrayFloat64) {
+    double result = 0;
+    for (uint32_t i = 0; i < arr->length; i++) {
+      result += arr->f64[i];
+    }
+    return charly_create_number(result);
+  }
+
+  int64_t result = 0;
+  for (uint32_t i = 0; i < arr->length; i++) {
+    result += arr->i32[i];
+  }
+  return charly_create_number(result);
+}
+
+// Arrays of different lengths are treated as if the longer one was truncated
+VALUE dot(VM& vm, VALUE left, VALUE right) {
+  CHECK(typedarray, left);
+  CHECK(typedarray, right);
+
+  Charly::TypedArray* l = charly_as_typedarray(left);
+  Charly::TypedArray* r = charly_as_typedarray(right);
+  uint32_t count = std::min(l->length, r->length);
+
+  if (l->kind == kTypedArrayInt32 && r->kind == kTypedArrayInt32) {
+    int64_t result = 0;
+    for (uint32_t i = 0; i < count; i++) {
+      result += static_cast<int64_t>(l->i32[i]) * r->i32[i];
+    }
+    return charly_create_number(result);
+  }
+
+  double result = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    double lv = l->kind == kTypedArrayFloat64 ? l->f64[i] : l->i32[i];
+    double rv = r->kind == kTypedArrayFloat64 ? r->f64[i] : r->i32[i];
+    result += lv * rv;
+  }
+  return charly_create_number(result);
+}
+
+VALUE to_a(VM& vm, VALUE array) {
+  CHECK(typedarray, array);
+
+  Charly::TypedArray* arr = charly_as_typedarray(array);
+  ManagedContext lalloc(vm);
+  Array* result = charly_as_array(lalloc.create_array(arr->length));
+  for (uint32_t i = 0; i < arr->length; i++) {
+    result->data->push_back(arr->read(i));
+  }
+
+  return charly_create_pointer(result);
+}
+
+}  // namespace TypedArray
+}  // namespace Internals
+}  // namespace Charly
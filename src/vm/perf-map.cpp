@@ -0,0 +1,83 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <mutex>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+#include "perf-map.h"
+
+namespace Charly::PerfMap {
+
+static std::mutex perf_map_mutex;
+static std::ofstream perf_map_file;
+static std::unordered_set<void* const*> registered_tables;
+
+static void write_symbol(const void* start, size_t size, const std::string& name) {
+  if (!perf_map_file.is_open()) {
+    perf_map_file.open("/tmp/perf-" + std::to_string(getpid()) + ".map", std::ios::app);
+  }
+
+  perf_map_file << std::hex << reinterpret_cast<uintptr_t>(start) << ' ' << size << std::dec << ' ' << name << '\n';
+}
+
+void add_symbol(const void* start, size_t size, const std::string& name) {
+  std::unique_lock<std::mutex> lk(perf_map_mutex);
+  write_symbol(start, size, name);
+  perf_map_file.flush();
+}
+
+void add_dispatch_table(void* const* table, const std::string* names, size_t count, const void* end,
+                        const std::string& prefix) {
+  std::unique_lock<std::mutex> lk(perf_map_mutex);
+  if (!registered_tables.insert(table).second) {
+    return;
+  }
+
+  std::vector<std::pair<uintptr_t, size_t>> handlers;
+  for (size_t i = 0; i < count; i++) {
+    handlers.emplace_back(reinterpret_cast<uintptr_t>(table[i]), i);
+  }
+  std::sort(handlers.begin(), handlers.end());
+
+  for (size_t i = 0; i < handlers.size(); i++) {
+    uintptr_t start = handlers[i].first;
+    uintptr_t next = i + 1 < handlers.size() ? handlers[i + 1].first : reinterpret_cast<uintptr_t>(end);
+    if (next <= start) {
+      continue;
+    }
+
+    write_symbol(reinterpret_cast<const void*>(start), next - start, prefix + names[handlers[i].second]);
+  }
+
+  perf_map_file.flush();
+}
+}  // namespace Charly::PerfMap
@@ -0,0 +1,127 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <algorithm>
+#include <iomanip>
+#include <unordered_set>
+
+#include "sampling-profiler.h"
+
+namespace Charly {
+
+void SamplingProfiler::start(std::chrono::microseconds interval) {
+  this->stop();
+  this->stopping = false;
+  this->timer = std::thread([this, interval]() {
+    std::unique_lock<std::mutex> lk(this->timer_mutex);
+    while (!this->timer_cv.wait_for(lk, interval, [this]() { return this->stopping; })) {
+      this->sample_requested.store(true, std::memory_order_relaxed);
+    }
+  });
+}
+
+void SamplingProfiler::stop() {
+  if (!this->timer.joinable())
+    return;
+
+  {
+    std::unique_lock<std::mutex> lk(this->timer_mutex);
+    this->stopping = true;
+  }
+  this->timer_cv.notify_all();
+  this->timer.join();
+  this->sample_requested.store(false, std::memory_order_relaxed);
+}
+
+void SamplingProfiler::clear() {
+  this->function_ids.clear();
+  this->function_names.clear();
+  this->stacks.clear();
+  this->samples = 0;
+}
+
+std::vector<ProfiledFunction> SamplingProfiler::functions() const {
+  std::vector<ProfiledFunction> functions;
+  for (const std::string& name : this->function_names) {
+    functions.push_back({name, 0, 0});
+  }
+
+  std::unordered_set<uint32_t> seen;
+  for (auto& [stack, count] : this->stacks) {
+    if (stack.size() == 0)
+      continue;
+
+    functions[stack.back()].self_samples += count;
+
+    // Recursive functions only count once towards the total of each sample
+    seen.clear();
+    for (uint32_t id : stack) {
+      if (seen.insert(id).second) {
+        functions[id].total_samples += count;
+      }
+    }
+  }
+
+  std::stable_sort(functions.begin(), functions.end(), [](const ProfiledFunction& l, const ProfiledFunction& r) {
+    return l.self_samples != r.self_samples ? l.self_samples > r.self_samples : l.total_samples > r.total_samples;
+  });
+
+  return functions;
+}
+
+void SamplingProfiler::write_collapsed(std::ostream& out) const {
+  for (auto& [stack, count] : this->stacks) {
+    for (size_t i = 0; i < stack.size(); i++) {
+      if (i > 0)
+        out << ';';
+      out << this->function_names[stack[i]];
+    }
+    out << ' ' << count << '\n';
+  }
+}
+
+void SamplingProfiler::write_summary(std::ostream& out, uint32_t count) const {
+  std::vector<ProfiledFunction> functions = this->functions();
+  auto percentage = [&](uint64_t part) { return this->samples ? 100.0 * part / this->samples : 0.0; };
+
+  std::ios_base::fmtflags previous_flags = out.flags();
+  std::streamsize previous_precision = out.precision();
+
+  out << "Sampling Profile (" << this->samples << " samples):" << '\n';
+  out << std::setw(10) << "self" << std::setw(9) << "self%" << std::setw(10) << "total" << std::setw(9) << "total%";
+  out << "  function" << '\n';
+  out << std::fixed << std::setprecision(2);
+  for (size_t i = 0; i < functions.size() && i < count; i++) {
+    const ProfiledFunction& function = functions[i];
+    out << std::setw(10) << function.self_samples << std::setw(9) << percentage(function.self_samples);
+    out << std::setw(10) << function.total_samples << std::setw(9) << percentage(function.total_samples);
+    out << "  " << function.name << '\n';
+  }
+
+  out.flags(previous_flags);
+  out.precision(previous_precision);
+}
+}  // namespace Charly
@@ -0,0 +1,77 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <cstring>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "static-assembler.h"
+#include "value.h"
+
+namespace Charly::StaticAssembler {
+
+const uint8_t* link_routine(const uint8_t* code,
+                            size_t size,
+                            const Relocation* relocations,
+                            size_t relocation_count,
+                            const void* const* natives) {
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  size_t mapping_size = (size + page_size - 1) / page_size * page_size;
+
+  // Fall back to the heap if no page could be mapped, the code just stays writable
+  uint8_t* memory = static_cast<uint8_t*>(
+      mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+  bool mapped = memory != MAP_FAILED;
+  if (!mapped) {
+    memory = new uint8_t[size];
+  }
+
+  std::memcpy(memory, code, size);
+  for (size_t i = 0; i < relocation_count; i++) {
+    const Relocation& relocation = relocations[i];
+    switch (relocation.kind) {
+      case RelocationKind::Symbol: {
+        VALUE symbol = charly_create_symbol(relocation.symbol, std::strlen(relocation.symbol));
+        std::memcpy(memory + relocation.offset, &symbol, sizeof(VALUE));
+        break;
+      }
+      case RelocationKind::Native: {
+        const void* pointer = natives[relocation.native_index];
+        std::memcpy(memory + relocation.offset, &pointer, sizeof(void*));
+        break;
+      }
+    }
+  }
+
+  if (mapped) {
+    mprotect(memory, mapping_size, PROT_READ);
+  }
+
+  return memory;
+}
+}  // namespace Charly::StaticAssembler
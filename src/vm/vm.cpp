@@ -25,21 +25,28 @@
  */
 
 #include <algorithm>
+#include <array>
 #include <cmath>
 #include <functional>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
 #include <thread>
-#include <random>
 
 #include <utf8/utf8.h>
 
 #include "gc.h"
 #include "managedcontext.h"
+#include "perf-map.h"
 #include "status.h"
+#include "static-assembler.h"
+#include "typed-array.h"
 #include "vm.h"
 
+#include "libs/fs/fs.h"
+#include "libs/isolate/isolate.h"
+#include "libs/net/net.h"
+
 namespace Charly {
 
 Frame* VM::pop_frame() {
@@ -50,42 +57,65 @@ Frame* VM::pop_frame() {
 }
 
 Frame* VM::create_frame(VALUE self, Function* function, uint8_t* return_address, bool halt_after_return) {
-  MemoryCell* cell = this->gc.allocate();
-  cell->basic.type = kTypeFrame;
-  cell->frame.parent = this->frames;
-  cell->frame.parent_environment_frame = function->context;
-  cell->frame.last_active_catchtable = this->catchstack;
-  cell->frame.caller_value = charly_create_pointer(function);
-  cell->frame.stacksize_at_entry = 0;  // set by call_generator
-  cell->frame.self = self;
-  cell->frame.return_address = return_address;
-  cell->frame.set_halt_after_return(halt_after_return);
 
   // Calculate the number of local variables this frame has to support
   uint32_t lvarcount = function->lvarcount;
 
+  // Frames are bump-allocated from the frame stack. Locals of frames which don't
+  // fit into the inline storage are placed directly after the frame.
+  // If the frame stack is exhausted, the frame is allocated inside the GC heap
+  size_t frame_size = sizeof(Frame);
+  if (lvarcount > kSmallFrameLocalCount) {
+    frame_size += sizeof(VALUE) * lvarcount;
+  }
+
+  Frame* frame;
+  if (this->frame_stack_top + frame_size <= this->frame_stack_end) {
+    frame = reinterpret_cast<Frame*>(this->frame_stack_top);
+    this->frame_stack_top += frame_size;
+    frame->basic = Basic();
+    frame->stack_allocated = true;
+  } else {
+    frame = this->gc.allocate<Frame>()->as<Frame>();
+    frame->stack_allocated = false;
+  }
+
+  frame->basic.type = kTypeFrame;
+  frame->parent = this->frames;
+  frame->parent_environment_frame = function->context;
+  frame->build_display();
+  frame->caller_value = charly_create_pointer(function);
+  frame->stacksize_at_entry = this->stack.size();
+  frame->self = self;
+  frame->return_address = return_address;
+  frame->set_halt_after_return(halt_after_return);
+
   // Allocate and prefill local variable space
   if (lvarcount <= kSmallFrameLocalCount) {
-    cell->frame.senv.lvarcount = lvarcount;
-    cell->frame.set_smallframe(true);
+    frame->senv.lvarcount = lvarcount;
+    frame->set_smallframe(true);
 
     while (lvarcount--)
-      cell->frame.senv.data[lvarcount] = kNull;
+      frame->senv.data[lvarcount] = kNull;
+  } else if (frame->stack_allocated) {
+    frame->xenv.data = reinterpret_cast<VALUE*>(frame + 1);
+    frame->xenv.lvarcount = lvarcount;
+    std::fill_n(frame->xenv.data, lvarcount, kNull);
   } else {
-    cell->frame.lenv = new std::vector<VALUE>(lvarcount, kNull);
+    frame->lenv = new std::vector<VALUE>(lvarcount, kNull);
   }
 
   // Append the frame
-  this->frames = cell->as<Frame>();
+  this->frames = frame;
 
   // Print the frame if the corresponding flag was set
   if (this->context.trace_frames) {
     this->context.err_stream << "Entering frame: ";
-    this->pretty_print(this->context.err_stream, cell->as_value());
+    this->pretty_print(this->context.err_stream, charly_create_pointer(frame));
     this->context.err_stream << '\n';
   }
 
-  return cell->as<Frame>();
+  return frame;
 }
 
 Frame* VM::create_frame(VALUE self,
@@ -93,13 +123,14 @@ Frame* VM::create_frame(VALUE self,
                         uint32_t lvarcount,
                         uint8_t* return_address,
                         bool halt_after_return) {
-  MemoryCell* cell = this->gc.allocate();
+  MemoryCell* cell = this->gc.allocate<Frame>();
   cell->basic.type = kTypeFrame;
   cell->frame.parent = this->frames;
   cell->frame.parent_environment_frame = parent_environment_frame;
-  cell->frame.last_active_catchtable = this->catchstack;
+  cell->frame.build_display();
   cell->frame.caller_value = kNull;
-  cell->frame.stacksize_at_entry = 0;  // set by call_generator
+  cell->frame.stacksize_at_entry = this->stack.size();
+  cell->frame.stack_allocated = false;
   cell->frame.self = self;
   cell->frame.return_address = return_address;
   cell->frame.set_halt_after_return(halt_after_return);
@@ -127,118 +158,162 @@ Frame* VM::create_frame(VALUE self,
   return cell->as<Frame>();
 }
 
-VALUE VM::pop_stack() {
-  VALUE val = kNull;
-
-  if (this->stack.size() > 0) {
-    val = this->stack.back();
-    this->stack.pop_back();
+Frame* VM::capture_current_frame() {
+  Frame* frame = this->frames;
+  if (frame == nullptr || !frame->stack_allocated) {
+    return frame;
   }
 
-  return val;
+  // Copy the frame into a heap cell
+  //
+  // The stack frame stays valid during the allocation, so a collection
+  // triggered here still sees it via the frame chain
+  MemoryCell* cell = this->gc.allocate<Frame>();
+  cell->frame = *frame;
+  cell->frame.basic.mark = false;
+  cell->frame.stack_allocated = false;
+  if (!frame->is_smallframe()) {
+    cell->frame.lenv = new std::vector<VALUE>(frame->xenv.data, frame->xenv.data + frame->xenv.lvarcount);
+  }
+
+  // The frame was the youngest one on the frame stack, so its memory
+  // can be reused right away
+  this->frames = cell->as<Frame>();
+  this->frame_stack_top = reinterpret_cast<uint8_t*>(frame);
+
+  return this->frames;
 }
 
-void VM::push_stack(VALUE value) {
-  this->stack.push_back(value);
+Frame* VM::create_environment_frame(Frame* parent_environment_frame, uint32_t lvarcount) {
+  Frame* frame = this->create_frame(kNull, parent_environment_frame, lvarcount, nullptr);
+  this->frames = frame->parent;
+  frame->parent = nullptr;
+  return frame;
 }
 
-CatchTable* VM::create_catchtable(uint8_t* address) {
-  MemoryCell* cell = this->gc.allocate();
-  cell->basic.type = kTypeCatchTable;
-  cell->catchtable.stacksize = this->stack.size();
-  cell->catchtable.frame = this->frames;
-  cell->catchtable.parent = this->catchstack;
-  cell->catchtable.address = address;
-  this->catchstack = cell->as<CatchTable>();
+void VM::release_frame(Frame* frame) {
 
-  // Print the catchtable if the corresponding flag was set
-  if (this->context.trace_catchtables) {
-    this->context.err_stream << "Entering catchtable: ";
-    this->pretty_print(this->context.err_stream, cell->as_value());
-    this->context.err_stream << '\n';
-  }
+  // Frames kept alive by closures or generators shouldn't reference
+  // frames which have already been left
+  frame->parent = nullptr;
 
-  return cell->as<CatchTable>();
+  // Frames are always left in the reverse order they were entered in,
+  // so all frames above this one are dead too
+  if (frame->stack_allocated) {
+    this->frame_stack_top = reinterpret_cast<uint8_t*>(frame);
+  }
 }
 
-CatchTable* VM::pop_catchtable() {
-  if (!this->catchstack) {
-    this->context.err_stream << "No catchtable registered" << '\n';
-    this->context.err_stream << "Last exception thrown: ";
-    this->to_s(this->context.err_stream, this->last_exception_thrown);
-    this->context.err_stream << '\n';
-    this->panic(Status::CatchStackEmpty);
+uint8_t* VM::call_site_address(Frame* frame) {
+  // Frames which halt the machine after returning store the address of the calling
+  // instruction as their return address, all others store the address of the following instruction
+  uint8_t* address = frame->return_address;
+  if (address && (charly_is_generator(frame->caller_value) || !frame->halt_after_return())) {
+    address--;
   }
-  CatchTable* current = this->catchstack;
-  this->catchstack = current->parent;
 
-  return current;
+  return address;
 }
 
-void VM::unwind_catchstack() {
-  CatchTable* table = this->pop_catchtable();
+std::optional<uint8_t*> VM::find_exception_handler(uint8_t* address) {
+  InstructionBlock* block = this->context.compiler_manager.address_mapping.resolve_block(address);
+  if (block == nullptr) {
+    return std::nullopt;
+  }
+
+  std::optional<uint32_t> handler = block->find_exception_handler(address - block->get_data());
+  if (!handler) {
+    return std::nullopt;
+  }
+
+  return block->get_data() + handler.value();
+}
 
-  // Walk the frame tree until we reach the frame stored in the catchtable
-  while (this->frames) {
-    if (this->frames == table->frame) {
+void VM::unwind_to_handler() {
+  // Search the frame chain for the innermost handler protecting the current instruction
+  //
+  // For frames below the current one, the instruction that performed the call is looked up
+  Frame* frame = this->frames;
+  uint8_t* address = this->ip;
+  std::optional<uint8_t*> handler;
+  while (frame) {
+    handler = this->find_exception_handler(address);
+    if (handler) {
       break;
-    } else {
-      if (this->frames->halt_after_return()) {
-        this->halted = true;
-      }
+    }
 
-      // If this frame was created by a generator, we need to switch the catchtable to the one
-      // stored inside the frame. The catchtables stored inside the generator are only valid inside the
-      // generator itself
-      if (charly_is_generator(this->frames->caller_value)) {
-        Generator* generator = charly_as_generator(this->frames->caller_value);
-        table = generator->context_frame->last_active_catchtable;
-      }
+    address = this->call_site_address(frame);
+    frame = frame->parent;
+  }
+
+  if (!handler) {
+    this->flush_output();
+    this->context.err_stream << "Uncaught exception" << '\n';
+    this->context.err_stream << "Last exception thrown: ";
+    this->to_s(this->context.err_stream, this->last_exception_thrown);
+    this->context.err_stream << '\n';
+    this->panic(Status::UncaughtException);
+  }
+
+  // Leave all frames above the one containing the handler
+  while (this->frames != frame) {
+    Frame* current = this->frames;
+    if (current->halt_after_return()) {
+      this->halted = true;
     }
 
-    this->frames = this->frames->parent;
+    if (charly_is_generator(current->caller_value)) {
+      this->leave_generator_stack(charly_as_generator(current->caller_value));
+    }
+
+    this->frames = current->parent;
+    this->release_frame(current);
   }
 
-  // Jump to the handler block of the catchtable
-  this->ip = table->address;
+  // Jump to the handler block
+  this->ip = handler.value();
 
-  // Show the catchtable we just restored if the corresponding flag was set
+  // Show the handler we just jumped to if the corresponding flag was set
   if (this->context.trace_catchtables) {
-    // Show the table we've restored
-    this->context.err_stream << "Restored CatchTable: ";
-    this->pretty_print(this->context.err_stream, charly_create_pointer(table));
+    this->context.err_stream << "Entering exception handler: ";
+    this->context.err_stream << reinterpret_cast<void*>(this->ip);
     this->context.err_stream << '\n';
   }
 
-  // If there are less elements on the stack than there were when the table was pushed
-  // that means that the stack is not in a predictable state anymore
+  // If there are less elements on the stack than there were when the frame
+  // was entered, the stack is not in a predictable state anymore
   // There is nothing we can do, but crash
-  if (this->stack.size() < table->stacksize) {
+  if (this->stack.size() < frame->stacksize_at_entry) {
     this->panic(Status::CorruptedStack);
   }
 
-  // Unwind the stack to be the size it was when this catchtable
-  // was pushed. Because the stack could be smaller, we need to
-  // calculate the amount of values we can pop
-  size_t popcount = this->stack.size() - table->stacksize;
-  while (popcount--) {
-    this->stack.pop_back();
-  }
+  // Try statements only appear at the statement level, where the stack of
+  // a frame is empty
+  this->stack.resize(frame->stacksize_at_entry);
 }
 
 VALUE VM::create_object(uint32_t initial_capacity) {
-  MemoryCell* cell = this->gc.allocate();
+  MemoryCell* cell = this->gc.allocate<Object>();
   cell->basic.type = kTypeObject;
   cell->object.klass = this->primitive_object;
-  cell->object.container = new std::unordered_map<VALUE, VALUE>();
-  cell->object.container->reserve(initial_capacity);
+  cell->object.set_prototype(false);
+  cell->object.shape = this->root_shape;
+  cell->object.overflow_slots = nullptr;
+  cell->object.container = nullptr;
+
+  // Objects which are going to hold a lot of properties are
+  // created in dictionary mode right away
+  if (initial_capacity > kShapeMaxSlotCount) {
+    cell->object.make_dictionary(initial_capacity);
+  }
+
   return cell->as_value();
 }
 
 VALUE VM::create_array(uint32_t initial_capacity) {
-  MemoryCell* cell = this->gc.allocate();
+  MemoryCell* cell = this->gc.allocate<Array>();
   cell->basic.type = kTypeArray;
-  cell->array.data = new std::vector<VALUE>();
+  cell->array.data = new ArrayStorage();
   cell->array.data->reserve(initial_capacity);
   return cell->as_value();
 }
@@ -248,8 +323,10 @@ VALUE VM::create_string(const char* data, uint32_t length) {
     return charly_create_istring(data, length);
 
   // Check if we can create a short string
-  MemoryCell* cell = this->gc.allocate();
+  MemoryCell* cell = this->gc.allocate<String>();
   cell->basic.type = kTypeString;
+  cell->string.symbol = 0;
+  cell->string.utf8_length = kUTF8LengthUnknown;
 
   if (length <= kShortStringMaxSize) {
     // Copy the string into the cell itself
@@ -265,6 +342,8 @@ VALUE VM::create_string(const char* data, uint32_t length) {
     cell->string.set_shortstring(false);
     cell->string.lbuf.data = copied_string;
     cell->string.lbuf.length = length;
+    cell->string.lbuf.buffer = nullptr;
+    cell->string.lbuf.memory = nullptr;
   }
 
   return cell->as_value();
@@ -275,8 +354,10 @@ VALUE VM::create_string(const std::string& str) {
     return charly_create_istring(str.c_str(), str.size());
 
   // Check if we can create a short string
-  MemoryCell* cell = this->gc.allocate();
+  MemoryCell* cell = this->gc.allocate<String>();
   cell->basic.type = kTypeString;
+  cell->string.symbol = 0;
+  cell->string.utf8_length = kUTF8LengthUnknown;
 
   if (str.size() <= kShortStringMaxSize) {
     // Copy the string into the cell itself
@@ -292,23 +373,67 @@ VALUE VM::create_string(const std::string& str) {
     cell->string.set_shortstring(false);
     cell->string.lbuf.data = copied_string;
     cell->string.lbuf.length = str.size();
+    cell->string.lbuf.buffer = nullptr;
+    cell->string.lbuf.memory = nullptr;
   }
 
   return cell->as_value();
 }
 
 VALUE VM::create_weak_string(char* data, uint32_t length) {
-  MemoryCell* cell = this->gc.allocate();
+  MemoryCell* cell = this->gc.allocate<String>();
+  cell->basic.type = kTypeString;
+  cell->string.symbol = 0;
+  cell->string.utf8_length = kUTF8LengthUnknown;
+  cell->string.set_shortstring(false);
+  cell->string.lbuf.data = data;
+  cell->string.lbuf.length = length;
+  cell->string.lbuf.buffer = nullptr;
+  cell->string.lbuf.memory = nullptr;
+  return cell->as_value();
+}
+
+VALUE VM::create_buffered_string(StringBuffer* buffer, uint32_t length) {
+  // The allocation might free the last string referencing the buffer
+  buffer->retain();
+
+  MemoryCell* cell = this->gc.allocate<String>();
+  cell->basic.type = kTypeString;
+  cell->string.symbol = 0;
+  cell->string.utf8_length = kUTF8LengthUnknown;
+  cell->string.set_shortstring(false);
+  cell->string.lbuf.data = buffer->data();
+  cell->string.lbuf.length = length;
+  cell->string.lbuf.buffer = buffer;
+  cell->string.lbuf.memory = nullptr;
+  return cell->as_value();
+}
+
+VALUE VM::create_string_view(SharedMemory* memory, char* data, uint32_t length) {
+  if (length <= kShortStringMaxSize) {
+    return this->create_string(data, length);
+  }
+
+  // The allocation might free the last reference to the memory
+  memory->retain();
+
+  MemoryCell* cell = this->gc.allocate<String>();
   cell->basic.type = kTypeString;
+  cell->string.symbol = 0;
+  cell->string.utf8_length = kUTF8LengthUnknown;
   cell->string.set_shortstring(false);
   cell->string.lbuf.data = data;
   cell->string.lbuf.length = length;
+  cell->string.lbuf.buffer = nullptr;
+  cell->string.lbuf.memory = memory;
   return cell->as_value();
 }
 
 VALUE VM::create_empty_short_string() {
-  MemoryCell* cell = this->gc.allocate();
+  MemoryCell* cell = this->gc.allocate<String>();
   cell->basic.type = kTypeString;
+  cell->string.symbol = 0;
+  cell->string.utf8_length = kUTF8LengthUnknown;
   cell->string.set_shortstring(true);
   cell->string.sbuf.length = 0;
   return cell->as_value();
@@ -318,65 +443,69 @@ VALUE VM::create_function(VALUE name,
                           uint8_t* body_address,
                           uint32_t argc,
                           uint32_t lvarcount,
+                          uint32_t max_stack_depth,
                           bool anonymous,
                           bool needs_arguments) {
-  MemoryCell* cell = this->gc.allocate();
+  Frame* context = this->capture_current_frame();
+  MemoryCell* cell = this->gc.allocate<Function>();
   cell->basic.type = kTypeFunction;
   cell->function.name = name;
   cell->function.argc = argc;
   cell->function.lvarcount = lvarcount;
-  cell->function.context = this->frames;
+  cell->function.context = context;
   cell->function.body_address = body_address;
+  cell->function.max_stack_depth = max_stack_depth;
   cell->function.set_anonymous(anonymous);
   cell->function.set_needs_arguments(needs_arguments);
   cell->function.bound_self_set = false;
   cell->function.bound_self = kNull;
-  cell->function.container = new std::unordered_map<VALUE, VALUE>();
+  cell->function.container = nullptr;
   return cell->as_value();
 }
 
-VALUE VM::create_cfunction(VALUE name, uint32_t argc, void* pointer) {
-  MemoryCell* cell = this->gc.allocate();
+VALUE VM::create_cfunction(VALUE name, uint32_t argc, void* pointer, CFunctionThunk thunk) {
+  MemoryCell* cell = this->gc.allocate<CFunction>();
   cell->basic.type = kTypeCFunction;
   cell->cfunction.name = name;
   cell->cfunction.pointer = pointer;
+  cell->cfunction.thunk = thunk;
   cell->cfunction.argc = argc;
-  cell->cfunction.container = new std::unordered_map<VALUE, VALUE>();
+  cell->cfunction.container = nullptr;
   return cell->as_value();
 }
 
-VALUE VM::create_generator(VALUE name, uint8_t* resume_address) {
-  MemoryCell* cell = this->gc.allocate();
+VALUE VM::create_generator(VALUE name, uint8_t* resume_address, uint32_t max_stack_depth) {
+  Frame* context = this->capture_current_frame();
+  MemoryCell* cell = this->gc.allocate<Generator>();
   cell->basic.type = kTypeGenerator;
   cell->generator.name = name;
-  cell->generator.context_frame = this->frames;
-  cell->generator.context_catchtable = this->catchstack;
-  cell->generator.context_stack = new std::vector<VALUE>();
+  cell->generator.context_frame = context;
+  cell->generator.context_stack = new OperandStack();
   cell->generator.resume_address = resume_address;
-  cell->generator.owns_catchtable = false;
+  cell->generator.max_stack_depth = max_stack_depth;
   cell->generator.running = false;
   cell->generator.set_finished(false);
   cell->generator.set_started(false);
   cell->generator.bound_self_set = false;
   cell->generator.bound_self = kNull;
-  cell->generator.container = new std::unordered_map<VALUE, VALUE>();
+  cell->generator.container = nullptr;
   return cell->as_value();
 }
 
 VALUE VM::create_class(VALUE name) {
-  MemoryCell* cell = this->gc.allocate();
+  MemoryCell* cell = this->gc.allocate<Class>();
   cell->basic.type = kTypeClass;
   cell->klass.name = name;
   cell->klass.constructor = kNull;
   cell->klass.member_properties = new std::vector<VALUE>();
   cell->klass.prototype = kNull;
   cell->klass.parent_class = kNull;
-  cell->klass.container = new std::unordered_map<VALUE, VALUE>();
+  cell->klass.container = nullptr;
   return cell->as_value();
 }
 
 VALUE VM::create_cpointer(void* data, void* destructor) {
-  MemoryCell* cell = this->gc.allocate();
+  MemoryCell* cell = this->gc.allocate<CPointer>();
   cell->basic.type = kTypeCPointer;
   cell->cpointer.data = data;
   cell->cpointer.destructor = destructor;
@@ -394,11 +523,17 @@ VALUE VM::create_symbol(VALUE value) {
     case kTypeCPointer: {
       return charly_create_symbol("<" + charly_get_typestring(value) + ">");
     }
+
+    // Heap strings cache their symbol, so registering a known key is a single lookup
+    case kTypeString: {
+      VALUE symbol = charly_create_symbol(value);
+      return this->context.symtable.register_symbol(symbol, charly_string_data(value), charly_string_length(value));
+    }
   }
 
-  std::stringstream buffer;
-  this->to_s(buffer, value);
-  return this->context.symtable(buffer.str());
+  this->format_buffer.clear();
+  this->to_s(this->format_buffer, value);
+  return this->context.symtable(std::string(this->format_buffer.data(), this->format_buffer.size()));
 }
 
 VALUE VM::copy_value(VALUE value) {
@@ -429,20 +564,47 @@ VALUE VM::deep_copy_value(VALUE value) {
 
 VALUE VM::copy_object(VALUE object) {
   Object* source = charly_as_object(object);
-  Object* target = charly_as_object(this->create_object(source->container->size()));
-  target->container->insert(source->container->begin(), source->container->end());
+  Object* target = charly_as_object(this->create_object(0));
+  target->klass = source->klass;
+
+  // Dictionaries are shared until either object is modified
+  if (source->is_dictionary()) {
+    target->shape = nullptr;
+    target->container = source->container->retain();
+    return charly_create_pointer(target);
+  }
+
+  // Shapes are immutable, so only the slots have to be copied
+  target->shape = source->shape;
+  std::copy(source->inline_slots, source->inline_slots + kObjectInlineSlotCount, target->inline_slots);
+  if (source->overflow_slots) {
+    target->overflow_slots = new std::vector<VALUE>(*source->overflow_slots);
+  }
+
   return charly_create_pointer(target);
 }
 
 VALUE VM::deep_copy_object(VALUE object) {
   ManagedContext lalloc(*this);
-
-  Object* source = charly_as_object(object);
-  Object* target = charly_as_object(lalloc.create_object(source->container->size()));
-
-  // Copy each member from the source object into the target
-  for (auto & [ key, value ] : *source->container) {
-    (*target->container)[key] = this->deep_copy_value(value);
+  Object* target = charly_as_object(lalloc.mark_in_gc(this->copy_object(object)));
+
+  // Storage shared with the source object is only copied if it contains values which need to be copied
+  if (target->is_dictionary()) {
+    bool contains_heap_values = std::any_of(target->container->begin(), target->container->end(),
+                                            [](auto& entry) { return charly_is_on_heap(entry.second); });
+    if (contains_heap_values) {
+      for (auto& entry : *target->writable_container()) {
+        VALUE value = this->deep_copy_value(entry.second);
+        this->gc.write_barrier(target);
+        entry.second = value;
+      }
+    }
+  } else {
+    for (uint32_t i = 0; i < target->shape->slot_count(); i++) {
+      VALUE value = this->deep_copy_value(target->read_slot(i));
+      this->gc.write_barrier(target);
+      target->write_slot(i, value);
+    }
   }
 
   return charly_create_pointer(target);
@@ -450,24 +612,27 @@ VALUE VM::deep_copy_object(VALUE object) {
 
 VALUE VM::copy_array(VALUE array) {
   Array* source = charly_as_array(array);
-  Array* target = charly_as_array(this->create_array(source->data->size()));
+  Array* target = charly_as_array(this->create_array(0));
 
-  for (auto value : *source->data) {
-    target->data->push_back(value);
-  }
+  // The elements are shared until either array is modified
+  target->data->release();
+  target->data = source->data->retain();
 
   return charly_create_pointer(target);
 }
 
 VALUE VM::deep_copy_array(VALUE array) {
   ManagedContext lalloc(*this);
-
-  Array* source = charly_as_array(array);
-  Array* target = charly_as_array(lalloc.create_array(source->data->size()));
-
-  // Copy each member from the source object into the target
-  for (auto& value : *source->data) {
-    target->data->push_back(this->deep_copy_value(value));
+  Array* target = charly_as_array(lalloc.mark_in_gc(this->copy_array(array)));
+
+  // Storage shared with the source array is only copied if it contains values which need to be copied
+  if (std::any_of(target->data->begin(), target->data->end(), charly_is_on_heap)) {
+    ArrayStorage* data = target->writable();
+    for (auto& entry : *data) {
+      VALUE value = this->deep_copy_value(entry);
+      this->gc.write_barrier(target);
+      entry = value;
+    }
   }
 
   return charly_create_pointer(target);
@@ -483,34 +648,47 @@ VALUE VM::copy_function(VALUE function) {
   Function* source = charly_as_function(function);
   Function* target =
       charly_as_function(this->create_function(source->name, source->body_address, source->argc, source->lvarcount,
-                                               source->anonymous(), source->needs_arguments()));
+                                               source->max_stack_depth, source->anonymous(),
+                                               source->needs_arguments()));
 
   target->context = source->context;
   target->bound_self_set = source->bound_self_set;
   target->bound_self = source->bound_self;
-  *(target->container) = *(source->container);
+  if (source->container) {
+    target->container = new ValueMap(*source->container);
+  }
 
   return charly_create_pointer(target);
 }
 
 VALUE VM::copy_cfunction(VALUE function) {
   CFunction* source = charly_as_cfunction(function);
-  CFunction* target = charly_as_cfunction(this->create_cfunction(source->name, source->argc, source->pointer));
-  *(target->container) = *(source->container);
+  CFunction* target = charly_as_cfunction(this->create_cfunction(source->name, source->argc, source->pointer, source->thunk));
+  if (source->container) {
+    target->container = new ValueMap(*source->container);
+  }
 
   return charly_create_pointer(target);
 }
 
 VALUE VM::copy_generator(VALUE generator) {
   Generator* source = charly_as_generator(generator);
-  Generator* target = charly_as_generator(this->create_generator(source->name, source->resume_address));
+  Generator* target = charly_as_generator(
+      this->create_generator(source->name, source->resume_address, source->max_stack_depth));
 
   target->bound_self_set = source->bound_self_set;
   target->bound_self = source->bound_self;
   target->set_finished(source->finished());
-  *(target->container) = *(source->container);
+  if (source->container) {
+    target->container = new ValueMap(*source->container);
+  }
   *(target->context_stack) = *(source->context_stack);
+
+  // The header of the frame cell is kept, it still belongs to the target's generation
+  this->gc.write_barrier(target->context_frame);
+  Basic frame_header = target->context_frame->basic;
   *(target->context_frame) = *(source->context_frame);
+  target->context_frame->basic = frame_header;
 
   return charly_create_pointer(target);
 }
@@ -521,18 +699,31 @@ VALUE VM::add(VALUE left, VALUE right) {
   }
 
   if (charly_is_array(left)) {
-    Array* new_array = charly_as_array(this->copy_array(left));
-    if (charly_is_array(right)) {
-      Array* aright = charly_as_array(right);
+    Array* aleft = charly_as_array(left);
 
-      for (auto& value : *aright->data) {
-        new_array->data->push_back(value);
-      }
+    // Appending an empty array results in a copy, which shares the elements of the left array
+    if (charly_is_array(right) && charly_as_array(right)->data->empty()) {
+      return this->copy_array(left);
+    }
+
+    // Allocate the result with its final size right away
+    //
+    // The operands have already been popped off the stack, so they have to
+    // be kept alive while the new array is allocated
+    HandleScope handles(this->gc);
+    handles.add(left);
+    handles.add(right);
+    uint32_t right_size = charly_is_array(right) ? charly_as_array(right)->data->size() : 1;
+    Array* new_array = charly_as_array(this->create_array(aleft->data->size() + right_size));
+    new_array->data->insert(new_array->data->end(), aleft->data->begin(), aleft->data->end());
 
-      return charly_create_pointer(new_array);
+    if (charly_is_array(right)) {
+      Array* aright = charly_as_array(right);
+      new_array->data->insert(new_array->data->end(), aright->data->begin(), aright->data->end());
+    } else {
+      new_array->data->push_back(right);
     }
 
-    new_array->data->push_back(right);
     return charly_create_pointer(new_array);
   }
 
@@ -568,7 +759,13 @@ VALUE VM::add(VALUE left, VALUE right) {
     char* right_data = charly_string_data(right);
 
     // Check if both strings would fit into the short encoding
+    //
+    // The operands have already been popped off the stack, so they have to
+    // be kept alive while the new string is allocated
     if (new_length <= kShortStringMaxSize) {
+      HandleScope handles(this->gc);
+      handles.add(left);
+      handles.add(right);
       String* new_string = charly_as_hstring(this->create_empty_short_string());
       std::memcpy(new_string->sbuf.data, left_data, left_length);
       std::memcpy(new_string->sbuf.data + left_length, right_data, right_length);
@@ -576,11 +773,26 @@ VALUE VM::add(VALUE left, VALUE right) {
       return charly_create_pointer(new_string);
     }
 
-    // Allocate the buffer for the string
-    char* new_data = reinterpret_cast<char*>(std::malloc(new_length));
-    std::memcpy(new_data, left_data, left_length);
-    std::memcpy(new_data + left_length, right_data, right_length);
-    return this->create_weak_string(new_data, new_length);
+    // If the left string ends at the end of its buffer, the right string can be
+    // appended in place and the result shares the buffer with the left string
+    String* left_string = charly_is_hstring(left) ? charly_as_hstring(left) : nullptr;
+    if (left_string && !left_string->is_shortstring() && left_string->lbuf.buffer) {
+      StringBuffer* buffer = left_string->lbuf.buffer;
+      if (buffer->can_append(left_length, right_length)) {
+        std::memcpy(buffer->data() + left_length, right_data, right_length);
+        buffer->used = new_length;
+        return this->create_buffered_string(buffer, new_length);
+      }
+    }
+
+    // Reserve space for future concatenations, so that building a string piece by piece
+    // only copies each piece once
+    uint64_t capacity = std::min(new_length * 2, static_cast<uint64_t>(kMaxStringLength));
+    StringBuffer* buffer = StringBuffer::create(capacity);
+    std::memcpy(buffer->data(), left_data, left_length);
+    std::memcpy(buffer->data() + left_length, right_data, right_length);
+    buffer->used = new_length;
+    return this->create_buffered_string(buffer, new_length);
   }
 
   // Operator overloading
@@ -590,11 +802,21 @@ VALUE VM::add(VALUE left, VALUE right) {
   }
 
   // String concatenation for different types
-  if (charly_is_string(left) || charly_is_string(right)) {
-    std::stringstream buf;
-    this->to_s(buf, left);
-    this->to_s(buf, right);
-    return this->create_string(buf.str());
+  //
+  // Only the right operand is converted when appending to a string,
+  // so the result can keep using the buffer of the left string
+  if (charly_is_string(left)) {
+    HandleScope handles(this->gc);
+    handles.add(left);
+
+    return this->add(left, this->to_string(right));
+  }
+
+  if (charly_is_string(right)) {
+    this->format_buffer.clear();
+    this->to_s(this->format_buffer, left);
+    this->to_s(this->format_buffer, right);
+    return this->create_string(this->format_buffer.data(), this->format_buffer.size());
   }
 
   return kNaN;
@@ -648,6 +870,8 @@ VALUE VM::mul(VALUE left, VALUE right) {
 
     // Check if the result would fit into the short encoding
     if (new_length <= kShortStringMaxSize) {
+      HandleScope handles(this->gc);
+      handles.add(left);
       String* new_string = charly_as_hstring(this->create_empty_short_string());
 
       // Copy the string amount times
@@ -883,7 +1107,8 @@ VALUE VM::unot(VALUE value) {
 VALUE VM::shl(VALUE left, VALUE right) {
   if (charly_is_array(left)) {
     Array* arr = charly_as_array(left);
-    (*arr->data).push_back(right);
+    this->gc.write_barrier(arr);
+    arr->writable()->push_back(right);
     return left;
   }
 
@@ -970,7 +1195,7 @@ VALUE VM::ubnot(VALUE value) {
   return kNaN;
 }
 
-VALUE VM::readmembersymbol(VALUE source, VALUE symbol) {
+VALUE VM::readmembersymbol(VALUE source, VALUE symbol, InlineCache* cache) {
   switch (charly_get_type(source)) {
     case kTypeObject: {
       Object* obj = charly_as_object(source);
@@ -979,8 +1204,32 @@ VALUE VM::readmembersymbol(VALUE source, VALUE symbol) {
         return obj->klass;
       }
 
-      if (obj->container->count(symbol) == 1) {
-        return (*obj->container)[symbol];
+      // Objects with the same shape store this symbol in the same slot
+      if (cache != nullptr && obj->shape != nullptr && cache->shape == obj->shape) {
+        return obj->read_slot(cache->slot);
+      }
+
+      if (obj->is_dictionary()) {
+        auto it = obj->container->find(symbol);
+        if (it != obj->container->end()) {
+          return it->second;
+        }
+      } else {
+        auto offset = obj->shape->lookup(symbol);
+        if (offset.has_value()) {
+          if (cache != nullptr) {
+            cache->shape = obj->shape;
+            cache->slot = offset.value();
+          }
+
+          return obj->read_slot(offset.value());
+        }
+      }
+
+      if (obj->has_lazy_members()) {
+        if (auto member = this->read_lazy_member(obj, symbol)) {
+          return member.value();
+        }
       }
 
       break;
@@ -989,8 +1238,11 @@ VALUE VM::readmembersymbol(VALUE source, VALUE symbol) {
     case kTypeFunction: {
       Function* func = charly_as_function(source);
 
-      if (func->container->count(symbol) == 1) {
-        return (*func->container)[symbol];
+      if (func->container) {
+        auto it = func->container->find(symbol);
+        if (it != func->container->end()) {
+          return it->second;
+        }
       }
 
       if (symbol == charly_create_symbol("name")) {
@@ -1003,8 +1255,11 @@ VALUE VM::readmembersymbol(VALUE source, VALUE symbol) {
     case kTypeCFunction: {
       CFunction* cfunc = charly_as_cfunction(source);
 
-      if (cfunc->container->count(symbol) == 1) {
-        return (*cfunc->container)[symbol];
+      if (cfunc->container) {
+        auto it = cfunc->container->find(symbol);
+        if (it != cfunc->container->end()) {
+          return it->second;
+        }
       }
 
       if (symbol == charly_create_symbol("name")) {
@@ -1016,8 +1271,11 @@ VALUE VM::readmembersymbol(VALUE source, VALUE symbol) {
     case kTypeClass: {
       Class* klass = charly_as_class(source);
 
-      if (klass->container->count(symbol) == 1) {
-        return (*klass->container)[symbol];
+      if (klass->container) {
+        auto it = klass->container->find(symbol);
+        if (it != klass->container->end()) {
+          return it->second;
+        }
       }
 
       if (symbol == charly_create_symbol("prototype")) {
@@ -1048,6 +1306,13 @@ VALUE VM::readmembersymbol(VALUE source, VALUE symbol) {
         return charly_create_integer(charly_string_utf8_length(source));
       }
 
+      break;
+    }
+    case kTypeCPointer: {
+      if (symbol == charly_create_symbol("length") && charly_is_typedarray(source)) {
+        return charly_create_integer(charly_as_typedarray(source)->length);
+      }
+
       break;
     }
   }
@@ -1061,6 +1326,29 @@ VALUE VM::readmembersymbol(VALUE source, VALUE symbol) {
   // is checked
   //
   // If no result was found, null is returned
+  //
+  // The result of this lookup only depends on the class which is being searched,
+  // so it can be stored inside the inline cache of the calling instruction
+  VALUE cache_key = kNull;
+  if (cache != nullptr) {
+    if (charly_is_object(source)) {
+      cache_key = charly_as_object(source)->klass;
+      if (!charly_is_class(cache_key)) {
+        cache_key = this->primitive_object;
+      }
+    } else {
+      cache_key = this->primitive_class_of(source);
+    }
+
+    auto cached_value = cache->lookup(cache_key, this->inline_cache_epoch);
+    if (cached_value.has_value()) {
+      return cached_value.value();
+    }
+  }
+
+  VALUE result = kNull;
+  std::optional<VALUE> prototype_lookup;
+
   if (charly_is_object(source)) {
     VALUE val_klass = charly_as_object(source)->klass;
 
@@ -1070,19 +1358,20 @@ VALUE VM::readmembersymbol(VALUE source, VALUE symbol) {
     }
 
     Class* klass = charly_as_class(val_klass);
-    auto result = this->findprototypevalue(klass, symbol);
-
-    if (result.has_value()) {
-      return result.value();
-    }
+    prototype_lookup = this->findprototypevalue(klass, symbol);
   }
 
-  auto primitive_lookup = this->findprimitivevalue(source, symbol);
-  if (primitive_lookup.has_value()) {
-    return primitive_lookup.value();
+  if (prototype_lookup.has_value()) {
+    result = prototype_lookup.value();
   } else {
-    return kNull;
+    result = this->findprimitivevalue(source, symbol).value_or(kNull);
+  }
+
+  if (cache != nullptr) {
+    cache->insert(cache_key, result, this->inline_cache_epoch);
   }
+
+  return result;
 }
 
 VALUE VM::readmembervalue(VALUE source, VALUE value) {
@@ -1116,11 +1405,27 @@ VALUE VM::readmembervalue(VALUE source, VALUE value) {
         return this->readmembersymbol(source, charly_create_symbol(value));
       }
     }
+    case kTypeCPointer: {
+      if (charly_is_number(value) && charly_is_typedarray(source)) {
+        TypedArray* arr = charly_as_typedarray(source);
+        uint32_t index;
+
+        if (!arr->resolve_index(value, index)) {
+          return kNull;
+        }
+
+        return arr->read(index);
+      }
+
+      return this->readmembersymbol(source, charly_create_symbol(value));
+    }
     default: { return this->readmembersymbol(source, charly_create_symbol(value)); }
   }
 }
 
 VALUE VM::setmembersymbol(VALUE target, VALUE symbol, VALUE value) {
+  this->gc.write_barrier(target);
+
   switch (charly_get_type(target)) {
     case kTypeObject: {
       Object* obj = charly_as_object(target);
@@ -1130,19 +1435,24 @@ VALUE VM::setmembersymbol(VALUE target, VALUE symbol, VALUE value) {
         break;
       }
 
-      (*obj->container)[symbol] = value;
+      // Changing a prototype might change the result of cached lookups
+      if (obj->is_prototype()) {
+        this->invalidate_inline_caches();
+      }
+
+      obj->write(symbol, value);
       break;
     }
 
     case kTypeFunction: {
       Function* func = charly_as_function(target);
-      (*func->container)[symbol] = value;
+      (*func->writable_container())[symbol] = value;
       break;
     }
 
     case kTypeCFunction: {
       CFunction* cfunc = charly_as_cfunction(target);
-      (*cfunc->container)[symbol] = value;
+      (*cfunc->writable_container())[symbol] = value;
       break;
     }
 
@@ -1151,10 +1461,14 @@ VALUE VM::setmembersymbol(VALUE target, VALUE symbol, VALUE value) {
 
       if (symbol == charly_create_symbol("prototype")) {
         klass->prototype = value;
+        if (charly_is_object(value)) {
+          charly_as_object(value)->set_prototype(true);
+        }
+        this->invalidate_inline_caches();
         break;
       }
 
-      (*klass->container)[symbol] = value;
+      (*klass->writable_container())[symbol] = value;
       break;
     }
   }
@@ -1180,11 +1494,25 @@ VALUE VM::setmembervalue(VALUE target, VALUE member_value, VALUE value) {
       }
 
       // Update the value
-      (*arr->data)[index] = value;
+      this->gc.write_barrier(arr);
+      (*arr->writable())[index] = value;
       return value;
     }
   }
 
+  // Typed arrays only store numbers
+  if (charly_is_number(member_value) && charly_is_typedarray(target)) {
+    TypedArray* arr = charly_as_typedarray(target);
+    uint32_t index;
+
+    if (!charly_is_number(value) || !arr->resolve_index(member_value, index)) {
+      return kNull;
+    }
+
+    arr->write(index, value);
+    return value;
+  }
+
   // Turn member_value into a symbol
   return this->setmembersymbol(target, this->create_symbol(member_value), value);
 }
@@ -1197,9 +1525,8 @@ std::optional<VALUE> VM::findprototypevalue(Class* klass, VALUE symbol) {
     Object* prototype = charly_as_object(klass->prototype);
 
     // Check if this class container contains the symbol
-    if (prototype->container->count(symbol) == 1) {
-      result = (*prototype->container)[symbol];
-    } else {
+    result = prototype->read(symbol);
+    if (!result.has_value()) {
       if (charly_is_class(klass->parent_class)) {
         Class* pklass = charly_as_class(klass->parent_class);
         auto presult = this->findprototypevalue(pklass, symbol);
@@ -1214,21 +1541,27 @@ std::optional<VALUE> VM::findprototypevalue(Class* klass, VALUE symbol) {
   return result;
 }
 
+VALUE VM::primitive_class_of(VALUE value) {
+  switch (charly_get_type(value)) {
+    case kTypeNumber: return this->primitive_number;
+    case kTypeString: return this->primitive_string;
+    case kTypeBoolean: return this->primitive_boolean;
+    case kTypeNull: return this->primitive_null;
+    case kTypeArray: return this->primitive_array;
+    case kTypeFunction: return this->primitive_function;
+    case kTypeCFunction: return this->primitive_function;
+    case kTypeGenerator: return this->primitive_generator;
+    case kTypeClass: return this->primitive_class;
+    case kTypeCPointer: return this->primitive_value;
+  }
+
+  return kNull;
+}
+
 std::optional<VALUE> VM::findprimitivevalue(VALUE value, VALUE symbol) {
 
   // Get the corresponding primitive class
-  VALUE found_primitive_class = kNull;
-  switch (charly_get_type(value)) {
-    case kTypeNumber: found_primitive_class = this->primitive_number; break;
-    case kTypeString: found_primitive_class = this->primitive_string; break;
-    case kTypeBoolean: found_primitive_class = this->primitive_boolean; break;
-    case kTypeNull: found_primitive_class = this->primitive_null; break;
-    case kTypeArray: found_primitive_class = this->primitive_array; break;
-    case kTypeFunction: found_primitive_class = this->primitive_function; break;
-    case kTypeCFunction: found_primitive_class = this->primitive_function; break;
-    case kTypeGenerator: found_primitive_class = this->primitive_generator; break;
-    case kTypeClass: found_primitive_class = this->primitive_class; break;
-  }
+  VALUE found_primitive_class = this->primitive_class_of(value);
 
   if (symbol == charly_create_symbol("klass")) {
     return found_primitive_class;
@@ -1238,8 +1571,15 @@ std::optional<VALUE> VM::findprimitivevalue(VALUE value, VALUE symbol) {
     return std::nullopt;
   }
 
+  std::optional<VALUE> result;
+  if (this->method_cache->lookup(found_primitive_class, symbol, this->inline_cache_epoch, result)) {
+    return result;
+  }
+
   Class* pclass = charly_as_class(found_primitive_class);
-  return this->findprototypevalue(pclass, symbol);
+  result = this->findprototypevalue(pclass, symbol);
+  this->method_cache->insert(found_primitive_class, symbol, result, this->inline_cache_epoch);
+  return result;
 }
 
 VALUE VM::call_dynamic(VALUE v, const std::vector<VALUE>& args, VALUE target) {
@@ -1255,10 +1595,56 @@ VALUE VM::call_dynamic(VALUE v, const std::vector<VALUE>& args, VALUE target) {
   this->call(args.size(), true, true);
   this->run();
   this->halted = false;
-  return this->pop_stack();
+  return this->pop_result();
+}
+
+std::optional<VALUE> VM::call_callback(VALUE function, uint32_t argc, VALUE* argv) {
+  uint8_t* original_ip = this->ip;
+
+  switch (charly_get_type(function)) {
+    case kTypeFunction: {
+      Function* tfunc = charly_as_function(function);
+
+      // Callbacks are called without a target, see VM::call
+      VALUE self = kNull;
+      if (tfunc->bound_self_set) {
+        self = tfunc->bound_self;
+      } else if (tfunc->context) {
+        self = tfunc->context->self;
+      }
+
+      // If the function couldn't be entered, an exception was thrown
+      this->call_function(tfunc, argc, argv, self, true);
+      if (this->ip != tfunc->body_address) {
+        return std::nullopt;
+      }
+
+      this->run();
+      this->halted = false;
+      break;
+    }
+
+    case kTypeCFunction: {
+      this->call_cfunction(charly_as_cfunction(function), argc, argv);
+      break;
+    }
+
+    default: {
+      this->throw_exception("Attempted to call a non-callable type: " + charly_get_typestring(function));
+      return std::nullopt;
+    }
+  }
+
+  // Exceptions which weren't caught inside the callback unwind its frame and
+  // continue at a handler in one of the calling frames
+  if (this->ip != original_ip) {
+    return std::nullopt;
+  }
+
+  return this->pop_result();
 }
 
-void VM::call(uint32_t argc, bool with_target, bool halt_after_return) {
+void VM::call(uint32_t argc, bool with_target, bool halt_after_return, bool tail_call) {
   // Stack allocate enough space to copy all arguments into
   VALUE arguments[argc];
 
@@ -1322,7 +1708,7 @@ void VM::call(uint32_t argc, bool with_target, bool halt_after_return) {
         }
       }
 
-      this->call_function(tfunc, argc, arguments, target, halt_after_return);
+      this->call_function(tfunc, argc, arguments, target, halt_after_return, tail_call);
       return;
     }
 
@@ -1357,7 +1743,12 @@ void VM::call(uint32_t argc, bool with_target, bool halt_after_return) {
   }
 }
 
-void VM::call_function(Function* function, uint32_t argc, VALUE* argv, VALUE self, bool halt_after_return) {
+void VM::call_function(Function* function,
+                       uint32_t argc,
+                       VALUE* argv,
+                       VALUE self,
+                       bool halt_after_return,
+                       bool tail_call) {
   // Check if the function was called with enough arguments
   if (argc < function->argc) {
     this->throw_exception("Not enough arguments for function call");
@@ -1383,6 +1774,28 @@ void VM::call_function(Function* function, uint32_t argc, VALUE* argv, VALUE sel
     ctx.mark_in_gc(argv[i]);
   }
 
+  // Tail calls replace the current frame with the frame of the callee
+  //
+  // This is only possible if the frame doesn't belong to a generator, since returning from those
+  // has to run additional logic. The code generator never emits tail calls inside try blocks
+  if (tail_call) {
+    Frame* current = this->frames;
+    if (current && charly_is_function(current->caller_value)) {
+      return_address = current->return_address;
+      halt_after_return = current->halt_after_return();
+
+      // Print the frame if the correponding flag was set
+      if (this->context.trace_frames) {
+        this->context.err_stream << "Left frame: ";
+        this->pretty_print(this->context.err_stream, charly_create_pointer(current));
+        this->context.err_stream << '\n';
+      }
+
+      this->frames = current->parent;
+      this->release_frame(current);
+    }
+  }
+
   Frame* frame = ctx.create_frame(self, function, return_address, halt_after_return);
 
   // Copy the arguments into the function frame
@@ -1404,6 +1817,9 @@ void VM::call_function(Function* function, uint32_t argc, VALUE* argv, VALUE sel
       frame->write_local(i, argv[i]);
   }
 
+  // Instructions of the function push without checking the capacity of the stack
+  this->stack.reserve(function->max_stack_depth + kOperandStackRedZone);
+
   this->ip = function->body_address;
 }
 
@@ -1415,47 +1831,49 @@ void VM::call_cfunction(CFunction* function, uint32_t argc, VALUE* argv) {
   }
 
   // Mark the function and function arguments as temporaries
-  this->gc.mark_persistent(charly_create_pointer(function));
+  HandleScope handles(this->gc);
+  handles.add(charly_create_pointer(function));
   for (uint i = 0; i < argc; i++) {
-    this->gc.mark_persistent(argv[i]);
+    handles.add(argv[i]);
   }
 
-  // We keep a reference to the current catchtable around in case the constructor throws an exception
-  // After the constructor call we check if the table changed
-  CatchTable* original_catchtable = this->catchstack;
+  // We keep a reference to the current instruction around in case the function throws an exception
+  // If it was caught, execution continues inside the handler instead
+  uint8_t* original_ip = this->ip;
 
   VALUE rv = kNull;
 
-  // TODO: Expand this to 15 arguments
-  switch (function->argc) {
-    case 0: rv = reinterpret_cast<VALUE (*)(VM&)>(function->pointer)(*this); break;
-    case 1: rv = reinterpret_cast<VALUE (*)(VM&, VALUE)>(function->pointer)(*this, argv[0]); break;
-    case 2: rv = reinterpret_cast<VALUE (*)(VM&, VALUE, VALUE)>(function->pointer)(*this, argv[0], argv[1]); break;
-    case 3:
-      rv = reinterpret_cast<VALUE (*)(VM&, VALUE, VALUE, VALUE)>(function->pointer)(*this, argv[0], argv[1], argv[2]);
-      break;
-    case 4:
-      rv = reinterpret_cast<VALUE (*)(VM&, VALUE, VALUE, VALUE, VALUE)>(function->pointer)(*this, argv[0], argv[1], argv[2], argv[3]);
-      break;
-    case 5:
-      rv = reinterpret_cast<VALUE (*)(VM&, VALUE, VALUE, VALUE, VALUE, VALUE)>(function->pointer)(*this, argv[0], argv[1], argv[2], argv[3], argv[4]);
-      break;
-    default: {
-      this->throw_exception("Too many arguments for CFunction call");
-      return;
+  // Typed functions unpack their own arguments, untyped functions receive
+  // as many arguments as they declared
+  if (function->thunk != nullptr) {
+    rv = function->thunk(*this, argc, argv);
+  } else {
+    // TODO: Expand this to 15 arguments
+    switch (function->argc) {
+      case 0: rv = reinterpret_cast<VALUE (*)(VM&)>(function->pointer)(*this); break;
+      case 1: rv = reinterpret_cast<VALUE (*)(VM&, VALUE)>(function->pointer)(*this, argv[0]); break;
+      case 2: rv = reinterpret_cast<VALUE (*)(VM&, VALUE, VALUE)>(function->pointer)(*this, argv[0], argv[1]); break;
+      case 3:
+        rv = reinterpret_cast<VALUE (*)(VM&, VALUE, VALUE, VALUE)>(function->pointer)(*this, argv[0], argv[1], argv[2]);
+        break;
+      case 4:
+        rv = reinterpret_cast<VALUE (*)(VM&, VALUE, VALUE, VALUE, VALUE)>(function->pointer)(*this, argv[0], argv[1], argv[2], argv[3]);
+        break;
+      case 5:
+        rv = reinterpret_cast<VALUE (*)(VM&, VALUE, VALUE, VALUE, VALUE, VALUE)>(function->pointer)(*this, argv[0], argv[1], argv[2], argv[3], argv[4]);
+        break;
+      default: {
+        this->throw_exception("Too many arguments for CFunction call");
+        return;
+      }
     }
   }
 
-  this->gc.unmark_persistent(charly_create_pointer(function));
-  for (uint i = 0; i < argc; i++) {
-    this->gc.unmark_persistent(argv[i]);
-  }
-
   // The cfunction call might have halted the machine by either executing a module
   // or calling a user defined function
   this->halted = false;
 
-  if (this->catchstack == original_catchtable) {
+  if (this->ip == original_ip) {
     this->push_stack(rv);
   }
 }
@@ -1503,23 +1921,21 @@ void VM::call_generator(Generator* generator, uint32_t argc, VALUE* argv) {
   // We patch some fields of the frame, so a return or yield call can return to the
   // correct position
   Frame* frame = generator->context_frame;
+  this->gc.write_barrier(frame);
   frame->parent = this->frames;
-  frame->last_active_catchtable = this->catchstack;
   frame->caller_value = charly_create_pointer(generator);
-  frame->stacksize_at_entry = this->stack.size();
+  frame->stacksize_at_entry = 0;
   frame->return_address = return_address;
 
   this->frames = frame;
-  if (generator->owns_catchtable) {
-    this->catchstack = generator->context_catchtable;
-  }
   this->ip = generator->resume_address;
 
-  // Restore the values on the stack which ere active when the generator was paused
-  while (generator->context_stack->size()) {
-    this->push_stack(generator->context_stack->back());
-    generator->context_stack->pop_back();
-  }
+  // Switch to the stack of the generator, which still contains the values of its last pause
+  //
+  // The stack of the caller is kept inside the generator until it yields or returns
+  this->gc.write_barrier(generator);
+  this->stack.swap(*generator->context_stack);
+  this->stack.reserve(generator->max_stack_depth + kOperandStackRedZone);
 
   // Push the argument onto the stack
   if (generator->started()) {
@@ -1535,20 +1951,25 @@ void VM::call_generator(Generator* generator, uint32_t argc, VALUE* argv) {
   generator->running = true;
 }
 
+void VM::leave_generator_stack(Generator* generator) {
+  this->stack.swap(*generator->context_stack);
+  generator->context_stack->clear();
+}
+
 void VM::initialize_member_properties(Class* klass, Object* object) {
   if (charly_is_class(klass->parent_class)) {
     this->initialize_member_properties(charly_as_class(klass->parent_class), object);
   }
 
   for (auto field : *klass->member_properties) {
-    (*object->container)[field] = kNull;
+    object->write(field, kNull);
   }
 }
 
 bool VM::invoke_class_constructors(Class* klass, Object* object, uint32_t argc, VALUE* argv) {
-  // We keep a reference to the current catchtable around in case the constructor throws an exception
-  // After the constructor call we check if the table changed
-  CatchTable* original_catchtable = this->catchstack;
+  // We keep a reference to the current instruction around in case the function throws an exception
+  // If it was caught, execution continues inside the handler instead
+  uint8_t* original_ip = this->ip;
 
   if (charly_is_class(klass->parent_class)) {
     bool success = this->invoke_class_constructors(charly_as_class(klass->parent_class), object, argc, argv);
@@ -1570,46 +1991,51 @@ bool VM::invoke_class_constructors(Class* klass, Object* object, uint32_t argc,
 
     // Pop the return value generated by the class constructor off the stack
     // We don't need it anymore
-    if (this->catchstack == original_catchtable) {
+    if (this->ip == original_ip) {
       this->pop_stack();
     }
   }
 
-  return this->catchstack == original_catchtable;
+  return this->ip == original_ip;
 }
 
+// Instructionblocks are shared with other isolates, which might quicken the instruction concurrently
 Opcode VM::fetch_instruction() {
-  return *reinterpret_cast<Opcode*>(this->ip);
+  return static_cast<Opcode>(__atomic_load_n(this->ip, __ATOMIC_RELAXED));
 }
 
 void VM::op_readlocal(uint32_t index, uint32_t level) {
-  // Travel to the correct frame
-  Frame* frame = this->frames;
-  while (level != 0 && level--) {
-    if (!frame->parent_environment_frame) {
-      return this->panic(Status::ReadFailedTooDeep);
-    }
+  // The verifier made sure the frame exists and index is in bounds
+  Frame* frame = this->frames->environment_frame(level);
+  this->push_stack(frame->read_local(index));
+}
 
-    frame = frame->parent_environment_frame;
-  }
+void VM::op_readmembersymbol(VALUE symbol, uint32_t* cache_index) {
+  VALUE source = this->pop_stack();
 
-  // Check if the index isn't out-of-bounds
-  if (index >= frame->lvarcount()) {
-    return this->panic(Status::ReadFailedOutOfBounds);
+  // Allocate an inline cache for this instruction the first time it runs
+  uint32_t index = VM::claim_cache_index(cache_index);
+  if (index >= this->inline_caches.size()) {
+    this->inline_caches.resize(index + 1);
   }
 
-  this->push_stack(frame->read_local(index));
-}
-
-void VM::op_readmembersymbol(VALUE symbol) {
-  VALUE source = this->pop_stack();
-  this->push_stack(this->readmembersymbol(source, symbol));
+  // Reading a lazy member might throw an exception while its module is imported
+  uint8_t* original_ip = this->ip;
+  VALUE result = this->readmembersymbol(source, symbol, &this->inline_caches[index]);
+  if (this->ip == original_ip) {
+    this->push_stack(result);
+  }
 }
 
 void VM::op_readmembervalue() {
   VALUE value = this->pop_stack();
   VALUE source = this->pop_stack();
-  this->push_stack(this->readmembervalue(source, value));
+
+  uint8_t* original_ip = this->ip;
+  VALUE result = this->readmembervalue(source, value);
+  if (this->ip == original_ip) {
+    this->push_stack(result);
+  }
 }
 
 void VM::op_readarrayindex(uint32_t index) {
@@ -1635,22 +2061,10 @@ void VM::op_readarrayindex(uint32_t index) {
 void VM::op_setlocalpush(uint32_t index, uint32_t level) {
   VALUE value = this->pop_stack();
 
-  // Travel to the correct frame
-  Frame* frame = this->frames;
-  while (level--) {
-    if (!frame->parent_environment_frame) {
-      return this->panic(Status::WriteFailedTooDeep);
-    }
-
-    frame = frame->parent_environment_frame;
-  }
-
-  // Check if the index isn't out-of-bounds
-  if (index < frame->lvarcount()) {
-    frame->write_local(index, value);
-  } else {
-    this->panic(Status::WriteFailedOutOfBounds);
-  }
+  // The verifier made sure the frame exists and index is in bounds
+  Frame* frame = this->frames->environment_frame(level);
+  this->gc.write_barrier(frame);
+  frame->write_local(index, value);
 
   this->push_stack(value);
 }
@@ -1685,7 +2099,8 @@ void VM::op_setarrayindexpush(uint32_t index) {
     this->push_stack(kNull);
   }
 
-  (*arr->data)[index] = expression;
+  this->gc.write_barrier(arr);
+  (*arr->writable())[index] = expression;
 
   this->push_stack(stackval);
 }
@@ -1693,22 +2108,10 @@ void VM::op_setarrayindexpush(uint32_t index) {
 void VM::op_setlocal(uint32_t index, uint32_t level) {
   VALUE value = this->pop_stack();
 
-  // Travel to the correct frame
-  Frame* frame = this->frames;
-  while (level--) {
-    if (!frame->parent_environment_frame) {
-      return this->panic(Status::WriteFailedTooDeep);
-    }
-
-    frame = frame->parent_environment_frame;
-  }
-
-  // Check if the index isn't out-of-bounds
-  if (index < frame->lvarcount()) {
-    frame->write_local(index, value);
-  } else {
-    this->panic(Status::WriteFailedOutOfBounds);
-  }
+  // The verifier made sure the frame exists and index is in bounds
+  Frame* frame = this->frames->environment_frame(level);
+  this->gc.write_barrier(frame);
+  frame->write_local(index, value);
 }
 
 void VM::op_setmembersymbol(VALUE symbol) {
@@ -1741,7 +2144,8 @@ void VM::op_setarrayindex(uint32_t index) {
     this->push_stack(kNull);
   }
 
-  (*arr->data)[index] = expression;
+  this->gc.write_barrier(arr);
+  (*arr->writable())[index] = expression;
 }
 
 void VM::op_putself(uint32_t level) {
@@ -1752,10 +2156,7 @@ void VM::op_putself(uint32_t level) {
 
   VALUE self_val = kNull;
 
-  Frame* frm = this->frames;
-  while (frm && level--) {
-    frm = frm->parent_environment_frame;
-  }
+  Frame* frm = this->frames->environment_frame(level);
 
   if (frm) {
     self_val = frm->self;
@@ -1768,8 +2169,31 @@ void VM::op_putvalue(VALUE value) {
   this->push_stack(value);
 }
 
-void VM::op_putstring(char* data, uint32_t length) {
-  this->push_stack(this->create_string(data, length));
+void VM::op_putstring(uint32_t offset, uint32_t length) {
+  // Strings are immutable, so every execution of a literal can push the same string
+  auto interned = this->interned_literals.find(offset);
+  if (interned != this->interned_literals.end()) {
+    this->push_stack(interned->second);
+    return;
+  }
+
+  // We assume the compiler generated valid offsets and lengths, so we don't do
+  // any out-of-bounds checking here
+  // TODO: Should we do out-of-bounds checking here?
+  //
+  // The string pool is shared with other isolates, so the literal is copied out of it once
+  std::string literal = this->context.stringpool.get_string(offset, length);
+  VALUE string = this->create_string(literal.data(), length);
+
+  // The symbol of heap strings is computed up front, since literals are often used as keys
+  if (charly_is_hstring(string)) {
+    VALUE symbol =
+        this->context.symtable.register_symbol(charly_create_symbol(literal.data(), length), literal.data(), length);
+    charly_as_hstring(string)->symbol = symbol;
+  }
+
+  this->interned_literals.insert({offset, string});
+  this->push_stack(string);
 }
 
 void VM::op_putfunction(VALUE symbol,
@@ -1777,8 +2201,10 @@ void VM::op_putfunction(VALUE symbol,
                         bool anonymous,
                         bool needs_arguments,
                         uint32_t argc,
-                        uint32_t lvarcount) {
-  VALUE function = this->create_function(symbol, body_address, argc, lvarcount, anonymous, needs_arguments);
+                        uint32_t lvarcount,
+                        uint32_t max_stack_depth) {
+  VALUE function =
+      this->create_function(symbol, body_address, argc, lvarcount, max_stack_depth, anonymous, needs_arguments);
   this->push_stack(function);
 }
 
@@ -1787,8 +2213,8 @@ void VM::op_putcfunction(VALUE symbol, void* pointer, uint32_t argc) {
   this->push_stack(function);
 }
 
-void VM::op_putgenerator(VALUE symbol, uint8_t* resume_address) {
-  VALUE generator = this->create_generator(symbol, resume_address);
+void VM::op_putgenerator(VALUE symbol, uint8_t* resume_address, uint32_t max_stack_depth) {
+  VALUE generator = this->create_generator(symbol, resume_address, max_stack_depth);
   this->push_stack(generator);
 }
 
@@ -1810,7 +2236,7 @@ void VM::op_puthash(uint32_t count) {
   while (count--) {
     key = this->pop_stack();
     value = this->pop_stack();
-    (*object->container)[key] = value;
+    object->write(key, value);
   }
 
   this->push_stack(charly_create_pointer(object));
@@ -1828,7 +2254,10 @@ void VM::op_putclass(VALUE name,
   Class* klass = charly_as_class(lalloc.create_class(name));
   klass->member_properties->reserve(propertycount);
   klass->prototype = lalloc.create_object(methodcount);
-  klass->container->reserve(staticpropertycount + staticmethodcount);
+  charly_as_object(klass->prototype)->set_prototype(true);
+  if (staticpropertycount + staticmethodcount) {
+    klass->writable_container()->reserve(staticpropertycount + staticmethodcount);
+  }
 
   if (has_constructor) {
     klass->constructor = this->pop_stack();
@@ -1846,7 +2275,7 @@ void VM::op_putclass(VALUE name,
       this->panic(Status::InvalidArgumentType);
     }
     Function* func_smethod = charly_as_function(smethod);
-    (*klass->container)[func_smethod->name] = smethod;
+    (*klass->writable_container())[func_smethod->name] = smethod;
   }
 
   while (methodcount--) {
@@ -1856,7 +2285,7 @@ void VM::op_putclass(VALUE name,
     }
     Function* func_method = charly_as_function(method);
     Object* obj_methods = charly_as_object(klass->prototype);
-    (*obj_methods->container)[func_method->name] = method;
+    obj_methods->write(func_method->name, method);
   }
 
   while (staticpropertycount--) {
@@ -1864,7 +2293,7 @@ void VM::op_putclass(VALUE name,
     if (!charly_is_symbol(sprop)) {
       this->panic(Status::InvalidArgumentType);
     }
-    (*klass->container)[sprop] = kNull;
+    (*klass->writable_container())[sprop] = kNull;
   }
 
   while (propertycount--) {
@@ -1921,10 +2350,16 @@ void VM::op_callmember(uint32_t argc) {
   this->call(argc, true);
 }
 
+void VM::op_tailcall(uint32_t argc) {
+  this->call(argc, false, false, true);
+}
+
+void VM::op_tailcallmember(uint32_t argc) {
+  this->call(argc, true, false, true);
+}
+
 void VM::op_return() {
   Frame* frame = this->frames;
-  if (!frame)
-    this->panic(Status::CantReturnFromTopLevel);
 
   // Returning from a generator causes the generator to terminate
   // Mark it as done and delete some items which are no longer needed
@@ -1933,9 +2368,13 @@ void VM::op_return() {
     generator->set_finished(true);
     generator->set_started(false);
     generator->running = false;
+
+    // Hand the return value over to the stack of the caller
+    VALUE return_value = this->pop_stack();
+    this->leave_generator_stack(generator);
+    this->push_stack(return_value);
   }
 
-  this->catchstack = frame->last_active_catchtable;
   this->frames = frame->parent;
   this->ip = frame->return_address;
 
@@ -1949,43 +2388,34 @@ void VM::op_return() {
     this->pretty_print(this->context.err_stream, charly_create_pointer(frame));
     this->context.err_stream << '\n';
   }
+
+  this->release_frame(frame);
 }
 
 void VM::op_yield() {
+  // The verifier only allows yield inside generator bodies
   Frame* frame = this->frames;
-  if (!frame)
-    this->panic(Status::CantReturnFromTopLevel);
-
-  // Check if we are exiting from a generator
-  if (!charly_is_generator(frame->caller_value)) {
-    this->panic(Status::CantYieldFromNonGenerator);
-  }
 
   // Store the yielded value
   VALUE yield_value = this->pop_stack();
 
   // Store context info inside the generator
   Generator* generator = charly_as_generator(frame->caller_value);
-  generator->owns_catchtable = generator->context_catchtable != this->catchstack;
-  generator->context_catchtable = this->catchstack;
   generator->resume_address = this->ip + kInstructionLengths[Opcode::Yield];
   generator->running = false;
-  size_t stack_value_pop_count = this->stack.size() - frame->stacksize_at_entry;
-  while (stack_value_pop_count--) {
-    generator->context_stack->push_back(this->pop_stack());
-  }
+  this->gc.write_barrier(generator);
+  this->stack.swap(*generator->context_stack);
 
   this->push_stack(yield_value);
 
-  // We can't restore catchtables by popping them, since the list of tables
-  // in the generator might be different than of the outside world
-  this->catchstack = frame->last_active_catchtable;
   this->frames = frame->parent;
   this->ip = frame->return_address;
 
   if (frame->halt_after_return()) {
     this->halted = true;
   }
+
+  this->release_frame(frame);
 }
 
 void VM::op_throw() {
@@ -1998,59 +2428,105 @@ void VM::throw_exception(const std::string& message) {
   // Create exception object
   Object* ex_obj = charly_as_object(lalloc.create_object(2));
   VALUE ex_msg = lalloc.create_string(message.c_str(), message.size());
-  (*ex_obj->container)[this->context.symtable("message")] = ex_msg;
-  (*ex_obj->container)[this->context.symtable("stacktrace")] = this->stacktrace_array();
+  ex_obj->write(this->context.symtable("message"), ex_msg);
+  ex_obj->write(this->context.symtable("stacktrace"), this->stacktrace_array());
 
   this->last_exception_thrown = charly_create_pointer(ex_obj);
 
   // Unwind stack and push exception object
-  this->unwind_catchstack();
+  this->unwind_to_handler();
   this->push_stack(charly_create_pointer(ex_obj));
 }
 
 void VM::throw_exception(VALUE payload) {
-  this->unwind_catchstack();
   this->last_exception_thrown = payload;
+  this->unwind_to_handler();
   this->push_stack(payload);
 }
 
+void VM::throw_out_of_memory_exception() {
+  // The request stays pending until the stack was unwound. The values which exhausted the heap are
+  // usually only released by the unwinding, collections triggered by the allocation of the exception
+  // would otherwise request another one, which the script would receive right after catching this one
+  OutOfMemoryReason reason = this->gc.pending_out_of_memory_reason();
+  if (this->context.out_of_memory_callback) {
+    this->context.out_of_memory_callback(*this, reason);
+  }
+
+  switch (reason) {
+    case kHeapLimitReached: {
+      this->throw_exception("Out of memory: heap limit reached");
+      break;
+    }
+    case kTaskBudgetExhausted: {
+      this->throw_exception("Out of memory: allocation budget of the task exhausted");
+      break;
+    }
+  }
+
+  this->gc.clear_out_of_memory();
+}
+
 VALUE VM::stacktrace_array() {
   ManagedContext lalloc(*this);
   Array* arr = charly_as_array(lalloc.create_array(1));
 
   std::stringstream io;
 
+  // Append the trace entry to the array and reset the stringstream
+  auto push_entry = [&]() {
+    std::string strcopy = io.str();
+    arr->data->push_back(lalloc.create_string(strcopy.data(), strcopy.size()));
+    io.str("");
+  };
+
+  // Each frame is executing the instruction which entered the frame above it
+  uint8_t* address = this->ip;
   Frame* frame = this->frames;
   while (frame && charly_is_frame(charly_create_pointer(frame))) {
+    bool inlined = this->print_inlined_functions(io, address, push_entry);
     this->pretty_print(io, charly_create_pointer(frame));
+    if (!inlined) {
+      this->print_source_position(io, address);
+    }
+    push_entry();
+    address = this->call_site_address(frame);
     frame = frame->parent;
-
-    // Append the trace entry to the array and reset the stringstream
-    std::string strcopy = io.str();
-    arr->data->push_back(lalloc.create_string(strcopy.data(), strcopy.size()));
-    io.str("");
   }
 
   return charly_create_pointer(arr);
 }
 
-void VM::op_registercatchtable(int32_t offset) {
-  this->create_catchtable(this->ip + offset);
-}
+bool VM::print_inlined_functions(std::ostream& io, uint8_t* address, const std::function<void()>& callback) {
+  InstructionBlock* block = address ? this->context.compiler_manager.address_mapping.resolve_block(address) : nullptr;
+  if (block == nullptr) {
+    return false;
+  }
 
-void VM::op_popcatchtable() {
-  this->pop_catchtable();
+  // Only the innermost function is executing the instruction at address
+  bool printed = false;
+  uint32_t offset = address - block->get_data();
+  for (const InlinedFunctionEntry& entry : block->inlined_functions) {
+    if (offset >= entry.begin && offset < entry.end) {
+      io << "(" << std::setfill(' ') << std::setw(14) << "inlined" << std::setw(1) << ") ";
+      io << "(" << std::setw(10) << "function" << std::setw(1) << ") ";
+      io << this->context.symtable(entry.name).value_or("??");
+      if (!printed) {
+        this->print_source_position(io, address);
+      }
+      callback();
+      printed = true;
+    }
+  }
 
-  // Show the catchtable we just restored if the corresponding flag was set
-  if (this->context.trace_catchtables) {
-    CatchTable* table = this->catchstack;
+  return printed;
+}
 
-    if (table != nullptr) {
-      // Show the table we've restored
-      this->context.err_stream << "Restored CatchTable: ";
-      this->pretty_print(this->context.err_stream, charly_create_pointer(table));
-      this->context.err_stream << '\n';
-    }
+void VM::print_source_position(std::ostream& io, uint8_t* address) {
+  auto position = address ? this->context.compiler_manager.address_mapping.resolve_position(address) : std::nullopt;
+  if (position.has_value()) {
+    auto& [path, source_position] = position.value();
+    io << " at " << path << ":" << source_position.line << ":" << source_position.column;
   }
 }
 
@@ -2112,37 +2588,260 @@ void VM::op_branchneq(int32_t offset) {
     this->ip += offset;
 }
 
+void VM::op_loopincrement(int32_t offset, uint32_t index, uint32_t level, VALUE step, Opcode comparison) {
+  VALUE bound = this->pop_stack();
+
+  Frame* frame = this->frames->environment_frame(level);
+  VALUE counter = frame->read_local(index);
+
+  // Integer counters stay integers as long as they don't overflow, so they can be
+  // advanced and compared without dispatching on their type
+  if (charly_is_int(counter) && charly_is_int(step) && charly_is_int(bound)) {
+    int64_t next = charly_int_to_int64(counter) + charly_int_to_int64(step);
+    if (next < kMaxInt && next > kMinInt) {
+      frame->write_local(index, charly_create_integer(next));
+
+      int64_t limit = charly_int_to_int64(bound);
+      bool exit;
+      switch (comparison) {
+        case Opcode::BranchLt: exit = next < limit; break;
+        case Opcode::BranchGt: exit = next > limit; break;
+        case Opcode::BranchLe: exit = next <= limit; break;
+        default: exit = next >= limit; break;
+      }
+
+      if (!exit)
+        this->ip += offset;
+      return;
+    }
+  }
+
+  // Generic path, the operators might call overloaded operator methods
+  //
+  // The bound has already been popped off the stack, so it has to be kept alive
+  // while the addition allocates
+  HandleScope handles(this->gc);
+  handles.add(bound);
+  uint8_t* original_ip = this->ip;
+  VALUE next = this->add(counter, step);
+  if (this->ip != original_ip) {
+    return;
+  }
+
+  this->gc.write_barrier(frame);
+  frame->write_local(index, next);
+
+  VALUE exit;
+  switch (comparison) {
+    case Opcode::BranchLt: exit = this->lt(next, bound); break;
+    case Opcode::BranchGt: exit = this->gt(next, bound); break;
+    case Opcode::BranchLe: exit = this->le(next, bound); break;
+    default: exit = this->ge(next, bound); break;
+  }
+
+  if (this->ip == original_ip && exit != kTrue)
+    this->ip += offset;
+}
+
+void VM::op_readglobal(uint32_t index) {
+  // The verifier made sure index is in bounds of the top level frame
+  this->push_stack(this->top_frame->read_local(index));
+}
+
+void VM::op_setglobalpush(uint32_t index) {
+  VALUE value = this->pop_stack();
+  this->gc.write_barrier(this->top_frame);
+  this->top_frame->write_local(index, value);
+  this->push_stack(value);
+}
+
+void VM::op_setglobal(uint32_t index) {
+  VALUE value = this->pop_stack();
+  this->gc.write_barrier(this->top_frame);
+  this->top_frame->write_local(index, value);
+}
+
+void VM::op_readglobalmembersymbol(uint32_t index, VALUE symbol, uint32_t* cache_index) {
+  this->op_readglobal(index);
+  this->op_readmembersymbol(symbol, cache_index);
+}
+
+void VM::op_branchtable(uint32_t table_index, uint32_t* cache_index) {
+  uint32_t index = VM::claim_cache_index(cache_index);
+  if (index >= this->branch_table_blocks.size()) {
+    this->branch_table_blocks.resize(index + 1, nullptr);
+  }
+
+  InstructionBlock*& block = this->branch_table_blocks[index];
+  if (block == nullptr) {
+    block = this->context.compiler_manager.address_mapping.resolve_block(this->ip);
+  }
+
+  if (block == nullptr) {
+    this->panic(Status::InvalidInstructionPointer);
+  }
+
+  const SwitchTable& table = block->branch_tables[table_index];
+  VALUE value = this->stack.back();
+  if (charly_is_int(value) && table.integer_targets.size()) {
+    this->ip = block->get_data() + table.find_integer_target(charly_int_to_int64(value));
+  } else if (charly_is_string(value) && table.string_targets.size()) {
+    std::string_view key(charly_string_data(value), charly_string_length(value));
+    this->ip = block->get_data() + table.find_string_target(key);
+  }
+}
+
 void VM::op_typeof() {
   VALUE value = this->pop_stack();
   const std::string& stringrep = charly_get_typestring(value);
   this->push_stack(this->create_string(stringrep.data(), stringrep.size()));
 }
 
+void VM::op_readlocalmembersymbol(uint32_t index, uint32_t level, VALUE symbol, uint32_t* cache_index) {
+  this->op_readlocal(index, level);
+  this->op_readmembersymbol(symbol, cache_index);
+}
+
+void VM::op_putselfmembersymbol(uint32_t level, VALUE symbol, uint32_t* cache_index) {
+  this->op_putself(level);
+  this->op_readmembersymbol(symbol, cache_index);
+}
+
+void VM::op_readlocalpair(uint32_t index1, uint32_t level1, uint32_t index2, uint32_t level2) {
+  this->op_readlocal(index1, level1);
+  this->op_readlocal(index2, level2);
+}
+
 void VM::stacktrace(std::ostream& io) {
   Frame* frame = this->frames;
 
   int i = 0;
   io << "IP: " << static_cast<void*>(this->ip) << '\n';
-  while (frame && charly_is_frame(charly_create_pointer(frame))) {
+
+  auto print_index = [&]() {
     io << std::setfill(' ') << std::setw(2);
     io << i++ << ": ";
     io << std::setw(1);
+  };
+
+  uint8_t* address = this->ip;
+  while (frame && charly_is_frame(charly_create_pointer(frame))) {
+    print_index();
+    bool inlined = this->print_inlined_functions(io, address, [&]() {
+      io << '\n';
+      print_index();
+    });
     this->pretty_print(io, charly_create_pointer(frame));
+    if (!inlined) {
+      this->print_source_position(io, address);
+    }
     io << '\n';
+    address = this->call_site_address(frame);
     frame = frame->parent;
   }
 }
 
-void VM::catchstacktrace(std::ostream& io) {
-  CatchTable* table = this->catchstack;
+void VM::record_profiler_sample() {
+  std::vector<uint32_t> stack;
+  for (Frame* frame = this->frames; frame && charly_is_frame(charly_create_pointer(frame)); frame = frame->parent) {
+    VALUE callee = frame->caller_value;
 
-  int i = 0;
-  while (table) {
-    io << i++ << "# ";
-    this->pretty_print(io, charly_create_pointer(table));
-    io << '\n';
-    table = table->parent;
-  }
+    // Generators resume at a different address each time, so they are identified by their name
+    const void* key = nullptr;
+    VALUE name = kNull;
+    uint8_t* body_address = nullptr;
+
+    switch (charly_get_type(callee)) {
+      case kTypeFunction: {
+        Function* fn = charly_as_function(callee);
+        key = fn->body_address;
+        name = fn->anonymous() ? kNull : fn->name;
+        body_address = fn->body_address;
+        break;
+      }
+      case kTypeGenerator: {
+        name = charly_as_generator(callee)->name;
+        key = reinterpret_cast<const void*>(name);
+        break;
+      }
+      case kTypeCFunction: {
+        key = charly_as_cfunction(callee)->pointer;
+        name = charly_as_cfunction(callee)->name;
+        break;
+      }
+      // The top frame isn't entered via a call
+      default: continue;
+    }
+
+    stack.push_back(this->profiler.function_id(key, [&]() {
+      std::string label = this->context.symtable(name).value_or("<anonymous>");
+      auto position =
+          body_address ? this->context.compiler_manager.address_mapping.resolve_position(body_address) : std::nullopt;
+      if (position.has_value()) {
+        auto& [path, source_position] = position.value();
+        label += " (" + path + ":" + std::to_string(source_position.line) + ")";
+      }
+
+      // Semicolons separate the frames of a collapsed stack
+      std::replace(label.begin(), label.end(), ';', ',');
+      return label;
+    }));
+  }
+
+  std::reverse(stack.begin(), stack.end());
+  this->profiler.add_sample(stack);
+}
+
+RuntimeMetricsReport VM::runtime_metrics() {
+  auto us = [](uint64_t nanoseconds) { return nanoseconds / 1000.0; };
+  auto count = [](uint64_t value) { return static_cast<double>(value); };
+  const EventLoopMetrics& loop = this->event_loop_metrics;
+  const WorkerPoolMetrics& workers = this->worker_pool.metrics;
+
+  auto uptime = std::chrono::steady_clock::now() - loop.start_time;
+  uint64_t uptime_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(uptime).count();
+  double loop_utilization = uptime_ns ? 1.0 - std::min(1.0, static_cast<double>(loop.idle_time) / uptime_ns) : 0;
+
+  // Fraction of the combined uptime of all worker threads they spent executing tasks
+  uint64_t worker_time = uptime_ns * this->worker_pool.thread_count();
+  uint64_t busy_time = workers.busy_time.load(std::memory_order_relaxed);
+  double worker_utilization = worker_time ? std::min(1.0, static_cast<double>(busy_time) / worker_time) : 0;
+
+  return {
+    {"uptime", us(uptime_ns)},
+    {"tasks_executed", count(loop.tasks_executed)},
+    {"task_queue_depth", count(this->task_queue.size())},
+    {"max_task_queue_depth", count(loop.max_task_queue_depth)},
+    {"task_wait_avg", us(loop.task_queue_wait.average())},
+    {"task_wait_p99", us(loop.task_queue_wait.percentile(99))},
+    {"event_loop_utilization", loop_utilization},
+    {"timers_pending", count(this->timers.size())},
+    {"timers_fired", count(loop.timers_fired)},
+    {"timer_lateness_avg", us(loop.timer_lateness.average())},
+    {"timer_lateness_p99", us(loop.timer_lateness.percentile(99))},
+    {"timer_lateness_max", us(loop.timer_lateness.max.load(std::memory_order_relaxed))},
+    {"worker_threads", count(this->worker_pool.thread_count())},
+    {"worker_queue_depth", count(this->worker_pool.queued_task_count())},
+    {"worker_tasks_completed", count(workers.tasks_completed.load(std::memory_order_relaxed))},
+    {"worker_utilization", worker_utilization},
+    {"worker_wait_avg", us(workers.queue_wait.average())},
+    {"worker_wait_p99", us(workers.queue_wait.percentile(99))},
+    {"booted_from_image", count(this->booted_from_image)},
+    {"jit_enabled", count(this->jit.is_enabled())},
+    {"jit_compiled_functions", count(this->jit.compiled_functions().size())},
+  };
+}
+
+void VM::write_runtime_metrics(std::ostream& out) {
+  std::ios_base::fmtflags flags = out.flags();
+  std::streamsize precision = out.precision();
+  out << std::setprecision(15) << "metrics";
+  for (const auto& [name, value] : this->runtime_metrics()) {
+    out << ' ' << name << '=' << std::round(value * 1000) / 1000;
+  }
+  out << std::endl;
+  out.flags(flags);
+  out.precision(precision);
 }
 
 void VM::stackdump(std::ostream& io) {
@@ -2155,10 +2854,8 @@ void VM::stackdump(std::ostream& io) {
 // TODO: Move this message to value.h
 // TODO: It will still require access to the symbol table, figure out how to remove this dependency
 void VM::pretty_print(std::ostream& io, VALUE value) {
-  // Check if this value was already printed before
-  auto begin = this->pretty_print_stack.begin();
-  auto end = this->pretty_print_stack.end();
-  bool printed_before = std::find(begin, end, value) != end;
+  // Check if this value is already being printed further up
+  bool printed_before = this->pretty_print_visited.count(value) > 0;
 
   switch (charly_get_type(value)) {
     case kTypeDead: {
@@ -2169,17 +2866,8 @@ void VM::pretty_print(std::ostream& io, VALUE value) {
     }
 
     case kTypeNumber: {
-      const double d = io.precision();
-      io.precision(16);
-      io << std::fixed;
-      if (charly_is_int(value)) {
-        io << charly_int_to_int64(value);
-      } else {
-        io << charly_double_to_double(value);
-      }
-      io << std::scientific;
-      io.precision(d);
-
+      char buffer[kFormattedNumberMaxLength];
+      io.write(buffer, format_number(buffer, value));
       break;
     }
 
@@ -2210,18 +2898,17 @@ void VM::pretty_print(std::ostream& io, VALUE value) {
         break;
       }
 
-      this->pretty_print_stack.push_back(value);
+      this->pretty_print_visited.insert(value);
 
-      for (auto& entry : *object->container) {
+      object->each([&](VALUE key, VALUE value) {
         io << " ";
-        std::string key = this->context.symtable(entry.first).value_or(kUndefinedSymbolString);
-        io << key << "=";
-        this->pretty_print(io, entry.second);
-      }
+        io << this->context.symtable(key).value_or(kUndefinedSymbolString) << "=";
+        this->pretty_print(io, value);
+      });
 
       io << ">";
 
-      this->pretty_print_stack.pop_back();
+      this->pretty_print_visited.erase(value);
       break;
     }
 
@@ -2235,7 +2922,7 @@ void VM::pretty_print(std::ostream& io, VALUE value) {
         break;
       }
 
-      this->pretty_print_stack.push_back(value);
+      this->pretty_print_visited.insert(value);
 
       io << "[";
 
@@ -2252,7 +2939,7 @@ void VM::pretty_print(std::ostream& io, VALUE value) {
 
       io << "]>";
 
-      this->pretty_print_stack.pop_back();
+      this->pretty_print_visited.erase(value);
       break;
     }
 
@@ -2264,7 +2951,7 @@ void VM::pretty_print(std::ostream& io, VALUE value) {
         break;
       }
 
-      this->pretty_print_stack.push_back(value);
+      this->pretty_print_visited.insert(value);
 
       io << "<Function ";
       io << "name=";
@@ -2280,16 +2967,18 @@ void VM::pretty_print(std::ostream& io, VALUE value) {
       io << "bound_self=";
       this->pretty_print(io, func->bound_self);
 
-      for (auto& entry : *func->container) {
-        io << " ";
-        std::string key = this->context.symtable(entry.first).value_or(kUndefinedSymbolString);
-        io << key << "=";
-        this->pretty_print(io, entry.second);
+      if (func->container) {
+        for (auto& entry : *func->container) {
+          io << " ";
+          std::string key = this->context.symtable(entry.first).value_or(kUndefinedSymbolString);
+          io << key << "=";
+          this->pretty_print(io, entry.second);
+        }
       }
 
       io << ">";
 
-      this->pretty_print_stack.pop_back();
+      this->pretty_print_visited.erase(value);
       break;
     }
 
@@ -2301,7 +2990,7 @@ void VM::pretty_print(std::ostream& io, VALUE value) {
         break;
       }
 
-      this->pretty_print_stack.push_back(value);
+      this->pretty_print_visited.insert(value);
 
       io << "<CFunction ";
       io << "name=";
@@ -2311,16 +3000,18 @@ void VM::pretty_print(std::ostream& io, VALUE value) {
       io << " ";
       io << "pointer=" << reinterpret_cast<uint64_t*>(func->pointer) << "";
 
-      for (auto& entry : *func->container) {
-        io << " ";
-        std::string key = this->context.symtable(entry.first).value_or(kUndefinedSymbolString);
-        io << key << "=";
-        this->pretty_print(io, entry.second);
+      if (func->container) {
+        for (auto& entry : *func->container) {
+          io << " ";
+          std::string key = this->context.symtable(entry.first).value_or(kUndefinedSymbolString);
+          io << key << "=";
+          this->pretty_print(io, entry.second);
+        }
       }
 
       io << ">";
 
-      this->pretty_print_stack.pop_back();
+      this->pretty_print_visited.erase(value);
       break;
     }
 
@@ -2332,7 +3023,7 @@ void VM::pretty_print(std::ostream& io, VALUE value) {
         break;
       }
 
-      this->pretty_print_stack.push_back(value);
+      this->pretty_print_visited.insert(value);
 
       io << "<Generator ";
       io << "name=";
@@ -2343,21 +3034,22 @@ void VM::pretty_print(std::ostream& io, VALUE value) {
       io << "started=" << (generator->started() ? "true" : "false") << " ";
       io << "running=" << (generator->running ? "true" : "false") << " ";
       io << "context_frame=" << reinterpret_cast<void*>(generator->context_frame) << " ";
-      io << "context_catchtable=" << reinterpret_cast<void*>(generator->context_catchtable) << " ";
       io << "bound_self_set=" << (generator->bound_self_set ? "true" : "false") << " ";
       io << "bound_self=";
       this->pretty_print(io, generator->bound_self);
 
-      for (auto& entry : *generator->container) {
-        io << " ";
-        std::string key = this->context.symtable(entry.first).value_or(kUndefinedSymbolString);
-        io << key << "=";
-        this->pretty_print(io, entry.second);
+      if (generator->container) {
+        for (auto& entry : *generator->container) {
+          io << " ";
+          std::string key = this->context.symtable(entry.first).value_or(kUndefinedSymbolString);
+          io << key << "=";
+          this->pretty_print(io, entry.second);
+        }
       }
 
       io << ">";
 
-      this->pretty_print_stack.pop_back();
+      this->pretty_print_visited.erase(value);
       break;
     }
 
@@ -2369,7 +3061,7 @@ void VM::pretty_print(std::ostream& io, VALUE value) {
         break;
       }
 
-      this->pretty_print_stack.push_back(value);
+      this->pretty_print_visited.insert(value);
 
       io << "<Class ";
       io << "name=";
@@ -2393,15 +3085,17 @@ void VM::pretty_print(std::ostream& io, VALUE value) {
       this->pretty_print(io, klass->parent_class);
       io << " ";
 
-      for (auto entry : *klass->container) {
-        io << " " << this->context.symtable(entry.first).value_or(kUndefinedSymbolString);
-        io << "=";
-        this->pretty_print(io, entry.second);
+      if (klass->container) {
+        for (auto entry : *klass->container) {
+          io << " " << this->context.symtable(entry.first).value_or(kUndefinedSymbolString);
+          io << "=";
+          this->pretty_print(io, entry.second);
+        }
       }
 
       io << ">";
 
-      this->pretty_print_stack.pop_back();
+      this->pretty_print_visited.erase(value);
       break;
     }
 
@@ -2463,35 +3157,12 @@ void VM::pretty_print(std::ostream& io, VALUE value) {
 
       break;
     }
-
-    case kTypeCatchTable: {
-      CatchTable* table = charly_as_catchtable(value);
-
-      if (printed_before) {
-        io << "<CatchTable ...>";
-        break;
-      }
-
-      this->pretty_print_stack.push_back(value);
-
-      io << "<CatchTable ";
-      io << "address=" << reinterpret_cast<void*>(table->address) << " ";
-      io << "stacksize=" << table->stacksize << " ";
-      io << "frame=" << table->frame << " ";
-      io << "parent=" << table->parent;
-      io << ">";
-
-      this->pretty_print_stack.pop_back();
-      break;
-    }
   }
 }
 
-void VM::to_s(std::ostream& io, VALUE value, uint32_t depth) {
-  // Check if this value was already printed before
-  auto begin = this->pretty_print_stack.begin();
-  auto end = this->pretty_print_stack.end();
-  bool printed_before = std::find(begin, end, value) != end;
+void VM::to_s(OutputBuffer& io, VALUE value, uint32_t depth) {
+  // Check if this value is already being printed further up
+  bool printed_before = this->pretty_print_visited.count(value) > 0;
 
   switch (charly_get_type(value)) {
     case kTypeDead: {
@@ -2501,22 +3172,12 @@ void VM::to_s(std::ostream& io, VALUE value, uint32_t depth) {
     }
 
     case kTypeNumber: {
-      const double d = io.precision();
-      io.precision(16);
-      io << std::fixed;
-      if (charly_is_int(value)) {
-        io << charly_int_to_int64(value);
-      } else {
-        io << charly_double_to_double(value);
-      }
-      io << std::scientific;
-      io.precision(d);
-
+      io.write_number(value);
       break;
     }
 
     case kTypeBoolean: {
-      io << std::boolalpha << (value == kTrue) << std::noboolalpha;
+      io << (value == kTrue ? "true" : "false");
       break;
     }
 
@@ -2540,7 +3201,7 @@ void VM::to_s(std::ostream& io, VALUE value, uint32_t depth) {
         break;
       }
 
-      this->pretty_print_stack.push_back(value);
+      this->pretty_print_visited.insert(value);
 
       if (charly_is_class(object->klass)) {
         Class* klass = charly_as_class(object->klass);
@@ -2550,18 +3211,17 @@ void VM::to_s(std::ostream& io, VALUE value, uint32_t depth) {
       if (this->context.verbose_addresses) io << "@" << reinterpret_cast<void*>(value) << ":";
       io << "{\n";
 
-      for (auto& entry : *object->container) {
-        io << std::string(depth + 2, ' ');
-        std::string key = this->context.symtable(entry.first).value_or(kUndefinedSymbolString);
-        io << key << " = ";
-        this->to_s(io, entry.second, depth + 2);
+      object->each([&](VALUE key, VALUE value) {
+        io.write_spaces(depth + 2);
+        io << this->context.symtable(key).value_or(kUndefinedSymbolString) << " = ";
+        this->to_s(io, value, depth + 2);
         io << '\n';
-      }
+      });
 
-      io << std::string(depth == 0 ? 0 : depth, ' ');
+      io.write_spaces(depth);
       io << "}";
 
-      this->pretty_print_stack.pop_back();
+      this->pretty_print_visited.erase(value);
       break;
     }
 
@@ -2575,7 +3235,7 @@ void VM::to_s(std::ostream& io, VALUE value, uint32_t depth) {
         break;
       }
 
-      this->pretty_print_stack.push_back(value);
+      this->pretty_print_visited.insert(value);
 
       io << "[";
 
@@ -2592,7 +3252,7 @@ void VM::to_s(std::ostream& io, VALUE value, uint32_t depth) {
 
       io << "]";
 
-      this->pretty_print_stack.pop_back();
+      this->pretty_print_visited.erase(value);
       break;
     }
 
@@ -2605,23 +3265,24 @@ void VM::to_s(std::ostream& io, VALUE value, uint32_t depth) {
         break;
       }
 
-      this->pretty_print_stack.push_back(value);
+      this->pretty_print_visited.insert(value);
 
       io << "<Function ";
-      io << "";
       this->to_s(io, func->name);
       io << "#" << func->argc;
 
-      for (auto& entry : *func->container) {
-        io << " ";
-        std::string key = this->context.symtable(entry.first).value_or(kUndefinedSymbolString);
-        io << key << "=";
-        this->to_s(io, entry.second, depth);
+      if (func->container) {
+        for (auto& entry : *func->container) {
+          io << " ";
+          std::string key = this->context.symtable(entry.first).value_or(kUndefinedSymbolString);
+          io << key << "=";
+          this->to_s(io, entry.second, depth);
+        }
       }
 
       io << ">";
 
-      this->pretty_print_stack.pop_back();
+      this->pretty_print_visited.erase(value);
       break;
     }
 
@@ -2634,22 +3295,24 @@ void VM::to_s(std::ostream& io, VALUE value, uint32_t depth) {
         break;
       }
 
-      this->pretty_print_stack.push_back(value);
+      this->pretty_print_visited.insert(value);
 
       io << "<CFunction ";
       this->to_s(io, func->name, depth);
       io << "#" << func->argc;
 
-      for (auto& entry : *func->container) {
-        io << " ";
-        std::string key = this->context.symtable(entry.first).value_or(kUndefinedSymbolString);
-        io << key << "=";
-        this->to_s(io, entry.second, depth);
+      if (func->container) {
+        for (auto& entry : *func->container) {
+          io << " ";
+          std::string key = this->context.symtable(entry.first).value_or(kUndefinedSymbolString);
+          io << key << "=";
+          this->to_s(io, entry.second, depth);
+        }
       }
 
       io << ">";
 
-      this->pretty_print_stack.pop_back();
+      this->pretty_print_visited.erase(value);
       break;
     }
 
@@ -2662,7 +3325,7 @@ void VM::to_s(std::ostream& io, VALUE value, uint32_t depth) {
         break;
       }
 
-      this->pretty_print_stack.push_back(value);
+      this->pretty_print_visited.insert(value);
 
       io << "<Generator ";
       this->to_s(io, generator->name, depth);
@@ -2670,16 +3333,18 @@ void VM::to_s(std::ostream& io, VALUE value, uint32_t depth) {
       io << (generator->started() ? " started" : "");
       io << (generator->running ? " running" : "");
 
-      for (auto& entry : *generator->container) {
-        io << " ";
-        std::string key = this->context.symtable(entry.first).value_or(kUndefinedSymbolString);
-        io << key << "=";
-        this->to_s(io, entry.second, depth);
+      if (generator->container) {
+        for (auto& entry : *generator->container) {
+          io << " ";
+          std::string key = this->context.symtable(entry.first).value_or(kUndefinedSymbolString);
+          io << key << "=";
+          this->to_s(io, entry.second, depth);
+        }
       }
 
       io << ">";
 
-      this->pretty_print_stack.pop_back();
+      this->pretty_print_visited.erase(value);
       break;
     }
 
@@ -2692,25 +3357,42 @@ void VM::to_s(std::ostream& io, VALUE value, uint32_t depth) {
         break;
       }
 
-      this->pretty_print_stack.push_back(value);
+      this->pretty_print_visited.insert(value);
 
       io << "<Class ";
       this->to_s(io, klass->name, depth);
 
-      for (auto entry : *klass->container) {
-        io << " " << this->context.symtable(entry.first).value_or(kUndefinedSymbolString);
-        io << "=";
-        this->to_s(io, entry.second, depth);
+      if (klass->container) {
+        for (auto entry : *klass->container) {
+          io << " " << this->context.symtable(entry.first).value_or(kUndefinedSymbolString);
+          io << "=";
+          this->to_s(io, entry.second, depth);
+        }
       }
 
       io << ">";
 
-      this->pretty_print_stack.pop_back();
+      this->pretty_print_visited.erase(value);
       break;
     }
 
     case kTypeCPointer: {
       if (this->context.verbose_addresses) io << "@" << reinterpret_cast<void*>(value) << ":";
+
+      if (charly_is_typedarray(value)) {
+        TypedArray* array = charly_as_typedarray(value);
+        io << (array->kind == kTypedArrayFloat64 ? "<TypedArray float64 [" : "<TypedArray int32 [");
+        for (uint32_t i = 0; i < array->length; i++) {
+          if (i > 0) {
+            io << ", ";
+          }
+
+          this->to_s(io, array->read(i), depth);
+        }
+        io << "]>";
+        break;
+      }
+
       io << "<CPointer>";
       break;
     }
@@ -2729,7 +3411,33 @@ void VM::to_s(std::ostream& io, VALUE value, uint32_t depth) {
   }
 }
 
+void VM::to_s(std::ostream& io, VALUE value, uint32_t depth) {
+  OutputBuffer buffer;
+  this->to_s(buffer, value, depth);
+  io.write(buffer.data(), buffer.size());
+}
+
+VALUE VM::to_string(VALUE value) {
+  this->format_buffer.clear();
+  this->to_s(this->format_buffer, value);
+  return this->create_string(this->format_buffer.data(), this->format_buffer.size());
+}
+
+void VM::write_output(VALUE value) {
+  this->to_s(this->output_buffer, value);
+  if (this->output_buffer.size() >= kOutputBufferFlushThreshold) {
+    this->flush_output();
+  }
+}
+
+void VM::flush_output() {
+  if (this->output_buffer.size()) {
+    this->output_buffer.flush_to(this->context.out_stream);
+  }
+}
+
 void VM::panic(STATUS reason) {
+  this->flush_output();
   this->context.err_stream << "Panic: " << kStatusHumanReadable[reason] << '\n';
   this->context.err_stream << '\n' << "Stacktrace:" << '\n';
   this->stacktrace(this->context.err_stream);
@@ -2742,24 +3450,51 @@ void VM::panic(STATUS reason) {
 }
 
 void VM::run() {
+  (this->*(this->dispatch_loop))();
+}
+
+VM::DispatchLoop VM::select_dispatch_loop(const VMContext& context) {
+  if (context.instruction_profile) {
+    if (context.trace_opcodes) {
+      return &VM::run_loop<true, true>;
+    }
+
+    return &VM::run_loop<true, false>;
+  }
+
+  if (context.trace_opcodes) {
+    return &VM::run_loop<false, true>;
+  }
+
+  return &VM::run_loop<false, false>;
+}
+
+template <bool kInstructionProfile, bool kTraceOpcodes>
+void VM::run_loop() {
   this->halted = false;
 
-  // High resolution clock used to track how long instructions take
-  std::chrono::time_point<std::chrono::high_resolution_clock> exec_start;
+  // Cycle counter value at the start of the current instruction
+  [[maybe_unused]] uint64_t exec_start = 0;
   Opcode opcode = Opcode::Halt;
   uint8_t* old_ip = this->ip;
 
+  // Instructions which could change the instruction pointer to null check it themselves,
+  // so we only need to check it once when entering the loop
+  if (this->ip == nullptr) {
+    this->panic(Status::InvalidInstructionPointer);
+  }
+
 // Runs at the beginning of every instruction
+//
+// The instrumentation code is only compiled into the variants of this loop
+// which were requested via the VMContext
 #define OPCODE_PROLOGUE()                                                                              \
   if (this->halted)                                                                                    \
     return;                                                                                            \
-  if (this->context.instruction_profile) {                                                             \
-    exec_start = std::chrono::high_resolution_clock::now();                                            \
-  }                                                                                                    \
-  if (this->ip == nullptr) {                                                                           \
-    this->panic(Status::InvalidInstructionPointer);                                                    \
+  if constexpr (kInstructionProfile) {                                                                 \
+    exec_start = read_cycle_counter();                                                                 \
   }                                                                                                    \
-  if (this->context.trace_opcodes) {                                                                   \
+  if constexpr (kTraceOpcodes) {                                                                       \
     this->context.err_stream.fill('0');                                                                \
     this->context.err_stream << "0x" << std::hex;                                                      \
     this->context.err_stream << std::setw(12) << reinterpret_cast<uint64_t>(this->ip) << std::setw(1); \
@@ -2769,13 +3504,34 @@ void VM::run() {
   }
 
 // Runs at the end of each instruction
-#define OPCODE_EPILOGUE()                                                                                 \
-  if (this->context.instruction_profile) {                                                                \
-    std::chrono::duration<double> exec_duration = std::chrono::high_resolution_clock::now() - exec_start; \
-    uint64_t duration_in_nanoseconds = static_cast<uint32_t>(exec_duration.count() * 1000000000);         \
-    if (this->context.instruction_profile) {                                                              \
-      this->instruction_profile.add_entry(opcode, duration_in_nanoseconds);                               \
-    }                                                                                                     \
+#define OPCODE_EPILOGUE()                                                                   \
+  if constexpr (kInstructionProfile) {                                                      \
+    this->instruction_profile.add_entry(opcode, old_ip, read_cycle_counter() - exec_start); \
+  }
+
+// Calls, returns and backward branches check if the sampling profiler asked for a sample
+#define PROFILER_SAFEPOINT()         \
+  if (this->profiler.sample_due()) { \
+    this->record_profiler_sample();  \
+  }
+
+// Calls, returns and backward branches throw the out of memory exception requested by the garbage collector
+#define MEMORY_SAFEPOINT()                  \
+  if (this->gc.out_of_memory_pending()) {   \
+    this->throw_out_of_memory_exception(); \
+    DISPATCH();                             \
+  }
+
+// Calls, returns and backward branches continue in native code once the JIT compiled their target
+//
+// If COUNT is true, arriving at the target counts towards the hotness of the function in the current frame
+#define JIT_SAFEPOINT(COUNT)                                         \
+  if (this->jit.is_enabled() && this->enter_compiled_code(COUNT)) { \
+    DISPATCH_POSSIBLY_NULL();                                        \
+  }
+#define JIT_LOOP_SAFEPOINT() \
+  if (this->ip < old_ip) {   \
+    JIT_SAFEPOINT(true);     \
   }
 
 // Increment the instruction pointer
@@ -2799,6 +3555,17 @@ void VM::run() {
   INCIP();       \
   DISPATCH();
 
+// Rewrites the current instruction into its number specialized variant
+// if the two operands on top of the stack are both numbers
+#define QUICKEN_NUMERIC(O)                                                                     \
+  if (this->stack.size() >= 2 && charly_is_number(this->stack[this->stack.size() - 1]) &&      \
+      charly_is_number(this->stack[this->stack.size() - 2])) {                                 \
+    __atomic_store_n(this->ip, O, __ATOMIC_RELAXED);                                           \
+  }
+
+// Rewrites the current instruction back into its generic variant
+#define DEOPTIMIZE(O) __atomic_store_n(this->ip, O, __ATOMIC_RELAXED);
+
   // Dispatch table used for the computed goto main interpreter switch
   static void* OPCODE_DISPATCH_TABLE[] = {&&charly_main_switch_nop,
                                           &&charly_main_switch_readlocal,
@@ -2831,8 +3598,6 @@ void VM::run() {
                                           &&charly_main_switch_return,
                                           &&charly_main_switch_yield,
                                           &&charly_main_switch_throw,
-                                          &&charly_main_switch_registercatchtable,
-                                          &&charly_main_switch_popcatchtable,
                                           &&charly_main_switch_branch,
                                           &&charly_main_switch_branchif,
                                           &&charly_main_switch_branchunless,
@@ -2865,7 +3630,40 @@ void VM::run() {
                                           &&charly_main_switch_ubnot,
                                           &&charly_main_switch_halt,
                                           &&charly_main_switch_gccollect,
-                                          &&charly_main_switch_typeof};
+                                          &&charly_main_switch_typeof,
+                                          &&charly_main_switch_readlocalmembersymbol,
+                                          &&charly_main_switch_putselfmembersymbol,
+                                          &&charly_main_switch_readlocalpair,
+                                          &&charly_main_switch_addnum,
+                                          &&charly_main_switch_subnum,
+                                          &&charly_main_switch_mulnum,
+                                          &&charly_main_switch_ltnum,
+                                          &&charly_main_switch_gtnum,
+                                          &&charly_main_switch_lenum,
+                                          &&charly_main_switch_genum,
+                                          &&charly_main_switch_branchltnum,
+                                          &&charly_main_switch_branchgtnum,
+                                          &&charly_main_switch_branchlenum,
+                                          &&charly_main_switch_branchgenum,
+                                          &&charly_main_switch_tailcall,
+                                          &&charly_main_switch_tailcallmember,
+                                          &&charly_main_switch_branchtable,
+                                          &&charly_main_switch_loopincrement,
+                                          &&charly_main_switch_readglobal,
+                                          &&charly_main_switch_setglobalpush,
+                                          &&charly_main_switch_setglobal,
+                                          &&charly_main_switch_readglobalmembersymbol};
+
+  // Native profilers only know the symbol of the whole loop, so each handler gets its own
+  if (this->context.perf_map) {
+    std::string prefix = "charly::";
+    if (kInstructionProfile)
+      prefix += "profiled::";
+    if (kTraceOpcodes)
+      prefix += "traced::";
+    PerfMap::add_dispatch_table(OPCODE_DISPATCH_TABLE, kOpcodeMnemonics, kOpcodeCount, &&charly_main_switch_end,
+                                prefix);
+  }
 
   DISPATCH();
 charly_main_switch_nop : {
@@ -2886,7 +3684,8 @@ charly_main_switch_readlocal : {
 charly_main_switch_readmembersymbol : {
   OPCODE_PROLOGUE();
   VALUE symbol = *reinterpret_cast<VALUE*>(this->ip + sizeof(Opcode));
-  this->op_readmembersymbol(symbol);
+  uint32_t* cache_index = reinterpret_cast<uint32_t*>(this->ip + sizeof(Opcode) + sizeof(VALUE));
+  this->op_readmembersymbol(symbol, cache_index);
   OPCODE_EPILOGUE();
   NEXTOP();
 }
@@ -2991,11 +3790,7 @@ charly_main_switch_putstring : {
   uint32_t offset = *reinterpret_cast<uint32_t*>(this->ip + sizeof(Opcode));
   uint32_t length = *reinterpret_cast<uint32_t*>(this->ip + sizeof(Opcode) + sizeof(uint32_t));
 
-  // We assume the compiler generated valid offsets and lengths, so we don't do
-  // any out-of-bounds checking here
-  // TODO: Should we do out-of-bounds checking here?
-  char* str_start = reinterpret_cast<char*>(this->context.stringpool.get_data() + offset);
-  this->op_putstring(str_start, length);
+  this->op_putstring(offset, length);
 
   OPCODE_EPILOGUE();
   NEXTOP();
@@ -3012,8 +3807,11 @@ charly_main_switch_putfunction : {
                                                sizeof(bool) + sizeof(bool));
   uint32_t lvarcount = *reinterpret_cast<uint32_t*>(this->ip + sizeof(Opcode) + sizeof(VALUE) + sizeof(int32_t) +
                                                     sizeof(bool) + sizeof(bool) + sizeof(uint32_t));
+  uint32_t max_stack_depth = *reinterpret_cast<uint32_t*>(this->ip + sizeof(Opcode) + sizeof(VALUE) +
+                                                          sizeof(int32_t) + sizeof(bool) + sizeof(bool) +
+                                                          sizeof(uint32_t) + sizeof(uint32_t));
 
-  this->op_putfunction(symbol, this->ip + body_offset, anonymous, needs_arguments, argc, lvarcount);
+  this->op_putfunction(symbol, this->ip + body_offset, anonymous, needs_arguments, argc, lvarcount, max_stack_depth);
   OPCODE_EPILOGUE();
   NEXTOP();
 }
@@ -3021,7 +3819,7 @@ charly_main_switch_putfunction : {
 charly_main_switch_putcfunction : {
   OPCODE_PROLOGUE();
   VALUE symbol = *reinterpret_cast<VALUE*>(this->ip + sizeof(Opcode));
-  void* pointer = this->ip + sizeof(Opcode) + sizeof(VALUE);
+  void* pointer = *reinterpret_cast<void**>(this->ip + sizeof(Opcode) + sizeof(VALUE));
   uint32_t argc = *reinterpret_cast<uint32_t*>(this->ip + sizeof(Opcode) + sizeof(VALUE) + sizeof(void*));
   this->op_putcfunction(symbol, pointer, argc);
   OPCODE_EPILOGUE();
@@ -3032,8 +3830,9 @@ charly_main_switch_putgenerator : {
   OPCODE_PROLOGUE();
   VALUE symbol = *reinterpret_cast<VALUE*>(this->ip + sizeof(Opcode));
   int32_t body_offset = *reinterpret_cast<int32_t*>(this->ip + sizeof(Opcode) + sizeof(VALUE));
+  uint32_t max_stack_depth = *reinterpret_cast<uint32_t*>(this->ip + sizeof(Opcode) + sizeof(VALUE) + sizeof(int32_t));
 
-  this->op_putgenerator(symbol, this->ip + body_offset);
+  this->op_putgenerator(symbol, this->ip + body_offset, max_stack_depth);
   OPCODE_EPILOGUE();
   NEXTOP();
 }
@@ -3106,6 +3905,8 @@ charly_main_switch_swap : {
 
 charly_main_switch_call : {
   OPCODE_PROLOGUE();
+  PROFILER_SAFEPOINT();
+  MEMORY_SAFEPOINT();
   uint32_t argc = *reinterpret_cast<uint32_t*>(this->ip + sizeof(Opcode));
   this->op_call(argc);
   OPCODE_EPILOGUE();
@@ -3113,22 +3914,29 @@ charly_main_switch_call : {
   if (this->ip == nullptr) {
     this->panic(Status::InvalidInstructionPointer);
   }
+  JIT_SAFEPOINT(this->ip != old_ip + kInstructionLengths[opcode]);
   DISPATCH();
 }
 
 charly_main_switch_callmember : {
   OPCODE_PROLOGUE();
+  PROFILER_SAFEPOINT();
+  MEMORY_SAFEPOINT();
   uint32_t argc = *reinterpret_cast<uint32_t*>(this->ip + sizeof(Opcode));
   this->op_callmember(argc);
   OPCODE_EPILOGUE();
   CONDINCIP();
+  JIT_SAFEPOINT(this->ip != old_ip + kInstructionLengths[opcode]);
   DISPATCH();
 }
 
 charly_main_switch_return : {
   OPCODE_PROLOGUE();
+  PROFILER_SAFEPOINT();
+  MEMORY_SAFEPOINT();
   this->op_return();
   OPCODE_EPILOGUE();
+  JIT_SAFEPOINT(false);
   DISPATCH_POSSIBLY_NULL();
 }
 
@@ -3146,27 +3954,15 @@ charly_main_switch_throw : {
   DISPATCH();
 }
 
-charly_main_switch_registercatchtable : {
-  OPCODE_PROLOGUE();
-  int32_t offset = *reinterpret_cast<int32_t*>(this->ip + sizeof(Opcode));
-  this->op_registercatchtable(offset);
-  OPCODE_EPILOGUE();
-  NEXTOP();
-}
-
-charly_main_switch_popcatchtable : {
-  OPCODE_PROLOGUE();
-  this->op_popcatchtable();
-  OPCODE_EPILOGUE();
-  NEXTOP();
-}
-
 charly_main_switch_branch : {
   OPCODE_PROLOGUE();
+  PROFILER_SAFEPOINT();
+  MEMORY_SAFEPOINT();
   int32_t offset = *reinterpret_cast<int32_t*>(this->ip + sizeof(Opcode));
   this->op_branch(offset);
   OPCODE_EPILOGUE();
   CONDINCIP();
+  JIT_LOOP_SAFEPOINT();
   DISPATCH();
 }
 
@@ -3176,6 +3972,7 @@ charly_main_switch_branchif : {
   this->op_branchif(offset);
   OPCODE_EPILOGUE();
   CONDINCIP();
+  JIT_LOOP_SAFEPOINT();
   DISPATCH();
 }
 
@@ -3185,42 +3982,51 @@ charly_main_switch_branchunless : {
   this->op_branchunless(offset);
   OPCODE_EPILOGUE();
   CONDINCIP();
+  JIT_LOOP_SAFEPOINT();
   DISPATCH();
 }
 
 charly_main_switch_branchlt : {
   OPCODE_PROLOGUE();
   int32_t offset = *reinterpret_cast<int32_t*>(this->ip + sizeof(Opcode));
+  QUICKEN_NUMERIC(Opcode::BranchLtNum);
   this->op_branchlt(offset);
   OPCODE_EPILOGUE();
   CONDINCIP();
+  JIT_LOOP_SAFEPOINT();
   DISPATCH();
 }
 
 charly_main_switch_branchgt : {
   OPCODE_PROLOGUE();
   int32_t offset = *reinterpret_cast<int32_t*>(this->ip + sizeof(Opcode));
+  QUICKEN_NUMERIC(Opcode::BranchGtNum);
   this->op_branchgt(offset);
   OPCODE_EPILOGUE();
   CONDINCIP();
+  JIT_LOOP_SAFEPOINT();
   DISPATCH();
 }
 
 charly_main_switch_branchle : {
   OPCODE_PROLOGUE();
   int32_t offset = *reinterpret_cast<int32_t*>(this->ip + sizeof(Opcode));
+  QUICKEN_NUMERIC(Opcode::BranchLeNum);
   this->op_branchle(offset);
   OPCODE_EPILOGUE();
   CONDINCIP();
+  JIT_LOOP_SAFEPOINT();
   DISPATCH();
 }
 
 charly_main_switch_branchge : {
   OPCODE_PROLOGUE();
   int32_t offset = *reinterpret_cast<int32_t*>(this->ip + sizeof(Opcode));
+  QUICKEN_NUMERIC(Opcode::BranchGeNum);
   this->op_branchge(offset);
   OPCODE_EPILOGUE();
   CONDINCIP();
+  JIT_LOOP_SAFEPOINT();
   DISPATCH();
 }
 
@@ -3230,6 +4036,7 @@ charly_main_switch_brancheq : {
   this->op_brancheq(offset);
   OPCODE_EPILOGUE();
   CONDINCIP();
+  JIT_LOOP_SAFEPOINT();
   DISPATCH();
 }
 
@@ -3239,11 +4046,13 @@ charly_main_switch_branchneq : {
   this->op_branchneq(offset);
   OPCODE_EPILOGUE();
   CONDINCIP();
+  JIT_LOOP_SAFEPOINT();
   DISPATCH();
 }
 
 charly_main_switch_add : {
   OPCODE_PROLOGUE();
+  QUICKEN_NUMERIC(Opcode::AddNum);
   VALUE right = this->pop_stack();
   VALUE left = this->pop_stack();
   this->push_stack(this->add(left, right));
@@ -3253,6 +4062,7 @@ charly_main_switch_add : {
 
 charly_main_switch_sub : {
   OPCODE_PROLOGUE();
+  QUICKEN_NUMERIC(Opcode::SubNum);
   VALUE right = this->pop_stack();
   VALUE left = this->pop_stack();
   this->push_stack(this->sub(left, right));
@@ -3262,6 +4072,7 @@ charly_main_switch_sub : {
 
 charly_main_switch_mul : {
   OPCODE_PROLOGUE();
+  QUICKEN_NUMERIC(Opcode::MulNum);
   VALUE right = this->pop_stack();
   VALUE left = this->pop_stack();
   this->push_stack(this->mul(left, right));
@@ -3332,6 +4143,7 @@ charly_main_switch_neq : {
 
 charly_main_switch_lt : {
   OPCODE_PROLOGUE();
+  QUICKEN_NUMERIC(Opcode::LtNum);
   VALUE right = this->pop_stack();
   VALUE left = this->pop_stack();
   this->push_stack(this->lt(left, right));
@@ -3341,6 +4153,7 @@ charly_main_switch_lt : {
 
 charly_main_switch_gt : {
   OPCODE_PROLOGUE();
+  QUICKEN_NUMERIC(Opcode::GtNum);
   VALUE right = this->pop_stack();
   VALUE left = this->pop_stack();
   this->push_stack(this->gt(left, right));
@@ -3350,6 +4163,7 @@ charly_main_switch_gt : {
 
 charly_main_switch_le : {
   OPCODE_PROLOGUE();
+  QUICKEN_NUMERIC(Opcode::LeNum);
   VALUE right = this->pop_stack();
   VALUE left = this->pop_stack();
   this->push_stack(this->le(left, right));
@@ -3359,6 +4173,7 @@ charly_main_switch_le : {
 
 charly_main_switch_ge : {
   OPCODE_PROLOGUE();
+  QUICKEN_NUMERIC(Opcode::GeNum);
   VALUE right = this->pop_stack();
   VALUE left = this->pop_stack();
   this->push_stack(this->ge(left, right));
@@ -3447,61 +4262,1043 @@ charly_main_switch_typeof : {
   OPCODE_EPILOGUE();
   NEXTOP();
 }
-}
 
-void VM::exec_prelude() {
-  // Charly = {
-  //   internals: {
-  //     get_method: <Internals::get_method>
-  //   }
-  // }
-  this->top_frame =
-      this->create_frame(kNull, this->frames, Compilation::kKnownTopLevelConstants.size(), nullptr);
-  this->op_putcfunction(this->context.symtable("get_method"), reinterpret_cast<void*>(Internals::get_method), 1);
-  this->op_putvalue(this->context.symtable("get_method"));
-  this->op_puthash(1);
-  this->op_putvalue(this->context.symtable("internals"));
-  this->op_puthash(1);
-
-  // The Charly value is the first top level constant
-  this->op_setlocal(0, 0);
-  this->op_pop();
+charly_main_switch_readlocalmembersymbol : {
+  OPCODE_PROLOGUE();
+  uint32_t index = *reinterpret_cast<uint32_t*>(this->ip + sizeof(Opcode));
+  uint32_t level = *reinterpret_cast<uint32_t*>(this->ip + sizeof(Opcode) + sizeof(uint32_t));
+  VALUE symbol = *reinterpret_cast<VALUE*>(this->ip + sizeof(Opcode) + sizeof(uint32_t) * 2);
+  uint32_t* cache_index = reinterpret_cast<uint32_t*>(this->ip + sizeof(Opcode) + sizeof(uint32_t) * 2 + sizeof(VALUE));
+  this->op_readlocalmembersymbol(index, level, symbol, cache_index);
+  OPCODE_EPILOGUE();
+  NEXTOP();
 }
 
-uint8_t VM::start_runtime() {
-  this->starttime = std::chrono::high_resolution_clock::now();
+charly_main_switch_putselfmembersymbol : {
+  OPCODE_PROLOGUE();
+  uint32_t level = *reinterpret_cast<uint32_t*>(this->ip + sizeof(Opcode));
+  VALUE symbol = *reinterpret_cast<VALUE*>(this->ip + sizeof(Opcode) + sizeof(uint32_t));
+  uint32_t* cache_index = reinterpret_cast<uint32_t*>(this->ip + sizeof(Opcode) + sizeof(uint32_t) + sizeof(VALUE));
+  this->op_putselfmembersymbol(level, symbol, cache_index);
+  OPCODE_EPILOGUE();
+  NEXTOP();
+}
 
-  while (this->running) {
-    Timestamp now = std::chrono::steady_clock::now();
+charly_main_switch_readlocalpair : {
+  OPCODE_PROLOGUE();
+  uint32_t index1 = *reinterpret_cast<uint32_t*>(this->ip + sizeof(Opcode));
+  uint32_t level1 = *reinterpret_cast<uint32_t*>(this->ip + sizeof(Opcode) + sizeof(uint32_t));
+  uint32_t index2 = *reinterpret_cast<uint32_t*>(this->ip + sizeof(Opcode) + sizeof(uint32_t) * 2);
+  uint32_t level2 = *reinterpret_cast<uint32_t*>(this->ip + sizeof(Opcode) + sizeof(uint32_t) * 3);
+  this->op_readlocalpair(index1, level1, index2, level2);
+  OPCODE_EPILOGUE();
+  NEXTOP();
+}
 
-    // Add all expired timers and intervals to the task_queue
-    if (this->timers.size()) {
-      auto it = this->timers.begin();
-      while (it != this->timers.end() && it->first <= now) {
-        now = std::chrono::steady_clock::now();
-        this->register_task(it->second);
-        this->timers.erase(it);
-        it = this->timers.begin();
-      }
-    }
-    if (this->intervals.size()) {
-      auto it = this->intervals.begin();
-      while (it != this->intervals.end() && it->first <= now) {
-        now = std::chrono::steady_clock::now();
-        this->register_task(std::get<0>(it->second));
-        this->intervals.insert({now + std::chrono::milliseconds(std::get<1>(it->second)), it->second});
-        this->intervals.erase(it);
-        it = this->intervals.begin();
+charly_main_switch_addnum : {
+  OPCODE_PROLOGUE();
+  VALUE right = this->pop_stack();
+  VALUE left = this->pop_stack();
+  if (charly_is_number(left) && charly_is_number(right)) {
+    this->push_stack(charly_add_number(left, right));
+  } else {
+    DEOPTIMIZE(Opcode::Add);
+    this->push_stack(this->add(left, right));
+  }
+  OPCODE_EPILOGUE();
+  NEXTOP();
+}
+
+charly_main_switch_subnum : {
+  OPCODE_PROLOGUE();
+  VALUE right = this->pop_stack();
+  VALUE left = this->pop_stack();
+  if (charly_is_number(left) && charly_is_number(right)) {
+    this->push_stack(charly_sub_number(left, right));
+  } else {
+    DEOPTIMIZE(Opcode::Sub);
+    this->push_stack(this->sub(left, right));
+  }
+  OPCODE_EPILOGUE();
+  NEXTOP();
+}
+
+charly_main_switch_mulnum : {
+  OPCODE_PROLOGUE();
+  VALUE right = this->pop_stack();
+  VALUE left = this->pop_stack();
+  if (charly_is_number(left) && charly_is_number(right)) {
+    this->push_stack(charly_mul_number(left, right));
+  } else {
+    DEOPTIMIZE(Opcode::Mul);
+    this->push_stack(this->mul(left, right));
+  }
+  OPCODE_EPILOGUE();
+  NEXTOP();
+}
+
+charly_main_switch_ltnum : {
+  OPCODE_PROLOGUE();
+  VALUE right = this->pop_stack();
+  VALUE left = this->pop_stack();
+  if (charly_is_number(left) && charly_is_number(right)) {
+    this->push_stack(charly_lt_number(left, right));
+  } else {
+    DEOPTIMIZE(Opcode::Lt);
+    this->push_stack(this->lt(left, right));
+  }
+  OPCODE_EPILOGUE();
+  NEXTOP();
+}
+
+charly_main_switch_gtnum : {
+  OPCODE_PROLOGUE();
+  VALUE right = this->pop_stack();
+  VALUE left = this->pop_stack();
+  if (charly_is_number(left) && charly_is_number(right)) {
+    this->push_stack(charly_gt_number(left, right));
+  } else {
+    DEOPTIMIZE(Opcode::Gt);
+    this->push_stack(this->gt(left, right));
+  }
+  OPCODE_EPILOGUE();
+  NEXTOP();
+}
+
+charly_main_switch_lenum : {
+  OPCODE_PROLOGUE();
+  VALUE right = this->pop_stack();
+  VALUE left = this->pop_stack();
+  if (charly_is_number(left) && charly_is_number(right)) {
+    this->push_stack(charly_le_number(left, right));
+  } else {
+    DEOPTIMIZE(Opcode::Le);
+    this->push_stack(this->le(left, right));
+  }
+  OPCODE_EPILOGUE();
+  NEXTOP();
+}
+
+charly_main_switch_genum : {
+  OPCODE_PROLOGUE();
+  VALUE right = this->pop_stack();
+  VALUE left = this->pop_stack();
+  if (charly_is_number(left) && charly_is_number(right)) {
+    this->push_stack(charly_ge_number(left, right));
+  } else {
+    DEOPTIMIZE(Opcode::Ge);
+    this->push_stack(this->ge(left, right));
+  }
+  OPCODE_EPILOGUE();
+  NEXTOP();
+}
+
+charly_main_switch_branchltnum : {
+  OPCODE_PROLOGUE();
+  int32_t offset = *reinterpret_cast<int32_t*>(this->ip + sizeof(Opcode));
+  VALUE right = this->pop_stack();
+  VALUE left = this->pop_stack();
+  if (charly_is_number(left) && charly_is_number(right)) {
+    if (charly_lt_number(left, right) == kTrue)
+      this->ip += offset;
+  } else {
+    DEOPTIMIZE(Opcode::BranchLt);
+    if (this->lt(left, right) == kTrue)
+      this->ip += offset;
+  }
+  OPCODE_EPILOGUE();
+  CONDINCIP();
+  JIT_LOOP_SAFEPOINT();
+  DISPATCH();
+}
+
+charly_main_switch_branchgtnum : {
+  OPCODE_PROLOGUE();
+  int32_t offset = *reinterpret_cast<int32_t*>(this->ip + sizeof(Opcode));
+  VALUE right = this->pop_stack();
+  VALUE left = this->pop_stack();
+  if (charly_is_number(left) && charly_is_number(right)) {
+    if (charly_gt_number(left, right) == kTrue)
+      this->ip += offset;
+  } else {
+    DEOPTIMIZE(Opcode::BranchGt);
+    if (this->gt(left, right) == kTrue)
+      this->ip += offset;
+  }
+  OPCODE_EPILOGUE();
+  CONDINCIP();
+  JIT_LOOP_SAFEPOINT();
+  DISPATCH();
+}
+
+charly_main_switch_branchlenum : {
+  OPCODE_PROLOGUE();
+  int32_t offset = *reinterpret_cast<int32_t*>(this->ip + sizeof(Opcode));
+  VALUE right = this->pop_stack();
+  VALUE left = this->pop_stack();
+  if (charly_is_number(left) && charly_is_number(right)) {
+    if (charly_le_number(left, right) == kTrue)
+      this->ip += offset;
+  } else {
+    DEOPTIMIZE(Opcode::BranchLe);
+    if (this->le(left, right) == kTrue)
+      this->ip += offset;
+  }
+  OPCODE_EPILOGUE();
+  CONDINCIP();
+  JIT_LOOP_SAFEPOINT();
+  DISPATCH();
+}
+
+charly_main_switch_branchgenum : {
+  OPCODE_PROLOGUE();
+  int32_t offset = *reinterpret_cast<int32_t*>(this->ip + sizeof(Opcode));
+  VALUE right = this->pop_stack();
+  VALUE left = this->pop_stack();
+  if (charly_is_number(left) && charly_is_number(right)) {
+    if (charly_ge_number(left, right) == kTrue)
+      this->ip += offset;
+  } else {
+    DEOPTIMIZE(Opcode::BranchGe);
+    if (this->ge(left, right) == kTrue)
+      this->ip += offset;
+  }
+  OPCODE_EPILOGUE();
+  CONDINCIP();
+  JIT_LOOP_SAFEPOINT();
+  DISPATCH();
+}
+
+charly_main_switch_tailcall : {
+  OPCODE_PROLOGUE();
+  PROFILER_SAFEPOINT();
+  MEMORY_SAFEPOINT();
+  uint32_t argc = *reinterpret_cast<uint32_t*>(this->ip + sizeof(Opcode));
+  this->op_tailcall(argc);
+  OPCODE_EPILOGUE();
+  CONDINCIP();
+  if (this->ip == nullptr) {
+    this->panic(Status::InvalidInstructionPointer);
+  }
+  JIT_SAFEPOINT(this->ip != old_ip + kInstructionLengths[opcode]);
+  DISPATCH();
+}
+
+charly_main_switch_tailcallmember : {
+  OPCODE_PROLOGUE();
+  PROFILER_SAFEPOINT();
+  MEMORY_SAFEPOINT();
+  uint32_t argc = *reinterpret_cast<uint32_t*>(this->ip + sizeof(Opcode));
+  this->op_tailcallmember(argc);
+  OPCODE_EPILOGUE();
+  CONDINCIP();
+  JIT_SAFEPOINT(this->ip != old_ip + kInstructionLengths[opcode]);
+  DISPATCH();
+}
+
+charly_main_switch_branchtable : {
+  OPCODE_PROLOGUE();
+  uint32_t table_index = *reinterpret_cast<uint32_t*>(this->ip + sizeof(Opcode));
+  uint32_t* cache_index = reinterpret_cast<uint32_t*>(this->ip + sizeof(Opcode) + sizeof(uint32_t));
+  this->op_branchtable(table_index, cache_index);
+  OPCODE_EPILOGUE();
+  CONDINCIP();
+  DISPATCH();
+}
+
+charly_main_switch_loopincrement : {
+  OPCODE_PROLOGUE();
+  PROFILER_SAFEPOINT();
+  MEMORY_SAFEPOINT();
+  int32_t offset = *reinterpret_cast<int32_t*>(this->ip + sizeof(Opcode));
+  uint32_t index = *reinterpret_cast<uint32_t*>(this->ip + sizeof(Opcode) + sizeof(int32_t));
+  uint32_t level = *reinterpret_cast<uint32_t*>(this->ip + sizeof(Opcode) + sizeof(int32_t) + sizeof(uint32_t));
+  VALUE step = *reinterpret_cast<VALUE*>(this->ip + sizeof(Opcode) + sizeof(int32_t) + sizeof(uint32_t) * 2);
+  Opcode comparison =
+      *reinterpret_cast<Opcode*>(this->ip + sizeof(Opcode) + sizeof(int32_t) + sizeof(uint32_t) * 2 + sizeof(VALUE));
+  this->op_loopincrement(offset, index, level, step, comparison);
+  OPCODE_EPILOGUE();
+  CONDINCIP();
+  JIT_LOOP_SAFEPOINT();
+  DISPATCH();
+}
+
+charly_main_switch_readglobal : {
+  OPCODE_PROLOGUE();
+  uint32_t index = *reinterpret_cast<uint32_t*>(this->ip + sizeof(Opcode));
+  this->op_readglobal(index);
+  OPCODE_EPILOGUE();
+  NEXTOP();
+}
+
+charly_main_switch_setglobalpush : {
+  OPCODE_PROLOGUE();
+  uint32_t index = *reinterpret_cast<uint32_t*>(this->ip + sizeof(Opcode));
+  this->op_setglobalpush(index);
+  OPCODE_EPILOGUE();
+  NEXTOP();
+}
+
+charly_main_switch_setglobal : {
+  OPCODE_PROLOGUE();
+  uint32_t index = *reinterpret_cast<uint32_t*>(this->ip + sizeof(Opcode));
+  this->op_setglobal(index);
+  OPCODE_EPILOGUE();
+  NEXTOP();
+}
+
+charly_main_switch_readglobalmembersymbol : {
+  OPCODE_PROLOGUE();
+  uint32_t index = *reinterpret_cast<uint32_t*>(this->ip + sizeof(Opcode));
+  VALUE symbol = *reinterpret_cast<VALUE*>(this->ip + sizeof(Opcode) + sizeof(uint32_t));
+  uint32_t* cache_index = reinterpret_cast<uint32_t*>(this->ip + sizeof(Opcode) + sizeof(uint32_t) + sizeof(VALUE));
+  this->op_readglobalmembersymbol(index, symbol, cache_index);
+  OPCODE_EPILOGUE();
+  NEXTOP();
+}
+
+// Never reached, marks the end of the last handler for the perf map
+charly_main_switch_end:
+  return;
+}
+
+template <Opcode O>
+uint8_t* VM::jit_execute(VM* vm, uint8_t* ip) {
+  vm->ip = ip;
+
+  // Calls, returns and backward branches are safepoints for the sampling profiler, just like in the interpreter
+  if constexpr (O == Opcode::Call || O == Opcode::CallMember || O == Opcode::Return || O == Opcode::Branch ||
+                O == Opcode::TailCall || O == Opcode::TailCallMember || O == Opcode::LoopIncrement) {
+    if (vm->profiler.sample_due()) {
+      vm->record_profiler_sample();
+    }
+
+    if (vm->gc.out_of_memory_pending()) {
+      vm->throw_out_of_memory_exception();
+      return vm->halted ? nullptr : vm->ip;
+    }
+  }
+
+  // Same as the handlers in VM::run_loop, minus the quickening of generic instructions
+  switch (O) {
+    case Opcode::Nop: {
+      break;
+    }
+    case Opcode::ReadLocal: {
+      uint32_t index = *reinterpret_cast<uint32_t*>(ip + sizeof(Opcode));
+      uint32_t level = *reinterpret_cast<uint32_t*>(ip + sizeof(Opcode) + sizeof(uint32_t));
+      vm->op_readlocal(index, level);
+      break;
+    }
+    case Opcode::ReadMemberSymbol: {
+      VALUE symbol = *reinterpret_cast<VALUE*>(ip + sizeof(Opcode));
+      uint32_t* cache_index = reinterpret_cast<uint32_t*>(ip + sizeof(Opcode) + sizeof(VALUE));
+      vm->op_readmembersymbol(symbol, cache_index);
+      break;
+    }
+    case Opcode::ReadMemberValue: {
+      vm->op_readmembervalue();
+      break;
+    }
+    case Opcode::ReadArrayIndex: {
+      uint32_t index = *reinterpret_cast<uint32_t*>(ip + sizeof(Opcode));
+      vm->op_readarrayindex(index);
+      break;
+    }
+    case Opcode::SetLocalPush: {
+      uint32_t index = *reinterpret_cast<uint32_t*>(ip + sizeof(Opcode));
+      uint32_t level = *reinterpret_cast<uint32_t*>(ip + sizeof(Opcode) + sizeof(uint32_t));
+      vm->op_setlocalpush(index, level);
+      break;
+    }
+    case Opcode::SetMemberSymbolPush: {
+      VALUE symbol = *reinterpret_cast<VALUE*>(ip + sizeof(Opcode));
+      vm->op_setmembersymbolpush(symbol);
+      break;
+    }
+    case Opcode::SetMemberValuePush: {
+      vm->op_setmembervaluepush();
+      break;
+    }
+    case Opcode::SetArrayIndexPush: {
+      uint32_t index = *reinterpret_cast<uint32_t*>(ip + sizeof(Opcode));
+      vm->op_setarrayindexpush(index);
+      break;
+    }
+    case Opcode::SetLocal: {
+      uint32_t index = *reinterpret_cast<uint32_t*>(ip + sizeof(Opcode));
+      uint32_t level = *reinterpret_cast<uint32_t*>(ip + sizeof(Opcode) + sizeof(uint32_t));
+      vm->op_setlocal(index, level);
+      break;
+    }
+    case Opcode::SetMemberSymbol: {
+      VALUE symbol = *reinterpret_cast<VALUE*>(ip + sizeof(Opcode));
+      vm->op_setmembersymbol(symbol);
+      break;
+    }
+    case Opcode::SetMemberValue: {
+      vm->op_setmembervalue();
+      break;
+    }
+    case Opcode::SetArrayIndex: {
+      uint32_t index = *reinterpret_cast<uint32_t*>(ip + sizeof(Opcode));
+      vm->op_setarrayindex(index);
+      break;
+    }
+    case Opcode::PutSelf: {
+      uint32_t level = *reinterpret_cast<uint32_t*>(ip + sizeof(Opcode));
+      vm->op_putself(level);
+      break;
+    }
+    case Opcode::PutValue: {
+      VALUE value = *reinterpret_cast<VALUE*>(ip + sizeof(Opcode));
+      vm->op_putvalue(value);
+      break;
+    }
+    case Opcode::PutString: {
+      uint32_t offset = *reinterpret_cast<uint32_t*>(ip + sizeof(Opcode));
+      uint32_t length = *reinterpret_cast<uint32_t*>(ip + sizeof(Opcode) + sizeof(uint32_t));
+      vm->op_putstring(offset, length);
+      break;
+    }
+    case Opcode::PutFunction: {
+      VALUE symbol = *reinterpret_cast<VALUE*>(ip + sizeof(Opcode));
+      int32_t body_offset = *reinterpret_cast<int32_t*>(ip + sizeof(Opcode) + sizeof(VALUE));
+      bool anonymous = *reinterpret_cast<bool*>(ip + sizeof(Opcode) + sizeof(VALUE) + sizeof(int32_t));
+      bool needs_arguments =
+          *reinterpret_cast<bool*>(ip + sizeof(Opcode) + sizeof(VALUE) + sizeof(int32_t) + sizeof(bool));
+      uint32_t argc = *reinterpret_cast<uint32_t*>(ip + sizeof(Opcode) + sizeof(VALUE) + sizeof(int32_t) +
+                                                   sizeof(bool) + sizeof(bool));
+      uint32_t lvarcount = *reinterpret_cast<uint32_t*>(ip + sizeof(Opcode) + sizeof(VALUE) + sizeof(int32_t) +
+                                                        sizeof(bool) + sizeof(bool) + sizeof(uint32_t));
+      uint32_t max_stack_depth = *reinterpret_cast<uint32_t*>(ip + sizeof(Opcode) + sizeof(VALUE) + sizeof(int32_t) +
+                                                              sizeof(bool) + sizeof(bool) + sizeof(uint32_t) +
+                                                              sizeof(uint32_t));
+      vm->op_putfunction(symbol, ip + body_offset, anonymous, needs_arguments, argc, lvarcount, max_stack_depth);
+      break;
+    }
+    case Opcode::PutCFunction: {
+      VALUE symbol = *reinterpret_cast<VALUE*>(ip + sizeof(Opcode));
+      void* pointer = *reinterpret_cast<void**>(ip + sizeof(Opcode) + sizeof(VALUE));
+      uint32_t argc = *reinterpret_cast<uint32_t*>(ip + sizeof(Opcode) + sizeof(VALUE) + sizeof(void*));
+      vm->op_putcfunction(symbol, pointer, argc);
+      break;
+    }
+    case Opcode::PutGenerator: {
+      VALUE symbol = *reinterpret_cast<VALUE*>(ip + sizeof(Opcode));
+      int32_t body_offset = *reinterpret_cast<int32_t*>(ip + sizeof(Opcode) + sizeof(VALUE));
+      uint32_t max_stack_depth = *reinterpret_cast<uint32_t*>(ip + sizeof(Opcode) + sizeof(VALUE) + sizeof(int32_t));
+      vm->op_putgenerator(symbol, ip + body_offset, max_stack_depth);
+      break;
+    }
+    case Opcode::PutArray: {
+      uint32_t count = *reinterpret_cast<uint32_t*>(ip + sizeof(Opcode));
+      vm->op_putarray(count);
+      break;
+    }
+    case Opcode::PutHash: {
+      uint32_t size = *reinterpret_cast<uint32_t*>(ip + sizeof(Opcode));
+      vm->op_puthash(size);
+      break;
+    }
+    case Opcode::PutClass: {
+      VALUE name = *reinterpret_cast<VALUE*>(ip + sizeof(Opcode));
+      uint32_t propertycount = *reinterpret_cast<VALUE*>(ip + sizeof(Opcode) + sizeof(VALUE));
+      uint32_t staticpropertycount =
+          *reinterpret_cast<uint32_t*>(ip + sizeof(Opcode) + sizeof(VALUE) + sizeof(uint32_t));
+      uint32_t methodcount =
+          *reinterpret_cast<uint32_t*>(ip + sizeof(Opcode) + sizeof(VALUE) + sizeof(uint32_t) + sizeof(uint32_t));
+      uint32_t staticmethodcount = *reinterpret_cast<uint32_t*>(ip + sizeof(Opcode) + sizeof(VALUE) +
+                                                                sizeof(uint32_t) + sizeof(uint32_t) + sizeof(uint32_t));
+      bool has_parent_class = *reinterpret_cast<bool*>(ip + sizeof(Opcode) + sizeof(VALUE) + sizeof(uint32_t) +
+                                                       sizeof(uint32_t) + sizeof(uint32_t) + sizeof(uint32_t));
+      bool has_constructor =
+          *reinterpret_cast<bool*>(ip + sizeof(Opcode) + sizeof(VALUE) + sizeof(uint32_t) + sizeof(uint32_t) +
+                                   sizeof(uint32_t) + sizeof(uint32_t) + sizeof(bool));
+      vm->op_putclass(name, propertycount, staticpropertycount, methodcount, staticmethodcount, has_parent_class,
+                      has_constructor);
+      break;
+    }
+    case Opcode::Pop: {
+      vm->op_pop();
+      break;
+    }
+    case Opcode::Dup: {
+      vm->op_dup();
+      break;
+    }
+    case Opcode::Dupn: {
+      uint32_t count = *reinterpret_cast<uint32_t*>(ip + sizeof(Opcode));
+      vm->op_dupn(count);
+      break;
+    }
+    case Opcode::Swap: {
+      vm->op_swap();
+      break;
+    }
+    case Opcode::Call: {
+      uint32_t argc = *reinterpret_cast<uint32_t*>(ip + sizeof(Opcode));
+      vm->op_call(argc);
+      break;
+    }
+    case Opcode::CallMember: {
+      uint32_t argc = *reinterpret_cast<uint32_t*>(ip + sizeof(Opcode));
+      vm->op_callmember(argc);
+      break;
+    }
+    case Opcode::Return: {
+      vm->op_return();
+      break;
+    }
+    case Opcode::Yield: {
+      vm->op_yield();
+      break;
+    }
+    case Opcode::Throw: {
+      vm->op_throw();
+      break;
+    }
+    case Opcode::Branch: {
+      vm->op_branch(*reinterpret_cast<int32_t*>(ip + sizeof(Opcode)));
+      break;
+    }
+    case Opcode::BranchIf: {
+      vm->op_branchif(*reinterpret_cast<int32_t*>(ip + sizeof(Opcode)));
+      break;
+    }
+    case Opcode::BranchUnless: {
+      vm->op_branchunless(*reinterpret_cast<int32_t*>(ip + sizeof(Opcode)));
+      break;
+    }
+    case Opcode::BranchLt:
+    case Opcode::BranchLtNum: {
+      vm->op_branchlt(*reinterpret_cast<int32_t*>(ip + sizeof(Opcode)));
+      break;
+    }
+    case Opcode::BranchGt:
+    case Opcode::BranchGtNum: {
+      vm->op_branchgt(*reinterpret_cast<int32_t*>(ip + sizeof(Opcode)));
+      break;
+    }
+    case Opcode::BranchLe:
+    case Opcode::BranchLeNum: {
+      vm->op_branchle(*reinterpret_cast<int32_t*>(ip + sizeof(Opcode)));
+      break;
+    }
+    case Opcode::BranchGe:
+    case Opcode::BranchGeNum: {
+      vm->op_branchge(*reinterpret_cast<int32_t*>(ip + sizeof(Opcode)));
+      break;
+    }
+    case Opcode::BranchEq: {
+      vm->op_brancheq(*reinterpret_cast<int32_t*>(ip + sizeof(Opcode)));
+      break;
+    }
+    case Opcode::BranchNeq: {
+      vm->op_branchneq(*reinterpret_cast<int32_t*>(ip + sizeof(Opcode)));
+      break;
+    }
+    case Opcode::Add:
+    case Opcode::AddNum: {
+      VALUE right = vm->pop_stack();
+      VALUE left = vm->pop_stack();
+      vm->push_stack(vm->add(left, right));
+      break;
+    }
+    case Opcode::Sub:
+    case Opcode::SubNum: {
+      VALUE right = vm->pop_stack();
+      VALUE left = vm->pop_stack();
+      vm->push_stack(vm->sub(left, right));
+      break;
+    }
+    case Opcode::Mul:
+    case Opcode::MulNum: {
+      VALUE right = vm->pop_stack();
+      VALUE left = vm->pop_stack();
+      vm->push_stack(vm->mul(left, right));
+      break;
+    }
+    case Opcode::Div: {
+      VALUE right = vm->pop_stack();
+      VALUE left = vm->pop_stack();
+      vm->push_stack(vm->div(left, right));
+      break;
+    }
+    case Opcode::Mod: {
+      VALUE right = vm->pop_stack();
+      VALUE left = vm->pop_stack();
+      vm->push_stack(vm->mod(left, right));
+      break;
+    }
+    case Opcode::Pow: {
+      VALUE right = vm->pop_stack();
+      VALUE left = vm->pop_stack();
+      vm->push_stack(vm->pow(left, right));
+      break;
+    }
+    case Opcode::Eq: {
+      VALUE right = vm->pop_stack();
+      VALUE left = vm->pop_stack();
+      vm->push_stack(vm->eq(left, right));
+      break;
+    }
+    case Opcode::Neq: {
+      VALUE right = vm->pop_stack();
+      VALUE left = vm->pop_stack();
+      vm->push_stack(vm->neq(left, right));
+      break;
+    }
+    case Opcode::Lt:
+    case Opcode::LtNum: {
+      VALUE right = vm->pop_stack();
+      VALUE left = vm->pop_stack();
+      vm->push_stack(vm->lt(left, right));
+      break;
+    }
+    case Opcode::Gt:
+    case Opcode::GtNum: {
+      VALUE right = vm->pop_stack();
+      VALUE left = vm->pop_stack();
+      vm->push_stack(vm->gt(left, right));
+      break;
+    }
+    case Opcode::Le:
+    case Opcode::LeNum: {
+      VALUE right = vm->pop_stack();
+      VALUE left = vm->pop_stack();
+      vm->push_stack(vm->le(left, right));
+      break;
+    }
+    case Opcode::Ge:
+    case Opcode::GeNum: {
+      VALUE right = vm->pop_stack();
+      VALUE left = vm->pop_stack();
+      vm->push_stack(vm->ge(left, right));
+      break;
+    }
+    case Opcode::Shr: {
+      VALUE right = vm->pop_stack();
+      VALUE left = vm->pop_stack();
+      vm->push_stack(vm->shr(left, right));
+      break;
+    }
+    case Opcode::Shl: {
+      VALUE right = vm->pop_stack();
+      VALUE left = vm->pop_stack();
+      vm->push_stack(vm->shl(left, right));
+      break;
+    }
+    case Opcode::And: {
+      VALUE right = vm->pop_stack();
+      VALUE left = vm->pop_stack();
+      vm->push_stack(vm->band(left, right));
+      break;
+    }
+    case Opcode::Or: {
+      VALUE right = vm->pop_stack();
+      VALUE left = vm->pop_stack();
+      vm->push_stack(vm->bor(left, right));
+      break;
+    }
+    case Opcode::Xor: {
+      VALUE right = vm->pop_stack();
+      VALUE left = vm->pop_stack();
+      vm->push_stack(vm->bxor(left, right));
+      break;
+    }
+    case Opcode::UAdd: {
+      vm->push_stack(vm->uadd(vm->pop_stack()));
+      break;
+    }
+    case Opcode::USub: {
+      vm->push_stack(vm->usub(vm->pop_stack()));
+      break;
+    }
+    case Opcode::UNot: {
+      vm->push_stack(vm->unot(vm->pop_stack()));
+      break;
+    }
+    case Opcode::UBNot: {
+      vm->push_stack(vm->ubnot(vm->pop_stack()));
+      break;
+    }
+    case Opcode::GCCollect: {
+      vm->gc.do_collect();
+      break;
+    }
+    case Opcode::Typeof: {
+      vm->op_typeof();
+      break;
+    }
+    case Opcode::ReadLocalMemberSymbol: {
+      uint32_t index = *reinterpret_cast<uint32_t*>(ip + sizeof(Opcode));
+      uint32_t level = *reinterpret_cast<uint32_t*>(ip + sizeof(Opcode) + sizeof(uint32_t));
+      VALUE symbol = *reinterpret_cast<VALUE*>(ip + sizeof(Opcode) + sizeof(uint32_t) * 2);
+      uint32_t* cache_index = reinterpret_cast<uint32_t*>(ip + sizeof(Opcode) + sizeof(uint32_t) * 2 + sizeof(VALUE));
+      vm->op_readlocalmembersymbol(index, level, symbol, cache_index);
+      break;
+    }
+    case Opcode::PutSelfMemberSymbol: {
+      uint32_t level = *reinterpret_cast<uint32_t*>(ip + sizeof(Opcode));
+      VALUE symbol = *reinterpret_cast<VALUE*>(ip + sizeof(Opcode) + sizeof(uint32_t));
+      uint32_t* cache_index = reinterpret_cast<uint32_t*>(ip + sizeof(Opcode) + sizeof(uint32_t) + sizeof(VALUE));
+      vm->op_putselfmembersymbol(level, symbol, cache_index);
+      break;
+    }
+    case Opcode::ReadLocalPair: {
+      uint32_t index1 = *reinterpret_cast<uint32_t*>(ip + sizeof(Opcode));
+      uint32_t level1 = *reinterpret_cast<uint32_t*>(ip + sizeof(Opcode) + sizeof(uint32_t));
+      uint32_t index2 = *reinterpret_cast<uint32_t*>(ip + sizeof(Opcode) + sizeof(uint32_t) * 2);
+      uint32_t level2 = *reinterpret_cast<uint32_t*>(ip + sizeof(Opcode) + sizeof(uint32_t) * 3);
+      vm->op_readlocalpair(index1, level1, index2, level2);
+      break;
+    }
+    case Opcode::TailCall: {
+      uint32_t argc = *reinterpret_cast<uint32_t*>(ip + sizeof(Opcode));
+      vm->op_tailcall(argc);
+      break;
+    }
+    case Opcode::TailCallMember: {
+      uint32_t argc = *reinterpret_cast<uint32_t*>(ip + sizeof(Opcode));
+      vm->op_tailcallmember(argc);
+      break;
+    }
+    case Opcode::BranchTable: {
+      uint32_t table_index = *reinterpret_cast<uint32_t*>(ip + sizeof(Opcode));
+      uint32_t* cache_index = reinterpret_cast<uint32_t*>(ip + sizeof(Opcode) + sizeof(uint32_t));
+      vm->op_branchtable(table_index, cache_index);
+      break;
+    }
+    case Opcode::LoopIncrement: {
+      int32_t offset = *reinterpret_cast<int32_t*>(ip + sizeof(Opcode));
+      uint32_t index = *reinterpret_cast<uint32_t*>(ip + sizeof(Opcode) + sizeof(int32_t));
+      uint32_t level = *reinterpret_cast<uint32_t*>(ip + sizeof(Opcode) + sizeof(int32_t) + sizeof(uint32_t));
+      VALUE step = *reinterpret_cast<VALUE*>(ip + sizeof(Opcode) + sizeof(int32_t) + sizeof(uint32_t) * 2);
+      Opcode comparison =
+          *reinterpret_cast<Opcode*>(ip + sizeof(Opcode) + sizeof(int32_t) + sizeof(uint32_t) * 2 + sizeof(VALUE));
+      vm->op_loopincrement(offset, index, level, step, comparison);
+      break;
+    }
+    case Opcode::ReadGlobal: {
+      uint32_t index = *reinterpret_cast<uint32_t*>(ip + sizeof(Opcode));
+      vm->op_readglobal(index);
+      break;
+    }
+    case Opcode::SetGlobalPush: {
+      uint32_t index = *reinterpret_cast<uint32_t*>(ip + sizeof(Opcode));
+      vm->op_setglobalpush(index);
+      break;
+    }
+    case Opcode::SetGlobal: {
+      uint32_t index = *reinterpret_cast<uint32_t*>(ip + sizeof(Opcode));
+      vm->op_setglobal(index);
+      break;
+    }
+    case Opcode::ReadGlobalMemberSymbol: {
+      uint32_t index = *reinterpret_cast<uint32_t*>(ip + sizeof(Opcode));
+      VALUE symbol = *reinterpret_cast<VALUE*>(ip + sizeof(Opcode) + sizeof(uint32_t));
+      uint32_t* cache_index = reinterpret_cast<uint32_t*>(ip + sizeof(Opcode) + sizeof(uint32_t) + sizeof(VALUE));
+      vm->op_readglobalmembersymbol(index, symbol, cache_index);
+      break;
+    }
+    default: {
+      break;
+    }
+  }
+
+  // Advance past the instruction the same way the interpreter does
+  //
+  // Instructions which may transfer control only advance if they didn't, returns,
+  // yields and throws never advance
+  switch (O) {
+    case Opcode::Call:
+    case Opcode::TailCall: {
+      if (vm->ip == ip) {
+        vm->ip += kInstructionLengths[O];
+      }
+      if (vm->ip == nullptr) {
+        vm->panic(Status::InvalidInstructionPointer);
+      }
+      break;
+    }
+    case Opcode::CallMember:
+    case Opcode::TailCallMember:
+    case Opcode::Branch:
+    case Opcode::BranchIf:
+    case Opcode::BranchUnless:
+    case Opcode::BranchLt:
+    case Opcode::BranchGt:
+    case Opcode::BranchLe:
+    case Opcode::BranchGe:
+    case Opcode::BranchEq:
+    case Opcode::BranchNeq:
+    case Opcode::BranchLtNum:
+    case Opcode::BranchGtNum:
+    case Opcode::BranchLeNum:
+    case Opcode::BranchGeNum:
+    case Opcode::BranchTable:
+    case Opcode::LoopIncrement: {
+      if (vm->ip == ip) {
+        vm->ip += kInstructionLengths[O];
+      }
+      break;
+    }
+    case Opcode::Return:
+    case Opcode::Yield:
+    case Opcode::Throw: {
+      break;
+    }
+    default: {
+      vm->ip += kInstructionLengths[O];
+      break;
+    }
+  }
+
+  return vm->halted ? nullptr : vm->ip;
+}
+
+const JITHelper* VM::jit_helpers() {
+  static const std::array<JITHelper, kOpcodeCount> helpers = []() {
+    std::array<JITHelper, kOpcodeCount> table = {};
+#define JIT_HELPER(O) table[Opcode::O] = &VM::jit_execute<Opcode::O>;
+    JIT_HELPER(Nop)
+    JIT_HELPER(ReadLocal)
+    JIT_HELPER(ReadMemberSymbol)
+    JIT_HELPER(ReadMemberValue)
+    JIT_HELPER(ReadArrayIndex)
+    JIT_HELPER(SetLocalPush)
+    JIT_HELPER(SetMemberSymbolPush)
+    JIT_HELPER(SetMemberValuePush)
+    JIT_HELPER(SetArrayIndexPush)
+    JIT_HELPER(SetLocal)
+    JIT_HELPER(SetMemberSymbol)
+    JIT_HELPER(SetMemberValue)
+    JIT_HELPER(SetArrayIndex)
+    JIT_HELPER(PutSelf)
+    JIT_HELPER(PutValue)
+    JIT_HELPER(PutString)
+    JIT_HELPER(PutFunction)
+    JIT_HELPER(PutCFunction)
+    JIT_HELPER(PutGenerator)
+    JIT_HELPER(PutArray)
+    JIT_HELPER(PutHash)
+    JIT_HELPER(PutClass)
+    JIT_HELPER(Pop)
+    JIT_HELPER(Dup)
+    JIT_HELPER(Dupn)
+    JIT_HELPER(Swap)
+    JIT_HELPER(Call)
+    JIT_HELPER(CallMember)
+    JIT_HELPER(Return)
+    JIT_HELPER(Yield)
+    JIT_HELPER(Throw)
+    JIT_HELPER(Branch)
+    JIT_HELPER(BranchIf)
+    JIT_HELPER(BranchUnless)
+    JIT_HELPER(BranchLt)
+    JIT_HELPER(BranchGt)
+    JIT_HELPER(BranchLe)
+    JIT_HELPER(BranchGe)
+    JIT_HELPER(BranchEq)
+    JIT_HELPER(BranchNeq)
+    JIT_HELPER(Add)
+    JIT_HELPER(Sub)
+    JIT_HELPER(Mul)
+    JIT_HELPER(Div)
+    JIT_HELPER(Mod)
+    JIT_HELPER(Pow)
+    JIT_HELPER(Eq)
+    JIT_HELPER(Neq)
+    JIT_HELPER(Lt)
+    JIT_HELPER(Gt)
+    JIT_HELPER(Le)
+    JIT_HELPER(Ge)
+    JIT_HELPER(Shr)
+    JIT_HELPER(Shl)
+    JIT_HELPER(And)
+    JIT_HELPER(Or)
+    JIT_HELPER(Xor)
+    JIT_HELPER(UAdd)
+    JIT_HELPER(USub)
+    JIT_HELPER(UNot)
+    JIT_HELPER(UBNot)
+    JIT_HELPER(GCCollect)
+    JIT_HELPER(Typeof)
+    JIT_HELPER(ReadLocalMemberSymbol)
+    JIT_HELPER(PutSelfMemberSymbol)
+    JIT_HELPER(ReadLocalPair)
+    JIT_HELPER(AddNum)
+    JIT_HELPER(SubNum)
+    JIT_HELPER(MulNum)
+    JIT_HELPER(LtNum)
+    JIT_HELPER(GtNum)
+    JIT_HELPER(LeNum)
+    JIT_HELPER(GeNum)
+    JIT_HELPER(BranchLtNum)
+    JIT_HELPER(BranchGtNum)
+    JIT_HELPER(BranchLeNum)
+    JIT_HELPER(BranchGeNum)
+    JIT_HELPER(TailCall)
+    JIT_HELPER(TailCallMember)
+    JIT_HELPER(BranchTable)
+    JIT_HELPER(LoopIncrement)
+    JIT_HELPER(ReadGlobal)
+    JIT_HELPER(SetGlobalPush)
+    JIT_HELPER(SetGlobal)
+    JIT_HELPER(ReadGlobalMemberSymbol)
+#undef JIT_HELPER
+    return table;
+  }();
+
+  return helpers.data();
+}
+
+bool VM::enter_compiled_code(bool count) {
+  bool entered = false;
+  while (!this->halted) {
+    void* code = this->jit.lookup(this->ip);
+
+    // Count the call or loop iteration towards the hotness of the function executing in the current frame
+    if (code == nullptr && count && this->frames && charly_is_function(this->frames->caller_value)) {
+      Function* function = charly_as_function(this->frames->caller_value);
+      if (this->jit.record_execution(function->body_address)) {
+        this->compile_function(function);
+        code = this->jit.lookup(this->ip);
+      }
+    }
+
+    if (code == nullptr) {
+      break;
+    }
+
+    this->jit.execute(this, code);
+    entered = true;
+
+    // Compiled code returns once execution continues outside of it, most often because it
+    // called another function. Arriving at the entry of a function counts as a call
+    count = this->frames && charly_is_function(this->frames->caller_value) &&
+            charly_as_function(this->frames->caller_value)->body_address == this->ip;
+  }
+
+  return entered;
+}
+
+void VM::compile_function(Function* function) {
+  VALUE symbol = function->anonymous() ? kNull : function->name;
+  std::string name = this->context.symtable(symbol).value_or("<anonymous>");
+  auto position = this->context.compiler_manager.address_mapping.resolve_position(function->body_address);
+  if (position.has_value()) {
+    auto& [path, source_position] = position.value();
+    name += " (" + path + ":" + std::to_string(source_position.line) + ")";
+  }
+
+  if (this->jit.compile(function->body_address, name) && this->context.trace_jit) {
+    const CompiledFunction& compiled = this->jit.compiled_functions().back();
+    this->context.err_stream << "Compiled " << compiled.name << ": " << compiled.instruction_count
+                             << " instructions, " << compiled.code_size << " bytes" << '\n';
+  }
+}
+
+// Charly = {
+//   internals: {
+//     get_method: <Internals::get_method>
+//   }
+// }
+//
+// The Charly value is the first top level constant
+static constexpr auto kPreludeBootstrap = StaticAssembler::assemble(
+    StaticAssembler::instruction<Opcode::PutCFunction>(StaticAssembler::SymbolOperand{"get_method"},
+                                                       StaticAssembler::NativeOperand{0},
+                                                       1u),
+    StaticAssembler::instruction<Opcode::PutValue>(StaticAssembler::SymbolOperand{"get_method"}),
+    StaticAssembler::instruction<Opcode::PutHash>(1u),
+    StaticAssembler::instruction<Opcode::PutValue>(StaticAssembler::SymbolOperand{"internals"}),
+    StaticAssembler::instruction<Opcode::PutHash>(1u),
+    StaticAssembler::instruction<Opcode::SetLocal>(0u, 0u),
+    StaticAssembler::instruction<Opcode::Halt>());
+
+void VM::exec_prelude() {
+  static const void* const natives[] = {reinterpret_cast<void*>(Internals::get_method)};
+
+  // Linked once per process and shared by all VMs, the code is never written to
+  static const uint8_t* bootstrap = kPreludeBootstrap.link(natives);
+  kPreludeBootstrap.register_symbols(this->context.symtable);
+
+  this->top_frame =
+      this->create_frame(kNull, this->frames, Compilation::kKnownTopLevelConstants.size(), nullptr);
+
+  uint8_t* old_ip = this->ip;
+  this->ip = const_cast<uint8_t*>(bootstrap);
+  this->run();
+  this->ip = old_ip;
+}
+
+uint8_t VM::start_runtime() {
+  this->starttime = std::chrono::high_resolution_clock::now();
+  this->next_metrics_dump = std::chrono::steady_clock::now() + std::chrono::milliseconds(this->context.metrics_interval);
+
+  // Worker results are moved into this queue before they are handled
+  std::queue<AsyncTaskResult> results;
+
+  // Readiness events of sockets reported by the event loop
+  std::vector<EventLoop::Event> socket_events;
+
+  while (this->running) {
+    Timestamp now = std::chrono::steady_clock::now();
+
+    // Idle programs don't allocate, so they write requested heap snapshots in between tasks
+    if (this->gc.heap_snapshot_requested()) {
+      this->gc.write_requested_heap_snapshot();
+    }
+
+    // Add all expired timers and intervals to the task_queue
+    if (this->timers.size()) {
+      std::vector<VMTask> expired;
+      std::vector<Timestamp> deadlines;
+      this->timers.advance(now, expired, &deadlines);
+      for (size_t i = 0; i < expired.size(); i++) {
+        VMTask task = expired[i];
+        task.deadline = deadlines[i];
+        this->register_task(task);
       }
+      this->event_loop_metrics.timers_fired += expired.size();
+    }
+
+    // Poll open sockets without blocking, their callbacks are added to the task queue
+    if (this->sockets.size()) {
+      this->event_loop.wait(std::chrono::milliseconds(0), socket_events);
+      Internals::Net::handle_events(*this, socket_events);
+    }
+
+    // Messages of other isolates are added to the task queue
+    if (this->isolates.size()) {
+      Internals::Isolate::handle_messages(*this);
     }
 
     // Add all worker thread results to the task queue
+    //
+    // The whole queue is taken at once, so worker threads only contend for
+    // the lock while it is being swapped
     {
       std::unique_lock<std::mutex> lk(this->worker_result_queue_m);
-      while (this->worker_result_queue.size()) {
-        AsyncTaskResult result = this->worker_result_queue.front();
-        this->worker_result_queue.pop();
-        this->register_task(VMTask(result.cb, result.result));
+      results.swap(this->worker_result_queue);
+    }
+
+    while (results.size()) {
+      AsyncTaskResult result = std::move(results.front());
+      results.pop();
+
+      const AsyncTask& task = result.task;
+      if (task.type == AsyncTaskType::echo) {
+        this->register_task(VMTask(task.cb, task.arguments[0]));
+      } else {
+        this->register_task(VMTask(task.cb, Internals::FS::result_value(*this, result)));
+      }
+
+      this->gc.unmark_persistent(task.cb);
+      for (VALUE item : task.arguments) {
+        this->gc.unmark_persistent(item);
       }
     }
 
@@ -3512,72 +5309,101 @@ uint8_t VM::start_runtime() {
       VMTask task = this->task_queue.front();
       this->task_queue.pop();
 
+      Timestamp started_at = std::chrono::steady_clock::now();
+      this->event_loop_metrics.tasks_executed++;
+      this->event_loop_metrics.task_queue_wait.record(started_at - task.queued_at);
+      if (task.deadline != Timestamp()) {
+        this->event_loop_metrics.timer_lateness.record(started_at - task.deadline);
+      }
+
       // Make sure we got a callable type as callback
       if (!charly_is_function(task.fn)) {
         this->panic(Status::RuntimeTaskNotCallable);
       }
 
-      this->gc.mark_persistent(task.fn);
-      this->gc.mark_persistent(task.argument);
+      lalloc.mark_in_gc(task.fn);
+      lalloc.mark_in_gc(task.argument);
 
-      // 0 is the index of the Charly object in the top frame
+      // Anonymous functions keep the self value of the frame they were created in,
+      // everything else is called with the Charly object at index 0 of the top frame
       Function* fn = charly_as_function(task.fn);
-      this->call_function(fn, 1, &task.argument, this->top_frame->read_local(0), true);
+      VALUE self = this->top_frame->read_local(0);
+      if (fn->bound_self_set) {
+        self = fn->bound_self;
+      } else if (fn->anonymous() && fn->context) {
+        self = fn->context->self;
+      }
+
+      this->gc.start_task();
+      this->call_function(fn, 1, &task.argument, self, true);
       this->run();
-      this->pop_stack();
+      this->pop_result();
+    } else if (this->gc.is_marking()) {
 
-      this->gc.unmark_persistent(task.fn);
-      this->gc.unmark_persistent(task.argument);
-    } else {
+      // Use the idle time to advance an ongoing collection
+      this->gc.do_mark_step();
+    } else if (this->gc.is_sweeping()) {
+
+      // Sweep heaps left over from the last collection
+      this->gc.do_sweep_step();
+    } else if (!this->can_exit_runtime()) {
 
-      // Wait for the next result from the worker result queue
+      // Block until a worker thread finishes a task, a socket becomes ready, another isolate
+      // sends a message or the next timer expires
       //
-      // We calculate the wait timeout based on the next timers and / or intervals
-      // This is so we don't stall the thread unneccesarily
-      now = std::chrono::steady_clock::now();
-      auto timer_wait = std::chrono::milliseconds(10 * 1000);
-      auto interval_wait = std::chrono::milliseconds(10 * 1000);
-
-      // Check the next timers and intervals
-      if (this->timers.size())
-        timer_wait = std::chrono::duration_cast<std::chrono::milliseconds>(this->timers.begin()->first - now);
-      if (this->intervals.size())
-        interval_wait = std::chrono::duration_cast<std::chrono::milliseconds>(this->intervals.begin()->first - now);
-
-      // Wait for the result queue
-      std::unique_lock<std::mutex> lk(this->worker_result_queue_m);
-      this->worker_result_queue_cv.wait_for(lk, std::min(timer_wait, interval_wait));
+      // Nothing was executed during this iteration, so the timestamp taken at
+      // its start is still accurate enough to calculate the timeout
+      this->flush_output();
+      auto timeout = this->timers.time_until_next(now, std::chrono::milliseconds(10 * 1000));
+      if (this->context.metrics_interval) {
+        timeout = std::min(timeout, std::chrono::ceil<std::chrono::milliseconds>(this->next_metrics_dump - now));
+        timeout = std::max(timeout, std::chrono::milliseconds(0));
+      }
+      this->event_loop.wait(timeout, socket_events);
+      this->event_loop_metrics.idle_time +=
+          std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - now).count();
+      Internals::Net::handle_events(*this, socket_events);
     }
 
-    // Check if we can exit the runtime
-    if (this->task_queue.size() == 0 && this->timers.size() == 0 && this->intervals.size() == 0 &&
-        this->worker_task_queue.size() == 0 && this->worker_result_queue.size() == 0) {
+    if (this->context.metrics_interval && now >= this->next_metrics_dump) {
+      this->write_runtime_metrics(*this->context.metrics_stream);
+      this->next_metrics_dump = now + std::chrono::milliseconds(this->context.metrics_interval);
+    }
 
-      // Check if there is at least one worker thread executing a task
-      auto it_begin = this->worker_threads.begin();
-      auto it_end = this->worker_threads.end();
-      if (std::find_if(it_begin, it_end, [](WorkerThread* wt) {
-        return wt->currently_executing_task;
-        }) == it_end) {
-        this->running = false;
-      }
+    if (this->can_exit_runtime()) {
+      this->running = false;
     }
   }
 
+  this->flush_output();
   return this->status_code;
 }
 
+bool VM::can_exit_runtime() {
+  if (this->task_queue.size() || this->timers.size() || this->sockets.size() ||
+      Internals::Isolate::keeps_running(*this) || !this->worker_pool.idle()) {
+    return false;
+  }
+
+  // Worker threads push their results before they stop counting as executing,
+  // so the result queue has to be checked after the pool
+  std::unique_lock<std::mutex> lk(this->worker_result_queue_m);
+  return this->worker_result_queue.size() == 0;
+}
+
 VALUE VM::exec_module(Function* fn) {
   ManagedContext lalloc(*this);
   VALUE export_obj = lalloc.create_object(0);
 
   uint8_t* old_ip = this->ip;
   this->call_function(fn, 1, &export_obj, kNull, true);
+  this->gc.write_barrier(this->frames);
   this->frames->parent_environment_frame = this->top_frame;
+  this->frames->build_display();
   this->frames->set_halt_after_return(true);
   this->run();
   this->ip = old_ip;
-  return this->pop_stack();
+  return this->pop_result();
 }
 
 VALUE VM::exec_function(Function* fn, VALUE argument) {
@@ -3585,7 +5411,7 @@ VALUE VM::exec_function(Function* fn, VALUE argument) {
   this->call_function(fn, 1, &argument, kNull, true);
   this->run();
   this->ip = old_ip;
-  return this->pop_stack();
+  return this->pop_result();
 }
 
 void VM::exit(uint8_t status_code) {
@@ -3594,16 +5420,14 @@ void VM::exit(uint8_t status_code) {
   // and interrupt currently running task
   // Stop all the currently running worker threads
   this->timers.clear();
+  Internals::Net::close_all(*this);
+  Internals::Isolate::close_all(*this);
   while (this->task_queue.size()) {
     this->task_queue.pop();
   }
 
-  {
-    std::unique_lock<std::mutex> lk(this->worker_task_queue_m);
-    while (this->worker_task_queue.size()) {
-      this->worker_task_queue.pop();
-    }
-  }
+  // Join all worker threads before clearing the results they might still push
+  this->worker_pool.stop();
 
   {
     std::unique_lock<std::mutex> lk(this->worker_result_queue_m);
@@ -3615,14 +5439,71 @@ void VM::exit(uint8_t status_code) {
   this->halted = true;
   this->running = false;
 
-  // Join all worker threads
-  this->worker_threads_active = false;
-  this->worker_task_queue_cv.notify_all();
-  for (WorkerThread* t : this->worker_threads) {
-    if (t->th.joinable()) t->th.join();
+  this->status_code = status_code;
+}
+
+std::optional<VALUE> VM::find_imported_module(const std::string& path) {
+  auto it = this->imported_modules.find(path);
+  if (it == this->imported_modules.end()) {
+    return std::nullopt;
   }
 
-  this->status_code = status_code;
+  // Modified modules are imported again if the corresponding flag is set
+  if (this->context.reload_changed_modules) {
+    std::error_code error;
+    auto modification_time = std::filesystem::last_write_time(path, error);
+    if (error || modification_time != it->second.modification_time) {
+      return std::nullopt;
+    }
+  }
+
+  return it->second.exports;
+}
+
+void VM::register_imported_module(const std::string& path, VALUE exports) {
+  std::error_code error;
+  auto modification_time = std::filesystem::last_write_time(path, error);
+  this->imported_modules[path] = {exports, modification_time};
+}
+
+void VM::register_lazy_member(Object* object, VALUE symbol, const std::string& path) {
+  object->set_lazy_members(true);
+  this->lazy_members.push_back({charly_create_pointer(object), symbol, path});
+}
+
+std::optional<VALUE> VM::read_lazy_member(Object* object, VALUE symbol) {
+  VALUE target = charly_create_pointer(object);
+  auto it = std::find_if(this->lazy_members.begin(), this->lazy_members.end(), [&](const LazyMember& member) {
+    return member.object == target && member.symbol == symbol;
+  });
+  if (it == this->lazy_members.end()) {
+    return std::nullopt;
+  }
+
+  // The entry is removed before the import so the module can't recursively import itself
+  std::string path = it->path;
+  this->lazy_members.erase(it);
+  object->set_lazy_members(std::any_of(this->lazy_members.begin(), this->lazy_members.end(),
+                                       [&](const LazyMember& member) { return member.object == target; }));
+
+  ManagedContext lalloc(*this);
+  VALUE include = lalloc.create_string(path);
+  VALUE source = lalloc.create_string("");
+
+  uint8_t* original_ip = this->ip;
+  VALUE exports = Internals::import(*this, include, source);
+
+  // Executing the module halted the machine
+  this->halted = false;
+
+  // The import threw an exception
+  if (this->ip != original_ip) {
+    return kNull;
+  }
+
+  // Writing the module onto the object allows future reads to hit the inline caches
+  this->setmembersymbol(target, symbol, exports);
+  return exports;
 }
 
 VALUE VM::register_module(InstructionBlock* block) {
@@ -3630,20 +5511,23 @@ VALUE VM::register_module(InstructionBlock* block) {
   this->ip = block->get_data();
   this->run();
   this->ip = old_ip;
-  return this->pop_stack();
+  return this->pop_result();
 }
 
 void VM::register_task(VMTask task) {
   this->gc.mark_persistent(task.fn);
   this->gc.mark_persistent(task.argument);
+  task.queued_at = std::chrono::steady_clock::now();
   this->task_queue.push(task);
+  this->event_loop_metrics.max_task_queue_depth =
+      std::max(this->event_loop_metrics.max_task_queue_depth, static_cast<uint64_t>(this->task_queue.size()));
 }
 
 uint64_t VM::register_timer(Timestamp ts, VMTask task) {
   this->gc.mark_persistent(task.fn);
   this->gc.mark_persistent(task.argument);
   task.uid = this->get_next_timer_id();
-  this->timers.insert({ts, task});
+  this->timers.insert(task.uid, ts, task);
   return task.uid;
 }
 
@@ -3655,7 +5539,7 @@ uint64_t VM::register_interval(uint32_t period, VMTask task) {
   Timestamp exec_at = now + std::chrono::milliseconds(period);
 
   task.uid = this->get_next_timer_id();
-  this->intervals.insert({exec_at, {task, period}});
+  this->timers.insert(task.uid, exec_at, task, period);
   return task.uid;
 }
 
@@ -3664,85 +5548,74 @@ uint64_t VM::get_next_timer_id() {
 }
 
 void VM::clear_timer(uint64_t uid) {
-  for (auto it : this->timers) {
-    if (it.second.uid == uid) {
-      this->timers.erase(it.first);
-      break;
-    }
+  VMTask task;
+  if (this->timers.remove(uid, false, task)) {
+    this->gc.unmark_persistent(task.fn);
+    this->gc.unmark_persistent(task.argument);
   }
 }
 
 void VM::clear_interval(uint64_t uid) {
-  for (auto it : this->intervals) {
-    if (std::get<0>(it.second).uid == uid) {
-      this->intervals.erase(it.first);
-      break;
-    }
+  VMTask task;
+  if (this->timers.remove(uid, true, task)) {
+    this->gc.unmark_persistent(task.fn);
+    this->gc.unmark_persistent(task.argument);
   }
 }
 
-std::mutex db_mutex;
-
-void VM::worker_thread_handler(void* vm_handle, uint16_t tid) {
-  VM* vm = static_cast<VM*>(vm_handle);
-  WorkerThread* wt = vm->worker_threads[tid];
-
-  while (vm->worker_threads_active) {
-    AsyncTask task;
+uint32_t VM::worker_thread_count(const VMContext& context) {
+  if (context.single_worker_thread) return 1;
+  if (context.worker_threads) return context.worker_threads;
+  return WorkerPool::available_cpus();
+}
 
-    // If there are no tasks available right now, we wait
-    {
-      std::unique_lock<std::mutex> lk(vm->worker_task_queue_m);
-      while (vm->worker_task_queue.size() == 0) {
-        vm->worker_task_queue_cv.wait(lk);
+std::mutex VM::cache_index_mutex;
+uint32_t VM::next_cache_index = 1;
 
-        if (!vm->worker_threads_active) {
-          return;
-        }
-      }
+uint32_t VM::claim_cache_index(uint32_t* operand) {
+  uint32_t index = __atomic_load_n(operand, __ATOMIC_RELAXED);
+  if (index) {
+    return index;
+  }
 
-      wt->currently_executing_task = true;
-      task = vm->worker_task_queue.front();
+  // Another isolate might have claimed an index while we were waiting for the lock
+  std::unique_lock<std::mutex> lk(VM::cache_index_mutex);
+  index = __atomic_load_n(operand, __ATOMIC_RELAXED);
+  if (index == 0) {
+    index = VM::next_cache_index++;
+    __atomic_store_n(operand, index, __ATOMIC_RELAXED);
+  }
 
-      // Mark the task payload as persistent in the gc
-      vm->gc.mark_persistent(task.cb);
-      for (VALUE item : task.arguments) {
-        vm->gc.mark_persistent(item);
-      }
-      vm->worker_task_queue.pop();
-    }
+  return index;
+}
 
-    // Simulate some cpu action
-    //
-    // We can't just sleep because that would pause the thread
-    std::random_device rd;  // Will be used to obtain a seed for the random number engine
-    std::mt19937 gen(rd()); // Standard mersenne_twister_engine seeded with rd()
-    std::uniform_int_distribution<> dis(1, 3);
-    Timestamp work_till = std::chrono::steady_clock::now() + std::chrono::milliseconds(100 * dis(gen));
-    while (std::chrono::steady_clock::now() < work_till) {
-      continue;
+void VM::execute_worker_tasks(std::vector<AsyncTaskResult>& batch) {
+  for (AsyncTaskResult& result : batch) {
+    if (result.task.type != AsyncTaskType::echo) {
+      Internals::FS::perform(result);
     }
+  }
 
-    // Push the result onto the vms result queue
-    {
-      std::unique_lock<std::mutex> lk(vm->worker_result_queue_m);
-      vm->worker_result_queue.push({task.cb, task.arguments[0]});
-      vm->worker_result_queue_cv.notify_one();
-      wt->currently_executing_task = false;
-
-      // Unmark the task payload as persistent in the gc
-      vm->gc.unmark_persistent(task.cb);
-      for (VALUE item : task.arguments) {
-        vm->gc.unmark_persistent(item);
-      }
+  // Push the results onto the vms result queue
+  {
+    std::unique_lock<std::mutex> lk(this->worker_result_queue_m);
+    for (AsyncTaskResult& result : batch) {
+      this->worker_result_queue.push(std::move(result));
     }
   }
+
+  this->event_loop.wake();
 }
 
 void VM::register_worker_task(AsyncTask task) {
-  std::unique_lock<std::mutex> lk(this->worker_task_queue_m);
-  this->worker_task_queue.push(task);
-  this->worker_task_queue_cv.notify_one();
+  // The payload stays alive while a worker thread holds the task, it is released
+  // once the result has been handed to the task queue
+  this->gc.mark_persistent(task.cb);
+  for (VALUE item : task.arguments) {
+    this->gc.mark_persistent(item);
+  }
+
+  this->worker_pool.submit(std::move(task));
 }
 
 }  // namespace Charly
@@ -0,0 +1,162 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+
+#include "worker-pool.h"
+
+namespace Charly {
+
+WorkerPool::WorkerPool(uint32_t max_threads, BatchHandler handler)
+    : handler(handler), max_threads(std::max(max_threads, 1u)) {
+  // Deques are allocated up front, so threads never observe the vector being resized
+  for (uint32_t i = 0; i < this->max_threads; i++) {
+    this->deques.push_back(std::make_unique<WorkerDeque>());
+  }
+}
+
+uint32_t WorkerPool::available_cpus() {
+  uint32_t cpus = std::max(std::thread::hardware_concurrency(), 1u);
+
+  // cgroup v2 stores the quota and period in a single file, the quota is "max" if there is no limit
+  // cgroup v1 uses two separate files and a quota of -1 if there is no limit
+  int64_t quota = -1;
+  int64_t period = 0;
+  std::ifstream cpu_max("/sys/fs/cgroup/cpu.max");
+  std::string quota_string;
+  if (cpu_max >> quota_string >> period) {
+    if (quota_string.compare("max")) {
+      quota = std::strtoll(quota_string.c_str(), nullptr, 10);
+    }
+  } else {
+    std::ifstream quota_file("/sys/fs/cgroup/cpu/cpu.cfs_quota_us");
+    std::ifstream period_file("/sys/fs/cgroup/cpu/cpu.cfs_period_us");
+    if (!(quota_file >> quota && period_file >> period)) {
+      quota = -1;
+    }
+  }
+
+  if (quota > 0 && period > 0) {
+    int64_t quota_cpus = (quota + period - 1) / period;
+    cpus = std::min(cpus, static_cast<uint32_t>(std::max(quota_cpus, static_cast<int64_t>(1))));
+  }
+
+  return cpus;
+}
+
+void WorkerPool::submit(AsyncTask&& task) {
+  task.submitted_at = std::chrono::steady_clock::now();
+  std::unique_lock<std::mutex> lk(this->park_m);
+
+  // Start a new thread if all running threads are busy
+  if (this->parked_threads == 0 && this->threads.size() < this->max_threads) {
+    size_t id = this->threads.size();
+    this->deques[id]->push(std::move(task));
+    this->queued_tasks++;
+    this->threads.emplace_back([this, id]() { this->worker_main(id); });
+    return;
+  }
+
+  this->deques[this->next_deque++ % this->threads.size()]->push(std::move(task));
+  this->queued_tasks++;
+  if (this->parked_threads) {
+    this->park_cv.notify_one();
+  }
+}
+
+void WorkerPool::stop() {
+  {
+    std::unique_lock<std::mutex> lk(this->park_m);
+    this->active = false;
+    this->park_cv.notify_all();
+  }
+
+  for (std::thread& thread : this->threads) {
+    if (thread.joinable()) thread.join();
+  }
+
+  for (auto& deque : this->deques) {
+    std::unique_lock<std::mutex> lk(deque->m);
+    this->queued_tasks -= deque->tasks.size();
+    deque->tasks.clear();
+  }
+}
+
+bool WorkerPool::idle() {
+  // A thread is counted as executing before it takes tasks off a deque,
+  // so a task is always accounted for by at least one of the two counters
+  return this->queued_tasks.load() == 0 && this->executing_threads.load() == 0;
+}
+
+void WorkerPool::worker_main(size_t id) {
+  std::vector<AsyncTaskResult> batch;
+  while (this->take_tasks(id, batch)) {
+    auto start = std::chrono::steady_clock::now();
+    for (const AsyncTaskResult& result : batch) {
+      this->metrics.queue_wait.record(start - result.task.submitted_at);
+    }
+
+    this->handler(batch);
+    this->metrics.tasks_completed.fetch_add(batch.size(), std::memory_order_relaxed);
+    this->metrics.busy_time.fetch_add(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count(),
+        std::memory_order_relaxed);
+    batch.clear();
+    this->executing_threads--;
+  }
+}
+
+bool WorkerPool::take_tasks(size_t id, std::vector<AsyncTaskResult>& batch) {
+  for (;;) {
+    this->executing_threads++;
+    if (!this->active.load()) {
+      this->executing_threads--;
+      return false;
+    }
+
+    size_t taken = this->deques[id]->pop(batch, kBatchSize);
+    for (size_t i = 1; taken == 0 && i < this->deques.size(); i++) {
+      taken = this->deques[(id + i) % this->deques.size()]->steal(batch, kBatchSize);
+    }
+
+    if (taken) {
+      this->queued_tasks -= taken;
+      return true;
+    }
+
+    this->executing_threads--;
+
+    // Park until new tasks are submitted
+    std::unique_lock<std::mutex> lk(this->park_m);
+    this->parked_threads++;
+    this->park_cv.wait(lk, [&]() { return !this->active.load() || this->queued_tasks.load() > 0; });
+    this->parked_threads--;
+  }
+}
+
+}  // namespace Charly
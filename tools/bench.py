@@ -0,0 +1,146 @@
+#!/usr/bin/env python3
+#
+# This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+#
+# MIT License
+#
+# Copyright (c) 2017 - 2019 Leonard Schütz
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+# Runs the benchmark suite and reports the wall clock time of each benchmark
+#
+# Every benchmark is executed in a fresh process after a number of warmup runs.
+# Flags for the vm can be declared inside a benchmark via a "// bench-flags: ..." line.
+# The results are printed as a table and optionally written to a JSON file, which
+# can be compared against the results of another vm version via --compare
+
+import argparse
+import json
+import os
+import platform
+import statistics
+import subprocess
+import sys
+import time
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+
+def bench_flags(path):
+    with open(path) as source:
+        for line in source:
+            if line.startswith("// bench-flags:"):
+                return line[len("// bench-flags:"):].split()
+    return []
+
+
+def run_once(vm, path, flags, env):
+    start = time.perf_counter()
+    # The vm resolves the path of the main file relative to its working directory
+    result = subprocess.run([vm, os.path.relpath(path, ROOT)] + flags,
+                            cwd=ROOT,
+                            env=env,
+                            stdout=subprocess.DEVNULL,
+                            stderr=subprocess.PIPE)
+    elapsed = time.perf_counter() - start
+
+    if result.returncode != 0:
+        sys.stderr.write(result.stderr.decode(errors="replace"))
+        raise RuntimeError("%s exited with status %d" % (path, result.returncode))
+
+    return elapsed
+
+
+def git_revision():
+    try:
+        return subprocess.check_output(["git", "rev-parse", "HEAD"], cwd=ROOT, stderr=subprocess.DEVNULL).decode().strip()
+    except (OSError, subprocess.CalledProcessError):
+        return None
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Runs the charly benchmark suite")
+    parser.add_argument("benchmarks", nargs="*", help="benchmark files, defaults to benchmarks/*.ch")
+    parser.add_argument("--vm", default=os.path.join(ROOT, "bin", "vm"), help="path of the vm binary")
+    parser.add_argument("--runs", type=int, default=5, help="measured runs per benchmark")
+    parser.add_argument("--warmup", type=int, default=1, help="unmeasured runs per benchmark")
+    parser.add_argument("--output", help="write the results to this JSON file")
+    parser.add_argument("--compare", help="JSON results of an earlier run to compare against")
+    args = parser.parse_args()
+
+    paths = [os.path.abspath(path) for path in args.benchmarks]
+    if not paths:
+        directory = os.path.join(ROOT, "benchmarks")
+        paths = sorted(os.path.join(directory, name) for name in os.listdir(directory) if name.endswith(".ch"))
+
+    vm = os.path.abspath(args.vm)
+    env = dict(os.environ)
+    env.setdefault("CHARLYVMDIR", ROOT)
+
+    baseline = {}
+    if args.compare:
+        with open(args.compare) as previous:
+            baseline = {entry["name"]: entry for entry in json.load(previous)["benchmarks"]}
+
+    results = []
+    print("%-28s %10s %10s %10s %10s" % ("benchmark", "median", "stddev", "min", "change"))
+    for path in paths:
+        name = os.path.splitext(os.path.basename(path))[0]
+        flags = bench_flags(path)
+
+        for _ in range(args.warmup):
+            run_once(vm, path, flags, env)
+        samples = [run_once(vm, path, flags, env) for _ in range(args.runs)]
+
+        entry = {
+            "name": name,
+            "flags": flags,
+            "samples": samples,
+            "median": statistics.median(samples),
+            "mean": statistics.mean(samples),
+            "stddev": statistics.stdev(samples) if len(samples) > 1 else 0.0,
+            "min": min(samples),
+            "max": max(samples),
+        }
+        results.append(entry)
+
+        change = ""
+        if name in baseline:
+            change = "%+.1f%%" % ((entry["median"] / baseline[name]["median"] - 1) * 100)
+
+        print("%-28s %9.3fs %9.3fs %9.3fs %10s" % (name, entry["median"], entry["stddev"], entry["min"], change))
+
+    if args.output:
+        report = {
+            "vm": vm,
+            "revision": git_revision(),
+            "platform": platform.platform(),
+            "timestamp": int(time.time()),
+            "runs": args.runs,
+            "warmup": args.warmup,
+            "benchmarks": results,
+        }
+        with open(args.output, "w") as output:
+            json.dump(report, output, indent=2)
+            output.write("\n")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,308 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Companion tool for heap snapshots written by the garbage collector
+//
+// Usage:
+//   heapsnapshot summary <snapshot> [count]   Per-type totals and the cells retaining the most memory
+//   heapsnapshot diff <old> <new> [count]     Per-type growth and the new cells retaining the most memory
+//
+// The retained size of a cell is the amount of memory which would be freed if
+// the cell became unreachable. It is computed from the dominator tree of the heap graph
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace Charly::HeapSnapshot {
+
+struct Cell {
+  std::string address;
+  std::string type;
+  uint64_t size = 0;
+  uint64_t retained_size = 0;
+  std::vector<uint32_t> edges;
+};
+
+struct Snapshot {
+  // Node 0 is a synthetic root referencing all roots of the snapshot
+  std::vector<Cell> cells;
+  std::unordered_map<std::string, uint32_t> ids;
+
+  uint32_t id_of(const std::string& address) {
+    auto it = this->ids.find(address);
+    if (it != this->ids.end()) {
+      return it->second;
+    }
+
+    uint32_t id = this->cells.size();
+    this->cells.emplace_back();
+    this->cells.back().address = address;
+    this->ids.insert({address, id});
+    return id;
+  }
+};
+
+bool load(const std::string& filename, Snapshot& snapshot) {
+  std::ifstream file(filename);
+  if (!file.is_open()) {
+    std::cerr << "Could not open " << filename << '\n';
+    return false;
+  }
+
+  std::string line;
+  if (!std::getline(file, line) || line != "charly-heap-snapshot 1") {
+    std::cerr << filename << " is not a heap snapshot" << '\n';
+    return false;
+  }
+
+  snapshot.cells.emplace_back();
+  snapshot.cells[0].type = "(root)";
+
+  while (std::getline(file, line)) {
+    std::istringstream stream(line);
+    std::string kind;
+    stream >> kind;
+
+    if (kind == "root") {
+      std::string address;
+      stream >> address;
+      uint32_t id = snapshot.id_of(address);
+      snapshot.cells[0].edges.push_back(id);
+    } else if (kind == "cell") {
+      std::string address;
+      std::string type;
+      uint64_t size;
+      stream >> address >> type >> size;
+      uint32_t id = snapshot.id_of(address);
+      snapshot.cells[id].type = type;
+      snapshot.cells[id].size = size;
+
+      std::string edge;
+      while (stream >> edge) {
+        uint32_t child = snapshot.id_of(edge);
+        snapshot.cells[id].edges.push_back(child);
+      }
+    }
+  }
+
+  return true;
+}
+
+// Computes the retained size of every cell using the iterative dominator
+// algorithm by Cooper, Harvey and Kennedy
+void compute_retained_sizes(Snapshot& snapshot) {
+  size_t count = snapshot.cells.size();
+  const uint32_t kUndefined = UINT32_MAX;
+
+  // Number the cells in postorder
+  std::vector<uint32_t> postorder;
+  std::vector<uint32_t> postorder_index(count, kUndefined);
+  std::vector<bool> visited(count, false);
+  std::vector<std::pair<uint32_t, size_t>> stack = {{0, 0}};
+  visited[0] = true;
+  while (stack.size()) {
+    auto& [id, edge] = stack.back();
+    if (edge < snapshot.cells[id].edges.size()) {
+      uint32_t child = snapshot.cells[id].edges[edge++];
+      if (!visited[child]) {
+        visited[child] = true;
+        stack.push_back({child, 0});
+      }
+    } else {
+      postorder_index[id] = postorder.size();
+      postorder.push_back(id);
+      stack.pop_back();
+    }
+  }
+
+  std::vector<std::vector<uint32_t>> predecessors(count);
+  for (uint32_t id : postorder) {
+    for (uint32_t child : snapshot.cells[id].edges) {
+      predecessors[child].push_back(id);
+    }
+  }
+
+  std::vector<uint32_t> idom(count, kUndefined);
+  idom[0] = 0;
+  auto intersect = [&](uint32_t a, uint32_t b) {
+    while (a != b) {
+      while (postorder_index[a] < postorder_index[b])
+        a = idom[a];
+      while (postorder_index[b] < postorder_index[a])
+        b = idom[b];
+    }
+    return a;
+  };
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+
+    // Visit the cells in reverse postorder, skipping the root
+    for (auto it = postorder.rbegin() + 1; it != postorder.rend(); it++) {
+      uint32_t id = *it;
+      uint32_t new_idom = kUndefined;
+      for (uint32_t pred : predecessors[id]) {
+        if (idom[pred] == kUndefined)
+          continue;
+        new_idom = new_idom == kUndefined ? pred : intersect(pred, new_idom);
+      }
+
+      if (idom[id] != new_idom) {
+        idom[id] = new_idom;
+        changed = true;
+      }
+    }
+  }
+
+  // Dominated cells always come before their dominator in postorder
+  for (uint32_t id : postorder) {
+    snapshot.cells[id].retained_size += snapshot.cells[id].size;
+    if (id != 0) {
+      snapshot.cells[idom[id]].retained_size += snapshot.cells[id].retained_size;
+    }
+  }
+}
+
+struct TypeTotals {
+  uint64_t count = 0;
+  uint64_t size = 0;
+};
+
+std::map<std::string, TypeTotals> totals_by_type(const Snapshot& snapshot) {
+  std::map<std::string, TypeTotals> totals;
+  for (size_t id = 1; id < snapshot.cells.size(); id++) {
+    const Cell& cell = snapshot.cells[id];
+    totals[cell.type].count++;
+    totals[cell.type].size += cell.size;
+  }
+  return totals;
+}
+
+void print_largest(const Snapshot& snapshot, std::vector<uint32_t> ids, size_t count) {
+  std::sort(ids.begin(), ids.end(), [&](uint32_t a, uint32_t b) {
+    return snapshot.cells[a].retained_size > snapshot.cells[b].retained_size;
+  });
+  if (ids.size() > count) {
+    ids.resize(count);
+  }
+
+  std::cout << std::left << std::setw(20) << "address" << std::setw(12) << "type" << std::right << std::setw(14)
+            << "size" << std::setw(14) << "retained" << '\n';
+  for (uint32_t id : ids) {
+    const Cell& cell = snapshot.cells[id];
+    std::cout << std::left << std::setw(20) << cell.address << std::setw(12) << cell.type << std::right
+              << std::setw(14) << cell.size << std::setw(14) << cell.retained_size << '\n';
+  }
+}
+
+int summary(const std::string& filename, size_t count) {
+  Snapshot snapshot;
+  if (!load(filename, snapshot)) {
+    return 1;
+  }
+  compute_retained_sizes(snapshot);
+
+  std::cout << std::left << std::setw(12) << "type" << std::right << std::setw(12) << "count" << std::setw(14)
+            << "size" << '\n';
+  for (auto& [type, totals] : totals_by_type(snapshot)) {
+    std::cout << std::left << std::setw(12) << type << std::right << std::setw(12) << totals.count << std::setw(14)
+              << totals.size << '\n';
+  }
+  std::cout << "total retained size: " << snapshot.cells[0].retained_size << '\n' << '\n';
+
+  std::vector<uint32_t> ids;
+  for (uint32_t id = 1; id < snapshot.cells.size(); id++) {
+    ids.push_back(id);
+  }
+  print_largest(snapshot, ids, count);
+  return 0;
+}
+
+int diff(const std::string& old_filename, const std::string& new_filename, size_t count) {
+  Snapshot old_snapshot;
+  Snapshot new_snapshot;
+  if (!load(old_filename, old_snapshot) || !load(new_filename, new_snapshot)) {
+    return 1;
+  }
+  compute_retained_sizes(new_snapshot);
+
+  // Cells are never moved, so cells which survived between two snapshots
+  // of the same process keep their addresses
+  std::map<std::string, TypeTotals> old_totals = totals_by_type(old_snapshot);
+  std::map<std::string, TypeTotals> new_totals = totals_by_type(new_snapshot);
+  for (auto& [type, totals] : old_totals) {
+    new_totals[type];
+  }
+
+  std::cout << std::left << std::setw(12) << "type" << std::right << std::setw(12) << "count +/-" << std::setw(14)
+            << "size +/-" << '\n';
+  for (auto& [type, totals] : new_totals) {
+    int64_t count_delta = totals.count - old_totals[type].count;
+    int64_t size_delta = totals.size - old_totals[type].size;
+    std::cout << std::left << std::setw(12) << type << std::right << std::showpos << std::setw(12) << count_delta
+              << std::setw(14) << size_delta << std::noshowpos << '\n';
+  }
+  std::cout << '\n';
+
+  std::vector<uint32_t> ids;
+  for (uint32_t id = 1; id < new_snapshot.cells.size(); id++) {
+    if (old_snapshot.ids.count(new_snapshot.cells[id].address) == 0) {
+      ids.push_back(id);
+    }
+  }
+  std::cout << ids.size() << " new cells" << '\n';
+  print_largest(new_snapshot, ids, count);
+  return 0;
+}
+
+}  // namespace Charly::HeapSnapshot
+
+int main(int argc, char** argv) {
+  using namespace Charly::HeapSnapshot;
+  std::vector<std::string> args(argv + 1, argv + argc);
+
+  if (args.size() >= 2 && args[0] == "summary") {
+    return summary(args[1], args.size() >= 3 ? std::stoul(args[2]) : 20);
+  }
+
+  if (args.size() >= 3 && args[0] == "diff") {
+    return diff(args[1], args[2], args.size() >= 4 ? std::stoul(args[3]) : 20);
+  }
+
+  std::cerr << "Usage: heapsnapshot summary <snapshot> [count]" << '\n';
+  std::cerr << "       heapsnapshot diff <old> <new> [count]" << '\n';
+  return 1;
+}
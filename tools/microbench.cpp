@@ -0,0 +1,333 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Native microbenchmarks for internal components of the vm
+//
+// Usage:
+//   microbench [--min-time <ms>] [filter...]
+//
+// Each benchmark runs in batches of doubling size until a single batch takes at least
+// the minimum time, the last batch is reported. Only benchmarks whose name contains one
+// of the filters are run.
+//
+// Reported columns:
+//   ns/op      Wall clock time per operation
+//   allocs/op  Calls to the global operator new per operation
+//   cells/op   Cells handed out by the garbage collector per operation
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "charly.h"
+#include "managedcontext.h"
+#include "parser.h"
+#include "sourcefile.h"
+
+static std::atomic<uint64_t> g_allocation_count = 0;
+
+void* operator new(size_t size) {
+  g_allocation_count.fetch_add(1, std::memory_order_relaxed);
+  if (void* ptr = std::malloc(size ? size : 1)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept {
+  std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+  std::free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+  std::free(ptr);
+}
+
+namespace Charly::Microbench {
+
+// Prevents the compiler from removing computations whose result is never used
+template <typename T>
+inline void keep(T&& value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+struct Result {
+  uint64_t iterations = 0;
+  double ns_per_op = 0;
+  double allocs_per_op = 0;
+  double cells_per_op = 0;
+};
+
+class Runner {
+public:
+  Runner(VM& t_vm, std::chrono::nanoseconds t_min_time, std::vector<std::string> t_filters)
+      : vm(t_vm), min_time(t_min_time), filters(t_filters) {
+  }
+
+  template <typename Fn>
+  void run(const std::string& name, Fn&& fn) {
+    if (!this->is_selected(name))
+      return;
+
+    Result result;
+    for (uint64_t iterations = 1;; iterations *= 2) {
+      uint64_t allocations_before = g_allocation_count.load(std::memory_order_relaxed);
+      uint64_t cells_before = this->vm.gc_stats().allocated_cells;
+      auto start = std::chrono::steady_clock::now();
+
+      for (uint64_t i = 0; i < iterations; i++) {
+        fn(i);
+      }
+
+      auto elapsed = std::chrono::steady_clock::now() - start;
+      uint64_t allocations = g_allocation_count.load(std::memory_order_relaxed) - allocations_before;
+      uint64_t cells = this->vm.gc_stats().allocated_cells - cells_before;
+
+      if (elapsed >= this->min_time || iterations >= (1ull << 40)) {
+        double count = static_cast<double>(iterations);
+        result.iterations = iterations;
+        result.ns_per_op = std::chrono::duration<double, std::nano>(elapsed).count() / count;
+        result.allocs_per_op = allocations / count;
+        result.cells_per_op = cells / count;
+        break;
+      }
+    }
+
+    std::cout << std::left << std::setw(36) << name << std::right;
+    std::cout << std::setw(12) << result.iterations;
+    std::cout << std::fixed << std::setprecision(1) << std::setw(14) << result.ns_per_op;
+    std::cout << std::setprecision(2) << std::setw(12) << result.allocs_per_op;
+    std::cout << std::setw(12) << result.cells_per_op << '\n';
+  }
+
+  void print_header() {
+    std::cout << std::left << std::setw(36) << "benchmark" << std::right;
+    std::cout << std::setw(12) << "iterations";
+    std::cout << std::setw(14) << "ns/op";
+    std::cout << std::setw(12) << "allocs/op";
+    std::cout << std::setw(12) << "cells/op" << '\n';
+  }
+
+private:
+  bool is_selected(const std::string& name) {
+    if (this->filters.size() == 0)
+      return true;
+
+    for (const std::string& filter : this->filters) {
+      if (name.find(filter) != std::string::npos)
+        return true;
+    }
+
+    return false;
+  }
+
+  VM& vm;
+  std::chrono::nanoseconds min_time;
+  std::vector<std::string> filters;
+};
+
+// Synthetic source exercising most token types and syntax constructs
+std::string generate_source(uint32_t functions) {
+  std::string source;
+  for (uint32_t i = 0; i < functions; i++) {
+    std::string n = std::to_string(i);
+    source += "// Function number " + n + "\n";
+    source += "func f" + n + "(a, b) {\n";
+    source += "  const values = [1, 2.5, 0x1f, \"text\", null, true]\n";
+    source += "  let result = { name: \"f" + n + "\", count: a + b * 2 }\n";
+    source += "  if (a > b && b <= 10) {\n";
+    source += "    result.count += values.length\n";
+    source += "  } else {\n";
+    source += "    result.count = values.map(->(v) v).length\n";
+    source += "  }\n";
+    source += "  try {\n";
+    source += "    throw result\n";
+    source += "  } catch (e) {\n";
+    source += "    return e.count\n";
+    source += "  }\n";
+    source += "}\n\n";
+  }
+  return source;
+}
+
+void run_gc_benchmarks(Runner& runner, VM& vm) {
+  runner.run("gc.allocate.object", [&](uint64_t) { keep(vm.create_object(4)); });
+  runner.run("gc.allocate.array", [&](uint64_t) { keep(vm.create_array(8)); });
+  runner.run("gc.allocate.string", [&](uint64_t) { keep(vm.create_string("hello world", 11)); });
+
+  // Full collections with a live set of 10000 objects
+  ManagedContext ctx(vm);
+  for (uint32_t i = 0; i < 10000; i++) {
+    ctx.create_object(4);
+  }
+  runner.run("gc.collect.10k-live", [&](uint64_t) { vm.collect_garbage(); });
+}
+
+void run_symboltable_benchmarks(Runner& runner, SymbolTable& symtable) {
+  std::vector<std::string> names;
+  for (uint32_t i = 0; i < 256; i++) {
+    names.push_back("symbol_name_" + std::to_string(i));
+    symtable.encode_string(names.back());
+  }
+
+  runner.run("symboltable.encode_string", [&](uint64_t i) { keep(symtable.encode_string(names[i & 255])); });
+}
+
+void run_compiler_benchmarks(Runner& runner) {
+  std::string source = generate_source(100);
+
+  runner.run("lexer.tokenize.100-functions", [&](uint64_t) {
+    SourceFile file("microbench.ch", source);
+    Compilation::Lexer lexer(file);
+    lexer.tokenize();
+    keep(lexer.tokens.size());
+  });
+
+  runner.run("parser.parse.100-functions", [&](uint64_t) {
+    SourceFile file("microbench.ch", source);
+    Compilation::Parser parser(file);
+    Compilation::ParserResult result = parser.parse();
+    if (result.abstract_syntax_tree.has_value()) {
+      delete result.abstract_syntax_tree.value();
+    }
+  });
+}
+
+void run_vm_benchmarks(Runner& runner, VM& vm, SymbolTable& symtable) {
+  VALUE int_left = charly_create_integer(25);
+  VALUE int_right = charly_create_integer(17);
+  runner.run("vm.add.int", [&](uint64_t) { keep(vm.add(int_left, int_right)); });
+
+  VALUE float_left = charly_create_double(2.5);
+  VALUE float_right = charly_create_double(0.25);
+  runner.run("vm.add.float", [&](uint64_t) { keep(vm.add(float_left, float_right)); });
+
+  ManagedContext ctx(vm);
+  VALUE string_left = ctx.create_string("hello ");
+  VALUE string_right = ctx.create_string("world");
+  runner.run("vm.add.string", [&](uint64_t) { keep(vm.add(string_left, string_right)); });
+
+  // Object with 16 properties, the symbol looked up is the last one that was added
+  VALUE object = ctx.create_object(16);
+  for (uint32_t i = 0; i < 16; i++) {
+    vm.setmembersymbol(object, symtable("field_" + std::to_string(i)), charly_create_integer(i));
+  }
+  VALUE symbol = symtable("field_15");
+  runner.run("vm.readmembersymbol.object", [&](uint64_t) { keep(vm.readmembersymbol(object, symbol)); });
+
+  InlineCache cache;
+  runner.run("vm.readmembersymbol.object-cached",
+             [&](uint64_t) { keep(vm.readmembersymbol(object, symbol, &cache)); });
+
+  VALUE array = ctx.create_array(4);
+  VALUE length = symtable("length");
+  runner.run("vm.readmembersymbol.array-length", [&](uint64_t) { keep(vm.readmembersymbol(array, length)); });
+}
+
+void run_utf8buffer_benchmarks(Runner& runner) {
+  std::string ascii(4096, 'a');
+  std::string mixed;
+  while (mixed.size() < 4096) {
+    mixed += "abc äöü € 𝄞 ";
+  }
+
+  runner.run("utf8buffer.write_string.4k", [&](uint64_t) {
+    UTF8Buffer buffer;
+    buffer.write_string(ascii);
+    keep(buffer.get_writeoffset());
+  });
+
+  runner.run("utf8buffer.append_utf8.1k", [&](uint64_t) {
+    UTF8Buffer buffer;
+    for (uint32_t cp = 0; cp < 1024; cp++) {
+      buffer.append_utf8(0x20 + cp);
+    }
+    keep(buffer.get_writeoffset());
+  });
+
+  UTF8Buffer ascii_buffer;
+  ascii_buffer.write_string(ascii);
+  runner.run("utf8buffer.codepointcount.ascii-4k", [&](uint64_t) { keep(ascii_buffer.codepointcount()); });
+
+  UTF8Buffer mixed_buffer;
+  mixed_buffer.write_string(mixed);
+  runner.run("utf8buffer.codepointcount.mixed-4k", [&](uint64_t) { keep(mixed_buffer.codepointcount()); });
+}
+
+int run(int argc, char** argv, char** envp) {
+  std::chrono::nanoseconds min_time = std::chrono::milliseconds(200);
+  std::vector<std::string> filters;
+  for (int i = 1; i < argc; i++) {
+    std::string argument(argv[i]);
+    if (argument == "--min-time" && i + 1 < argc) {
+      min_time = std::chrono::milliseconds(std::atoi(argv[++i]));
+    } else {
+      filters.push_back(argument);
+    }
+  }
+
+  // The vm is only used as a host for the benchmarked components, no code is executed
+  char program_name[] = "microbench";
+  char* vm_argv[] = {program_name, nullptr};
+  RunFlags flags(1, vm_argv, envp);
+  Compilation::CompilerManager cmanager(flags);
+  VMContext context({.symtable = cmanager.symtable,
+                     .stringpool = cmanager.stringpool,
+                     .compiler_manager = cmanager,
+                     .single_worker_thread = true});
+  VM vm(context);
+
+  Runner runner(vm, min_time, filters);
+  runner.print_header();
+  run_gc_benchmarks(runner, vm);
+  run_symboltable_benchmarks(runner, cmanager.symtable);
+  run_compiler_benchmarks(runner);
+  run_vm_benchmarks(runner, vm, cmanager.symtable);
+  run_utf8buffer_benchmarks(runner);
+
+  return 0;
+}
+}  // namespace Charly::Microbench
+
+int main(int argc, char** argv, char** envp) {
+  return Charly::Microbench::run(argc, argv, envp);
+}
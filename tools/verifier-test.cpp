@@ -0,0 +1,356 @@
+/*
+ * This file is part of the Charly Virtual Machine (https://github.com/KCreate/charly-vm)
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 - 2019 Leonard Schütz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Tests for the bytecode verifier
+//
+// Usage:
+//   verifier-test [path...]
+//
+// Checks that handcrafted malformed blocks are rejected with the expected reason, then compiles
+// every .ch file below the given paths and verifies the resulting blocks again, including the
+// declared stack depths which are only checked when modules are loaded from the cache.
+// Exits with a non-zero status if any check failed.
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "assembler.h"
+#include "charly.h"
+#include "verifier.h"
+
+namespace Charly::VerifierTest {
+using namespace Compilation;
+
+struct Testcase {
+  std::string name;
+  std::function<void(Assembler&)> build;
+
+  // Substring of the expected error, empty if the block is valid
+  std::string expected_error;
+};
+
+// Function with a single local, returning it if it is truthy and null otherwise
+static void write_function(Assembler& assembler) {
+  Label body = assembler.reserve_label();
+  Label otherwise = assembler.reserve_label();
+  assembler.write_putfunction_to_label(charly_create_symbol("test"), body, true, false, 1, 1);
+  assembler.write_pop();
+  assembler.write_halt();
+  assembler.place_label(body);
+  assembler.write_readlocal(0, 0);
+  assembler.write_branchunless_to_label(otherwise);
+  assembler.write_readlocal(0, 0);
+  assembler.write_return();
+  assembler.place_label(otherwise);
+  assembler.write_putvalue(kNull);
+  assembler.write_return();
+}
+
+static const std::vector<Testcase> kTestcases = {
+  {"accepts straight line code",
+   [](Assembler& assembler) {
+     assembler.write_putvalue(kNull);
+     assembler.write_pop();
+     assembler.write_halt();
+   },
+   ""},
+  {"accepts functions with branches", write_function, ""},
+  {"accepts exception handlers",
+   [](Assembler& assembler) {
+     assembler.write_putvalue(kNull);
+     assembler.write_throw();
+     uint32_t handler = assembler.get_writeoffset();
+     assembler.write_pop();
+     assembler.write_halt();
+     assembler.exception_table.push_back({0, handler, handler});
+   },
+   ""},
+  {"rejects unknown opcodes",
+   [](Assembler& assembler) {
+     assembler.write_operator(0xff);
+   },
+   "unknown opcode"},
+  {"rejects truncated instructions",
+   [](Assembler& assembler) {
+     assembler.write_operator(static_cast<uint8_t>(Opcode::PutValue));
+   },
+   "instruction exceeds the end of the block"},
+  {"rejects branches past the end of the block",
+   [](Assembler& assembler) {
+     assembler.write_branch(1000);
+   },
+   "invalid branch target"},
+  {"rejects branches before the start of the block",
+   [](Assembler& assembler) {
+     assembler.write_nop();
+     assembler.write_branch(-100);
+   },
+   "invalid branch target"},
+  {"rejects branches into the middle of an instruction",
+   [](Assembler& assembler) {
+     assembler.write_putvalue(kNull);
+     assembler.write_branch(-4);
+   },
+   "invalid branch target"},
+  {"rejects conditional branches to invalid targets",
+   [](Assembler& assembler) {
+     assembler.write_putvalue(kTrue);
+     assembler.write_branchif(3);
+     assembler.write_halt();
+   },
+   "invalid branch target"},
+  {"rejects functions whose body is outside of the block",
+   [](Assembler& assembler) {
+     assembler.write_putfunction(charly_create_symbol("test"), 1000, true, false, 0, 0, 1);
+     assembler.write_halt();
+   },
+   "invalid function body"},
+  {"rejects exception handlers outside of the block",
+   [](Assembler& assembler) {
+     assembler.write_halt();
+     assembler.exception_table.push_back({0, 1, 1000});
+   },
+   "invalid exception table entry"},
+  {"rejects execution running past the end of the block",
+   [](Assembler& assembler) {
+     assembler.write_putvalue(kNull);
+     assembler.write_pop();
+   },
+   "execution runs past the end of the block"},
+  {"rejects stack underflows",
+   [](Assembler& assembler) {
+     assembler.write_pop();
+     assembler.write_halt();
+   },
+   "stack underflow"},
+  {"rejects calls with more arguments than values on the stack",
+   [](Assembler& assembler) {
+     assembler.write_putvalue(kNull);
+     assembler.write_call(2);
+     assembler.write_halt();
+   },
+   "stack underflow"},
+  {"rejects joins with different stack depths",
+   [](Assembler& assembler) {
+     Label join = assembler.reserve_label();
+     assembler.write_putvalue(kTrue);
+     assembler.write_branchif_to_label(join);
+     assembler.write_putvalue(kNull);
+     assembler.place_label(join);
+     assembler.write_halt();
+     assembler.resolve_unresolved_label_references();
+   },
+   "inconsistent stack depth"},
+  {"rejects loops which grow the stack",
+   [](Assembler& assembler) {
+     Label loop = assembler.place_label();
+     assembler.write_putvalue(kNull);
+     assembler.write_branch_to_label(loop);
+     assembler.resolve_unresolved_label_references();
+   },
+   "inconsistent stack depth"},
+  {"rejects functions returning with an unbalanced stack",
+   [](Assembler& assembler) {
+     Label body = assembler.reserve_label();
+     assembler.write_putfunction_to_label(charly_create_symbol("test"), body, true, false, 0, 0);
+     assembler.write_pop();
+     assembler.write_halt();
+     assembler.place_label(body);
+     assembler.write_putvalue(kNull);
+     assembler.write_putvalue(kNull);
+     assembler.write_return();
+     assembler.resolve_unresolved_label_references();
+   },
+   "function returns with an unbalanced stack"},
+  {"rejects returns outside of a function",
+   [](Assembler& assembler) {
+     assembler.write_putvalue(kNull);
+     assembler.write_return();
+   },
+   "return outside of a function"},
+  {"rejects yields outside of a generator",
+   [](Assembler& assembler) {
+     assembler.write_putvalue(kNull);
+     assembler.write_yield();
+     assembler.write_halt();
+   },
+   "yield outside of a generator"},
+  {"rejects locals outside of a frame",
+   [](Assembler& assembler) {
+     assembler.write_readlocal(0, 0);
+     assembler.write_halt();
+   },
+   "local variable out of bounds"},
+  {"rejects locals out of bounds",
+   [](Assembler& assembler) {
+     Label body = assembler.reserve_label();
+     assembler.write_putfunction_to_label(charly_create_symbol("test"), body, true, false, 0, 1);
+     assembler.write_pop();
+     assembler.write_halt();
+     assembler.place_label(body);
+     assembler.write_readlocal(1, 0);
+     assembler.write_return();
+     assembler.resolve_unresolved_label_references();
+   },
+   "local variable out of bounds"},
+  {"rejects native function pointers",
+   [](Assembler& assembler) {
+     assembler.write_putcfunction(charly_create_symbol("test"), 0, 0);
+     assembler.write_pop();
+     assembler.write_halt();
+   },
+   "native function pointer"},
+};
+
+static bool run_testcase(const Testcase& testcase) {
+  Assembler assembler;
+  testcase.build(assembler);
+  assembler.resolve_unresolved_label_references();
+
+  // Blocks are verified like the code generator does, before the stack depths are known
+  Verifier verifier(assembler);
+  std::optional<std::string> error = verifier.verify(false);
+
+  bool passed;
+  if (testcase.expected_error.size()) {
+    passed = error.has_value() && error->find(testcase.expected_error) != std::string::npos;
+  } else {
+    passed = !error.has_value();
+  }
+
+  if (passed) {
+    std::cout << "ok    " << testcase.name << '\n';
+  } else {
+    std::cout << "FAIL  " << testcase.name << ": " << error.value_or("block was accepted") << '\n';
+  }
+
+  return passed;
+}
+
+// Declared stack depths are checked once they have been written into the block
+static bool run_stack_depth_testcases() {
+  bool passed = true;
+
+  {
+    Assembler assembler;
+    write_function(assembler);
+    assembler.resolve_unresolved_label_references();
+    Verifier verifier(assembler);
+    verifier.verify(false);
+    assembler.write_stack_depths(verifier.stack_depths);
+
+    std::optional<std::string> error = Verifier(assembler).verify();
+    std::cout << (error ? "FAIL  " : "ok    ") << "accepts declared stack depths covering the body"
+              << (error ? ": " + error.value() : "") << '\n';
+    passed &= !error.has_value();
+  }
+
+  {
+    Assembler assembler;
+    write_function(assembler);
+    assembler.resolve_unresolved_label_references();
+
+    std::optional<std::string> error = Verifier(assembler).verify();
+    bool rejected = error && error->find("declared stack depth is too small for the body") != std::string::npos;
+    std::cout << (rejected ? "ok    " : "FAIL  ") << "rejects declared stack depths smaller than the body"
+              << (rejected ? "" : ": " + error.value_or("block was accepted")) << '\n';
+    passed &= rejected;
+  }
+
+  return passed;
+}
+
+// Output of the compiler has to pass the checks done for blocks loaded from the module cache
+static bool verify_compiler_output(CompilerManager& cmanager, const std::string& path) {
+  std::ifstream file(path);
+  std::stringstream source;
+  source << file.rdbuf();
+
+  std::optional<CompilerResult> result = cmanager.compile(path, source.str());
+  if (!result.has_value() || !result->instructionblock.has_value()) {
+    std::cout << "FAIL  " << path << ": could not be compiled" << '\n';
+    return false;
+  }
+
+  std::optional<std::string> error = Verifier(*result->instructionblock.value()).verify();
+  if (error) {
+    std::cout << "FAIL  " << path << ": " << error.value() << '\n';
+    return false;
+  }
+
+  return true;
+}
+
+int run(int argc, char** argv, char** envp) {
+  char program_name[] = "verifier-test";
+  char no_module_cache[] = "-fno_module_cache";
+  char no_parallel_compile[] = "-fno_parallel_compile";
+  char* vm_argv[] = {program_name, no_module_cache, no_parallel_compile, nullptr};
+  RunFlags flags(3, vm_argv, envp);
+  CompilerManager cmanager(flags);
+
+  size_t failures = 0;
+  for (const Testcase& testcase : kTestcases) {
+    failures += !run_testcase(testcase);
+  }
+  failures += !run_stack_depth_testcases();
+
+  std::vector<std::string> paths;
+  for (int i = 1; i < argc; i++) {
+    std::filesystem::path root(argv[i]);
+    if (std::filesystem::is_directory(root)) {
+      for (const auto& entry : std::filesystem::recursive_directory_iterator(root)) {
+        if (entry.is_regular_file() && entry.path().extension() == ".ch") {
+          paths.push_back(entry.path().string());
+        }
+      }
+    } else {
+      paths.push_back(root.string());
+    }
+  }
+
+  std::sort(paths.begin(), paths.end());
+  size_t compiler_failures = 0;
+  for (const std::string& path : paths) {
+    compiler_failures += !verify_compiler_output(cmanager, path);
+  }
+  std::cout << (compiler_failures ? "FAIL  " : "ok    ") << "accepts the output of the compiler for " << paths.size()
+            << " files" << '\n';
+  failures += compiler_failures;
+
+  return failures ? 1 : 0;
+}
+}  // namespace Charly::VerifierTest
+
+int main(int argc, char** argv, char** envp) {
+  return Charly::VerifierTest::run(argc, argv, envp);
+}